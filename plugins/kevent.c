@@ -0,0 +1,152 @@
+/* In-process keventd, sys/pwr/ac condition from power_supply uevents
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "finit.h"
+#include "cond.h"
+#include "helpers.h"
+#include "plugin.h"
+#include "pwr.h"
+
+#define KEVENT_BUFSZ 8192
+
+static char *kev_buf;
+
+static void kevent_cond(void)
+{
+	int online = pwr_online();
+
+	logit(LOG_INFO, "AC %s", online ? "connected" : "disconnected");
+	if (online)
+		cond_set_oneshot("sys/pwr/ac");
+	else
+		cond_clear("sys/pwr/ac");
+}
+
+static void kevent_cb(void *arg, int sd, int events)
+{
+	ssize_t len;
+
+	while ((len = recv(sd, kev_buf, KEVENT_BUFSZ - 1, 0)) != 0) {
+		if (len < 0) {
+			switch (errno) {
+			case EINTR:
+				continue;
+
+			case ENOBUFS:	/* netlink(7) */
+				warnx("lost uevents, rescanning power supplies.");
+				if (pwr_scan())
+					kevent_cond();
+				continue;
+
+			case EAGAIN:
+				break;
+
+			default:
+				err(1, "recv()");
+				break;
+			}
+
+			return;
+		}
+
+		kev_buf[len] = 0;
+		if (!strstr(kev_buf, "power_supply"))
+			continue;
+
+		dbg("%s", kev_buf);
+		if (pwr_uevent(kev_buf, len))
+			kevent_cond();
+	}
+}
+
+/*
+ * Conditions are available from here, the socket has been open since
+ * plugin_init() so no uevents are lost between the scan and the first
+ * callback.
+ */
+static void kevent_scan(void *arg)
+{
+	pwr_scan();
+	kevent_cond();
+}
+
+static plugin_t plugin = {
+	.name = __FILE__,
+	.hook[HOOK_SVC_PLUGIN] = { .cb = kevent_scan },
+	.io = {
+		.cb    = kevent_cb,
+		.flags = PLUGIN_IO_READ,
+	},
+};
+
+PLUGIN_INIT(plugin_init)
+{
+	struct sockaddr_nl sa;
+	int sd;
+
+	sd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (sd < 0) {
+		err(1, "socket()");
+		return;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = 1;	/* kernel uevents only, not libudev */
+
+	if (bind(sd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		err(1, "bind()");
+		close(sd);
+		return;
+	}
+
+	kev_buf = malloc(KEVENT_BUFSZ);
+	if (!kev_buf) {
+		err(1, "malloc()");
+		close(sd);
+		return;
+	}
+
+	plugin.io.fd = sd;
+	plugin_register(&plugin);
+}
+
+PLUGIN_EXIT(plugin_exit)
+{
+	plugin_unregister(&plugin);
+	close(plugin.io.fd);
+	free(kev_buf);
+	pwr_exit();
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -51,38 +51,103 @@
 #include "util.h"
 #include "plugin.h"
 
+#define MODPROBE_BATCH    64	/* aliases per modprobe -a */
+#define MODPROBE_WORKERS  4	/* max parallel modprobe, <= online CPUs */
+#define ALIAS_BUCKETS     256
+
 struct module {
 	TAILQ_ENTRY(module) link;
+	TAILQ_ENTRY(module) hash;	/* for alias_exist() */
 	char *alias;
 };
 
 static TAILQ_HEAD(, module) modules  = TAILQ_HEAD_INITIALIZER(modules);
+static TAILQ_HEAD(, module) aliases[ALIAS_BUCKETS];
+static int num_aliases;
 
-static int modprobe(char *alias)
+static pid_t modprobe(char **alias, int num)
 {
-	char *args[] = {
-		"modprobe",
-		"-abq",
-		alias,
-		NULL,
-	};
+	char *args[MODPROBE_BATCH + 3];
 	pid_t pid;
+	int i;
+
+	args[0] = "modprobe";
+	args[1] = "-abq";
+	for (i = 0; i < num; i++)
+		args[i + 2] = alias[i];
+	args[i + 2] = NULL;
 
 	pid = fork();
 	switch (pid) {
 	case -1:
 		err(1, "Failed forking modprobe child");
-		return 1;
+		return -1;
 	case 0:
 		execvp(args[0], args);
-		break;
+		_exit(EX_OSERR);
 	default:
-		if (!complete(args[0], pid))
-			dbg("Successful modprobe of %s", alias);
+		dbg("Started modprobe of %d aliases, PID %d", num, pid);
 		break;
 	}
 
-	return 0;
+	return pid;
+}
+
+static int workers(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus < 1)
+		return 1;
+	if (cpus > MODPROBE_WORKERS)
+		return MODPROBE_WORKERS;
+
+	return (int)cpus;
+}
+
+/*
+ * Load all aliases in batches of MODPROBE_BATCH, instead of one fork
+ * per alias, with a few batches running in parallel.  modprobe -a
+ * handles dependencies and already loaded modules in each batch.
+ * Returns the number of batches that could not be started or waited for.
+ */
+static int modprobe_all(void)
+{
+	char *batch[MODPROBE_BATCH];
+	pid_t pid[MODPROBE_WORKERS];
+	int max = workers();
+	int head = 0, num = 0;
+	struct module *m;
+	int rc = 0;
+	int n = 0;
+
+	dbg("Loading %d aliases, %d per batch, %d workers", num_aliases, MODPROBE_BATCH, max);
+	m = TAILQ_FIRST(&modules);
+	while (m || num) {
+		/*
+		 * Wait for the oldest batch when all workers are busy, or at
+		 * the end.  Like before, the exit status is ignored, aliases
+		 * without a module are not an error.
+		 */
+		if (num == max || (!m && num)) {
+			if (complete("modprobe", pid[head]) == -1)
+				rc++;
+			head = (head + 1) % max;
+			num--;
+			continue;
+		}
+
+		for (n = 0; m && n < MODPROBE_BATCH; m = TAILQ_NEXT(m, link))
+			batch[n++] = m->alias;
+
+		pid[(head + num) % max] = modprobe(batch, n);
+		if (pid[(head + num) % max] == -1)
+			rc++;
+		else
+			num++;
+	}
+
+	return rc;
 }
 
 static void alias_add(char *alias)
@@ -99,11 +164,15 @@ static void alias_add(char *alias)
 	}
 
 	TAILQ_INSERT_TAIL(&modules, m, link);
+	TAILQ_INSERT_TAIL(&aliases[strhash(STRHASH_INIT, alias) % ALIAS_BUCKETS], m, hash);
+	num_aliases++;
 }
 
 static void alias_remove(struct module *m)
 {
 	TAILQ_REMOVE(&modules, m, link);
+	TAILQ_REMOVE(&aliases[strhash(STRHASH_INIT, m->alias) % ALIAS_BUCKETS], m, hash);
+	num_aliases--;
 	free(m->alias);
 	free(m);
 }
@@ -112,7 +181,7 @@ static int alias_exist(char *alias)
 {
 	struct module *m;
 
-	TAILQ_FOREACH(m, &modules, link) {
+	TAILQ_FOREACH(m, &aliases[strhash(STRHASH_INIT, alias) % ALIAS_BUCKETS], hash) {
 		if (!strcmp(m->alias, alias))
 			return 1;
 	}
@@ -216,12 +285,11 @@ static void coldplug(void *arg)
 
 	print_desc("Cold plugging system", NULL);
 	rc = nftw("/sys/devices", scan_alias, 200, FTW_DEPTH | FTW_PHYS);
-	if (!rc) {
-		TAILQ_FOREACH_SAFE(m, &modules, link, tmp) {
-			rc += modprobe(m->alias);
-			alias_remove(m);
-		}
-	}
+	if (!rc)
+		rc = modprobe_all();
+
+	TAILQ_FOREACH_SAFE(m, &modules, link, tmp)
+		alias_remove(m);
 
 	print_result(rc);
 }
@@ -234,6 +302,11 @@ static plugin_t plugin = {
 
 PLUGIN_INIT(plugin_init)
 {
+	int i;
+
+	for (i = 0; i < ALIAS_BUCKETS; i++)
+		TAILQ_INIT(&aliases[i]);
+
 	plugin_register(&plugin);
 }
 
@@ -27,10 +27,14 @@
  * Each module is loaded when entering runlevel 2, 3, 4, or 5, using the
  * modprobe tool.
  *
- * Loading is done by inserting a `task` stanza in Finit, ensuring all
- * modules are loaded in parallel, with other modules and programs.
- * Each `task` stanza is by default given the name:modprobe.module and
- * indexed with `:ID`, starting with 1.
+ * Modules from all files are collected first, and modules that are
+ * already loaded, e.g. by the modprobe plugin's coldplug, or listed in
+ * more than one file, are skipped.  Modules without arguments are then
+ * loaded in batches, `modprobe -a`, by a few `task` stanzas running in
+ * parallel, with other modules and programs.  Modules with arguments
+ * get a task each, by default named name:modprobe.module and indexed
+ * with `:ID`, starting with 1.  Batches are named modprobe.batch, a
+ * batch with only one module keeps the name of the module.
  *
  * Indexing can be disabled per file in /etc/modules-load.d/, anywwhere
  * in a file, by putting the keyword `noindex` on a line of its own.  A
@@ -39,6 +43,9 @@
  * `noindex` is read indexing is disabled and all subseequent tasks will
  * not have any `:ID` at all.
  *
+ * The modules of a file with `set ordered` are loaded in the order they
+ * are listed, each task waits for the previous one to succeed.
+ *
  * Please note, the :ID is there for your benefit, it ensures that tasks
  * in Finit are unique.  If you have two tasks with the same name and ID
  * (or no ID), the last one read replaces any preceeding one!
@@ -63,15 +70,125 @@
 #define MODULES_LOAD_PATH "/etc/modules-load.d"
 #endif
 #define MODPROBE_PATH     "/sbin/modprobe"
+#define MODULES_BATCH     32	/* max modules per modprobe -a */
 #define SERVICE_LINE \
-	"cgroup.init name:modprobe.%s :%d [%s] %s %s %s --"
+	"cgroup.init name:modprobe.%s :%d [%s] %s %s %s %s --"
 #define SERVICE_LINE_NOINDEX \
-	"cgroup.init name:modprobe.%s [%s] %s %s %s --"
+	"cgroup.init name:modprobe.%s [%s] %s %s %s %s --"
+
+struct kmod {
+	TAILQ_ENTRY(kmod) link;
+	char *name;
+	char *args;		/* empty if none */
+	char *lvl;
+	char *modprobe;
+	int   index;		/* 0: noindex */
+	int   ordered;		/* from a file with set ordered */
+	int   file;		/* file number, for ordered chains */
+};
+
+static TAILQ_HEAD(, kmod) kmods = TAILQ_HEAD_INITIALIZER(kmods);
+
+/* Batch of modules for one modprobe -a task */
+struct batch {
+	struct kmod *mod[MODULES_BATCH];
+	int          num;
+	size_t       len;	/* length of module names, incl. spaces */
+};
+
+/* Module names in /proc/modules use '_', modprobe accepts both */
+static int kmod_match(const char *a, const char *b)
+{
+	for (; *a && *b; a++, b++) {
+		if (*a == *b || ((*a == '-' || *a == '_') && (*b == '-' || *b == '_')))
+			continue;
+		return 0;
+	}
+
+	return *a == *b;
+}
+
+static int kmod_loaded(const char *name)
+{
+	char line[256];
+	int found = 0;
+	FILE *fp;
+
+	fp = fopen("/proc/modules", "r");
+	if (!fp)
+		return 0;
+
+	while (!found && fgets(line, sizeof(line), fp)) {
+		char *ptr = strchr(line, ' ');
+
+		if (ptr)
+			*ptr = 0;
+		found = kmod_match(line, name);
+	}
+	fclose(fp);
+
+	return found;
+}
+
+static int kmod_listed(const char *name)
+{
+	struct kmod *km;
+
+	TAILQ_FOREACH(km, &kmods, link) {
+		if (kmod_match(km->name, name))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void kmod_free(struct kmod *km)
+{
+	free(km->name);
+	free(km->args);
+	free(km->lvl);
+	free(km->modprobe);
+	free(km);
+}
+
+static int kmod_add(char *mod, char *args, char *lvl, char *modprobe, int index, int ordered, int file)
+{
+	struct kmod *km;
+
+	if (kmod_listed(mod)) {
+		dbg("%s already listed, skipping.", mod);
+		return 0;
+	}
+	if (kmod_loaded(mod)) {
+		dbg("%s already loaded, skipping.", mod);
+		return 0;
+	}
+
+	km = calloc(1, sizeof(*km));
+	if (!km)
+		return -1;
+
+	km->name     = strdup(mod);
+	km->args     = strdup(args ?: "");
+	km->lvl      = strdup(lvl);
+	km->modprobe = strdup(modprobe);
+	if (!km->name || !km->args || !km->lvl || !km->modprobe) {
+		kmod_free(km);
+		return -1;
+	}
+	km->index   = index;
+	km->ordered = ordered;
+	km->file    = file;
+	TAILQ_INSERT_TAIL(&kmods, km, link);
+
+	return 1;
+}
 
-static int modules_load(const char *file, int index)
+static int modules_load(const char *file, int index, int fno)
 {
 	char module_path[PATH_MAX];
 	char *modprobe_path;
+	int ordered = 0;
 	int num = 0;
 	char *line;
 	char *lvl;
@@ -101,7 +218,8 @@ static int modules_load(const char *file, int index)
 	}
 
 	while ((line = fparseln(fp, NULL, NULL, NULL, 0))) {
-		char cmd[CMD_SIZE], *mod, *args, *set;
+		char *mod, *args, *set;
+		int rc;
 
 		/*
 		 * fparseln() skips regular UNIX comments only.
@@ -125,6 +243,12 @@ static int modules_load(const char *file, int index)
 				goto next;
 			}
 
+			if (!strcmp(set, "ordered")) {
+				ordered = 1;
+				free(set);
+				goto next;
+			}
+
 			if ((val = fgetval(set, "index", "= \t"))) {
 				index = atoi(val);
 				free(set);
@@ -162,14 +286,12 @@ static int modules_load(const char *file, int index)
 		if (!mod)
 			goto next;
 
-		if (!index)
-			snprintf(cmd, sizeof(cmd), SERVICE_LINE_NOINDEX, mod, lvl, modprobe_path, mod, args);
-		else
-			snprintf(cmd, sizeof(cmd), SERVICE_LINE, mod, index++, lvl, modprobe_path, mod, args);
-
-		dbg("task %s", cmd);
-		service_register(SVC_TYPE_TASK, cmd, global_rlimit, NULL);
-		num++;
+		rc = kmod_add(mod, args, lvl, modprobe_path, index, ordered, fno);
+		if (rc < 0)
+			warnx("failed allocating memory for module %s", mod);
+		else if (rc > 0 && index)
+			index++;
+		num += rc > 0;
 	next:
 		free(line);
 	}
@@ -181,6 +303,131 @@ skip:
 	return num;
 }
 
+/*
+ * Register one task for the modules in a batch.  The cond is the task
+ * to wait for, in ordered files, or empty.  If next is set, it gets the
+ * condition for the next task in an ordered chain.
+ */
+static void batch_task(struct batch *b, const char *cond, char *next, size_t len)
+{
+	struct kmod *km = b->mod[0];
+	char cmd[CMD_SIZE], mods[CMD_SIZE] = "";
+	static int batchno = 1;
+	char *name, *flag;
+	int i, id;
+
+	if (!b->num)
+		return;
+
+	if (b->num == 1) {
+		name = km->name;
+		flag = "";
+		id   = km->index;
+		strlcpy(mods, km->name, sizeof(mods));
+		if (km->args[0]) {
+			strlcat(mods, " ", sizeof(mods));
+			strlcat(mods, km->args, sizeof(mods));
+		}
+	} else {
+		name = "batch";
+		flag = "-a";
+		id   = batchno++;
+		for (i = 0; i < b->num; i++) {
+			if (i)
+				strlcat(mods, " ", sizeof(mods));
+			strlcat(mods, b->mod[i]->name, sizeof(mods));
+		}
+	}
+
+	if (!id)
+		snprintf(cmd, sizeof(cmd), SERVICE_LINE_NOINDEX, name, km->lvl, cond, km->modprobe, flag, mods);
+	else
+		snprintf(cmd, sizeof(cmd), SERVICE_LINE, name, id, km->lvl, cond, km->modprobe, flag, mods);
+
+	dbg("task %s", cmd);
+	service_register(SVC_TYPE_TASK, cmd, global_rlimit, NULL);
+
+	if (next) {
+		if (id)
+			snprintf(next, len, "<task/modprobe.%s:%d/success>", name, id);
+		else
+			snprintf(next, len, "<task/modprobe.%s/success>", name);
+	}
+
+	b->num = 0;
+	b->len = 0;
+}
+
+/* Can km be added to batch b, same runlevels and modprobe, and room */
+static int batch_fits(struct batch *b, struct kmod *km)
+{
+	struct kmod *first = b->mod[0];
+
+	if (!b->num)
+		return 1;
+	if (b->num == MODULES_BATCH || b->len + strlen(km->name) + 1 > CMD_SIZE / 2)
+		return 0;
+
+	return !strcmp(first->lvl, km->lvl) && !strcmp(first->modprobe, km->modprobe) &&
+		first->ordered == km->ordered && first->file == km->file;
+}
+
+static void batch_add(struct batch *b, struct kmod *km)
+{
+	b->mod[b->num++] = km;
+	b->len += strlen(km->name) + 1;
+}
+
+/*
+ * Register tasks for all collected modules.  Modules with arguments
+ * get a task of their own, modprobe -a does not take arguments.  For
+ * ordered files, batches of consecutive modules are chained.
+ */
+static void modules_register(void)
+{
+	char cond[MAX_COND_LEN] = "";
+	struct batch chain = { 0 };
+	struct batch b = { 0 };
+	struct kmod *km, *tmp;
+	int file = -1;
+
+	TAILQ_FOREACH(km, &kmods, link) {
+		if (!km->ordered) {
+			if (km->args[0]) {
+				struct batch one = { .mod = { km }, .num = 1 };
+
+				batch_task(&one, "", NULL, 0);
+				continue;
+			}
+
+			if (!batch_fits(&b, km))
+				batch_task(&b, "", NULL, 0);
+			batch_add(&b, km);
+			continue;
+		}
+
+		/* New ordered file, start a new chain */
+		if (km->file != file) {
+			batch_task(&chain, cond, cond, sizeof(cond));
+			cond[0] = 0;
+			file = km->file;
+		}
+
+		if (km->args[0] || !batch_fits(&chain, km))
+			batch_task(&chain, cond, cond, sizeof(cond));
+		batch_add(&chain, km);
+		if (km->args[0])
+			batch_task(&chain, cond, cond, sizeof(cond));
+	}
+	batch_task(&chain, cond, NULL, 0);
+	batch_task(&b, "", NULL, 0);
+
+	TAILQ_FOREACH_SAFE(km, &kmods, link, tmp) {
+		TAILQ_REMOVE(&kmods, km, link);
+		kmod_free(km);
+	}
+}
+
 /* XXX: check here for .conf only? */
 static int module_filter(const struct dirent *d)
 {
@@ -204,11 +451,13 @@ static void load(void *arg)
 	num = scandir(MODULES_LOAD_PATH, &dentry, module_filter, alphasort);
 	if (num > 0) {
 		for (i = 0; i < num; i++) {
-			index += modules_load(dentry[i]->d_name, index);
+			index += modules_load(dentry[i]->d_name, index, i);
 			free(dentry[i]);
 		}
 		free(dentry);
 	}
+
+	modules_register();
 }
 
 static plugin_t plugin = {
@@ -34,6 +34,17 @@
 #include "service.h"
 
 #define  NL_BUFSZ	4096
+#define  NL_RCVBUF	(4 * 1024 * 1024)
+#define  NL_BUCKETS	64
+#define  NL_IFF_EXIST	(1u << 31)	/* Not an IFF_* flag, only ours */
+#define  NL_IFF_MASK	(NL_IFF_EXIST | IFF_UP | IFF_RUNNING)
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK	270
+#endif
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12	/* Linux 4.20 */
+#endif
 
 struct nl_request {
 	struct nlmsghdr nh;
@@ -43,20 +54,224 @@ struct nl_request {
 	};
 };
 
-static int   nl_defidx;
-static int   nl_ifdown;
+/*
+ * Last known state of each interface, used to only touch net/IFNAME/
+ * conditions on actual edges, and to know the name of an interface
+ * when it is removed or renamed.
+ */
+struct nl_iface {
+	TAILQ_ENTRY(nl_iface) link;
+	int           index;
+	unsigned int  flags;		/* NL_IFF_MASK */
+	unsigned int  gen;		/* Last resync it was seen in */
+	char          name[IFNAMSIZ + 1];
+};
+
+/*
+ * Main table default routes we know of.  The kernel does not send any
+ * RTM_DELROUTE when an interface goes down, so we prune by ifindex.
+ */
+struct nl_defroute {
+	TAILQ_ENTRY(nl_defroute) link;
+	int           index;
+	int           gw;
+	unsigned int  metric;
+};
+
+static TAILQ_HEAD(, nl_iface)    nl_ifaces[NL_BUCKETS];
+static TAILQ_HEAD(, nl_defroute) nl_defroutes = TAILQ_HEAD_INITIALIZER(nl_defroutes);
+
+static unsigned int nl_gen;
+static int   nl_hasdef;
 static char *nl_buf;
 
 
+static void net_cond_set(char *ifname, char *cond, int set)
+{
+	char msg[MAX_ARG_LEN];
+
+	snprintf(msg, sizeof(msg), "net/%s/%s", ifname, cond);
+	if (set)
+		cond_set(msg);
+	else
+		cond_clear(msg);
+}
+
+/* Only set or clear net/route/default when we gain our first, or lose our last */
+static void nl_defroute_update(void)
+{
+	int has = !TAILQ_EMPTY(&nl_defroutes);
+
+	if (has == nl_hasdef)
+		return;
+
+	nl_hasdef = has;
+	if (has)
+		cond_set("net/route/default");
+	else
+		cond_clear("net/route/default");
+}
+
+static struct nl_defroute *nl_defroute_find(int index, int gw, unsigned int metric)
+{
+	struct nl_defroute *dr;
+
+	TAILQ_FOREACH(dr, &nl_defroutes, link) {
+		if (dr->index == index && dr->gw == gw && dr->metric == metric)
+			return dr;
+	}
+
+	return NULL;
+}
+
+/* Forget default routes via index, or all if index is zero */
+static void nl_defroute_flush(int index)
+{
+	struct nl_defroute *dr, *tmp;
+
+	TAILQ_FOREACH_SAFE(dr, &nl_defroutes, link, tmp) {
+		if (index && dr->index != index)
+			continue;
+
+		TAILQ_REMOVE(&nl_defroutes, dr, link);
+		free(dr);
+	}
+}
+
+static void nl_defroute_add(int index, int gw, unsigned int metric)
+{
+	struct nl_defroute *dr;
+
+	if (nl_defroute_find(index, gw, metric))
+		return;
+
+	dr = malloc(sizeof(*dr));
+	if (!dr) {
+		err(1, "Failed allocating default route");
+		return;
+	}
+
+	dr->index  = index;
+	dr->gw     = gw;
+	dr->metric = metric;
+	TAILQ_INSERT_TAIL(&nl_defroutes, dr, link);
+}
+
+static void nl_defroute_del(int index, int gw, unsigned int metric)
+{
+	struct nl_defroute *dr;
+
+	dr = nl_defroute_find(index, gw, metric);
+	if (!dr)
+		return;
+
+	TAILQ_REMOVE(&nl_defroutes, dr, link);
+	free(dr);
+}
+
+static struct nl_iface *nl_iface_find(int index)
+{
+	struct nl_iface *ifp;
+
+	TAILQ_FOREACH(ifp, &nl_ifaces[(unsigned int)index % NL_BUCKETS], link) {
+		if (ifp->index == index)
+			return ifp;
+	}
+
+	return NULL;
+}
+
+/* Update conditions for the flags that changed since last time */
+static void nl_iface_cond(struct nl_iface *ifp, unsigned int flags)
+{
+	unsigned int changed = ifp->flags ^ flags;
+
+	if (changed & NL_IFF_EXIST)
+		net_cond_set(ifp->name, "exist",   flags & NL_IFF_EXIST);
+	if (changed & IFF_UP)
+		net_cond_set(ifp->name, "up",      flags & IFF_UP);
+	if (changed & IFF_RUNNING)
+		net_cond_set(ifp->name, "running", flags & IFF_RUNNING);
+
+	ifp->flags = flags;
+}
+
+static void nl_iface_set(int index, char *ifname, unsigned int flags)
+{
+	struct nl_iface *ifp;
+
+	ifp = nl_iface_find(index);
+	if (!ifp) {
+		ifp = calloc(1, sizeof(*ifp));
+		if (!ifp) {
+			err(1, "Failed allocating interface %s", ifname);
+			return;
+		}
+
+		ifp->index = index;
+		strlcpy(ifp->name, ifname, sizeof(ifp->name));
+		TAILQ_INSERT_TAIL(&nl_ifaces[(unsigned int)index % NL_BUCKETS], ifp, link);
+	} else if (strcmp(ifp->name, ifname)) {
+		dbg("%s: renamed to %s", ifp->name, ifname);
+		nl_iface_cond(ifp, 0);
+		strlcpy(ifp->name, ifname, sizeof(ifp->name));
+	}
+
+	ifp->gen = nl_gen;
+	nl_iface_cond(ifp, flags & NL_IFF_MASK);
+
+	/*
+	 * Linux doesn't send route changes when interfaces go down, so
+	 * we need to check ourselves, e.g. for loss of default route.
+	 */
+	if (!(flags & IFF_UP)) {
+		nl_defroute_flush(index);
+		nl_defroute_update();
+	}
+}
+
+static void nl_iface_drop(struct nl_iface *ifp)
+{
+	nl_iface_cond(ifp, 0);
+	nl_defroute_flush(ifp->index);
+	nl_defroute_update();
+
+	TAILQ_REMOVE(&nl_ifaces[(unsigned int)ifp->index % NL_BUCKETS], ifp, link);
+	free(ifp);
+}
+
+static void nl_iface_del(int index)
+{
+	struct nl_iface *ifp;
+
+	ifp = nl_iface_find(index);
+	if (ifp)
+		nl_iface_drop(ifp);
+}
+
+/* Drop interfaces not seen in the latest resync, they are gone */
+static void nl_iface_sweep(void)
+{
+	struct nl_iface *ifp, *tmp;
+	int i;
+
+	for (i = 0; i < NL_BUCKETS; i++) {
+		TAILQ_FOREACH_SAFE(ifp, &nl_ifaces[i], link, tmp) {
+			if (ifp->gen != nl_gen)
+				nl_iface_drop(ifp);
+		}
+	}
+}
+
+
 static void nl_route(struct nlmsghdr *nlmsg, ssize_t len)
 {
-	char daddr[INET_ADDRSTRLEN];
 	char gaddr[INET_ADDRSTRLEN];
-	struct in_addr ind, ing;
+	unsigned int metric = 0;
+	struct in_addr ing;
 	struct rtmsg *r;
 	struct rtattr *a;
-	int plen = 0;
-	int dst = 0;
+	int table;
 	int idx = 0;
 	int gw = 0;
 	int la;
@@ -74,56 +289,51 @@ static void nl_route(struct nlmsghdr *nlmsg, ssize_t len)
 		return;
 	}
 
+	/*
+	 * Bail out early on anything but a default route, on a router
+	 * with a full table this is called for every single route.
+	 */
+	if (r->rtm_dst_len != 0)
+		return;
+
+	table = r->rtm_table;
 	while (RTA_OK(a, la)) {
 		void *data = RTA_DATA(a);
 
 		switch (a->rta_type) {
 		case RTA_GATEWAY:
 			gw = *((int *)data);
-			//dbg("GW: 0x%04x", gw);
-			break;
-
-		case RTA_DST:
-			dst = *((int *)data);
-			plen = r->rtm_dst_len;
-			//dbg("Prefix LEN: 0x%04x", plen);
 			break;
 
 		case RTA_OIF:
 			idx = *((int *)data);
-			//dbg("IDX: 0x%04x", idx);
+			break;
+
+		case RTA_PRIORITY:
+			metric = *((unsigned int *)data);
+			break;
+
+		case RTA_TABLE:
+			table = *((int *)data);
 			break;
 		}
 
 		a = RTA_NEXT(a, la);
 	}
 
-	ind.s_addr = dst;
+	if (table != RT_TABLE_MAIN || (!gw && !idx))
+		return;
+
 	ing.s_addr = gw;
-	inet_ntop(AF_INET, &ind, daddr, sizeof(daddr));
 	inet_ntop(AF_INET, &ing, gaddr, sizeof(gaddr));
-	dbg("Got gw %s dst/len %s/%d ifindex %d", gaddr, daddr, plen, idx);
-
-	if ((!dst && !plen) && (gw || idx)) {
-		if (nlmsg->nlmsg_type == RTM_DELROUTE) {
-			cond_clear("net/route/default");
-			nl_defidx = 0;
-		} else {
-			cond_set("net/route/default");
-			nl_defidx = idx;
-		}
-	}
-}
+	dbg("%s default gw %s ifindex %d metric %u",
+	    nlmsg->nlmsg_type == RTM_DELROUTE ? "Del" : "New", gaddr, idx, metric);
 
-static void net_cond_set(char *ifname, char *cond, int set)
-{
-	char msg[MAX_ARG_LEN];
-
-	snprintf(msg, sizeof(msg), "net/%s/%s", ifname, cond);
-	if (set)
-		cond_set(msg);
+	if (nlmsg->nlmsg_type == RTM_DELROUTE)
+		nl_defroute_del(idx, gw, metric);
 	else
-		cond_clear(msg);
+		nl_defroute_add(idx, gw, metric);
+	nl_defroute_update();
 }
 
 static int validate_ifname(const char *ifname)
@@ -146,19 +356,6 @@ static int validate_ifname(const char *ifname)
 	return 0;
 }
 
-/*
- * Check if this interface was associated with the default route
- * previously, or if it's been removed.  If so, trigger a recheck
- * of the system default route.
- */
-static void nl_check_default(char *ifname)
-{
-	int idx = (int)if_nametoindex(ifname);
-
-	if ((nl_defidx > 0 && nl_defidx == idx) || (idx == 0 && errno == ENODEV))
-		nl_ifdown = 1;
-}
-
 static void nl_link(struct nlmsghdr *nlmsg, ssize_t len)
 {
 	char ifname[IFNAMSIZ + 1];
@@ -196,20 +393,13 @@ static void nl_link(struct nlmsghdr *nlmsg, ssize_t len)
 			 * Check ifi_flags here to see if the interface is UP/DOWN
 			 */
 			dbg("%s: New link, flags 0x%x, change 0x%x", ifname, i->ifi_flags, i->ifi_change);
-			net_cond_set(ifname, "exist",   1);
-			net_cond_set(ifname, "up",      i->ifi_flags & IFF_UP);
-			net_cond_set(ifname, "running", i->ifi_flags & IFF_RUNNING);
-			if (!(i->ifi_flags & IFF_UP) || !(i->ifi_flags & IFF_RUNNING))
-				nl_check_default(ifname);
+			nl_iface_set(i->ifi_index, ifname, NL_IFF_EXIST | i->ifi_flags);
 			break;
 
 		case RTM_DELLINK:
 			/* NOTE: Interface has disappeared, not link down ... */
 			dbg("%s: Delete link", ifname);
-			net_cond_set(ifname, "exist",   0);
-			net_cond_set(ifname, "up",      0);
-			net_cond_set(ifname, "running", 0);
-			nl_check_default(ifname);
+			nl_iface_del(i->ifi_index);
 			break;
 
 		case RTM_NEWADDR:
@@ -305,15 +495,17 @@ static int nl_request(int sd, unsigned int seq, int type)
 	switch (type) {
 	case RTM_GETROUTE:
 //		dbg("RTM_GETROUTE");
+		/* Only honored by the kernel with NETLINK_GET_STRICT_CHK */
 		nlr->rtm.rtm_family = AF_INET;
 		nlr->rtm.rtm_table  = RT_TABLE_MAIN;
+		nlr->rtm.rtm_type   = RTN_UNICAST;
 		nlr->nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
 		break;
 
 	case RTM_GETLINK:
 //		dbg("RTM_GETLINK");
 		nlr->ifi.ifi_family = AF_UNSPEC;
-		nlr->ifi.ifi_change = 0xFFFFFFFF;
+		/* strict dumps require ifi_change (and flags) to be zero */
 		nlr->nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ifinfomsg));
 		break;
 
@@ -342,10 +534,15 @@ static void nl_resync_ifaces(int sd, unsigned int seq)
 
 /*
  * We've potentially lost netlink events, let's resync with kernel.
+ * Conditions are only touched for interfaces and routes that changed
+ * while we were not looking.  With strict checking the kernel filters
+ * the route dump for us, we still check for default routes ourselves,
+ * because prefix length filtering is not supported for IPv4 dumps.
  */
-static void nl_resync(int all)
+static void nl_resync(void)
 {
 	unsigned int seq = 0;
+	int on = 1;
 	int sd;
 
 	sd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
@@ -354,19 +551,19 @@ static void nl_resync(int all)
 		return;
 	}
 
-	if (all) {
-		dbg("============================ RESYNC =================================");
-		/* this doesn't update conditions, and thus does not stop services */
-		cond_deassert("net/");
+	if (setsockopt(sd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &on, sizeof(on)))
+		dbg("No strict netlink checking, unfiltered route dump.");
 
-		nl_resync_ifaces(sd, seq++);
-		nl_resync_routes(sd, seq++);
+	dbg("============================ RESYNC =================================");
+	nl_gen++;
+	nl_resync_ifaces(sd, seq++);
+	nl_iface_sweep();
 
-		/* delayed update after we've corrected things */
-		service_step_all(SVC_TYPE_ANY);
-		dbg("=========================== RESYNCED ================================");
-	} else
-		nl_resync_routes(sd, seq++);
+	/* relearn default routes, net/route/default only changes on edges */
+	nl_defroute_flush(0);
+	nl_resync_routes(sd, seq++);
+	nl_defroute_update();
+	dbg("=========================== RESYNCED ================================");
 
 	close(sd);
 }
@@ -376,28 +573,9 @@ static void nl_callback(void *arg, int sd, int events)
 	if (nl_parse(sd) < 0) {
 		if (errno == ENOBUFS) {	/* netlink(7) */
 			warnx("busy system, resynchronizing with kernel.");
-			nl_resync(1);
-			return;
+			nl_resync();
 		}
 	}
-
-	/*
-	 * Linux doesn't send route changes when interfaces go down, so
-	 * we need to check ourselves, e.g. for loss of default route.
-	 */
-	if (nl_ifdown) {
-		dbg("interface down, checking default route.");
-		if (nl_defidx > 0) {
-			nl_defidx = 0;
-			nl_resync(0);
-			if (nl_defidx <= 0) {
-				cond_clear("net/route/default");
-				nl_defidx = 0;
-			}
-		}
-
-		nl_ifdown = 0;
-	}
 }
 
 static void nl_reconf(void *arg)
@@ -417,7 +595,8 @@ static plugin_t plugin = {
 PLUGIN_INIT(plugin_init)
 {
 	struct sockaddr_nl sa;
-	int sd;
+	int val = NL_RCVBUF;
+	int sd, i;
 
 	sd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
 	if (sd < 0) {
@@ -425,6 +604,11 @@ PLUGIN_INIT(plugin_init)
 		return;
 	}
 
+	/* Absorb bursts, e.g. route flaps, without falling back to resync */
+	if (setsockopt(sd, SOL_SOCKET, SO_RCVBUFFORCE, &val, sizeof(val)) &&
+	    setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)))
+		warn("Failed setting netlink receive buffer size");
+
 	memset(&sa, 0, sizeof(sa));
 	sa.nl_family = AF_NETLINK;
 	sa.nl_groups = RTMGRP_IPV4_ROUTE | RTMGRP_LINK;
@@ -443,6 +627,9 @@ PLUGIN_INIT(plugin_init)
 		return;
 	}
 
+	for (i = 0; i < NL_BUCKETS; i++)
+		TAILQ_INIT(&nl_ifaces[i]);
+
 	plugin.io.fd = sd;
 	plugin_register(&plugin);
 }
@@ -35,7 +35,9 @@
 #include "service.h"
 #include "iwatch.h"
 
-static struct iwatch iw_pidfile;
+static struct iwatch iw_pidfile = { .name = "pidfile" };
+static char *rundir;		/* realpath() of /var/run */
+static int   targeted;		/* Only watching dirs of declared PID files */
 
 
 static int pidfile_add_path(struct iwatch *iw, char *path)
@@ -61,6 +63,94 @@ static int pidfile_add_path(struct iwatch *iw, char *path)
 	return iwatch_add(iw, path, IN_ONLYDIR | IN_CLOSE_WRITE);
 }
 
+/*
+ * Services relying on PID file readiness that do not declare one are
+ * found by the PID in any file created in /run, see svc_find_by_pidfile()
+ */
+static int pidfile_all_declared(void)
+{
+	svc_t *svc, *iter = NULL;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (!svc_is_daemon(svc) && !svc_is_sysv(svc))
+			continue;
+
+		if (svc->notify == SVC_NOTIFY_PID && !svc->pidfile[0])
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Directory of a declared PID file, or one of its parents */
+static int pidfile_wanted(const char *dir)
+{
+	size_t len = strlen(dir);
+	svc_t *svc, *iter = NULL;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		char *fn = svc->pidfile[0] == '!' ? &svc->pidfile[1] : svc->pidfile;
+
+		if (!strncmp(fn, dir, len) && fn[len] == '/')
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Watch directory of @fn, and any parents up to rundir, that exist */
+static void pidfile_watch_dirs(struct iwatch *iw, char *fn)
+{
+	size_t len = strlen(rundir);
+	char dir[PATH_MAX];
+	char *ptr;
+
+	if (strncmp(fn, rundir, len) || fn[len] != '/')
+		return;		/* Outside of /run, e.g. /var/lib/foo/pid */
+
+	strlcpy(dir, fn, sizeof(dir));
+	for (ptr = strchr(&dir[len + 1], '/'); ptr; ptr = strchr(ptr + 1, '/')) {
+		*ptr = 0;
+		if (!fisdir(dir))
+			break;
+		if (!iwatch_find_by_path(iw, dir))
+			iwatch_add(iw, dir, IN_ONLYDIR | IN_CLOSE_WRITE);
+		*ptr = '/';
+	}
+}
+
+/*
+ * At system up and after each reload, when all services have declared
+ * their PID files, only watch their directories, instead of all of
+ * /run, where sockets and lock files cause a lot of unrelated events.
+ */
+static void pidfile_targets(void *arg)
+{
+	struct iwatch_path *iwp, *tmp;
+	svc_t *svc, *iter = NULL;
+
+	if (!rundir)
+		return;
+
+	if (!pidfile_all_declared()) {
+		if (targeted)
+			dbg("Undeclared PID files, watching all of %s", rundir);
+		targeted = 0;
+		return;
+	}
+
+	targeted = 1;
+	TAILQ_FOREACH_SAFE(iwp, &iw_pidfile.iwp_list, link, tmp) {
+		if (strcmp(iwp->path, rundir) && !pidfile_wanted(iwp->path))
+			iwatch_del(&iw_pidfile, iwp);
+	}
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->pidfile[0])
+			pidfile_watch_dirs(&iw_pidfile, svc->pidfile[0] == '!' ? &svc->pidfile[1] : svc->pidfile);
+	}
+}
+
 static void pidfile_update_conds(char *dir, char *name, uint32_t mask)
 {
 	char cond[MAX_COND_LEN];
@@ -121,7 +211,7 @@ static void pidfile_update_conds(char *dir, char *name, uint32_t mask)
 			if (pid != svc->pid) {
 				dbg("Forking service %s (cmd %s) changed PID from %d to %d",
 				   svc_ident(svc, NULL, 0), svc->cmd, svc->pid, pid);
-				svc->pid = pid;
+				svc_set_pid(svc, pid);
 
 				/* Complement log in service.c for non-forking services */
 				logit(LOG_CONSOLE | LOG_NOTICE, "Started %s[%d]", svc_ident(svc, NULL, 0), pid);
@@ -179,7 +269,10 @@ static void pidfile_handle_dir(struct iwatch *iw, char *dir, char *name, int mas
 	iwp = iwatch_find_by_path(iw, path);
 
 	if (mask & IN_CREATE) {
-		if (!iwp) {
+		if (!iwp && targeted) {
+			if (pidfile_wanted(path) && !iwatch_add(iw, path, IN_ONLYDIR | IN_CLOSE_WRITE))
+				pidfile_scandir(iw, path, sizeof(path));
+		} else if (!iwp) {
 			if (!pidfile_add_path(iw, path))
 				pidfile_scandir(iw, path, sizeof(path));
 		}
@@ -202,6 +295,7 @@ static void pidfile_callback(void *arg, int fd, int events)
 		return;
 	}
 	ev_buf[sz] = 0;
+	iwatch_coalesce(ev_buf, sz);
 
 	for (off = 0; off < (size_t)sz; off += sizeof(*ev) + ev->len) {
 		struct iwatch_path *iwp;
@@ -260,6 +354,8 @@ static void pidfile_reconf(void *arg)
 		cond_set_path(cond_path(cond), COND_ON);
 	}
 
+	pidfile_targets(NULL);
+
 	/*
 	 * This calls service_step(), which in turn schedules itself as
 	 * long as stepped services change state.  Services going from
@@ -294,10 +390,13 @@ static void pidfile_init(void *arg)
 		}
 	}
 
-	if (pidfile_add_path(&iw_pidfile, path))
+	if (pidfile_add_path(&iw_pidfile, path)) {
 		iwatch_exit(&iw_pidfile);
+		free(path);
+		return;
+	}
 
-	free(path);
+	rundir = path;
 }
 
 /*
@@ -317,6 +416,7 @@ static void pidfile_init(void *arg)
 static plugin_t plugin = {
 	.name = __FILE__,
 	.hook[HOOK_BASEFS_UP]  = { .cb = pidfile_init   },
+	.hook[HOOK_SYSTEM_UP]  = { .cb = pidfile_targets },
 	.hook[HOOK_SVC_RECONF] = { .cb = pidfile_reconf },
 	.depends = { "netlink" }, /* bootmisc depends on us */
 };
@@ -340,6 +440,7 @@ PLUGIN_EXIT(plugin_exit)
 {
 	plugin_unregister(&plugin);
 	iwatch_exit(&iw_pidfile);
+	free(rundir);
 }
 
 /**
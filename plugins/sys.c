@@ -33,7 +33,7 @@
 #include "plugin.h"
 #include "iwatch.h"
 
-static struct iwatch iw_sys;
+static struct iwatch iw_sys = { .name = "sys" };
 
 
 static int sys_add_path(struct iwatch *iw, char *path)
@@ -125,6 +125,7 @@ static void sys_callback(void *arg, int fd, int events)
 		return;
 	}
 	ev_buf[sz] = 0;
+	iwatch_coalesce(ev_buf, sz);
 
 	for (off = 0; off < (size_t)sz; off += sizeof(*ev) + ev->len) {
 		struct iwatch_path *iwp;
@@ -32,7 +32,7 @@
 #include "plugin.h"
 #include "iwatch.h"
 
-static struct iwatch iw_usr;
+static struct iwatch iw_usr = { .name = "usr" };
 
 
 static void usr_cond(char *name, uint32_t mask)
@@ -42,7 +42,7 @@ static void setup(void *arg)
 	}
 
 	if (fexist("/var/run/console/console.lock") && which("pam_console_apply"))
-		run("pam_console_apply", "pam-console");
+		run_async("pam_console_apply", "pam-console", NULL, NULL);
 }
 
 static plugin_t plugin = {
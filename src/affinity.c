@@ -0,0 +1,372 @@
+/* CPU affinity, NUMA memory policy, and scheduling of services
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Per-service placement and scheduling, applied in the child between
+ * fork() and exec(), instead of a wrapper script and taskset, numactl,
+ * chrt, nice, and ionice adding a fork+exec of their own.
+ *
+ * - cpus:LIST            CPU affinity, e.g. cpus:2-3,6.  When the service
+ *                        has a leaf cgroup of its own, and the cpuset
+ *                        controller is available, cpuset.cpus is used
+ * - numa:POLICY[:NODES]  memory policy: local, preferred:NODE, bind:LIST,
+ *                        or interleave[:LIST], default all nodes
+ * - sched:POLICY[:PRIO]  other, batch, idle, fifo:PRIO, or rr:PRIO
+ * - nice:NUM             nice value, -20..19
+ * - ionice:CLASS[:LEVEL] idle, be:0-7, or rt:0-7, plain 0-7 is be:LEVEL
+ *
+ * Options are validated when the .conf file is read, a bad option is
+ * logged and ignored.
+ */
+
+#include "config.h"
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+#else
+# include <lite/lite.h>
+#endif
+
+#include "finit.h"
+#include "affinity.h"
+#include "log.h"
+
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT     0
+#define MPOL_PREFERRED   1
+#define MPOL_BIND        2
+#define MPOL_INTERLEAVE  3
+#define MPOL_LOCAL       4
+#endif
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+#define NODES_MAX        1024
+#define LONG_BITS        (8 * sizeof(long))
+
+static const char *ioclass[] = { "none", "rt", "be", "idle" };
+
+/*
+ * Parse list on the form 0-3,8,10-11 to bitmask of @max bits.  Returns
+ * number of bits set, or -1 on error.
+ */
+static int parse_list(const char *list, unsigned long *mask, int max)
+{
+	const char *ptr = list;
+	int num = 0;
+
+	memset(mask, 0, max / 8);
+	while (*ptr) {
+		char *end;
+		long lo, hi;
+
+		lo = strtol(ptr, &end, 10);
+		if (end == ptr || lo < 0 || lo >= max)
+			return -1;
+		hi = lo;
+		if (*end == '-') {
+			ptr = end + 1;
+			hi = strtol(ptr, &end, 10);
+			if (end == ptr || hi < lo || hi >= max)
+				return -1;
+		}
+
+		for (long i = lo; i <= hi; i++) {
+			mask[i / LONG_BITS] |= 1UL << (i % LONG_BITS);
+			num++;
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -1;
+		ptr = end;
+	}
+
+	return num;
+}
+
+static int parse_cpus(char *arg)
+{
+	cpu_set_t set;
+
+	return parse_list(arg, (unsigned long *)&set, CPU_SETSIZE) > 0 ? 0 : -1;
+}
+
+/* Returns MPOL_* mode and @nodes mask, or -1 on error */
+static int parse_numa(const char *arg, unsigned long *nodes)
+{
+	const char *list = strchr(arg, ':');
+	size_t len = list ? (size_t)(list - arg) : strlen(arg);
+	int mode, num;
+
+	if (list)
+		list++;
+
+	if (!strncmp(arg, "local", len) && len == 5)
+		return list ? -1 : MPOL_LOCAL;
+	if (!strncmp(arg, "default", len) && len == 7)
+		return list ? -1 : MPOL_DEFAULT;
+
+	if (!strncmp(arg, "preferred", len) && len == 9)
+		mode = MPOL_PREFERRED;
+	else if (!strncmp(arg, "bind", len) && len == 4)
+		mode = MPOL_BIND;
+	else if (!strncmp(arg, "interleave", len) && len == 10)
+		mode = MPOL_INTERLEAVE;
+	else
+		return -1;
+
+	if (!list || !strcmp(list, "all")) {
+		if (mode != MPOL_INTERLEAVE)
+			return -1;
+		memset(nodes, 0xff, NODES_MAX / 8);
+		return mode;
+	}
+
+	num = parse_list(list, nodes, NODES_MAX);
+	if (num < 1 || (mode == MPOL_PREFERRED && num != 1))
+		return -1;
+
+	return mode;
+}
+
+static int parse_sched(char *arg, int *prio)
+{
+	static const struct {
+		const char *name;
+		int         policy;
+	} policies[] = {
+		{ "other", SCHED_OTHER },
+		{ "batch", SCHED_BATCH },
+		{ "idle",  SCHED_IDLE  },
+		{ "fifo",  SCHED_FIFO  },
+		{ "rr",    SCHED_RR    },
+	};
+	char *ptr;
+
+	ptr = strchr(arg, ':');
+	if (ptr)
+		*ptr++ = 0;
+
+	for (size_t i = 0; i < NELEMS(policies); i++) {
+		int policy = policies[i].policy;
+
+		if (strcmp(arg, policies[i].name))
+			continue;
+
+		if (policy == SCHED_FIFO || policy == SCHED_RR) {
+			*prio = ptr ? atoi(ptr) : 1;
+			if (*prio < 1 || *prio > 99)
+				return -1;
+		} else {
+			if (ptr)
+				return -1;
+			*prio = 0;
+		}
+
+		return policy;
+	}
+
+	return -1;
+}
+
+/* Returns ioprio, class << 13 | level, or -1 on error */
+static int parse_ionice(char *arg)
+{
+	char *ptr;
+	int level = 4;
+
+	ptr = strchr(arg, ':');
+	if (ptr) {
+		*ptr++ = 0;
+		level = atoi(ptr);
+	} else if (isdigit((unsigned char)arg[0])) {
+		level = atoi(arg);
+		arg = "be";
+	}
+
+	for (int class = 1; class < (int)NELEMS(ioclass); class++) {
+		if (strcmp(arg, ioclass[class]))
+			continue;
+
+		if (class == 3)
+			level = 0;
+		else if (level < 0 || level > 7)
+			return -1;
+
+		return class << IOPRIO_CLASS_SHIFT | level;
+	}
+
+	return -1;
+}
+
+/**
+ * affinity_setup - Set up CPU affinity, NUMA policy and scheduling
+ * @svc:    Service to set up
+ * @cpus:   cpus:LIST, or %NULL
+ * @numa:   numa:POLICY[:NODES], or %NULL
+ * @sched:  sched:POLICY[:PRIO], or %NULL
+ * @nice:   nice:NUM, or %NULL
+ * @ionice: ionice:CLASS[:LEVEL], or %NULL
+ *
+ * Called on every .conf file (re)load, options that are not set are
+ * reset to the default, i.e., inherited from Finit.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero if any option was ignored.
+ */
+int affinity_setup(svc_t *svc, char *cpus, char *numa, char *sched, char *nice, char *ionice)
+{
+	unsigned long nodes[NODES_MAX / LONG_BITS];
+	char *ident = svc_ident(svc, NULL, 0);
+	int rc = 0;
+
+	svc->cpus[0] = 0;
+	if (cpus) {
+		if (strlen(cpus) < sizeof(svc->cpus) && !parse_cpus(cpus))
+			strlcpy(svc->cpus, cpus, sizeof(svc->cpus));
+		else {
+			logit(LOG_WARNING, "%s: invalid cpus:%s", ident, cpus);
+			rc = 1;
+		}
+	}
+
+	svc->numa[0] = 0;
+	if (numa) {
+		if (strlen(numa) < sizeof(svc->numa) && parse_numa(numa, nodes) != -1)
+			strlcpy(svc->numa, numa, sizeof(svc->numa));
+		else {
+			logit(LOG_WARNING, "%s: invalid numa:%s", ident, numa);
+			rc = 1;
+		}
+	}
+
+	svc->sched_policy = -1;
+	svc->sched_prio = 0;
+	if (sched) {
+		int prio;
+		int policy;
+
+		policy = parse_sched(sched, &prio);
+		if (policy != -1) {
+			svc->sched_policy = policy;
+			svc->sched_prio = prio;
+		} else {
+			logit(LOG_WARNING, "%s: invalid sched:%s", ident, sched);
+			rc = 1;
+		}
+	}
+
+	svc->nice = 0;
+	if (nice) {
+		const char *errstr = NULL;
+		int val;
+
+		val = strtonum(nice, -20, 19, &errstr);
+		if (!errstr)
+			svc->nice = val;
+		else {
+			logit(LOG_WARNING, "%s: invalid nice:%s", ident, nice);
+			rc = 1;
+		}
+	}
+
+	svc->ioprio = 0;
+	if (ionice) {
+		int ioprio;
+
+		ioprio = parse_ionice(ionice);
+		if (ioprio != -1)
+			svc->ioprio = ioprio;
+		else {
+			logit(LOG_WARNING, "%s: invalid ionice:%s", ident, ionice);
+			rc = 1;
+		}
+	}
+
+	return rc;
+}
+
+/**
+ * affinity_apply - Apply CPU affinity, NUMA policy and scheduling
+ * @svc:    Service being started
+ * @cpuset: CPU affinity already set by cpuset.cpus of leaf cgroup
+ *
+ * Called in the child from service_fork(), before dropping privileges.
+ * Failures are logged, the service is started regardless.
+ */
+void affinity_apply(svc_t *svc, int cpuset)
+{
+	char *ident = svc_ident(svc, NULL, 0);
+
+	if (svc->numa[0]) {
+		unsigned long nodes[NODES_MAX / LONG_BITS];
+		int mode;
+
+		mode = parse_numa(svc->numa, nodes);
+		if (mode == MPOL_LOCAL || mode == MPOL_DEFAULT)
+			mode = syscall(SYS_set_mempolicy, mode, NULL, 0);
+		else
+			mode = syscall(SYS_set_mempolicy, mode, nodes, NODES_MAX + 1);
+		if (mode)
+			logit(LOG_WARNING, "%s: failed setting numa:%s: %s", ident, svc->numa, strerror(errno));
+	}
+
+	if (svc->cpus[0] && !cpuset) {
+		cpu_set_t set;
+
+		parse_list(svc->cpus, (unsigned long *)&set, CPU_SETSIZE);
+		if (sched_setaffinity(0, sizeof(set), &set))
+			logit(LOG_WARNING, "%s: failed setting cpus:%s: %s", ident, svc->cpus, strerror(errno));
+	}
+
+	if (svc->nice && setpriority(PRIO_PROCESS, 0, svc->nice))
+		logit(LOG_WARNING, "%s: failed setting nice:%d: %s", ident, svc->nice, strerror(errno));
+
+	if (svc->sched_policy != -1) {
+		struct sched_param param = { .sched_priority = svc->sched_prio };
+
+		if (sched_setscheduler(0, svc->sched_policy, &param))
+			logit(LOG_WARNING, "%s: failed setting scheduling policy: %s", ident, strerror(errno));
+	}
+
+	if (svc->ioprio && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, svc->ioprio))
+		logit(LOG_WARNING, "%s: failed setting ionice:%s: %s", ident,
+		      ioclass[svc->ioprio >> IOPRIO_CLASS_SHIFT], strerror(errno));
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,420 @@
+/* Boot timeline analysis for initctl
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "analyze.h"
+#include "client.h"
+#include "initctl.h"
+#include "svc.h"
+#include "timeline.h"
+#include "util.h"
+
+#define CHAIN_MAX   16		/* Max depth of critical chain */
+#define SLOWEST_MAX 10		/* Services listed, unless -v */
+
+/* The parts of a svc_t we need, the strings of svc_t are not kept */
+struct node {
+	char         ident[MAX_IDENT_LEN];
+	char         name[MAX_ARG_LEN];
+	char         cond[MAX_COND_LEN];
+	svc_type_t   type;
+	int          runlevels;
+	long long    stamp[SVC_STAMP_MAX];
+};
+
+static struct tl_event events[TIMELINE_MAX];
+static int             num_events;
+static struct node    *nodes;
+static int             num_nodes;
+static long long       origin;	/* First event, all times relative to this */
+
+static int load_events(void)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_GET_TIMELINE,
+	};
+	ssize_t len;
+	int rc = -1;
+
+	if (client_request(&rq, sizeof(rq)))
+		goto done;
+
+	num_events = rq.runlevel;
+	if (num_events < 0 || num_events > TIMELINE_MAX)
+		goto done;
+
+	len = num_events * sizeof(events[0]);
+	if (len && read(client_socket(), events, len) != len)
+		goto done;
+
+	rc = 0;
+done:
+	client_disconnect();
+	return rc;
+}
+
+static int load_services(void)
+{
+	svc_t *svc;
+
+	for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0)) {
+		struct node *n;
+
+		n = realloc(nodes, (num_nodes + 1) * sizeof(*nodes));
+		if (!n)
+			return -1;
+		nodes = n;
+
+		n = &nodes[num_nodes++];
+		svc_ident(svc, n->ident, sizeof(n->ident));
+		strlcpy(n->name, svc->name, sizeof(n->name));
+		strlcpy(n->cond, svc->cond, sizeof(n->cond));
+		n->type      = svc->type;
+		n->runlevels = svc->runlevels;
+		memcpy(n->stamp, svc->stamp, sizeof(n->stamp));
+	}
+
+	return 0;
+}
+
+/* Ready, done, or at least started */
+static long long ready(struct node *n)
+{
+	if (n->stamp[SVC_STAMP_READY])
+		return n->stamp[SVC_STAMP_READY];
+
+	return n->stamp[SVC_STAMP_FORK];
+}
+
+/* Time from conditions satisfied to ready, i.e., the cost of starting */
+static long long startup(struct node *n)
+{
+	if (!n->stamp[SVC_STAMP_COND] || !ready(n))
+		return 0;
+
+	return ready(n) - n->stamp[SVC_STAMP_COND];
+}
+
+static long long find_event(const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_events; i++) {
+		if (!strcmp(events[i].name, name))
+			return events[i].msec;
+	}
+
+	return 0;
+}
+
+static struct node *find_node(const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_nodes; i++) {
+		if (!strcmp(nodes[i].ident, name) || !strcmp(nodes[i].name, name))
+			return &nodes[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Find service providing a condition, e.g. pid/foo or service/foo/ready,
+ * or the ready time of a hook condition if @n is NULL on return.
+ */
+static long long provider(const char *cond, struct node **n)
+{
+	char name[MAX_ARG_LEN];
+	const char *ptr;
+	size_t len;
+
+	*n = NULL;
+	if (!strncmp(cond, "hook/", 5))
+		return find_event(cond);
+
+	if (strncmp(cond, "pid/", 4) && strncmp(cond, "service/", 8) &&
+	    strncmp(cond, "task/", 5) && strncmp(cond, "run/", 4))
+		return 0;
+
+	ptr = strchr(cond, '/') + 1;
+	len = strcspn(ptr, "/");
+	if (len >= sizeof(name))
+		return 0;
+	memcpy(name, ptr, len);
+	name[len] = 0;
+
+	*n = find_node(name);
+	if (!*n)
+		return 0;
+
+	return ready(*n);
+}
+
+static char *msec(long long ms, char *buf, size_t len)
+{
+	if (ms)
+		snprintf(buf, len, "%lld.%03llds", ms / 1000, ms % 1000);
+	else
+		strlcpy(buf, "-", len);
+
+	return buf;
+}
+
+static int by_startup(const void *a, const void *b)
+{
+	long long d = startup((struct node *)b) - startup((struct node *)a);
+
+	return d < 0 ? -1 : d > 0;
+}
+
+static void show_events(void)
+{
+	char buf[16];
+	int i;
+
+	if (heading)
+		print_header("%-10s  %s", "TIME", "EVENT");
+	for (i = 0; i < num_events; i++)
+		printf("%-10s  %s\n", msec(events[i].msec - origin, buf, sizeof(buf)), events[i].name);
+}
+
+static void show_slowest(void)
+{
+	char wait[16], start[16], at[16];
+	struct node *sorted;
+	int i, max;
+
+	sorted = malloc(num_nodes * sizeof(*nodes));
+	if (!sorted)
+		return;
+	memcpy(sorted, nodes, num_nodes * sizeof(*nodes));
+	qsort(sorted, num_nodes, sizeof(*nodes), by_startup);
+
+	max = verbose ? num_nodes : SLOWEST_MAX;
+	if (heading)
+		print_header("%-10s  %-10s  %-10s  %s", "STARTUP", "WAITING", "READY", "IDENT");
+	for (i = 0; i < num_nodes && i < max; i++) {
+		struct node *n = &sorted[i];
+		long long waited = 0;
+
+		if (!startup(n))
+			break;
+		if (n->stamp[SVC_STAMP_ENABLED])
+			waited = n->stamp[SVC_STAMP_COND] - n->stamp[SVC_STAMP_ENABLED];
+
+		printf("%-10s  %-10s  %-10s  %s%s\n",
+		       msec(startup(n), start, sizeof(start)),
+		       msec(waited, wait, sizeof(wait)),
+		       msec(ready(n) - origin, at, sizeof(at)), n->ident,
+		       n->stamp[SVC_STAMP_CRASH] ? " (crashed)" : "");
+	}
+	free(sorted);
+}
+
+/*
+ * The transition to the configured runlevel waits for all run/task in
+ * runlevel S, the last one done gated it.  From there, follow the
+ * condition which was satisfied last, to its provider, and so on.
+ */
+static void show_chain(void)
+{
+	long long running = find_event("sm/running");
+	struct node *gate = NULL;
+	char at[16], took[16];
+	int i, depth;
+
+	for (i = 0; i < num_nodes; i++) {
+		struct node *n = &nodes[i];
+
+		if (!ISSET(n->runlevels, INIT_LEVEL) || !ready(n))
+			continue;
+		if (running && ready(n) > running)
+			continue;
+		if (!gate || ready(n) > ready(gate))
+			gate = n;
+	}
+
+	if (heading)
+		print_header("%-10s  %-10s  %s", "READY", "STARTUP", "CRITICAL CHAIN");
+	if (running)
+		printf("%-10s  %-10s  sm/running\n", msec(running - origin, at, sizeof(at)), "");
+
+	for (depth = 0; gate && depth < CHAIN_MAX; depth++) {
+		char cond[MAX_COND_LEN], *c;
+		struct node *next = NULL;
+		long long latest = 0;
+		char *hook = NULL;
+
+		printf("%-10s  %-10s  %*s%s\n", msec(ready(gate) - origin, at, sizeof(at)),
+		       msec(startup(gate), took, sizeof(took)), 2 * (depth + 1), "", gate->ident);
+
+		strlcpy(cond, gate->cond, sizeof(cond));
+		for (c = strtok(cond, ","); c; c = strtok(NULL, ",")) {
+			struct node *n;
+			long long t;
+
+			t = provider(c, &n);
+			if (t <= latest || (n && n == gate))
+				continue;
+
+			latest = t;
+			next   = n;
+			hook   = n ? NULL : c;
+		}
+
+		if (hook)
+			printf("%-10s  %-10s  %*s%s\n", msec(latest - origin, at, sizeof(at)),
+			       "", 2 * (depth + 2), "", hook);
+		gate = next;
+	}
+}
+
+static void json_analyze(void)
+{
+	char buf[MAX_ARG_LEN];
+	int i, j;
+
+	printf("{\n  \"events\": [");
+	for (i = 0; i < num_events; i++)
+		printf("%s\n    { \"name\": \"%s\", \"time\": %lld }", i ? "," : "",
+		       json_escape(events[i].name, buf, sizeof(buf)), events[i].msec);
+	printf("\n  ],\n  \"services\": [");
+	for (i = 0; i < num_nodes; i++) {
+		static const char *stamp[] = {
+			"enabled", "condition", "pre", "fork", "ready", "crash"
+		};
+		struct node *n = &nodes[i];
+
+		printf("%s\n    { \"identity\": \"%s\"", i ? "," : "",
+		       json_escape(n->ident, buf, sizeof(buf)));
+		for (j = 0; j < SVC_STAMP_MAX; j++) {
+			if (n->stamp[j])
+				printf(", \"%s\": %lld", stamp[j], n->stamp[j]);
+		}
+		printf(" }");
+	}
+	printf("\n  ]\n}\n");
+}
+
+/*
+ * One row per service, waiting for conditions in grey, pre: script in
+ * yellow, and starting until ready in red.  Events as vertical lines.
+ */
+static void svg_analyze(void)
+{
+	const int row = 20, scale = 10, left = 200; /* scale: msec per pixel */
+	char buf[MAX_ARG_LEN];
+	long long end = 0;
+	int i, y = 0;
+
+	for (i = 0; i < num_events; i++) {
+		if (events[i].msec > end)
+			end = events[i].msec;
+	}
+	for (i = 0; i < num_nodes; i++) {
+		if (ready(&nodes[i]) > end)
+			end = ready(&nodes[i]);
+	}
+
+	printf("<?xml version=\"1.0\" standalone=\"no\"?>\n"
+	       "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%lld\" height=\"%d\" "
+	       "font-family=\"sans-serif\" font-size=\"12\">\n",
+	       left + (end - origin) / scale + 100, (num_nodes + 2) * row);
+
+	for (i = 0; i < num_events; i++) {
+		long long x = left + (events[i].msec - origin) / scale;
+
+		printf("  <line x1=\"%lld\" y1=\"0\" x2=\"%lld\" y2=\"%d\" stroke=\"blue\"/>\n"
+		       "  <text x=\"%lld\" y=\"%d\" fill=\"blue\">%s</text>\n",
+		       x, x, (num_nodes + 2) * row, x + 2, (num_nodes + 1) * row + 14,
+		       xml_escape(events[i].name, buf, sizeof(buf)));
+	}
+
+	for (i = 0; i < num_nodes; i++) {
+		struct node *n = &nodes[i];
+		long long t[] = {
+			n->stamp[SVC_STAMP_ENABLED],
+			n->stamp[SVC_STAMP_COND],
+			n->stamp[SVC_STAMP_PRE] ?: n->stamp[SVC_STAMP_COND],
+			ready(n)
+		};
+		const char *color[] = { "#ccc", "#fc3", "#e33" };
+		int j;
+
+		if (!ready(n))
+			continue;
+
+		y += row;
+		printf("  <text x=\"4\" y=\"%d\">%s</text>\n", y + 14,
+		       xml_escape(n->ident, buf, sizeof(buf)));
+		for (j = 0; j < 3; j++) {
+			if (!t[j] || t[j + 1] < t[j])
+				continue;
+			printf("  <rect x=\"%lld\" y=\"%d\" width=\"%lld\" height=\"%d\" fill=\"%s\"/>\n",
+			       left + (t[j] - origin) / scale, y + 2, (t[j + 1] - t[j]) / scale + 1,
+			       row - 4, color[j]);
+		}
+	}
+	printf("</svg>\n");
+}
+
+int do_analyze(char *arg)
+{
+	int i;
+
+	if (load_events() || load_services())
+		ERRX(69, "failed reading boot timeline from finit");
+
+	for (i = 0; i < num_events; i++) {
+		if (!origin || events[i].msec < origin)
+			origin = events[i].msec;
+	}
+
+	if (arg && !strcmp(arg, "svg"))
+		svg_analyze();
+	else if (json)
+		json_analyze();
+	else {
+		show_events();
+		puts("");
+		show_slowest();
+		puts("");
+		show_chain();
+	}
+
+	free(nodes);
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -41,14 +42,21 @@
 #include "finit.h"
 #include "cond.h"
 #include "conf.h"
+#include "footprint.h"
 #include "helpers.h"
+#include "history.h"
 #include "log.h"
+#include "metrics.h"
 #include "plugin.h"
 #include "private.h"
+#include "reexec.h"
 #include "schedule.h"
 #include "service.h"
 #include "sig.h"
+#include "timeline.h"
+#include "trace.h"
 #include "util.h"
+#include "wdt.h"
 
 static uev_t api_watcher;
 
@@ -57,6 +65,15 @@ static int call(int (*action)(svc_t *, void *), char *buf, size_t len)
 	return svc_parse_jobstr(buf, len, NULL, action, NULL);
 }
 
+/* Batched requests are stepped in one go from the run queue, see do_batch() */
+static void step(svc_t *svc, void *user_data)
+{
+	if (user_data)
+		service_schedule(svc);
+	else
+		service_step(svc);
+}
+
 static int stop(svc_t *svc, void *user_data)
 {
 	if (!svc)
@@ -64,8 +81,7 @@ static int stop(svc_t *svc, void *user_data)
 
 	service_timeout_cancel(svc);
 	svc_stop(svc);
-	service_step(svc);
-	service_step_all(SVC_TYPE_ANY);
+	step(svc, user_data);
 
 	return 0;
 }
@@ -77,8 +93,7 @@ static int start(svc_t *svc, void *user_data)
 
 	service_timeout_cancel(svc);
 	svc_start(svc);
-	service_step(svc);
-	service_step_all(SVC_TYPE_ANY);
+	step(svc, user_data);
 
 	return 0;
 }
@@ -93,12 +108,18 @@ static int restart(svc_t *svc, void *user_data)
 	if (!svc)
 		return 1;
 
+	/* Instances of a template with instances:N, restart in batches */
+	if (svc->instances > 1) {
+		service_rolling(svc);
+		return 0;
+	}
+
 	if (!svc_is_running(svc))
 		return start(svc, user_data);
 
 	service_timeout_cancel(svc);
 	service_stop(svc);
-	service_step(svc);
+	step(svc, user_data);
 
 	return 0;
 }
@@ -114,7 +135,7 @@ static int reload(svc_t *svc, void *user_data)
 		service_timeout_cancel(svc);
 
 	svc_mark_dirty(svc);
-	service_step(svc);
+	step(svc, user_data);
 
 	return 0;
 }
@@ -124,6 +145,45 @@ static int do_start  (char *buf, size_t len) { return call(start,   buf, len); }
 static int do_restart(char *buf, size_t len) { return call(restart, buf, len); }
 static int do_reload (char *buf, size_t len) { return call(reload,  buf, len); }
 
+static int not_found(char *name, char *id, void *user_data)
+{
+	return 1;
+}
+
+/* Template instance, e.g. worker@1 from worker@1.conf, or worker@ */
+static char *instance(svc_t *svc, char *buf, size_t len)
+{
+	char *ptr;
+
+	strlcpy(buf, basenm(svc->file), len);
+	ptr = strstr(buf, ".conf");
+	if (ptr)
+		*ptr = 0;
+
+	return strchr(buf, '@') ? buf : "";
+}
+
+/* Glob, e.g. 'agent:*' or 'worker@*', matching service identities */
+static int call_glob(int (*action)(svc_t *, void *), char *pattern, void *user_data)
+{
+	svc_t *svc, *iter = NULL;
+	int result = 0, num = 0;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		char ident[MAX_IDENT_LEN];
+
+		if (fnmatch(pattern, svc_ident(svc, ident, sizeof(ident)), 0) &&
+		    fnmatch(pattern, svc->name, 0) &&
+		    fnmatch(pattern, instance(svc, ident, sizeof(ident)), 0))
+			continue;
+
+		result += action(svc, user_data);
+		num++;
+	}
+
+	return num ? result : 1;
+}
+
 static int do_signal_svc(svc_t *svc, void *user_data)
 {
 	int signo;
@@ -223,6 +283,12 @@ static svc_t *do_find_byc(char *buf, size_t len)
 	return svc_find_by_cond(input);
 }
 
+static void do_reexec(void *unused)
+{
+	reexec();
+}
+static struct wq reexec_work = { .cb = do_reexec };
+
 static void bypass_shutdown(void *);
 struct wq emergency = { .cb = bypass_shutdown };
 
@@ -241,6 +307,10 @@ static int do_reboot(int cmd, int timeout, char *buf, size_t len)
 		halt = SHUT_REBOOT;
 		break;
 
+	case INIT_CMD_KEXEC:
+		halt = SHUT_KEXEC;
+		break;
+
 	case INIT_CMD_HALT:
 		halt = SHUT_HALT;
 		break;
@@ -268,6 +338,12 @@ static int do_reboot(int cmd, int timeout, char *buf, size_t len)
 		service_runlevel(6);
 		break;
 
+	case INIT_CMD_KEXEC:
+		dbg("kexec reboot");
+		halt = SHUT_KEXEC;
+		service_runlevel(6);
+		break;
+
 	case INIT_CMD_HALT:
 		dbg("halt");
 		halt = SHUT_HALT;
@@ -310,276 +386,949 @@ ev_t ev_list[] = {
 	{ NULL, NULL }
 };
 
-static void send_svc(int sd, svc_t *svc)
+/*
+ * Each connected client has its own I/O watcher and a queue of replies
+ * not yet written.  The socket is non-blocking, so a slow, or stuck,
+ * client never stalls the event loop of PID 1, and a client idle for
+ * longer than API_IDLE_TIMEOUT is disconnected.
+ */
+#define API_IDLE_TIMEOUT 15000	/* msec, same as initctl REQUEST_TIMEOUT */
+#define API_MAX_CLIENTS  32
+#define API_MAX_EVENTS   256	/* Max queued events per subscriber */
+#define API_MAX_BATCH    65536	/* Max payload of INIT_CMD_SVC_BATCH */
+#define API_CHUNK        4096	/* Max message size of INIT_CMD_GET_METRICS */
+
+struct api_msg {
+	TAILQ_ENTRY(api_msg) link;
+	size_t               len;
+	char                 data[];
+};
+
+struct api_client {
+	LIST_ENTRY(api_client) link;
+	uev_t                  watcher;
+	struct wq              idle;
+	int                    closing;	/* Close when queue is drained */
+	TAILQ_HEAD(, api_msg)  queue;
+	int                    queued;
+	svc_t                 *iter;	/* INIT_CMD_SVC_ITER */
+
+	/* Subscriber, see INIT_CMD_SUBSCRIBE */
+	int                    events;
+	char                   filter[64];
+	uint32_t               dropped;
+};
+
+static LIST_HEAD(, api_client) api_clients = LIST_HEAD_INITIALIZER(api_clients);
+static int api_num_clients;
+
+static void client_free(struct api_client *cl, int keep_fd)
+{
+	struct api_msg *msg, *tmp;
+
+	TAILQ_FOREACH_SAFE(msg, &cl->queue, link, tmp) {
+		TAILQ_REMOVE(&cl->queue, msg, link);
+		free(msg);
+	}
+	cl->queued = 0;
+
+	cancel_work(&cl->idle);
+	uev_io_stop(&cl->watcher);
+	if (!keep_fd)
+		close(cl->watcher.fd);
+
+	LIST_REMOVE(cl, link);
+	api_num_clients--;
+	free(cl);
+}
+
+static void client_idle(void *arg)
+{
+	struct api_client *cl = (struct api_client *)((struct wq *)arg)->arg;
+
+	dbg("Disconnecting idle API client");
+	client_free(cl, 0);
+}
+
+/* Write as much as possible of queued replies, messages are never split */
+static int client_flush(struct api_client *cl)
+{
+	struct api_msg *msg;
+
+	while ((msg = TAILQ_FIRST(&cl->queue))) {
+		ssize_t len;
+
+		len = send(cl->watcher.fd, msg->data, msg->len, MSG_NOSIGNAL);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			dbg("Failed sending reply to client: %s", strerror(errno));
+			return -1;
+		}
+
+		TAILQ_REMOVE(&cl->queue, msg, link);
+		cl->queued--;
+		free(msg);
+	}
+
+	if (TAILQ_EMPTY(&cl->queue)) {
+		if (cl->closing)
+			return 1;
+		uev_io_set(&cl->watcher, cl->watcher.fd, UEV_READ);
+	} else
+		uev_io_set(&cl->watcher, cl->watcher.fd, UEV_WRITE);
+
+	return 0;
+}
+
+/* Queue one reply message, written from client_cb() when writable */
+static int api_send(struct api_client *cl, const void *buf, size_t len)
+{
+	struct api_msg *msg;
+
+	msg = malloc(sizeof(*msg) + len);
+	if (!msg) {
+		err(1, "Failed queueing reply to API client");
+		return -1;
+	}
+
+	msg->len = len;
+	memcpy(msg->data, buf, len);
+	TAILQ_INSERT_TAIL(&cl->queue, msg, link);
+	cl->queued++;
+
+	return 0;
+}
+
+static int event_match(struct api_client *cl, int type, const char *name)
+{
+	if (!(cl->events & type))
+		return 0;
+	if (type == INIT_EVENT_RUNLEVEL || !cl->filter[0])
+		return 1;
+
+	return !strncmp(name, cl->filter, strlen(cl->filter));
+}
+
+/**
+ * api_event - Push event to all subscribers
+ * @type:  One of %INIT_EVENT_SVC, %INIT_EVENT_COND, %INIT_EVENT_RUNLEVEL
+ * @name:  Service identity, or condition, %NULL for runlevel
+ * @state: New state, or runlevel
+ * @prev:  Previous state, or runlevel
+ * @pid:   PID of service, or 0
+ *
+ * Sent right away if possible, otherwise queued until the subscriber
+ * socket is writable.  When a subscriber has %API_MAX_EVENTS queued,
+ * new events are dropped, the number of which is reported in the next
+ * event that fits in the queue.
+ */
+void api_event(int type, const char *name, int state, int prev, int pid)
+{
+	static uint32_t seq;
+	struct init_event ev = {
+		.seq   = ++seq,
+		.type  = type,
+		.state = state,
+		.prev  = prev,
+		.pid   = pid,
+	};
+	struct api_client *cl;
+
+	if (LIST_EMPTY(&api_clients))
+		return;
+
+	ev.msec = timeline_now();
+	if (name)
+		strlcpy(ev.name, name, sizeof(ev.name));
+
+	LIST_FOREACH(cl, &api_clients, link) {
+		if (!event_match(cl, type, ev.name))
+			continue;
+
+		if (cl->queued >= API_MAX_EVENTS) {
+			cl->dropped++;
+			continue;
+		}
+
+		ev.dropped  = cl->dropped;
+		cl->dropped = 0;
+
+		/* Never free clients here, we may be called from client_cb() */
+		if (TAILQ_EMPTY(&cl->queue) &&
+		    send(cl->watcher.fd, &ev, sizeof(ev), MSG_NOSIGNAL | MSG_DONTWAIT) == sizeof(ev))
+			continue;
+
+		if (!api_send(cl, &ev, sizeof(ev)))
+			uev_io_set(&cl->watcher, cl->watcher.fd, UEV_WRITE);
+	}
+}
+
+/*
+ * Subscribe to events, the ACK is sent first and then all events until
+ * the client disconnects.  No idle timeout for subscribers.
+ */
+static int subscribe(struct api_client *cl, struct init_request *rq)
+{
+	strterm(rq->data, sizeof(rq->data));
+	strlcpy(cl->filter, rq->data, sizeof(cl->filter));
+	cl->events = rq->runlevel ?: INIT_EVENT_SVC | INIT_EVENT_COND | INIT_EVENT_RUNLEVEL;
+	dbg("subscribe, events 0x%x, filter '%s'", cl->events, cl->filter);
+
+	return 0;
+}
+
+static void send_svc(struct api_client *cl, svc_t *svc)
 {
-	svc_t empty = { 0 };
-	size_t len;
+	svc_t empty = { .pid = -1 };
 
-	if (!svc) {
-		empty.pid = -1;
+	if (!svc)
 		svc = &empty;
+
+	if (api_send(cl, svc, sizeof(*svc)))
+		return;
+
+	/* Followed by its command line args and strings, see client.c */
+	if (svc->strings_len)
+		api_send(cl, svc->strings, svc->strings_len);
+}
+
+/*
+ * filter: 'foo'   should match foo:1 foo:2, etc. but not foobar
+ * filter: 'foo:1' should only match foo:1
+ * filter: 'foo:'  is allowed to fail, unsupported syntax atm
+ * filter: 'foo:*' is allowed to fail, unsupported syntax atm
+ */
+static int dump_match(svc_t *svc, char *filter)
+{
+	if (!filter[0])
+		return 1;
+
+	if (strchr(filter, ':')) {
+		char ident[MAX_IDENT_LEN];
+
+		return !strcmp(svc_ident(svc, ident, sizeof(ident)), filter);
 	}
 
-	len = write(sd, svc, sizeof(*svc));
-	if (len != sizeof(*svc))
-		dbg("Failed sending svc_t to client");
+	return !strcmp(svc->name, filter);
 }
 
-static void api_cb(uev_t *w, void *arg, int events)
+static int send_rec(struct api_client *cl, svc_t *svc)
 {
-	static svc_t *iter = NULL;
-	struct init_request rq;
-	int sd, lvl;
-	svc_t *svc;
+	struct svc_rec *rec;
+	char *ptr;
+	size_t need;
+	int rc, i;
+
+	need = sizeof(*rec);
+	if (svc) {
+		need += strlen(svc->name) + strlen(svc->id) + strlen(svc->desc) + 4;
+		for (i = 0; svc->args[i]; i++)
+			need += strlen(svc->args[i]) + 1;
+	}
 
-	sd = accept(w->fd, NULL, NULL);
-	if (sd < 0) {
-		err(1, "Failed serving API request");
-		goto error;
+	rec = calloc(1, need);
+	if (!rec)
+		return -1;
+
+	rec->len = need;
+	rec->pid = -1;
+	if (svc) {
+		rec->pid         = svc->pid;
+		rec->status      = svc->status;
+		rec->runlevels   = svc->runlevels;
+		rec->restart_tot = svc->restart_tot;
+		rec->type        = svc->type;
+		rec->state       = svc->state;
+		rec->block       = svc->block;
+		rec->started     = svc->started;
+		rec->manual      = svc->manual;
+
+		ptr = stpcpy(rec->strings, svc->name) + 1;
+		ptr = stpcpy(ptr, svc->id) + 1;
+		ptr = stpcpy(ptr, svc->desc) + 1;
+		for (i = 0; svc->args[i]; i++)
+			ptr = stpcpy(ptr, svc->args[i]) + 1;
 	}
 
-	while (1) {
-		int result = 0;
-		ssize_t len;
+	rc = api_send(cl, rec, need);
+	free(rec);
 
-		len = read(sd, &rq, sizeof(rq));
-		if (len <= 0) {
-			if (-1 == len) {
-				if (EINTR == errno)
-					continue;
+	return rc;
+}
 
-				if (EAGAIN == errno)
-					break;
+/*
+ * Stream all services, optionally filtered on type and name, over the
+ * same connection.  The brief records carry only what `initctl status`
+ * needs for its table, the full ones the same as INIT_CMD_SVC_FIND.
+ */
+static void svc_dump(struct api_client *cl, struct init_request *rq)
+{
+	int full = rq->runlevel & SVC_DUMP_FULL;
+	int types = rq->sleeptime;
+	svc_t *iter = NULL;
+	svc_t *svc;
+
+	strterm(rq->data, sizeof(rq->data));
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (types && !(svc->type & types))
+			continue;
+		if (!dump_match(svc, rq->data))
+			continue;
+
+		if (full)
+			send_svc(cl, svc);
+		else if (send_rec(cl, svc))
+			goto fail;
+	}
 
-				/* we get here when client restarts itself */
-				if (ECONNRESET == errno)
-					break;
+	if (full)
+		send_svc(cl, NULL);
+	else if (send_rec(cl, NULL))
+		goto fail;
 
-				errx(1, "Failed reading initctl request, error %d: %s", errno, strerror(errno));
+	return;
+fail:
+	dbg("Failed queueing service records to client");
+}
+
+/*
+ * The payload, following the request in the same message, is a list of
+ * NUL terminated jobs: "start foo", "stop bar:2", "restart agent:*", or
+ * "reload 3".  All services are marked first, then stepped together
+ * from the run queue.  The reply is followed by a message with an int32
+ * result per job, the number of failed, or missing, services.
+ */
+static int do_batch(struct api_client *cl, struct init_request *rq, char *buf, size_t len)
+{
+	struct {
+		const char *op;
+		int (*action)(svc_t *, void *);
+	} ops[] = {
+		{ "start",   start   },
+		{ "stop",    stop    },
+		{ "restart", restart },
+		{ "reload",  reload  },
+	};
+	int32_t *results = NULL;
+	int result = 0, num = 0;
+	int batch = 1;
+	char *job;
+
+	if (!len || buf[len - 1])
+		goto fail;
+
+	for (job = buf; job < buf + len; job += strlen(job) + 1) {
+		int (*action)(svc_t *, void *) = NULL;
+		int32_t *tmp;
+		char *arg;
+
+		tmp = realloc(results, (num + 1) * sizeof(*results));
+		if (!tmp)
+			goto fail;
+		results = tmp;
+
+		arg = strchr(job, ' ');
+		if (arg) {
+			*arg++ = 0;
+			for (size_t i = 0; i < NELEMS(ops); i++) {
+				if (!strcmp(job, ops[i].op))
+					action = ops[i].action;
 			}
+		}
 
-			break;
+		if (!action || !arg[0])
+			results[num] = 1;
+		else if (strpbrk(arg, "*?["))
+			results[num] = call_glob(action, arg, &batch);
+		else
+			results[num] = svc_parse_jobstr(arg, strlen(arg) + 1, &batch, action, not_found);
+		result += results[num++];
+	}
+
+	dbg("batch of %d jobs, %d failed", num, result);
+	rq->cmd      = result ? INIT_CMD_NACK : INIT_CMD_ACK;
+	rq->runlevel = num;
+	if (!api_send(cl, rq, sizeof(*rq)))
+		api_send(cl, results, num * sizeof(*results));
+	free(results);
+
+	return 0;
+fail:
+	free(results);
+	rq->cmd      = INIT_CMD_NACK;
+	rq->runlevel = 0;
+	api_send(cl, rq, sizeof(*rq));
+
+	return -1;
+}
+
+/*
+ * The payload is a list of NUL terminated usr/ conditions, with or
+ * without the usr/ prefix, which are set if rq->runlevel is non-zero,
+ * otherwise cleared.  All are changed before their dependents are
+ * stepped, once.  The reply has the number of failed conditions in
+ * rq->runlevel.
+ */
+static int do_cond_batch(struct api_client *cl, struct init_request *rq, char *buf, size_t len)
+{
+	char **names = NULL;
+	int num = 0, failed = 0;
+	char *cond;
+
+	if (!len || buf[len - 1])
+		goto fail;
+
+	for (cond = buf; cond < buf + len; cond += strlen(cond) + 1) {
+		char *name = cond;
+		char **tmp;
+
+		if (!strncmp(name, COND_USR, strlen(COND_USR)))
+			name += strlen(COND_USR);
+		if (!name[0] || strpbrk(name, "/.")) {
+			failed++;
+			continue;
 		}
 
-		if (rq.magic != INIT_MAGIC || len != sizeof(rq)) {
-			errx(1, "Invalid initctl request");
-			break;
+		tmp = realloc(names, (num + 1) * sizeof(*names));
+		if (!tmp)
+			goto fail;
+		names = tmp;
+
+		/* Always with the usr/ prefix */
+		if (name == cond) {
+			names[num] = malloc(strlen(COND_USR) + strlen(name) + 1);
+			if (!names[num])
+				goto fail;
+			strcpy(stpcpy(names[num], COND_USR), name);
+		} else
+			names[num] = strdup(cond);
+		if (!names[num])
+			goto fail;
+		num++;
+	}
+
+	failed += cond_batch(names, num, rq->runlevel);
+	dbg("batch of %d conditions, %d failed", num + failed, failed);
+
+	rq->cmd      = failed ? INIT_CMD_NACK : INIT_CMD_ACK;
+	rq->runlevel = failed;
+	api_send(cl, rq, sizeof(*rq));
+
+	while (num--)
+		free(names[num]);
+	free(names);
+
+	return 0;
+fail:
+	while (num--)
+		free(names[num]);
+	free(names);
+	rq->cmd      = INIT_CMD_NACK;
+	rq->runlevel = -1;
+	api_send(cl, rq, sizeof(*rq));
+
+	return -1;
+}
+
+/* Boot timeline, number of events in rq->runlevel, see timeline.h */
+static void send_timeline(struct api_client *cl, struct init_request *rq)
+{
+	const struct tl_event *events;
+	int num;
+
+	events = timeline_get(&num);
+
+	rq->cmd      = INIT_CMD_ACK;
+	rq->runlevel = num;
+	if (api_send(cl, rq, sizeof(*rq)))
+		return;
+
+	if (num)
+		api_send(cl, events, num * sizeof(*events));
+}
+
+/* Text is sent in API_CHUNK sized messages after the ACK */
+static void send_text(struct api_client *cl, struct init_request *rq, int (*write)(FILE *))
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	if (!fp) {
+		rq->cmd = INIT_CMD_NACK;
+		api_send(cl, rq, sizeof(*rq));
+		return;
+	}
+	write(fp);
+	fclose(fp);
+
+	rq->cmd      = INIT_CMD_ACK;
+	rq->runlevel = (int)len;
+	if (!api_send(cl, rq, sizeof(*rq))) {
+		for (size_t off = 0; off < len; off += API_CHUNK)
+			api_send(cl, &buf[off], MIN(len - off, API_CHUNK));
+	}
+	free(buf);
+}
+
+/* Samples are sent oldest first, in API_CHUNK sized messages after the ACK */
+static void send_history(struct api_client *cl, struct init_request *rq)
+{
+	const int chunk = API_CHUNK / sizeof(struct init_sample);
+	struct init_sample *buf = NULL;
+	svc_t *svc;
+	int num = 0;
+
+	svc = do_find(rq->data, sizeof(rq->data));
+	if (svc)
+		buf = history_get(svc, &num);
+
+	if (!svc || (!buf && history_interval() == 0)) {
+		rq->cmd = INIT_CMD_NACK;
+		api_send(cl, rq, sizeof(*rq));
+		return;
+	}
+
+	rq->cmd       = INIT_CMD_ACK;
+	rq->runlevel  = num;
+	rq->sleeptime = history_interval();
+	if (!api_send(cl, rq, sizeof(*rq))) {
+		for (int i = 0; i < num; i += chunk)
+			api_send(cl, &buf[i], MIN(num - i, chunk) * sizeof(*buf));
+	}
+	free(buf);
+}
+
+/* Records are sent oldest first, in API_CHUNK sized messages after the ACK */
+static void send_earlylog(struct api_client *cl, struct init_request *rq)
+{
+	const int chunk = API_CHUNK / sizeof(struct init_logrec);
+	struct init_logrec *buf;
+	int num, lost;
+
+	buf = log_early(&num, &lost);
+	if (!buf) {
+		rq->cmd = INIT_CMD_NACK;
+		api_send(cl, rq, sizeof(*rq));
+		return;
+	}
+
+	rq->cmd       = INIT_CMD_ACK;
+	rq->runlevel  = num;
+	rq->sleeptime = lost;
+	if (!api_send(cl, rq, sizeof(*rq))) {
+		for (int i = 0; i < num; i += chunk)
+			api_send(cl, &buf[i], MIN(num - i, chunk) * sizeof(*buf));
+	}
+	free(buf);
+}
+
+/*
+ * Handle one request from a client, all replies are queued.  Returns 1
+ * to close the connection when the replies have been sent, and -1 when
+ * the socket has been handed over as notify socket of a service.  All
+ * other requests keep the connection, for clients like libfinit-client
+ * that pipeline requests.
+ */
+static int api_request(struct api_client *cl, struct init_request *rq, char *payload, size_t len)
+{
+	int result = 0;
+	svc_t *svc;
+	int lvl;
+
+	metrics.requests++;
+	TRACE2(api_request, rq->cmd, rq->data);
+	switch (rq->cmd) {
+	case INIT_CMD_RELOAD:
+	case INIT_CMD_START_SVC:
+	case INIT_CMD_RESTART_SVC:
+	case INIT_CMD_STOP_SVC:
+	case INIT_CMD_RELOAD_SVC:
+	case INIT_CMD_SVC_BATCH:
+	case INIT_CMD_REBOOT:
+	case INIT_CMD_KEXEC:
+	case INIT_CMD_HALT:
+	case INIT_CMD_POWEROFF:
+	case INIT_CMD_SUSPEND:
+	case INIT_CMD_REEXEC:
+		if (IS_RESERVED_RUNLEVEL(runlevel)) {
+			strterm(rq->data, sizeof(rq->data));
+			warnx("Unsupported command (cmd: %d, data: %s) in runlevel S and 6/0.",
+			      rq->cmd, rq->data);
+			return 1;
 		}
+	default:
+		break;
+	}
 
-		switch (rq.cmd) {
-		case INIT_CMD_RELOAD:
-		case INIT_CMD_START_SVC:
-		case INIT_CMD_RESTART_SVC:
-		case INIT_CMD_STOP_SVC:
-		case INIT_CMD_RELOAD_SVC:
-		case INIT_CMD_REBOOT:
-		case INIT_CMD_HALT:
-		case INIT_CMD_POWEROFF:
-		case INIT_CMD_SUSPEND:
-			if (IS_RESERVED_RUNLEVEL(runlevel)) {
-				strterm(rq.data, sizeof(rq.data));
-				warnx("Unsupported command (cmd: %d, data: %s) in runlevel S and 6/0.",
-				      rq.cmd, rq.data);
-				goto leave;
+	switch (rq->cmd) {
+	case INIT_CMD_RUNLVL:
+		/* Allow changing cfglevel in runlevel S */
+		if (IS_RESERVED_RUNLEVEL(runlevel)) {
+			if (runlevel != INIT_LEVEL) {
+				warnx("Cannot abort runlevel 6/0.");
+				break;
 			}
+		}
+
+		switch (rq->runlevel) {
+		case 's':
+		case 'S':
+			rq->runlevel = '1'; /* Single user mode */
+			/* fallthrough */
+
+		case '0'...'9':
+			dbg("Setting new runlevel %c", rq->runlevel);
+			lvl = rq->runlevel - '0';
+			if (lvl == 0)
+				halt = SHUT_OFF;
+			if (lvl == 6)
+				halt = SHUT_REBOOT;
+
+			/* User requested change in next runlevel */
+			if (runlevel == INIT_LEVEL)
+				cfglevel = lvl;
+			else
+				service_runlevel(lvl);
+			break;
+
 		default:
+			dbg("Unsupported runlevel: %d", rq->runlevel);
 			break;
 		}
+		break;
 
-		switch (rq.cmd) {
-		case INIT_CMD_RUNLVL:
-			/* Allow changing cfglevel in runlevel S */
-			if (IS_RESERVED_RUNLEVEL(runlevel)) {
-				if (runlevel != INIT_LEVEL) {
-					warnx("Cannot abort runlevel 6/0.");
-					break;
-				}
-			}
+	case INIT_CMD_DEBUG:
+		dbg("debug");
+		log_debug();
+		svc_pool_stats(rq->data, sizeof(rq->data));
+		break;
 
-			switch (rq.runlevel) {
-			case 's':
-			case 'S':
-				rq.runlevel = '1'; /* Single user mode */
-				/* fallthrough */
-
-			case '0'...'9':
-				dbg("Setting new runlevel %c", rq.runlevel);
-				lvl = rq.runlevel - '0';
-				if (lvl == 0)
-					halt = SHUT_OFF;
-				if (lvl == 6)
-					halt = SHUT_REBOOT;
-
-				/* User requested change in next runlevel */
-				if (runlevel == INIT_LEVEL)
-					cfglevel = lvl;
-				else
-					service_runlevel(lvl);
-				break;
+	case INIT_CMD_RELOAD: /* 'init q' and 'initctl reload' */
+		dbg("reload");
+		service_reload_dynamic();
+		break;
 
-			default:
-				dbg("Unsupported runlevel: %d", rq.runlevel);
-				break;
-			}
-			break;
+	case INIT_CMD_START_SVC:
+		dbg("start %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_start(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_DEBUG:
-			dbg("debug");
-			log_debug();
-			break;
+	case INIT_CMD_RESTART_SVC:
+		dbg("restart %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_restart(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_RELOAD: /* 'init q' and 'initctl reload' */
-			dbg("reload");
-			service_reload_dynamic();
-			break;
+	case INIT_CMD_STOP_SVC:
+		dbg("stop %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_stop(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_START_SVC:
-			dbg("start %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_start(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_RELOAD_SVC:
+		dbg("reload %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_reload(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_RESTART_SVC:
-			dbg("restart %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_restart(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_GET_PLUGINS:
+		result = plugin_list(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_STOP_SVC:
-			dbg("stop %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_stop(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_PLUGIN_DEPS:
+		result = plugin_deps(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_RELOAD_SVC:
-			dbg("reload %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_reload(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_GET_RUNLEVEL:
+		dbg("get runlevel");
+		rq->runlevel  = runlevel;
+		rq->sleeptime = prevlevel;
+		break;
 
-		case INIT_CMD_GET_PLUGINS:
-			result = plugin_list(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_REBOOT:
+	case INIT_CMD_KEXEC:
+	case INIT_CMD_HALT:
+	case INIT_CMD_POWEROFF:
+	case INIT_CMD_SUSPEND:
+		result = do_reboot(rq->cmd, rq->sleeptime, rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_PLUGIN_DEPS:
-			result = plugin_deps(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_ACK:
+		dbg("Client failed reading ACK");
+		return 1;
 
-		case INIT_CMD_GET_RUNLEVEL:
-			dbg("get runlevel");
-			rq.runlevel  = runlevel;
-			rq.sleeptime = prevlevel;
+	case INIT_CMD_WDOG_HELLO:
+		dbg("wdog hello");
+		if (rq->runlevel <= 0) {
+			result = 1;
 			break;
+		}
 
-		case INIT_CMD_REBOOT:
-		case INIT_CMD_HALT:
-		case INIT_CMD_POWEROFF:
-		case INIT_CMD_SUSPEND:
-			result = do_reboot(rq.cmd, rq.sleeptime, rq.data, sizeof(rq.data));
+		dbg("Request to hand-over wdog ... to PID %d", rq->runlevel);
+		svc = svc_find_by_pid(rq->runlevel);
+		if (!svc) {
+			logit(LOG_ERR, "Cannot find PID %d, not registered.", rq->runlevel);
 			break;
+		}
 
-		case INIT_CMD_ACK:
-			dbg("Client failed reading ACK");
-			goto leave;
+		if (wdog && wdog != svc) {
+			char name[32];
 
-		case INIT_CMD_WDOG_HELLO:
-			dbg("wdog hello");
-			if (rq.runlevel <= 0) {
-				result = 1;
-				break;
-			}
+			svc_ident(svc, name, sizeof(name));
+			logit(LOG_NOTICE, "Handing over wdog ctrl from %s[%d] to %s[%d]",
+			      svc_ident(wdog, NULL, 0), wdog->pid, name, svc->pid);
 
-			dbg("Request to hand-over wdog ... to PID %d", rq.runlevel);
-			svc = svc_find_by_pid(rq.runlevel);
-			if (!svc) {
-				logit(LOG_ERR, "Cannot find PID %d, not registered.", rq.runlevel);
-				break;
+			if (wdog->protect) {
+				logit(LOG_NOTICE, "Stopping and deleting built-in watchdog.");
+				stop(wdog, NULL);
+				svc_del(wdog);
 			}
+		}
+		if (wdt_enabled()) {
+			logit(LOG_NOTICE, "Handing over wdog ctrl from finit to %s[%d]",
+			      svc_ident(svc, NULL, 0), svc->pid);
+			wdt_exit();
+		}
+		wdog = svc;
+		break;
 
-			if (wdog && wdog != svc) {
-				char name[32];
+	case INIT_CMD_SVC_ITER:
+		/*
+		 * Each client has its own iterator, so the connection is
+		 * kept for all steps and closed after the last service.
+		 */
+		if (rq->runlevel || cl->iter)
+			svc = svc_iterator(&cl->iter, rq->runlevel);
+		else
+			svc = NULL;
+		send_svc(cl, svc);
+		return svc ? 0 : 1;
+
+	case INIT_CMD_SVC_QUERY:
+		dbg("svc query: %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_query(rq->data, sizeof(rq->data));
+		break;
 
-				svc_ident(svc, name, sizeof(name));
-				logit(LOG_NOTICE, "Handing over wdog ctrl from %s[%d] to %s[%d]",
-				      svc_ident(wdog, NULL, 0), wdog->pid, name, svc->pid);
+	case INIT_CMD_SVC_FIND:
+		dbg("svc find: %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		send_svc(cl, do_find(rq->data, sizeof(rq->data)));
+		return 0;
 
-				if (wdog->protect) {
-					logit(LOG_NOTICE, "Stopping and deleting built-in watchdog.");
-					stop(wdog, NULL);
-					svc_del(wdog);
-				}
-			}
-			wdog = svc;
+	case INIT_CMD_SVC_FIND_BYC:
+		dbg("svc find by cond: %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		send_svc(cl, do_find_byc(rq->data, sizeof(rq->data)));
+		return 0;
+
+	case INIT_CMD_SIGNAL:
+		/* runlevel is reused for signal */
+		dbg("svc signal %d: %s", rq->runlevel, rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_signal(rq->data, sizeof(rq->data), rq->runlevel);
+		break;
+
+	case INIT_CMD_GET_TIMELINE:
+		dbg("get timeline");
+		send_timeline(cl, rq);
+		return 0;
+
+	case INIT_CMD_SVC_BATCH:
+		do_batch(cl, rq, payload, len);
+		return 0;
+
+	case INIT_CMD_COND_BATCH:
+		do_cond_batch(cl, rq, payload, len);
+		return 0;
+
+	case INIT_CMD_SUBSCRIBE:
+		result = subscribe(cl, rq);
+		break;
+
+	case INIT_CMD_SVC_DUMP:
+		svc_dump(cl, rq);
+		return 0;
+
+	case INIT_CMD_SVC_HISTORY:
+		dbg("svc history: %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		send_history(cl, rq);
+		return 0;
+
+	case INIT_CMD_GET_METRICS:
+		dbg("get metrics");
+		send_text(cl, rq, metrics_write);
+		return 0;
+
+	case INIT_CMD_GET_FOOTPRINT:
+		dbg("get footprint");
+		send_text(cl, rq, footprint_write);
+		return 0;
+
+	case INIT_CMD_GET_EARLYLOG:
+		dbg("get early log");
+		send_earlylog(cl, rq);
+		return 0;
+
+	case INIT_CMD_COMPILE:
+		dbg("compile");
+		result = conf_snapshot();
+		break;
+
+	case INIT_CMD_REEXEC:
+		dbg("reexec");
+		if (reexec_busy()) {
+			result = 1;
 			break;
+		}
+		/* After we have replied to initctl */
+		schedule_work(&reexec_work);
+		break;
 
-		case INIT_CMD_SVC_ITER:
-//			dbg("svc iter, first: %d", rq.runlevel);
-			/*
-			 * XXX: This severely limits the number of
-			 * simultaneous client connections, but will
-			 * have to do for now.
-			 */
-			svc = svc_iterator(&iter, rq.runlevel);
-			send_svc(sd, svc);
-			goto leave;
-
-		case INIT_CMD_SVC_QUERY:
-			dbg("svc query: %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_query(rq.data, sizeof(rq.data));
+	case INIT_CMD_NOTIFY_SOCKET:
+		svc = svc_find_by_pid(rq->runlevel);
+		if (!svc) {
+			errx(1, "Unknown PID, cannot register notify socket");
+			result = 1;
 			break;
+		}
 
-		case INIT_CMD_SVC_FIND:
-			dbg("svc find: %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			send_svc(sd, do_find(rq.data, sizeof(rq.data)));
-			goto leave;
-
-		case INIT_CMD_SVC_FIND_BYC:
-			dbg("svc find by cond: %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			send_svc(sd, do_find_byc(rq.data, sizeof(rq.data)));
-			goto leave;
-
-		case INIT_CMD_SIGNAL:
-			/* runlevel is reused for signal */
-			dbg("svc signal %d: %s", rq.runlevel, rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_signal(rq.data, sizeof(rq.data), rq.runlevel);
+		/* Same fd cannot be in the event loop twice */
+		uev_io_stop(&cl->watcher);
+		if (uev_io_init(ctx, &svc->notify_watcher, service_notify_cb, svc, cl->watcher.fd, UEV_READ)) {
+			err(1, "Falied initializing %s readiness notifier", svc_ident(svc, NULL, 0));
 			break;
+		}
+		return -1;	/* Don't close socket, used for notify */
 
-		case INIT_CMD_NOTIFY_SOCKET:
-			svc = svc_find_by_pid(rq.runlevel);
-			if (!svc) {
-				errx(1, "Unknown PID, cannot register notify socket");
-				result = 1;
-				break;
-			}
+	default:
+		dbg("Unsupported cmd: %d", rq->cmd);
+		break;
+	}
 
-			if (uev_io_init(ctx, &svc->notify_watcher, service_notify_cb, svc, sd, UEV_READ)) {
-				err(1, "Falied initializing %s readiness notifier", svc_ident(svc, NULL, 0));
-				break;
-			}
-			return;	/* Don't close sd, used for notify */
+	if (result)
+		rq->cmd = INIT_CMD_NACK;
+	else
+		rq->cmd = INIT_CMD_ACK;
+	api_send(cl, rq, sizeof(*rq));
 
-		default:
-			dbg("Unsupported cmd: %d", rq.cmd);
-			break;
+	return 0;
+}
+
+/*
+ * One request at a time, and no more until all replies are sent.  The
+ * connection is closed on error, at EOF, or when requested by the last
+ * command, e.g. INIT_CMD_SVC_FIND, when its replies have been sent.
+ */
+static void client_cb(uev_t *w, void *arg, int events)
+{
+	static struct {
+		struct init_request rq;
+		char                payload[API_MAX_BATCH];
+	} msg;
+	struct api_client *cl = (struct api_client *)arg;
+	ssize_t len;
+	int rc;
+	PROBE("api/client");
+
+	if (UEV_ERROR == events)
+		goto close;
+
+	if ((events & UEV_READ) && TAILQ_EMPTY(&cl->queue) && !cl->closing) {
+		len = read(w->fd, &msg, sizeof(msg));
+		if (len == -1) {
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+
+			/* we get here when client restarts itself */
+			if (errno != ECONNRESET)
+				errx(1, "Failed reading initctl request, error %d: %s", errno, strerror(errno));
+			goto close;
+		}
+		if (!len)
+			goto close;
+
+		if (len < (ssize_t)sizeof(msg.rq) || msg.rq.magic != INIT_MAGIC ||
+		    (len != sizeof(msg.rq) && msg.rq.cmd != INIT_CMD_SVC_BATCH &&
+		     msg.rq.cmd != INIT_CMD_COND_BATCH)) {
+			errx(1, "Invalid initctl request");
+			goto close;
 		}
 
-		if (result)
-			rq.cmd = INIT_CMD_NACK;
+		rc = api_request(cl, &msg.rq, msg.payload, len - sizeof(msg.rq));
+		if (rc < 0) {
+			client_free(cl, 1);
+			return;
+		}
+		if (rc)
+			cl->closing = 1;
+
+		if (cl->events)
+			cancel_work(&cl->idle);
 		else
-			rq.cmd = INIT_CMD_ACK;
-		len = write(sd, &rq, sizeof(rq));
-		if (len != sizeof(rq))
-			dbg("Failed sending ACK/NACK back to client");
+			schedule_work(&cl->idle);
 	}
 
-leave:
-	close(sd);
+	if (!client_flush(cl))
+		return;
+close:
+	client_free(cl, 0);
+}
+
+static void api_cb(uev_t *w, void *arg, int events)
+{
+	struct api_client *cl;
+	int sd;
+	PROBE("api");
+
 	if (UEV_ERROR == events)
 		goto error;
+
+	sd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (sd < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+
+		err(1, "Failed serving API request");
+		goto error;
+	}
+
+	if (api_num_clients >= API_MAX_CLIENTS) {
+		warnx("Too many API clients, dropping connection.");
+		close(sd);
+		return;
+	}
+
+	cl = calloc(1, sizeof(*cl));
+	if (!cl) {
+		err(1, "Failed allocating API client");
+		close(sd);
+		return;
+	}
+
+	TAILQ_INIT(&cl->queue);
+	cl->idle.cb    = client_idle;
+	cl->idle.arg   = cl;
+	cl->idle.delay = API_IDLE_TIMEOUT;
+	if (uev_io_init(w->ctx, &cl->watcher, client_cb, cl, sd, UEV_READ)) {
+		err(1, "Failed setting up API client watcher");
+		free(cl);
+		close(sd);
+		return;
+	}
+
+	LIST_INSERT_HEAD(&api_clients, cl, link);
+	api_num_clients++;
+	schedule_work(&cl->idle);
+
 	return;
 error:
 	api_exit();
@@ -597,6 +1346,14 @@ int api_init(uev_ctx_t *ctx)
 	int uid, gid;
 	int sd;
 
+	/* Listening socket from before re-exec, see reexec.c */
+	sd = reexec_api();
+	if (sd > 0) {
+		if (!uev_io_init(ctx, &api_watcher, api_cb, NULL, sd, UEV_READ))
+			return 0;
+		close(sd);
+	}
+
 	dbg("Setting up external API socket ...");
 	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
 	if (-1 == sd) {
@@ -629,6 +1386,11 @@ error:
 	return 1;
 }
 
+int api_sd(void)
+{
+	return api_watcher.fd;
+}
+
 int api_exit(void)
 {
 	uev_io_stop(&api_watcher);
@@ -21,9 +21,15 @@
  * THE SOFTWARE.
  */
 
+#include "config.h"		/* Generated by configure script */
+
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 # include <libite/queue.h>	/* BSD sys/queue.h API */
@@ -32,12 +38,16 @@
 # include <lite/queue.h>	/* BSD sys/queue.h API */
 #endif
 #include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>		/* get_nprocs_conf() */
 
 #include "cgroup.h"
 #include "finit.h"
 #include "iwatch.h"
 #include "log.h"
+#include "metrics.h"
+#include "service.h"
 #include "util.h"
 
 struct cg {
@@ -54,26 +64,106 @@ static TAILQ_HEAD(, cg) cgroups = TAILQ_HEAD_INITIALIZER(cgroups);
 
 static char controllers[256];
 
-static struct iwatch iw_cgroup;
+static struct iwatch iw_cgroup = { .name = "cgroup" };
 static uev_t cgw;
 static int avail;
 
+/*
+ * Last value written to each cgroup file, to skip writing unchanged
+ * settings on reload, writing e.g. cpuset.cpus disturbs running tasks.
+ */
+#define CGVAL_BUCKETS 64
+
+struct cgval {
+	TAILQ_ENTRY(cgval) link;
+	char             *val;
+	char              file[];
+};
+
+static TAILQ_HEAD(, cgval) cgvals[CGVAL_BUCKETS];
+
+static unsigned int cgval_hash(const char *file)
+{
+	unsigned int hash = 5381;
+
+	while (*file)
+		hash = hash * 33 + (unsigned char)*file++;
+
+	return hash % CGVAL_BUCKETS;
+}
 
-static void cgset(const char *path, char *ctrl, char *prop)
+static struct cgval *cgval_find(const char *file)
 {
+	struct cgval *cv;
+
+	TAILQ_FOREACH(cv, &cgvals[cgval_hash(file)], link) {
+		if (!strcmp(cv->file, file))
+			return cv;
+	}
+
+	return NULL;
+}
+
+static void cgval_save(const char *file, const char *val)
+{
+	struct cgval *cv;
+	char *str;
+
+	str = strdup(val);
+	if (!str)
+		return;
+
+	cv = cgval_find(file);
+	if (!cv) {
+		cv = malloc(sizeof(*cv) + strlen(file) + 1);
+		if (!cv) {
+			free(str);
+			return;
+		}
+		strcpy(cv->file, file);
+		TAILQ_INSERT_HEAD(&cgvals[cgval_hash(file)], cv, link);
+	} else
+		free(cv->val);
+
+	cv->val = str;
+}
+
+/* Forget all values of group at @path, and its subgroups, when (re)created or removed */
+static void cgval_flush(const char *path)
+{
+	size_t len = strlen(path);
+	struct cgval *cv, *tmp;
+
+	for (int i = 0; i < CGVAL_BUCKETS; i++) {
+		TAILQ_FOREACH_SAFE(cv, &cgvals[i], link, tmp) {
+			if (strncmp(cv->file, path, len) || cv->file[len] != '/')
+				continue;
+
+			TAILQ_REMOVE(&cgvals[i], cv, link);
+			free(cv->val);
+			free(cv);
+		}
+	}
+}
+
+/* Returns 1 if written, 0 if unchanged, or -1 on error */
+static int cgset(const char *path, char *ctrl, char *prop)
+{
+	char file[512];
+	struct cgval *cv;
 	char *val;
 
 	dbg("path %s, ctrl %s, prop %s", path ?: "NIL", ctrl ?: "NIL", prop ?: "NIL");
 	if (!path || !ctrl) {
 		errx(1, "Missing path or controller, skipping!");
-		return;
+		return -1;
 	}
 
 	if (!prop) {
 		prop = strchr(ctrl, '.');
 		if (!prop) {
 			errx(1, "Invalid cgroup ctrl syntax: %s", ctrl);
-			return;
+			return -1;
 		}
 
 		*prop++ = 0;
@@ -82,19 +172,29 @@ static void cgset(const char *path, char *ctrl, char *prop)
 	val = strchr(prop, ':');
 	if (!val) {
 		errx(1, "Missing cgroup ctrl value, prop %s", prop);
-		return;
+		return -1;
 	}
 	*val++ = 0;
 
 	/* disallow sneaky relative paths */
 	if (strstr(ctrl, "..") || strstr(prop, "..")) {
 		errx(1, "Possible security violation; '..' not allowed in cgroup config!");
-		return;
+		return -1;
+	}
+
+	snprintf(file, sizeof(file), "%s/%s.%s", path, ctrl, prop);
+	cv = cgval_find(file);
+	if (cv && !strcmp(cv->val, val))
+		return 0;
+
+	dbg("%s <= %s", file, val);
+	if (fnwrite(val, "%s", file)) {
+		err(1, "Failed setting %s = %s", file, val);
+		return -1;
 	}
+	cgval_save(file, val);
 
-	dbg("%s/%s.%s <= %s", path, ctrl, prop, val);
-	if (fnwrite(val, "%s/%s.%s", path, ctrl, prop))
-		err(1, "Failed setting %s/%s.%s = %s", path, ctrl, prop, val);
+	return 1;
 }
 
 /*
@@ -102,7 +202,7 @@ static void cgset(const char *path, char *ctrl, char *prop)
  * Finit supports the short-form 'mem.', replacing it with 'memory.' when
  * writing the setting to the file system.
  */
-static void group_init(char *path, int leaf, const char *cfg)
+static void group_init(char *path, int leaf, const char *cfg, int *applied, int *skipped)
 {
 	char *ptr, *s;
 
@@ -112,6 +212,7 @@ static void group_init(char *path, int leaf, const char *cfg)
 			err(1, "Failed creating cgroup %s", path);
 			return;
 		}
+		cgval_flush(path);
 
 		/* enable detected controllers on domain groups */
 		if (!leaf && fnwrite(controllers, "%s/cgroup.subtree_control", path))
@@ -130,71 +231,428 @@ static void group_init(char *path, int leaf, const char *cfg)
 	dbg("%s <=> %s", path, s);
 	ptr = strtok(s, ",");
 	while (ptr) {
+		int rc;
+
 		dbg("ptr: %s", ptr);
 		if (!strncmp("mem.", ptr, 4))
-			cgset(path, "memory", &ptr[4]);
+			rc = cgset(path, "memory", &ptr[4]);
 		else
-			cgset(path, ptr, NULL);
+			rc = cgset(path, ptr, NULL);
+
+		if (rc == 1)
+			(*applied)++;
+		else if (rc == 0)
+			(*skipped)++;
 
 		ptr = strtok(NULL, ",");
 	}
 }
 
-static int cgroup_leaf_init(char *group, char *name, int pid, const char *cfg)
+/*
+ * Create and initialize new leaf group, watching it for when it becomes
+ * empty.  The path to the group is returned in @path.
+ */
+static void leaf_init(char *group, char *name, const char *cfg, char *path, size_t len)
+{
+	int applied = 0, skipped = 0;
+	char events[288];
+
+	dbg("group %s, name %s, cfg %s", group, name, cfg ?: "NIL");
+	snprintf(path, len, FINIT_CGPATH "/%s/%s", group, name);
+	group_init(path, 1, cfg, &applied, &skipped);
+	dbg("%s: %d settings applied, %d unchanged", path, applied, skipped);
+
+	snprintf(events, sizeof(events), "%s/cgroup.events", path);
+	iwatch_add(&iw_cgroup, events, 0);
+
+	/* OOM kills and memory.high throttling, see service_memory_events() */
+	snprintf(events, sizeof(events), "%s/memory.events", path);
+	iwatch_add(&iw_cgroup, events, 0);
+}
+
+/*
+ * Top-level group of a service, or NULL if the service runs directly in
+ * the root or init/ group, i.e., has no leaf group of its own.
+ */
+static char *service_parent(struct cgroup *cg)
 {
 	char path[256];
 
-	dbg("group %s, name %s, pid %d, cfg %s", group, name, pid, cfg ?: "NIL");
+	if (!cg || !cg->name[0])
+		return "system";
+
+	if (!strcmp(cg->name, "root") || !strcmp(cg->name, "init"))
+		return NULL;
+
+	snprintf(path, sizeof(path), FINIT_CGPATH "/%s", cg->name);
+	if (fisdir(path))
+		return cg->name;
+
+	return "system";
+}
+
+static void service_group(char *name, struct cgroup *cg, char *path, size_t len)
+{
+	char *group;
+
+	group = service_parent(cg);
+	if (!group) {
+		if (!strcmp(cg->name, "root"))
+			strlcpy(path, FINIT_CGPATH, len);
+		else
+			strlcpy(path, FINIT_CGPATH "/init", len);
+		return;
+	}
+
+	leaf_init(group, name, cg ? cg->cfg : NULL, path, len);
+}
+
+static int move_pid(char *path, int pid)
+{
 	if (pid < 0 || pid == 1) {
 		errno = EINVAL;
 		return 1;
 	}
 
-	/* create and initialize new group */
-	snprintf(path, sizeof(path), "/sys/fs/cgroup/%s/%s", group, name);
-	group_init(path, 1, cfg);
-
-	/* move process to new group */
-	if (fnwrite(str("%d", pid), "%s/cgroup.procs", path))
+	if (fnwrite(str("%d", pid), "%s/cgroup.procs", path)) {
 		err(1, "Failed moving pid %d to group %s", pid, path);
+		return 1;
+	}
 
-	strlcat(path, "/cgroup.events", sizeof(path));
+	return 0;
+}
 
-	return iwatch_add(&iw_cgroup, path, 0);
+/**
+ * cgroup_move - Move process to group
+ * @fd:  Group, from cgroup_service_fd() or cgroup_user_fd()
+ * @pid: Process to move
+ *
+ * Fallback for when cgroup_fork() is not supported.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int cgroup_move(int fd, int pid)
+{
+	char buf[16];
+	int procs, len;
+
+	if (fd < 0 || pid < 0 || pid == 1) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	procs = openat(fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+	if (procs == -1)
+		goto fail;
+
+	len = snprintf(buf, sizeof(buf), "%d", pid);
+	if (write(procs, buf, len) != len) {
+		close(procs);
+		goto fail;
+	}
+
+	return close(procs);
+fail:
+	err(1, "Failed moving pid %d to group", pid);
+	return 1;
+}
+
+/**
+ * cgroup_cpuset - Set CPUs of a group
+ * @fd:   Group, from cgroup_service_fd()
+ * @cpus: CPU list, e.g. 2-3,6, or empty string for all CPUs of parent
+ *
+ * Used for the cpus: option of services with a leaf group of their own,
+ * so that also processes resetting their CPU affinity are confined.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero if the cpuset controller is missing,
+ * or on error.
+ */
+int cgroup_cpuset(int fd, const char *cpus)
+{
+	size_t len = strlen(cpus);
+	int cpuset;
+
+	if (fd < 0 || !strstr(controllers, "+cpuset")) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	cpuset = openat(fd, "cpuset.cpus", O_WRONLY | O_CLOEXEC);
+	if (cpuset == -1)
+		return 1;
+
+	if (write(cpuset, len ? cpus : "\n", len ? len : 1) == -1) {
+		warn("Failed setting cpuset.cpus %s", cpus);
+		close(cpuset);
+		return 1;
+	}
+
+	return close(cpuset);
+}
+
+static int open_group(char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		err(1, "Failed opening group %s", path);
+
+	return fd;
 }
 
 int cgroup_user(char *name, int pid)
 {
+	char path[256];
+
 	if (!avail)
 		return 0;
 
-	return cgroup_leaf_init("user", name, pid, NULL);
+	leaf_init("user", name, NULL, path, sizeof(path));
+
+	return move_pid(path, pid);
 }
 
 int cgroup_service(char *name, int pid, struct cgroup *cg)
 {
-	char *group = "system";
+	char path[256];
 
 	if (!avail)
 		return 0;
 
-	if (cg && cg->name[0]) {
-		char path[256];
+	service_group(name, cg, path, sizeof(path));
 
-		if (!strcmp(cg->name, "root"))
-			return fnwrite(str("%d", pid), FINIT_CGPATH "/cgroup.procs");
+	return move_pid(path, pid);
+}
 
-		if (!strcmp(cg->name, "init"))
-			return fnwrite(str("%d", pid), FINIT_CGPATH "/init/cgroup.procs");
+/**
+ * cgroup_user_fd - Open leaf group of a user process
+ * @name: Name of leaf group in user/
+ *
+ * For cgroup_fork(), like cgroup_user() but before the process exists.
+ *
+ * Returns:
+ * An O_DIRECTORY file descriptor, or -1 if cgroups are not available.
+ */
+int cgroup_user_fd(char *name)
+{
+	char path[256];
+
+	if (!avail)
+		return -1;
+
+	leaf_init("user", name, NULL, path, sizeof(path));
+
+	return open_group(path);
+}
+
+/**
+ * cgroup_service_fd - Open leaf group of a service
+ * @name: Name of leaf group
+ * @cg:   Optional group and settings of the service
+ *
+ * For cgroup_fork(), like cgroup_service() but before the process exists.
+ *
+ * Returns:
+ * An O_DIRECTORY file descriptor, or -1 if cgroups are not available.
+ */
+int cgroup_service_fd(char *name, struct cgroup *cg)
+{
+	char path[256];
+
+	if (!avail)
+		return -1;
+
+	service_group(name, cg, path, sizeof(path));
+
+	return open_group(path);
+}
+
+/**
+ * cgroup_service_path - Path to leaf group of a service
+ * @name: Name of leaf group
+ * @cg:   Optional group and settings of the service
+ * @path: Buffer for the path
+ * @len:  Size of @path
+ *
+ * Returns:
+ * The path, or %NULL if the service does not have a leaf group.
+ */
+char *cgroup_service_path(char *name, struct cgroup *cg, char *path, size_t len)
+{
+	char *group;
+
+	if (!avail)
+		return NULL;
+
+	group = service_parent(cg);
+	if (!group)
+		return NULL;
+
+	snprintf(path, len, FINIT_CGPATH "/%s/%s", group, name);
+	if (!fisdir(path))
+		return NULL;
+
+	return path;
+}
+
+/**
+ * cgroup_service_populated - Check if leaf group of a service is in use
+ * @name: Name of leaf group
+ * @cg:   Optional group and settings of the service
+ *
+ * Only groups that can be drained with cgroup_service_kill() count, so
+ * callers waiting for a group to become empty never wait in vain.
+ *
+ * Returns:
+ * Non-zero if the group has processes left, otherwise zero.
+ */
+int cgroup_service_populated(char *name, struct cgroup *cg)
+{
+	char *group, buf[80];
+	int populated = 0;
+	FILE *fp;
+
+	if (!avail)
+		return 0;
+
+	group = service_parent(cg);
+	if (!group)
+		return 0;
+
+	/* cgroup.kill was added in Linux 5.14 */
+	if (!fexistf(FINIT_CGPATH "/%s/%s/cgroup.kill", group, name))
+		return 0;
+
+	fp = fopenf("r", FINIT_CGPATH "/%s/%s/cgroup.events", group, name);
+	if (!fp)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (strncmp(buf, "populated", 9))
+			continue;
+
+		populated = atoi(&buf[10]);
+		break;
+	}
+	fclose(fp);
+
+	return populated;
+}
+
+/**
+ * cgroup_service_kill - SIGKILL all processes in leaf group of a service
+ * @name: Name of leaf group
+ * @cg:   Optional group and settings of the service
+ *
+ * Unlike kill(-pgrp, SIGKILL) this also reaches processes that have
+ * changed process group or session, with one write to cgroup.kill.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero if the group does not exist or the
+ * kernel does not support cgroup.kill.
+ */
+int cgroup_service_kill(char *name, struct cgroup *cg)
+{
+	char *group;
+
+	if (!avail)
+		return 1;
 
-		snprintf(path, sizeof(path), "/sys/fs/cgroup/%s", cg->name);
-		if (fisdir(path))
-			group = cg->name;
+	group = service_parent(cg);
+	if (!group) {
+		errno = EINVAL;
+		return 1;
 	}
 
-	return cgroup_leaf_init(group, name, pid, cg ? cg->cfg : NULL);
+	dbg("SIGKILL all processes in %s/%s", group, name);
+	return fnwrite("1", FINIT_CGPATH "/%s/%s/cgroup.kill", group, name);
 }
 
+#ifdef SYS_clone3
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+/* struct clone_args, version 2 (Linux 5.7), from linux/sched.h */
+struct clone3_args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+	uint64_t set_tid;
+	uint64_t set_tid_size;
+	uint64_t cgroup;
+};
+
+static int noclone3;
+
+/*
+ * Raw clone3() skips the atfork handlers of the C library, e.g. for the
+ * malloc arena locks, which is only safe when we have no other threads,
+ * like the .conf prefetch or readahead helpers.  One link per thread in
+ * /proc/self/task, plus . and ..
+ */
+static int threaded(void)
+{
+	struct stat st;
+
+	if (stat("/proc/self/task", &st))
+		return 1;
+
+	return st.st_nlink > 3;
+}
+
+/**
+ * cgroup_fork - Create a new process in a cgroup
+ * @fd: Group, from cgroup_service_fd() or cgroup_user_fd()
+ *
+ * Like fork(), but using clone3() with CLONE_INTO_CGROUP so the child
+ * starts in its group, instead of being moved there after fork().  Only
+ * when single threaded, see threaded().
+ *
+ * Returns:
+ * Like fork(), with the exception that -1 means the caller must fall
+ * back to fork() followed by cgroup_service() or cgroup_user().
+ */
+pid_t cgroup_fork(int fd)
+{
+	struct clone3_args args = {
+		.flags       = CLONE_INTO_CGROUP,
+		.exit_signal = SIGCHLD,
+		.cgroup      = fd,
+	};
+	long pid;
+
+	if (fd < 0 || noclone3 || threaded())
+		return -1;
+
+	pid = syscall(SYS_clone3, &args, sizeof(args));
+	if (pid == -1) {
+		/* Not supported by kernel, or too old for cgroup field */
+		if (errno == ENOSYS || errno == E2BIG) {
+			dbg("No clone3() CLONE_INTO_CGROUP support, falling back to fork().");
+			noclone3 = 1;
+		}
+		return -1;
+	}
+
+	return pid;
+}
+#else
+pid_t cgroup_fork(int fd)
+{
+	return -1;
+}
+#endif /* SYS_clone3 */
+
 static void append_ctrl(char *ctrl)
 {
 	if (controllers[0])
@@ -207,6 +665,7 @@ static void append_ctrl(char *ctrl)
 static void cgroup_handle_event(char *event, uint32_t mask)
 {
 	char path[strlen(event) + 1];
+	char leaf[80];
 	char buf[80];
 	char *ptr;
 	FILE *fp;
@@ -215,6 +674,15 @@ static void cgroup_handle_event(char *event, uint32_t mask)
 	if (!(mask & IN_MODIFY))
 		return;
 
+	ptr = strrchr(event, '/');
+	if (ptr && !strcmp(ptr, "/memory.events")) {
+		strlcpy(path, event, sizeof(path));
+		path[ptr - event] = 0;
+		ptr = strrchr(path, '/');
+		service_memory_events(ptr ? &ptr[1] : path, path);
+		return;
+	}
+
 	fp = fopen(event, "r");
 	if (!fp) {
 		dbg("Failed opening %s, skipping ...", event);
@@ -233,17 +701,23 @@ static void cgroup_handle_event(char *event, uint32_t mask)
 		ptr = strrchr(path, '/');
 		if (ptr) {
 			*ptr = 0;
+			ptr = strrchr(path, '/');
+			strlcpy(leaf, ptr ? &ptr[1] : path, sizeof(leaf));
+
 			if (!cgroup_del(path)) {
 				/*
 				 * try with parent, top-level group, we
 				 * may get events out-of-order *sigh*
 				 */
 				ptr = strrchr(path, '/');
-				if (!ptr)
-					break;
-				*ptr = 0;
-				cgroup_del(path);
+				if (ptr) {
+					*ptr = 0;
+					cgroup_del(path);
+				}
 			}
+
+			/* group drained, services waiting for it can stop now */
+			service_cgroup_empty(leaf);
 		}
 
 		break;
@@ -258,6 +732,7 @@ static void cgroup_events_cb(uev_t *w, void *arg, int events)
 	struct inotify_event *ev;
 	ssize_t sz;
 	size_t off;
+	PROBE("cgroup");
 
 	sz = read(w->fd, ev_buf, sizeof(ev_buf) - 1);
 	if (sz <= 0) {
@@ -265,6 +740,7 @@ static void cgroup_events_cb(uev_t *w, void *arg, int events)
 		return;
 	}
 	ev_buf[sz] = 0;
+	iwatch_coalesce(ev_buf, sz);
 
 	for (off = 0; off < (size_t)sz; off += sizeof(*ev) + ev->len) {
 		struct iwatch_path *iwp;
@@ -417,6 +893,7 @@ int cgroup_del(char *dir)
 		dbg("Failed removing %s: %s", dir, strerror(errno));
 		return -1;
 	}
+	cgval_flush(dir);
 
 	if (cg) {
 		TAILQ_REMOVE(&cgroups, cg, link);
@@ -431,6 +908,7 @@ int cgroup_del(char *dir)
 /* the top-level init cgroup is a leaf, that's ensured in cgroup_init() */
 void cgroup_config(void)
 {
+	int applied = 0, skipped = 0;
 	struct cg *cg;
 
 	if (!avail)
@@ -446,16 +924,37 @@ void cgroup_config(void)
 			leaf = 1;	/* reserved */
 
 		snprintf(path, sizeof(path), "%s/%s", FINIT_CGPATH, cg->name);
-		group_init(path, leaf, cg->cfg);
+		group_init(path, leaf, cg->cfg, &applied, &skipped);
 
 		strlcat(path, "/cgroup.events", sizeof(path));
 		iwatch_add(&iw_cgroup, path, 0);
 	}
+
+	dbg("cgroup config: %d settings applied, %d unchanged", applied, skipped);
 }
 
 /*
  * Called by Finit at early boot to mount initial cgroups
  */
+/* Number of top-level groups, and their size in bytes, for footprint */
+size_t cgroup_footprint(size_t *bytes)
+{
+	struct cg *cg;
+	size_t num = 0;
+
+	*bytes = 0;
+	TAILQ_FOREACH(cg, &cgroups, link) {
+		*bytes += sizeof(*cg);
+		if (cg->name)
+			*bytes += strlen(cg->name) + 1;
+		if (cg->cfg)
+			*bytes += strlen(cg->cfg) + 1;
+		num++;
+	}
+
+	return num;
+}
+
 void cgroup_init(uev_ctx_t *ctx)
 {
 	int opts = MS_NODEV | MS_NOEXEC | MS_NOSUID;
@@ -463,6 +962,9 @@ void cgroup_init(uev_ctx_t *ctx)
 	FILE *fp;
 	int fd;
 
+	for (int i = 0; i < CGVAL_BUCKETS; i++)
+		TAILQ_INIT(&cgvals[i]);
+
 #ifndef CGROUP2_ENABLED
 	avail = 0;
 	return;
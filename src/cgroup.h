@@ -24,6 +24,7 @@
 #ifndef FINIT_CGROUP_H_
 #define FINIT_CGROUP_H_
 
+#include <sys/types.h>
 #include <uev/uev.h>
 
 struct cgroup {
@@ -37,10 +38,21 @@ void cgroup_cleanup (void);
 int  cgroup_add     (char *name, char *cfg, int is_protected);
 int  cgroup_del     (char *dir);
 void cgroup_config  (void);
+size_t cgroup_footprint(size_t *bytes);
 
 void cgroup_init    (uev_ctx_t *ctx);
 
 int  cgroup_user    (char *name, int pid);
 int  cgroup_service (char *name, int pid, struct cgroup *cg);
 
+int   cgroup_user_fd    (char *name);
+int   cgroup_service_fd (char *name, struct cgroup *cg);
+int   cgroup_move       (int fd, int pid);
+int   cgroup_cpuset     (int fd, const char *cpus);
+
+char *cgroup_service_path     (char *name, struct cgroup *cg, char *path, size_t len);
+int   cgroup_service_populated (char *name, struct cgroup *cg);
+int   cgroup_service_kill      (char *name, struct cgroup *cg);
+pid_t cgroup_fork       (int fd);
+
 #endif /* FINIT_CGROUP_H_ */
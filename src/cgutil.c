@@ -24,11 +24,14 @@
 #include "config.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <search.h>
 #include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 #else
@@ -52,31 +55,59 @@ uint64_t total_ram;			/* From sysinfo() */
 
 struct cg  dummy;			/* empty result "NULL"      */
 struct cg *list;
+unsigned   generation;			/* Refresh counter, see cg_stats() */
+
+/*
+ * Process name and arguments, cached between refreshes of 'top'.  A PID
+ * is only reused by a process with a later start time, so for known
+ * processes /proc/PID/stat, which holds both comm and start time, is
+ * the only file read.  Entries not seen in a refresh are dropped.
+ */
+#define PROC_BUCKETS 1024
+
+struct proc {
+	struct proc       *next;
+	pid_t              pid;
+	unsigned long long start;	/* Clock ticks after boot */
+	unsigned           gen;
+	char               comm[32];
+	char              *args;	/* NULL for kernel threads */
+};
+
+static struct proc *procs[PROC_BUCKETS];
 
 int cgroup_avail(void)
 {
 	return fismnt(FINIT_CGPATH);
 }
 
-char *pid_cmdline(int pid, char *buf, size_t len)
+/* One open and pread() of a /proc/PID file, NUL terminated */
+static ssize_t proc_read(int pid, const char *file, char *buf, size_t len)
 {
-	size_t i, sz;
-	char *ptr;
-	FILE *fp;
-
-	fp = fopenf("r", "/proc/%d/cmdline", pid);
-	if (!fp) {
-		buf[0] = 0;
-		return buf;
-	}
+	char path[32];
+	ssize_t sz;
+	int fd;
 
-	sz = fread(buf, sizeof(buf[0]), len - 1, fp);
-	fclose(fp);
-	if (!sz)
-		return NULL;		/* kernel thread */
+	snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
 
+	sz = pread(fd, buf, len - 1, 0);
+	close(fd);
+	if (sz < 0)
+		return -1;
 	buf[sz] = 0;
 
+	return sz;
+}
+
+/* Skip argv[0], already shown as comm, and join the arguments */
+static char *cmdline_args(char *buf, size_t sz)
+{
+	size_t i;
+	char *ptr;
+
 	ptr = strchr(buf, 0);
 	if (ptr && ptr != buf) {
 		ptr++;
@@ -92,6 +123,101 @@ char *pid_cmdline(int pid, char *buf, size_t len)
 	return buf;
 }
 
+char *pid_cmdline(int pid, char *buf, size_t len)
+{
+	ssize_t sz;
+
+	sz = proc_read(pid, "cmdline", buf, len);
+	if (sz < 0) {
+		buf[0] = 0;
+		return buf;
+	}
+	if (!sz)
+		return NULL;		/* kernel thread */
+
+	return cmdline_args(buf, sz);
+}
+
+/*
+ * Name and start time from /proc/PID/stat, comm is in parenthesis and
+ * may itself contain both space and parenthesis, starttime is field 22
+ */
+static int proc_stat(int pid, char *comm, size_t len, unsigned long long *start)
+{
+	char buf[512], *beg, *end;
+
+	if (proc_read(pid, "stat", buf, sizeof(buf)) <= 0)
+		return -1;
+
+	beg = strchr(buf, '(');
+	end = strrchr(buf, ')');
+	if (!beg || !end || end < beg)
+		return -1;
+
+	*end++ = 0;
+	strlcpy(comm, beg + 1, len);
+
+	if (sscanf(end, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u"
+		   " %*d %*d %*d %*d %*d %*d %llu", start) != 1)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Cached name and arguments of @pid, *args is NULL for kernel threads.
+ * Returns -1 if the process is gone.
+ */
+static int proc_get(int pid, char **comm, char **args)
+{
+	struct proc **pp, *p, *found = NULL;
+	unsigned long long start;
+	char name[32];
+
+	if (proc_stat(pid, name, sizeof(name), &start))
+		return -1;
+
+	pp = &procs[pid % PROC_BUCKETS];
+	while ((p = *pp)) {
+		if (p->pid == pid && p->start == start) {
+			found = p;
+		} else if (p->pid == pid || generation - p->gen > 1) {
+			*pp = p->next;
+			free(p->args);
+			free(p);
+			continue;
+		}
+		pp = &p->next;
+	}
+
+	if (!found) {
+		char buf[512];
+		ssize_t sz;
+
+		found = calloc(1, sizeof(*found));
+		if (!found)
+			return -1;
+
+		found->pid   = pid;
+		found->start = start;
+		sz = proc_read(pid, "cmdline", buf, sizeof(buf));
+		if (sz > 0)
+			found->args = strdup(cmdline_args(buf, sz));
+
+		found->next = procs[pid % PROC_BUCKETS];
+		procs[pid % PROC_BUCKETS] = found;
+	}
+
+	/* comm can be changed, e.g. with prctl(PR_SET_NAME) */
+	strlcpy(found->comm, name, sizeof(found->comm));
+	found->gen = generation;
+
+	*comm = found->comm;
+	*args = found->args;
+
+	return 0;
+}
+
 char *pid_comm(int pid, char *buf, size_t len)
 {
 	char *ptr = NULL;
@@ -172,58 +298,85 @@ static char *cgroup_memval(char *path, char *file, char *buf, size_t len)
 	return buf;
 }
 
+static const char *cg_files[CG_FD_MAX] = {
+	[CG_CPU_STAT]     = "cpu.stat",
+	[CG_MEM_STAT]     = "memory.stat",
+	[CG_MEM_CURRENT]  = "memory.current",
+	[CG_IO_STAT]      = "io.stat",
+	[CG_CPU_PRESSURE] = "cpu.pressure",
+	[CG_MEM_PRESSURE] = "memory.pressure",
+	[CG_IO_PRESSURE]  = "io.pressure",
+};
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Re-read stat file from the start, NULL if missing or cgroup is gone */
+static char *cg_read(struct cg *cg, int file, char *buf, size_t len)
+{
+	ssize_t num;
+
+	if (cg->cg_fd[file] == -1)
+		return NULL;
+
+	num = pread(cg->cg_fd[file], buf, len - 1, 0);
+	if (num <= 0)
+		return NULL;
+	buf[num] = 0;
+
+	return buf;
+}
+
+/* Next "key value" line of a flat keyed file, e.g. memory.stat */
+static char *cg_next(char **ptr, uint64_t *val)
+{
+	char *line, *key;
+
+	while ((line = strsep(ptr, "\n"))) {
+		key = strsep(&line, " ");
+		if (!line)
+			continue;
+
+		*val = strtoull(line, NULL, 10);
+		return key;
+	}
+
+	return NULL;
+}
+
 static uint64_t cgroup_memuse(struct cg *cg)
 {
-	char buf[42];
-	FILE *fp;
+	char buf[8192], *ptr, *key;
+	uint64_t val;
 
-	fp = fopenf("r", "%s/memory.stat", cg->cg_path);
-	if (fp) {
+	ptr = cg_read(cg, CG_MEM_STAT, buf, sizeof(buf));
+	if (ptr) {
 		cg->cg_rss = 0;
 		cg->cg_vmlib = 0;
 
-		while (fgets(buf, sizeof(buf), fp)) {
-			chomp(buf);
-
-			if (!strncmp(buf, "anon", 4)) {
-				cg->cg_rss += strtoull(&buf[5], NULL, 10);
-				continue;
-			}
-			if (!strncmp(buf, "slab", 4)) {
-				cg->cg_rss += strtoull(&buf[5], NULL, 10);
-				continue;
-			}
-			if (!strncmp(buf, "kernel_stack", 12)) {
-				cg->cg_rss += strtoull(&buf[5], NULL, 10);
-				continue;
-			}
-			if (!strncmp(buf, "pagetables", 10)) {
-				cg->cg_rss += strtoull(&buf[5], NULL, 10);
-				continue;
-			}
-			if (!strncmp(buf, "percpu", 6)) {
-				cg->cg_rss += strtoull(&buf[5], NULL, 10);
-				continue;
-			}
-			if (!strncmp(buf, "sock", 4)) {
-				cg->cg_rss += strtoull(&buf[5], NULL, 10);
-				continue;
-			}
-			if (!strncmp(buf, "file", 4)) {
-				cg->cg_vmlib += strtoull(&buf[5], NULL, 10);
-				continue;
-			}
-			if (!strncmp(buf, "file_mapped", 11)) {
-				cg->cg_vmlib += strtoull(&buf[5], NULL, 10);
-				continue;
-			}
+		while ((key = cg_next(&ptr, &val))) {
+			if (!strcmp(key, "anon")   || !strcmp(key, "slab")   ||
+			    !strcmp(key, "percpu") || !strcmp(key, "sock")   ||
+			    !strcmp(key, "kernel_stack") || !strcmp(key, "pagetables"))
+				cg->cg_rss += val;
+			else if (!strcmp(key, "file") || !strcmp(key, "file_mapped"))
+				cg->cg_vmlib += val;
 		}
-		fclose(fp);
 	}
 
-	cg->cg_memshare = (float)(cg->cg_rss * 100 / total_ram);
+	cg->cg_memshare = total_ram ? (float)cg->cg_rss * 100.0 / total_ram : 0.0;
 
-	return cg->cg_vmsize = cgroup_uint64(cg->cg_path, "memory.current");
+	cg->cg_vmsize = 0;
+	if (cg_read(cg, CG_MEM_CURRENT, buf, sizeof(buf)))
+		cg->cg_vmsize = strtoull(buf, NULL, 10);
+
+	return cg->cg_vmsize;
 }
 
 uint64_t cgroup_memory(char *group)
@@ -235,37 +388,76 @@ uint64_t cgroup_memory(char *group)
 	return cgroup_uint64(path, "memory.current");
 }
 
-static float cgroup_cpuload(struct cg *cg)
+/* Sum of rbytes and wbytes of all devices in io.stat */
+static uint64_t cgroup_io(struct cg *cg)
 {
-	char fn[256];
-	char buf[64];
-	FILE *fp;
+	char buf[4096], *ptr, *tok;
+	uint64_t sum = 0;
+
+	ptr = cg_read(cg, CG_IO_STAT, buf, sizeof(buf));
+	while (ptr && (tok = strsep(&ptr, " \n"))) {
+		if (!strncmp(tok, "rbytes=", 7))
+			sum += strtoull(&tok[7], NULL, 10);
+		else if (!strncmp(tok, "wbytes=", 7))
+			sum += strtoull(&tok[7], NULL, 10);
+	}
 
-	snprintf(fn, sizeof(fn), "%s/cpu.stat", cg->cg_path);
-	fp = fopen(fn, "r");
-	if (!fp)
-		ERR(72, "Cannot open %s", fn);
+	return sum;
+}
+
+/* Highest "some avg10" of cpu, memory, and io pressure */
+static float cgroup_psi(struct cg *cg)
+{
+	char buf[256], *ptr;
+	float max = 0.0;
 
-	while (fgets(buf, sizeof(buf), fp)) {
-		uint64_t curr;
+	for (int i = CG_CPU_PRESSURE; i <= CG_IO_PRESSURE; i++) {
+		float val;
 
-		chomp(buf);
-		if (strncmp(buf, "usage_usec", 10))
+		if (!cg_read(cg, i, buf, sizeof(buf)))
 			continue;
 
-		curr = strtoull(&buf[11], NULL, 10);
-		if (cg->cg_prev != 0) {
-			uint64_t diff = curr - cg->cg_prev;
+		ptr = strstr(buf, "avg10=");
+		if (!ptr)
+			continue;
+
+		val = strtof(&ptr[6], NULL);
+		if (val > max)
+			max = val;
+	}
 
-			/* this expects 1 sec poll interval */
-			cg->cg_load = (float)(diff / 1000000);
-			cg->cg_load *= 100.0;
+	return max;
+}
+
+/*
+ * Sample CPU and I/O usage, the rate is calculated using the actual
+ * time since the previous sample of the same group, any interval.
+ */
+static float cgroup_cpuload(struct cg *cg)
+{
+	char buf[512], *ptr, *key;
+	uint64_t now, curr = 0, io;
+	uint64_t val;
+
+	ptr = cg_read(cg, CG_CPU_STAT, buf, sizeof(buf));
+	while (ptr && (key = cg_next(&ptr, &val))) {
+		if (!strcmp(key, "usage_usec")) {
+			curr = val;
+			break;
 		}
-		cg->cg_prev = curr;
-		break;
 	}
 
-	fclose(fp);
+	io  = cgroup_io(cg);
+	now = now_usec();
+	if (cg->cg_stamp && now > cg->cg_stamp) {
+		uint64_t dt = now - cg->cg_stamp;
+
+		cg->cg_load = curr > cg->cg_prev ? (float)(curr - cg->cg_prev) * 100.0 / dt : 0.0;
+		cg->cg_io   = io > cg->cg_prev_io ? (float)(io - cg->cg_prev_io) * 1000000.0 / dt : 0.0;
+	}
+	cg->cg_stamp   = now;
+	cg->cg_prev    = curr;
+	cg->cg_prev_io = io;
 
 	return cg->cg_load;
 }
@@ -273,14 +465,18 @@ static float cgroup_cpuload(struct cg *cg)
 static struct cg *append(char *path)
 {
 	struct cg *cg;
-	char fn[256];
 	ENTRY item;
+	int fd;
 
-	snprintf(fn, sizeof(fn), "%s/cpu.stat", path);
-	if (access(fn, F_OK)) {
+	fd = openat(AT_FDCWD, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	if (faccessat(fd, "cpu.stat", F_OK, 0)) {
 		/* older kernels, 4.19, don't have summary cpu.stat in root */
 		if (strcmp(path, FINIT_CGPATH))
 			WARN("not a cgroup path with cpu controller, %s", path);
+		close(fd);
 		return NULL;
 	}
 
@@ -288,6 +484,10 @@ static struct cg *append(char *path)
 	if (!cg)
 		ERR(71, "failed allocating struct cg");
 
+	for (int i = 0; i < CG_FD_MAX; i++)
+		cg->cg_fd[i] = openat(fd, cg_files[i], O_RDONLY | O_CLOEXEC);
+	close(fd);
+
 	cg->cg_path = strdup(path);
 	if (list)
 		cg->cg_next = list;
@@ -321,8 +521,10 @@ struct cg *cg_stats(char *path)
 	if (!cg)
 		return &dummy;
 
+	cg->cg_gen = generation;
 	cgroup_cpuload(cg);
 	cgroup_memuse(cg);
+	cg->cg_psi = cgroup_psi(cg);
 
 	return cg;
 }
@@ -358,10 +560,26 @@ static int cgroup_filter(const struct dirent *entry)
 	return 1;
 }
 
+/* Columns of initctl top, see TOP_HEADING */
+static char *top_row(struct cg *cg, char *row, size_t len)
+{
+	char s[32], r[32], l[32], io[32];
+
+	snprintf(row, len, "\r %6.6s  %6.6s  %6.6s %5.1f %5.1f  %6.6s %5.1f  ",
+		 memsz(cg->cg_vmsize, s, sizeof(s)),
+		 memsz(cg->cg_rss,    r, sizeof(r)),
+		 memsz(cg->cg_vmlib,  l, sizeof(l)),
+		 cg->cg_memshare, cg->cg_load,
+		 memsz((uint64_t)cg->cg_io, io, sizeof(io)),
+		 cg->cg_psi);
+
+	return row;
+}
+
 int cgroup_tree(char *path, char *pfx, int mode, int pos)
 {
 	struct dirent **namelist = NULL;
-	char s[32], r[32], l[32];
+	char s[32];
 	char row[ttcols + 9];		/* + control codes */
 	size_t rlen = sizeof(row) - 1;
 	size_t rplen = rlen - 9;
@@ -395,12 +613,8 @@ int cgroup_tree(char *path, char *pfx, int mode, int pos)
 		pfx = "";
 		switch (mode) {
 		case 1:
-			cg = cg_stats(path);
-			snprintf(row, rplen, "\r %6.6s  %6.6s  %6.6s %5.1f %5.1f  %s",
-				 memsz(cg->cg_vmsize, s, sizeof(s)),
-				 memsz(cg->cg_rss,    r, sizeof(r)),
-				 memsz(cg->cg_vmlib,  l, sizeof(l)),
-				 cg->cg_memshare, cg->cg_load, path);
+			top_row(cg_stats(path), row, rplen);
+			strlcat(row, path, rplen);
 			break;
 		case 2:
 			cg = cg_conf(path);
@@ -423,7 +637,7 @@ int cgroup_tree(char *path, char *pfx, int mode, int pos)
 
 		i = 0;
 		while (fgets(buf, sizeof(buf), fp)) {
-			char comm[80] = { 0 };
+			char *comm, *args;
 			pid_t pid;
 
 			pid = atoi(chomp(buf));
@@ -431,13 +645,12 @@ int cgroup_tree(char *path, char *pfx, int mode, int pos)
 				continue;
 
 			/* skip kernel threads for now (no cmdline) */
-			pid_comm(pid, comm, sizeof(comm));
-			if (pid_cmdline(pid, buf, sizeof(buf))) {
+			if (!proc_get(pid, &comm, &args) && args) {
 				char proc[ttcols];
 
 				switch (mode) {
 				case 1:
-					snprintf(row, rplen, "\r%37s", " ");
+					snprintf(row, rplen, "\r%51s", " ");
 					break;
 				case 2:
 					snprintf(row, rplen, "\r --.-- [            ]        [            ] ");
@@ -450,7 +663,7 @@ int cgroup_tree(char *path, char *pfx, int mode, int pos)
 				strlcat(row, pfx, rplen);
 				strlcat(row, ++i == num ? END : FORK, rlen);
 
-				snprintf(proc, sizeof(proc), " %d %s %s", pid, comm, buf);
+				snprintf(proc, sizeof(proc), " %d %s %s", pid, comm, args);
 
 				if (plain) {
 					strlcat(row, proc, rplen);
@@ -489,13 +702,7 @@ int cgroup_tree(char *path, char *pfx, int mode, int pos)
 			snprintf(buf, sizeof(buf), "%s/%s", path, nm);
 			switch (mode) {
 			case 1:
-				cg = cg_stats(buf);
-				snprintf(row, rplen,
-					 "\r %6.6s  %6.6s  %6.6s %5.1f %5.1f  ",
-					 memsz(cg->cg_vmsize, s, sizeof(s)),
-					 memsz(cg->cg_rss,    r, sizeof(r)),
-					 memsz(cg->cg_vmlib,  l, sizeof(l)),
-					 cg->cg_memshare, cg->cg_load);
+				top_row(cg_stats(buf), row, rplen);
 				break;
 			case 2:
 				cg = cg_conf(buf);
@@ -549,15 +756,109 @@ int show_cgps(char *arg)
 	return cgroup_tree(arg, NULL, 0, 0);
 }
 
+#define TOP_HEADING " VmSIZE     RSS   VmLIB  %%MEM  %%CPU    IO/s  %%PSI  GROUP"
+
+static int sort_order = CG_SORT_TREE;
+
+/* Sample @path and all groups below it */
+static void collect(char *path)
+{
+	struct dirent **namelist = NULL;
+	char buf[512];
+	int i, n;
+
+	cg_stats(path);
+
+	n = scandir(path, &namelist, cgroup_filter, NULL);
+	if (n <= 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "%s/%s", path, namelist[i]->d_name);
+		collect(buf);
+		free(namelist[i]);
+	}
+	free(namelist);
+}
+
+/* Descending order */
+#define CMP(a, b) (((a) < (b)) - ((a) > (b)))
+
+static int cg_compare(const void *a, const void *b)
+{
+	const struct cg *x = *(const struct cg **)a;
+	const struct cg *y = *(const struct cg **)b;
+
+	switch (sort_order) {
+	case CG_SORT_CPU:
+		return CMP(x->cg_load, y->cg_load);
+	case CG_SORT_MEM:
+		return CMP(x->cg_vmsize, y->cg_vmsize);
+	case CG_SORT_RSS:
+		return CMP(x->cg_rss, y->cg_rss);
+	case CG_SORT_IO:
+		return CMP(x->cg_io, y->cg_io);
+	case CG_SORT_PSI:
+		return CMP(x->cg_psi, y->cg_psi);
+	}
+
+	return strcmp(x->cg_path, y->cg_path);
+}
+
+/* Flat listing of all groups below @path, sorted by the selected column */
+static void cgroup_sorted(char *path)
+{
+	struct cg **arr, *cg;
+	char row[ttcols + 9];
+	size_t num = 0, i;
+	size_t skip;
+
+	collect(path);
+
+	for (cg = list; cg; cg = cg->cg_next)
+		num++;
+
+	arr = calloc(num, sizeof(*arr));
+	if (!arr)
+		return;
+
+	num = 0;
+	for (cg = list; cg; cg = cg->cg_next) {
+		if (cg->cg_gen == generation)
+			arr[num++] = cg;
+	}
+	qsort(arr, num, sizeof(*arr), cg_compare);
+
+	skip = strlen(FINIT_CGPATH);
+	for (i = 0; i < num && (int)i < ttrows - 2; i++) {
+		char *nm = arr[i]->cg_path;
+
+		if (!strncmp(nm, FINIT_CGPATH, skip) && nm[skip])
+			nm += skip + 1;
+
+		top_row(arr[i], row, sizeof(row) - 9);
+		strlcat(row, nm, sizeof(row) - 9);
+		puts(row);
+	}
+
+	free(arr);
+}
+
 static void cgtop(uev_t *w, void *arg, int events)
 {
 	(void)w;
 	(void)events;
 
+	generation++;
 	fputs("\e[2J\e[1;1H", stdout);
 	if (heading)
-		print_header(" VmSIZE     RSS   VmLIB  %%MEM  %%CPU  GROUP");
-	cgroup_tree(arg, NULL, 1, 0);
+		print_header(TOP_HEADING);
+
+	if (sort_order == CG_SORT_TREE)
+		cgroup_tree(arg, NULL, 1, 0);
+	else
+		cgroup_sorted(arg);
+	fflush(stdout);
 }
 
 static void cleanup(void)
@@ -579,19 +880,39 @@ static void key(uev_t *w, void *arg, int events)
 {
 	char ch;
 
-	(void)arg;
 	(void)events;
 
 	if (read(w->fd, &ch, sizeof(ch)) != -1) {
 		switch (ch) {
 		case 'q':
 			uev_exit(w->ctx);
+			return;
+
+		case 't':
+			sort_order = CG_SORT_TREE;
+			break;
+		case 'c':
+			sort_order = CG_SORT_CPU;
+			break;
+		case 'm':
+			sort_order = CG_SORT_MEM;
+			break;
+		case 'r':
+			sort_order = CG_SORT_RSS;
+			break;
+		case 'i':
+			sort_order = CG_SORT_IO;
+			break;
+		case 'p':
+			sort_order = CG_SORT_PSI;
 			break;
 
 		default:
 			dbg("Got char 0x%02x", ch);
-			break;
+			return;
 		}
+
+		cgtop(w, arg, 0);
 	}
 }
 
@@ -601,6 +922,7 @@ int show_cgtop(char *arg)
         uev_t timer, input, sigint, sigterm, sigquit;
 	char path[512];
         uev_ctx_t ctx;
+	int first;
 
 	if (!arg)
 		arg = FINIT_CGPATH;
@@ -609,14 +931,20 @@ int show_cgtop(char *arg)
 		arg = path;
 	}
 
-	if (!hcreate(ttrows + 25))
+	/* Never full, hsearch() cannot grow */
+	if (!hcreate(4096))
 		ERR(70, "failed creating hash table");
 
 	sysinfo(&si);
 	total_ram = si.totalram * si.mem_unit;
 
+	/* First sample, so the first listing has rates */
+	generation++;
+	collect(arg);
+	first = ionce ? interval : MIN(interval, 250);
+
         uev_init(&ctx);
-        uev_timer_init(&ctx, &timer, cgtop, arg, 1, ionce ? 0 : 1000);
+        uev_timer_init(&ctx, &timer, cgtop, arg, first, ionce ? 0 : interval);
 
 	if (!ionce && !plain) {
 		int flags;
@@ -628,7 +956,7 @@ int show_cgtop(char *arg)
 		flags = fcntl(STDIN_FILENO, F_GETFL);
 		if (flags != -1)
 			(void)fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
-		(void)uev_io_init(&ctx, &input, key, NULL, STDIN_FILENO, UEV_READ);
+		(void)uev_io_init(&ctx, &input, key, arg, STDIN_FILENO, UEV_READ);
 
 		(void)uev_signal_init(&ctx, &sigint, leave, NULL, SIGINT);
 		(void)uev_signal_init(&ctx, &sigterm, leave, NULL, SIGTERM);
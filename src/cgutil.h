@@ -27,17 +27,45 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+/* Stat files kept open by cg_stats(), re-read with pread() */
+enum {
+	CG_CPU_STAT = 0,
+	CG_MEM_STAT,
+	CG_MEM_CURRENT,
+	CG_IO_STAT,
+	CG_CPU_PRESSURE,
+	CG_MEM_PRESSURE,
+	CG_IO_PRESSURE,
+	CG_FD_MAX
+};
+
+/* Sort order of initctl top, see show_cgtop() */
+enum {
+	CG_SORT_TREE = 0,
+	CG_SORT_CPU,
+	CG_SORT_MEM,
+	CG_SORT_RSS,
+	CG_SORT_IO,
+	CG_SORT_PSI,
+};
+
 struct cg {
 	struct cg *cg_next;
+	unsigned   cg_gen;		/* Last refresh seen in     */
 
 	/* stats */
 	char      *cg_path;		/* path in /sys/fs/cgroup   */
-	uint64_t   cg_prev;		/* cpuacct.usage            */
+	int        cg_fd[CG_FD_MAX];	/* -1 if missing            */
+	uint64_t   cg_stamp;		/* usec, CLOCK_MONOTONIC    */
+	uint64_t   cg_prev;		/* cpu.stat usage_usec      */
+	uint64_t   cg_prev_io;		/* io.stat rbytes + wbytes  */
 	uint64_t   cg_rss;		/* memory.stat              */
 	uint64_t   cg_vmlib;		/* memory.stat              */
 	uint64_t   cg_vmsize;		/* memory.current           */
 	float      cg_memshare;		/* cg_rss / total_ram * 100 */
-	float      cg_load;		/* curr - prev / 10000000.0 */
+	float      cg_load;		/* %CPU since last sample   */
+	float      cg_io;		/* bytes/s since last sample */
+	float      cg_psi;		/* max some avg10 of cpu, memory, io */
 
 	/* config */
 	struct {
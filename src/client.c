@@ -23,6 +23,9 @@
 
 #include <errno.h>
 #include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -153,30 +156,95 @@ int client_command(int cmd)
 	return client_request(&rq, sizeof(rq));
 }
 
+/*
+ * Relocate a string pointer in a received svc_t, from the address space
+ * of finit to our copy of the strings.
+ */
+static char *reloc(svc_t *svc, char *strings, char *ptr)
+{
+	uintptr_t off = (uintptr_t)ptr - (uintptr_t)svc->strings;
+
+	if (off >= svc->strings_len)
+		return "";
+
+	return &strings[off];
+}
+
+/*
+ * The svc_t is followed by a message with its command line args and
+ * strings, all pointers are relocated to our copy in @strings.
+ */
+static int recv_svc(svc_t *svc, char **strings)
+{
+	size_t i, max;
+	char *ptr;
+
+	if (read(sd, svc, sizeof(*svc)) != sizeof(*svc))
+		return -1;
+	if (svc->pid < 0)
+		return 0;
+
+	max = svc->strings_len / sizeof(char *);
+	if (!max) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	ptr = realloc(*strings, svc->strings_len);
+	if (!ptr)
+		return -1;
+	*strings = ptr;
+
+	if (read(sd, ptr, svc->strings_len) != (ssize_t)svc->strings_len)
+		return -1;
+	ptr[svc->strings_len - 1] = 0;
+
+	svc->args = (char **)ptr;
+	for (i = 0; i < max - 1 && svc->args[i]; i++)
+		svc->args[i] = reloc(svc, ptr, svc->args[i]);
+	svc->args[i] = NULL;
+
+	svc->desc         = reloc(svc, ptr, svc->desc);
+	svc->env          = reloc(svc, ptr, svc->env);
+	svc->pre_script   = reloc(svc, ptr, svc->pre_script);
+	svc->post_script  = reloc(svc, ptr, svc->post_script);
+	svc->ready_script = reloc(svc, ptr, svc->ready_script);
+	svc->listen       = reloc(svc, ptr, svc->listen);
+	svc->status_msg   = reloc(svc, ptr, svc->status_msg);
+	svc->path         = reloc(svc, ptr, svc->path);
+	svc->strings      = ptr;
+
+	return 0;
+}
+
 svc_t *client_svc_iterator(int first)
 {
 	struct init_request rq = {
 		.magic = INIT_MAGIC,
 		.cmd   = INIT_CMD_SVC_ITER,
 	};
+	static char *strings;
 	static svc_t svc;
 
-	if (client_connect() == -1)
-		return NULL;
-
-	if (first)
+	/* Finit keeps the iterator per connection, until the last service */
+	if (first) {
+		if (sd >= 0)
+			client_disconnect();
+		if (client_connect() == -1)
+			return NULL;
 		rq.runlevel = 1;
-	else
-		rq.runlevel = 0;
+	} else if (sd < 0)
+		return NULL;
 
 	if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
 		goto error;
-	if (read(sd, &svc, sizeof(svc)) != sizeof(svc))
+	if (recv_svc(&svc, &strings))
 		goto error;
 
-	client_disconnect();
-	if (svc.pid < 0)
+	if (svc.pid < 0) {
+		client_disconnect();
 		return NULL;
+	}
 
 	return &svc;
 error:
@@ -187,12 +255,165 @@ error:
 	return NULL;
 }
 
+/*
+ * Unpack a brief status record to a svc_t, all strings point into the
+ * record, which is valid until the next one is read.
+ */
+static int recv_rec(svc_t *svc, struct svc_rec **rec, size_t *sz, char ***args, size_t *nargs)
+{
+	char *ptr, *end;
+	ssize_t len;
+	size_t num;
+
+	/* Size of next record, without consuming it */
+	len = recv(sd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+	if (len < (ssize_t)sizeof(**rec)) {
+		errno = len < 0 ? errno : EBADMSG;
+		return -1;
+	}
+
+	if ((size_t)len > *sz) {
+		void *tmp;
+
+		tmp = realloc(*rec, len);
+		if (!tmp)
+			return -1;
+		*rec = tmp;
+		*sz  = len;
+	}
+
+	len = read(sd, *rec, *sz);
+	if (len < (ssize_t)sizeof(**rec) || (*rec)->len != (size_t)len) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	memset(svc, 0, sizeof(*svc));
+	*((pid_t *)&svc->pid) = (*rec)->pid;
+	if (svc->pid < 0)
+		return 0;
+
+	*((svc_state_t *)&svc->state) = (*rec)->state;
+	svc->status      = (*rec)->status;
+	svc->runlevels   = (*rec)->runlevels;
+	svc->restart_tot = (*rec)->restart_tot;
+	svc->type        = (*rec)->type;
+	svc->block       = (*rec)->block;
+	svc->started     = (*rec)->started;
+	svc->manual      = (*rec)->manual;
+
+	ptr = (*rec)->strings;
+	end = (char *)*rec + len;
+	end[-1] = 0;
+
+	strlcpy(svc->name, ptr, sizeof(svc->name));
+	ptr += strlen(ptr) + 1;
+	if (ptr < end) {
+		strlcpy(svc->id, ptr, sizeof(svc->id));
+		ptr += strlen(ptr) + 1;
+	}
+	svc->desc = ptr < end ? ptr : "";
+	ptr += strlen(svc->desc) + 1;
+
+	for (num = 0; ptr < end && *ptr; num++) {
+		if (num + 1 >= *nargs) {
+			char **tmp;
+
+			tmp = realloc(*args, (*nargs + 16) * sizeof(char *));
+			if (!tmp)
+				return -1;
+			*args = tmp;
+			*nargs += 16;
+		}
+		(*args)[num] = ptr;
+		ptr += strlen(ptr) + 1;
+	}
+	if (!*args) {
+		*args = calloc(1, sizeof(char *));
+		if (!*args)
+			return -1;
+		*nargs = 1;
+	}
+	(*args)[num] = NULL;
+
+	svc->args = *args;
+	if (num)
+		strlcpy(svc->cmd, svc->args[0], sizeof(svc->cmd));
+	svc->env = svc->pre_script = svc->post_script = svc->ready_script = "";
+
+	return 0;
+}
+
+/**
+ * client_svc_dump - Iterate over all services using a single request
+ * @first:   Non-zero to send request, zero for next service
+ * @full:    Non-zero for complete svc_t, otherwise brief status only
+ * @types:   Filter on type(s) of service, e.g. %SVC_TYPE_SERVICE, 0 for all
+ * @filter:  Optional name, or name:id, of services
+ *
+ * Unlike client_svc_iterator(), which needs a connection, and a full
+ * svc_t, per service, Finit streams all services in one go.  With
+ * brief records only the fields for `initctl status` are set.
+ *
+ * Returns:
+ * Pointer to next service, valid until next call, or %NULL at the end.
+ */
+svc_t *client_svc_dump(int first, int full, int types, const char *filter)
+{
+	static struct svc_rec *rec;
+	static char *strings;
+	static size_t sz, nargs;
+	static char **args;
+	static svc_t svc;
+	int rc;
+
+	if (first) {
+		struct init_request rq = {
+			.magic     = INIT_MAGIC,
+			.cmd       = INIT_CMD_SVC_DUMP,
+			.runlevel  = full ? SVC_DUMP_FULL : SVC_DUMP_BRIEF,
+			.sleeptime = types,
+		};
+
+		if (sd >= 0)
+			client_disconnect();
+		if (client_connect() == -1)
+			return NULL;
+
+		if (filter)
+			strlcpy(rq.data, filter, sizeof(rq.data));
+		if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
+			goto error;
+	} else if (sd < 0)
+		return NULL;
+
+	if (full)
+		rc = recv_svc(&svc, &strings);
+	else
+		rc = recv_rec(&svc, &rec, &sz, &args, &nargs);
+	if (rc)
+		goto error;
+
+	if (svc.pid < 0) {
+		client_disconnect();
+		return NULL;
+	}
+
+	return &svc;
+error:
+	warn("Failed communicating with finit, error %d", errno);
+	client_disconnect();
+
+	return NULL;
+}
+
 static svc_t *do_find(int cmd, const char *arg)
 {
 	struct init_request rq = {
 		.magic = INIT_MAGIC,
 		.cmd   = cmd,
 	};
+	static char *strings;
 	static svc_t svc;
 
 	if (client_connect() == -1)
@@ -201,7 +422,7 @@ static svc_t *do_find(int cmd, const char *arg)
 	strlcpy(rq.data, arg, sizeof(rq.data));
 	if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
 		goto error;
-	if (read(sd, &svc, sizeof(svc)) != sizeof(svc))
+	if (recv_svc(&svc, &strings))
 		goto error;
 
 	client_disconnect();
@@ -36,6 +36,7 @@ int    client_send             (struct init_request *rq, ssize_t len);
 int    client_command          (int cmd);
 
 svc_t *client_svc_iterator     (int first);
+svc_t *client_svc_dump         (int first, int full, int types, const char *filter);
 svc_t *client_svc_find         (const char *arg);
 svc_t *client_svc_find_by_cond (const char *arg);
 
@@ -22,9 +22,13 @@
  */
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <ftw.h>
 #include <libgen.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 #else
@@ -33,9 +37,14 @@
 
 #include "finit.h"
 #include "cond.h"
+#include "metrics.h"
 #include "pid.h"
+#include "private.h"
+#include "schedule.h"
 #include "service.h"
 #include "sm.h"
+#include "trace.h"
+#include "util.h"
 
 struct cond_boot {
 	TAILQ_ENTRY(cond_boot) link;
@@ -43,6 +52,83 @@ struct cond_boot {
 };
 static TAILQ_HEAD(, cond_boot) cond_boot_list = TAILQ_HEAD_INITIALIZER(cond_boot_list);
 
+/*
+ * Reverse index from a condition to all services depending on it, so
+ * a condition change only touches the services that are affected.
+ * Condition names are interned on first use, nodes are freed again
+ * when no service depends on them and the condition is off.
+ *
+ * Each node also caches the state of the condition.  The file system
+ * in /run/finit/cond is written through on every change, for initctl
+ * and other external readers, but never read back unless a condition
+ * is changed behind our back, e.g. by initctl or keventd, after which
+ * the usr/sys plugins call cond_update() to invalidate the cache.
+ */
+struct cond_node {
+	LIST_ENTRY(cond_node)  link;
+	TAILQ_HEAD(, cond_dep) deps;
+	TAILQ_ENTRY(cond_node) flux_link;
+
+	int                    cached;	/* gen and oneshot are valid */
+	int                    oneshot;	/* symlink to reconf, always on */
+	unsigned int           gen;	/* generation, 0: off */
+	int                    flux;	/* on flux_list, see cond_reload() */
+	int                    busy;	/* being reasserted, do not free */
+	int                    slot;	/* entry in shm table, -1: none */
+	char                   name[];
+};
+
+/* Cached generation of _PATH_RECONF, 0: not read yet */
+static unsigned int reconf_gen;
+
+/* Conditions put in flux by cond_reload(), waiting to be reasserted */
+static TAILQ_HEAD(, cond_node) flux_list = TAILQ_HEAD_INITIALIZER(flux_list);
+
+/* Published condition table, see cond.h */
+static struct cond_shm *shm;
+static uint16_t         shm_free[COND_SHM_MAX];	/* released slots */
+static int              shm_nfree;
+
+static enum cond_state cond_cache_state(struct cond_node *node);
+
+struct cond_dep {
+	TAILQ_ENTRY(cond_dep) link;	/* all dependents of a condition */
+	struct cond_dep      *next;	/* next condition of the same svc */
+	struct cond_node     *node;
+	svc_t                *svc;
+	int                   watch;	/* only step svc, e.g. if:<cond> */
+};
+
+#define COND_BUCKETS 256
+static LIST_HEAD(, cond_node) cond_index[COND_BUCKETS];
+
+/*
+ * Debounced conditions, `debounce PREFIX TIME` in finit.conf.  Edges of
+ * a condition matching PREFIX are held back until it has been stable
+ * for TIME, so a flapping link only changes the condition, and stops or
+ * starts its dependents, once.  All pending edges share one timer.
+ */
+struct cond_debounce {
+	TAILQ_ENTRY(cond_debounce) link;
+	int                  msec;
+	size_t               len;
+	char                 prefix[];
+};
+
+struct cond_pending {
+	TAILQ_ENTRY(cond_pending) link;
+	long long            expires;	/* msec CLOCK_MONOTONIC */
+	enum cond_state      state;	/* latest edge, applied on expiry */
+	char                 name[];
+};
+
+static TAILQ_HEAD(, cond_debounce) debounce_list = TAILQ_HEAD_INITIALIZER(debounce_list);
+static TAILQ_HEAD(, cond_pending)  pending_list  = TAILQ_HEAD_INITIALIZER(pending_list);
+
+static void debounce_cb(void *arg);
+static struct wq debounce_work = { .cb = debounce_cb };
+static long long debounce_next;	/* when debounce_work expires */
+
 
 /*
  * Parse finit.cond=cond[,cond[,...]] from command line.  It creates a
@@ -164,6 +250,14 @@ static int cond_set_gen(const char *file, unsigned int gen)
 	return (ret > 0) ? 0 : ret;
 }
 
+static unsigned int cond_reconf_gen(void)
+{
+	if (!reconf_gen)
+		reconf_gen = cond_get_gen(_PATH_RECONF);
+
+	return reconf_gen;
+}
+
 static void cond_bump_reconf(void)
 {
 	unsigned int rgen;
@@ -172,11 +266,14 @@ static void cond_bump_reconf(void)
 	 * If %_PATH_RECONF does not exist, cond_get_gen() returns 0
 	 * meaning that rgen++ is always what we want.
 	 */
-	rgen = cond_get_gen(_PATH_RECONF);
+	rgen = cond_reconf_gen();
 	rgen++;
 
-	if (cond_set_gen(_PATH_RECONF, rgen))
+	if (cond_set_gen(_PATH_RECONF, rgen)) {
 		err(1, "Failed setting %s to gen %d", _PATH_RECONF, rgen);
+		return;
+	}
+	reconf_gen = rgen;
 }
 
 static int cond_checkpath(const char *path)
@@ -238,25 +335,283 @@ static void cond_delpath(const char *path)
 	}
 }
 
+static struct cond_node *cond_node_find(const char *name, int create)
+{
+	struct cond_node *node;
+	unsigned int hash;
+	size_t len;
+
+	hash = strhash(STRHASH_INIT, name) & (COND_BUCKETS - 1);
+	LIST_FOREACH(node, &cond_index[hash], link) {
+		if (!strcmp(node->name, name))
+			return node;
+	}
+
+	if (!create)
+		return NULL;
+
+	len = strlen(name) + 1;
+	node = calloc(1, sizeof(*node) + len);
+	if (!node)
+		return NULL;
+
+	memcpy(node->name, name, len);
+	node->slot = -1;
+	TAILQ_INIT(&node->deps);
+	LIST_INSERT_HEAD(&cond_index[hash], node, link);
+
+	return node;
+}
+
+static void shm_write_begin(void)
+{
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void shm_write_end(void)
+{
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Publish the cached state of a condition to the shm table.  Slots are
+ * only held by conditions that are on, or in flux, so the table holds
+ * the same conditions as /run/finit/cond.  The slot of a condition that
+ * is cleared is emptied, readers skip it, and reused for the next one.
+ */
+static void cond_shm_publish(struct cond_node *node)
+{
+	struct cond_shm_ent *ent;
+	enum cond_state state;
+
+	if (!shm)
+		return;
+
+	state = cond_cache_state(node);
+	if (node->slot < 0) {
+		if (state == COND_OFF || shm->overflow)
+			return;
+
+		if (shm_nfree > 0) {
+			shm_write_begin();
+			node->slot = shm_free[--shm_nfree];
+			ent = &shm->ent[node->slot];
+			strlcpy(ent->name, node->name, sizeof(ent->name));
+			ent->state = state;
+			shm_write_end();
+			return;
+		}
+
+		if (shm->num >= COND_SHM_MAX) {
+			warnx("Too many conditions for %s, readers fall back to %s",
+			      _PATH_CONDSHM, _PATH_COND);
+			shm_write_begin();
+			shm->overflow = 1;
+			shm_write_end();
+			return;
+		}
+
+		shm_write_begin();
+		node->slot = shm->num;
+		ent = &shm->ent[node->slot];
+		strlcpy(ent->name, node->name, sizeof(ent->name));
+		ent->state = state;
+		shm->num++;
+		shm_write_end();
+		return;
+	}
+
+	ent = &shm->ent[node->slot];
+	if (state == COND_OFF) {
+		shm_write_begin();
+		ent->state = COND_OFF;
+		ent->name[0] = 0;
+		shm_write_end();
+		shm_free[shm_nfree++] = node->slot;
+		node->slot = -1;
+		return;
+	}
+
+	if (ent->state == state)
+		return;
+
+	shm_write_begin();
+	ent->state = state;
+	shm_write_end();
+}
+
+static void cond_shm_init(void)
+{
+	char path[MAX_ARG_LEN];
+	char *file;
+	void *ptr;
+	int fd;
+
+	file = pid_runpath(_PATH_CONDSHM, path, sizeof(path));
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		err(1, "Failed creating condition table %s", file);
+		return;
+	}
+
+	if (ftruncate(fd, sizeof(*shm))) {
+		err(1, "Failed sizing condition table %s", file);
+		close(fd);
+		return;
+	}
+
+	ptr = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		err(1, "Failed mapping condition table %s", file);
+		return;
+	}
+
+	shm = ptr;
+	shm->magic = COND_SHM_MAGIC;
+}
+
+static void cond_unflux(struct cond_node *node)
+{
+	if (!node->flux)
+		return;
+
+	TAILQ_REMOVE(&flux_list, node, flux_link);
+	node->flux = 0;
+}
+
+static void cond_cache_load(struct cond_node *node)
+{
+	const char *path;
+	struct stat st;
+
+	node->oneshot = 0;
+	node->gen = 0;
+
+	path = cond_path(node->name);
+	if (!lstat(path, &st)) {
+		if (S_ISLNK(st.st_mode))
+			node->oneshot = 1;
+		else if (S_ISREG(st.st_mode))
+			node->gen = cond_get_gen(path);
+	}
+
+	node->cached = 1;
+	cond_shm_publish(node);
+}
+
+static struct cond_node *cond_cache(const char *name)
+{
+	struct cond_node *node;
+
+	node = cond_node_find(name, 1);
+	if (node && !node->cached)
+		cond_cache_load(node);
+
+	return node;
+}
+
+/*
+ * Free a node nobody depends on once its condition is off, otherwise
+ * every name ever set or cleared, e.g., pid/ conditions of instances
+ * that come and go, would be kept for the lifetime of PID 1.
+ */
+static void cond_node_gc(struct cond_node *node)
+{
+	if (!node || !TAILQ_EMPTY(&node->deps) || node->flux || node->busy)
+		return;
+	if (node->slot >= 0)
+		return;
+	if (node->cached && (node->oneshot || node->gen))
+		return;
+
+	LIST_REMOVE(node, link);
+	free(node);
+}
+
+static enum cond_state cond_cache_state(struct cond_node *node)
+{
+	unsigned int rgen;
+
+	rgen = cond_reconf_gen();
+	if (!rgen)
+		return COND_OFF;
+
+	if (node->oneshot)
+		return COND_ON;
+	if (!node->gen)
+		return COND_OFF;
+
+	return (node->gen == rgen) ? COND_ON : COND_FLUX;
+}
+
+/* From /run/finit/cond/foo/bar to foo/bar */
+static const char *cond_name(const char *path)
+{
+	const char *ptr;
+
+	ptr = strstr(path, COND_BASE "/");
+	if (!ptr)
+		return NULL;
+
+	return ptr + strlen(COND_BASE) + 1;
+}
+
+/*
+ * Read path, only conditions already known are cached.  Otherwise any
+ * name queried would add a node that is never freed.
+ */
+enum cond_state cond_get(const char *name)
+{
+	struct cond_node *node;
+
+	if (!name)
+		return COND_OFF;
+
+	node = cond_node_find(name, 0);
+	if (!node)
+		return cond_get_path(cond_path(name));
+	if (!node->cached)
+		cond_cache_load(node);
+
+	return cond_cache_state(node);
+}
+
 int cond_set_path(const char *path, enum cond_state next)
 {
+	struct cond_node *node = NULL;
 	enum cond_state prev;
+	const char *name;
 	unsigned int rgen;
 
 	dbg("%s <= %d", path, next);
-	prev = cond_get_path(path);
+	name = cond_name(path);
+	if (name)
+		node = cond_cache(name);
+	if (node)
+		prev = cond_cache_state(node);
+	else
+		prev = cond_get_path(path);
 
 	switch (next) {
 	case COND_ON:
 		if (cond_checkpath(path))
 		    return 0;
 
-		rgen = cond_get_gen(_PATH_RECONF);
+		rgen = cond_reconf_gen();
 		if (!rgen) {
 			errx(1, "Unable to read configuration generation (%s)", path);
 			return -1;
 		}
-		cond_set_gen(path, rgen);
+		if (cond_set_gen(path, rgen)) {
+			err(1, "Failed setting condition %s", path);
+			if (node)
+				node->cached = 0;
+			return 0;
+		}
+		if (node)
+			node->gen = rgen;
 		break;
 
 	case COND_OFF:
@@ -272,6 +627,10 @@ int cond_set_path(const char *path, enum cond_state next)
 				break;
 			}
 		}
+		if (node) {
+			node->oneshot = 0;
+			node->gen = 0;
+		}
 		break;
 
 	default:
@@ -279,34 +638,484 @@ int cond_set_path(const char *path, enum cond_state next)
 		return 0;
 	}
 
-	return next != prev;
+	if (node) {
+		cond_unflux(node);
+		cond_shm_publish(node);
+		cond_node_gc(node);
+	}
+
+	if (next == prev)
+		return 0;
+
+	metrics.cond_flips++;
+	TRACE3(cond, name ?: path, prev, next);
+	api_event(INIT_EVENT_COND, name ?: path, next, prev, 0);
+	return 1;
 }
 
-/* Should only be used by cond_set*(), cond_clear(), and usr/sys plugins! */
-int cond_update(const char *name)
+static int cond_dep_new(svc_t *svc, const char *name, int watch)
 {
-	svc_t *svc, *iter = NULL;
-	int affects = 0;
+	struct cond_node *node;
+	struct cond_dep *dep;
 
-	dbg("%s", name);
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
-		if (!svc_has_cond(svc) || !cond_affects(name, svc->cond))
+	if (!svc || !name || !name[0]) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	node = cond_node_find(name, 1);
+	if (!node)
+		goto fail;
+
+	for (dep = svc->cond_deps; dep; dep = dep->next) {
+		if (dep->node != node)
 			continue;
 
+		if (!watch)
+			dep->watch = 0;
+		return 0;
+	}
+
+	dep = malloc(sizeof(*dep));
+	if (!dep)
+		goto fail;
+
+	dep->svc   = svc;
+	dep->node  = node;
+	dep->watch = watch;
+	dep->next  = svc->cond_deps;
+	svc->cond_deps = dep;
+	TAILQ_INSERT_TAIL(&node->deps, dep, link);
+
+	return 0;
+fail:
+	err(1, "Failed indexing condition %s for %s", name, svc_ident(svc, NULL, 0));
+	return -1;
+}
+
+/**
+ * cond_dep_add - Register service as depending on a condition
+ * @svc:  Service with @name in its list of conditions
+ * @name: Condition name, e.g. "net/route/default"
+ *
+ * Called by conf_parse_cond() for each condition in the service's
+ * condition list.  Registering the same condition twice is a no-op.
+ *
+ * Returns:
+ * POSIX OK(0), or -1 on error with @errno set.
+ */
+int cond_dep_add(svc_t *svc, const char *name)
+{
+	return cond_dep_new(svc, name, 0);
+}
+
+/**
+ * cond_dep_watch - Step service when a condition changes
+ * @svc:  Service to step
+ * @name: Condition name
+ *
+ * Like cond_dep_add(), but @name is not one of the conditions of @svc,
+ * e.g., a condition in an if:<cond> statement evaluated at runtime.
+ *
+ * Returns:
+ * POSIX OK(0), or -1 on error with @errno set.
+ */
+int cond_dep_watch(svc_t *svc, const char *name)
+{
+	return cond_dep_new(svc, name, 1);
+}
+
+/**
+ * cond_dep_del - Drop service from all conditions it depends on
+ * @svc: Service to drop
+ *
+ * Called before the condition list of a service is parsed again, and
+ * when the service is removed.
+ */
+void cond_dep_del(svc_t *svc)
+{
+	struct cond_dep *dep, *next;
+
+	if (!svc)
+		return;
+
+	for (dep = svc->cond_deps; dep; dep = next) {
+		next = dep->next;
+		TAILQ_REMOVE(&dep->node->deps, dep, link);
+		cond_node_gc(dep->node);
+		free(dep);
+	}
+	svc->cond_deps = NULL;
+}
+
+/**
+ * cond_dep_iterator - Iterate over all services depending on a condition
+ * @iter:  Iterator, must be a valid pointer
+ * @first: If set, get first &svc_t, otherwise get next
+ * @name:  Condition name, only used when @first is set
+ *
+ * Returns:
+ * The next &svc_t depending on @name, or %NULL when no more entries.
+ */
+svc_t *cond_dep_iterator(struct cond_dep **iter, int first, const char *name)
+{
+	struct cond_dep *dep;
+
+	if (!iter) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (first) {
+		struct cond_node *node;
+
+		node = name ? cond_node_find(name, 0) : NULL;
+		dep = node ? TAILQ_FIRST(&node->deps) : NULL;
+	} else
+		dep = *iter;
+
+	if (!dep) {
+		*iter = NULL;
+		return NULL;
+	}
+
+	*iter = TAILQ_NEXT(dep, link);
+
+	return dep->svc;
+}
+
+/**
+ * cond_svc_iterator - Iterate over all conditions of a service
+ * @iter:  Iterator, must be a valid pointer
+ * @first: If set, get first condition, otherwise get next
+ * @svc:   Service, only used when @first is set
+ *
+ * Returns:
+ * The name of the next condition, or %NULL when no more entries.
+ */
+const char *cond_svc_iterator(struct cond_dep **iter, int first, svc_t *svc)
+{
+	struct cond_dep *dep;
+
+	if (!iter) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (first)
+		dep = svc ? svc->cond_deps : NULL;
+	else
+		dep = *iter;
+
+	while (dep && dep->watch)
+		dep = dep->next;
+
+	if (!dep) {
+		*iter = NULL;
+		return NULL;
+	}
+
+	*iter = dep->next;
+
+	return dep->node->name;
+}
+
+/**
+ * cond_svc_has - Check if a service depends on a condition
+ * @svc:  Service to check
+ * @name: Condition name
+ *
+ * Returns:
+ * %TRUE(1) if @name is one of the conditions of @svc, otherwise %FALSE(0)
+ */
+int cond_svc_has(svc_t *svc, const char *name)
+{
+	struct cond_node *node;
+	struct cond_dep *dep;
+
+	if (!svc || !name)
+		return 0;
+
+	node = cond_node_find(name, 0);
+	if (!node)
+		return 0;
+
+	for (dep = svc->cond_deps; dep; dep = dep->next) {
+		if (dep->node == node && !dep->watch)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * cond_get_svc - Get aggregated state of all conditions of a service
+ * @svc: Service to check
+ *
+ * Like cond_get_agg(), but runs over the conditions compiled by
+ * conf_parse_cond() instead of splitting the svc->cond string.
+ *
+ * Returns:
+ * The lowest state of all conditions, %COND_ON if @svc has none.
+ */
+enum cond_state cond_get_svc(svc_t *svc)
+{
+	enum cond_state s = COND_ON;
+	struct cond_dep *dep;
+
+	if (!svc)
+		return COND_ON;
+
+	for (dep = svc->cond_deps; s && dep; dep = dep->next) {
+		struct cond_node *node = dep->node;
+
+		if (dep->watch)
+			continue;
+		if (!node->cached)
+			cond_cache_load(node);
+
+		s = min(s, cond_cache_state(node));
+	}
+
+	return s;
+}
+
+/*
+ * Step all services depending on @name, or with @batch, add them to
+ * the run queue to be stepped once, later, see cond_batch().
+ */
+static int cond_notify_svc(const char *name, int batch)
+{
+	struct cond_dep *iter = NULL;
+	int affects = 0;
+	svc_t *svc;
+
+	for (svc = cond_dep_iterator(&iter, 1, name); svc; svc = cond_dep_iterator(&iter, 0, NULL)) {
 		affects++;
 		dbg("%s: match <%s> %s(%s)", name ?: "nil", svc->cond, svc->desc, svc->cmd);
 		/* Fix bug #314: race condition between crashing services and conditions */
-		if (svc_is_restart(svc) && cond_get_agg(svc->cond) == COND_OFF) {
+		if (svc_is_restart(svc) && cond_get_svc(svc) == COND_OFF) {
 			dbg("%s: cancel timer & unblock => WAITING state.", name ?: "nil");
 			service_timeout_cancel(svc);
 			svc_unblock(svc);
 		}
-		service_step(svc);
+		if (batch)
+			service_schedule(svc);
+		else
+			service_step(svc);
 	}
 
 	return affects;
 }
 
+static int cond_notify(const char *name)
+{
+	return cond_notify_svc(name, 0);
+}
+
+/*
+ * Should only be used by usr/sys plugins, and when conditions have been
+ * removed from the file system.  The cached state of the condition is
+ * read back from the file system before stepping affected services,
+ * unless it is unchanged, e.g., a condition set by cond_batch() or
+ * cond_set_oneshot().
+ *
+ * Returns number of affected services, or -1 if unchanged, so the sys
+ * plugin does not remove conditions asserted by Finit itself.
+ */
+int cond_update(const char *name)
+{
+	struct cond_node *node;
+
+	dbg("%s", name);
+	if (name) {
+		node = cond_node_find(name, 0);
+		if (node) {
+			enum cond_state prev = COND_OFF;
+			int cached = node->cached;
+			int same;
+
+			if (cached)
+				prev = cond_cache_state(node);
+			cond_cache_load(node);
+			same = cached && prev == cond_cache_state(node);
+			cond_node_gc(node);
+			if (same) {
+				dbg("%s: unchanged", name);
+				return -1;
+			}
+		}
+	}
+
+	return cond_notify(name);
+}
+
+static long long msec_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * cond_debounce_add - Parse debounce line from /etc/finit.conf
+ * @arg: PREFIX TIME, where TIME is in seconds, or msec with ms suffix
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on invalid syntax.
+ */
+int cond_debounce_add(char *arg)
+{
+	struct cond_debounce *db;
+	char *prefix, *time, *ptr;
+	long msec;
+
+	prefix = strtok(arg, " \t");
+	time   = strtok(NULL, " \t");
+	if (!prefix || !time)
+		goto invalid;
+
+	msec = strtol(time, &ptr, 10);
+	if (!*ptr || !strcmp(ptr, "s"))
+		msec *= 1000;
+	else if (strcmp(ptr, "ms"))
+		goto invalid;
+	if (msec <= 0 || msec > 60000)
+		goto invalid;
+
+	db = malloc(sizeof(*db) + strlen(prefix) + 1);
+	if (!db) {
+		err(1, "Failed allocating debounce %s", prefix);
+		return 1;
+	}
+
+	db->msec = (int)msec;
+	db->len  = strlen(prefix);
+	strcpy(db->prefix, prefix);
+	TAILQ_INSERT_TAIL(&debounce_list, db, link);
+	dbg("Debouncing %s conditions %ld msec", prefix, msec);
+
+	return 0;
+invalid:
+	logit(LOG_WARNING, "Invalid debounce setting '%s %s'", prefix ?: "", time ?: "");
+	return 1;
+}
+
+static void debounce_schedule(long long expires)
+{
+	long long now = msec_now();
+
+	cancel_work(&debounce_work);
+	debounce_next = expires;
+	debounce_work.delay = expires > now ? (int)(expires - now) : 0;
+	schedule_work(&debounce_work);
+}
+
+/* Apply the final state of all edges that have settled */
+static void debounce_cb(void *arg)
+{
+	TAILQ_HEAD(, cond_pending) due = TAILQ_HEAD_INITIALIZER(due);
+	struct cond_pending *p, *tmp;
+	long long now = msec_now();
+	long long next = 0;
+
+	(void)arg;
+
+	TAILQ_FOREACH_SAFE(p, &pending_list, link, tmp) {
+		if (p->expires > now) {
+			if (!next || p->expires < next)
+				next = p->expires;
+			continue;
+		}
+
+		TAILQ_REMOVE(&pending_list, p, link);
+		TAILQ_INSERT_TAIL(&due, p, link);
+	}
+	if (next)
+		debounce_schedule(next);
+
+	/* Dependents may set conditions, which must not touch this list */
+	TAILQ_FOREACH_SAFE(p, &due, link, tmp) {
+		int rc;
+
+		TAILQ_REMOVE(&due, p, link);
+		if (p->state == COND_ON)
+			rc = cond_set_noupdate(p->name);
+		else
+			rc = cond_clear_noupdate(p->name);
+		if (!rc)
+			cond_notify(p->name);
+		else
+			dbg("%s: settled in previous state", p->name);
+		free(p);
+	}
+}
+
+/*
+ * Hold back the edge of a debounced condition, a later edge before it
+ * has settled replaces it and restarts the settle time.  Returns 1 if
+ * the edge is held back, 0 if the condition is not debounced.
+ */
+static int cond_debounce(const char *name, enum cond_state state)
+{
+	struct cond_debounce *db;
+	struct cond_pending *p;
+	long long expires;
+
+	TAILQ_FOREACH(db, &debounce_list, link) {
+		if (!strncmp(name, db->prefix, db->len))
+			break;
+	}
+	if (!db)
+		return 0;
+
+	TAILQ_FOREACH(p, &pending_list, link) {
+		if (!strcmp(p->name, name))
+			break;
+	}
+	if (!p) {
+		p = malloc(sizeof(*p) + strlen(name) + 1);
+		if (!p) {
+			err(1, "Failed allocating debounced %s, not debouncing", name);
+			return 0;
+		}
+		strcpy(p->name, name);
+		TAILQ_INSERT_TAIL(&pending_list, p, link);
+	} else
+		dbg("%s: new edge before settled, restarting %d msec", name, db->msec);
+
+	expires    = msec_now() + db->msec;
+	p->state   = state;
+	p->expires = expires;
+
+	if (!debounce_work.index || expires < debounce_next)
+		debounce_schedule(expires);
+
+	return 1;
+}
+
+/*
+ * Forget a held back edge, e.g. when a debounced condition is set as
+ * a oneshot, which is not debounced, so a pending clear of it does not
+ * win over the newer set when it settles.
+ */
+static void cond_debounce_drop(const char *name)
+{
+	struct cond_pending *p;
+
+	TAILQ_FOREACH(p, &pending_list, link) {
+		if (strcmp(p->name, name))
+			continue;
+
+		dbg("%s: dropping held back edge", name);
+		TAILQ_REMOVE(&pending_list, p, link);
+		free(p);
+		break;
+	}
+}
+
 int cond_set_noupdate(const char *name)
 {
 	dbg("%s", name);
@@ -322,14 +1131,17 @@ int cond_set_noupdate(const char *name)
 void cond_set(const char *name)
 {
 	dbg("%s", name);
+	if (cond_debounce(name, COND_ON))
+		return;
 	if (cond_set_noupdate(name))
 		return;
 
-	cond_update(name);
+	cond_notify(name);
 }
 
 int cond_set_oneshot_noupdate(const char *name)
 {
+	struct cond_node *node;
 	const char *path;
 
 	if (string_compare(name, "nop"))
@@ -345,6 +1157,14 @@ int cond_set_oneshot_noupdate(const char *name)
 		err(1, "Failed creating onshot cond %s", name);
 		return 1;
 	}
+	cond_debounce_drop(name);
+
+	node = cond_cache(name);
+	if (node) {
+		node->oneshot = 1;
+		node->gen = 0;
+		cond_shm_publish(node);
+	}
 
 	return 0;
 }
@@ -355,7 +1175,7 @@ void cond_set_oneshot(const char *name)
 	if (cond_set_oneshot_noupdate(name))
 		return;
 
-	cond_update(name);
+	cond_notify(name);
 }
 
 int cond_clear_noupdate(const char *name)
@@ -373,17 +1193,115 @@ int cond_clear_noupdate(const char *name)
 void cond_clear(const char *name)
 {
 	dbg("%s", name);
+	if (cond_debounce(name, COND_OFF))
+		return;
 	if (cond_clear_noupdate(name))
 		return;
 
-	cond_update(name);
+	cond_notify(name);
 }
 
+/**
+ * cond_batch - Set or clear many static conditions at once
+ * @names: Array of condition names, e.g. "usr/foo"
+ * @num:   Number of entries in @names
+ * @set:   Set conditions if non-zero, otherwise clear them
+ *
+ * All conditions are changed first, like cond_set_oneshot() and
+ * cond_clear(), then all services depending on any of them are
+ * stepped once from the run queue.  The names of the conditions that
+ * changed are moved to the front of @names, the order is not kept.
+ *
+ * Returns:
+ * Number of conditions that could not be changed.
+ */
+int cond_batch(char *names[], int num, int set)
+{
+	int i, changed = 0, failed = 0;
+
+	for (i = 0; i < num; i++) {
+		char *name;
+
+		if (set) {
+			if (cond_set_oneshot_noupdate(names[i])) {
+				failed++;
+				continue;
+			}
+		} else {
+			if (cond_debounce(names[i], COND_OFF))
+				continue;
+			if (cond_clear_noupdate(names[i]))
+				continue;
+		}
+
+		name = names[changed];
+		names[changed++] = names[i];
+		names[i] = name;
+	}
+
+	for (i = 0; i < changed; i++)
+		cond_notify_svc(names[i], 1);
+
+	return failed;
+}
+
+/*
+ * Move a condition out of step with the configuration generation, one
+ * ahead of it, which is never written by anyone else.  The condition
+ * is in flux until it is set or cleared again.
+ */
+static void cond_flux(const char *name)
+{
+	struct cond_node *node;
+	unsigned int rgen;
+
+	node = cond_cache(name);
+	if (!node || node->oneshot || cond_cache_state(node) != COND_ON) {
+		cond_node_gc(node);
+		return;
+	}
+
+	rgen = cond_reconf_gen() + 1;
+	if (cond_set_gen(cond_path(name), rgen)) {
+		err(1, "Failed setting condition %s in flux", name);
+		node->cached = 0;
+		return;
+	}
+	node->gen = rgen;
+	cond_shm_publish(node);
+
+	if (!node->flux) {
+		TAILQ_INSERT_TAIL(&flux_list, node, flux_link);
+		node->flux = 1;
+	}
+
+	metrics.cond_flips++;
+	TRACE3(cond, name, COND_ON, COND_FLUX);
+	api_event(INIT_EVENT_COND, name, COND_FLUX, COND_ON, 0);
+}
+
+/*
+ * Called on reload, after conf_reload(), to put the conditions owned
+ * by changed or removed services in flux.  All other conditions keep
+ * their generation, so only services depending on a changed service
+ * are paused, see service_step().  The owner, or the pidfile plugin,
+ * reasserts the condition when the service is up again.
+ */
 void cond_reload(void)
 {
+	char cond[MAX_COND_LEN];
+	svc_t *svc, *iter = NULL;
+
 	dbg("");
 
-	cond_bump_reconf();
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (!svc_is_changed(svc) && !svc_is_removed(svc))
+			continue;
+
+		cond_flux(mkcond(svc, cond, sizeof(cond)));
+		snprintf(cond, sizeof(cond), "service/%s/ready", svc_ident(svc, NULL, 0));
+		cond_flux(cond);
+	}
 }
 
 static int do_assert(const char *fpath, const struct stat *sb, int tflg, struct FTW *ftw, int set)
@@ -412,11 +1330,6 @@ static int do_assert(const char *fpath, const struct stat *sb, int tflg, struct
 	return 0;
 }
 
-static int reassert(const char *fpath, const struct stat *sb, int tflg, struct FTW *ftw)
-{
-	return do_assert(fpath, sb, tflg, ftw, 1);
-}
-
 static int deassert(const char *fpath, const struct stat *sb, int tflg, struct FTW *ftw)
 {
 	return do_assert(fpath, sb, tflg, ftw, 0);
@@ -425,11 +1338,35 @@ static int deassert(const char *fpath, const struct stat *sb, int tflg, struct F
 /*
  * Used only by netlink plugin atm.
  * type: is a one of pid/, net/, etc.
+ *
+ * Only conditions put in flux by cond_reload() need reasserting, the
+ * rest are still in step with the configuration generation.
  */
 void cond_reassert(const char *pat)
 {
+	TAILQ_HEAD(, cond_node) list = TAILQ_HEAD_INITIALIZER(list);
+	struct cond_node *node, *tmp;
+	size_t len = strlen(pat);
+
 	dbg("%s", pat);
-	nftw(cond_path(pat), reassert, 20, FTW_DEPTH);
+
+	/* Dependents may set or clear conditions, which unflux them */
+	TAILQ_FOREACH_SAFE(node, &flux_list, flux_link, tmp) {
+		if (strncmp(node->name, pat, len))
+			continue;
+
+		cond_unflux(node);
+		TAILQ_INSERT_TAIL(&list, node, flux_link);
+		node->busy = 1;
+	}
+
+	while ((node = TAILQ_FIRST(&list))) {
+		TAILQ_REMOVE(&list, node, flux_link);
+		dbg("Reasserting %s", node->name);
+		cond_set(node->name);
+		node->busy = 0;
+		cond_node_gc(node);
+	}
 }
 
 /*
@@ -441,6 +1378,21 @@ void cond_deassert(const char *pat)
 	nftw(cond_path(pat), deassert, 20, FTW_DEPTH);
 }
 
+/* After re-exec, publish all conditions still in the file system */
+static int do_load(const char *fpath, const struct stat *sb, int tflg, struct FTW *ftw)
+{
+	const char *name;
+
+	if (tflg != FTW_F && tflg != FTW_SL)
+		return 0;
+
+	name = cond_name(fpath);
+	if (name && strcmp(name, "reconf"))
+		cond_cache(name);
+
+	return 0;
+}
+
 /*
  * Check if we have bootstrapped enough of the system to use conditions.
  * Will answer 'No' before bootstrap done *and* at shutdown/reboot.
@@ -459,13 +1411,25 @@ void cond_init(void)
 		return;
 	}
 
-	cond_bump_reconf();
+	cond_shm_init();
+
+	/* After re-exec all conditions are still valid, don't flux them */
+	if (!reexecd)
+		cond_bump_reconf();
+	else
+		nftw(_PATH_COND, do_load, 20, FTW_PHYS);
 	cond_boot_strap();
 }
 
 void cond_exit(void)
 {
 	cond_delpath(_PATH_COND);
+
+	if (shm) {
+		munmap(shm, sizeof(*shm));
+		shm = NULL;
+		unlink(_PATH_CONDSHM);
+	}
 }
 
 /**
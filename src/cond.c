@@ -21,7 +21,9 @@
  * THE SOFTWARE.
  */
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 #else
@@ -89,10 +91,13 @@ enum cond_state cond_get_path(const char *path)
 	return (cgen == rgen) ? COND_ON : COND_FLUX;
 }
 
+#ifndef __FINIT__
+/* Finit keeps all conditions in memory, see cond-w.c */
 enum cond_state cond_get(const char *name)
 {
 	return cond_get_path(cond_path(name));
 }
+#endif /* __FINIT__ */
 
 enum cond_state cond_get_agg(const char *names)
 {
@@ -127,6 +132,112 @@ int cond_affects(const char *name, const char *names)
 	return 0;
 }
 
+/**
+ * cond_shm_map - Map the condition table published by Finit
+ *
+ * The mapping is kept for the life time of the process.
+ *
+ * Returns:
+ * Read-only table, or %NULL if Finit does not (yet) publish one.
+ */
+const struct cond_shm *cond_shm_map(void)
+{
+	static const struct cond_shm *shm;
+	void *ptr;
+	int fd;
+
+	if (shm)
+		return shm;
+
+	fd = open(_PATH_CONDSHM, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	ptr = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED)
+		return NULL;
+
+	shm = ptr;
+	if (shm->magic != COND_SHM_MAGIC) {
+		munmap(ptr, sizeof(*shm));
+		shm = NULL;
+	}
+
+	return shm;
+}
+
+static uint32_t seq_begin(const struct cond_shm *shm)
+{
+	uint32_t seq;
+
+	while ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+static int seq_retry(const struct cond_shm *shm, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/**
+ * cond_shm_read - Copy a consistent snapshot of the condition table
+ * @shm: Table from cond_shm_map()
+ * @ent: Array to copy entries to
+ * @max: Number of entries in @ent
+ *
+ * Returns:
+ * Number of entries copied, or -1 if the table has overflowed.
+ */
+int cond_shm_read(const struct cond_shm *shm, struct cond_shm_ent *ent, size_t max)
+{
+	uint32_t seq, num;
+	int overflow;
+
+	do {
+		seq = seq_begin(shm);
+		num = min(shm->num, (uint32_t)COND_SHM_MAX);
+		if (num > max)
+			num = max;
+		overflow = shm->overflow;
+		memcpy(ent, shm->ent, num * sizeof(*ent));
+	} while (seq_retry(shm, seq));
+
+	return overflow ? -1 : (int)num;
+}
+
+/**
+ * cond_shm_get - Look up the state of one condition in the table
+ * @shm:  Table from cond_shm_map()
+ * @name: Condition name, e.g. "net/route/default"
+ *
+ * Returns:
+ * The &enum cond_state of @name, or -1 if the table has overflowed.
+ */
+int cond_shm_get(const struct cond_shm *shm, const char *name)
+{
+	uint32_t seq, num, i;
+	int state;
+
+	do {
+		seq = seq_begin(shm);
+		state = shm->overflow ? -1 : COND_OFF;
+		num = min(shm->num, (uint32_t)COND_SHM_MAX);
+		for (i = 0; i < num; i++) {
+			if (strncmp(shm->ent[i].name, name, sizeof(shm->ent[i].name)))
+				continue;
+
+			state = shm->ent[i].state;
+			break;
+		}
+	} while (seq_retry(shm, seq));
+
+	return state;
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
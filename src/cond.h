@@ -2,6 +2,7 @@
 #define FINIT_COND_H_
 
 #include <paths.h>
+#include <stdint.h>
 
 #include "svc.h"
 
@@ -17,6 +18,7 @@
 #define _PATH_CONDSYS  _PATH_COND   COND_SYS
 #define _PATH_CONDUSR  _PATH_COND   COND_USR
 #define _PATH_RECONF   _PATH_COND   "reconf"
+#define _PATH_CONDSHM  _PATH_VARRUN "finit/cond.shm"
 
 typedef enum cond_state {
 	COND_OFF = 0,
@@ -24,6 +26,31 @@ typedef enum cond_state {
 	COND_ON
 } cond_state_t;
 
+/*
+ * Read-only table of all known conditions, published by Finit in
+ * _PATH_CONDSHM for readers to mmap().  The entry of a condition that
+ * is cleared is emptied, state off and no name, and later reused.  The
+ * table is guarded by a seqlock: seq is odd while Finit updates it, so
+ * readers copy what they need and retry if seq has changed, see
+ * cond_shm_read().  If more conditions are set than fit, overflow is
+ * set and readers must use the file system instead.
+ */
+#define COND_SHM_MAGIC 0x464e4443	/* "CDNF" */
+#define COND_SHM_MAX   1024
+
+struct cond_shm_ent {
+	uint32_t state;			/* enum cond_state */
+	char     name[MAX_COND_LEN];
+};
+
+struct cond_shm {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t num;			/* entries used so far */
+	uint32_t overflow;
+	struct cond_shm_ent ent[COND_SHM_MAX];
+};
+
 char           *mkcond       (svc_t *svc, char *buf, size_t len);
 const char     *condstr      (enum cond_state s);
 const char     *cond_path    (const char *name);
@@ -33,13 +60,19 @@ enum cond_state cond_get     (const char *name);
 enum cond_state cond_get_agg (const char *names);
 int             cond_affects (const char *name, const char *names);
 
+const struct cond_shm *cond_shm_map(void);
+int             cond_shm_read(const struct cond_shm *shm, struct cond_shm_ent *ent, size_t max);
+int             cond_shm_get (const struct cond_shm *shm, const char *name);
+
 void cond_boot_parse  (char *arg);
+int  cond_debounce_add(char *arg);
 int  cond_update      (const char *name);
 int  cond_set_path    (const char *path, enum cond_state new);
 void cond_set         (const char *name);
 void cond_set_oneshot (const char *name);
 void cond_clear       (const char *name);
 void cond_reload      (void);
+int  cond_batch       (char *names[], int num, int set);
 
 int  cond_set_noupdate(const char *name);
 int  cond_set_oneshot_noupdate(const char *name);
@@ -48,6 +81,14 @@ int  cond_clear_noupdate(const char *name);
 void cond_reassert    (const char *pat);
 void cond_deassert    (const char *pat);
 
+int    cond_dep_add     (svc_t *svc, const char *name);
+int    cond_dep_watch   (svc_t *svc, const char *name);
+void   cond_dep_del     (svc_t *svc);
+svc_t *cond_dep_iterator(struct cond_dep **iter, int first, const char *name);
+const char *cond_svc_iterator(struct cond_dep **iter, int first, svc_t *svc);
+int    cond_svc_has     (svc_t *svc, const char *name);
+enum cond_state cond_get_svc(svc_t *svc);
+
 int  cond_is_available(void);
 
 void cond_init        (void);
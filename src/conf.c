@@ -28,6 +28,7 @@
 #include <string.h>
 #include <sys/inotify.h>
 #include <sys/resource.h>
+#include <sys/sysinfo.h>	/* get_nprocs() */
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 # include <libite/queue.h>	/* BSD sys/queue.h API */
@@ -37,18 +38,33 @@
 #endif
 #include <time.h>
 #include <glob.h>
+#ifdef PARALLEL_BOOT
+#include <pthread.h>
+#endif
 
 #include "finit.h"
 #include "cond.h"
 #include "devmon.h"
 #include "iwatch.h"
+#include "logger.h"
+#include "metrics.h"
 #include "private.h"
+#include "psi.h"
+#include "schedule.h"
 #include "service.h"
+#include "snapshot.h"
+#include "timeline.h"
 #include "tty.h"
+#include "usercache.h"
 #include "helpers.h"
+#include "history.h"
+#include "notify.h"
 #include "util.h"
+#include "wdt.h"
+#include "which.h"
 
 #define BOOTSTRAP (runlevel == INIT_LEVEL)
+#define INSTANCES_MAX 1024	/* instances:N, see conf_parse_instances() */
 
 int logfile_size_max = 200000;	/* 200 kB */
 int logfile_count_max = 5;
@@ -85,6 +101,7 @@ char *fsck_repair = "-p";
 char *runparts = NULL;
 int   runparts_progress;
 int   runparts_sysv;
+int   runparts_jobs;
 
 char cgroup_current[16]; /* cgroup.NAME sets current cgroup for a set of services */
 
@@ -93,17 +110,35 @@ struct conf_change {
 	char *name;
 };
 
-static struct iwatch iw_conf;
+static struct iwatch iw_conf = { .name = "conf" };
 static int iwatch_fd;
 static uev_t etcw;
 
 static TAILQ_HEAD(, conf_change) conf_change_list = TAILQ_HEAD_INITIALIZER(conf_change_list);
 
+/*
+ * Record of all parsed .conf files, for incremental reload.  A file
+ * with global settings, e.g., env vars or an include, or any file read
+ * from finit.conf, always triggers a full reload when changed.
+ */
+struct conf_file {
+	TAILQ_ENTRY(conf_file) link;
+	char *path;		/* as parsed, e.g. /etc/finit.d/enabled/foo.conf */
+	char *name;		/* realpath(), same as in conf_change_list */
+	int   globals;
+};
+
+static TAILQ_HEAD(, conf_file) conf_file_list = TAILQ_HEAD_INITIALIZER(conf_file_list);
+
+/* .conf files to re-parse on incremental reload due to env: changes */
+static TAILQ_HEAD(, conf_change) conf_reparse_list = TAILQ_HEAD_INITIALIZER(conf_reparse_list);
+
 static char *path;
 static char *shell;
 
 static int  parse_conf(char *file, int is_rcsd);
 static void drop_changes(void);
+static struct conf_change *conf_find(char *file);
 
 static int get_bool(char *arg, int default_value)
 {
@@ -131,8 +166,10 @@ static int validate_arg(char *arg, const char *opt)
 /*
  * finit.cond   = foo          (=> <boot/foo>)
  * finit.config = /path/to/etc/alt-finit.conf
+ * finit.container = [on,off]  (default: auto-detect)
  * finit.debug  = [on,off]
  * finit.fstab  = /path/to/etc/fstab.aternative
+ * finit.mount  = [serial,parallel]
  * finit.status = [on,off]     (compat finit.show_status)
  * finit.status_style = [old,classic,modern]
  */
@@ -160,6 +197,11 @@ static void parse_finit_opts(char *opt)
 		return;
 	}
 
+	if (string_compare(opt, "container")) {
+		container = get_bool(arg, 1);
+		return;
+	}
+
 	if (string_compare(opt, "debug")) {
 		debug = get_bool(arg, 1);
 		return;
@@ -174,6 +216,13 @@ static void parse_finit_opts(char *opt)
 		return;
 	}
 
+	if (string_compare(opt, "mount")) {
+		if (validate_arg(arg, "finit.mount"))
+			return;
+		mntmode = string_compare(arg, "parallel");
+		return;
+	}
+
 	if (string_compare(opt, "status_style")) {
 		if (validate_arg(arg, "finit.status_style"))
 			return;
@@ -343,6 +392,24 @@ static void parse_kernel_loglevel(void)
 		kerndebug = 1;
 }
 
+/*
+ * finit.container is needed by fs_init(), before /proc is mounted and
+ * conf_parse_cmdline() can read /proc/cmdline, so look for it in the
+ * non-kernel options on our cmdline already.  Parsed again later.
+ */
+void conf_parse_container(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		char opt[32];
+
+		if (strncmp(argv[i], "finit.container", 15))
+			continue;
+
+		strlcpy(opt, &argv[i][6], sizeof(opt));
+		parse_finit_opts(opt);
+	}
+}
+
 /*
  * Kernel gives us all non-kernel options on our cmdline
  */
@@ -418,51 +485,110 @@ void conf_saverc(void)
 }
 
 /*
- * Called at bootstrap to log execution order (for debug)
+ * Execution order at bootstrap is buffered in memory and written to
+ * exec.order in one go, when the system is up or when the records have
+ * been pending for EXEC_ORDER_DELAY msec, not on every single exec.
  */
-void conf_save_exec_order(svc_t *svc, char *cmdline, int result)
+#define EXEC_ORDER_FILE  _PATH_VARRUN "finit/exec.order"
+#define EXEC_ORDER_DELAY 2000
+
+static FILE   *exec_fp;
+static char   *exec_buf;
+static size_t  exec_len;
+
+static void exec_order_cb(void *arg);
+static struct wq exec_work = {
+	.cb    = exec_order_cb,
+	.delay = EXEC_ORDER_DELAY,
+};
+
+/**
+ * conf_flush_exec_order - Write buffered execution order to disk
+ *
+ * Called at %HOOK_SYSTEM_UP, and from a timer during bootstrap.
+ */
+void conf_flush_exec_order(void)
 {
-	const char *fn = _PATH_VARRUN "finit/exec.order";
-	const char *ststr = !result ? "[ OK ]" : "[FAIL]";
-	static char *prepared = NULL;
-	int first = !fexist(fn);
 	FILE *fp;
+	int first;
 
-	fp = fopen(fn, "a+");
-	if (!fp) {
-		err(1, "failed writing to %s", fn);
+	cancel_work(&exec_work);
+	if (!exec_fp)
 		return;
+
+	fclose(exec_fp);
+	exec_fp = NULL;
+	if (!exec_buf)
+		return;
+
+	first = !fexist(EXEC_ORDER_FILE);
+	fp = fopen(EXEC_ORDER_FILE, "a");
+	if (!fp) {
+		err(1, "failed writing to %s", EXEC_ORDER_FILE);
+		goto done;
 	}
 
 	if (first) {
-		fprintf(fp, "# Execution order of run/task/services at bootstrap\n");
-		fprintf(fp, "# ST    TYPE     COMMAND LINE (DESC)\n");
+		fprintf(fp, "# Execution order of run/task/services at bootstrap, msec since boot\n");
+		fprintf(fp, "# STATUS\tSTART\tDONE\tTYPE\tIDENT\tCOMMAND LINE\tDESCRIPTION\n");
 	}
+	fwrite(exec_buf, exec_len, 1, fp);
+	fclose(fp);
+done:
+	free(exec_buf);
+	exec_buf = NULL;
+	exec_len = 0;
+}
+
+static void exec_order_cb(void *arg)
+{
+	conf_flush_exec_order();
+}
+
+/*
+ * Called at bootstrap to log execution order (for debug).  Each record
+ * is one line of tab separated fields, see conf_flush_exec_order().
+ */
+void conf_save_exec_order(svc_t *svc, char *cmdline, int result)
+{
+	static long long start;
+	static char *prepared;
+	char ident[MAX_IDENT_LEN];
 
 	if (result == -1) {
-		int len;
-
-		len = snprintf(NULL, 0, "        %-7s  %-64s (%s)", svc_typestr(svc), cmdline, svc->desc);
-		if (len > 0) {
-			if (prepared)
-				free(prepared);
-			prepared = malloc(++len);
-			if (!prepared)
-				goto done;
-			snprintf(prepared, len, "        %-7s  %-64s (%s)", svc_typestr(svc), cmdline, svc->desc);
-		}
-	} else {
-		if (prepared) {
-			memcpy(prepared, ststr, strlen(ststr));
-			fprintf(fp, "%s\n", prepared);
-			free(prepared);
+		free(prepared);
+		prepared = NULL;
+
+		start = timeline_now();
+		if (asprintf(&prepared, "%s\t%s\t%s\t%s", svc_typestr(svc),
+			     svc_ident(svc, ident, sizeof(ident)), cmdline, svc->desc) < 0)
 			prepared = NULL;
-		} else {
-			fprintf(fp, "%s  %-7s  %-64s (%s)\n", ststr, svc_typestr(svc), cmdline, svc->desc);
+		return;
+	}
+
+	if (!exec_fp) {
+		exec_fp = open_memstream(&exec_buf, &exec_len);
+		if (!exec_fp) {
+			err(1, "failed buffering execution order");
+			return;
 		}
 	}
-done:
-	fclose(fp);
+
+	if (prepared) {
+		fprintf(exec_fp, "%s\t%lld\t%lld\t%s\n", !result ? "OK" : "FAIL",
+			start, timeline_now(), prepared);
+		free(prepared);
+		prepared = NULL;
+	} else {
+		long long now = timeline_now();
+
+		fprintf(exec_fp, "%s\t%lld\t%lld\t%s\t%s\t%s\t%s\n", !result ? "OK" : "FAIL",
+			now, now, svc_typestr(svc), svc_ident(svc, ident, sizeof(ident)),
+			cmdline ?: svc->cmd, svc->desc);
+	}
+
+	if (!exec_work.index)
+		schedule_work(&exec_work);
 }
 
 /*
@@ -656,6 +782,40 @@ int conf_parse_runlevels(char *runlevels)
 	return bitmask;
 }
 
+/**
+ * conf_parse_instances - Parse instances:N[:spread] of a template
+ * @arg:    Option value, N, or auto for the number of online CPUs
+ * @spread: Optional, set if each instance should get a CPU of its own
+ *
+ * Returns:
+ * Number of instances, or zero on error.
+ */
+int conf_parse_instances(char *arg, int *spread)
+{
+	const char *errstr = NULL;
+	char buf[32], *ptr;
+	int num;
+
+	strlcpy(buf, arg, sizeof(buf));
+	ptr = strchr(buf, ' ');
+	if (ptr)
+		*ptr = 0;
+	ptr = strchr(buf, ':');
+	if (ptr)
+		*ptr++ = 0;
+	if (spread)
+		*spread = ptr && !strcmp(ptr, "spread");
+
+	if (!strcmp(buf, "auto"))
+		return get_nprocs();
+
+	num = strtonum(buf, 1, INSTANCES_MAX, &errstr);
+	if (errstr)
+		return 0;
+
+	return num;
+}
+
 void conf_parse_cond(svc_t *svc, char *cond)
 {
 	size_t i = 0;
@@ -672,6 +832,7 @@ void conf_parse_cond(svc_t *svc, char *cond)
 		svc->sighup = 1;
 
 	if (!cond) {
+		cond_dep_del(svc);
 		memset(svc->cond, 0, sizeof(svc->cond));
 		return;
 	}
@@ -698,14 +859,20 @@ void conf_parse_cond(svc_t *svc, char *cond)
 		i++;
 	ptr[i] = 0;
 
-	if (i >= sizeof(svc->cond)) {
-		logit(LOG_WARNING, "%s: too long list of conditions: %s", svc_ident(svc, NULL, 0), ptr);
-		return;
-	}
+	/*
+	 * The compiled list of conditions, see cond_dep_add(), is what
+	 * Finit uses.  The svc->cond string is only for initctl, so it
+	 * is fine if it is truncated.
+	 */
+	if (i >= sizeof(svc->cond))
+		logit(LOG_NOTICE, "%s: too long list of conditions for initctl: %s", svc_ident(svc, NULL, 0), ptr);
 
+	cond_dep_del(svc);
 	svc->cond[0] = 0;
 	for (i = 0, c = strtok(ptr, ","); c; c = strtok(NULL, ","), i++) {
 		devmon_add_cond(c);
+		plugin_want_cond(c);
+		cond_dep_add(svc, c);
 		if (i)
 			strlcat(svc->cond, ",", sizeof(svc->cond));
 		strlcat(svc->cond, c, sizeof(svc->cond));
@@ -903,14 +1070,25 @@ static int parse_static(char *line, int is_rcsd)
 
 	if (BOOTSTRAP && MATCH_CMD(line, "runparts ", x)) {
 		if (runparts) free(runparts);
-		runparts_progress = runparts_sysv = 0;
+		runparts_progress = runparts_sysv = runparts_jobs = 0;
 		while (x) {
 			if (MATCH_CMD(x, "progress", x))
 				runparts_progress = 1;
 			else if (MATCH_CMD(x, "sysv", x))
 				runparts_sysv = 1;
-			else
+			else if (MATCH_CMD(x, "parallel", x)) {
+				runparts_jobs = -1; /* online CPUs */
+				if (*x == ':') {
+					runparts_jobs = atoi(++x);
+					while (isdigit(*x))
+						x++;
+					if (runparts_jobs <= 0)
+						runparts_jobs = -1;
+				}
+			} else
 				break;
+			while (*x && isspace(*x))
+				x++;
 		}
 		runparts = strdup(strip_line(x));
 		return 0;
@@ -943,6 +1121,8 @@ static int parse_static(char *line, int is_rcsd)
 				size = strtobytes(strtok(NULL, ":= "));
 			else if (!strncmp(tok, "count", 5))
 				count = strtobytes(strtok(NULL, ":= "));
+			else if (!strcmp(tok, "builtin"))
+				logger_builtin = 1;
 
 			tok = strtok(NULL, ":= ");
 		}
@@ -990,13 +1170,108 @@ static int parse_static(char *line, int is_rcsd)
 			readiness = SVC_NOTIFY_NONE;
 	}
 
+	/*
+	 * Pressure stall triggers, asserting psi/ conditions, see psi.c
+	 * Only read once at bootstrap.
+	 */
+	if (BOOTSTRAP && MATCH_CMD(line, "psi ", x)) {
+		psi_add(strip_line(x));
+		return 0;
+	}
+
+	/*
+	 * Integrated watchdog, kicked from the event loop, see wdt.c
+	 * Only read once at bootstrap.
+	 */
+	if (BOOTSTRAP && MATCH_CMD(line, "watchdog", x) && (!*x || isspace(*x))) {
+		wdt_conf(strip_line(x));
+		return 0;
+	}
+
+	/*
+	 * Run hook scripts in the background, see plugin.c
+	 * Only read once at bootstrap.
+	 */
+	if (BOOTSTRAP && MATCH_CMD(line, "hookscripts ", x)) {
+		plugin_script_conf(strip_line(x));
+		return 0;
+	}
+
+	/*
+	 * Settle time for edges of conditions, e.g. net/, see cond-w.c
+	 * Only read once at bootstrap.
+	 */
+	if (BOOTSTRAP && MATCH_CMD(line, "debounce ", x)) {
+		cond_debounce_add(strip_line(x));
+		return 0;
+	}
+
+	/*
+	 * Sample resource usage of services, see history.c
+	 * Only read once at bootstrap.
+	 */
+	if (BOOTSTRAP && MATCH_CMD(line, "history ", x)) {
+		history_add(strip_line(x));
+		return 0;
+	}
+
+	/*
+	 * One shared socket for all notify:systemd services, instead of
+	 * one connection per service.  Only read once at bootstrap.
+	 */
+	if (BOOTSTRAP && MATCH_CMD(line, "notify ", x)) {
+		char *token = strip_line(x);
+
+		if (!strcmp(token, "shared"))
+			notify_shared = 1;
+		return 0;
+	}
+
+	/*
+	 * Max number of services starting in parallel, optionally per
+	 * runlevel: jobs [S] 2
+	 */
+	if (MATCH_CMD(line, "jobs ", x)) {
+		char *token = strip_line(x);
+		const char *err = NULL;
+		int levels = 0;
+		int val;
+
+		if (token[0] == '[') {
+			levels = conf_parse_runlevels(token);
+			token = strchr(token, ']');
+			if (!token)
+				return 0;
+			token = strip_line(token + 1);
+		}
+
+		val = strtonum(token, 0, 1024, &err);
+		if (err)
+			logit(LOG_WARNING, "Invalid jobs setting '%s', %s", token, err);
+		else
+			service_jobs(levels, val);
+		return 0;
+	}
+
 	if (MATCH_CMD(line, "reboot-delay ", x)) {
 		syncsec = strtonum(strip_line(x), 0, 60, NULL);
 		return 0;
 	}
 
+	/* Deadline for stopping all services and unmounting at shutdown */
+	if (MATCH_CMD(line, "shutdown-timeout ", x)) {
+		shutsec = strtonum(strip_line(x), 0, 600, NULL);
+		return 0;
+	}
+
+	/* Reboot with kexec, when a kernel has been loaded, see do_shutdown() */
+	if (MATCH_CMD(line, "reboot-kexec ", x)) {
+		kexecboot = get_bool(strip_line(x), 0);
+		return 0;
+	}
+
 	/*
-	 * Periodic check and instability index leveler, seconds
+	 * Instability index leveler, seconds
 	 */
 	if (MATCH_CMD(line, "service-interval ", x)) {
 		char *token = strip_line(x);
@@ -1005,13 +1280,8 @@ static int parse_static(char *line, int is_rcsd)
 
 		/* 0 min to 1 day, should check at least daily */
 		val = strtonum(token, 0, 1440, &err);
-		if (!err) {
-			int disabled = !service_interval;
-
+		if (!err)
 			service_interval = val * 1000; /* to milliseconds */
-			if (disabled)
-				service_init(NULL);
-		}
 		return 0;
 	}
 
@@ -1073,42 +1343,64 @@ static int parse_dynamic(char *line, struct rlimit rlimit[], char *file)
 	return 1;
 }
 
+/* Number of %i in line */
+static int placeholders(const char *line)
+{
+	int num = 0;
+
+	while ((line = strstr(line, "%i"))) {
+		line += 2;
+		num++;
+	}
+
+	return num;
+}
+
+/* Copy of line with all @num %i replaced with name */
+static char *subst(const char *line, int num, const char *name)
+{
+	size_t nlen = strlen(name);
+	const char *ptr;
+	char *buf, *pos;
+
+	buf = malloc(strlen(line) + num * nlen + 1);
+	if (!buf)
+		return NULL;
+
+	pos = buf;
+	while (num-- > 0 && (ptr = strstr(line, "%i"))) {
+		memcpy(pos, line, ptr - line);
+		pos += ptr - line;
+		memcpy(pos, name, nlen);
+		pos += nlen;
+		line = ptr + 2;
+	}
+	strcpy(pos, line);
+
+	return buf;
+}
+
 /*
  * Very simple and crude implementation, only supports '%i'
  */
 static char *instantiate(char *line, char *name)
 {
-	char *ptr, *end = strchr(line, 0);
-	char *pos = line;
-	size_t num = 0;
+	char *ptr;
+	int num;
 
-	if (!name[0] || !end)
+	if (!name[0])
 		return line;
 
-	while ((ptr = strchr(pos, '%'))) {
-		num++;
-		pos++;
-	}
+	num = placeholders(line);
+	if (!num)
+		return line;
 
-	ptr = realloc(line, strlen(line) + num * strlen(name) + 1);
+	ptr = subst(line, num, name);
 	if (!ptr)
 		return line;
+	free(line);
 
-	pos = line = ptr;
-	while ((ptr = strchr(pos, '%'))) {
-		if (!strncmp(ptr, "%i", 2)) {
-			char *rest = &ptr[2];
-			char *next = ptr + strlen(name);
-
-			memmove(next, rest, strlen(rest) + 1);
-			memcpy(ptr, name, strlen(name));
-
-			pos += strlen(name);
-		} else
-			pos++;
-	}
-
-	return line;
+	return ptr;
 }
 
 static int is_template(const char *file, char *name, size_t len)
@@ -1132,31 +1424,60 @@ static int is_template(const char *file, char *name, size_t len)
 	return 1;		/* instantiated template */
 }
 
-static int parse_conf(char *file, int is_rcsd)
+/*
+ * Templates, foo@.conf, are read once, and re-read only when changed.
+ * Each instance, e.g. enabled/foo@1.conf -> available/foo@.conf, then
+ * only makes copies of the lines with all %i replaced.
+ */
+struct tmpl_line {
+	char *text;
+	int   num;			/* number of %i */
+};
+
+struct tmpl {
+	TAILQ_ENTRY(tmpl) link;
+	char             *path;		/* realpath() of template */
+
+	dev_t             dev;
+	ino_t             ino;
+	off_t             size;
+	struct timespec   mtime;
+
+	size_t            count;
+	struct tmpl_line *lines;
+};
+
+static TAILQ_HEAD(, tmpl) tmpl_list = TAILQ_HEAD_INITIALIZER(tmpl_list);
+
+/* Option of a template stanza, expanding the template itself */
+#define INSTANCES_OPT " instances:"
+
+static void tmpl_flush(struct tmpl *t)
 {
-	struct rlimit rlimit[RLIMIT_NLIMITS];
-	char name[65] = { 0 };
-	FILE *fp;
+	for (size_t i = 0; i < t->count; i++)
+		free(t->lines[i].text);
+	free(t->lines);
+	t->lines = NULL;
+	t->count = 0;
+}
 
-	if (is_template(file, name, sizeof(name))) {
-		if (!name[0]) {
-			dbg("*** Skipping template file %s", file);
-			return 0;
-		}
-		dbg("*** instantiating %s from %s ...", name, file);
-	}
+static void tmpl_drop(struct tmpl *t)
+{
+	TAILQ_REMOVE(&tmpl_list, t, link);
+	tmpl_flush(t);
+	free(t->path);
+	free(t);
+}
 
-	fp = fopen(file, "r");
-	if (!fp)
-		return 1;
+static int tmpl_read(struct tmpl *t)
+{
+	size_t max = 0;
+	FILE *fp;
 
-	/* Prepare default limits and group for each service in /etc/finit.d/ */
-	if (is_rcsd) {
-		memcpy(rlimit, global_rlimit, sizeof(rlimit));
-		cgroup_current[0] = 0;
-	}
+	fp = fopen(t->path, "r");
+	if (!fp)
+		return -1;
 
-	dbg("*** Parsing %s", file);
 	while (!feof(fp)) {
 		char *line;
 
@@ -1164,78 +1485,891 @@ static int parse_conf(char *file, int is_rcsd)
 		if (!line)
 			continue;
 
-		tabstospaces(line);
-//		dbg("raw: %s", line);
-		line = instantiate(line, name);
-//		dbg("ins: %s", line);
+		if (t->count == max) {
+			struct tmpl_line *ptr;
 
-		if (!parse_static(line, is_rcsd))
-			;
-		else if (!parse_dynamic(line, is_rcsd ? rlimit : global_rlimit, file))
-			;
-		else
-			parse_env(line);
+			max = max ? max * 2 : 16;
+			ptr = realloc(t->lines, max * sizeof(*ptr));
+			if (!ptr) {
+				free(line);
+				fclose(fp);
+				return -1;
+			}
+			t->lines = ptr;
+		}
 
-		free(line);
+		tabstospaces(line);
+		t->lines[t->count].text = line;
+		t->lines[t->count].num  = placeholders(line);
+		t->count++;
 	}
-
 	fclose(fp);
 
 	return 0;
 }
 
-static void glob_append(glob_t *gl, int append, const char *fmt, ...)
+/*
+ * Find, or read, template of an instance.  Returns NULL if file is not
+ * a symlink to a template, e.g. a regular file named foo@1.conf.
+ */
+static struct tmpl *tmpl_get(char *file)
 {
-	va_list ap;
-	size_t len;
-	char *path;
+	char name[2] = { 0 };
+	struct stat st;
+	struct tmpl *t;
+	char *rp;
 
-	va_start(ap, fmt);
-	len = vsnprintf(NULL, 0, fmt, ap);
-	va_end(ap);
+	rp = realpath(file, NULL);
+	if (!rp)
+		return NULL;
 
-	path = alloca(++len);
-	if (!path) {
-		warn("failed alloca() in glob_append()");
-		return;
+	if (!is_template(rp, name, sizeof(name)) || name[0] || stat(rp, &st)) {
+		free(rp);
+		return NULL;
 	}
 
-	va_start(ap, fmt);
-	vsnprintf(path, len, fmt, ap);
-	va_end(ap);
+	TAILQ_FOREACH(t, &tmpl_list, link) {
+		if (!strcmp(t->path, rp))
+			break;
+	}
 
-	dbg("conf_reload(): glob %s ...", path);
-	glob(path, append ? GLOB_APPEND : 0, NULL, gl);
+	if (t) {
+		free(rp);
+		if (t->dev == st.st_dev && t->ino == st.st_ino && t->size == st.st_size &&
+		    t->mtime.tv_sec == st.st_mtim.tv_sec && t->mtime.tv_nsec == st.st_mtim.tv_nsec)
+			return t;
+
+		dbg("Template %s changed, re-reading.", t->path);
+		tmpl_flush(t);
+	} else {
+		t = calloc(1, sizeof(*t));
+		if (!t) {
+			free(rp);
+			return NULL;
+		}
+		t->path = rp;
+		TAILQ_INSERT_TAIL(&tmpl_list, t, link);
+	}
+
+	if (tmpl_read(t)) {
+		tmpl_drop(t);
+		return NULL;
+	}
+
+	t->dev   = st.st_dev;
+	t->ino   = st.st_ino;
+	t->size  = st.st_size;
+	t->mtime = st.st_mtim;
+
+	return t;
 }
 
 /*
- * Reload /etc/finit.conf and all *.conf in /etc/finit.d/
+ * Service stanzas, and per-file settings, that can be re-parsed without
+ * affecting anything else.  All other non-empty lines are considered
+ * global, e.g., env vars, include, or top-level cgroup settings.
  */
-int conf_reload(void)
+static int is_dynamic(char *line)
 {
-	glob_t gl;
-	size_t i;
+	const char *kw[] = {
+		"service ", "task ", "run ", "sysv ", "tty ",
+		"rlimit ", "cgroup.", NULL
+	};
+	char *x;
 
-	/* Set time according to current time zone */
-	tzset();
-	dbg("Set time  daylight: %d  timezone: %ld  tzname: %s %s",
-	   daylight, timezone, tzname[0], tzname[1]);
+	while (isspace(*line))
+		line++;
+	if (!*line)
+		return 1;
 
-	/* Mark and sweep */
-	cgroup_mark_all();
-	svc_mark_dynamic();
-	conf_reset_env();
+	for (int i = 0; kw[i]; i++) {
+		if (MATCH_CMD(line, kw[i], x))
+			return 1;
+	}
 
-	/*
-	 * Reset global rlimit to bootstrap values from conf_init().
-	 */
-	memcpy(global_rlimit, initial_rlimit, sizeof(global_rlimit));
+	return 0;
+}
 
-	/*
-	 * When built with --disable-rescue mode many other 'if (rescue)'
-	 * code paths are #ifdeffed out.  This one, and the ones in the
-	 * plugins, are not because a hook or plugin can still trigger
-	 * the alternative rescue.conf instead of finit.conf.  This for
+static struct conf_file *file_find(char *name)
+{
+	struct conf_file *cf;
+
+	TAILQ_FOREACH(cf, &conf_file_list, link) {
+		if (string_compare(cf->name, name))
+			return cf;
+	}
+
+	return NULL;
+}
+
+static struct conf_file *file_find_by_path(char *path)
+{
+	struct conf_file *cf;
+
+	TAILQ_FOREACH(cf, &conf_file_list, link) {
+		if (string_compare(cf->path, path))
+			return cf;
+	}
+
+	return NULL;
+}
+
+static void file_add(char *path, int globals)
+{
+	struct conf_file *cf;
+	char *rp;
+
+	rp = realpath(path, NULL);
+	if (!rp)
+		rp = strdup(path);
+	if (!rp)
+		goto fail;
+
+	cf = file_find(rp);
+	if (cf) {
+		free(rp);
+		cf->globals = globals;
+		return;
+	}
+
+	cf = malloc(sizeof(*cf));
+	if (!cf) {
+		free(rp);
+		goto fail;
+	}
+
+	cf->path = strdup(path);
+	if (!cf->path) {
+		free(cf);
+		free(rp);
+		goto fail;
+	}
+	cf->name = rp;
+	cf->globals = globals;
+	TAILQ_INSERT_TAIL(&conf_file_list, cf, link);
+	return;
+fail:
+	warn("failed recording %s", path);
+}
+
+static void drop_files(void)
+{
+	struct conf_file *cf, *tmp;
+
+	TAILQ_FOREACH_SAFE(cf, &conf_file_list, link, tmp) {
+		TAILQ_REMOVE(&conf_file_list, cf, link);
+		free(cf->path);
+		free(cf->name);
+		free(cf);
+	}
+}
+
+/*
+ * Lines for parse_conf(), from snapshot, or read from .conf file with
+ * continuation lines and comments handled, and template instantiated.
+ */
+struct conf_reader {
+	FILE        *fp;
+	const char  *snap;
+	uint32_t     lines;
+	struct tmpl *tmpl;
+	size_t       pos;
+	char        *name;
+	int          cpu;		/* instances:N:spread, -1: none */
+};
+
+/* Give the stanza with instances:N:spread a CPU of its own, cpus:NUM */
+static char *spread(char *line, int cpu)
+{
+	char opt[16], *ptr, *buf;
+	size_t len;
+
+	ptr = strchr(line, ' ');
+	if (!ptr || !strstr(line, INSTANCES_OPT))
+		return line;
+
+	len = snprintf(opt, sizeof(opt), " cpus:%d", cpu);
+	buf = malloc(strlen(line) + len + 1);
+	if (!buf)
+		return line;
+
+	memcpy(buf, line, ptr - line);
+	strcpy(&buf[ptr - line], opt);
+	strcat(buf, ptr);
+	free(line);
+
+	return buf;
+}
+
+static char *conf_getline(struct conf_reader *rd)
+{
+	char *line;
+
+	if (rd->tmpl) {
+		struct tmpl_line *tl;
+
+		if (rd->pos >= rd->tmpl->count)
+			return NULL;
+
+		tl = &rd->tmpl->lines[rd->pos++];
+		line = subst(tl->text, tl->num, rd->name);
+		if (!line)
+			warn("failed instantiating %s", rd->tmpl->path);
+		else if (rd->cpu >= 0)
+			line = spread(line, rd->cpu);
+
+		return line;
+	}
+
+	if (!rd->fp) {
+		if (!rd->lines)
+			return NULL;
+
+		line = strdup(rd->snap);
+		if (!line) {
+			warn("failed reading snapshot");
+			return NULL;
+		}
+		rd->snap += strlen(rd->snap) + 1;
+		rd->lines--;
+
+		return line;
+	}
+
+	while (!feof(rd->fp)) {
+		line = fparseln(rd->fp, NULL, NULL, NULL, FPARSELN_UNESCCOMM);
+		if (!line)
+			continue;
+
+		tabstospaces(line);
+//		dbg("raw: %s", line);
+		line = instantiate(line, rd->name);
+//		dbg("ins: %s", line);
+
+		return line;
+	}
+
+	return NULL;
+}
+
+/* Returns non-zero if any line is a global setting */
+static int parse_lines(struct conf_reader *rd, char *file, int is_rcsd)
+{
+	struct rlimit rlimit[RLIMIT_NLIMITS];
+	int globals = 0;
+	char *line;
+
+	/* Prepare default limits and group for each service in /etc/finit.d/ */
+	if (is_rcsd) {
+		memcpy(rlimit, global_rlimit, sizeof(rlimit));
+		cgroup_current[0] = 0;
+	}
+
+	while ((line = conf_getline(rd))) {
+		if (!is_dynamic(line))
+			globals = 1;
+
+		if (!parse_static(line, is_rcsd))
+			;
+		else if (!parse_dynamic(line, is_rcsd ? rlimit : global_rlimit, file))
+			;
+		else
+			parse_env(line);
+
+		free(line);
+	}
+
+	return globals;
+}
+
+/*
+ * A template with instances:N in its stanza is expanded to instances
+ * 1..N, as if enabled/foo@1.conf .. foo@N.conf had been created.  With
+ * instances:N:spread each instance also gets a CPU, cpus:0 .. cpus:N-1,
+ * wrapping around at the number of online CPUs.
+ */
+static int parse_instances(char *file, int is_rcsd)
+{
+	struct conf_reader rd = { 0 };
+	int num = 0, cpu = 0, globals = 0;
+	char name[16];
+	struct tmpl *t;
+
+	t = tmpl_get(file);
+	if (!t)
+		return 0;
+
+	for (size_t i = 0; i < t->count && !num; i++) {
+		char *ptr = strstr(t->lines[i].text, INSTANCES_OPT);
+
+		if (ptr)
+			num = conf_parse_instances(ptr + strlen(INSTANCES_OPT), &cpu);
+	}
+	if (!num) {
+		dbg("*** Skipping template file %s", file);
+		return 0;
+	}
+
+	for (int i = 1; i <= num; i++) {
+		snprintf(name, sizeof(name), "%d", i);
+		dbg("*** instantiating %s from %s ...", name, file);
+
+		rd.tmpl = t;
+		rd.pos  = 0;
+		rd.name = name;
+		rd.cpu  = cpu ? (i - 1) % get_nprocs() : -1;
+		globals |= parse_lines(&rd, file, is_rcsd);
+	}
+	file_add(file, !is_rcsd || globals);
+
+	return 0;
+}
+
+static int parse_conf(char *file, int is_rcsd)
+{
+	struct conf_reader rd = { .cpu = -1 };
+	char name[65] = { 0 };
+	int globals;
+
+	if (is_template(file, name, sizeof(name))) {
+		if (!name[0])
+			return parse_instances(file, is_rcsd);
+		dbg("*** instantiating %s from %s ...", name, file);
+	}
+
+	rd.name = name;
+	rd.snap = snap_find(file, &rd.lines);
+	if (!rd.snap && name[0])
+		rd.tmpl = tmpl_get(file);
+	if (!rd.snap && !rd.tmpl) {
+		rd.fp = fopen(file, "r");
+		if (!rd.fp)
+			return 1;
+	}
+
+	dbg("*** Parsing %s%s", file, rd.snap ? " (snapshot)" : "");
+	globals = parse_lines(&rd, file, is_rcsd);
+
+	if (rd.fp)
+		fclose(rd.fp);
+	file_add(file, !is_rcsd || globals);
+
+	return 0;
+}
+
+/*
+ * Save all .conf files parsed by the latest reload to a snapshot, for
+ * use at next boot.  Files are read again, any one changed since the
+ * latest reload is included anyway, with its current content, since
+ * the snapshot is validated when used.
+ */
+static int snapshot_file(struct snap *sn, char *file)
+{
+	struct conf_reader rd = { .cpu = -1 };
+	char name[65] = { 0 };
+	size_t len = 0, sz = 0;
+	char *data = NULL;
+	struct stat st;
+	uint32_t num = 0;
+	char *line;
+	int rc;
+
+	if (is_template(file, name, sizeof(name)) && !name[0])
+		return 0;
+
+	rd.name = name;
+	rd.fp = fopen(file, "r");
+	if (!rd.fp)
+		return 0;	/* removed since reload, skip */
+
+	if (fstat(fileno(rd.fp), &st)) {
+		fclose(rd.fp);
+		return -1;
+	}
+
+	while ((line = conf_getline(&rd))) {
+		size_t n = strlen(line) + 1;
+
+		if (len + n > sz) {
+			char *ptr;
+
+			sz = (len + n) * 2;
+			ptr = realloc(data, sz);
+			if (!ptr) {
+				free(line);
+				free(data);
+				fclose(rd.fp);
+				return -1;
+			}
+			data = ptr;
+		}
+
+		memcpy(&data[len], line, n);
+		len += n;
+		num++;
+		free(line);
+	}
+	fclose(rd.fp);
+
+	rc = snap_add(sn, file, &st, data, len, num);
+	free(data);
+
+	return rc;
+}
+
+/**
+ * conf_snapshot - Save parsed .conf files for faster boot
+ *
+ * Called by `initctl compile`.  The snapshot is used at boot by
+ * parse_conf() for all .conf files that have not changed since.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int conf_snapshot(void)
+{
+	struct conf_file *cf;
+	struct snap *sn;
+	int rc = 0;
+
+	sn = snap_create(FINIT_SNAPSHOT, NULL, NULL);
+	if (!sn)
+		return 1;
+
+	TAILQ_FOREACH(cf, &conf_file_list, link) {
+		if (snapshot_file(sn, cf->path)) {
+			err(1, "Failed adding %s to snapshot", cf->path);
+			rc = 1;
+			break;
+		}
+	}
+
+	if (snap_commit(sn, rc))
+		return 1;
+
+	logit(LOG_NOTICE, "Saved snapshot of %s and %s/*.conf to %s", finit_conf, finit_rcsd, FINIT_SNAPSHOT);
+	return 0;
+}
+
+#ifdef PARALLEL_BOOT
+static pthread_t prefetch_tid;
+static int       prefetch_running;
+static char     *prefetch_buf;
+static size_t    prefetch_len;
+
+/*
+ * Runs in a helper thread, in parallel with fsck and mount -a, so must
+ * not touch any state of the main thread.  All .conf files are read
+ * into an in-memory snapshot, handed over to parse_conf() by joining
+ * the thread in conf_init().  Files that change before that, e.g. by
+ * being mounted over, fail the stat() check in snap_find().
+ */
+static void *prefetch(void *arg)
+{
+	const char *dirs[] = {
+		FINIT_SYSPATH_, FINIT_RUNPATH_, finit_rcsd, NULL
+	};
+	struct snap *sn;
+	char pattern[256];
+	glob_t gl;
+	int rc = 0;
+
+	sn = snap_create(NULL, &prefetch_buf, &prefetch_len);
+	if (!sn)
+		return NULL;
+
+	if (snapshot_file(sn, finit_conf))
+		rc = 1;
+
+	for (int i = 0; !rc && dirs[i]; i++) {
+		for (int enabled = 0; !rc && enabled < 2; enabled++) {
+			if (enabled && dirs[i] != finit_rcsd)
+				break;
+
+			snprintf(pattern, sizeof(pattern), "%s%s/*.conf", dirs[i], enabled ? "/enabled" : "");
+			if (glob(pattern, 0, NULL, &gl))
+				continue;
+
+			for (size_t j = 0; !rc && j < gl.gl_pathc; j++)
+				rc = snapshot_file(sn, gl.gl_pathv[j]);
+			globfree(&gl);
+		}
+	}
+
+	snap_commit(sn, rc);
+
+	return NULL;
+}
+
+/**
+ * conf_prefetch - Start reading .conf files in the background
+ *
+ * Called before fs_mount_all(), reading all .conf files in parallel
+ * with fsck and mount -a.  Not needed when booting with a snapshot
+ * from `initctl compile`.
+ */
+void conf_prefetch(void)
+{
+	if (rescue || fexist(FINIT_SNAPSHOT))
+		return;
+
+	if (pthread_create(&prefetch_tid, NULL, prefetch, NULL)) {
+		warn("Failed starting .conf prefetch thread");
+		return;
+	}
+	prefetch_running = 1;
+}
+
+/* Wait for prefetch thread and use its snapshot for the initial parse */
+static int prefetch_join(void)
+{
+	int rc;
+
+	if (!prefetch_running)
+		return -1;
+
+	pthread_join(prefetch_tid, NULL);
+	prefetch_running = 0;
+	if (!prefetch_buf)
+		return -1;
+
+	rc = snap_load_mem(prefetch_buf, prefetch_len);
+	prefetch_buf = NULL;
+
+	return rc;
+}
+#else
+#define prefetch_join() -1
+#endif
+
+static void glob_append(glob_t *gl, int append, const char *fmt, ...)
+{
+	va_list ap;
+	size_t len;
+	char *path;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	path = alloca(++len);
+	if (!path) {
+		warn("failed alloca() in glob_append()");
+		return;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(path, len, fmt, ap);
+	va_end(ap);
+
+	dbg("conf_reload(): glob %s ...", path);
+	glob(path, append ? GLOB_APPEND : 0, NULL, gl);
+}
+
+/*
+ * Next, read all *.conf in /lib/finit/system and /etc/finit.d/
+ * The system files were previously created at runtime by plugins
+ * but are now regular files that can be overridden by files in
+ * /etc/finit.d -- similar to how tmfiles.d(5) work.  E.g., add
+ * an override .conf, or an ignore by symlinking to /dev/null
+ *
+ * The .conf files (and run/task/service stanzas) are parsed and
+ * started in order.  Each directory is sorted alphanumerically
+ * and then the result is appended to the overall order:
+ *
+ *     /lib/finit/system/10-hotplug.conf
+ *     /lib/finit/system/90-testserv.conf
+ *     /run/finit/system/dbus.conf
+ *     /run/finit/system/tty.conf
+ *     /etc/finit.d/10-abc.conf
+ *     /etc/finit.d/20-abc.conf
+ *     /etc/finit.d/enabled/1-aaa.conf
+ *     /etc/finit.d/enabled/1-abc.conf
+ *     /etc/finit.d/enabled/2-aaa.conf
+ */
+static void conf_glob(glob_t *gl)
+{
+	glob_append(gl, 0, "%s/*.conf", FINIT_SYSPATH_);
+	glob_append(gl, 1, "%s/*.conf", FINIT_RUNPATH_);
+	glob_append(gl, 1, "%s/*.conf", finit_rcsd);
+	glob_append(gl, 1, "%s/enabled/*.conf", finit_rcsd);
+}
+
+/* Changed .conf file is in use, i.e., is, or is the target of, a glob match */
+static int in_glob(glob_t *gl, char *name)
+{
+	for (size_t i = 0; i < gl->gl_pathc; i++) {
+		char *rp;
+		int rc;
+
+		rp = realpath(gl->gl_pathv[i], NULL);
+		if (!rp)
+			continue;
+
+		rc = string_compare(rp, name);
+		free(rp);
+		if (rc)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* System .conf files can be overridden, let full reload sort that out */
+static int is_override(char *name)
+{
+	const char *base = basenm(name);
+
+	return fexistf("%s/%s", FINIT_SYSPATH_, base) ||
+	       fexistf("%s/%s", FINIT_RUNPATH_, base);
+}
+
+/* Scan new, not yet parsed, content of a changed .conf for globals */
+static int has_globals(char *file)
+{
+	int globals = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return 0;
+
+	while (!globals && !feof(fp)) {
+		char *line;
+
+		line = fparseln(fp, NULL, NULL, NULL, FPARSELN_UNESCCOMM);
+		if (!line)
+			continue;
+
+		tabstospaces(line);
+		if (!is_dynamic(line))
+			globals = 1;
+		free(line);
+	}
+	fclose(fp);
+
+	return globals;
+}
+
+static char *svc_file(svc_t *svc)
+{
+	struct conf_file *cf;
+
+	cf = file_find_by_path(svc->file);
+	if (cf)
+		return cf->name;
+
+	return svc->file;
+}
+
+static int reparse_add(char *name)
+{
+	struct conf_change *node;
+
+	TAILQ_FOREACH(node, &conf_reparse_list, link) {
+		if (string_compare(node->name, name))
+			return 0;
+	}
+
+	node = malloc(sizeof(*node));
+	if (!node)
+		return -1;
+
+	node->name = strdup(name);
+	if (!node->name) {
+		free(node);
+		return -1;
+	}
+	TAILQ_INSERT_TAIL(&conf_reparse_list, node, link);
+
+	return 0;
+}
+
+static int reparse_find(char *name)
+{
+	struct conf_change *node;
+
+	TAILQ_FOREACH(node, &conf_reparse_list, link) {
+		if (string_compare(node->name, name))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void drop_reparse(void)
+{
+	struct conf_change *node, *tmp;
+
+	TAILQ_FOREACH_SAFE(node, &conf_reparse_list, link, tmp) {
+		TAILQ_REMOVE(&conf_reparse_list, node, link);
+		free(node->name);
+		free(node);
+	}
+}
+
+/*
+ * A changed env: file only affects the services that source it, but
+ * the .conf they are declared in must be re-parsed for register to
+ * detect the change.  Returns non-zero if that's not possible.
+ */
+static int env_changed(char *name)
+{
+	svc_t *svc, *iter = NULL;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		struct conf_file *cf;
+		char *env, *rp;
+		int match;
+
+		env = svc_getenv(svc);
+		if (!env)
+			continue;
+
+		rp = realpath(env, NULL);
+		match = string_compare(rp ?: env, name);
+		free(rp);
+		if (!match)
+			continue;
+
+		if (!svc->file[0])
+			return 1;
+
+		cf = file_find(svc_file(svc));
+		if (!cf || cf->globals)
+			return 1;
+
+		if (reparse_add(cf->name))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Check if an incremental reload is possible, i.e., only .conf files
+ * with service stanzas, or env: files, have changed.  If so, only the
+ * services declared in affected files are marked for removal.
+ */
+static int conf_incremental(glob_t *gl)
+{
+	struct conf_change *node;
+	svc_t *svc, *iter = NULL;
+
+	if (bootstrap || rescue || TAILQ_EMPTY(&conf_change_list))
+		return 0;
+
+	TAILQ_FOREACH(node, &conf_change_list, link) {
+		struct conf_file *cf = file_find(node->name);
+		size_t len = strlen(node->name);
+
+		if (cf && cf->globals)
+			goto full;
+
+		/* templates may have any number of instances */
+		if (strchr(basenm(node->name), '@'))
+			goto full;
+
+		if (len > 5 && !strcmp(&node->name[len - 5], ".conf")) {
+			/* removed, any services are swept */
+			if (!fexist(node->name))
+				continue;
+
+			if (!in_glob(gl, node->name)) {
+				if (cf)
+					goto full; /* e.g. included file */
+				continue;	   /* e.g. available/ but not enabled */
+			}
+
+			if (is_override(node->name) || has_globals(node->name))
+				goto full;
+			continue;
+		}
+
+		/* included file without .conf suffix */
+		if (cf)
+			goto full;
+
+		if (env_changed(node->name))
+			goto full;
+	}
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		char *name;
+
+		if (!svc->file[0])
+			continue;
+
+		name = svc_file(svc);
+		if (conf_find(name) || reparse_find(name))
+			svc_mark(svc);
+	}
+
+	return 1;
+full:
+	dbg("%s changed, full reload required.", node->name);
+	drop_reparse();
+	return 0;
+}
+
+/* On incremental reload, only files that have changed are re-parsed */
+static int conf_affected(char *path)
+{
+	char *rp;
+	int rc;
+
+	rp = realpath(path, NULL);
+	if (!rp)
+		return 0;
+
+	rc = conf_find(rp) || reparse_find(rp);
+	free(rp);
+
+	return rc;
+}
+
+/*
+ * Reload /etc/finit.conf and all *.conf in /etc/finit.d/
+ */
+int conf_reload(void)
+{
+	int incremental = 0;
+	glob_t gl;
+	size_t i;
+
+	/* Set time according to current time zone */
+	tzset();
+	dbg("Set time  daylight: %d  timezone: %ld  tzname: %s %s",
+	   daylight, timezone, tzname[0], tzname[1]);
+
+	if (!rescue) {
+		conf_glob(&gl);
+		incremental = conf_incremental(&gl);
+	}
+
+	if (incremental) {
+		dbg("Incremental reload, only changed .conf files.");
+	} else {
+		/* Mark and sweep */
+		cgroup_mark_all();
+		svc_mark_dynamic();
+		conf_reset_env();
+		service_jobs(-1, 0);
+		drop_files();
+
+		/*
+		 * Reset global rlimit to bootstrap values from conf_init().
+		 */
+		memcpy(global_rlimit, initial_rlimit, sizeof(global_rlimit));
+	}
+	which_flush();
+	usercache_flush();
+
+	/*
+	 * When built with --disable-rescue mode many other 'if (rescue)'
+	 * code paths are #ifdeffed out.  This one, and the ones in the
+	 * plugins, are not because a hook or plugin can still trigger
+	 * the alternative rescue.conf instead of finit.conf.  This for
 	 * very advanced use-cases where files on /etc are generated at
 	 * bootstrap, including users and passwords, from other sources.
 	 */
@@ -1253,41 +2387,17 @@ int conf_reload(void)
 	}
 
 	/* First, read /etc/finit.conf */
-	parse_conf(finit_conf, 0);
-
-	/* Set global limits */
-	for (int i = 0; i < RLIMIT_NLIMITS; i++) {
-		if (setrlimit(i, &global_rlimit[i]) == -1)
-			logit(LOG_WARNING, "rlimit: Failed setting %s: %s",
-			      rlim2str(i), lim2str(&global_rlimit[i]));
+	if (!incremental) {
+		parse_conf(finit_conf, 0);
+
+		/* Set global limits */
+		for (int i = 0; i < RLIMIT_NLIMITS; i++) {
+			if (setrlimit(i, &global_rlimit[i]) == -1)
+				logit(LOG_WARNING, "rlimit: Failed setting %s: %s",
+				      rlim2str(i), lim2str(&global_rlimit[i]));
+		}
 	}
 
-	/*
-	 * Next, read all *.conf in /lib/finit/system and /etc/finit.d/
-	 * The system files were previously created at runtime by plugins
-	 * but are now regular files that can be overridden by files in
-	 * /etc/finit.d -- similar to how tmfiles.d(5) work.  E.g., add
-	 * an override .conf, or an ignore by symlinking to /dev/null
-	 *
-	 * The .conf files (and run/task/service stanzas) are parsed and
-	 * started in order.  Each directory is sorted alphanumerically
-	 * and then the result is appended to the overall order:
-	 *
-	 *     /lib/finit/system/10-hotplug.conf
-	 *     /lib/finit/system/90-testserv.conf
-	 *     /run/finit/system/dbus.conf
-	 *     /run/finit/system/tty.conf
-	 *     /etc/finit.d/10-abc.conf
-	 *     /etc/finit.d/20-abc.conf
-	 *     /etc/finit.d/enabled/1-aaa.conf
-	 *     /etc/finit.d/enabled/1-abc.conf
-	 *     /etc/finit.d/enabled/2-aaa.conf
-	 */
-	glob_append(&gl, 0, "%s/*.conf", FINIT_SYSPATH_);
-	glob_append(&gl, 1, "%s/*.conf", FINIT_RUNPATH_);
-	glob_append(&gl, 1, "%s/*.conf", finit_rcsd);
-	glob_append(&gl, 1, "%s/enabled/*.conf", finit_rcsd);
-
 	if (bootstrap) {
 		const char *fn = _PATH_VARRUN "finit/conf.order";
 		FILE *fp;
@@ -1323,6 +2433,9 @@ int conf_reload(void)
 		if (!path)
 			continue; /* skip, override exists */
 
+		if (incremental && !conf_affected(path))
+			continue;
+
 		/* Check that it's an actual file ... beyond any symlinks */
 		if (lstat(path, &st)) {
 			dbg("Skipping %s, cannot access: %s", path, strerror(errno));
@@ -1371,6 +2484,7 @@ done:
 
 	/* Drop record of all .conf changes */
 	drop_changes();
+	drop_reparse();
 
 	if (bootstrap)
 		wdog = svc_find("watchdog", "finit");
@@ -1508,6 +2622,7 @@ static int conf_iwatch_read(int fd)
 	if (sz <= 0)
 		return -1;
 	ev_buf[sz] = 0;
+	iwatch_coalesce(ev_buf, sz);
 
 	for (off = 0; off < (size_t)sz; off += sizeof(*ev) + ev->len) {
 		struct iwatch_path *iwp;
@@ -1538,6 +2653,8 @@ static int conf_iwatch_read(int fd)
 
 static void conf_cb(uev_t *w, void *arg, int events)
 {
+	PROBE("conf");
+
 	if (conf_iwatch_read(w->fd)) {
 		err(1, "invalid inotify event");
 		return;
@@ -1588,7 +2705,12 @@ int conf_monitor(void)
 	rc += iwatch_add(&iw_conf, FINIT_SYSCONFIG, IN_ONLYDIR);
 #endif
 
-	return rc + conf_reload();
+	rc += conf_reload();
+
+	/* Snapshot only used at boot, later changes are read as usual */
+	snap_unload();
+
+	return rc;
 }
 
 /*
@@ -1623,15 +2745,24 @@ int conf_init(uev_ctx_t *ctx)
 	}
 #endif
 	/*
-	 * Start kernel event daemon as soon as possible, if enabled
+	 * Start kernel event daemon as soon as possible, if enabled,
+	 * unless the kevent plugin does the same job in-process.
 	 */
+#ifndef HAVE_KEVENT_PLUGIN
 	if (whichp(FINIT_EXECPATH_ "/keventd"))
 		conf_save_service(SVC_TYPE_SERVICE, "[S12345789] cgroup.init notify:none "
 				  FINIT_EXECPATH_ "/keventd -- Finit kernel event daemon", "keventd.conf");
+#endif
 
 	dbg("Allow plugins to register early runlevel 1 run/task/services ...");
 	plugin_run_hooks(HOOK_SVC_PLUGIN);
 
+	/* Use snapshot from `initctl compile`, if available, for all .conf */
+	if (!snap_load(FINIT_SNAPSHOT))
+		logit(LOG_INFO, "Using configuration snapshot %s", FINIT_SNAPSHOT);
+	else if (!prefetch_join())
+		dbg("Using .conf files prefetched during mount");
+
 	/* Read global rlimits and global cgroup setup from /etc/finit.conf */
 	parse_conf(finit_conf, 0);
 
@@ -1651,7 +2782,7 @@ int conf_init(uev_ctx_t *ctx)
 	 */
 	if (runparts && fisdir(runparts) && !rescue) {
 		char conf[sizeof(_PATH_RUNPARTS) + strlen(runparts) + 100];
-		char args[10] = { 0 };
+		char args[32] = { 0 };
 
 		if (debug)
 			strlcat(args, "-d ", sizeof(args));
@@ -1659,6 +2790,12 @@ int conf_init(uev_ctx_t *ctx)
 			strlcat(args, "-p ", sizeof(args));
 		if (runparts_sysv)
 			strlcat(args, "-s ", sizeof(args));
+		if (runparts_jobs) {
+			char jobs[16];
+
+			snprintf(jobs, sizeof(jobs), "-j %d ", runparts_jobs > 0 ? runparts_jobs : 0);
+			strlcat(args, jobs, sizeof(args));
+		}
 
 		snprintf(conf, sizeof(conf), "[S] <int/bootstrap> notify:none log:console %s %s %s"
 			 " -- Calling runparts %s in the background",
@@ -41,13 +41,18 @@ void conf_reload          (void);
 int  conf_any_change      (void);
 int  conf_changed         (char *file);
 int  conf_monitor         (void);
+int  conf_snapshot        (void);
+void conf_prefetch        (void);
 
 void conf_reset_env       (void);
 void conf_saverc          (void);
 void conf_save_exec_order (svc_t *svc, char *cmdline, int result);
+void conf_flush_exec_order(void);
 void conf_save_service    (int type, char *cfg, char *file);
+void conf_parse_container (int argc, char *argv[]);
 void conf_parse_cmdline   (int argc, char *argv[]);
 int  conf_parse_runlevels (char *runlevels);
+int  conf_parse_instances (char *arg, int *spread);
 void conf_parse_cond      (svc_t *svc, char *cond);
 
 #endif	/* FINIT_CONF_H_ */
@@ -0,0 +1,191 @@
+/* Non-blocking console output queue for Finit's own messages
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"		/* Generated by configure script */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "finit.h"
+#include "conout.h"
+#include "helpers.h"
+#include "metrics.h"
+
+/*
+ * On slow serial consoles a burst of progress or crash messages would
+ * throttle PID 1 to the UART speed.  Instead, Finit writes to its own
+ * non-blocking descriptor of the console, what the console does not
+ * take right away is queued and written from the event loop.  When the
+ * queue is full, new messages are dropped, and a summary of how many
+ * is printed when the console has caught up.
+ *
+ * Until conout_init(), and after conout_sync() at shutdown, output is
+ * written synchronously to stderr, as before.
+ */
+static char         queue[CONOUT_QLEN];
+static size_t       qlen;
+static int          fd = -1;
+static uev_t        watcher;
+static unsigned int dropped;
+
+/* Write as much as the console takes, then wait for it to drain */
+static void drain(void)
+{
+	while (qlen > 0) {
+		ssize_t num;
+
+		num = write(fd, queue, qlen);
+		if (num == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				qlen = 0; /* console gone, e.g. hung up */
+			break;
+		}
+
+		qlen -= num;
+		memmove(queue, &queue[num], qlen);
+
+		if (!qlen && dropped) {
+			qlen = snprintf(queue, sizeof(queue), "\r\n*** %u console messages dropped ***\r\n", dropped);
+			dropped = 0;
+		}
+	}
+
+	if (qlen)
+		uev_io_start(&watcher);
+	else
+		uev_io_stop(&watcher);
+}
+
+static void conout_cb(uev_t *w, void *arg, int events)
+{
+	PROBE("conout");
+
+	if (UEV_ERROR == events) {
+		/* Console gone, fall back to synchronous writes */
+		close(fd);
+		fd  = -1;
+		qlen = 0;
+		return;
+	}
+
+	drain();
+}
+
+/**
+ * conout_write - Write to the console without blocking
+ * @buf: Message to write
+ * @len: Length of @buf
+ *
+ * Messages that do not fit in the queue are dropped in full, never
+ * truncated, so escape sequences for progress output are not broken.
+ *
+ * Returns:
+ * Always @len, or -1 on error in synchronous mode.
+ */
+ssize_t conout_write(const char *buf, size_t len)
+{
+	if (fd == -1)
+		return dprint(STDERR_FILENO, buf, len);
+
+	/* Make room, if the console has caught up */
+	if (qlen > 0)
+		drain();
+
+	if (qlen + len > sizeof(queue)) {
+		dropped++;
+		return len;
+	}
+
+	memcpy(&queue[qlen], buf, len);
+	qlen += len;
+	drain();
+
+	return len;
+}
+
+/**
+ * conout_sync - Flush queue and switch to synchronous console output
+ * @msec: Max time to wait for the console to drain
+ *
+ * Called at shutdown, before Finit stops the event loop.
+ */
+void conout_sync(int msec)
+{
+	struct pollfd pfd = { .events = POLLOUT };
+
+	if (fd == -1)
+		return;
+
+	pfd.fd = fd;
+	while (qlen > 0 && poll(&pfd, 1, msec) > 0) {
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+			break;
+		drain();
+	}
+
+	uev_io_stop(&watcher);
+	close(fd);
+	fd  = -1;
+	qlen = 0;
+}
+
+/**
+ * conout_init - Set up non-blocking console output
+ * @ctx: Event loop context
+ *
+ * The console is opened again via /proc, giving Finit a descriptor of
+ * its own with O_NONBLOCK, services inherit stderr unaffected.  If the
+ * console cannot be polled, e.g. a regular file in a container, Finit
+ * keeps writing synchronously.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero if console output remains synchronous.
+ */
+int conout_init(uev_ctx_t *ctx)
+{
+	fd = open("/proc/self/fd/2", O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+	if (fd == -1)
+		return 1;
+
+	if (uev_io_init(ctx, &watcher, conout_cb, NULL, fd, UEV_WRITE)) {
+		close(fd);
+		fd = -1;
+		return 1;
+	}
+	uev_io_stop(&watcher);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -21,23 +21,43 @@
  * THE SOFTWARE.
  */
 
+#include "config.h"		/* Generated by configure script */
+
 #include <fnmatch.h>
 #include <glob.h>
 #include <limits.h>
 #include <paths.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
 
 #include "finit.h"
 #include "cond.h"
 #include "helpers.h"
+#include "metrics.h"
 #include "pid.h"
 #include "plugin.h"
 #include "service.h"
 #include "iwatch.h"
 
-static struct iwatch iw_devmon;
+static struct iwatch iw_devmon = { .name = "devmon" };
 static uev_t devw;
+static uev_t uevw;
 static int fd;
 
+/*
+ * Only kernel add@ and remove@ uevents, dropping bind@, change@, and
+ * other noise.  The KEY=val pairs have no fixed offset, so matching on
+ * DEVNAME against registered conditions is done in uevent_cb().
+ */
+static struct sock_filter uevent_filter[] = {
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x61646440, 2, 0),	/* "add@" */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x72656d6f, 1, 0),	/* "remo" */
+	BPF_STMT(BPF_RET | BPF_K, 0),
+	BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+};
+
 struct dev_node {
 	TAILQ_ENTRY(dev_node) link;
 	char   *name;
@@ -206,6 +226,7 @@ static void devmon_cb(uev_t *w, void *arg, int events)
 	struct inotify_event *ev;
 	ssize_t sz;
 	size_t off;
+	PROBE("devmon");
 
 	sz = read(w->fd, ev_buf, sizeof(ev_buf) - 1);
 	if (sz <= 0) {
@@ -213,6 +234,7 @@ static void devmon_cb(uev_t *w, void *arg, int events)
 		return;
 	}
 	ev_buf[sz] = 0;
+	iwatch_coalesce(ev_buf, sz);
 
 	for (off = 0; off < (size_t)sz; off += sizeof(*ev) + ev->len) {
 		struct iwatch_path *iwp;
@@ -243,6 +265,97 @@ static void devmon_cb(uev_t *w, void *arg, int events)
 	}
 }
 
+/*
+ * Kernel uevents are sent after devtmpfs has created, or before it has
+ * removed, the device node, so conditions can be set directly instead of
+ * waiting for inotify on /dev.
+ */
+static void uevent_cb(uev_t *w, void *arg, int events)
+{
+	static char buf[8192];
+	struct sockaddr_nl sa;
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len  = sizeof(buf) - 1,
+	};
+	struct msghdr msg = {
+		.msg_name    = &sa,
+		.msg_namelen = sizeof(sa),
+		.msg_iov     = &iov,
+		.msg_iovlen  = 1,
+	};
+	char *action = NULL, *devname = NULL;
+	char cond[MAX_ARG_LEN];
+	ssize_t len;
+	char *ptr;
+	PROBE("uevent");
+
+	len = recvmsg(w->fd, &msg, 0);
+	if (len <= 0)
+		return;
+	if (sa.nl_pid)
+		return;		/* Not from kernel */
+	buf[len] = 0;
+
+	/* "ACTION@DEVPATH\0" followed by "KEY=val\0" pairs */
+	for (ptr = buf + strlen(buf) + 1; ptr < buf + len; ptr += strlen(ptr) + 1) {
+		if (!strncmp(ptr, "ACTION=", 7))
+			action = &ptr[7];
+		else if (!strncmp(ptr, "DEVNAME=", 8))
+			devname = &ptr[8];
+	}
+
+	if (!action || !devname)
+		return;
+
+	snprintf(cond, sizeof(cond), "dev/%s", devname);
+	if (!find_node(cond))
+		return;
+
+	dbg("uevent %s %s", action, cond);
+	if (!strcmp(action, "add"))
+		cond_set(cond);
+	else if (!strcmp(action, "remove"))
+		cond_clear(cond);
+}
+
+/* Optional, e.g. not available in containers, /dev inotify still works */
+static void uevent_init(uev_ctx_t *ctx)
+{
+	struct sock_fprog prog = {
+		.len    = sizeof(uevent_filter) / sizeof(uevent_filter[0]),
+		.filter = uevent_filter,
+	};
+	struct sockaddr_nl sa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,		/* Kernel events, not udev */
+	};
+	int sz = 256 * 1024;
+	int sd;
+
+	sd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (sd == -1) {
+		dbg("No kernel uevent socket: %s", strerror(errno));
+		return;
+	}
+
+	if (setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)))
+		dbg("Failed attaching uevent filter: %s", strerror(errno));
+	if (setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz)))
+		dbg("Failed increasing uevent socket buffer: %s", strerror(errno));
+
+	if (bind(sd, (struct sockaddr *)&sa, sizeof(sa))) {
+		dbg("Failed binding uevent socket: %s", strerror(errno));
+		close(sd);
+		return;
+	}
+
+	if (uev_io_init(ctx, &uevw, uevent_cb, NULL, sd, UEV_READ)) {
+		err(1, "Failed setting up I/O callback for uevent socket");
+		close(sd);
+	}
+}
+
 void devmon_init(uev_ctx_t *ctx)
 {
 	char dir[MAX_ARG_LEN];
@@ -262,6 +375,8 @@ void devmon_init(uev_ctx_t *ctx)
 		return;
 	}
 
+	uevent_init(ctx);
+
 	strlcpy(dir, _PATH_DEV, sizeof(dir));
 	if (devmon_add_path(&iw_devmon, dir))
 		iwatch_exit(&iw_devmon);
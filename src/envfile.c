@@ -0,0 +1,361 @@
+/* Cache of parsed service env: files
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+#include <wordexp.h>
+
+#include "envfile.h"
+#include "finit.h"
+#include "log.h"
+
+/*
+ * Env files are read and parsed by Finit, once, instead of by each
+ * forked child before exec.  The result is cached per path and reused
+ * until the file is changed or replaced, which is detected by stat().
+ *
+ * Values without any expansions are stored fully expanded.  The rest,
+ * e.g. `FOO=$HOME/bar`, must still be expanded by the child, after it
+ * has dropped privileges and changed HOME, like before.
+ */
+struct envvar {
+	TAILQ_ENTRY(envvar) link;
+	char *key;
+	char *val;
+	int   expand;
+};
+
+struct envfile {
+	TAILQ_ENTRY(envfile) link;
+	TAILQ_HEAD(, envvar) vars;
+
+	char           *path;
+	dev_t           dev;
+	ino_t           ino;
+	off_t           size;
+	struct timespec mtime;
+};
+
+static TAILQ_HEAD(, envfile) envfiles = TAILQ_HEAD_INITIALIZER(envfiles);
+
+
+static void expand(char *key, char *value)
+{
+	wordexp_t we = { 0 };
+	char *val;
+	size_t i;
+
+	val = alloca(LINE_SIZE);
+	if (!val) {
+		setenv(key, value, 1);
+		return;
+	}
+
+	switch (wordexp(value, &we, 0)) {
+	case 0:
+		for (i = 0, *val = 0; i < we.we_wordc; i++) {
+			if (i > 0)
+				strlcat(val, " ", LINE_SIZE);
+			strlcat(val, we.we_wordv[i], LINE_SIZE);
+		}
+		setenv(key, val, 1);
+		wordfree(&we);
+		break;
+
+	case WRDE_NOSPACE:
+		wordfree(&we);
+		/* fallthrough */
+	default:
+		setenv(key, value, 1);
+		break;
+	}
+}
+
+/*
+ * Expansions that depend on the environment, or the file system, of
+ * the child.  Without them wordexp() only does quote removal and field
+ * splitting, which is safe to do in advance.
+ */
+static int need_expand(const char *value)
+{
+	return strpbrk(value, "$`~*?[") != NULL;
+}
+
+static int add(struct envfile *ef, char *key, char *value)
+{
+	struct envvar *var;
+
+	var = calloc(1, sizeof(*var));
+	if (!var)
+		return -1;
+
+	var->key = strdup(key);
+	var->expand = need_expand(value);
+	if (var->expand) {
+		var->val = strdup(value);
+	} else {
+		wordexp_t we = { 0 };
+		size_t i, len = 0;
+
+		if (!wordexp(value, &we, WRDE_NOCMD)) {
+			for (i = 0; i < we.we_wordc; i++)
+				len += strlen(we.we_wordv[i]) + 1;
+
+			var->val = calloc(1, len + 1);
+			for (i = 0; var->val && i < we.we_wordc; i++) {
+				if (i > 0)
+					strcat(var->val, " ");
+				strcat(var->val, we.we_wordv[i]);
+			}
+		} else
+			var->val = strdup(value);
+		wordfree(&we);
+	}
+
+	if (!var->key || !var->val) {
+		free(var->key);
+		free(var->val);
+		free(var);
+		return -1;
+	}
+
+	TAILQ_INSERT_TAIL(&ef->vars, var, link);
+	return 0;
+}
+
+static void flush(struct envfile *ef)
+{
+	struct envvar *var, *tmp;
+
+	TAILQ_FOREACH_SAFE(var, &ef->vars, link, tmp) {
+		TAILQ_REMOVE(&ef->vars, var, link);
+		free(var->key);
+		free(var->val);
+		free(var);
+	}
+}
+
+static int parse(struct envfile *ef)
+{
+	char *buf, *line;
+	FILE *fp;
+
+	fp = fopen(ef->path, "r");
+	if (!fp)
+		return -1;
+
+	buf = alloca(LINE_SIZE);
+	if (!buf) {
+		warn("Failed allocating temporary env buffer");
+		fclose(fp);
+		return -1;
+	}
+
+	line = buf;
+	while (fgets(line, LINE_SIZE, fp)) {
+		char *key = chomp(line);
+		char *value, *end;
+
+		/* skip any leading whitespace */
+		while (isspace(*key))
+			key++;
+
+		/* skip comments */
+		if (*key == '#' || *key == ';')
+			continue;
+
+		/* find end of line */
+		end = key;
+		while (*end)
+			end++;
+
+		/* strip trailing whitespace */
+		if (end > key) {
+			end--;
+			while (isspace(*end))
+				*end-- = 0;
+		}
+
+		value = strchr(key, '=');
+		if (!value)
+			continue;
+		*value++ = 0;
+
+		/* strip leading whitespace from value */
+		while (isspace(*value))
+			value++;
+
+		/* unquote value, if quoted */
+		if (value[0] == '"' || value[0] == '\'') {
+			char q = value[0];
+
+			if (*end == q) {
+				value = &value[1];
+				*end = 0;
+			}
+		}
+
+		/* find end of key */
+		end = key;
+		while (*end)
+			end++;
+
+		/* strip trailing whitespace */
+		if (end > key) {
+			end--;
+			while (isspace(*end))
+				*end-- = 0;
+		}
+
+		/* strip any leading 'set ' */
+		end = key;
+		if (!strncmp(key, "set", 3))
+			end += 3;
+
+		/* check key, no spaces allowed */
+		while (*end && isspace(*end))
+			end++;
+		key = end;
+		while (*end && !isspace(*end))
+			end++;
+		if (*end != 0) {
+			warnx("%s: '%s=%s': not a valid identifier", ef->path, key, value);
+			continue;	/* invalid key */
+		}
+
+		if (add(ef, key, value))
+			warn("%s: failed caching %s", ef->path, key);
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+static void drop(struct envfile *ef)
+{
+	TAILQ_REMOVE(&envfiles, ef, link);
+	flush(ef);
+	free(ef->path);
+	free(ef);
+}
+
+/**
+ * envfile_get - Get parsed env file, read it only if changed
+ * @path: Absolute path to env file
+ *
+ * Called by Finit before forking a service, the result is passed to
+ * envfile_apply() in the child.
+ *
+ * Returns:
+ * Cached env file, or %NULL if the file does not exist.
+ */
+struct envfile *envfile_get(char *path)
+{
+	struct envfile *ef;
+	struct stat st;
+
+	TAILQ_FOREACH(ef, &envfiles, link) {
+		if (!strcmp(ef->path, path))
+			break;
+	}
+
+	if (stat(path, &st)) {
+		if (ef)
+			drop(ef);
+		return NULL;
+	}
+
+	if (ef) {
+		if (ef->dev == st.st_dev && ef->ino == st.st_ino && ef->size == st.st_size &&
+		    ef->mtime.tv_sec == st.st_mtim.tv_sec && ef->mtime.tv_nsec == st.st_mtim.tv_nsec)
+			return ef;
+
+		dbg("%s changed, reloading.", path);
+		flush(ef);
+	} else {
+		ef = calloc(1, sizeof(*ef));
+		if (!ef)
+			return NULL;
+
+		ef->path = strdup(path);
+		if (!ef->path) {
+			free(ef);
+			return NULL;
+		}
+		TAILQ_INIT(&ef->vars);
+		TAILQ_INSERT_TAIL(&envfiles, ef, link);
+	}
+
+	if (parse(ef)) {
+		drop(ef);
+		return NULL;
+	}
+
+	ef->dev   = st.st_dev;
+	ef->ino   = st.st_ino;
+	ef->size  = st.st_size;
+	ef->mtime = st.st_mtim;
+
+	return ef;
+}
+
+/**
+ * envfile_apply - Set environment variables from env file
+ * @ef: Env file from envfile_get()
+ *
+ * Called in the privsepped child, after the global environment from
+ * finit.conf, so an env file can override it.  Variables in the file
+ * are set in order, so one can refer to another.
+ */
+void envfile_apply(struct envfile *ef)
+{
+	struct envvar *var;
+
+	if (!ef)
+		return;
+
+	TAILQ_FOREACH(var, &ef->vars, link) {
+		if (var->expand)
+			expand(var->key, var->val);
+		else
+			setenv(var->key, var->val, 1);
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
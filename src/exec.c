@@ -25,6 +25,7 @@
 #include "config.h"		/* Generated by configure script */
 
 #include <err.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <sysexits.h>
 #include <sys/ioctl.h>
@@ -41,6 +42,7 @@
 
 #include "finit.h"
 #include "cgroup.h"
+#include "cond.h"
 #include "conf.h"
 #include "helpers.h"
 #include "sig.h"
@@ -48,6 +50,7 @@
 #include "utmp-api.h"
 
 #define NUM_ARGS    16
+#define EXEC_MAX_JOBS 64
 
 
 /* Wait for process completion, returns status of waitpid(2) syscall */
@@ -69,22 +72,203 @@ int complete(char *cmd, int pid)
 	return status;
 }
 
-static int do_redirect(void)
+/*
+ * Async helper jobs, collected by service_monitor() via exec_collect().
+ * Output from a job started with a 'log' prefix is read from a pipe by
+ * an I/O watcher, so neither the helper nor its logging blocks PID 1.
+ */
+struct job {
+	pid_t  pid;
+	int    fd;
+	uev_t  io;
+	char  *log;
+	void (*cb)(void *arg, int status);
+	void  *arg;
+
+	size_t len;
+	char   buf[256];
+};
+
+static struct job *jobs[EXEC_MAX_JOBS];
+
+/*
+ * Split 'cmd' into an argv[] for posix_spawnp(), handles simple quoting:
+ * run("su -c \"dbus-daemon --system\" messagebus");
+ *   => "su", "-c", "\"dbus-daemon --system\"", "messagebus"
+ *
+ * Returns the (modifiable) copy of 'cmd' that args[] points into.
+ */
+static char *split(char *cmd, char *args[])
 {
-	FILE *fp;
+	char *backup, *arg;
+	int i = 0;
+
+	/* We must create a copy that is possible to modify. */
+	backup = arg = strdup(cmd);
+	if (!arg)
+		return NULL;
+
+	args[i++] = strsep(&arg, "\t ");
+	while (arg && i < NUM_ARGS) {
+		if (*arg == '\'' || *arg == '"') {
+			char *p, delim[2] = " ";
+
+			delim[0]  = arg[0];
+			args[i++] = arg++;
+			strsep(&arg, delim);
+			 p     = arg - 1;
+			*p     = *delim;
+			*arg++ = 0;
+		} else {
+			args[i++] = strsep(&arg, "\t ");
+		}
+	}
+	args[i] = NULL;
+
+	if (i == NUM_ARGS && arg) {
+		warnx("Command too long: %s", cmd);
+		free(backup);
+		errno = EOVERFLOW;
+		return NULL;
+	}
+
+	return backup;
+}
+
+/*
+ * Start 'cmd' using posix_spawn(), i.e., vfork() semantics, so we do
+ * not have to copy the page tables of PID 1 for every little helper.
+ * The child gets its own session, an empty signal mask, and default
+ * signal dispositions, same as sig_unblock() does for fork()'ed ones.
+ *
+ * With 'log' set, 'cmd' is run by the shell (like popen) and 'fd' is
+ * set to the read end of a pipe connected to its stdout.  Otherwise
+ * 'cmd' is split into tokens and all output goes to /dev/null.
+ */
+static pid_t spawn(char *cmd, char *log, int *fd)
+{
+	char *args[NUM_ARGS + 1] = { 0 };
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	int pfd[2] = { -1, -1 };
+	char *backup = NULL;
+	sigset_t mask;
+	pid_t pid = -1;
+	short flags;
+	int rc;
+
+	if (log) {
+		args[0] = "sh";
+		args[1] = "-c";
+		args[2] = cmd;
+		args[3] = NULL;
+
+		if (pipe2(pfd, O_CLOEXEC)) {
+			warn("Failed creating pipe for %s", cmd);
+			return -1;
+		}
+	} else {
+		backup = split(cmd, args);
+		if (!backup)
+			return -1;
+	}
+
+	posix_spawn_file_actions_init(&fa);
+	if (log) {
+		posix_spawn_file_actions_adddup2(&fa, pfd[1], STDOUT_FILENO);
+	} else {
+		posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDWR, 0);
+		posix_spawn_file_actions_adddup2(&fa, STDIN_FILENO, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&fa, STDIN_FILENO, STDERR_FILENO);
+	}
+
+	posix_spawnattr_init(&attr);
+#ifdef POSIX_SPAWN_SETSID
+	flags = POSIX_SPAWN_SETSID;
+#else
+	flags = POSIX_SPAWN_SETPGROUP;
+#endif
+	posix_spawnattr_setflags(&attr, flags | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigfillset(&mask);
+	sigdelset(&mask, SIGKILL);
+	sigdelset(&mask, SIGSTOP);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+
+	rc = posix_spawnp(&pid, log ? _PATH_BSHELL : args[0], &fa, &attr, args, environ);
+	if (rc) {
+		errno = rc;
+		warn("Failed starting %s", log ? cmd : args[0]);
+		pid = -1;
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	if (backup)
+		free(backup);
+
+	if (log) {
+		close(pfd[1]);
+		if (pid == -1)
+			close(pfd[0]);
+		else
+			*fd = pfd[0];
+	}
+
+	return pid;
+}
+
+/* Translate waitpid() status of 'cmd' to a return value for run() */
+static int result(char *cmd, int status)
+{
+	int rc;
+
+	if (-1 == status)
+		return 1;
 
-	fp = fopen("/dev/null", "w");
-	if (fp) {
-		int fd = fileno(fp);
+	rc = WEXITSTATUS(status);
+	if (WIFEXITED(status)) {
+		dbg("Started '%s' and exit without signal, status: %d", cmd, rc);
+	} else if (WIFSIGNALED(status)) {
+		dbg("Process '%s' terminated by signal %d", cmd, WTERMSIG(status));
+		if (!rc)
+			rc = 1; /* Must alert callee the command did not complete successfully.
+				 * This is necessary since not all programs trap signals and
+				 * change their return code accordingly. --Jocke */
+	}
 
-		dup2(fd, STDIN_FILENO);
-		dup2(fd, STDOUT_FILENO);
-		dup2(fd, STDERR_FILENO);
+	return rc;
+}
+
+/* Start 'cmd' and wait for it, returns the waitpid() status, or -1 */
+static int run_wait(char *cmd, char *log)
+{
+	int fd = -1;
+	pid_t pid;
+
+	pid = spawn(cmd, log, &fd);
+	if (pid == -1)
+		return -1;
 
-		return fclose(fp);
+	if (fd != -1) {
+		char *pfx, buf[256];
+		FILE *fp;
+
+		fp = fdopen(fd, "r");
+		if (!fp) {
+			close(fd);
+		} else {
+			pfx = *log ? ": " : "";
+			while (fgets(buf, sizeof(buf), fp)) {
+				chomp(buf);
+				logit(LOG_NOTICE, "%s%s%s", log, pfx, buf);
+			}
+			fclose(fp);
+		}
 	}
 
-	return -1;
+	return complete(cmd, pid);
 }
 
 /*
@@ -95,105 +279,176 @@ static int do_redirect(void)
  */
 int run(char *cmd, char *log)
 {
-	char *args[NUM_ARGS + 1] = { 0 };
-	int status, result, i = 0;
-	char *backup = NULL;
-	pid_t pid;
+	return result(cmd, run_wait(cmd, log));
+}
 
-	if (!log) {
-		char *arg;
-
-		/* We must create a copy that is possible to modify. */
-		backup = arg = strdup(cmd);
-		if (!arg)
-			return 1;
-
-		/* Split command line into tokens of an argv[] array. */
-		args[i++] = strsep(&arg, "\t ");
-		while (arg && i < NUM_ARGS) {
-			/* Handle run("su -c \"dbus-daemon --system\" messagebus");
-			 *   => "su", "-c", "\"dbus-daemon --system\"", "messagebus" */
-			if (*arg == '\'' || *arg == '"') {
-				char *p, delim[2] = " ";
-
-				delim[0]  = arg[0];
-				args[i++] = arg++;
-				strsep(&arg, delim);
-				 p     = arg - 1;
-				*p     = *delim;
-				*arg++ = 0;
-			} else {
-				args[i++] = strsep(&arg, "\t ");
-			}
-		}
-		args[i] = NULL;
+/* Log all complete lines in job buffer, on EOF also any trailing text */
+static void job_log(struct job *job, int eof)
+{
+	char *pfx = *job->log ? ": " : "";
+	char *line, *nl;
+
+	line = job->buf;
+	while ((nl = memchr(line, '\n', job->len - (line - job->buf)))) {
+		*nl = 0;
+		logit(LOG_NOTICE, "%s%s%s", job->log, pfx, line);
+		line = nl + 1;
+	}
 
-		if (i == NUM_ARGS && arg) {
-			errx(1, "Command too long: %s", cmd);
-			free(backup);
-			errno = EOVERFLOW;
-			return 1;
-		}
+	job->len -= line - job->buf;
+	if (job->len && (eof || job->len == sizeof(job->buf) - 1)) {
+		job->buf[job->len] = 0;
+		logit(LOG_NOTICE, "%s%s%s", job->log, pfx, line);
+		job->len = 0;
 	}
+	memmove(job->buf, line, job->len);
+}
 
-	pid = fork();
-	if (0 == pid) {
-		char *pfx, buf[256];
-		FILE *pp;
-		int rc;
-
-		setsid();
-		sig_unblock();
-		if (!log) {
-			do_redirect();
-			execvp(args[0], args);
-			_exit(EX_OSERR);
+/* Read all currently available output, closes the pipe on EOF/error */
+static void job_read(struct job *job)
+{
+	while (job->fd != -1) {
+		ssize_t num;
+
+		num = read(job->fd, &job->buf[job->len], sizeof(job->buf) - 1 - job->len);
+		if (num > 0) {
+			job->len += num;
+			job_log(job, 0);
+			continue;
 		}
 
-		pp = popen(cmd, "r");
-		if (!pp)
-			_exit(EX_OSERR);
+		if (num == -1 && errno == EINTR)
+			continue;
+		if (num == -1 && errno == EAGAIN)
+			return;
 
-		pfx = *log ? ": " : "";
-		while (fgets(buf, sizeof(buf), pp)) {
-			chomp(buf);
-			logit(LOG_NOTICE, "%s%s%s", log, pfx, buf);
-		}
+		job_log(job, 1);
+		uev_io_stop(&job->io);
+		close(job->fd);
+		job->fd = -1;
+	}
+}
+
+static void job_cb(uev_t *w, void *arg, int events)
+{
+	(void)w;
+	(void)events;
+	job_read(arg);
+}
+
+/**
+ * run_async - start helper command without waiting for it
+ * @cmd: Command line to run
+ * @log: Log output with this prefix, "" for none, or %NULL to discard
+ * @cb:  Optional callback called with the waitpid() status on completion
+ * @arg: Argument to @cb
+ *
+ * Like run(), but returns as soon as @cmd has been started.  The exit
+ * status is delivered by exec_collect() from service_monitor(), so the
+ * event loop keeps reaping and serving API requests meanwhile.
+ *
+ * Before the event loop is up and at shutdown, i.e., when conditions
+ * are not available, this falls back to run() and calls @cb directly.
+ *
+ * @cb is called exactly once if @cmd could be started, and never if
+ * this function returns -1, so the caller still owns @arg then.
+ *
+ * Returns PID of the started process, 0 if it already completed, or
+ * -1 on error.
+ */
+pid_t run_async(char *cmd, char *log, void (*cb)(void *arg, int status), void *arg)
+{
+	struct job *job;
+	int i, fd = -1;
 
-		rc = pclose(pp);
-		if (rc == -1)
-			_exit(EX_OSERR);
-		_exit(WEXITSTATUS(rc));
-	} else if (-1 == pid) {
-		err(1, "%s", !log ? args[0] : cmd);
-		if (backup)
-			free(backup);
+	for (i = 0; i < EXEC_MAX_JOBS; i++) {
+		if (!jobs[i])
+			break;
+	}
+
+	if (!ctx || !cond_is_available() || i == EXEC_MAX_JOBS) {
+		int status;
+
+		status = run_wait(cmd, log);
+		if (status == -1)
+			return -1;
+		if (cb)
+			cb(arg, status);
+
+		return 0;
+	}
 
+	job = calloc(1, sizeof(*job));
+	if (!job || (log && !(job->log = strdup(log)))) {
+		warn("Failed starting %s", cmd);
+		free(job);
 		return -1;
 	}
 
-	status = complete(args[0], pid);
-	if (-1 == status) {
-		if (backup)
-			free(backup);
-		return 1;
+	job->pid = spawn(cmd, log, &fd);
+	if (job->pid == -1) {
+		free(job->log);
+		free(job);
+		return -1;
 	}
 
-	result = WEXITSTATUS(status);
-	if (WIFEXITED(status)) {
-		dbg("Started '%s' and exit without signal, status: %d", cmd, result);
-	} else if (WIFSIGNALED(status)) {
-		dbg("Process '%s' terminated by signal %d", cmd, WTERMSIG(status));
-		if (!result)
-			result = 1; /* Must alert callee the command did not complete successfully.
-				     * This is necessary since not all programs trap signals and
-				     * change their return code accordingly. --Jocke */
+	job->fd  = fd;
+	job->cb  = cb;
+	job->arg = arg;
+	if (fd != -1) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		if (uev_io_init(ctx, &job->io, job_cb, job, fd, UEV_READ)) {
+			warn("Failed watching output from %s", cmd);
+			close(fd);
+			job->fd = -1;
+		}
 	}
+	jobs[i] = job;
 
-	if (backup)
-		free(backup);
+	dbg("Started '%s' as PID %d", cmd, job->pid);
+
+	return job->pid;
+}
+
+/**
+ * exec_collect - collect an async helper started with run_async()
+ * @pid:    PID of the collected process
+ * @status: waitpid() status
+ *
+ * Called by service_monitor() for PIDs it does not know about.  Logs
+ * any remaining output and calls the completion callback, if any.
+ *
+ * Returns 0 if @pid was an async helper, otherwise 1.
+ */
+int exec_collect(pid_t pid, int status)
+{
+	struct job *job;
+	int i;
+
+	for (i = 0; i < EXEC_MAX_JOBS; i++) {
+		if (jobs[i] && jobs[i]->pid == pid)
+			break;
+	}
+	if (i == EXEC_MAX_JOBS)
+		return 1;
+
+	job = jobs[i];
+	jobs[i] = NULL;
+
+	job_read(job);
+	if (job->fd != -1) {
+		/* Output held open by a grandchild, stop listening */
+		uev_io_stop(&job->io);
+		close(job->fd);
+	}
+
+	if (job->cb)
+		job->cb(job->arg, status);
+
+	free(job->log);
+	free(job);
 
-	return result;
+	return 0;
 }
 
 int run_interactive(char *cmd, char *fmt, ...)
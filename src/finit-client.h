@@ -0,0 +1,90 @@
+/* Client library for the Finit API socket, see libfinit-client.c
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_CLIENT_LIB_H_
+#define FINIT_CLIENT_LIB_H_
+
+#include <sys/types.h>
+
+/*
+ * Stable API, unlike svc_t and other internals of Finit.  Bumped only
+ * on incompatible changes, together with the library version.
+ */
+#define FINIT_CLIENT_API 1
+
+typedef struct finit_conn finit_conn_t;
+
+/* Reply to a request, in the same order as the requests were sent */
+struct finit_reply {
+	unsigned int  tag;		/* From finit_send() */
+	int           ok;		/* 1: ACK, 0: NACK */
+	int           arg;		/* E.g., current runlevel */
+	int           arg2;		/* E.g., previous runlevel */
+	char          data[368];	/* Command specific, NUL terminated */
+};
+
+/* Brief status of a service, from finit_svc_dump() */
+struct finit_svc {
+	pid_t         pid;
+	int           state;		/* svc_state_t, see finit/svc.h */
+	int           type;		/* svc_type_t, see finit/svc.h */
+	int           block;		/* svc_block_t, see finit/svc.h */
+	int           status;		/* From waitpid(), if not running */
+	int           runlevels;	/* Bitmask, bit 0-9 */
+	unsigned int  restarts;
+	const char   *name;
+	const char   *id;
+	const char   *desc;
+	const char  **args;		/* NULL terminated, args[0] is the command */
+};
+
+finit_conn_t *finit_open      (const char *path);
+void          finit_close     (finit_conn_t *fc);
+
+int           finit_fd        (finit_conn_t *fc);
+int           finit_events    (finit_conn_t *fc);
+int           finit_pending   (finit_conn_t *fc);
+
+int           finit_send      (finit_conn_t *fc, int cmd, int arg, const char *data);
+int           finit_flush     (finit_conn_t *fc);
+int           finit_recv      (finit_conn_t *fc, struct finit_reply *reply, int timeout);
+int           finit_call      (finit_conn_t *fc, int cmd, int arg, const char *data, struct finit_reply *reply);
+
+int           finit_start     (finit_conn_t *fc, const char *job);
+int           finit_stop      (finit_conn_t *fc, const char *job);
+int           finit_restart   (finit_conn_t *fc, const char *job);
+int           finit_reload    (finit_conn_t *fc, const char *job);
+int           finit_runlevel  (finit_conn_t *fc, int *prevlevel);
+
+char         *finit_metrics   (finit_conn_t *fc, size_t *len);
+int           finit_svc_dump  (finit_conn_t *fc, int types, const char *filter,
+			       int (*cb)(const struct finit_svc *svc, void *arg), void *arg);
+
+#endif /* FINIT_CLIENT_LIB_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
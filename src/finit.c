@@ -48,16 +48,25 @@
 #include "cgroup.h"
 #include "cond.h"
 #include "conf.h"
+#include "conout.h"
 #include "devmon.h"
+#include "pathwatch.h"
 #include "helpers.h"
+#include "history.h"
 #include "private.h"
 #include "plugin.h"
+#include "psi.h"
+#include "readahead.h"
+#include "reexec.h"
 #include "service.h"
 #include "sig.h"
 #include "sm.h"
 #include "tty.h"
+#include "usercache.h"
 #include "util.h"
 #include "utmp-api.h"
+#include "wdt.h"
+#include "which.h"
 
 int   runlevel  = INIT_LEVEL;	/* Bootstrap 'S' */
 int   cfglevel  = RUNLEVEL;	/* Fallback if no configured runlevel */
@@ -67,9 +76,14 @@ int   debug     = 0;		/* debug mode from kernel cmdline */
 int   rescue    = 0;		/* rescue mode from kernel cmdline */
 int   single    = 0;		/* single user mode from kernel cmdline */
 int   bootstrap = 1;		/* set while bootrapping (for TTYs) */
+int   reexecd   = 0;		/* set if restarted by initctl reexec */
 int   kerndebug = 0;		/* set if /proc/sys/kernel/printk > 7 */
 int   syncsec   = 0;		/* reboot delay */
+int   kexecboot = 0;		/* reboot with kexec, if loaded */
+int   shutsec   = 30;		/* shutdown deadline */
 int   readiness = SVC_NOTIFY_PID;
+int   mntmode   = 0;		/* 1: parallel mount, from finit.mount */
+int   container = -1;		/* 1: container, from finit.container, -1: detect */
 char *finit_conf= NULL;
 char *finit_rcsd= NULL;
 char *fstab     = NULL;
@@ -199,15 +213,231 @@ char *fs_root_dev(char *real, size_t len)
 	return real;
 }
 
+/*
+ * Checks of one pass in /etc/fstab.  Checks of filesystems on different
+ * disks run in parallel, like fsck -A, checks on the same disk in turn.
+ */
+struct fsck_job {
+	TAILQ_ENTRY(fsck_job) link;
+	dev_t   disk;			/* whole disk, 0: unknown */
+	pid_t   pid;
+	int     rc;
+	FILE   *fp;			/* output, shown when done */
+	char    dev[192];
+};
+TAILQ_HEAD(fsck_head, fsck_job);
+
+/*
+ * Find the whole disk of a block device, or partition, so we do not
+ * run more than one check per disk at a time.  Returns 0 if unknown,
+ * all those are checked in turn.
+ */
+static dev_t fsck_disk(const char *dev)
+{
+	char path[256], buf[32];
+	struct stat st;
+	char *ptr;
+
+	if (string_match(dev, "UUID="))
+		snprintf(path, sizeof(path), "/dev/disk/by-uuid/%s", &dev[5]);
+	else if (string_match(dev, "LABEL="))
+		snprintf(path, sizeof(path), "/dev/disk/by-label/%s", &dev[6]);
+	else
+		strlcpy(path, dev, sizeof(path));
+
+	if (stat(path, &st) || !S_ISBLK(st.st_mode))
+		return 0;
+
+	/* Partitions have a partition file, their parent is the disk */
+	if (!fexistf("/sys/dev/block/%u:%u/partition", major(st.st_rdev), minor(st.st_rdev)))
+		return st.st_rdev;
+
+	if (fnread(buf, sizeof(buf), "/sys/dev/block/%u:%u/../dev",
+		   major(st.st_rdev), minor(st.st_rdev)) == -1)
+		return st.st_rdev;
+
+	ptr = strchr(buf, ':');
+	if (!ptr)
+		return st.st_rdev;
+	*ptr++ = 0;
+
+	return makedev(atoi(buf), atoi(ptr));
+}
+
+static int fsck_spawn(struct fsck_job *job)
+{
+	char *args[5];
+	int i = 0;
+
+	args[i++] = "fsck";
+	if (fsck_mode[0])
+		args[i++] = fsck_mode;
+	if (fsck_repair[0])
+		args[i++] = fsck_repair;
+	args[i++] = job->dev;
+	args[i]   = NULL;
+
+	dbg("Starting fsck of %s %s %s", job->dev, fsck_mode, fsck_repair);
+	job->fp  = tempfile();
+	job->pid = fork();
+	if (job->pid == 0) {
+		setsid();
+		sig_unblock();
+		if (job->fp) {
+			dup2(fileno(job->fp), STDOUT_FILENO);
+			dup2(fileno(job->fp), STDERR_FILENO);
+		}
+		execvp(args[0], args);
+		_exit(EX_OSERR);
+	}
+	if (job->pid == -1) {
+		err(1, "Failed starting fsck of %s", job->dev);
+		if (job->fp)
+			fclose(job->fp);
+		job->fp = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait for any running check to complete.  We poll each PID instead of
+ * using waitpid(-1), we must not reap processes started by plugins.
+ */
+static struct fsck_job *fsck_wait(struct fsck_head *running)
+{
+	struct fsck_job *job;
+
+	while (1) {
+		TAILQ_FOREACH(job, running, link) {
+			int status;
+			pid_t pid;
+
+			pid = waitpid(job->pid, &status, WNOHANG);
+			if (pid == 0 || (pid == -1 && errno == EINTR))
+				continue;
+
+			if (pid == -1) {
+				warn("Lost fsck of %s", job->dev);
+				job->rc = 8;	/* operational error */
+				return job;
+			}
+
+			/* Same as run(), a signal is not a success */
+			job->rc = WEXITSTATUS(status);
+			if (WIFSIGNALED(status) && !job->rc)
+				job->rc = 1;
+
+			return job;
+		}
+
+		usleep(20000);
+	}
+}
+
+/* Dump buffered output of a job on stderr, after its [ OK ] or [FAIL] */
+static void job_output(FILE **fp)
+{
+	char line[LINE_SIZE];
+	size_t len;
+
+	if (!*fp)
+		return;
+
+	rewind(*fp);
+	while ((len = fread(line, 1, sizeof(line), *fp)) > 0) {
+		if (fwrite(line, 1, len, stderr) != len)
+			break;
+	}
+	fclose(*fp);
+	*fp = NULL;
+}
+
+/* Show result of a check, with its output, when it is done */
+static void fsck_done(struct fsck_job *job)
+{
+	print(!!job->rc, "Checking filesystem %s", job->dev);
+	job_output(&job->fp);
+}
+
+static int fsck_busy(struct fsck_head *running, dev_t disk)
+{
+	struct fsck_job *job;
+
+	TAILQ_FOREACH(job, running, link) {
+		if (job->disk == disk)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Run all checks of a pass, one per disk at a time.  Returns the sum of
+ * all exit codes, like the serial checks, and sets failed if any of the
+ * checks failed, i.e., exited with 2 or larger.
+ */
+static int fsck_parallel(struct fsck_head *pending, int pass, int *failed)
+{
+	struct fsck_head running = TAILQ_HEAD_INITIALIZER(running);
+	struct fsck_job *job, *tmp;
+	int rc = 0;
+
+	while (!TAILQ_EMPTY(pending) || !TAILQ_EMPTY(&running)) {
+		TAILQ_FOREACH_SAFE(job, pending, link, tmp) {
+			if (fsck_busy(&running, job->disk))
+				continue;
+
+			TAILQ_REMOVE(pending, job, link);
+			if (fsck_spawn(job)) {
+				job->rc = 8;
+				fsck_done(job);
+				rc += job->rc;
+				*failed = 1;
+				free(job);
+				continue;
+			}
+			TAILQ_INSERT_TAIL(&running, job, link);
+		}
+
+		if (TAILQ_EMPTY(&running))
+			continue;
+
+		job = fsck_wait(&running);
+		TAILQ_REMOVE(&running, job, link);
+		dbg("Pass %d fsck of %s done, rc %d", pass, job->dev, job->rc);
+		fsck_done(job);
+
+		/*
+		 * "failure" is defined as exiting with a return code of
+		 * 2 or larger.  A return code of 1 indicates that filesystem
+		 * errors were corrected but that the boot may proceed.
+		 */
+		if (job->rc > 1) {
+			logit(LOG_CONSOLE | LOG_ALERT, "Failed fsck %s", job->dev);
+			*failed = 1;
+		}
+		rc += job->rc;
+		free(job);
+	}
+
+	return rc;
+}
+
 /*
  * Check all filesystems in /etc/fstab with a fs_passno > 0
  */
 static int fsck(int pass)
 {
+	struct fsck_head jobs = TAILQ_HEAD_INITIALIZER(jobs);
+	struct fsck_job *job;
 	struct mntent mount;
 	struct mntent *mnt;
 	char real[192];
 	char buf[256];
+	int failed = 0;
+	int num = 0;
 	int rc = 0;
 	FILE *fp;
 
@@ -218,9 +448,7 @@ static int fsck(int pass)
 	}
 	dbg("Opened %s, pass %d", fstab, pass);
 	while ((mnt = getmntent_r(fp, &mount, buf, sizeof(buf)))) {
-		int fsck_rc = 0;
 		struct stat st;
-		char cmd[256];
 		char *dev;
 
 		dbg("got: fsname '%s' dir '%s' type '%s' opts '%s' freq '%d' passno '%d'",
@@ -263,23 +491,41 @@ static int fsck(int pass)
 			continue;
 		}
 
-		snprintf(cmd, sizeof(cmd), "fsck %s %s %s", fsck_mode, fsck_repair, dev);
-		dbg("Running pass %d fsck command %s", pass, cmd);
-		fsck_rc = run_interactive(cmd, "Checking filesystem %s", dev);
-		/*
-		 * "failure" is defined as exiting with a return code of
-		 * 2 or larger.  A return code of 1 indicates that filesystem
-		 * errors were corrected but that the boot may proceed.
-		 */
-		if (fsck_rc > 1) {
-			logit(LOG_CONSOLE | LOG_ALERT, "Failed fsck %s, attempting sulogin ...", dev);
-			sulogin(1);
+		job = calloc(1, sizeof(*job));
+		if (!job) {
+			err(1, "Failed allocating fsck of %s", dev);
+			continue;
 		}
-		rc += fsck_rc;
+		strlcpy(job->dev, dev, sizeof(job->dev));
+		job->disk = fsck_disk(dev);
+		TAILQ_INSERT_TAIL(&jobs, job, link);
+		num++;
 	}
 
 	endmntent(fp);
 
+	if (num == 1) {
+		char cmd[256];
+
+		job = TAILQ_FIRST(&jobs);
+		TAILQ_REMOVE(&jobs, job, link);
+
+		snprintf(cmd, sizeof(cmd), "fsck %s %s %s", fsck_mode, fsck_repair, job->dev);
+		dbg("Running pass %d fsck command %s", pass, cmd);
+		rc = run_interactive(cmd, "Checking filesystem %s", job->dev);
+		if (rc > 1) {
+			logit(LOG_CONSOLE | LOG_ALERT, "Failed fsck %s", job->dev);
+			failed = 1;
+		}
+		free(job);
+	} else if (num > 1)
+		rc = fsck_parallel(&jobs, pass, &failed);
+
+	if (failed) {
+		logit(LOG_CONSOLE | LOG_ALERT, "Failed fsck, attempting sulogin ...");
+		sulogin(1);
+	}
+
 	return rc;
 }
 
@@ -422,32 +668,422 @@ static void fs_finalize(void)
 		fs_mount("tmpfs", "/tmp", "tmpfs", MS_NOSUID | MS_NODEV, "mode=1777");
 }
 
-static void fs_swapon(char *cmd, size_t len)
+/*
+ * Enable swap in the background, <sys/swap> is asserted when all swap
+ * devices in /etc/fstab have been handled, successfully or not.
+ */
+static int swap_pending;
+
+static void swap_done(void *arg, int status)
+{
+	char *dev = arg;
+
+	if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+		logit(LOG_WARNING, "Failed enabling swap %s", dev);
+	free(dev);
+
+	if (--swap_pending == 0)
+		cond_set_oneshot("sys/swap");
+}
+
+static void fs_swapon(void)
 {
 	struct mntent *mnt;
 	FILE *fp;
 
-	if (!whichp("swapon"))
+	swap_pending = 1;
+	if (!fstab || !whichp("swapon"))
+		goto done;
+
+	fp = setmntent(fstab, "r");
+	if (!fp)
+		goto done;
+
+	while ((mnt = getmntent(fp))) {
+		char cmd[256], *dev;
+
+		if (strcmp(mnt->mnt_type, MNTTYPE_SWAP))
+			continue;
+
+		dev = strdup(mnt->mnt_fsname);
+		if (!dev)
+			break;
+
+		swap_pending++;
+		snprintf(cmd, sizeof(cmd), "swapon %s", dev);
+		if (run_async(cmd, "swapon", swap_done, dev) == -1) {
+			swap_pending--;
+			free(dev);
+		}
+	}
+
+	endmntent(fp);
+done:
+	swap_done(NULL, 0);
+}
+
+/*
+ * Mounted file systems from /etc/fstab, the mnt/ conditions for them
+ * are asserted by fs_mount_cond() when the condition system is up.
+ */
+struct mnt_done {
+	TAILQ_ENTRY(mnt_done) link;
+	char dir[];
+};
+static TAILQ_HEAD(, mnt_done) mnt_done_list = TAILQ_HEAD_INITIALIZER(mnt_done_list);
+
+static void fs_mount_done(const char *dir)
+{
+	struct mnt_done *md;
+
+	if (!strcmp(dir, "/"))
 		return;
 
+	md = malloc(sizeof(*md) + strlen(dir) + 1);
+	if (!md)
+		return;
+
+	strcpy(md->dir, dir);
+	TAILQ_INSERT_TAIL(&mnt_done_list, md, link);
+}
+
+/*
+ * Assert mnt/<path> for each mounted file system, '/' in the path is
+ * replaced with '-', like systemd mount units, since mnt/var must not
+ * be both a condition and a directory for mnt/var/lib.
+ */
+static void fs_mount_cond(void)
+{
+	struct mnt_done *md, *tmp;
+
+	TAILQ_FOREACH_SAFE(md, &mnt_done_list, link, tmp) {
+		char cond[strlen(md->dir) + 5];
+		char *ptr;
+
+		snprintf(cond, sizeof(cond), "mnt/%s", &md->dir[1]);
+		for (ptr = &cond[4]; *ptr; ptr++) {
+			if (*ptr == '/')
+				*ptr = '-';
+		}
+		cond_set_oneshot(cond);
+
+		TAILQ_REMOVE(&mnt_done_list, md, link);
+		free(md);
+	}
+}
+
+/* Record all mounted file systems after a serial mount -a */
+static void fs_mount_scan(void)
+{
+	struct mntent *mnt;
+	FILE *fp;
+
 	fp = setmntent(fstab, "r");
 	if (!fp)
 		return;
 
 	while ((mnt = getmntent(fp))) {
-		if (strcmp(mnt->mnt_type, MNTTYPE_SWAP))
+		if (!strcmp(mnt->mnt_type, MNTTYPE_SWAP) || hasmntopt(mnt, "noauto"))
+			continue;
+
+		if (fismnt(mnt->mnt_dir))
+			fs_mount_done(mnt->mnt_dir);
+	}
+
+	endmntent(fp);
+}
+
+#define MOUNT_TIMEOUT 90	/* sec, default per mount in parallel mode */
+
+struct mount_job {
+	TAILQ_ENTRY(mount_job) link;
+	pid_t   pid;
+	int     rc;
+	int     nofail;
+	int     timeout;		/* sec */
+	long    deadline;		/* jiffies() */
+	FILE   *fp;
+	char   *spec;
+	char   *dir;
+	char   *type;
+	char    opts[];
+};
+TAILQ_HEAD(mount_head, mount_job);
+
+/* Timeout from x-finit.timeout=SEC, or x-systemd.mount-timeout=SEC */
+static int mount_timeout(struct mntent *mnt)
+{
+	const char *opt[] = { "x-finit.timeout", "x-systemd.mount-timeout" };
+	size_t i;
+
+	for (i = 0; i < NELEMS(opt); i++) {
+		char *ptr = hasmntopt(mnt, opt[i]);
+
+		if (ptr && ptr[strlen(opt[i])] == '=')
+			return atoi(&ptr[strlen(opt[i]) + 1]);
+	}
+
+	return MOUNT_TIMEOUT;
+}
+
+/* Copy mount options, except our own x-finit.* options */
+static void mount_opts(char *dst, size_t len, char *src)
+{
+	char buf[strlen(src) + 1];
+	char *opt, *ptr;
+
+	dst[0] = 0;
+	strlcpy(buf, src, sizeof(buf));
+	for (opt = strtok_r(buf, ",", &ptr); opt; opt = strtok_r(NULL, ",", &ptr)) {
+		if (!strncmp(opt, "x-finit.", 8))
 			continue;
+		if (dst[0])
+			strlcat(dst, ",", len);
+		strlcat(dst, opt, len);
+	}
+
+	if (!dst[0])
+		strlcpy(dst, "defaults", len);
+}
+
+static struct mount_job *mount_job_new(struct mntent *mnt)
+{
+	size_t olen = strlen(mnt->mnt_opts) + 10;
+	struct mount_job *job;
+
+	job = calloc(1, sizeof(*job) + olen);
+	if (!job)
+		return NULL;
+
+	job->spec = strdup(mnt->mnt_fsname);
+	job->dir  = strdup(mnt->mnt_dir);
+	job->type = strdup(mnt->mnt_type);
+	if (!job->spec || !job->dir || !job->type) {
+		free(job->spec);
+		free(job->dir);
+		free(job->type);
+		free(job);
+		return NULL;
+	}
+
+	mount_opts(job->opts, olen, mnt->mnt_opts);
+	job->nofail  = hasmntopt(mnt, "nofail") != NULL;
+	job->timeout = mount_timeout(mnt);
+
+	return job;
+}
+
+static void mount_job_free(struct mount_job *job)
+{
+	free(job->spec);
+	free(job->dir);
+	free(job->type);
+	free(job);
+}
+
+static int mount_spawn(struct mount_job *job)
+{
+	char *args[] = {
+		"mount", "-n", "-t", job->type, "-o", job->opts, job->spec, job->dir, NULL
+	};
+
+	dbg("Mounting %s on %s type %s opts %s", job->spec, job->dir, job->type, job->opts);
+	job->fp  = tempfile();
+	job->pid = fork();
+	if (job->pid == 0) {
+		setsid();
+		sig_unblock();
+		if (job->fp) {
+			dup2(fileno(job->fp), STDOUT_FILENO);
+			dup2(fileno(job->fp), STDERR_FILENO);
+		}
+		execvp(args[0], args);
+		_exit(EX_OSERR);
+	}
+	if (job->pid == -1) {
+		err(1, "Failed mounting %s", job->dir);
+		if (job->fp)
+			fclose(job->fp);
+		job->fp = NULL;
+		return -1;
+	}
+
+	job->deadline = job->timeout > 0 ? jiffies() + job->timeout : 0;
+
+	return 0;
+}
+
+/*
+ * Wait for any running mount to complete, or time out.  Like for fsck,
+ * each PID is polled, we must not reap processes started by plugins.
+ */
+static struct mount_job *mount_wait(struct mount_head *running)
+{
+	struct mount_job *job;
+
+	while (1) {
+		long now = jiffies();
+
+		TAILQ_FOREACH(job, running, link) {
+			int status;
+			pid_t pid;
+
+			pid = waitpid(job->pid, &status, WNOHANG);
+			if (pid == 0 && job->deadline && now >= job->deadline) {
+				logit(LOG_CONSOLE | LOG_WARNING, "Timeout mounting %s after %d sec, aborting.",
+				      job->dir, job->timeout);
+				/*
+				 * A mount stuck in D state cannot be killed,
+				 * leave any straggler to service_monitor()
+				 */
+				kill(job->pid, SIGKILL);
+				waitpid(job->pid, NULL, WNOHANG);
+				job->rc = ETIMEDOUT;
+				return job;
+			}
+			if (pid == 0 || (pid == -1 && errno == EINTR))
+				continue;
+
+			if (pid == -1)
+				job->rc = 1;
+			else if (WIFEXITED(status))
+				job->rc = WEXITSTATUS(status);
+			else
+				job->rc = 1;
 
-		snprintf(cmd, len, "swapon %s", mnt->mnt_fsname);
-		run_interactive(cmd, "Enabling swap %s", mnt->mnt_fsname);
+			return job;
+		}
+
+		usleep(20000);
+	}
+}
+
+/* Is a a parent of, or the same mount point as, b */
+static int mount_parent(const char *a, const char *b)
+{
+	size_t len = strlen(a);
+
+	if (!strcmp(a, "/"))
+		return 1;
+
+	return !strncmp(a, b, len) && (b[len] == '/' || b[len] == 0);
+}
+
+/*
+ * A mount must wait for all mounts of parent directories, and earlier
+ * mounts on the same directory, listed before it in /etc/fstab.
+ */
+static int mount_blocked(struct mount_head *pending, struct mount_head *running,
+			 struct mount_job *job)
+{
+	struct mount_job *j;
+
+	TAILQ_FOREACH(j, running, link) {
+		if (mount_parent(j->dir, job->dir))
+			return 1;
 	}
 
+	TAILQ_FOREACH(j, pending, link) {
+		if (j == job)
+			break;
+		if (mount_parent(j->dir, job->dir))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Parallel version of mount -a.  Independent file systems are mounted
+ * at the same time, each with a timeout.  Returns non-zero if any
+ * mount, without the nofail option, failed.
+ */
+static int fs_mount_parallel(void)
+{
+	struct mount_head pending = TAILQ_HEAD_INITIALIZER(pending);
+	struct mount_head running = TAILQ_HEAD_INITIALIZER(running);
+	struct mount_job *job, *tmp;
+	struct mntent *mnt;
+	int failed = 0;
+	FILE *fp;
+
+	fp = setmntent(fstab, "r");
+	if (!fp)
+		return 1;
+
+	while ((mnt = getmntent(fp))) {
+		if (!strcmp(mnt->mnt_type, MNTTYPE_SWAP) || hasmntopt(mnt, "noauto"))
+			continue;
+
+		/* Like mount -a, skip already mounted, e.g., / and /proc */
+		if (fismnt(mnt->mnt_dir)) {
+			fs_mount_done(mnt->mnt_dir);
+			continue;
+		}
+
+		job = mount_job_new(mnt);
+		if (!job) {
+			err(1, "Failed allocating mount of %s", mnt->mnt_dir);
+			failed = 1;
+			continue;
+		}
+		TAILQ_INSERT_TAIL(&pending, job, link);
+	}
 	endmntent(fp);
+
+	while (!TAILQ_EMPTY(&pending) || !TAILQ_EMPTY(&running)) {
+		TAILQ_FOREACH_SAFE(job, &pending, link, tmp) {
+			if (mount_blocked(&pending, &running, job))
+				continue;
+
+			TAILQ_REMOVE(&pending, job, link);
+			if (mount_spawn(job)) {
+				print(1, "Mounting %s", job->dir);
+				if (!job->nofail)
+					failed = 1;
+				mount_job_free(job);
+				continue;
+			}
+			TAILQ_INSERT_TAIL(&running, job, link);
+		}
+
+		if (TAILQ_EMPTY(&running))
+			continue;
+
+		job = mount_wait(&running);
+		TAILQ_REMOVE(&running, job, link);
+
+		print(!!job->rc, "Mounting %s", job->dir);
+		job_output(&job->fp);
+		if (job->rc) {
+			if (!job->nofail)
+				failed = 1;
+		} else
+			fs_mount_done(job->dir);
+		mount_job_free(job);
+	}
+
+	return failed;
 }
 
 static void fs_mount_all(void)
 {
 	char cmd[256] = "mount -na";
+	int cont = in_container();
+	int rc = 0;
+
+	/*
+	 * In a container the runtime has set up our file systems, so
+	 * there is no root to fsck or remount, and no swap to enable.
+	 * An /etc/fstab is optional, mounted if it exists.
+	 */
+	if (cont) {
+		dbg("Container, skipping fsck, remount of /, and swap ...");
+		plugin_run_hooks(HOOK_ROOTFS_UP);
+		if (fstab && fexist(fstab))
+			goto mount;
+		goto finalize;
+	}
 
 	if (!fstab || !fexist(fstab)) {
 		logit(LOG_CONSOLE | LOG_NOTICE, "%s system fstab %s, trying fallback ...",
@@ -473,19 +1109,23 @@ static void fs_mount_all(void)
 
 	dbg("Root FS up, calling hooks ...");
 	plugin_run_hooks(HOOK_ROOTFS_UP);
-
+mount:
 	if (fstab && strcmp(fstab, "/etc/fstab"))
 		snprintf(cmd, sizeof(cmd), "mount -na -T %s", fstab);
 
-	if (run_interactive(cmd, "Mounting filesystems from %s", fstab))
+	if (mntmode) {
+		rc = fs_mount_parallel();
+	} else {
+		rc = run_interactive(cmd, "Mounting filesystems from %s", fstab);
+		fs_mount_scan();
+	}
+	if (rc)
 		plugin_run_hooks(HOOK_MOUNT_ERROR);
 
 	dbg("Calling extra mount hook, after mount -a ...");
 	plugin_run_hooks(HOOK_MOUNT_POST);
 
-	dbg("Enable any swap ...");
-	fs_swapon(cmd, sizeof(cmd));
-
+finalize:
 	dbg("Finalize, ensure common file systems are available ...");
 	fs_finalize();
 
@@ -516,6 +1156,16 @@ static void fs_init(void)
 	/* mask writable bit for g and o */
 	umask(022);
 
+	/*
+	 * Container runtimes provide /dev and /sys, we only need /proc
+	 * and can skip scanning /proc/mounts for the others.
+	 */
+	if (in_container()) {
+		if (!fisdir("/proc/self"))
+			fs_mount(fs[0].spec, fs[0].file, fs[0].type, 0, NULL);
+		return;
+	}
+
 	for (i = 0; i < NELEMS(fs); i++) {
 		/*
 		 * Check if already mounted, we may be running in a
@@ -628,8 +1278,16 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 * Need /dev, /proc, and /sys for console=, remount and cgroups
+	 * Replaced by a new finit from `initctl reexec`, the system is
+	 * already up, so skip everything that is only done at boot.
+	 */
+	reexecd = reexec_init(argv);
+
+	/*
+	 * Need /dev, /proc, and /sys for console=, remount and cgroups,
+	 * only /proc in a container, so check finit.container first
 	 */
+	conf_parse_container(argc, argv);
 	fs_init();
 
 	/*
@@ -641,7 +1299,10 @@ int main(int argc, char *argv[])
 	 * Figure out system console(s) and call log_init() to set
 	 * correct log level, possibly finit.debug enabled.
 	 */
-	console_init();
+	if (reexecd)
+		log_init();
+	else
+		console_init();
 
 	/*
 	 * Initialize event context.
@@ -649,6 +1310,11 @@ int main(int argc, char *argv[])
 	uev_init1(&loop, 1);
 	ctx = &loop;
 
+	/*
+	 * Console output from Finit no longer blocks on slow consoles.
+	 */
+	conout_init(&loop);
+
 	/*
 	 * Set PATH, SHELL, and PWD early to something sane
 	 */
@@ -674,13 +1340,15 @@ int main(int argc, char *argv[])
 	/*
 	 * Hello world.
 	 */
-	enable_progress(1);	/* Allow progress, if enabled */
-	banner();
-
-	if (osheading)
-		logit(LOG_CONSOLE | LOG_NOTICE, "%s, entering runlevel S", osheading);
-	else
-		logit(LOG_CONSOLE | LOG_NOTICE, "Entering runlevel S");
+	if (!reexecd) {
+		enable_progress(1);	/* Allow progress, if enabled */
+		banner();
+
+		if (osheading)
+			logit(LOG_CONSOLE | LOG_NOTICE, "%s, entering runlevel S", osheading);
+		else
+			logit(LOG_CONSOLE | LOG_NOTICE, "Entering runlevel S");
+	}
 
 	/*
 	 * Initial setup of signals, ignore all until we're up.
@@ -692,11 +1360,27 @@ int main(int argc, char *argv[])
 	 */
 	cgroup_init(&loop);
 
+	/*
+	 * Start reading .conf files in the background, if enabled, the
+	 * initial parse in conf_init() picks them up when done mounting.
+	 */
+#ifdef PARALLEL_BOOT
+	conf_prefetch();
+#endif
+
 	/*
 	 * Check custom fstab from cmdline, including fallback, then run
 	 * fsck before mounting all filesystems, on error call sulogin.
 	 */
-	fs_mount_all();
+	if (!reexecd) {
+		fs_mount_all();
+
+		/*
+		 * Read files of services mapped at previous boot into the
+		 * page cache, in a helper thread, if enabled.  Needs /var.
+		 */
+		readahead_start();
+	}
 
 	/*
 	 * Base FS up, enable standard SysV init signals and
@@ -712,15 +1396,33 @@ int main(int argc, char *argv[])
 	cond_set_oneshot(plugin_hook_str(HOOK_BANNER));
 	cond_set_oneshot(plugin_hook_str(HOOK_ROOTFS_UP));
 
+	/* Mounted file systems from /etc/fstab, mnt/<path> */
+	fs_mount_cond();
+
 	/* Some bootstrap tasks may need to know if we're in a container. */
 	if (in_container())
 		cond_set_oneshot("int/container");
+	else if (!reexecd) {
+		/* Swap and MD array waits, <sys/swap> and <sys/md/ARRAY/clean> */
+		fs_swapon();
+		mdadm_start();
+	}
+
+	/*
+	 * Cache whichp() lookups of services, set up after all file
+	 * systems are mounted since inotify does not see mounts.
+	 */
+	which_init(&loop);
+
+	/* Cache @user:group lookups of services, flushed on change in /etc */
+	usercache_init(&loop);
 
 	/*
 	 * Initialize .conf system and load static /etc/finit.conf then
 	 * tell the world what we used.
 	 */
 	devmon_init(&loop);
+	pathwatch_init(&loop);
 	conf_init(&loop);
 	conf_saverc();
 
@@ -730,18 +1432,27 @@ int main(int argc, char *argv[])
 	 */
 	conf_monitor();
 
+	/* Pressure stall triggers from /etc/finit.conf, cgroups now exist */
+	psi_init(&loop);
+
+	/* Resource usage history of services, if enabled */
+	history_init(&loop);
+
+	/* Integrated watchdog, replaces built-in watchdogd, if enabled */
+	wdt_init();
+
 	dbg("Starting initctl API responder ...");
 	api_init(&loop);
 
-	dbg("Starting service interval monitor ...");
-	service_init(&loop);
-
 	/*
 	 * Initialize state machine and start all bootstrap tasks
-	 * NOTE: no network available!
+	 * NOTE: no network available!  Unless we're re-executed, then
+	 * we adopt all services from before, see reexec.c
 	 */
-	sm_init(&sm);
-	sm_step(&sm);
+	if (!reexecd || reexec_restore(&sm)) {
+		sm_init(&sm);
+		sm_step(&sm);
+	}
 
 	/*
 	 * Enter main loop to monitor /dev/initctl and services
@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <paths.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sysexits.h>
@@ -50,6 +51,10 @@
 #define _PATH_VARRUN            "/var/run/"
 #endif
 
+#ifndef FINIT_SNAPSHOT
+#define FINIT_SNAPSHOT          "/etc/finit.snap"
+#endif
+
 #ifndef FINIT_CGPATH
 #define FINIT_CGPATH            "/sys/fs/cgroup"
 #endif
@@ -92,12 +97,24 @@
 #define INIT_CMD_HALT           21
 #define INIT_CMD_POWEROFF       22
 #define INIT_CMD_SUSPEND        23
+#define INIT_CMD_KEXEC          24   /* Reboot into kernel loaded by kexec -l */
 #define INIT_CMD_WDOG_HELLO     128  /* Watchdog register and hello */
 #define INIT_CMD_SVC_ITER       129
 #define INIT_CMD_SVC_QUERY      130
 #define INIT_CMD_SVC_FIND       131
 #define INIT_CMD_SVC_FIND_BYC   132
 #define INIT_CMD_SIGNAL         133
+#define INIT_CMD_GET_TIMELINE   134  /* Boot timeline events, see timeline.h */
+#define INIT_CMD_COMPILE        135  /* Save .conf snapshot, see snapshot.h */
+#define INIT_CMD_SVC_DUMP       136  /* Stream all services, see struct svc_rec */
+#define INIT_CMD_SUBSCRIBE      137  /* Stream events, see struct init_event */
+#define INIT_CMD_SVC_BATCH      138  /* Start/stop/restart/reload many, see api.c */
+#define INIT_CMD_GET_METRICS    139  /* OpenMetrics text, length in rq.runlevel */
+#define INIT_CMD_SVC_HISTORY    140  /* Resource samples, see struct init_sample */
+#define INIT_CMD_GET_EARLYLOG   141  /* Early log records, see struct init_logrec */
+#define INIT_CMD_REEXEC         142  /* Re-exec finit, keeping services, see reexec.c */
+#define INIT_CMD_COND_BATCH     143  /* Set/clear many usr/ conditions, see api.c */
+#define INIT_CMD_GET_FOOTPRINT  144  /* Resource footprint of Finit, text, see footprint.c */
 #define INIT_CMD_NOTIFY_SOCKET  200 /* For readiness notification socket */
 #define INIT_CMD_NACK           254
 #define INIT_CMD_ACK            255
@@ -111,6 +128,48 @@ struct init_request {
 	char	data[368];
 };
 
+/* Event types for INIT_CMD_SUBSCRIBE, mask in rq.runlevel, 0 for all */
+#define INIT_EVENT_SVC          1    /* Service state change, svc_state_t */
+#define INIT_EVENT_COND         2    /* Condition change, enum cond_state */
+#define INIT_EVENT_RUNLEVEL     4    /* Runlevel change */
+
+/* Pushed to subscribers, after the ACK, until they disconnect */
+struct init_event {
+	uint32_t seq;		/* Sequence number, gaps are filtered events */
+	uint32_t dropped;	/* Events lost before this one, queue full */
+	int64_t  msec;		/* CLOCK_MONOTONIC, i.e., since boot */
+	int32_t  type;		/* One of INIT_EVENT_* */
+	int32_t  state;		/* New state, or runlevel */
+	int32_t  prev;		/* Previous state, or runlevel */
+	int32_t  pid;		/* PID of service, or 0 */
+	char     name[128];	/* Service identity, or condition */
+};
+
+/*
+ * Resource usage of a service cgroup, see history.c.  Sent oldest first
+ * after the ACK, number of samples in rq.runlevel and sampling interval
+ * (sec) in rq.sleeptime.  Counters are cumulative, clients compute rates.
+ */
+struct init_sample {
+	int64_t  msec;		/* CLOCK_MONOTONIC, i.e., since boot */
+	uint64_t cpu_usec;	/* cpu.stat:usage_usec */
+	uint64_t mem_current;	/* memory.current */
+	uint64_t mem_peak;	/* memory.peak, 0 if unsupported */
+	uint64_t io_bytes;	/* io.stat:rbytes + wbytes, all devices */
+};
+
+/*
+ * Log records of Finit from before syslogd was up, for INIT_CMD_GET_EARLYLOG,
+ * sent oldest first after the ACK.  The number of records is in rq.runlevel,
+ * and the number of overwritten records in rq.sleeptime.
+ */
+struct init_logrec {
+	int64_t  msec;		/* CLOCK_MONOTONIC, i.e., since boot */
+	int32_t  prio;		/* facility | level */
+	int32_t  kmsg;		/* Also logged to /dev/kmsg, or stderr */
+	char     msg[240];
+};
+
 extern int    runlevel;
 extern int    cfglevel;
 extern int    cmdlevel;
@@ -119,9 +178,14 @@ extern int    debug;
 extern int    rescue;
 extern int    single;
 extern int    bootstrap;
+extern int    reexecd;
 extern int    kerndebug;
 extern int    syncsec;
+extern int    kexecboot;
+extern int    shutsec;
 extern int    readiness;
+extern int    mntmode;
+extern int    container;
 extern char  *fstab;
 extern char  *sdown;
 extern char  *network;
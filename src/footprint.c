@@ -0,0 +1,253 @@
+/* Resource footprint of PID 1 itself, for leak and regression tracking
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Finit runs for the entire uptime of the system, so any leak, however
+ * small, eventually becomes an outage.  This collects the heap, RSS,
+ * object counts and descriptors of PID 1 on request, for `initctl debug
+ * footprint` and the finit_footprint_* metrics.  Nothing is tracked in
+ * the hot paths, everything is counted when asked for.
+ */
+#include "config.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+#else
+# include <lite/lite.h>
+#endif
+
+#include "cgroup.h"
+#include "footprint.h"
+#include "iwatch.h"
+#include "private.h"
+#include "schedule.h"
+#include "svc.h"
+
+const char *fd_kind_str[FD_KINDS] = {
+	[FD_FILE]     = "file",
+	[FD_DIR]      = "dir",
+	[FD_DEV]      = "dev",
+	[FD_SOCKET]   = "socket",
+	[FD_PIPE]     = "pipe",
+	[FD_INOTIFY]  = "inotify",
+	[FD_EPOLL]    = "epoll",
+	[FD_SIGNALFD] = "signalfd",
+	[FD_TIMERFD]  = "timerfd",
+	[FD_EVENTFD]  = "eventfd",
+	[FD_OTHER]    = "other",
+};
+
+static int fd_kind(const char *link)
+{
+	const struct {
+		const char *prefix;
+		int         kind;
+	} map[] = {
+		{ "socket:",               FD_SOCKET   },
+		{ "pipe:",                 FD_PIPE     },
+		{ "anon_inode:inotify",    FD_INOTIFY  },
+		{ "anon_inode:[eventpoll", FD_EPOLL    },
+		{ "anon_inode:[signalfd",  FD_SIGNALFD },
+		{ "anon_inode:[timerfd",   FD_TIMERFD  },
+		{ "anon_inode:[eventfd",   FD_EVENTFD  },
+		{ "/dev/",                 FD_DEV      },
+	};
+	size_t i;
+
+	for (i = 0; i < NELEMS(map); i++) {
+		if (!strncmp(link, map[i].prefix, strlen(map[i].prefix)))
+			return map[i].kind;
+	}
+
+	if (link[0] == '/')
+		return fisdir(link) ? FD_DIR : FD_FILE;
+
+	return FD_OTHER;
+}
+
+static void fds(struct footprint *fp)
+{
+	struct dirent *d;
+	DIR *dir;
+
+	dir = opendir("/proc/self/fd");
+	if (!dir)
+		return;
+
+	while ((d = readdir(dir))) {
+		char path[sizeof(d->d_name) + 16], link[256];
+		ssize_t len;
+
+		if (d->d_name[0] == '.' || atoi(d->d_name) == dirfd(dir))
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/self/fd/%s", d->d_name);
+		len = readlink(path, link, sizeof(link) - 1);
+		if (len < 0)
+			continue;
+		link[len] = 0;
+
+		fp->fds[fd_kind(link)]++;
+		fp->fd_total++;
+	}
+
+	closedir(dir);
+}
+
+static void memory(struct footprint *fp)
+{
+	unsigned long size, resident;
+	FILE *fs;
+
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 mi = mallinfo2();
+
+	fp->heap_used = mi.uordblks;
+	fp->heap_free = mi.fordblks;
+	fp->heap_mmap = mi.hblkhd;
+#endif
+
+	fs = fopen("/proc/self/statm", "r");
+	if (!fs)
+		return;
+	if (fscanf(fs, "%lu %lu", &size, &resident) == 2)
+		fp->rss = (size_t)resident * sysconf(_SC_PAGESIZE);
+	fclose(fs);
+}
+
+/**
+ * footprint_get - Collect resource footprint of PID 1
+ * @fp: Footprint to fill in
+ *
+ * Returns:
+ * Always 0.
+ */
+int footprint_get(struct footprint *fp)
+{
+	memset(fp, 0, sizeof(*fp));
+
+	memory(fp);
+	fp->svc_total = svc_footprint(&fp->svc_live, &fp->svc_gc);
+	fp->cgroups   = cgroup_footprint(&fp->cgroup_bytes);
+	fp->plugins   = plugin_footprint(&fp->handles);
+	fp->timers    = schedule_pending(&fp->ready);
+	fds(fp);
+
+	return 0;
+}
+
+/* Human readable report, for initctl debug footprint */
+int footprint_write(FILE *fp)
+{
+	struct footprint f;
+	struct iwatch *iw;
+	int i;
+
+	footprint_get(&f);
+
+#ifdef HAVE_MALLINFO2
+	fprintf(fp, "Heap          : %zu bytes used, %zu free, %zu mmap\n",
+		f.heap_used, f.heap_free, f.heap_mmap);
+#else
+	fprintf(fp, "Heap          : unknown, no mallinfo2()\n");
+#endif
+	fprintf(fp, "RSS           : %zu bytes\n", f.rss);
+	fprintf(fp, "Services      : %zu live, %zu on gc_list, %zu allocated, %zu bytes each\n",
+		f.svc_live, f.svc_gc, f.svc_total, sizeof(svc_t));
+	fprintf(fp, "Cgroups       : %zu, %zu bytes\n", f.cgroups, f.cgroup_bytes);
+	fprintf(fp, "Plugins       : %zu, %zu dlopen() handles\n", f.plugins, f.handles);
+	fprintf(fp, "Timers        : %zu pending, %zu work ready\n", f.timers, f.ready);
+
+	for (iw = iwatch_iter(NULL); iw; iw = iwatch_iter(iw))
+		fprintf(fp, "iwatch %-7s: %zu paths\n", iw->name ?: "?", iwatch_paths(iw));
+
+	fprintf(fp, "Descriptors   : %zu", f.fd_total);
+	for (i = 0; i < FD_KINDS; i++) {
+		if (f.fds[i])
+			fprintf(fp, ", %zu %s", f.fds[i], fd_kind_str[i]);
+	}
+	fprintf(fp, "\n");
+
+	return ferror(fp);
+}
+
+static void gauge(FILE *fp, const char *name, const char *help)
+{
+	fprintf(fp, "# TYPE finit_footprint_%s gauge\n", name);
+	fprintf(fp, "# HELP finit_footprint_%s %s\n", name, help);
+}
+
+/* OpenMetrics gauges, called from metrics_write() */
+int footprint_metrics(FILE *fp)
+{
+	struct footprint f;
+	struct iwatch *iw;
+	int i;
+
+	footprint_get(&f);
+
+	gauge(fp, "memory_bytes", "Memory used by Finit.");
+#ifdef HAVE_MALLINFO2
+	fprintf(fp, "finit_footprint_memory_bytes{kind=\"heap\"} %zu\n", f.heap_used);
+	fprintf(fp, "finit_footprint_memory_bytes{kind=\"heap_free\"} %zu\n", f.heap_free);
+	fprintf(fp, "finit_footprint_memory_bytes{kind=\"mmap\"} %zu\n", f.heap_mmap);
+#endif
+	fprintf(fp, "finit_footprint_memory_bytes{kind=\"rss\"} %zu\n", f.rss);
+
+	gauge(fp, "objects", "Internal objects of Finit.");
+	fprintf(fp, "finit_footprint_objects{kind=\"svc\"} %zu\n", f.svc_live);
+	fprintf(fp, "finit_footprint_objects{kind=\"svc_gc\"} %zu\n", f.svc_gc);
+	fprintf(fp, "finit_footprint_objects{kind=\"svc_pool\"} %zu\n", f.svc_total);
+	fprintf(fp, "finit_footprint_objects{kind=\"cgroup\"} %zu\n", f.cgroups);
+	fprintf(fp, "finit_footprint_objects{kind=\"plugin\"} %zu\n", f.plugins);
+	fprintf(fp, "finit_footprint_objects{kind=\"timer\"} %zu\n", f.timers);
+
+	gauge(fp, "object_bytes", "Memory used by internal objects of Finit.");
+	fprintf(fp, "finit_footprint_object_bytes{kind=\"svc\"} %zu\n", f.svc_total * sizeof(svc_t));
+	fprintf(fp, "finit_footprint_object_bytes{kind=\"cgroup\"} %zu\n", f.cgroup_bytes);
+
+	gauge(fp, "iwatch_paths", "Paths watched with inotify.");
+	for (iw = iwatch_iter(NULL); iw; iw = iwatch_iter(iw))
+		fprintf(fp, "finit_footprint_iwatch_paths{watcher=\"%s\"} %zu\n", iw->name ?: "?", iwatch_paths(iw));
+
+	gauge(fp, "fds", "Open descriptors of Finit.");
+	for (i = 0; i < FD_KINDS; i++)
+		fprintf(fp, "finit_footprint_fds{kind=\"%s\"} %zu\n", fd_kind_str[i], f.fds[i]);
+
+	return ferror(fp);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,80 @@
+/* Resource footprint of PID 1 itself, for leak and regression tracking
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_FOOTPRINT_H_
+#define FINIT_FOOTPRINT_H_
+
+#include <stdio.h>
+
+enum fd_kind {
+	FD_FILE = 0,
+	FD_DIR,
+	FD_DEV,
+	FD_SOCKET,
+	FD_PIPE,
+	FD_INOTIFY,
+	FD_EPOLL,
+	FD_SIGNALFD,
+	FD_TIMERFD,
+	FD_EVENTFD,
+	FD_OTHER,
+	FD_KINDS
+};
+
+struct footprint {
+	size_t heap_used;	/* bytes, allocated with malloc() */
+	size_t heap_free;	/* bytes, free in arena */
+	size_t heap_mmap;	/* bytes, in mmap()'ed chunks */
+	size_t rss;		/* bytes, resident set size */
+
+	size_t svc_live;	/* svc_t in use */
+	size_t svc_gc;		/* svc_t removed, waiting for svc_gc() */
+	size_t svc_total;	/* svc_t allocated, in all pool slabs */
+
+	size_t cgroups;		/* top-level cgroups */
+	size_t cgroup_bytes;
+
+	size_t plugins;		/* registered plugins */
+	size_t handles;		/* ... of which loaded with dlopen() */
+
+	size_t timers;		/* pending delayed work, see schedule.c */
+	size_t ready;		/* work ready to run */
+
+	size_t fds[FD_KINDS];
+	size_t fd_total;
+};
+
+extern const char *fd_kind_str[FD_KINDS];
+
+int footprint_get    (struct footprint *fp);
+int footprint_write  (FILE *fp);
+int footprint_metrics(FILE *fp);
+
+#endif /* FINIT_FOOTPRINT_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -41,6 +41,7 @@
 #endif
 
 #include "finit.h"
+#include "conout.h"
 #include "helpers.h"
 #include "log.h"
 #include "private.h"
@@ -104,7 +105,7 @@ ssize_t cprintf(const char *fmt, ...)
 	size = vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
 
-	dprint(STDERR_FILENO, buf, size);
+	conout_write(buf, size);
 
 	return size;
 }
@@ -521,41 +522,22 @@ void networking(int updown)
 		goto fallback;
 
 	if (fexist("/etc/network/interfaces")) {
+		const char *cmd;
 		pid_t pid;
 
-		pid = fork();
-		if (pid == 0) {
-			const char *cmd;
-			char buf[256];
-			FILE *pp;
-			int rc;
-
-			setsid();
-			sig_unblock();
-
-			if (updown)
-				cmd = "ifup -a 2>&1";
-			else if (whichp("ifquery"))
-				/* Regular ifodwn supports --force but not -f */
-				cmd = "ifdown -a --force 2>&1";
-			else
-				/* Busybox ifdown support -f, but not --force */
-				cmd = "ifdown -a -f 2>&1";
-
-			pp = popen(cmd, "r");
-			if (!pp)
-				_exit(EX_OSERR);
-
-			while (fgets(buf, sizeof(buf), pp))
-				logit(LOG_NOTICE, "network: %s", chomp(buf));
-
-			rc = pclose(pp);
-			if (rc == -1)
-				_exit(EX_OSERR);
-			_exit(WEXITSTATUS(rc));
-		}
-		cgroup_service("network", pid, NULL);
-		print(pid > 0 ? 0 : 1, "%s network interfaces ...",
+		if (updown)
+			cmd = "ifup -a 2>&1";
+		else if (whichp("ifquery"))
+			/* Regular ifodwn supports --force but not -f */
+			cmd = "ifdown -a --force 2>&1";
+		else
+			/* Busybox ifdown support -f, but not --force */
+			cmd = "ifdown -a -f 2>&1";
+
+		pid = run_async((char *)cmd, "network", NULL, NULL);
+		if (pid > 0)
+			cgroup_service("network", pid, NULL);
+		print(pid >= 0 ? 0 : 1, "%s network interfaces ...",
 		      updown ? "Bringing up" : "Taking down");
 
 		goto done;
@@ -585,30 +567,38 @@ int in_container(void)
 		"lxc",
 		"docker",
 		"kubepod",
-		"unshare"
+		"unshare",
+		"podman",
+		"oci",
+		"systemd-nspawn"
 	};
 	const char *files[] = {
 		"/run/.containerenv",
-		"/.dockerenv"
+		"/.dockerenv",
+		"/run/systemd/container"
 	};
-	static int incont = -1;
 	size_t i;
 	char *c;
 
-	if (incont > 0)
-		return incont;
+	/*
+	 * Set from finit.container, or cached from previous call.  Only
+	 * a positive result is cached, the files may show up later, e.g.
+	 * when /run is mounted.
+	 */
+	if (container >= 0)
+		return container;
 
 	c = getenv("container");
 	if (c) {
 		for (i = 0; i < NELEMS(containers); i++) {
 			if (!strcmp(containers[i], c))
-				return incont = 1;
+				return container = 1;
 		}
 	}
 
 	for (i = 0; i < NELEMS(files); i++) {
 		if (!access(files[i], F_OK))
-			return incont = 1;
+			return container = 1;
 	}
 
 	return 0;
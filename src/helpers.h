@@ -82,14 +82,19 @@ void    set_hostname    (char **hostname);
 void    networking      (int updown);
 int     in_container    (void);
 
+void    mdadm_start     (void);
+void    mdadm_wait      (void);
+
 int     complete        (char *cmd, int pid);
 int     run             (char *cmd, char *log);
+pid_t   run_async       (char *cmd, char *log, void (*cb)(void *arg, int status), void *arg);
+int     exec_collect    (pid_t pid, int status);
 int     run_interactive (char *cmd, char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 int     exec_runtask    (char *cmd, char *args[]);
 pid_t   run_getty       (char *tty, char *cmd, char *args[], int noclear, int nowait, struct rlimit rlimit[]);
 pid_t   run_sh          (char *tty, int noclear, int nowait, struct rlimit rlimit[]);
 pid_t   run_bg          (char *cmd, char *args[]);
-int     run_parts       (char *dir, char *cmd, const char *env[], int progress, int sysv);
+int     run_parts       (char *dir, char *cmd, const char *env[], int progress, int sysv, int jobs);
 
 /*
  * Defaults to user "root" and group "wheel" (root) if:
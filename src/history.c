@@ -0,0 +1,285 @@
+/* Per-service resource usage history, ring buffer of cgroup samples
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * With the 'history' setting in /etc/finit.conf, the leaf cgroup of
+ * each running service is sampled at a fixed interval:
+ *
+ *     history 10           sample every 10 sec, keep 360 (one hour)
+ *     history 60 1440      sample every minute, keep one day
+ *
+ * The ring buffer of a service is allocated on its first sample and is
+ * kept when the service stops, or crashes, so it can be inspected after
+ * the fact with `initctl status --history foo`.  It is freed with the
+ * service object.  Services declared in the same .conf file share one
+ * leaf group, so their samples are the same.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+#else
+# include <lite/lite.h>
+#endif
+
+#include "finit.h"
+#include "history.h"
+#include "log.h"
+#include "metrics.h"
+#include "service.h"
+#include "timeline.h"
+#include "util.h"
+
+#define HISTORY_SAMPLES 360
+
+static uev_t timer;
+static int   history_sec;
+static int   history_max = HISTORY_SAMPLES;
+
+static uint64_t read_val(const char *path, const char *file)
+{
+	char buf[32];
+
+	if (fnread(buf, sizeof(buf), "%s/%s", path, file) <= 0)
+		return 0;
+
+	return strtoull(buf, NULL, 10);
+}
+
+/* Value of "key N" in flat keyed files like cpu.stat */
+static uint64_t read_key(const char *path, const char *file, const char *key)
+{
+	size_t len = strlen(key);
+	uint64_t val = 0;
+	char buf[128];
+	FILE *fp;
+
+	fp = fopenf("r", "%s/%s", path, file);
+	if (!fp)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (strncmp(buf, key, len) || buf[len] != ' ')
+			continue;
+
+		val = strtoull(&buf[len + 1], NULL, 10);
+		break;
+	}
+	fclose(fp);
+
+	return val;
+}
+
+/* Read and written bytes, sum of all devices in io.stat */
+static uint64_t read_io(const char *path)
+{
+	uint64_t sum = 0;
+	char buf[512];
+	FILE *fp;
+
+	fp = fopenf("r", "%s/io.stat", path);
+	if (!fp)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		char *tok;
+
+		for (tok = strtok(buf, " \n"); tok; tok = strtok(NULL, " \n")) {
+			if (!strncmp(tok, "rbytes=", 7) || !strncmp(tok, "wbytes=", 7))
+				sum += strtoull(&tok[7], NULL, 10);
+		}
+	}
+	fclose(fp);
+
+	return sum;
+}
+
+static void sample(svc_t *svc, long long now)
+{
+	struct init_sample *s;
+	struct history *h;
+	char path[256];
+
+	if (!service_cgroup(svc, path, sizeof(path)))
+		return;
+
+	h = svc->history;
+	if (!h) {
+		h = calloc(1, sizeof(*h) + history_max * sizeof(h->sample[0]));
+		if (!h) {
+			err(1, "Failed allocating history of %s", svc->name);
+			return;
+		}
+		svc->history = h;
+	}
+
+	s = &h->sample[h->head];
+	s->msec        = now;
+	s->cpu_usec    = read_key(path, "cpu.stat", "usage_usec");
+	s->mem_current = read_val(path, "memory.current");
+	s->mem_peak    = read_val(path, "memory.peak");
+	s->io_bytes    = read_io(path);
+
+	h->head = (h->head + 1) % history_max;
+	if (h->count < history_max)
+		h->count++;
+}
+
+static void history_cb(uev_t *w, void *arg, int events)
+{
+	long long now = timeline_now();
+	svc_t *svc, *iter = NULL;
+
+	PROBE("history");
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->pid <= 1)
+			continue;
+
+		sample(svc, now);
+	}
+}
+
+/**
+ * history_add - Parse 'history SEC [SAMPLES]' setting
+ * @arg: Setting, without the 'history' keyword
+ *
+ * Only called at bootstrap, before history_init(), the size of the
+ * ring buffers cannot change once allocated.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on invalid setting.
+ */
+int history_add(char *arg)
+{
+	const char *errstr = NULL;
+	char *tok;
+	int sec, max;
+
+	tok = strtok(arg, " \t");
+	if (!tok) {
+		logit(LOG_WARNING, "history: missing interval");
+		return 1;
+	}
+
+	sec = strtonum(tok, 0, 3600, &errstr);
+	if (errstr) {
+		logit(LOG_WARNING, "history: invalid interval %s, %s", tok, errstr);
+		return 1;
+	}
+
+	max = HISTORY_SAMPLES;
+	tok = strtok(NULL, " \t");
+	if (tok) {
+		max = strtonum(tok, 2, 100000, &errstr);
+		if (errstr) {
+			logit(LOG_WARNING, "history: invalid number of samples %s, %s", tok, errstr);
+			return 1;
+		}
+	}
+
+	history_sec = sec;
+	history_max = max;
+
+	return 0;
+}
+
+/**
+ * history_interval - Sampling interval
+ *
+ * Returns:
+ * Interval in seconds, or zero if disabled.
+ */
+int history_interval(void)
+{
+	return history_sec;
+}
+
+/**
+ * history_get - Copy of a service's samples
+ * @svc: Service
+ * @num: Number of samples returned
+ *
+ * Returns:
+ * Array of samples, oldest first, to be freed by the caller, or %NULL
+ * if @svc has not been sampled yet.
+ */
+struct init_sample *history_get(svc_t *svc, int *num)
+{
+	struct history *h = svc->history;
+	struct init_sample *buf;
+	int first;
+
+	*num = 0;
+	if (!h || !h->count)
+		return NULL;
+
+	buf = malloc(h->count * sizeof(*buf));
+	if (!buf)
+		return NULL;
+
+	first = (h->head - h->count + history_max) % history_max;
+	for (int i = 0; i < h->count; i++)
+		buf[i] = h->sample[(first + i) % history_max];
+	*num = h->count;
+
+	return buf;
+}
+
+/**
+ * history_init - Start sampling, if enabled
+ * @ctx: Event loop
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on error.
+ */
+int history_init(uev_ctx_t *ctx)
+{
+	int msec = history_sec * 1000;
+
+	if (!history_sec)
+		return 0;
+
+	dbg("Sampling service cgroups every %d sec, keeping %d samples", history_sec, history_max);
+	if (uev_timer_init(ctx, &timer, history_cb, NULL, msec, msec)) {
+		warn("Failed starting resource history timer");
+		return 1;
+	}
+
+	return 0;
+}
+
+void history_exit(void)
+{
+	if (history_sec)
+		uev_timer_stop(&timer);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -27,6 +27,7 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <paths.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <syslog.h>
@@ -40,6 +41,7 @@
 #endif
 
 #include "initctl.h"
+#include "analyze.h"
 #include "client.h"
 #include "cond.h"
 #include "serv.h"
@@ -62,9 +64,13 @@ char *finit_rcsd = NULL;
 int icreate  = 0;
 int iforce   = 0;
 int ionce    = 0;
+int interval = 1000;
 int debug    = 0;
+int early    = 0;
 int heading  = 1;
 int json     = 0;
+int kexec    = 0;
+int history  = 0;
 int noerr    = 0;
 int verbose  = 0;
 int plain    = 0;
@@ -89,7 +95,7 @@ static void col_widths(void)
 	iw = 0;
 	pw = 0;
 
-	for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0)) {
+	for (svc = client_svc_dump(1, 0, 0, NULL); svc; svc = client_svc_dump(0, 0, 0, NULL)) {
 		int w, p;
 
 		svc_ident(svc, ident, sizeof(ident));
@@ -151,14 +157,51 @@ static int runlevel_get(int *prevlevel)
 	return rc;
 }
 
+static int do_footprint(void)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_GET_FOOTPRINT,
+	};
+	char buf[4096];
+	ssize_t len;
+	int left;
+
+	if (client_request(&rq, sizeof(rq)))
+		ERRX(70, "failed fetching footprint");
+
+	for (left = rq.runlevel; left > 0; left -= len) {
+		len = read(client_socket(), buf, sizeof(buf));
+		if (len <= 0)
+			break;
+		fwrite(buf, len, 1, stdout);
+	}
+	client_disconnect();
+
+	return left > 0 ? 1 : 0;
+}
+
 static int toggle_debug(char *arg)
 {
 	struct init_request rq = {
 		.magic = INIT_MAGIC,
 		.cmd = INIT_CMD_DEBUG,
 	};
+	int rc;
 
-	return client_send(&rq, sizeof(rq));
+	if (arg) {
+		if (string_compare(arg, "footprint"))
+			return do_footprint();
+		ERRX(3, "Unknown debug command '%s'.", arg);
+	}
+
+	rc = client_send(&rq, sizeof(rq));
+	if (!rc && rq.data[0]) {
+		strterm(rq.data, sizeof(rq.data));
+		puts(rq.data);
+	}
+
+	return rc;
 }
 
 static int do_log(svc_t *svc, char *tail)
@@ -186,10 +229,57 @@ static int do_log(svc_t *svc, char *tail)
 	return systemf("cat %s | grep '\\[%d\\]\\|%s' %s", logfile, pid, nm, tail);
 }
 
+/* Log records of Finit from before syslogd was up, kept in memory */
+static int show_early(void)
+{
+	const char *lvl[] = { "EMERG", "ALERT", "CRIT", "ERR", "WARN", "NOTICE", "INFO", "DEBUG" };
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_GET_EARLYLOG,
+	};
+	struct init_logrec *buf;
+	size_t len, off;
+	ssize_t num;
+
+	if (client_request(&rq, sizeof(rq)))
+		ERRX(70, "failed fetching early log");
+
+	len = rq.runlevel * sizeof(*buf);
+	buf = malloc(len + 1);
+	if (!buf)
+		ERR(70, "failed allocating early log buffer");
+
+	for (off = 0; off < len; off += num) {
+		num = read(client_socket(), (char *)buf + off, len - off);
+		if (num <= 0)
+			break;
+	}
+	client_disconnect();
+	if (off < len)
+		ERRX(70, "failed reading early log");
+
+	if (rq.sleeptime > 0)
+		printf("-- %d earlier records lost --\n", rq.sleeptime);
+
+	for (int i = 0; i < rq.runlevel; i++) {
+		struct init_logrec *rec = &buf[i];
+
+		strterm(rec->msg, sizeof(rec->msg));
+		printf("[%5lld.%03lld] %-6s %s\n", (long long)rec->msec / 1000,
+		       (long long)rec->msec % 1000, lvl[LOG_PRI(rec->prio)], rec->msg);
+	}
+	free(buf);
+
+	return 0;
+}
+
 static int show_log(char *arg)
 {
 	svc_t *svc = NULL;
 
+	if (early)
+		return show_early();
+
 	if (arg) {
 		svc = client_svc_find(arg);
 		if (!svc)
@@ -274,21 +364,298 @@ static int do_startstop(int cmd, char *arg)
 	return do_svc(cmd, arg);
 }
 
-static int do_start  (char *arg) { return do_startstop(INIT_CMD_START_SVC,   arg); }
-static int do_stop   (char *arg) { return do_startstop(INIT_CMD_STOP_SVC,    arg); }
+/*
+ * Many jobs, or a glob, in one request.  Finit marks all services first
+ * and then steps them together.  The reply has a result per job.
+ */
+static int do_batch(const char *op, int argc, char *argv[])
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_SVC_BATCH,
+	};
+	int32_t results[argc];
+	size_t len = sizeof(rq);
+	char *msg, *ptr;
+	int i, rc = 0;
+	ssize_t sz;
+
+	for (i = 0; i < argc; i++)
+		len += strlen(op) + strlen(argv[i]) + 2;
+
+	msg = malloc(len);
+	if (!msg)
+		ERR(1, "failed allocating batch request");
+
+	memcpy(msg, &rq, sizeof(rq));
+	ptr = msg + sizeof(rq);
+	for (i = 0; i < argc; i++)
+		ptr += sprintf(ptr, "%s %s", op, argv[i]) + 1;
+
+	if (client_connect() == -1) {
+		free(msg);
+		return 1;
+	}
 
-static int do_reload (char *arg)
+	sz = write(client_socket(), msg, len);
+	free(msg);
+	if (sz != (ssize_t)len || read(client_socket(), &rq, sizeof(rq)) != sizeof(rq))
+		goto fail;
+
+	if (rq.runlevel != argc)
+		goto fail;
+
+	sz = argc * sizeof(results[0]);
+	if (read(client_socket(), results, sz) != sz)
+		goto fail;
+	client_disconnect();
+
+	for (i = 0; i < argc; i++) {
+		if (!results[i])
+			continue;
+
+		if (!noerr)
+			warnx("no such task or service(s): %s", argv[i]);
+		rc = 1;
+	}
+
+	return rc;
+fail:
+	client_disconnect();
+	if (!noerr)
+		warnx("failed %s request", op);
+
+	return 1;
+}
+
+/* A single job is sanity checked first, many are sent as one batch */
+static int do_jobs(int cmd, const char *op, int argc, char *argv[])
 {
-	if (!arg || !arg[0])
+	if (argc < 1)
+		ERRX(2, "missing command argument");
+
+	if (argc == 1 && !strpbrk(argv[0], "*?["))
+		return do_startstop(cmd, argv[0]);
+
+	if (do_batch(op, argc, argv))
+		return noerr ? 0 : 69;
+
+	return 0;
+}
+
+static int do_start(int argc, char *argv[]) { return do_jobs(INIT_CMD_START_SVC, "start", argc, argv); }
+static int do_stop (int argc, char *argv[]) { return do_jobs(INIT_CMD_STOP_SVC,  "stop",  argc, argv); }
+
+static int do_reload(int argc, char *argv[])
+{
+	if (argc < 1 || !argv[0][0])
 		return do_svc(INIT_CMD_RELOAD, NULL);
 
-	return do_startstop(INIT_CMD_RELOAD_SVC, arg);
+	return do_jobs(INIT_CMD_RELOAD_SVC, "reload", argc, argv);
+}
+
+static int do_compile(char *arg)
+{
+	return do_svc(INIT_CMD_COMPILE, NULL);
+}
+
+static int do_reexec(char *arg)
+{
+	if (do_svc(INIT_CMD_REEXEC, NULL))
+		ERRX(75, "system busy, try again later");
+
+	return 0;
+}
+
+static const char *event_state(struct init_event *ev, int state, char *buf, size_t len)
+{
+	static const char *svc_states[] = {
+		[SVC_HALTED_STATE]   = "halted",
+		[SVC_DONE_STATE]     = "done",
+		[SVC_STOPPING_STATE] = "stopping",
+		[SVC_CLEANUP_STATE]  = "cleanup",
+		[SVC_SETUP_STATE]    = "setup",
+		[SVC_PAUSED_STATE]   = "paused",
+		[SVC_WAITING_STATE]  = "waiting",
+		[SVC_STARTING_STATE] = "starting",
+		[SVC_RUNNING_STATE]  = "running",
+	};
+
+	switch (ev->type) {
+	case INIT_EVENT_SVC:
+		if (state >= 0 && state < (int)NELEMS(svc_states) && svc_states[state])
+			return svc_states[state];
+		break;
+
+	case INIT_EVENT_COND:
+		if (state >= COND_OFF && state <= COND_ON)
+			return condstr(state);
+		break;
+
+	case INIT_EVENT_RUNLEVEL:
+		if (state == INIT_LEVEL)
+			return "S";
+		snprintf(buf, len, "%d", state);
+		return buf;
+	}
+
+	return "unknown";
+}
+
+static int do_metrics(char *arg)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_GET_METRICS,
+	};
+	char buf[4096];
+	ssize_t len;
+	int left;
+
+	if (client_request(&rq, sizeof(rq)))
+		ERRX(70, "failed fetching metrics");
+
+	for (left = rq.runlevel; left > 0; left -= len) {
+		len = read(client_socket(), buf, sizeof(buf));
+		if (len <= 0)
+			break;
+		fwrite(buf, len, 1, stdout);
+	}
+	client_disconnect();
+
+	return left > 0 ? 1 : 0;
+}
+
+/* Resource usage history of one service, rates computed from the counters */
+static int show_history(char *ident)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_SVC_HISTORY,
+	};
+	struct init_sample *buf;
+	struct timespec ts;
+	long long now;
+	size_t len, off;
+	ssize_t num;
+
+	strlcpy(rq.data, ident, sizeof(rq.data));
+	if (client_request(&rq, sizeof(rq)))
+		ERRX(69, "no resource history of %s, missing 'history' in %s?", ident, finit_conf);
+
+	len = rq.runlevel * sizeof(*buf);
+	buf = malloc(len + 1);
+	if (!buf)
+		ERR(70, "failed allocating history buffer");
+
+	for (off = 0; off < len; off += num) {
+		num = read(client_socket(), (char *)buf + off, len - off);
+		if (num <= 0)
+			break;
+	}
+	client_disconnect();
+	if (off < len)
+		ERRX(70, "failed reading resource history of %s", ident);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+	if (json)
+		printf("{\n  \"interval\": %d,\n  \"samples\": [", rq.sleeptime);
+	else if (heading)
+		print_header("%-8s  %6s  %8s  %8s  %8s", "AGE", "CPU%", "MEMORY", "PEAK", "IO/s");
+
+	for (int i = 0; i < rq.runlevel; i++) {
+		struct init_sample *s = &buf[i];
+		char mem[16], peak[16], io[16];
+		double cpu = 0.0, rate = 0.0;
+
+		if (json) {
+			printf("%s\n    { \"time\": %lld, \"cpu_usec\": %llu, \"memory_current\": %llu, "
+			       "\"memory_peak\": %llu, \"io_bytes\": %llu }", i ? "," : "", (long long)s->msec,
+			       (unsigned long long)s->cpu_usec, (unsigned long long)s->mem_current,
+			       (unsigned long long)s->mem_peak, (unsigned long long)s->io_bytes);
+			continue;
+		}
+
+		/* Counters restart with the group, e.g. after a crash */
+		if (i > 0 && s->msec > buf[i - 1].msec) {
+			struct init_sample *p = &buf[i - 1];
+			double sec = (s->msec - p->msec) / 1000.0;
+
+			if (s->cpu_usec >= p->cpu_usec)
+				cpu = (s->cpu_usec - p->cpu_usec) / (sec * 10000.0);
+			if (s->io_bytes >= p->io_bytes)
+				rate = (s->io_bytes - p->io_bytes) / sec;
+		}
+
+		printf("-%-7lld  %6.1f  %8s  %8s  %8s\n", (now - s->msec) / 1000, cpu,
+		       memsz(s->mem_current, mem, sizeof(mem)),
+		       s->mem_peak ? memsz(s->mem_peak, peak, sizeof(peak)) : "-",
+		       memsz((uint64_t)rate, io, sizeof(io)));
+	}
+
+	if (json)
+		printf("%s]\n}\n", rq.runlevel ? "\n  " : "");
+	free(buf);
+
+	return 0;
+}
+
+static int do_events(char *arg)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_SUBSCRIBE,
+	};
+	struct init_event ev;
+	int sd;
+
+	if (arg)
+		strlcpy(rq.data, arg, sizeof(rq.data));
+
+	if (client_request(&rq, sizeof(rq)))
+		ERRX(70, "failed subscribing to events");
+
+	sd = client_socket();
+	while (read(sd, &ev, sizeof(ev)) == sizeof(ev)) {
+		const char *type = "runlevel";
+		char prev[8], next[8];
+
+		if (ev.type == INIT_EVENT_SVC)
+			type = "service";
+		else if (ev.type == INIT_EVENT_COND)
+			type = "condition";
+		ev.name[sizeof(ev.name) - 1] = 0;
+
+		if (json)
+			printf("{ \"seq\": %u, \"dropped\": %u, \"time\": %lld, \"type\": \"%s\", "
+			       "\"name\": \"%s\", \"prev\": \"%s\", \"state\": \"%s\", \"pid\": %d }\n",
+			       ev.seq, ev.dropped, (long long)ev.msec, type, ev.name,
+			       event_state(&ev, ev.prev, prev, sizeof(prev)),
+			       event_state(&ev, ev.state, next, sizeof(next)), ev.pid);
+		else {
+			if (ev.dropped)
+				printf("# %u events dropped\n", ev.dropped);
+			printf("%-6u %6lld.%03lld  %-9s  %s%s%s -> %s",
+			       ev.seq, (long long)ev.msec / 1000, (long long)ev.msec % 1000, type,
+			       ev.name, ev.name[0] ? " " : "",
+			       event_state(&ev, ev.prev, prev, sizeof(prev)),
+			       event_state(&ev, ev.state, next, sizeof(next)));
+			if (ev.pid > 0)
+				printf(" [%d]", ev.pid);
+			puts("");
+		}
+		fflush(stdout);
+	}
+	client_disconnect();
+
+	return 0;
 }
 
-static int do_restart(char *arg)
+static int do_restart(int argc, char *argv[])
 {
-	if (do_startstop(INIT_CMD_RESTART_SVC, arg))
-		ERRX(noerr ? 0 : 7, "failed restarting %s", arg);
+	if (do_jobs(INIT_CMD_RESTART_SVC, "restart", argc, argv))
+		ERRX(noerr ? 0 : 7, "failed restarting %s", argc > 1 ? "services" : argv[0]);
 
 	return 0;
 }
@@ -338,21 +705,11 @@ int do_signal(int argc, char *argv[])
 
 int dump_once;
 char *dump_filter;
-static int dump_one_cond(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf)
+static int dump_cond(const char *cond, const char *asserted)
 {
-	const char *cond, *asserted;
 	char *nm = "init";
 	pid_t pid = 1;
 
-	if (tflag != FTW_F)
-		return 0;
-
-	if (!strcmp(fpath, _PATH_RECONF))
-		return 0;
-
-	asserted = condstr(cond_get_path(fpath));
-	cond = &fpath[strlen(_PATH_COND)];
-
 	if (dump_filter && dump_filter[0] && strncmp(cond, dump_filter, strlen(dump_filter)))
 		return 0;
 
@@ -395,8 +752,55 @@ static int dump_one_cond(const char *fpath, const struct stat *sb, int tflag, st
 	return 0;
 }
 
+static int dump_one_cond(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf)
+{
+	if (tflag != FTW_F)
+		return 0;
+
+	if (!strcmp(fpath, _PATH_RECONF))
+		return 0;
+
+	return dump_cond(&fpath[strlen(_PATH_COND)], condstr(cond_get_path(fpath)));
+}
+
+static int by_cond_name(const void *a, const void *b)
+{
+	const struct cond_shm_ent *x = a, *y = b;
+
+	return strcmp(x->name, y->name);
+}
+
+/* Snapshot of the condition table published by Finit, see cond.h */
+static int dump_shm(const struct cond_shm *shm)
+{
+	struct cond_shm_ent *ent;
+	int i, num;
+
+	ent = malloc(COND_SHM_MAX * sizeof(*ent));
+	if (!ent)
+		return -1;
+
+	num = cond_shm_read(shm, ent, COND_SHM_MAX);
+	if (num < 0) {
+		free(ent);
+		return -1;
+	}
+
+	qsort(ent, num, sizeof(*ent), by_cond_name);
+	for (i = 0; i < num; i++) {
+		if (ent[i].state == COND_OFF)
+			continue;
+		dump_cond(ent[i].name, condstr(ent[i].state));
+	}
+	free(ent);
+
+	return 0;
+}
+
 static int do_cond_dump(char *arg)
 {
+	const struct cond_shm *shm;
+
 	col_widths();
 	if (heading && !json)
 		print_header("%-*s  %-*s  %-6s  %s", pw, "PID", iw, "IDENT",
@@ -404,7 +808,8 @@ static int do_cond_dump(char *arg)
 
 	dump_once = 0;
 	dump_filter = arg;
-	if (nftw(_PATH_COND, dump_one_cond, 20, 0) == -1) {
+	shm = cond_shm_map();
+	if ((!shm || dump_shm(shm)) && nftw(_PATH_COND, dump_one_cond, 20, 0) == -1) {
 		WARNX("Failed parsing %s", _PATH_COND);
 		return 1;
 	}
@@ -436,20 +841,71 @@ static cond_state_t cond_read(char *path)
 	return COND_ON;
 }
 
+/*
+ * Many usr/ conditions in one request, Finit steps all dependents once.
+ * Returns the number of failed conditions, or -1 if Finit cannot be
+ * reached, for the caller to fall back to the file system.
+ */
+static int cond_send_batch(condop_t op, char *names[], int num)
+{
+	struct init_request rq = {
+		.magic    = INIT_MAGIC,
+		.cmd      = INIT_CMD_COND_BATCH,
+		.runlevel = op == COND_SET,
+	};
+	size_t len = sizeof(rq);
+	char *msg, *ptr;
+	ssize_t sz;
+	int i;
+
+	for (i = 0; i < num; i++)
+		len += strlen(names[i]) + 1;
+
+	msg = malloc(len);
+	if (!msg)
+		return -1;
+
+	memcpy(msg, &rq, sizeof(rq));
+	ptr = msg + sizeof(rq);
+	for (i = 0; i < num; i++)
+		ptr = stpcpy(ptr, names[i]) + 1;
+
+	if (client_connect() == -1) {
+		free(msg);
+		return -1;
+	}
+
+	sz = write(client_socket(), msg, len);
+	free(msg);
+	if (sz != (ssize_t)len || read(client_socket(), &rq, sizeof(rq)) != sizeof(rq)) {
+		client_disconnect();
+		return -1;
+	}
+	client_disconnect();
+
+	if (rq.cmd == INIT_CMD_ACK)
+		return 0;
+
+	return rq.runlevel > 0 ? rq.runlevel : -1;
+}
+
 /*
  * cond get allows only one argument
- * cond set|clr iterate over multiple args
+ * cond set|clr iterate over multiple args, space or comma separated
  */
 static int do_cond_act(char *args, condop_t op)
 {
+	char *names[strlen(args ?: "") / 2 + 1];
+	const struct cond_shm *shm;
 	cond_state_t cstate;
+	int i, rc, num = 0;
 	char path[256];
 	char *arg;
 
 	if (!args || !args[0])
 		ERRX(2, "Invalid condition (empty)");
 
-	arg = strtok(args, " \t");
+	arg = strtok(args, " \t,");
 	while (arg) {
 		size_t off;
 
@@ -472,7 +928,11 @@ static int do_cond_act(char *args, condop_t op)
 
 		switch (op) {
 		case COND_GET:
-			cstate = cond_read(path);
+			rc = -1;
+			shm = cond_shm_map();
+			if (shm)
+				rc = cond_shm_get(shm, &path[off]);
+			cstate = rc == -1 ? cond_read(path) : (cond_state_t)rc;
 			if (verbose)
 				puts(condstr(cstate));
 
@@ -488,16 +948,31 @@ static int do_cond_act(char *args, condop_t op)
 			return 255;
 
 		case COND_SET:
-			if (symlink(_PATH_RECONF, path) && errno != EEXIST)
-				ERR(73, "Failed asserting condition <%s>", &path[off]);
-			break;
 		case COND_CLR:
-			if (erase(path) && errno != ENOENT)
-				ERR(73, "Failed deasserting condition <%s>", &path[off]);
+			names[num++] = arg;
 			break;
 		}
 
-		arg = strtok(NULL, " \t");
+		arg = strtok(NULL, " \t,");
+	}
+
+	rc = cond_send_batch(op, names, num);
+	if (rc > 0)
+		ERRX(73, "Failed %sasserting %d condition(s)", op == COND_SET ? "" : "de", rc);
+	if (rc == 0)
+		return 0;
+
+	/* Finit not reachable, e.g. from a chroot, use the file system */
+	for (i = 0; i < num; i++) {
+		snprintf(path, sizeof(path), _PATH_CONDUSR "%s", names[i]);
+
+		if (op == COND_SET) {
+			if (symlink(_PATH_RECONF, path) && errno != EEXIST)
+				ERR(73, "Failed asserting condition <%s%s>", COND_USR, names[i]);
+		} else {
+			if (erase(path) && errno != ENOENT)
+				ERR(73, "Failed deasserting condition <%s%s>", COND_USR, names[i]);
+		}
 	}
 
 	return 0;
@@ -647,7 +1122,7 @@ static int do_cmd(int cmd)
 	return 0;
 }
 
-int do_reboot  (char *arg) { return do_cmd(INIT_CMD_REBOOT);   }
+int do_reboot  (char *arg) { return do_cmd(kexec ? INIT_CMD_KEXEC : INIT_CMD_REBOOT); }
 int do_halt    (char *arg) { return do_cmd(INIT_CMD_HALT);     }
 int do_poweroff(char *arg) { return do_cmd(INIT_CMD_POWEROFF); }
 int do_suspend (char *arg) { return do_cmd(INIT_CMD_SUSPEND);  }
@@ -842,16 +1317,14 @@ static char *svc_command(svc_t *svc, char *buf, size_t len, int ansi)
 {
 	int bold = missing(svc) && ansi;
 
-	if (whichp(svc->cmd))
+	/* Only look up command in $PATH if it's reported missing */
+	if (bold && whichp(svc->cmd))
 		bold = 0;
 
 	strlcpy(buf, bold ? "\e[1m" : "", len);
 	strlcat(buf, svc->cmd, len);
 
-	for (int i = 1; i < MAX_NUM_SVC_ARGS; i++) {
-		if (!svc->args[i][0])
-			break;
-
+	for (int i = 1; svc->args[i]; i++) {
 		strlcat(buf, " ", len);
 		strlcat(buf, svc->args[i], len);
 	}
@@ -904,6 +1377,74 @@ static char *exit_status(svc_t *svc, char *buf, size_t len)
 	return buf;
 }
 
+/* CPU affinity, NUMA policy and scheduling, empty if inherited from Finit */
+static char *placement(svc_t *svc, char *buf, size_t len)
+{
+	const char *ioclass[] = { "none", "rt", "be", "idle" };
+	char tmp[80];
+
+	buf[0] = 0;
+	if (svc->cpus[0]) {
+		snprintf(tmp, sizeof(tmp), ", cpus %s", svc->cpus);
+		strlcat(buf, tmp, len);
+	}
+	if (svc->numa[0]) {
+		snprintf(tmp, sizeof(tmp), ", numa %s", svc->numa);
+		strlcat(buf, tmp, len);
+	}
+	switch (svc->sched_policy) {
+	case SCHED_BATCH:
+		strlcat(buf, ", sched batch", len);
+		break;
+	case SCHED_IDLE:
+		strlcat(buf, ", sched idle", len);
+		break;
+	case SCHED_FIFO:
+	case SCHED_RR:
+		snprintf(tmp, sizeof(tmp), ", sched %s:%d",
+			 svc->sched_policy == SCHED_FIFO ? "fifo" : "rr", svc->sched_prio);
+		strlcat(buf, tmp, len);
+		break;
+	default:
+		break;
+	}
+	if (svc->nice) {
+		snprintf(tmp, sizeof(tmp), ", nice %d", svc->nice);
+		strlcat(buf, tmp, len);
+	}
+	if (svc->ioprio) {
+		int class = (svc->ioprio >> 13) & 3;
+
+		if (class == 3)
+			snprintf(tmp, sizeof(tmp), ", ionice idle");
+		else
+			snprintf(tmp, sizeof(tmp), ", ionice %s:%d", ioclass[class], svc->ioprio & 7);
+		strlcat(buf, tmp, len);
+	}
+
+	/* Skip leading ", " */
+	if (buf[0])
+		memmove(buf, &buf[2], strlen(buf) - 1);
+
+	return buf;
+}
+
+/* Wall clock time of last/next run of timer tasks */
+static char *timer_time(time_t t, char *buf, size_t len)
+{
+	struct tm tm;
+
+	if (!t) {
+		strlcpy(buf, "never", len);
+		return buf;
+	}
+
+	localtime_r(&t, &tm);
+	strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+
+	return buf;
+}
+
 static char *status(svc_t *svc, int full)
 {
 	static char buf[96];
@@ -970,28 +1511,6 @@ static void show_cgroup_tree(char *group, char *pfx)
 	cgroup_tree(path, pfx, 0, 0);
 }
 
-/*
- * arg: 'foo'   should match foo:1 foo:2, etc. but not foobar
- * arg: 'foo:1' should only match foo:1
- * arg: 'foo:'  is allowed to fail, unsupported syntax atm
- * arg: 'foo:*' is allowed to fail, unsupported syntax atm
- */
-static int svc_compare(svc_t *svc, char *arg)
-{
-	char ident[MAX_IDENT_LEN];
-	char *ptr;
-
-	svc_ident(svc, ident, sizeof(ident));
-	ptr = strchr(ident, ':');
-	if (ptr && !strchr(arg, ':'))
-		*ptr = 0;
-
-	if (!strcmp(ident, arg))
-		return 1;
-
-	return 0;
-}
-
 static int json_status_one(FILE *fp, svc_t *svc, char *indent, int prev)
 {
 	long now = jiffies();
@@ -1046,11 +1565,36 @@ static int json_status_one(FILE *fp, svc_t *svc, char *indent, int prev)
 	if (buf[0])
 		fprintf(fp,
 			"%s  \"condition\": %s,\n", indent, buf);
+	if (svc->status_msg[0])
+		fprintf(fp,
+			"%s  \"message\": \"%s\",\n", indent,
+			json_escape(svc->status_msg, buf, sizeof(buf)));
+	if (svc->listen[0])
+		fprintf(fp,
+			"%s  \"listen\": \"%s\",\n", indent,
+			json_escape(svc->listen, buf, sizeof(buf)));
+	if (svc->path[0])
+		fprintf(fp,
+			"%s  \"path\": \"%s\",\n", indent,
+			json_escape(svc->path, buf, sizeof(buf)));
 	if (svc->manual)
 		fprintf(fp,
 			"%s  \"starts\": %d,\n", indent, svc->once);
+	if (svc_has_timer(svc))
+		fprintf(fp,
+			"%s  \"last_run\": %lld,\n"
+			"%s  \"next_run\": %lld,\n"
+			"%s  \"skipped\": %u,\n",
+			indent, (long long)svc->last_run,
+			indent, (long long)svc->next_run,
+			indent, svc->coalesced);
 	fprintf(fp,
 		"%s  \"restarts\": %d,\n", indent, svc->restart_tot); /* XXX: add restart_cnt and restart_max */
+	fprintf(fp,
+		"%s  \"oom_kills\": %u,\n", indent, svc->oom_tot);
+	if (svc->log.enabled && !svc_is_tty(svc))
+		fprintf(fp,
+			"%s  \"log_suppressed\": %llu,\n", indent, svc->log_suppressed);
 	fprintf(fp,
 		"%s  \"pidfile\": \"%s\",\n"
 		"%s  \"pid\": %d,\n"
@@ -1084,8 +1628,8 @@ static int show_status(char *arg)
 		char uptm[42] = "N/A";
 		char *pidfn = NULL;
 
-		for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0))
-			num += svc_compare(svc, arg);
+		for (svc = client_svc_dump(1, 0, 0, arg); svc; svc = client_svc_dump(0, 0, 0, NULL))
+			num++;
 
 		if (num > 1)
 			break;
@@ -1103,6 +1647,9 @@ static int show_status(char *arg)
 			return svc->state != SVC_RUNNING_STATE;
 		}
 
+		if (history)
+			return show_history(arg);
+
 		if (json) {
 			int rc;
 
@@ -1135,8 +1682,29 @@ static int show_status(char *arg)
 		printf("     Uptime : %s\n", svc->pid ? uptime(now - svc->start_time, uptm, sizeof(uptm)) : uptm);
 		if (svc->manual)
 			printf("     Starts : %d\n", svc->once);
+		if (svc_has_timer(svc)) {
+			char ok[48] = { 0 };
+
+			if (svc->last_run && !svc->pid)
+				exit_status(svc, ok, sizeof(ok));
+			printf("   Last run : %s%s\n", timer_time(svc->last_run, buf, sizeof(buf)), ok);
+			printf("   Next run : %s", timer_time(svc->next_run, buf, sizeof(buf)));
+			if (svc->coalesced)
+				printf(", %u skipped", svc->coalesced);
+			printf("\n");
+		}
 		printf("   Restarts : %d (%d/%d)\n", svc->restart_tot, svc->restart_cnt, svc->restart_max);
+		if (svc->oom_tot)
+			printf("  OOM kills : %u%s\n", svc->oom_tot, svc->oom ? ", since last start" : "");
+		if (!svc_is_tty(svc) && (svc->log.rate || svc->log_suppressed)) {
+			printf("  Log limit : %d/s, burst %d", svc->log.rate, svc->log.burst ?: svc->log.rate);
+			printf(", %llu suppressed\n", svc->log_suppressed);
+		}
+		if (svc->status_msg[0])
+			printf("    Message : %s\n", svc->status_msg);
 		printf("  Runlevels : %s\n", runlevel_string(runlevel, svc->runlevels));
+		if (placement(svc, buf, sizeof(buf))[0])
+			printf(" Scheduling : %s\n", buf);
 		if (cgrp && svc->pid > 1) {
 			char grbuf[128];
 			char path[256];
@@ -1164,11 +1732,7 @@ static int show_status(char *arg)
 	if (json) {
 		int prev = 0;
 
-		for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0)) {
-			svc_ident(svc, ident, sizeof(ident));
-			if (num && !svc_compare(svc, arg))
-				continue;
-
+		for (svc = client_svc_dump(1, 1, 0, num ? arg : NULL); svc; svc = client_svc_dump(0, 1, 0, NULL)) {
 			if (!prev)
 				fputs("[\n", stdout);
 			json_status_one(stdout, svc, "  ", prev++);
@@ -1193,12 +1757,10 @@ static int show_status(char *arg)
 		print_header("%s", title);
 	}
 
-	for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0)) {
+	for (svc = client_svc_dump(1, 0, 0, num ? arg : NULL); svc; svc = client_svc_dump(0, 0, 0, NULL)) {
 		char *lvls;
 
 		svc_ident(svc, ident, sizeof(ident));
-		if (num && !svc_compare(svc, arg))
-			continue;
 
 		printf("%-*d  ", pw, svc->pid);
 		printf("%-*s  %s ", iw, ident, status(svc, 0));
@@ -1222,7 +1784,7 @@ static int show_ident(char *arg)
 {
 	svc_t *svc;
 
-	for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0)) {
+	for (svc = client_svc_dump(1, 0, 0, NULL); svc; svc = client_svc_dump(0, 0, 0, NULL)) {
 		char ident[MAX_IDENT_LEN];
 		size_t len;
 		char *pos;
@@ -1285,9 +1847,13 @@ static int usage(int rc)
 		"Options:\n"
 		"  -b, --batch               Batch mode, no screen size probing\n"
 		"  -c, --create              Create missing paths (and files) as needed\n"
+		"  -e, --early               Finit messages from before syslogd in 'log'\n"
 		"  -f, --force               Ignore missing files and arguments, never prompt\n"
 		"  -h, --help                This help text\n"
+		"  -H, --history             Resource usage history in 'status <SVC>'\n"
+		"  -i, --interval=SEC        Update interval in commands like 'top', default 1\n"
 		"  -j, --json                JSON output in 'status' and 'cond' commands\n"
+		"  -k, --kexec               Reboot with kexec, if a kernel has been loaded\n"
 		"  -n, --noerr               Ignore error, e.g., already started/enabled/...\n"
 		"  -1, --once                Only one lap in commands like 'top'\n"
 		"  -p, --plain               Use plain table headings, no ctrl chars\n"
@@ -1298,6 +1864,7 @@ static int usage(int rc)
 		"\n"
 		"Commands:\n"
 		"  debug                     Toggle Finit (daemon) debug\n"
+		"  debug footprint           Show memory, objects, and descriptors of Finit\n"
 		"  help                      This help text\n"
 		"  version                   Show program version\n"
 		"\n", prognm);
@@ -1327,6 +1894,11 @@ static int usage(int rc)
 	else
 		fprintf(stderr,
 			"  reload                    Reload   %s (activate changes)\n", finit_conf);
+	fprintf(stderr,
+		"  compile                   Save snapshot of all .conf for faster boot\n"
+		"  reexec                    Re-exec Finit, e.g. after upgrade, keeps services\n"
+		"  events   [PREFIX]         Stream service, condition and runlevel events\n"
+		"  metrics                   Show counters and latencies, OpenMetrics text\n");
 
 	fprintf(stderr,
 		"\n"
@@ -1356,6 +1928,8 @@ static int usage(int rc)
 	fprintf(stderr,
 		"\n"
 		"  plugins                   List installed plugins\n"
+		"  analyze  [svg]            Show boot timeline, slowest services and critical\n"
+		"                            chain that gated the runlevel change, or as SVG\n"
 		"\n"
 		"  runlevel [0-9]            Show or set runlevel: 0 halt, 6 reboot\n"
 		"  reboot                    Reboot system\n"
@@ -1479,9 +2053,13 @@ int main(int argc, char *argv[])
 		{ "batch",      0, NULL, 'b' },
 		{ "create",     0, NULL, 'c' },
 		{ "debug",      0, NULL, 'd' },
+		{ "early",      0, NULL, 'e' },
 		{ "force",      0, NULL, 'f' },
 		{ "help",       0, NULL, 'h' },
+		{ "history",    0, NULL, 'H' },
+		{ "interval",   1, NULL, 'i' },
 		{ "json",       0, NULL, 'j' },
+		{ "kexec",      0, NULL, 'k' },
 		{ "noerr",      0, NULL, 'n' },
 		{ "once",       0, NULL, '1' },
 		{ "plain",      0, NULL, 'p' },
@@ -1519,14 +2097,18 @@ int main(int argc, char *argv[])
 		{ "edit",     NULL, serv_edit,    NULL, NULL  },
 		{ "create",   NULL, serv_creat,   NULL, NULL  },
 		{ "delete",   NULL, serv_delete,  NULL, NULL  },
-		{ "reload",   NULL, do_reload,    NULL, NULL  },
+		{ "reload",   NULL, NULL,         NULL, do_reload  },
+		{ "compile",  NULL, do_compile,   NULL, NULL  },
+		{ "reexec",   NULL, do_reexec,    NULL, NULL  },
+		{ "events",   NULL, do_events,    NULL, NULL  },
+		{ "metrics",  NULL, do_metrics,   NULL, NULL  },
 
 		{ "cond",     cond, NULL, NULL, NULL          },
 
 		{ "log",      NULL, show_log,     NULL, NULL  },
-		{ "start",    NULL, do_start,     NULL, NULL  },
-		{ "stop",     NULL, do_stop,      NULL, NULL  },
-		{ "restart",  NULL, do_restart,   NULL, NULL  },
+		{ "start",    NULL, NULL,         NULL, do_start   },
+		{ "stop",     NULL, NULL,         NULL, do_stop    },
+		{ "restart",  NULL, NULL,         NULL, do_restart },
 		{ "signal",   NULL, NULL,         NULL, do_signal  },
 		{ "kill",     NULL, NULL,         NULL, do_signal  }, /* alias */
 
@@ -1535,6 +2117,7 @@ int main(int argc, char *argv[])
 		{ "top",      NULL, show_cgtop,  &cgrp, NULL  },
 
 		{ "plugins",  NULL, plugins_list, NULL, NULL  },
+		{ "analyze",  NULL, do_analyze,   NULL, NULL  },
 
 		{ "runlevel", NULL, do_runlevel,  NULL, NULL  },
 		{ "reboot",   NULL, do_reboot,    NULL, NULL  },
@@ -1555,7 +2138,7 @@ int main(int argc, char *argv[])
 	cgrp = cgroup_avail();
 	utmp = has_utmp();
 
-	while ((c = getopt_long(argc, argv, "1bcdfh?jnpqtvV", long_options, NULL)) != EOF) {
+	while ((c = getopt_long(argc, argv, "1bcdefh?Hi:jknpqtvV", long_options, NULL)) != EOF) {
 		switch(c) {
 		case '1':
 			ionce = 1;
@@ -1573,6 +2156,10 @@ int main(int argc, char *argv[])
 			debug = 1;
 			break;
 
+		case 'e':
+			early = 1;
+			break;
+
 		case 'f':
 			iforce = 1;
 			break;
@@ -1581,10 +2168,24 @@ int main(int argc, char *argv[])
 		case '?':
 			return usage(0);
 
+		case 'H':
+			history = 1;
+			break;
+
+		case 'i':
+			interval = (int)(strtod(optarg, NULL) * 1000);
+			if (interval < 100)
+				interval = 100;
+			break;
+
 		case 'j':
 			json = 1;
 			break;
 
+		case 'k':
+			kexec = 1;
+			break;
+
 		case 'n':
 			noerr = 1;
 			break;
@@ -35,6 +35,7 @@ extern char *finit_rcsd;
 extern int icreate;			/* initctl -c */
 extern int iforce;			/* initctl -f */
 extern int ionce;			/* initctl -1 */
+extern int interval;			/* initctl -i, msec */
 extern int heading;			/* initctl -t */
 extern int json;			/* initctl -j */
 extern int noerr;			/* initctl -n */
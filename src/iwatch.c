@@ -28,6 +28,7 @@
 #include "finit.h"
 #include "iwatch.h"
 #include "log.h"
+#include "util.h"
 
 /*
  * iwatch is initialized and used mainly by the pidfile plugin, which is
@@ -37,6 +38,34 @@
  */
 static int initialized = 0;
 
+/* All active watchers, for the footprint report */
+static LIST_HEAD(, iwatch) registry = LIST_HEAD_INITIALIZER(registry);
+
+static struct iwatch_bucket *wd_bucket(struct iwatch *iw, int wd)
+{
+	return &iw->wd_hash[(unsigned int)wd & (IWATCH_BUCKETS - 1)];
+}
+
+static struct iwatch_bucket *path_bucket(struct iwatch *iw, const char *path)
+{
+	return &iw->path_hash[strhash(STRHASH_INIT, path) & (IWATCH_BUCKETS - 1)];
+}
+
+static void iwp_unlink(struct iwatch *iw, struct iwatch_path *iwp)
+{
+	TAILQ_REMOVE(&iw->iwp_list, iwp, link);
+	TAILQ_REMOVE(wd_bucket(iw, iwp->wd), iwp, wd_link);
+	TAILQ_REMOVE(path_bucket(iw, iwp->path), iwp, path_link);
+}
+
+static void registry_add(struct iwatch *iw)
+{
+	if (iw->registered)
+		return;
+
+	LIST_INSERT_HEAD(&registry, iw, reg);
+	iw->registered = 1;
+}
 
 int iwatch_init(struct iwatch *iw)
 {
@@ -49,6 +78,10 @@ int iwatch_init(struct iwatch *iw)
 	}
 
 	TAILQ_INIT(&iw->iwp_list);
+	for (int i = 0; i < IWATCH_BUCKETS; i++) {
+		TAILQ_INIT(&iw->wd_hash[i]);
+		TAILQ_INIT(&iw->path_hash[i]);
+	}
 
 	iw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 	if (iw->fd < 0) {
@@ -68,6 +101,7 @@ int iwatch_init(struct iwatch *iw)
 	}
 
 	initialized = 1;
+	registry_add(iw);
 
 	return iw->fd;
 }
@@ -77,7 +111,7 @@ void iwatch_exit(struct iwatch *iw)
 	struct iwatch_path *iwp, *tmp;
 
 	TAILQ_FOREACH_SAFE(iwp, &iw->iwp_list, link, tmp) {
-		TAILQ_REMOVE(&iw->iwp_list, iwp, link);
+		iwp_unlink(iw, iwp);
 		inotify_rm_watch(iw->fd, iwp->wd);
 		free(iwp->path);
 		free(iwp);
@@ -85,6 +119,34 @@ void iwatch_exit(struct iwatch *iw)
 
 	close(iw->fd);
 	initialized = 0;
+	if (iw->registered) {
+		LIST_REMOVE(iw, reg);
+		iw->registered = 0;
+	}
+}
+
+/* Number of paths watched by @iw */
+size_t iwatch_paths(struct iwatch *iw)
+{
+	struct iwatch_path *iwp;
+	size_t num = 0;
+
+	TAILQ_FOREACH(iwp, &iw->iwp_list, link)
+		num++;
+
+	return num;
+}
+
+/*
+ * Iterate over active watchers, start with @prev %NULL.  Returns %NULL
+ * when done.
+ */
+struct iwatch *iwatch_iter(struct iwatch *prev)
+{
+	if (!prev)
+		return LIST_FIRST(&registry);
+
+	return LIST_NEXT(prev, reg);
 }
 
 int iwatch_add1(struct iwatch *iw, char *file, uint32_t mask)
@@ -143,6 +205,8 @@ int iwatch_add1(struct iwatch *iw, char *file, uint32_t mask)
 	iwp->path = path;
 	iwp->wd = wd;
 	TAILQ_INSERT_HEAD(&iw->iwp_list, iwp, link);
+	TAILQ_INSERT_HEAD(wd_bucket(iw, wd), iwp, wd_link);
+	TAILQ_INSERT_HEAD(path_bucket(iw, path), iwp, path_link);
 
 	return 0;
 }
@@ -159,7 +223,7 @@ int iwatch_del(struct iwatch *iw, struct iwatch_path *iwp)
 
 	dbg("Removing watcher for removed path %s", iwp->path);
 
-	TAILQ_REMOVE(&iw->iwp_list, iwp, link);
+	iwp_unlink(iw, iwp);
 	inotify_rm_watch(iw->fd, iwp->wd);
 	free(iwp->path);
 	free(iwp);
@@ -174,7 +238,7 @@ struct iwatch_path *iwatch_find_by_wd(struct iwatch *iw, int wd)
 	if (!initialized)
 		return NULL;
 
-	TAILQ_FOREACH(iwp, &iw->iwp_list, link) {
+	TAILQ_FOREACH(iwp, wd_bucket(iw, wd), wd_link) {
 		if (iwp->wd == wd)
 			return iwp;
 	}
@@ -189,7 +253,7 @@ struct iwatch_path *iwatch_find_by_path(struct iwatch *iw, const char *path)
 	if (!initialized)
 		return NULL;
 
-	TAILQ_FOREACH(iwp, &iw->iwp_list, link) {
+	TAILQ_FOREACH(iwp, path_bucket(iw, path), path_link) {
 		if (!strcmp(iwp->path, path))
 			return iwp;
 	}
@@ -197,6 +261,61 @@ struct iwatch_path *iwatch_find_by_path(struct iwatch *iw, const char *path)
 	return NULL;
 }
 
+#define IWATCH_GONE (IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVE_SELF | IN_IGNORED)
+#define IWATCH_SLOTS 128
+
+/**
+ * iwatch_coalesce - Merge events for the same file in a read() batch
+ * @buf: Buffer of &struct inotify_event from read()
+ * @len: Number of bytes read
+ *
+ * Event storms, e.g., pidfiles written by many services at once, give
+ * IN_CREATE, IN_MODIFY and IN_CLOSE_WRITE for each file.  All events on
+ * the same wd and name are merged into the last one, which gets the
+ * union of their masks, unless it removes the file, and earlier events
+ * are cleared to mask 0, which callers already skip.
+ */
+void iwatch_coalesce(char *buf, size_t len)
+{
+	struct inotify_event *slot[IWATCH_SLOTS] = { NULL };
+	struct inotify_event *ev;
+	size_t off;
+
+	for (off = 0; off + sizeof(*ev) <= len; off += sizeof(*ev) + ev->len) {
+		unsigned int hash, i, n;
+
+		ev = (struct inotify_event *)&buf[off];
+		if (off + sizeof(*ev) + ev->len > len)
+			break;
+		if (ev->wd < 0 || !ev->mask)
+			continue;
+
+		hash = strhash(STRHASH_INIT + ev->wd, ev->len ? ev->name : "");
+		for (i = hash % IWATCH_SLOTS, n = 0; n < IWATCH_SLOTS; i = (i + 1) % IWATCH_SLOTS, n++) {
+			struct inotify_event *prev = slot[i];
+
+			if (!prev) {
+				slot[i] = ev;
+				break;
+			}
+
+			if (prev->wd != ev->wd || prev->len != ev->len ||
+			    (ev->len && strcmp(prev->name, ev->name)))
+				continue;
+
+			/* e.g. file replaced by directory, keep both */
+			if ((prev->mask ^ ev->mask) & IN_ISDIR)
+				break;
+
+			if (!(ev->mask & IWATCH_GONE))
+				ev->mask |= prev->mask & ~IWATCH_GONE;
+			prev->mask = 0;
+			slot[i] = ev;
+			break;
+		}
+	}
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
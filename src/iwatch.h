@@ -44,15 +44,27 @@
  */
 #define IWATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVE | IN_MASK_CREATE)
 
+/* Lookup by wd and path, for sets of thousands of watched paths */
+#define IWATCH_BUCKETS 256
+
 struct iwatch_path {
 	TAILQ_ENTRY(iwatch_path) link;
+	TAILQ_ENTRY(iwatch_path) wd_link;
+	TAILQ_ENTRY(iwatch_path) path_link;
 	char *path;
 	int wd;
 };
 
+TAILQ_HEAD(iwatch_bucket, iwatch_path);
+
 struct iwatch {
+	const char *name;	/* For footprint report, e.g. "conf" */
+	LIST_ENTRY(iwatch) reg;	/* Active watchers, see iwatch_iter() */
+	int registered;
 	int fd;
 	TAILQ_HEAD(, iwatch_path) iwp_list;
+	struct iwatch_bucket wd_hash[IWATCH_BUCKETS];
+	struct iwatch_bucket path_hash[IWATCH_BUCKETS];
 };
 
 
@@ -66,6 +78,11 @@ int  iwatch_del  (struct iwatch *iw, struct iwatch_path *iwp);
 struct iwatch_path *iwatch_find_by_wd   (struct iwatch *iw, int wd);
 struct iwatch_path *iwatch_find_by_path (struct iwatch *iw, const char *path);
 
+void iwatch_coalesce (char *buf, size_t len);
+
+size_t iwatch_paths  (struct iwatch *iw);
+struct iwatch *iwatch_iter(struct iwatch *prev);
+
 #endif /* FINIT_IWATCH_H_ */
 
 /**
@@ -22,7 +22,6 @@
  */
 
 #include <errno.h>
-#include <dirent.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdio.h>
@@ -46,13 +45,9 @@
 
 #include "cond.h"
 #include "pid.h"
+#include "pwr.h"
 #include "util.h"
 
-#define _PATH_SYSFS_PWR  "/sys/class/power_supply"
-
-static int num_ac_online;
-static int num_ac;
-
 static int running = 1;
 static int level;
 static int logon;
@@ -89,66 +84,21 @@ static void sys_cond(char *cond, int set)
 	}
 }
 
-static int fgetline(char *path, char *buf, size_t len)
-{
-	FILE *fp;
-
-	fp = fopen(path, "r");
-	if (!fp)
-		return -1;
-
-	if (!fgets(buf, len, fp)) {
-		fclose(fp);
-		return -1;
-	}
-
-	chomp(buf);
-	fclose(fp);
-
-	return 0;
-}
-
-static int check_online(char *online)
+static void pwr_cond(void)
 {
-	int val;
-
-	if (!online)
-		return 0;
+	int online = pwr_online();
 
-	val = atoi(online);
-	logit(LOG_INFO, "AC %s", val ? "connected" : "disconnected");
-
-	return val;
-}
-
-static int is_ac(char *type)
-{
-	char *types[] = {
-		"Mains",
-		"USB",
-		"BrickID",
-		"Wireless",
-		NULL
-	};
-	int i;
-
-	for (i = 0; types[i]; i++) {
-		if (!strncmp(type, types[i], strlen(types[i])))
-			return 1;
-	}
-
-	return 0;
+	logit(LOG_INFO, "AC %s", online ? "connected" : "disconnected");
+	sys_cond("pwr/ac", online);
 }
 
 static void init(void)
 {
-	struct dirent **d = NULL;
 	char *cond_dirs[] = {
 		_PATH_CONDSYS,
 		_PATH_CONDSYS "/pwr",
 	};
-	char path[384];
-	int i, n;
+	int i;
 
 	for (i = 0; i < (int)NELEMS(cond_dirs); i++) {
 		if (mkpath(cond_dirs[i], 0755) && errno != EEXIST) {
@@ -158,30 +108,8 @@ static void init(void)
 		}
 	}
 
-	n = scandir(_PATH_SYSFS_PWR, &d, NULL, alphasort);
-	for (i = 0; i < n; i++) {
-		char *nm = d[i]->d_name;
- 		char buf[10];
-
-		snprintf(path, sizeof(path), "%s/%s/type", _PATH_SYSFS_PWR, nm);
-		if (!fgetline(path, buf, sizeof(buf)) && is_ac(buf)) {
-			num_ac++;
-
-			snprintf(path, sizeof(path), "%s/%s/online", _PATH_SYSFS_PWR, nm);
-			if (!fgetline(path, buf, sizeof(buf))) {
-				if (check_online(buf))
-					num_ac_online++;
-			}
-		}
-		free(d[i]);
-	}
-
-	if (n > 0)
-		free(d);
-
-	/* if any power_supply is online, or none can be found */
-	if (num_ac == 0 || num_ac_online > 0)
-		sys_cond("pwr/ac", 1);
+	pwr_scan();
+	pwr_cond();
 }
 
 static void set_logging(int prio)
@@ -205,11 +133,11 @@ static void shut_down(int signo)
 }
 
 /*
- * Started by Finit as soon as possible when base filesystem is up,
- * modules have been probed, or insmodded from /etc/finit.conf, so by
- * now we should have /sys/class/power_supply/ available for probing.
- * If none is found we assert /sys/pwr/ac condition anyway, this is what
- * systemd does (ConditionACPower) and also makes most sense.
+ * Started by Finit as soon as possible when base filesystem is up, so
+ * power supplies may still be probed.  After the initial scan of sysfs
+ * all changes, including supplies coming and going, are tracked from
+ * kernel uevents, see pwr.c.  If no supply is found we assert the
+ * sys/pwr/ac condition anyway, like systemd (ConditionACPower).
  */
 int main(int argc, char *argv[])
 {
@@ -239,15 +167,13 @@ int main(int argc, char *argv[])
 
 	nls.nl_family = AF_NETLINK;
 	nls.nl_pid    = 0;
-	nls.nl_groups = -1;
+	nls.nl_groups = 1;	/* kernel uevents only, not libudev */
 	if (bind(pfd.fd, (void *)&nls, sizeof(struct sockaddr_nl)))
 		panic("bind failed");
 
 	logit(LOG_DEBUG, "Waiting for events ...");
 	while (running) {
-		char *path = NULL;
-		int ac = 0;
-		int i, len;
+		int len;
 
 		if (-1 == poll(&pfd, 1, -1)) {
 			if (errno == EINTR)
@@ -256,13 +182,16 @@ int main(int argc, char *argv[])
 			break;
 		}
 
-		len = recv(pfd.fd, buf, sizeof(buf), MSG_DONTWAIT);
+		len = recv(pfd.fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
 		if (len == -1) {
 			switch (errno) {
 			case EINTR:
+			case EAGAIN:
 				continue;
 			case ENOBUFS:
-				warn("lost events");
+				warn("lost events, rescanning");
+				if (pwr_scan())
+					pwr_cond();
 				continue;
 			default:
 				panic("unhandled");
@@ -272,40 +201,14 @@ int main(int argc, char *argv[])
 		buf[len] = 0;
 		logit(LOG_DEBUG, "%s", buf);
 
-		/* skip libusb events, focus on kernel events/changes */
-		if (strncmp(buf, "change@", 7))
-			continue;
-
 		/* XXX: currently limited to monitoring this subsystem */
 		if (!strstr(buf, "power_supply"))
 			continue;
 
-		i = 0;
-		while (i < len) {
-			char *line = buf + i;
-
-			logit(LOG_DEBUG, "%s", line);
-			if (!strncmp(line, "DEVPATH=", 8)) {
-				path = &line[8];
-				logit(LOG_DEBUG, "Got path %s", path);
-			} else if (!strncmp(line, "POWER_SUPPLY_TYPE=", 18)) {
-				ac = is_ac(&line[18]);
-			} else if (!strncmp(line, "POWER_SUPPLY_ONLINE=", 20) && ac) {
-				if (check_online(&line[20])) {
-					if (!num_ac_online)
-						sys_cond("pwr/ac", 1);
-					num_ac_online++;
-				} else {
-					if (num_ac_online > 0)
-						num_ac_online--;
-					if (!num_ac_online)
-						sys_cond("pwr/ac", 0);
-				}
-			}
-
-			i += strlen(line) + 1;
-		}
+		if (pwr_uevent(buf, len))
+			pwr_cond();
 	}
+	pwr_exit();
 	close(pfd.fd);
 
 	return 0;
@@ -0,0 +1,689 @@
+/* Client library for the Finit API socket, persistent and pipelined
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Unlike the client in initctl, which connects for each request, this
+ * library keeps the connection.  Requests are queued and written as
+ * the socket allows, without waiting for replies, which Finit sends in
+ * the same order as the requests.  All sockets are non-blocking, and
+ * finit_fd() with finit_events() can be used in any event loop to call
+ * finit_flush() and finit_recv() when ready.
+ *
+ * Finit disconnects idle clients, finit_call() and friends reconnect
+ * when needed.  Pipelined requests are lost if the connection is lost,
+ * finit_recv() then fails with ECONNRESET.
+ */
+#include "config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "finit.h"
+#include "svc.h"
+#include "finit-client.h"
+
+#define FINIT_TIMEOUT 15000	/* msec, same as initctl */
+
+struct finit_conn {
+	int                  sd;
+	char                 path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+	struct init_request *out;	/* Requests not yet written */
+	size_t               out_num;
+	size_t               out_max;
+
+	unsigned int         tag;	/* Tag of latest request */
+	unsigned int         done;	/* Tag of latest reply */
+};
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int do_connect(finit_conn_t *fc)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+	strncpy(sun.sun_path, fc->path, sizeof(sun.sun_path) - 1);
+	fc->sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fc->sd == -1)
+		return -1;
+
+	if (connect(fc->sd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		int saved = errno;
+
+		close(fc->sd);
+		fc->sd = -1;
+		errno = saved;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Drop connection, and all pipelined requests along with it */
+static void do_disconnect(finit_conn_t *fc)
+{
+	if (fc->sd != -1)
+		close(fc->sd);
+	fc->sd      = -1;
+	fc->out_num = 0;
+	fc->done    = fc->tag;
+}
+
+/*
+ * Reconnect, if Finit has closed an idle connection.  Only possible
+ * when there are no outstanding requests.
+ */
+static int do_check(finit_conn_t *fc)
+{
+	char c;
+
+	if (finit_pending(fc)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (fc->sd != -1) {
+		ssize_t len = recv(fc->sd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+		if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		do_disconnect(fc);
+	}
+
+	return do_connect(fc);
+}
+
+/* Wait for @events, returns 0 on timeout, -1 on error, or revents */
+static int do_poll(finit_conn_t *fc, int events, long long deadline)
+{
+	struct pollfd pfd = { .fd = fc->sd, .events = events };
+	int rc;
+
+	do {
+		int tmo = deadline < 0 ? -1 : (int)(deadline - now());
+
+		if (deadline >= 0 && tmo < 0)
+			tmo = 0;
+		rc = poll(&pfd, 1, tmo);
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc <= 0)
+		return rc;
+
+	return pfd.revents;
+}
+
+/* Blocking write of a request not sent through the queue */
+static int do_write(finit_conn_t *fc, struct init_request *rq, long long deadline)
+{
+	while (send(fc->sd, rq, sizeof(*rq), MSG_NOSIGNAL) != sizeof(*rq)) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return -1;
+		if (do_poll(fc, POLLOUT, deadline) <= 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Blocking read of one message, or with @flags only peeking at it */
+static ssize_t do_read(finit_conn_t *fc, void *buf, size_t len, int flags, long long deadline)
+{
+	while (1) {
+		ssize_t rc;
+
+		rc = recv(fc->sd, buf, len, flags | MSG_DONTWAIT);
+		if (rc != -1)
+			return rc;
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return -1;
+		if (do_poll(fc, POLLIN, deadline) <= 0)
+			return -1;
+	}
+}
+
+/**
+ * finit_open - Connect to Finit
+ * @path: Path to API socket, or %NULL for the default
+ *
+ * Returns:
+ * New connection, or %NULL with errno set on error.
+ */
+finit_conn_t *finit_open(const char *path)
+{
+	finit_conn_t *fc;
+
+	fc = calloc(1, sizeof(*fc));
+	if (!fc)
+		return NULL;
+
+	strncpy(fc->path, path ? path : INIT_SOCKET, sizeof(fc->path) - 1);
+	if (do_connect(fc)) {
+		int saved = errno;
+
+		free(fc);
+		errno = saved;
+		return NULL;
+	}
+
+	return fc;
+}
+
+/**
+ * finit_close - Disconnect from Finit and free connection
+ * @fc: Connection from finit_open()
+ */
+void finit_close(finit_conn_t *fc)
+{
+	if (!fc)
+		return;
+
+	do_disconnect(fc);
+	free(fc->out);
+	free(fc);
+}
+
+/**
+ * finit_fd - Socket of connection, for poll() or any event loop
+ * @fc: Connection from finit_open()
+ *
+ * Note, the socket changes when reconnecting.
+ */
+int finit_fd(finit_conn_t *fc)
+{
+	return fc->sd;
+}
+
+/**
+ * finit_events - Events to wait for on finit_fd()
+ * @fc: Connection from finit_open()
+ *
+ * Returns:
+ * %POLLIN, and %POLLOUT if there are requests not yet written.
+ */
+int finit_events(finit_conn_t *fc)
+{
+	return POLLIN | (fc->out_num ? POLLOUT : 0);
+}
+
+/**
+ * finit_pending - Number of requests waiting for a reply
+ * @fc: Connection from finit_open()
+ */
+int finit_pending(finit_conn_t *fc)
+{
+	return (int)(fc->tag - fc->done);
+}
+
+/**
+ * finit_flush - Write queued requests
+ * @fc: Connection from finit_open()
+ *
+ * Never blocks, call again when finit_fd() is writable.
+ *
+ * Returns:
+ * 0 when all requests are written, 1 if some remain, -1 on error.
+ */
+int finit_flush(finit_conn_t *fc)
+{
+	size_t i = 0;
+
+	if (fc->sd == -1) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	while (i < fc->out_num) {
+		ssize_t len;
+
+		len = send(fc->sd, &fc->out[i], sizeof(fc->out[i]), MSG_NOSIGNAL);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			do_disconnect(fc);
+			return -1;
+		}
+		i++;
+	}
+
+	fc->out_num -= i;
+	if (i && fc->out_num)
+		memmove(fc->out, &fc->out[i], fc->out_num * sizeof(fc->out[0]));
+
+	return fc->out_num ? 1 : 0;
+}
+
+/**
+ * finit_send - Queue request, without waiting for reply
+ * @fc:   Connection from finit_open()
+ * @cmd:  Command, e.g. %INIT_CMD_START_SVC, see finit/finit.h
+ * @arg:  Command argument, e.g. signal for %INIT_CMD_SIGNAL, or 0
+ * @data: Command data, e.g. a jobstr, or %NULL
+ *
+ * Only for commands with one &struct init_request as reply, use the
+ * dedicated functions for the others, e.g. finit_svc_dump().
+ *
+ * Returns:
+ * Tag of request, matching &finit_reply.tag, or -1 on error.
+ */
+int finit_send(finit_conn_t *fc, int cmd, int arg, const char *data)
+{
+	struct init_request *rq;
+
+	if (fc->sd == -1 && do_check(fc))
+		return -1;
+
+	if (fc->out_num == fc->out_max) {
+		size_t max = fc->out_max ? fc->out_max * 2 : 16;
+		void *ptr;
+
+		ptr = realloc(fc->out, max * sizeof(fc->out[0]));
+		if (!ptr)
+			return -1;
+		fc->out     = ptr;
+		fc->out_max = max;
+	}
+
+	rq = &fc->out[fc->out_num++];
+	memset(rq, 0, sizeof(*rq));
+	rq->magic    = INIT_MAGIC;
+	rq->cmd      = cmd;
+	rq->runlevel = arg;
+	if (data)
+		strncpy(rq->data, data, sizeof(rq->data) - 1);
+
+	if (finit_flush(fc) == -1)
+		return -1;
+
+	return (int)++fc->tag;
+}
+
+/**
+ * finit_recv - Read next reply
+ * @fc:      Connection from finit_open()
+ * @reply:   Reply to fill in
+ * @timeout: In msec, 0 returns at once if there is no reply, -1 waits
+ *
+ * Also writes queued requests while waiting.
+ *
+ * Returns:
+ * 1 with @reply filled in, 0 on timeout, or -1 on error.
+ */
+int finit_recv(finit_conn_t *fc, struct finit_reply *reply, int timeout)
+{
+	long long deadline = timeout < 0 ? -1 : now() + timeout;
+	struct init_request rq;
+
+	if (!finit_pending(fc)) {
+		errno = ENOMSG;
+		return -1;
+	}
+
+	while (1) {
+		ssize_t len;
+		int rc;
+
+		if (fc->out_num && finit_flush(fc) == -1)
+			return -1;
+
+		len = recv(fc->sd, &rq, sizeof(rq), MSG_DONTWAIT);
+		if (len == sizeof(rq))
+			break;
+
+		if (len == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			do_disconnect(fc);
+			return -1;
+		}
+		if (!len) {
+			do_disconnect(fc);
+			errno = ECONNRESET;
+			return -1;
+		}
+		if (len > 0) {
+			errno = EBADMSG;
+			return -1;
+		}
+
+		rc = do_poll(fc, finit_events(fc), deadline);
+		if (rc <= 0)
+			return rc;
+	}
+
+	reply->tag  = ++fc->done;
+	reply->ok   = rq.cmd == INIT_CMD_ACK;
+	reply->arg  = rq.runlevel;
+	reply->arg2 = rq.sleeptime;
+	memcpy(reply->data, rq.data, sizeof(reply->data));
+	reply->data[sizeof(reply->data) - 1] = 0;
+
+	return 1;
+}
+
+/**
+ * finit_call - Send request and wait for its reply
+ * @fc:    Connection from finit_open()
+ * @cmd:   Command, see finit_send()
+ * @arg:   Command argument, or 0
+ * @data:  Command data, or %NULL
+ * @reply: Reply to fill in
+ *
+ * Cannot be mixed with pipelined requests still waiting for replies.
+ *
+ * Returns:
+ * 0 when a reply is received, check @reply->ok, or -1 on error.
+ */
+int finit_call(finit_conn_t *fc, int cmd, int arg, const char *data, struct finit_reply *reply)
+{
+	int rc;
+
+	if (do_check(fc))
+		return -1;
+
+	if (finit_send(fc, cmd, arg, data) == -1) {
+		/* Lost connection before the request was sent, retry once */
+		if (do_check(fc) || finit_send(fc, cmd, arg, data) == -1)
+			return -1;
+	}
+
+	rc = finit_recv(fc, reply, FINIT_TIMEOUT);
+	if (rc == 0) {
+		do_disconnect(fc);
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	return rc == 1 ? 0 : -1;
+}
+
+static int do_simple(finit_conn_t *fc, int cmd, const char *job)
+{
+	struct finit_reply reply;
+
+	if (finit_call(fc, cmd, 0, job, &reply))
+		return -1;
+
+	return reply.ok ? 0 : 1;
+}
+
+/**
+ * finit_start - Start service(s)
+ * @fc:  Connection from finit_open()
+ * @job: Jobstr, e.g. "foo", "foo:1", or "1 2 bar"
+ *
+ * Returns:
+ * 0 on success, 1 if Finit failed the request, or -1 on error.
+ */
+int finit_start(finit_conn_t *fc, const char *job)
+{
+	return do_simple(fc, INIT_CMD_START_SVC, job);
+}
+
+/* See finit_start() */
+int finit_stop(finit_conn_t *fc, const char *job)
+{
+	return do_simple(fc, INIT_CMD_STOP_SVC, job);
+}
+
+/* See finit_start() */
+int finit_restart(finit_conn_t *fc, const char *job)
+{
+	return do_simple(fc, INIT_CMD_RESTART_SVC, job);
+}
+
+/* See finit_start(), with @job %NULL all .conf files are reloaded */
+int finit_reload(finit_conn_t *fc, const char *job)
+{
+	if (!job || !job[0])
+		return do_simple(fc, INIT_CMD_RELOAD, NULL);
+
+	return do_simple(fc, INIT_CMD_RELOAD_SVC, job);
+}
+
+/**
+ * finit_runlevel - Get current runlevel
+ * @fc:        Connection from finit_open()
+ * @prevlevel: Optional, set to previous runlevel
+ *
+ * Returns:
+ * Current runlevel, 10 for bootstrap (S), or -1 on error.
+ */
+int finit_runlevel(finit_conn_t *fc, int *prevlevel)
+{
+	struct finit_reply reply;
+
+	if (finit_call(fc, INIT_CMD_GET_RUNLEVEL, 0, NULL, &reply))
+		return -1;
+
+	if (prevlevel)
+		*prevlevel = reply.arg2;
+
+	return reply.arg;
+}
+
+/**
+ * finit_metrics - Counters and latencies, in OpenMetrics text format
+ * @fc:  Connection from finit_open()
+ * @len: Optional, set to length of text
+ *
+ * Cannot be mixed with pipelined requests still waiting for replies.
+ *
+ * Returns:
+ * NUL terminated text, to be freed by the caller, or %NULL on error.
+ */
+char *finit_metrics(finit_conn_t *fc, size_t *len)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_GET_METRICS,
+	};
+	long long deadline = now() + FINIT_TIMEOUT;
+	char *buf = NULL;
+	size_t off = 0;
+
+	if (do_check(fc) || do_write(fc, &rq, deadline))
+		goto fail;
+
+	if (do_read(fc, &rq, sizeof(rq), 0, deadline) != sizeof(rq) || rq.cmd != INIT_CMD_ACK || rq.runlevel < 0) {
+		errno = EBADMSG;
+		goto fail;
+	}
+
+	buf = malloc(rq.runlevel + 1);
+	if (!buf)
+		goto fail;
+
+	while (off < (size_t)rq.runlevel) {
+		ssize_t rc;
+
+		rc = do_read(fc, &buf[off], rq.runlevel - off, 0, deadline);
+		if (rc <= 0) {
+			errno = rc ? errno : ECONNRESET;
+			goto fail;
+		}
+		off += rc;
+	}
+	buf[off] = 0;
+
+	if (len)
+		*len = off;
+
+	return buf;
+fail:
+	do_disconnect(fc);
+	free(buf);
+
+	return NULL;
+}
+
+/* Unpack next brief record, see struct svc_rec in finit/svc.h */
+static int unpack(struct svc_rec *rec, size_t len, struct finit_svc *svc, const char ***args, size_t *max)
+{
+	char *ptr = rec->strings;
+	char *end = (char *)rec + len;
+	const char **str[] = { &svc->name, &svc->id, &svc->desc };
+	size_t num = 0;
+
+	end[-1] = 0;
+	for (size_t i = 0; i < sizeof(str) / sizeof(str[0]); i++) {
+		*str[i] = ptr < end ? ptr : "";
+		if (ptr < end)
+			ptr += strlen(ptr) + 1;
+	}
+
+	while (1) {
+		if (num + 1 >= *max) {
+			void *tmp;
+
+			tmp = realloc(*args, (*max + 16) * sizeof(char *));
+			if (!tmp)
+				return -1;
+			*args = tmp;
+			*max += 16;
+		}
+
+		if (ptr >= end || !*ptr)
+			break;
+
+		(*args)[num++] = ptr;
+		ptr += strlen(ptr) + 1;
+	}
+	(*args)[num] = NULL;
+
+	svc->pid       = rec->pid;
+	svc->state     = rec->state;
+	svc->type      = rec->type;
+	svc->block     = rec->block;
+	svc->status    = rec->status;
+	svc->runlevels = rec->runlevels;
+	svc->restarts  = rec->restart_tot;
+	svc->args      = *args;
+
+	return 0;
+}
+
+/**
+ * finit_svc_dump - Brief status of all, or some, services
+ * @fc:     Connection from finit_open()
+ * @types:  Filter on svc_type_t, e.g. %SVC_TYPE_SERVICE, or 0 for all
+ * @filter: Optional name, or name:id, of services
+ * @cb:     Called for each service, return non-zero to skip the rest
+ * @arg:    Argument to @cb
+ *
+ * All strings in the &struct finit_svc are only valid in @cb.  Cannot
+ * be mixed with pipelined requests still waiting for replies.
+ *
+ * Returns:
+ * 0 on success, or -1 on error.
+ */
+int finit_svc_dump(finit_conn_t *fc, int types, const char *filter,
+		   int (*cb)(const struct finit_svc *svc, void *arg), void *arg)
+{
+	struct init_request rq = {
+		.magic     = INIT_MAGIC,
+		.cmd       = INIT_CMD_SVC_DUMP,
+		.runlevel  = SVC_DUMP_BRIEF,
+		.sleeptime = types,
+	};
+	long long deadline = now() + FINIT_TIMEOUT;
+	struct svc_rec *rec = NULL;
+	const char **args = NULL;
+	size_t sz = 0, max = 0;
+	int done = 0, rc = -1;
+
+	if (do_check(fc))
+		return -1;
+
+	if (filter)
+		strncpy(rq.data, filter, sizeof(rq.data) - 1);
+
+	if (do_write(fc, &rq, deadline))
+		goto fail;
+
+	while (1) {
+		struct finit_svc svc;
+		ssize_t len;
+
+		len = do_read(fc, NULL, 0, MSG_PEEK | MSG_TRUNC, deadline);
+		if (len == -1)
+			goto fail;
+		if (len < (ssize_t)sizeof(*rec)) {
+			errno = len ? EBADMSG : ECONNRESET;
+			goto fail;
+		}
+
+		if ((size_t)len > sz) {
+			void *tmp;
+
+			tmp = realloc(rec, len);
+			if (!tmp)
+				goto fail;
+			rec = tmp;
+			sz  = len;
+		}
+
+		if (recv(fc->sd, rec, sz, MSG_DONTWAIT) != len || rec->len != (size_t)len) {
+			errno = EBADMSG;
+			goto fail;
+		}
+		if (rec->pid < 0)
+			break;
+
+		if (done)
+			continue;
+		if (unpack(rec, len, &svc, &args, &max))
+			goto fail;
+		done = cb(&svc, arg);
+	}
+	rc = 0;
+fail:
+	if (rc)
+		do_disconnect(fc);
+	free(args);
+	free(rec);
+
+	return rc;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,380 @@
+/* Socket activation, Finit binds sockets and starts service on demand
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"		/* Generated by configure script */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "listen.h"
+#include "log.h"
+#include "metrics.h"
+#include "private.h"
+#include "service.h"
+
+/*
+ * The sockets of a service are bound and listened to by Finit when the
+ * service is enabled and its conditions are satisfied.  The service is
+ * started at the first connection, or datagram, and inherits them using
+ * the sd_listen_fds(3) convention: LISTEN_FDS and LISTEN_PID, with the
+ * first socket as descriptor 3.  The sockets remain open in Finit, so
+ * no connections are lost when the service is restarted.
+ */
+struct listen {
+	svc_t   *svc;
+	int      num;
+	int      fd[LISTEN_MAX];
+	uev_t    watcher[LISTEN_MAX];
+};
+
+static int bind_unix(const char *path)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int sd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+
+	sd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd == -1)
+		return -1;
+
+	/* Stale socket from a previous instance of Finit or service */
+	(void)unlink(path);
+	if (bind(sd, (struct sockaddr *)&sun, sizeof(sun)) || listen(sd, SOMAXCONN)) {
+		close(sd);
+		return -1;
+	}
+	(void)chmod(path, 0666);
+
+	return sd;
+}
+
+/* [ADDR:]PORT, with IPv6 ADDR in brackets, e.g. [::1]:22 */
+static int bind_inet(char *spec, int type)
+{
+	struct addrinfo hints = {
+		.ai_flags    = AI_PASSIVE,
+		.ai_family   = AF_UNSPEC,
+		.ai_socktype = type,
+	};
+	struct addrinfo *ai;
+	char *addr = NULL;
+	char *port;
+	int sd, on = 1;
+	int rc;
+
+	port = strrchr(spec, ':');
+	if (port) {
+		*port++ = 0;
+		addr = spec;
+		if (addr[0] == '[') {
+			addr++;
+			addr[strcspn(addr, "]")] = 0;
+		}
+	} else
+		port = spec;
+
+	rc = getaddrinfo(addr, port, &hints, &ai);
+	if (rc) {
+		errno = rc == EAI_SYSTEM ? errno : EINVAL;
+		return -1;
+	}
+
+	sd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd == -1)
+		goto done;
+
+	setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(sd, ai->ai_addr, ai->ai_addrlen) ||
+	    (type == SOCK_STREAM && listen(sd, SOMAXCONN))) {
+		close(sd);
+		sd = -1;
+	}
+done:
+	freeaddrinfo(ai);
+	return sd;
+}
+
+/* tcp:[ADDR:]PORT, udp:[ADDR:]PORT, or unix:/path/to/sock */
+static int bind_one(char *spec)
+{
+	char *arg;
+
+	if (MATCH_CMD(spec, "tcp:", arg))
+		return bind_inet(arg, SOCK_STREAM);
+	if (MATCH_CMD(spec, "udp:", arg))
+		return bind_inet(arg, SOCK_DGRAM);
+	if (MATCH_CMD(spec, "unix:", arg))
+		return bind_unix(arg);
+
+	errno = EINVAL;
+	return -1;
+}
+
+static struct listen *listen_open(svc_t *svc)
+{
+	struct listen *l;
+	char *spec, *ptr;
+
+	l = calloc(1, sizeof(*l));
+	if (!l)
+		return NULL;
+	l->svc = svc;
+
+	spec = strdupa(svc->listen);
+	for (ptr = strtok(spec, ","); ptr && l->num < LISTEN_MAX; ptr = strtok(NULL, ",")) {
+		int sd;
+
+		/* bind_one() modifies its argument, keep ptr for errors */
+		sd = bind_one(strdupa(ptr));
+		if (sd == -1) {
+			logit(LOG_ERR, "%s: failed binding %s: %s", svc_ident(svc, NULL, 0), ptr, strerror(errno));
+			continue;
+		}
+
+		dbg("%s: listening on %s, fd %d", svc_ident(svc, NULL, 0), ptr, sd);
+		l->fd[l->num++] = sd;
+	}
+
+	if (!l->num) {
+		free(l);
+		return NULL;
+	}
+
+	return l;
+}
+
+static void listen_cb(uev_t *w, void *arg, int events)
+{
+	svc_t *svc = (svc_t *)arg;
+	PROBE("listen");
+
+	listen_stop(svc);
+	if (UEV_ERROR == events) {
+		logit(LOG_WARNING, "%s: error on socket, restarting listener", svc_ident(svc, NULL, 0));
+		listen_close(svc);
+		service_schedule(svc);
+		return;
+	}
+
+	dbg("%s: activated by fd %d", svc_ident(svc, NULL, 0), w->fd);
+	svc->activated = 1;
+	service_step(svc);
+}
+
+/**
+ * listen_start - Bind sockets of a service and wait for activity
+ * @svc: Service with listen:
+ *
+ * Sockets are bound the first time, then kept open until the service
+ * is removed, or its listen: option is changed at reload.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero if none of the sockets could be bound.
+ */
+int listen_start(svc_t *svc)
+{
+	struct listen *l = svc->sockets;
+	int i;
+
+	if (!l) {
+		l = listen_open(svc);
+		if (!l)
+			return 1;
+		svc->sockets = l;
+
+		for (i = 0; i < l->num; i++)
+			uev_io_init(ctx, &l->watcher[i], listen_cb, svc, l->fd[i], UEV_READ);
+		return 0;
+	}
+
+	for (i = 0; i < l->num; i++)
+		uev_io_start(&l->watcher[i]);
+
+	return 0;
+}
+
+/**
+ * listen_stop - Stop waiting for activity on the sockets of a service
+ * @svc: Service with listen:
+ *
+ * Called when the service is started, it takes over the sockets, or
+ * when the service is stopped or its conditions are no longer met.
+ */
+void listen_stop(svc_t *svc)
+{
+	struct listen *l = svc->sockets;
+	int i;
+
+	if (!l)
+		return;
+
+	for (i = 0; i < l->num; i++)
+		uev_io_stop(&l->watcher[i]);
+}
+
+/**
+ * listen_close - Close all sockets of a service
+ * @svc: Service with listen:
+ */
+void listen_close(svc_t *svc)
+{
+	struct listen *l = svc->sockets;
+	int i;
+
+	if (!l)
+		return;
+
+	listen_stop(svc);
+	for (i = 0; i < l->num; i++)
+		close(l->fd[i]);
+	free(l);
+
+	svc->sockets   = NULL;
+	svc->activated = 0;
+}
+
+/**
+ * listen_fds - Sockets of a service, for re-exec
+ * @svc: Service with listen:
+ * @fd:  Array of %LISTEN_MAX descriptors
+ *
+ * Returns:
+ * Number of sockets in @fd, zero if they are not bound yet.
+ */
+int listen_fds(svc_t *svc, int fd[])
+{
+	struct listen *l = svc->sockets;
+	int i;
+
+	if (!l)
+		return 0;
+
+	for (i = 0; i < l->num; i++)
+		fd[i] = l->fd[i];
+
+	return l->num;
+}
+
+/**
+ * listen_adopt - Take over sockets inherited from the previous finit
+ * @svc: Service with listen:
+ * @fd:  Array of sockets, from listen_fds() before re-exec
+ * @num: Number of sockets in @fd
+ *
+ * The sockets are not watched until listen_start(), i.e., when the
+ * service is waiting for its next activation.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on error, in which case the sockets are
+ * closed and bound again by listen_start().
+ */
+int listen_adopt(svc_t *svc, int fd[], int num)
+{
+	struct listen *l;
+	int i;
+
+	if (svc->sockets || num > LISTEN_MAX)
+		goto fail;
+
+	l = calloc(1, sizeof(*l));
+	if (!l)
+		goto fail;
+	l->svc = svc;
+
+	for (i = 0; i < num; i++) {
+		l->fd[i] = fd[i];
+		uev_io_init(ctx, &l->watcher[i], listen_cb, svc, fd[i], UEV_READ);
+		uev_io_stop(&l->watcher[i]);
+	}
+	l->num = num;
+	svc->sockets = l;
+
+	return 0;
+fail:
+	for (i = 0; i < num; i++)
+		close(fd[i]);
+	return 1;
+}
+
+/**
+ * listen_export - Hand over sockets to a service, in the child
+ * @svc: Service with listen:
+ *
+ * Moves the sockets to descriptor 3 and onwards, clearing close-on-exec,
+ * and sets LISTEN_FDS and LISTEN_PID for the service.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on error.
+ */
+int listen_export(svc_t *svc)
+{
+	struct listen *l = svc->sockets;
+	int fd[LISTEN_MAX];
+	char val[20];
+	int i;
+
+	if (!l)
+		return 0;
+
+	/* First move out of the way, target descriptors may be in use */
+	for (i = 0; i < l->num; i++) {
+		fd[i] = fcntl(l->fd[i], F_DUPFD, LISTEN_FDS_START + l->num);
+		if (fd[i] == -1)
+			return 1;
+	}
+
+	for (i = 0; i < l->num; i++) {
+		if (dup2(fd[i], LISTEN_FDS_START + i) == -1)
+			return 1;
+		close(fd[i]);
+	}
+
+	snprintf(val, sizeof(val), "%d", l->num);
+	setenv("LISTEN_FDS", val, 1);
+	snprintf(val, sizeof(val), "%d", getpid());
+	setenv("LISTEN_PID", val, 1);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -33,13 +33,26 @@
 #endif
 
 #include "finit.h"
+#include "conout.h"
 #include "helpers.h"
 #include "log.h"
+#include "timeline.h"
 #include "util.h"
 
 static int up       = 0;
 static int loglevel = LOG_INFO;
 
+/*
+ * Until syslogd is up, all log records of Finit are also kept in a ring
+ * buffer, including debug messages, which are not sent to /dev/kmsg.
+ * When syslogd comes up, records not already in the kernel log are
+ * replayed to syslog, with their original time since boot.  The ring
+ * is then kept as-is, for `initctl log --early`.
+ */
+static struct init_logrec ring[LOG_RING_MAX];
+static unsigned int       ring_cnt;
+static int                replayed;
+
 void log_init(void)
 {
 	if (debug)
@@ -73,6 +86,73 @@ static int log_open(void)
 	return up = 1;
 }
 
+static struct init_logrec *ring_add(int prio, const char *fmt, va_list ap)
+{
+	struct init_logrec *rec = &ring[ring_cnt++ % LOG_RING_MAX];
+
+	rec->msec = timeline_now();
+	rec->prio = prio;
+	rec->kmsg = 0;
+	vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+
+	return rec;
+}
+
+static void ring_replay(void)
+{
+	unsigned int i = 0;
+
+	if (replayed)
+		return;
+	replayed = 1;
+
+	if (ring_cnt > LOG_RING_MAX) {
+		syslog(LOG_NOTICE, "%u early log messages lost, see initctl log --early",
+		       ring_cnt - LOG_RING_MAX);
+		i = ring_cnt - LOG_RING_MAX;
+	}
+
+	for (; i < ring_cnt; i++) {
+		struct init_logrec *rec = &ring[i % LOG_RING_MAX];
+
+		if (rec->kmsg)
+			continue;
+
+		syslog(rec->prio, "[%5lld.%03lld] %s", (long long)rec->msec / 1000,
+		       (long long)rec->msec % 1000, rec->msg);
+	}
+}
+
+/**
+ * log_early - Log records of Finit from before syslogd was up
+ * @num:  Number of records returned
+ * @lost: Number of records overwritten, ring was full
+ *
+ * Returns:
+ * Array of &struct init_logrec, oldest first, to be freed by the caller,
+ * or %NULL on error.
+ */
+void *log_early(int *num, int *lost)
+{
+	struct init_logrec *buf;
+	unsigned int first = 0;
+	int i;
+
+	*num  = ring_cnt < LOG_RING_MAX ? ring_cnt : LOG_RING_MAX;
+	*lost = ring_cnt - *num;
+	if (ring_cnt > LOG_RING_MAX)
+		first = ring_cnt - LOG_RING_MAX;
+
+	buf = calloc(*num + 1, sizeof(*buf));
+	if (!buf)
+		return NULL;
+
+	for (i = 0; i < *num; i++)
+		buf[i] = ring[(first + i) % LOG_RING_MAX];
+
+	return buf;
+}
+
 static void log_close(void)
 {
 	closelog();
@@ -112,18 +192,26 @@ static const char *l2s(int prio)
  */
 void logit(int prio, const char *fmt, ...)
 {
+	struct init_logrec *rec;
 	va_list ap;
 	FILE *fp;
 
 	va_start(ap, fmt);
 
 	if (up || log_open()) {
+		ring_replay();
 		vsyslog(prio, fmt, ap);
 		goto done;
 	}
 
-	if (LOG_PRI(prio) > loglevel)
+	rec = ring_add(prio, fmt, ap);
+	va_end(ap);
+	va_start(ap, fmt);
+
+	/* Debug messages only in the ring, see ring_replay() */
+	if (LOG_PRI(prio) > loglevel || LOG_PRI(prio) == LOG_DEBUG)
 		goto done;
+	rec->kmsg = 1;
 
 	if (in_container() || !(fp = fopen("/dev/kmsg", "w"))) {
 		static char buf[512];
@@ -135,7 +223,7 @@ void logit(int prio, const char *fmt, ...)
 		pos += snprintf(&buf[pos], sizeof(buf) - pos, " [%s]: ", l2s(prio));
 		vsnprintf(&buf[pos], sizeof(buf) - pos, fmt, ap);
 		strlcat(buf, "\n", sizeof(buf));
-		fputs(buf, stderr);
+		conout_write(buf, strlen(buf));
 		goto done;
 	}
 
@@ -144,10 +232,18 @@ void logit(int prio, const char *fmt, ...)
 	fclose(fp);
 
 	if (debug) {
+		char buf[512];
+		int len;
+
 		va_end(ap);
 		va_start(ap, fmt);
-		vfprintf(stderr, fmt, ap);
-		fputs("\n", stderr);
+		len = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+		if (len >= (int)sizeof(buf) - 1)
+			len = sizeof(buf) - 2;
+		if (len >= 0) {
+			buf[len++] = '\n';
+			conout_write(buf, len);
+		}
 	}
 
 done:
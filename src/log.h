@@ -31,13 +31,13 @@
 #define LOG_CONSOLE  (14<<3)
 #endif
 
+extern int debug;
+
 #ifndef __FINIT__
 #include <err.h>
 #include <stdarg.h>
 #include <stdio.h>
 
-extern int debug;
-
 static __attribute__ ((format (printf, 1, 2))) inline void dbg(char *fmt, ...)
 {
 	va_list ap;
@@ -55,9 +55,10 @@ static __attribute__ ((format (printf, 1, 2))) inline void dbg(char *fmt, ...)
 #else
 /*
  * General log macros, similar to those used by initctl.  Initially intended
- * only for bridging client.c in Finit and initctl.
+ * only for bridging client.c in Finit and initctl.  Arguments to dbg() are
+ * only evaluated in debug mode, they are often expensive, e.g. svc_ident().
  */
-#define dbg(fmt, args...)      logit(LOG_DEBUG,   "%s():" fmt, __func__, ##args)
+#define dbg(fmt, args...)      do { if (debug) logit(LOG_DEBUG, "%s():" fmt, __func__, ##args); } while (0)
 #define info(fmt, args...)     logit(LOG_INFO,    "%s():" fmt, __func__, ##args)
 #define note(fmt, args...)     logit(LOG_NOTICE,  "%s():" fmt, __func__, ##args)
 #define warnx(fmt, args...)    logit(LOG_WARNING, "%s():" fmt, __func__, ##args)
@@ -69,15 +70,18 @@ static __attribute__ ((format (printf, 1, 2))) inline void dbg(char *fmt, ...)
  * DEPRECATED developer error and debug messages, please migrate to above!
  * Will be removed without further warning in a future Finit release.
  */
-#define  _d(fmt, args...) logit(LOG_DEBUG,   "%s():" fmt, __func__, ##args)
+#define  _d(fmt, args...) dbg(fmt, ##args)
 #define  _w(fmt, args...) logit(LOG_WARNING, "%s():" fmt, __func__, ##args)
 #define  _e(fmt, args...) logit(LOG_ERR,     "%s():" fmt, __func__, ##args)
 #define _pe(fmt, args...) logit(LOG_ERR,     "%s():" fmt ": %s", __func__, ##args, strerror(errno))
 
+#define LOG_RING_MAX 256	/* Early log records kept, see log_early() */
+
 void    log_init (void);
 void    log_exit (void);
 
 void    log_debug(void);
+void   *log_early(int *num, int *lost);
 
 void    logit    (int prio, const char *fmt, ...)   __attribute__ ((format (printf, 2, 3)));
 void    flog     (char *file, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
@@ -0,0 +1,563 @@
+/* Built-in log multiplexer for services with the log option
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"		/* Generated by configure script */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define SYSLOG_NAMES
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "finit.h"
+#include "conf.h"
+#include "helpers.h"
+#include "log.h"
+#include "logger.h"
+#include "metrics.h"
+
+#define LOGGER_BUFSZ 1024
+
+extern int logrotate(char *file, int num, off_t sz);
+
+/*
+ * Read end of the stdout/stderr pipe of a service.  All settings are
+ * copied from the svc_t since the logger outlives the process when it
+ * has forked off children that still hold the write end.
+ */
+struct logger {
+	LIST_ENTRY(logger) link;
+	uev_t  watcher;
+	int    wfd;			/* write end, until logger_start() */
+	pid_t  pid;
+	int    pri;			/* facility | level */
+	char   tag[MAX_IDENT_LEN];
+	char   file[sizeof(((svc_t *)0)->log.file)];
+
+	int    job;			/* Service, for svc->log_suppressed */
+	char   id[MAX_ID_LEN];
+	int    rate;			/* lines/sec, 0: unlimited */
+	int    burst;			/* lines */
+	long long tokens;		/* 1/1000 lines, token bucket */
+	long long last;			/* msec, last refill */
+	unsigned long long dropped;	/* lines since last summary */
+
+	size_t len;
+	char   buf[LOGGER_BUFSZ];
+};
+
+int logger_builtin;
+
+static LIST_HEAD(, logger) loggers = LIST_HEAD_INITIALIZER(loggers);
+static int sd = -1;		/* syslog socket, shared by all loggers */
+
+static int parse_code(CODE *names, const char *name, int def)
+{
+	for (int i = 0; names[i].c_name; i++) {
+		if (!strcmp(names[i].c_name, name))
+			return names[i].c_val;
+	}
+
+	return def;
+}
+
+/* facility.level, or only level, like logger(1) */
+static int parse_prio(const char *arg)
+{
+	int facility = LOG_DAEMON, level = LOG_INFO;
+	char buf[sizeof(((svc_t *)0)->log.prio)];
+	char *ptr;
+
+	strlcpy(buf, arg, sizeof(buf));
+	ptr = strchr(buf, '.');
+	if (ptr) {
+		*ptr++ = 0;
+		facility = parse_code(facilitynames, buf, facility);
+		level    = parse_code(prioritynames, ptr, level);
+	} else
+		level    = parse_code(prioritynames, buf, level);
+
+	return facility | level;
+}
+
+static int syslog_connect(void)
+{
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+		.sun_path   = _PATH_LOG,
+	};
+
+	if (sd != -1)
+		return 0;
+
+	sd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd == -1)
+		return -1;
+
+	if (connect(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		close(sd);
+		sd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Same format as syslog(3), one datagram per line.  Lines are dropped
+ * if syslogd is not running yet, or its socket buffer is full.
+ */
+static void syslog_send(struct logger *lg, char *line, size_t len)
+{
+	char hdr[64 + sizeof(lg->tag)];
+	struct iovec iov[2];
+	struct msghdr msg = {
+		.msg_iov    = iov,
+		.msg_iovlen = NELEMS(iov),
+	};
+	struct tm tm;
+	time_t now;
+	int hlen;
+
+	if (syslog_connect())
+		return;
+
+	now = time(NULL);
+	localtime_r(&now, &tm);
+	hlen  = snprintf(hdr, sizeof(hdr), "<%d>", lg->pri);
+	hlen += strftime(&hdr[hlen], sizeof(hdr) - hlen, "%h %e %T ", &tm);
+	hlen += snprintf(&hdr[hlen], sizeof(hdr) - hlen, "%s[%d]: ", lg->tag, lg->pid);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len  = hlen;
+	iov[1].iov_base = line;
+	iov[1].iov_len  = len;
+
+	if (sendmsg(sd, &msg, MSG_NOSIGNAL) == -1 && errno != EAGAIN) {
+		/* syslogd restarted, reconnect on next line */
+		close(sd);
+		sd = -1;
+	}
+}
+
+/*
+ * All complete lines of a batch are written to the file at once, the
+ * file is rotated according to the global log setting.
+ */
+static void file_write(struct logger *lg, char *lines, size_t len)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(lg->file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | O_NOCTTY, 0644);
+	if (fd == -1) {
+		dbg("Failed opening %s: %s", lg->file, strerror(errno));
+		return;
+	}
+
+	if (write(fd, lines, len) != (ssize_t)len)
+		dbg("Failed writing to %s: %s", lg->file, strerror(errno));
+
+	if (logfile_size_max > 0 && !fstat(fd, &st) && st.st_size > logfile_size_max) {
+		close(fd);
+		logrotate(lg->file, logfile_count_max, logfile_size_max);
+		return;
+	}
+
+	close(fd);
+}
+
+static long long now_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Token bucket of log:rate=N/s,burst=M, refilled with N lines per
+ * second up to M lines.  Returns 0 if the line should be dropped.
+ */
+static int allow(struct logger *lg)
+{
+	long long now;
+
+	if (!lg->rate)
+		return 1;
+
+	now = now_msec();
+	lg->tokens += (now - lg->last) * lg->rate;
+	lg->last = now;
+	if (lg->tokens > (long long)lg->burst * 1000)
+		lg->tokens = (long long)lg->burst * 1000;
+
+	if (lg->tokens < 1000) {
+		lg->dropped++;
+		return 0;
+	}
+	lg->tokens -= 1000;
+
+	return 1;
+}
+
+/* Log how many lines were dropped, before the next line that is not */
+static void summary(struct logger *lg)
+{
+	char msg[64];
+	int len;
+
+	if (!lg->dropped)
+		return;
+
+	len = snprintf(msg, sizeof(msg), "suppressed %llu messages\n", lg->dropped);
+	if (lg->file[0])
+		file_write(lg, msg, len);
+	else
+		syslog_send(lg, msg, len - 1);
+	lg->dropped = 0;
+}
+
+/* Add dropped lines to the service, for initctl status */
+static void account(struct logger *lg, unsigned long long num)
+{
+	svc_t *svc;
+
+	if (!num)
+		return;
+
+	svc = svc_find_by_jobid(lg->job, lg->id);
+	if (svc)
+		svc->log_suppressed += num;
+}
+
+/*
+ * Handle all complete lines in buffer, or everything on EOF or when the
+ * buffer is full.  Returns number of bytes consumed.
+ */
+static size_t flush(struct logger *lg, int eof)
+{
+	size_t len = lg->len, pos = 0, out = 0;
+	unsigned long long dropped = 0;
+	char *nl;
+
+	if (!eof) {
+		nl = memrchr(lg->buf, '\n', len);
+		if (nl)
+			len = nl - lg->buf + 1;
+		else if (len < sizeof(lg->buf))
+			return 0;
+	}
+
+	if (lg->file[0] && !lg->rate) {
+		file_write(lg, lg->buf, len);
+		return len;
+	}
+
+	while (pos < len) {
+		char *line = &lg->buf[pos];
+		size_t num;
+
+		nl = memchr(line, '\n', len - pos);
+		num = nl ? (size_t)(nl - line) : len - pos;
+		pos += num + (nl ? 1 : 0);
+
+		if (lg->file[0]) {
+			if (!allow(lg)) {
+				dropped++;
+				continue;
+			}
+			if (lg->dropped) {
+				if (out)
+					file_write(lg, lg->buf, out);
+				out = 0;
+				summary(lg);
+			}
+
+			/* Compact lines to write at start of buffer */
+			num = &lg->buf[pos] - line;
+			memmove(&lg->buf[out], line, num);
+			out += num;
+			continue;
+		}
+
+		if (num > 0 && line[num - 1] == '\r')
+			num--;
+		if (num == 0)
+			continue;
+
+		if (!allow(lg)) {
+			dropped++;
+			continue;
+		}
+		summary(lg);
+		syslog_send(lg, line, num);
+	}
+
+	if (out)
+		file_write(lg, lg->buf, out);
+	if (eof)
+		summary(lg);
+	account(lg, dropped);
+
+	return len;
+}
+
+static void logger_free(struct logger *lg)
+{
+	LIST_REMOVE(lg, link);
+	uev_io_stop(&lg->watcher);
+	close(lg->watcher.fd);
+	free(lg);
+}
+
+static void logger_cb(uev_t *w, void *arg, int events)
+{
+	struct logger *lg = arg;
+	size_t pos;
+	ssize_t num;
+	PROBE("logger");
+
+	if (UEV_ERROR == events) {
+		logger_free(lg);
+		return;
+	}
+
+	num = read(w->fd, &lg->buf[lg->len], sizeof(lg->buf) - lg->len);
+	if (num <= 0) {
+		if (num == -1 && (errno == EAGAIN || errno == EINTR))
+			return;
+
+		/* All writers have exited */
+		flush(lg, 1);
+		logger_free(lg);
+		return;
+	}
+
+	lg->len += num;
+	pos = flush(lg, 0);
+	if (pos > 0) {
+		lg->len -= pos;
+		memmove(lg->buf, &lg->buf[pos], lg->len);
+	}
+}
+
+/**
+ * logger_open - Create built-in logger for a service
+ * @svc: Service with log enabled
+ * @fd:  Pointer to write end of pipe, for redirect() in the child
+ *
+ * Called before forking off the service, the write end is passed to the
+ * child and the read end stays in Finit, see logger_start().
+ *
+ * Returns:
+ * A logger, or %NULL if the built-in logger is not enabled, not used
+ * by @svc, or on error.
+ */
+struct logger *logger_open(svc_t *svc, int *fd)
+{
+	struct logger *lg;
+	int pfd[2];
+
+	*fd = -1;
+	if (!logger_builtin || !svc->log.enabled || svc->log.null || svc->log.console)
+		return NULL;
+
+	lg = calloc(1, sizeof(*lg));
+	if (!lg)
+		return NULL;
+
+	if (pipe2(pfd, O_CLOEXEC)) {
+		free(lg);
+		return NULL;
+	}
+
+	if (uev_io_init(ctx, &lg->watcher, logger_cb, lg, pfd[0], UEV_READ)) {
+		close(pfd[0]);
+		close(pfd[1]);
+		free(lg);
+		return NULL;
+	}
+	/* Wait for logger_start(), the child may not exec() before that */
+	uev_io_stop(&lg->watcher);
+	fcntl(pfd[0], F_SETFL, O_NONBLOCK);
+
+	if (svc->log.file[0] == '/')
+		strlcpy(lg->file, svc->log.file, sizeof(lg->file));
+	if (svc->log.ident[0])
+		strlcpy(lg->tag, svc->log.ident, sizeof(lg->tag));
+	else
+		svc_ident(svc, lg->tag, sizeof(lg->tag));
+	lg->pri = parse_prio(svc->log.prio[0] ? svc->log.prio : "daemon.info");
+	lg->job = svc->job;
+	strlcpy(lg->id, svc->id, sizeof(lg->id));
+	if (svc->log.rate > 0) {
+		lg->rate   = svc->log.rate;
+		lg->burst  = svc->log.burst > 0 ? svc->log.burst : svc->log.rate;
+		lg->tokens = (long long)lg->burst * 1000;
+		lg->last   = now_msec();
+	}
+	lg->wfd = pfd[1];
+	*fd = pfd[1];
+	LIST_INSERT_HEAD(&loggers, lg, link);
+
+	return lg;
+}
+
+/**
+ * logger_start - Start logging output of a service
+ * @lg:  Logger from logger_open()
+ * @pid: PID of service, or -1 if fork() failed
+ *
+ * Called in the parent after fork(), closes the write end of the pipe
+ * and starts reading output of the service.
+ */
+void logger_start(struct logger *lg, pid_t pid)
+{
+	if (!lg)
+		return;
+
+	close(lg->wfd);
+	lg->wfd = -1;
+
+	if (pid <= 0) {
+		logger_free(lg);
+		return;
+	}
+
+	lg->pid = pid;
+	uev_io_start(&lg->watcher);
+}
+
+/**
+ * logger_save - Save state of all running loggers, for re-exec
+ * @recs: Pointer to array of records, allocated, free() after use
+ *
+ * Any partial line in the buffer of a logger is flushed.  The read end
+ * of the pipe, in @recs, is inherited by the new finit.
+ *
+ * Returns:
+ * Number of records in @recs, or -1 on error.
+ */
+int logger_save(struct logger_rec **recs)
+{
+	struct logger *lg;
+	int num = 0;
+
+	LIST_FOREACH(lg, &loggers, link)
+		num++;
+
+	*recs = calloc(num ?: 1, sizeof(**recs));
+	if (!*recs)
+		return -1;
+
+	num = 0;
+	LIST_FOREACH(lg, &loggers, link) {
+		struct logger_rec *rec = &(*recs)[num];
+
+		if (lg->wfd != -1)
+			continue;	/* not started yet */
+
+		if (lg->len) {
+			flush(lg, 1);
+			lg->len = 0;
+		}
+
+		rec->fd    = lg->watcher.fd;
+		rec->pid   = lg->pid;
+		rec->pri   = lg->pri;
+		rec->rate  = lg->rate;
+		rec->burst = lg->burst;
+		strlcpy(rec->tag, lg->tag, sizeof(rec->tag));
+		strlcpy(rec->file, lg->file, sizeof(rec->file));
+		num++;
+	}
+
+	return num;
+}
+
+/**
+ * logger_restore - Adopt logger of the previous finit, after re-exec
+ * @rec: Record from logger_save()
+ *
+ * Called after the services have been restored, the logger is tied to
+ * the service with the same PID, if it is still running.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on error, in which case the pipe is closed.
+ */
+int logger_restore(struct logger_rec *rec)
+{
+	struct logger *lg;
+	svc_t *svc;
+
+	lg = calloc(1, sizeof(*lg));
+	if (!lg)
+		goto fail;
+
+	if (uev_io_init(ctx, &lg->watcher, logger_cb, lg, rec->fd, UEV_READ)) {
+		free(lg);
+		goto fail;
+	}
+
+	lg->wfd   = -1;
+	lg->pid   = rec->pid;
+	lg->pri   = rec->pri;
+	lg->job   = -1;
+	strlcpy(lg->tag, rec->tag, sizeof(lg->tag));
+	strlcpy(lg->file, rec->file, sizeof(lg->file));
+	if (rec->rate > 0) {
+		lg->rate   = rec->rate;
+		lg->burst  = rec->burst;
+		lg->tokens = (long long)lg->burst * 1000;
+		lg->last   = now_msec();
+	}
+
+	svc = svc_find_by_pid(rec->pid);
+	if (svc) {
+		lg->job = svc->job;
+		strlcpy(lg->id, svc->id, sizeof(lg->id));
+	}
+	LIST_INSERT_HEAD(&loggers, lg, link);
+
+	return 0;
+fail:
+	close(rec->fd);
+	return 1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,57 @@
+/* Built-in log multiplexer for services with the log option
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_LOGGER_H_
+#define FINIT_LOGGER_H_
+
+#include "svc.h"
+
+struct logger;
+
+/* Running logger, handed over to the new finit at re-exec */
+struct logger_rec {
+	int32_t fd;			/* read end of pipe */
+	int32_t pid;
+	int32_t pri;
+	int32_t rate;
+	int32_t burst;
+	char    tag[MAX_IDENT_LEN];
+	char    file[sizeof(((svc_t *)0)->log.file)];
+};
+
+extern int logger_builtin;
+
+struct logger *logger_open    (svc_t *svc, int *fd);
+void           logger_start   (struct logger *lg, pid_t pid);
+
+int            logger_save    (struct logger_rec **recs);
+int            logger_restore (struct logger_rec *rec);
+
+#endif /* FINIT_LOGGER_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -22,12 +22,16 @@
 
 #include <config.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #define SYSLOG_NAMES
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #ifdef _LIBITE_LITE
@@ -40,51 +44,189 @@ static const char version_info[] = PACKAGE_NAME " v" PACKAGE_VERSION;
 extern int logrotate(char *file, int num, off_t sz);
 
 
-static int checksz(FILE *fp, off_t sz)
+/*
+ * Output is written to the log file in batches, when the buffer is
+ * almost full or LOGIT_FLUSH msec after the first unwritten byte, so
+ * a busy service does not stall on one write() and fsync() per line.
+ * The file size is tracked here, instead of calling fstat() per line.
+ */
+#define LOGIT_BUFSZ   16384
+#define LOGIT_FLUSH   1000	/* msec */
+
+struct wbuf {
+	char       *file;
+	int         num;		/* rotated files to keep */
+	off_t       sz;			/* rotate at this size */
+	int         fd;
+	off_t       pos;		/* current size of file */
+	long long   due;		/* flush deadline, msec */
+	size_t      len;
+	char        buf[LOGIT_BUFSZ];
+};
+
+static volatile sig_atomic_t stop;
+
+/* Killed when the service stops, write what we have before exiting */
+static void sigterm(int signo)
 {
-	struct stat st;
+	(void)signo;
+	stop = 1;
+}
 
-	if (sz <= 0)
-		return 0;
+static long long now_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	if (!fstat(fileno(fp), &st) && st.st_size > sz) {
-		fclose(fp);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int wopen(struct wbuf *w)
+{
+	struct stat st;
+
+	w->fd = open(w->file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | O_NOCTTY, 0644);
+	if (w->fd == -1) {
+		syslog(LOG_ERR | LOG_PERROR, "Failed opening %s: %s", w->file, strerror(errno));
 		return 1;
 	}
 
+	w->pos = 0;
+	if (!fstat(w->fd, &st))
+		w->pos = st.st_size;
+
+	return 0;
+}
+
+/*
+ * Write buffered lines, all of the buffer if @all is set, or when there
+ * is no complete line in a full buffer.  The file is rotated when it is
+ * past its max size, always at a line boundary unless @all is set.
+ */
+static int wflush(struct wbuf *w, int all)
+{
+	size_t len = w->len, pos = 0;
+	char *nl;
+
+	if (!all) {
+		nl = memrchr(w->buf, '\n', len);
+		if (nl)
+			len = nl - w->buf + 1;
+		else if (len < sizeof(w->buf))
+			return 0;
+	}
+
+	while (pos < len) {
+		ssize_t num;
+
+		num = write(w->fd, &w->buf[pos], len - pos);
+		if (num == -1) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "Failed writing %s: %s", w->file, strerror(errno));
+			break;
+		}
+		pos += num;
+	}
+
+	w->pos += len;
+	w->len -= len;
+	memmove(w->buf, &w->buf[len], w->len);
+	w->due = w->len ? now_msec() + LOGIT_FLUSH : 0;
+
+	if (w->sz > 0 && w->pos > w->sz) {
+		close(w->fd);
+		logrotate(w->file, w->num, w->sz);
+		return wopen(w);
+	}
+
 	return 0;
 }
 
-static int flogit(char *logfile, int num, off_t sz, char *buf, size_t len)
+static int wclose(struct wbuf *w)
 {
-	FILE *fp;
+	if (w->len)
+		wflush(w, 1);
+	fsync(w->fd);
+
+	return close(w->fd);
+}
 
-reopen:
-	fp = fopen(logfile, "a");
-	if (!fp) {
-		syslog(LOG_ERR | LOG_PERROR, "Failed opening %s: %s", logfile, strerror(errno));
+static int flogit(char *logfile, int num, off_t sz, char *msg)
+{
+	struct sigaction sa = { 0 };
+	struct wbuf *w;
+	int rc;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return 1;
+
+	w->file = logfile;
+	w->num  = num;
+	w->sz   = sz;
+	if (wopen(w)) {
+		free(w);
 		return 1;
 	}
 
-	if (buf[0]) {
-		fprintf(fp, "%s\n", buf);
-		fsync(fileno(fp));
-		if (checksz(fp, sz))
-			return logrotate(logfile, num, sz);
-	} else {
-		while ((fgets(buf, len, stdin))) {
-			fputs(buf, fp);
-			fsync(fileno(fp));
-
-			if (checksz(fp, sz)) {
-				logrotate(logfile, num, sz);
-				buf[0] = 0;
-				goto reopen;
-			}
+	if (msg[0]) {
+		w->len = snprintf(w->buf, sizeof(w->buf), "%s\n", msg);
+		goto done;
+	}
+
+	sa.sa_handler = sigterm;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	while (1) {
+		struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+		int timeout = -1;
+		ssize_t len;
+
+		if (w->due) {
+			timeout = (int)(w->due - now_msec());
+			if (timeout < 0)
+				timeout = 0;
+		}
+		if (stop)
+			timeout = 0;	/* read what is left, then exit */
+
+		rc = poll(&pfd, 1, timeout);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (rc == 0) {
+			if (stop)
+				break;
+			wflush(w, 1);
+			continue;
+		}
+
+		len = read(STDIN_FILENO, &w->buf[w->len], sizeof(w->buf) - w->len);
+		if (len <= 0) {
+			if (len == -1 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			break;	/* EOF, all writers have exited */
 		}
+
+		if (!w->len)
+			w->due = now_msec() + LOGIT_FLUSH;
+		w->len += len;
+
+		if (w->len >= sizeof(w->buf) * 3 / 4)
+			wflush(w, 0);
 	}
+done:
+	rc = wclose(w);
+	free(w);
 
-	return fclose(fp);
+	return rc;
 }
 
 static int logit(int level, char *buf, size_t len)
@@ -231,7 +373,7 @@ int main(int argc, char *argv[])
 	openlog(ident, log_opts, facility);
 
 	if (logfile)
-		rc = flogit(logfile, num, size, buf, sizeof(buf));
+		rc = flogit(logfile, num, size, buf);
 	else
 		rc = logit(level, buf, sizeof(buf));
 
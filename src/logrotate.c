@@ -20,11 +20,20 @@
  * THE SOFTWARE.
  */
 
+#include "config.h"		/* Generated by configure script */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 #else
@@ -41,11 +50,104 @@ static int recreate(char *path, mode_t mode, uid_t uid, gid_t gid)
 	return 0;
 }
 
+#ifdef HAVE_ZLIB
+/*
+ * Compress @file to @file.gz, via a temporary file.  If @file has been
+ * rotated again while we were busy, it is left as-is, uncompressed, it
+ * is no longer the file we read.
+ */
+static int gzip_file(char *file)
+{
+	size_t len = strlen(file) + 10 + 1;
+	char   gzfile[len], tmp[len];
+	struct stat st, now;
+	char   buf[BUFSIZ];
+	ssize_t num;
+	gzFile gz;
+	int    fd;
+
+	snprintf(gzfile, len, "%s.gz", file);
+	snprintf(tmp, len, "%s.gz~", file);
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st))
+		return 1;
+
+	gz = gzopen(tmp, "wb");
+	if (!gz) {
+		close(fd);
+		return 1;
+	}
+
+	while ((num = read(fd, buf, sizeof(buf))) > 0) {
+		if (gzwrite(gz, buf, num) != num) {
+			num = -1;
+			break;
+		}
+	}
+	close(fd);
+
+	if (gzclose(gz) != Z_OK || num < 0)
+		goto fail;
+
+	if (stat(file, &now) || now.st_ino != st.st_ino || now.st_dev != st.st_dev)
+		goto fail;
+
+	chmod(tmp, st.st_mode & 0777);
+	if (chown(tmp, st.st_uid, st.st_gid) || rename(tmp, gzfile))
+		goto fail;
+
+	return remove(file);
+fail:
+	(void)remove(tmp);
+	return 1;
+}
+#else
+static int gzip_file(char *file)
+{
+	return execlp("gzip", "gzip", "-f", file, NULL);
+}
+#endif
+
+/*
+ * Compression is done in a grandchild, reparented to PID 1 or the
+ * nearest subreaper, so the caller can go on writing to the new log
+ * file, and does not have to reap it.  Only the intermediate child,
+ * which exits right away, is collected here.
+ */
+static void compress_bg(char *file)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1) {
+		syslog(LOG_ERR, "Failed compressing %s: %s", file, strerror(errno));
+		return;
+	}
+
+	if (!pid) {
+		sigset_t nmask;
+
+		sigemptyset(&nmask);
+		sigprocmask(SIG_SETMASK, &nmask, NULL);
+		if (fork())
+			_exit(0);
+
+		_exit(gzip_file(file) ? 1 : 0);
+	}
+
+	while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+		;
+}
+
 /*
  * This function triggers a log rotates of @file when size >= @sz bytes
  * At most @num old versions are kept and by default it starts gzipping
  * .2 and older log files.  If gzip is not available in $PATH then @num
  * files are kept uncompressed.
+ *
+ * Only files are renamed here, compressing the .2 file is done in the
+ * background, see compress_bg(), with zlib when Finit is built with it.
  */
 int logrotate(char *file, int num, off_t sz)
 {
@@ -59,6 +161,7 @@ int logrotate(char *file, int num, off_t sz)
 			size_t len = strlen(file) + 10 + 1;
 			char   ofile[len];
 			char   nfile[len];
+			char   zfile[len];
 			int    cnt;
 
 			/* First age zipped log files */
@@ -72,6 +175,7 @@ int logrotate(char *file, int num, off_t sz)
 					       ofile, strerror(errno));
 			}
 
+			zfile[0] = 0;
 			for (cnt = num; cnt > 0; cnt--) {
 				snprintf(ofile, len, "%s.%d", file, cnt - 1);
 				snprintf(nfile, len, "%s.%d", file, cnt);
@@ -83,17 +187,16 @@ int logrotate(char *file, int num, off_t sz)
 					continue;
 				}
 
-				if (cnt == 2 && fexist(nfile)) {
-					if (systemf("gzip %s 2>/dev/null", nfile))
-						continue; /* no gzip, probably */
-
-					(void)remove(nfile);
-				}
+				if (cnt == 2 && fexist(nfile))
+					strlcpy(zfile, nfile, len);
 			}
 
 			if (rename(file, nfile))
 				goto fallback;
 			recreate(file, st.st_mode, st.st_uid, st.st_gid);
+
+			if (zfile[0])
+				compress_bg(zfile);
 		} else {
 		fallback:
 			if (truncate(file, 0))
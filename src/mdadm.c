@@ -25,8 +25,11 @@
 
 #include <glob.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 
+#include "cond.h"
 #include "helpers.h"
 #include "util.h"
 
@@ -42,6 +45,52 @@ static glob_t *get_arrays(void)
 	return NULL;
 }
 
+static void md_clean(void *arg, int status)
+{
+	char *array = arg;
+
+	if (status != -1 && WIFEXITED(status) && !WEXITSTATUS(status)) {
+		char cond[strlen(array) + 16];
+
+		snprintf(cond, sizeof(cond), "sys/md/%s/clean", array);
+		cond_set_oneshot(cond);
+	} else
+		logit(LOG_WARNING, "MD array %s not clean, mdadm status %d", array, status);
+
+	free(array);
+}
+
+/*
+ * At boot, wait for each MD array to be clean in the background.  A
+ * resync may take hours, so this must not hold up the rest of the boot.
+ * Services that need a clean array can depend on <sys/md/ARRAY/clean>.
+ */
+void mdadm_start(void)
+{
+	glob_t *gl;
+	size_t i;
+
+	if (!whichp("mdadm"))
+		return;
+
+	gl = get_arrays();
+	if (!gl)
+		return;
+
+	for (i = 0; i < gl->gl_pathc; i++) {
+		char cmd[160], *array;
+
+		array = strdup(basenm(gl->gl_pathv[i]));
+		if (!array)
+			break;
+
+		snprintf(cmd, sizeof(cmd), "mdadm --wait-clean /dev/%s", array);
+		if (run_async(cmd, "mdadm", md_clean, array) == -1)
+			free(array);
+	}
+	globfree(gl);
+}
+
 /*
  * If system has an MD raid, we must tell it to stop before continuing
  * with the shutdown.  Some controller cards, in particular the Intel(R)
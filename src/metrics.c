@@ -0,0 +1,381 @@
+/* Counters and latency histograms of Finit, in OpenMetrics text format
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Everything here is updated in place, from the hot paths, so it must
+ * stay cheap: counters and fixed bucket histograms only.  The text is
+ * generated on request, see INIT_CMD_GET_METRICS and initctl metrics.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <lite/lite.h>
+
+#include "footprint.h"
+#include "metrics.h"
+#include "timeline.h"
+
+struct metrics metrics;
+
+/* Upper bounds of histogram buckets, msec, last bucket is +Inf */
+static const long long bounds[METRICS_BUCKETS - 1] = {
+	1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000
+};
+
+static const char *states[] = {
+	[SVC_HALTED_STATE]   = "halted",
+	[SVC_DONE_STATE]     = "done",
+	[SVC_STOPPING_STATE] = "stopping",
+	[SVC_CLEANUP_STATE]  = "cleanup",
+	[SVC_SETUP_STATE]    = "setup",
+	[SVC_PAUSED_STATE]   = "paused",
+	[SVC_WAITING_STATE]  = "waiting",
+	[SVC_STARTING_STATE] = "starting",
+	[SVC_RUNNING_STATE]  = "running",
+};
+
+#ifdef LATENCY_PROBES
+/* Upper bounds of probe buckets, usec, last bucket is +Inf */
+static const long long probe_bounds[PROBE_BUCKETS - 1] = {
+	10, 100, 1000, 10000, 100000, 1000000
+};
+
+static struct probe *probes;
+static struct probe *stall;	/* Probe with the longest call */
+
+static long long usec(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * probe_get - Find, or create, a named probe
+ * @name: Callback name, e.g. "api", or "hook/basefs-up/netlink"
+ *
+ * Probes are never freed, use a fixed set of names.
+ *
+ * Returns:
+ * Probe, or %NULL if out of memory, which disables timing.
+ */
+struct probe *probe_get(const char *name)
+{
+	struct probe *p;
+
+	for (p = probes; p; p = p->next) {
+		if (!strcmp(p->name, name))
+			return p;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	p->name = strdup(name);
+	if (!p->name) {
+		free(p);
+		return NULL;
+	}
+
+	p->next = probes;
+	probes  = p;
+
+	return p;
+}
+
+/* Use PROBE() or PROBE_AT() instead */
+struct probe_ctx probe_begin(struct probe *p)
+{
+	struct probe_ctx ctx = { .probe = p };
+
+	if (p) {
+		ctx.wall = usec(CLOCK_MONOTONIC);
+		ctx.cpu  = usec(CLOCK_PROCESS_CPUTIME_ID);
+	}
+
+	return ctx;
+}
+
+/* Called when the probe_ctx goes out of scope */
+void probe_end(struct probe_ctx *ctx)
+{
+	struct probe *p = ctx->probe;
+	long long wall, cpu;
+	int i;
+
+	if (!p)
+		return;
+
+	wall = usec(CLOCK_MONOTONIC) - ctx->wall;
+	cpu  = usec(CLOCK_PROCESS_CPUTIME_ID) - ctx->cpu;
+
+	for (i = 0; i < PROBE_BUCKETS - 1; i++) {
+		if (wall <= probe_bounds[i])
+			break;
+	}
+
+	p->bucket[i]++;
+	p->count++;
+	p->wall += wall;
+	p->cpu  += cpu;
+	if ((unsigned long long)wall > p->max) {
+		p->max = wall;
+		if (!stall || p->max > stall->max)
+			stall = p;
+	}
+}
+
+static void usecs(FILE *fp, const char *name, const char *label, unsigned long long val)
+{
+	fprintf(fp, "finit_%s{callback=\"%s\"} %llu.%06llu\n", name, label,
+		val / 1000000, val % 1000000);
+}
+
+static void latency(FILE *fp)
+{
+	struct probe *p;
+	int i;
+
+	fprintf(fp, "# TYPE finit_callback_seconds histogram\n");
+	fprintf(fp, "# HELP finit_callback_seconds Wall time of event loop callbacks and plugin hooks.\n");
+	for (p = probes; p; p = p->next) {
+		unsigned long long sum = 0;
+
+		for (i = 0; i < PROBE_BUCKETS; i++) {
+			sum += p->bucket[i];
+			if (i < PROBE_BUCKETS - 1)
+				fprintf(fp, "finit_callback_seconds_bucket{callback=\"%s\",le=\"%.5f\"} %llu\n",
+					p->name, probe_bounds[i] / 1000000.0, sum);
+			else
+				fprintf(fp, "finit_callback_seconds_bucket{callback=\"%s\",le=\"+Inf\"} %llu\n",
+					p->name, sum);
+		}
+		usecs(fp, "callback_seconds_sum", p->name, p->wall);
+		fprintf(fp, "finit_callback_seconds_count{callback=\"%s\"} %llu\n", p->name, p->count);
+	}
+
+	fprintf(fp, "# TYPE finit_callback_cpu_seconds counter\n");
+	fprintf(fp, "# HELP finit_callback_cpu_seconds CPU time of event loop callbacks and plugin hooks.\n");
+	for (p = probes; p; p = p->next)
+		usecs(fp, "callback_cpu_seconds_total", p->name, p->cpu);
+
+	fprintf(fp, "# TYPE finit_callback_max_seconds gauge\n");
+	fprintf(fp, "# HELP finit_callback_max_seconds Longest call, i.e. event loop stall.\n");
+	for (p = probes; p; p = p->next)
+		usecs(fp, "callback_max_seconds", p->name, p->max);
+
+	fprintf(fp, "# TYPE finit_loop_stall_seconds gauge\n");
+	fprintf(fp, "# HELP finit_loop_stall_seconds Longest event loop stall, by any callback.\n");
+	if (stall)
+		usecs(fp, "loop_stall_seconds", stall->name, stall->max);
+}
+#else
+#define latency(fp)
+#endif
+
+/**
+ * metrics_observe - Add one sample to a histogram
+ * @h:    Histogram, e.g. &metrics.reload
+ * @msec: Sample, in milliseconds
+ */
+void metrics_observe(struct histogram *h, long long msec)
+{
+	int i;
+
+	if (msec < 0)
+		msec = 0;
+
+	for (i = 0; i < METRICS_BUCKETS - 1; i++) {
+		if (msec <= bounds[i])
+			break;
+	}
+
+	h->bucket[i]++;
+	h->count++;
+	h->sum += msec;
+}
+
+/**
+ * metrics_ready - Service is ready, or run/task is done
+ * @svc: Service
+ *
+ * Records the latency from the latest fork, once per fork.
+ */
+void metrics_ready(svc_t *svc)
+{
+	if (!svc->forked_at)
+		return;
+
+	svc->ready_msec = timeline_now() - svc->forked_at;
+	svc->forked_at  = 0;
+	metrics_observe(&metrics.ready, svc->ready_msec);
+}
+
+/**
+ * metrics_running - Bootstrap done, entering SM_RUNNING_STATE
+ *
+ * Records the time since the first timeline event, which is recorded
+ * early in main(), once per boot.
+ */
+void metrics_running(void)
+{
+	const struct tl_event *ev;
+	int num;
+
+	ev = timeline_get(&num);
+	if (metrics.bootstrap || num < 1)
+		return;
+
+	metrics.bootstrap = timeline_now() - ev[0].msec;
+}
+
+static void counter(FILE *fp, const char *name, const char *help, unsigned long long val)
+{
+	fprintf(fp, "# TYPE finit_%s counter\n", name);
+	fprintf(fp, "# HELP finit_%s %s\n", name, help);
+	fprintf(fp, "finit_%s_total %llu\n", name, val);
+}
+
+static void histogram(FILE *fp, const char *name, const char *help, struct histogram *h)
+{
+	unsigned long long sum = 0;
+	int i;
+
+	fprintf(fp, "# TYPE finit_%s_seconds histogram\n", name);
+	fprintf(fp, "# HELP finit_%s_seconds %s\n", name, help);
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		sum += h->bucket[i];
+		if (i < METRICS_BUCKETS - 1)
+			fprintf(fp, "finit_%s_seconds_bucket{le=\"%.3f\"} %llu\n", name,
+				bounds[i] / 1000.0, sum);
+		else
+			fprintf(fp, "finit_%s_seconds_bucket{le=\"+Inf\"} %llu\n", name, sum);
+	}
+	fprintf(fp, "finit_%s_seconds_sum %lld.%03lld\n", name, h->sum / 1000, h->sum % 1000);
+	fprintf(fp, "finit_%s_seconds_count %llu\n", name, h->count);
+}
+
+/* One family at a time, as required by OpenMetrics */
+static void services(FILE *fp, int family, long long now)
+{
+	svc_t *svc, *iter = NULL;
+	char ident[MAX_IDENT_LEN];
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		svc_ident(svc, ident, sizeof(ident));
+
+		switch (family) {
+		case 0:
+			fprintf(fp, "finit_service_restarts_total{service=\"%s\"} %u\n",
+				ident, svc->restart_tot);
+			break;
+
+		case 1:
+			fprintf(fp, "finit_service_restart_count{service=\"%s\"} %d\n",
+				ident, svc->restart_cnt);
+			break;
+
+		case 2:
+			for (size_t i = 0; i < NELEMS(states); i++) {
+				long long msec = svc->state_msec[i];
+
+				if (svc->state == (svc_state_t)i && svc->state_at)
+					msec += now - svc->state_at;
+				fprintf(fp, "finit_service_state_seconds_total{service=\"%s\",state=\"%s\"} %lld.%03lld\n",
+					ident, states[i], msec / 1000, msec % 1000);
+			}
+			break;
+
+		case 3:
+			if (svc->ready_msec < 0)
+				break;
+			fprintf(fp, "finit_service_ready_seconds{service=\"%s\"} %d.%03d\n",
+				ident, svc->ready_msec / 1000, svc->ready_msec % 1000);
+			break;
+		}
+	}
+}
+
+/**
+ * metrics_write - Write all metrics in OpenMetrics text format
+ * @fp: Output stream
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on write error.
+ */
+int metrics_write(FILE *fp)
+{
+	long long now = timeline_now();
+
+	counter(fp, "reaped", "Processes collected by Finit.", metrics.reaped);
+	counter(fp, "service_steps", "Calls to the service state machine.", metrics.steps);
+	counter(fp, "api_requests", "API requests served.", metrics.requests);
+	counter(fp, "cond_flips", "Condition changes.", metrics.cond_flips);
+	counter(fp, "reloads", "Reconfigurations.", metrics.reloads);
+	counter(fp, "work_queued", "Deferred work queued.", metrics.work_queued);
+	counter(fp, "work_coalesced", "Deferred work already queued, merged.", metrics.work_coalesced);
+	counter(fp, "work_run", "Deferred work run.", metrics.work_run);
+	counter(fp, "work_yields", "Work passes out of budget, yielded to I/O.", metrics.work_yields);
+
+	fprintf(fp, "# TYPE finit_bootstrap_seconds gauge\n");
+	fprintf(fp, "# HELP finit_bootstrap_seconds Time from start of Finit to end of bootstrap.\n");
+	fprintf(fp, "finit_bootstrap_seconds %lld.%03lld\n", metrics.bootstrap / 1000, metrics.bootstrap % 1000);
+
+	histogram(fp, "ready", "Latency from fork to ready, or run/task done.", &metrics.ready);
+	histogram(fp, "reload", "Duration of reconfiguration, until services are started.", &metrics.reload);
+
+	fprintf(fp, "# TYPE finit_service_restarts counter\n");
+	fprintf(fp, "# HELP finit_service_restarts Total restarts of service.\n");
+	services(fp, 0, now);
+
+	fprintf(fp, "# TYPE finit_service_restart_count gauge\n");
+	fprintf(fp, "# HELP finit_service_restart_count Restarts since service was last stable.\n");
+	services(fp, 1, now);
+
+	fprintf(fp, "# TYPE finit_service_state_seconds counter\n");
+	fprintf(fp, "# HELP finit_service_state_seconds Time spent in each state.\n");
+	services(fp, 2, now);
+
+	fprintf(fp, "# TYPE finit_service_ready_seconds gauge\n");
+	fprintf(fp, "# HELP finit_service_ready_seconds Latest latency from fork to ready.\n");
+	services(fp, 3, now);
+
+	footprint_metrics(fp);
+	latency(fp);
+	fprintf(fp, "# EOF\n");
+
+	return ferror(fp);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,105 @@
+/* Counters and latency histograms of Finit, in OpenMetrics text format
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_METRICS_H_
+#define FINIT_METRICS_H_
+
+#include <stdio.h>
+#include "svc.h"
+
+#define METRICS_BUCKETS  12	/* 1 ms .. 10 s, see metrics.c */
+
+struct histogram {
+	unsigned long long bucket[METRICS_BUCKETS];
+	unsigned long long count;
+	long long          sum;		/* msec */
+};
+
+struct metrics {
+	unsigned long long reaped;	/* Processes collected, service_monitor() */
+	unsigned long long steps;	/* service_step() calls */
+	unsigned long long requests;	/* API requests served */
+	unsigned long long cond_flips;	/* Condition changes, cond_set_path() */
+	unsigned long long reloads;	/* initctl reload, or SIGHUP */
+	unsigned long long work_queued;	/* Work queued, schedule_work() */
+	unsigned long long work_coalesced; /* Work already queued, merged */
+	unsigned long long work_run;	/* Work callbacks run */
+	unsigned long long work_yields;	/* Out of budget, yield to I/O */
+	long long          bootstrap;	/* msec, first timeline event to running */
+	struct histogram   ready;	/* Fork to ready, all services */
+	struct histogram   reload;	/* Reload, until all services are started */
+};
+
+extern struct metrics metrics;
+
+#ifdef LATENCY_PROBES
+#define PROBE_BUCKETS    7	/* 10 us .. 1 s, see metrics.c */
+
+/* Latency of one event loop callback, or plugin hook */
+struct probe {
+	struct probe      *next;
+	char              *name;
+	unsigned long long count;
+	unsigned long long wall;	/* usec, total */
+	unsigned long long cpu;		/* usec, total */
+	unsigned long long max;		/* usec, longest call */
+	unsigned long long bucket[PROBE_BUCKETS];
+};
+
+struct probe_ctx {
+	struct probe      *probe;
+	long long          wall;
+	long long          cpu;
+};
+
+/*
+ * Time the rest of the enclosing block, use at the top of a callback.
+ * PROBE() takes a constant name, PROBE_AT() a probe from probe_get().
+ */
+#define PROBE_AT(p)							\
+	struct probe_ctx probe_ctx_ __attribute__((cleanup(probe_end))) = probe_begin(p)
+#define PROBE(name)							\
+	static struct probe *probe_;					\
+	PROBE_AT(probe_ ?: (probe_ = probe_get(name)))
+
+struct probe    *probe_get  (const char *name);
+struct probe_ctx probe_begin(struct probe *p);
+void             probe_end  (struct probe_ctx *ctx);
+#else
+#define PROBE_AT(p)
+#define PROBE(name)
+#endif
+
+void metrics_observe(struct histogram *h, long long msec);
+void metrics_ready  (svc_t *svc);
+void metrics_running(void);
+int  metrics_write  (FILE *fp);
+
+#endif /* FINIT_METRICS_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
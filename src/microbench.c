@@ -0,0 +1,289 @@
+/* Microbenchmark of hot paths in svc, cond and conf
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+#else
+# include <lite/lite.h>
+#endif
+
+#include "cond.h"
+#include "conf.h"
+#include "finit.h"
+#include "private.h"
+#include "service.h"
+#include "svc.h"
+
+/*
+ * All of finit is linked in, with its main() renamed by CPPFLAGS, see
+ * Makefile.am.  The allocator is wrapped by the linker to count calls
+ * made from finit code.
+ */
+#undef main
+
+#define LAPS_MIN   100000	/* Lookups per function and size */
+
+static unsigned long long allocs;
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup (const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+	allocs++;
+	return __real_strdup(s);
+}
+
+static svc_t **svcs;		/* Registered services, by index */
+static int     num;		/* Number of services in this sweep */
+
+static long long nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Spread lookups evenly over all services, but not in order */
+static int pick(int i)
+{
+	return (int)(((long long)i * 7919) % num);
+}
+
+static void report(const char *name, long long ns, unsigned long long n, int laps)
+{
+	printf("%-24s %8d %12.1f %10.2f\n", name, num, (double)ns / laps, (double)n / laps);
+}
+
+#define BENCH(name, laps, expr)						\
+	do {								\
+		unsigned long long a_ = allocs;				\
+		long long t_ = nsec();					\
+		int i;							\
+									\
+		for (i = 0; i < (laps); i++)				\
+			expr;						\
+		report(name, nsec() - t_, allocs - a_, laps);		\
+	} while (0)
+
+/*
+ * Every service depends on the PID file of service N/2, and from
+ * N > 3 also on N/3, like test/bench/gen-conf.sh
+ */
+static void job(char *buf, size_t len, int i)
+{
+	char cond[64] = "";
+
+	if (i > 3)
+		snprintf(cond, sizeof(cond), "<pid/b%d,pid/b%d> ", i / 2, i / 3);
+	else if (i > 1)
+		snprintf(cond, sizeof(cond), "<pid/b%d> ", i / 2);
+
+	snprintf(buf, len, "[2345] name:b%d %s/bin/true -- Bench service %d", i, cond, i);
+}
+
+static void do_register(int i)
+{
+	char line[256];
+
+	job(line, sizeof(line), i);
+	service_register(SVC_TYPE_SERVICE, line, global_rlimit, "bench.conf");
+}
+
+static int found(svc_t *svc, void *arg)
+{
+	return 0;
+}
+
+static int not_found(char *name, char *id, void *arg)
+{
+	return 1;
+}
+
+static void do_jobstr(int i)
+{
+	char str[32];
+
+	snprintf(str, sizeof(str), "b%d", pick(i));
+	svc_parse_jobstr(str, sizeof(str), NULL, found, not_found);
+}
+
+static void do_find(int i)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "b%d", pick(i));
+	svc_find(name, NULL);
+}
+
+static void do_find_by_cond(int i)
+{
+	char cond[32];
+
+	snprintf(cond, sizeof(cond), "pid/b%d", pick(i));
+	svc_find_by_cond(cond);
+}
+
+static void sweep(void)
+{
+	svc_t *svc, *iter = NULL;
+	int laps = max(LAPS_MIN, num);
+	int i, n = 0;
+
+	svcs = calloc(num, sizeof(svc_t *));
+	if (!svcs) {
+		perror("calloc");
+		exit(1);
+	}
+
+	BENCH("service_register", num, do_register(i));
+	BENCH("service_register/reload", num, do_register(i));
+
+	for (svc = svc_iterator(&iter, 1); svc && n < num; svc = svc_iterator(&iter, 0))
+		svcs[n++] = svc;
+	if (n != num) {
+		fprintf(stderr, "Only %d of %d services registered!\n", n, num);
+		exit(1);
+	}
+
+	/* Half of all conditions on, otherwise cond_get_agg() stops early */
+	if (cond_is_available()) {
+		for (i = 0; i < num; i += 2) {
+			char cond[32];
+
+			snprintf(cond, sizeof(cond), "pid/b%d", i);
+			cond_set_noupdate(cond);
+		}
+	}
+
+	for (i = 0; i < num; i++)
+		svc_set_pid(svcs[i], 3000000 + i);
+
+	BENCH("svc_find", laps, do_find(i));
+	BENCH("svc_find_by_pid", laps, svc_find_by_pid(3000000 + pick(i)));
+	BENCH("svc_find_by_cond", laps, do_find_by_cond(i));
+	BENCH("svc_find_by_jobid", laps, svc_find_by_jobid(svcs[pick(i)]->job, NULL));
+	BENCH("svc_parse_jobstr", laps, do_jobstr(i));
+	BENCH("svc_enabled", laps, svc_enabled(svcs[pick(i)]));
+	BENCH("cond_get_agg", laps, cond_get_agg(svcs[pick(i)]->cond));
+
+	for (i = 0; i < num; i++)
+		svc_set_pid(svcs[i], 0);
+}
+
+static int usage(int rc)
+{
+	fprintf(stderr,
+		"Usage: microbench [NUM ...]\n"
+		"\n"
+		"Registers NUM services, default 100, 1000 and 10000, and reports the\n"
+		"time and number of allocations per call of hot functions.  Run in a\n"
+		"private mount namespace with a tmpfs on /run for realistic conditions,\n"
+		"e.g., unshare -rm sh -c 'mount -t tmpfs none /run && ./microbench'\n");
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	char *sizes[] = { "100", "1000", "10000", NULL };
+	char **arg = sizes;
+	uev_ctx_t loop;
+
+	if (argc > 1) {
+		if (argv[1][0] == '-')
+			return usage(!strcmp(argv[1], "-h") ? 0 : 1);
+		arg = &argv[1];
+	}
+
+	/* Mock context, never run, for timers and watchers set up by finit */
+	uev_init(&loop);
+	ctx = &loop;
+	runlevel = 2;
+
+	cond_init();
+	if (!cond_is_available())
+		fprintf(stderr, "Cannot create %s, all conditions are off.\n", _PATH_COND);
+
+	printf("%-24s %8s %12s %10s\n", "function", "services", "ns/op", "allocs/op");
+	for (; *arg; arg++) {
+		pid_t pid;
+		int status;
+
+		num = atoi(*arg);
+		if (num <= 0)
+			return usage(1);
+
+		/* Each sweep in a fresh copy of the process, nothing registered */
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0) {
+			sweep();
+			fflush(stdout);
+			_exit(0);
+		}
+		if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			return 1;
+	}
+
+	cond_exit();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
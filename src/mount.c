@@ -24,13 +24,27 @@
 #include "config.h"		/* Generated by configure script */
 
 #include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #ifdef HAVE_MNTENT_H
 #include <mntent.h>
 #endif
 #include <sys/mount.h>
+#include <sys/wait.h>
 
 #include "helpers.h"
+#include "timeline.h"
+
+/* Max number of file systems unmounted in parallel */
+#define UMOUNT_MAX 32
+
+struct umnt {
+	char  *dir;
+	pid_t  pid;
+	int    leaf;
+};
 
 /*
  * SysV init on Debian/Ubuntu skips these protected mount points
@@ -93,42 +107,171 @@ static struct mntent *iterator(char *filename, FILE **fp)
 	return NULL;
 }
 
-static int unmount(const char *target)
+static void unmount_error(const char *target, int error)
 {
-	int rc;
-
-	dbg("Unmounting %s", target);
+	if (error != EBUSY)
+		print(2, "Failed unmounting %s, error %d: %s", target, error, strerror(error));
+}
 
-	rc = umount(target);
-	if (rc) {
-		if (errno != EBUSY)
-			print(2, "Failed unmounting %s, error %d: %s", target, errno, strerror(errno));
-		return rc;
-	}
+/*
+ * Is @dir mounted on top of, or below, @top in the mount tree?  Later
+ * entries in /proc/mounts are stacked on earlier ones.
+ */
+static int is_below(const char *dir, const char *top)
+{
+	size_t len = strlen(top);
 
-	return 0;
+	return !strncmp(dir, top, len) && (dir[len] == '/' || dir[len] == 0);
 }
 
-void unmount_tmpfs(void)
+static int collect(struct umnt *list, int max, int tmpfs)
 {
 	struct mntent *mnt;
 	FILE *fp = NULL;
+	int i, j, num = 0;
 
 	while ((mnt = iterator("/proc/mounts", &fp))) {
-		if (!strcmp("tmpfs", mnt->mnt_fsname) && !unmount(mnt->mnt_dir))
-			iterator_end(&fp);  /* Restart iteration */
+		if (tmpfs && strcmp("tmpfs", mnt->mnt_fsname))
+			continue;
+		if (num >= max)
+			continue;
+
+		list[num].dir = strdup(mnt->mnt_dir);
+		if (!list[num].dir)
+			continue;
+		list[num].pid = 0;
+		list[num].leaf = 1;
+		num++;
+	}
+
+	/* Only leaves can be unmounted, siblings are independent */
+	for (i = 0; i < num; i++) {
+		for (j = i + 1; j < num; j++) {
+			if (is_below(list[j].dir, list[i].dir))
+				list[i].leaf = 0;
+		}
 	}
+
+	return num;
 }
 
-void unmount_regular(void)
+/*
+ * Unmount all leaves in the mount tree at the same time, each in its
+ * own process, since umount(2) syncs the file system and can block for
+ * a long time on slow media.  Give up waiting at the @deadline, and
+ * detach the rest instead.
+ *
+ * Returns: number of unmounted file systems, or zero if all were busy
+ */
+static int unmount_round(int tmpfs, long long deadline)
 {
-	struct mntent *mnt;
-	FILE *fp = NULL;
+	struct umnt list[UMOUNT_MAX * 4];
+	int i, num, running = 0, done = 0;
 
-	while ((mnt = iterator("/proc/mounts", &fp))) {
-		if (!unmount(mnt->mnt_dir))
-			iterator_end(&fp);  /* Restart iteration */
+	num = collect(list, NELEMS(list), tmpfs);
+	for (i = 0; i < num && running < UMOUNT_MAX; i++) {
+		pid_t pid;
+
+		if (!list[i].leaf)
+			continue;
+
+		dbg("Unmounting %s", list[i].dir);
+		if (deadline && timeline_now() >= deadline) {
+			if (umount2(list[i].dir, MNT_DETACH))
+				unmount_error(list[i].dir, errno);
+			else
+				done++;
+			continue;
+		}
+
+		pid = fork();
+		if (pid == 0)
+			_exit(umount(list[i].dir) ? errno : 0);
+		if (pid < 0) {
+			if (umount(list[i].dir))
+				unmount_error(list[i].dir, errno);
+			else
+				done++;
+			continue;
+		}
+
+		list[i].pid = pid;
+		running++;
+	}
+
+	while (running > 0) {
+		for (i = 0; i < num; i++) {
+			int status;
+			pid_t pid;
+
+			if (list[i].pid <= 0)
+				continue;
+
+			pid = waitpid(list[i].pid, &status, WNOHANG);
+			if (pid == 0)
+				continue;
+
+			list[i].pid = 0;
+			running--;
+			if (pid < 0 || !WIFEXITED(status))
+				continue;
+			if (WEXITSTATUS(status))
+				unmount_error(list[i].dir, WEXITSTATUS(status));
+			else
+				done++;
+		}
+
+		if (!running)
+			break;
+
+		if (deadline && timeline_now() >= deadline) {
+			for (i = 0; i < num; i++) {
+				if (list[i].pid <= 0)
+					continue;
+
+				print(1, "Timeout unmounting %s, detaching", list[i].dir);
+				if (!umount2(list[i].dir, MNT_DETACH))
+					done++;
+			}
+			break;
+		}
+
+		usleep(10000);
 	}
+
+	for (i = 0; i < num; i++)
+		free(list[i].dir);
+
+	return done;
+}
+
+static void unmount_all(int tmpfs, int msec)
+{
+	long long deadline = 0;
+
+	if (msec >= 0)
+		deadline = timeline_now() + msec;
+
+	while (unmount_round(tmpfs, deadline))
+		;
+}
+
+/**
+ * unmount_tmpfs - Unmount all non-protected tmpfs
+ * @msec: Time left of shutdown deadline, or -1 for none
+ */
+void unmount_tmpfs(int msec)
+{
+	unmount_all(1, msec);
+}
+
+/**
+ * unmount_regular - Unmount all non-protected file systems
+ * @msec: Time left of shutdown deadline, or -1 for none
+ */
+void unmount_regular(int msec)
+{
+	unmount_all(0, msec);
 }
 
 /**
@@ -0,0 +1,247 @@
+/* Readiness notification, sd_notify() protocol and shared socket
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"		/* Generated by configure script */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "log.h"
+#include "metrics.h"
+#include "notify.h"
+#include "private.h"
+#include "service.h"
+
+#define NOTIFY_EXTEND_MAX 3600000	/* msec, max EXTEND_TIMEOUT_USEC= */
+
+/*
+ * With 'notify shared' in finit.conf all notify:systemd services send
+ * their sd_notify() datagrams to one socket, instead of each having a
+ * connection to the API socket.  The sender is identified by the PID in
+ * its SCM_CREDENTIALS, looked up in the PID index.
+ */
+int notify_shared;
+
+static uev_t watcher;
+
+/**
+ * notify_parse - Handle sd_notify() message from a service
+ * @svc: Service that sent the message
+ * @buf: NUL terminated message, one VAR=VALUE per line
+ *
+ * Handles READY=1, STATUS=, WATCHDOG=1, WATCHDOG=trigger, and
+ * EXTEND_TIMEOUT_USEC=, all other variables are ignored.
+ */
+void notify_parse(svc_t *svc, char *buf)
+{
+	char *line, *ptr;
+
+	for (line = strtok_r(buf, "\n", &ptr); line; line = strtok_r(NULL, "\n", &ptr)) {
+		char *arg;
+
+		if (!strcmp(line, "READY=1")) {
+			/*
+			 * native (pidfile) services are marked as started by
+			 * the pidfile plugin.
+			 */
+			svc_started(svc);
+
+			/*
+			 * On reload, and this svc is unmodified, it is up to
+			 * the service_notify_reconf() function to step the
+			 * generation of the READY condition.
+			 */
+			service_ready(svc, 1);
+		} else if (MATCH_CMD(line, "STATUS=", arg)) {
+			svc_set_status(svc, arg);
+		} else if (MATCH_CMD(line, "WATCHDOG=", arg)) {
+			if (!strcmp(arg, "trigger") && svc->pid > 1) {
+				logit(LOG_WARNING, "%s: watchdog triggered by service, aborting it.",
+				      svc_ident(svc, NULL, 0));
+				kill(svc->pid, SIGABRT);
+			} else if (!strcmp(arg, "1")) {
+				dbg("%s: watchdog keepalive", svc_ident(svc, NULL, 0));
+				service_watchdog_kick(svc);
+			}
+		} else if (MATCH_CMD(line, "EXTEND_TIMEOUT_USEC=", arg)) {
+			unsigned long long msec = strtoull(arg, NULL, 10) / 1000;
+
+			/*
+			 * Only the SIGKILL timer of a stopping service can be
+			 * extended.  Less than 1 msec would SIGKILL it now.
+			 */
+			if (svc->state == SVC_STOPPING_STATE && svc->timer_cb && msec > 0) {
+				if (msec > NOTIFY_EXTEND_MAX)
+					msec = NOTIFY_EXTEND_MAX;
+				svc->timer.delay = (int)msec;
+				dbg("%s: extending stop timeout by %d msec", svc_ident(svc, NULL, 0), svc->timer.delay);
+				schedule_work(&svc->timer);
+			}
+		}
+	}
+}
+
+static void notify_cb(uev_t *w, void *arg, int events)
+{
+	PROBE("notify");
+
+	char cbuf[CMSG_SPACE(sizeof(struct ucred))];
+	struct ucred *cred = NULL;
+	struct cmsghdr *cmsg;
+	char buf[512];
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len  = sizeof(buf) - 1,
+	};
+	struct msghdr msg = {
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	ssize_t len;
+	svc_t *svc;
+
+	if (UEV_ERROR == events) {
+		warn("Spurious problem with notify socket, restarting.");
+		uev_io_start(w);
+		return;
+	}
+
+	len = recvmsg(w->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (len == -1) {
+		if (errno != EAGAIN)
+			warn("Failed reading notify socket");
+		return;
+	}
+	buf[len] = 0;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS)
+			cred = (struct ucred *)CMSG_DATA(cmsg);
+	}
+
+	if (!cred) {
+		dbg("Dropping notification without credentials");
+		return;
+	}
+
+	svc = svc_find_by_pid(cred->pid);
+	if (!svc || svc->notify != SVC_NOTIFY_SYSTEMD) {
+		dbg("Dropping notification from unknown PID %d", cred->pid);
+		return;
+	}
+
+	notify_parse(svc, buf);
+}
+
+/**
+ * notify_init - Set up shared notify socket
+ * @ctx: The libuEv context
+ *
+ * Called before starting a notify:systemd service in shared mode, only
+ * the first call creates the socket.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on error.
+ */
+int notify_init(uev_ctx_t *ctx)
+{
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+		.sun_path   = NOTIFY_SOCKET,
+	};
+	mode_t oldmask;
+	int sd, on = 1;
+
+	if (watcher.fd > 0)
+		return 0;
+
+	sd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd == -1)
+		goto fail;
+
+	if (setsockopt(sd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)))
+		goto error;
+
+	/* Services running as any user must be able to notify */
+	erase(NOTIFY_SOCKET);
+	oldmask = umask(0);
+	if (bind(sd, (struct sockaddr *)&sun, sizeof(sun))) {
+		umask(oldmask);
+		goto error;
+	}
+	umask(oldmask);
+
+	if (!uev_io_init(ctx, &watcher, notify_cb, NULL, sd, UEV_READ))
+		return 0;
+error:
+	close(sd);
+fail:
+	err(1, "Failed setting up shared notify socket");
+	return 1;
+}
+
+/**
+ * notify_sd - Shared notify socket, for re-exec
+ *
+ * Returns:
+ * The shared notify socket, or -1 if not set up.
+ */
+int notify_sd(void)
+{
+	return watcher.fd > 0 ? watcher.fd : -1;
+}
+
+/**
+ * notify_adopt - Take over shared notify socket after re-exec
+ * @ctx: The libuEv context
+ * @sd:  Socket from notify_sd() in the previous finit
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on error.
+ */
+int notify_adopt(uev_ctx_t *ctx, int sd)
+{
+	if (watcher.fd > 0 || uev_io_init(ctx, &watcher, notify_cb, NULL, sd, UEV_READ)) {
+		close(sd);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
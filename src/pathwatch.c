@@ -0,0 +1,378 @@
+/* Path activation, start run/task/service when a path appears or changes
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"		/* Generated by configure script */
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "finit.h"
+#include "iwatch.h"
+#include "log.h"
+#include "metrics.h"
+#include "pathwatch.h"
+#include "private.h"
+#include "schedule.h"
+#include "service.h"
+
+/*
+ * A job with path:SPEC[,SPEC] is started when any of its paths, where
+ * SPEC is [exists:|changed:|nonempty:]PATH, is activated:
+ *
+ *  - exists:PATH    PATH exists, the default
+ *  - changed:PATH   PATH is written to and closed, moved, or touched
+ *  - nonempty:DIR   DIR has at least one entry, e.g., a spool directory
+ *
+ * The parent directory is watched, or DIR itself, so PATH does not have
+ * to exist when the job is registered.  Bursts of events are coalesced
+ * into a single activation, and a run/task activated while it runs is
+ * run once more when it is done.
+ */
+#define PATH_COALESCE 100	/* msec */
+
+enum {
+	PATH_EXISTS = 0,
+	PATH_CHANGED,
+	PATH_NONEMPTY,
+};
+
+struct pathwatch {
+	TAILQ_ENTRY(pathwatch) link;
+	svc_t  *svc;
+	int     type;
+	int     wd;
+	char   *dir;		/* watched directory */
+	char   *name;		/* file in dir, NULL for nonempty */
+};
+
+static TAILQ_HEAD(, pathwatch) pw_list = TAILQ_HEAD_INITIALIZER(pw_list);
+static struct iwatch iw_path = { .name = "path" };
+static uev_t pathw;
+static int fd = -1;
+
+static const char *parse_type(const char *spec, int *type)
+{
+	struct {
+		const char *prefix;
+		int         type;
+	} types[] = {
+		{ "exists:",   PATH_EXISTS   },
+		{ "changed:",  PATH_CHANGED  },
+		{ "nonempty:", PATH_NONEMPTY },
+	};
+
+	*type = PATH_EXISTS;
+	for (size_t i = 0; i < NELEMS(types); i++) {
+		size_t len = strlen(types[i].prefix);
+
+		if (!strncmp(spec, types[i].prefix, len)) {
+			*type = types[i].type;
+			return &spec[len];
+		}
+	}
+
+	return spec;
+}
+
+static int is_nonempty(const char *dir)
+{
+	struct dirent *d;
+	int found = 0;
+	DIR *dp;
+
+	dp = opendir(dir);
+	if (!dp)
+		return 0;
+
+	while (!found && (d = readdir(dp))) {
+		if (strcmp(d->d_name, ".") && strcmp(d->d_name, ".."))
+			found = 1;
+	}
+	closedir(dp);
+
+	return found;
+}
+
+static int watch_dir(char *dir)
+{
+	struct iwatch_path *iwp;
+
+	iwp = iwatch_find_by_path(&iw_path, dir);
+	if (!iwp) {
+		if (iwatch_add1(&iw_path, dir, IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | IN_ONLYDIR))
+			return -1;
+		iwp = iwatch_find_by_path(&iw_path, dir);
+		if (!iwp)
+			return -1;
+	}
+
+	return iwp->wd;
+}
+
+static void unwatch_dir(int wd)
+{
+	struct iwatch_path *iwp;
+	struct pathwatch *pw;
+
+	TAILQ_FOREACH(pw, &pw_list, link) {
+		if (pw->wd == wd)
+			return;
+	}
+
+	iwp = iwatch_find_by_wd(&iw_path, wd);
+	if (iwp)
+		iwatch_del(&iw_path, iwp);
+}
+
+static void pw_free(struct pathwatch *pw)
+{
+	TAILQ_REMOVE(&pw_list, pw, link);
+	if (pw->wd >= 0)
+		unwatch_dir(pw->wd);
+	free(pw->dir);
+	free(pw->name);
+	free(pw);
+}
+
+static struct pathwatch *pw_new(svc_t *svc, const char *spec)
+{
+	struct pathwatch *pw;
+	char path[PATH_MAX];
+	const char *file;
+	char *ptr;
+
+	pw = calloc(1, sizeof(*pw));
+	if (!pw)
+		return NULL;
+
+	pw->svc = svc;
+	file = parse_type(spec, &pw->type);
+	if (file[0] != '/') {
+		logit(LOG_WARNING, "%s: path:%s must be absolute", svc_ident(svc, NULL, 0), spec);
+		free(pw);
+		return NULL;
+	}
+
+	strlcpy(path, file, sizeof(path));
+	if (pw->type == PATH_NONEMPTY) {
+		pw->dir = strdup(path);
+	} else {
+		ptr = strrchr(path, '/');
+		pw->name = strdup(&ptr[1]);
+		*ptr = 0;
+		pw->dir = strdup(path[0] ? path : "/");
+		if (!pw->name) {
+			free(pw->dir);
+			pw->dir = NULL;
+		}
+	}
+	if (!pw->dir) {
+		free(pw->name);
+		free(pw);
+		return NULL;
+	}
+
+	pw->wd = watch_dir(pw->dir);
+	if (pw->wd < 0)
+		logit(LOG_WARNING, "%s: cannot watch %s, does it exist?", svc_ident(svc, NULL, 0), pw->dir);
+	TAILQ_INSERT_TAIL(&pw_list, pw, link);
+
+	return pw;
+}
+
+static void path_work_cb(void *arg)
+{
+	svc_t *svc = (svc_t *)((struct wq *)arg)->arg;
+
+	dbg("%s: activated by path", svc_ident(svc, NULL, 0));
+	svc->activated = 1;
+	service_step(svc);
+}
+
+/* Coalesce a burst of events, and events while already activated */
+static void path_trigger(svc_t *svc)
+{
+	if (svc->activated || svc->path_work.index)
+		return;
+
+	svc->path_work.cb    = path_work_cb;
+	svc->path_work.arg   = svc;
+	svc->path_work.delay = PATH_COALESCE;
+	schedule_work(&svc->path_work);
+}
+
+static int pw_match(struct pathwatch *pw, struct inotify_event *ev)
+{
+	switch (pw->type) {
+	case PATH_EXISTS:
+		if (!(ev->mask & (IN_CREATE | IN_MOVED_TO)))
+			return 0;
+		break;
+	case PATH_CHANGED:
+		if (!(ev->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB)))
+			return 0;
+		break;
+	case PATH_NONEMPTY:
+		return (ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+	}
+
+	return ev->len && !strcmp(ev->name, pw->name);
+}
+
+static void pathwatch_cb(uev_t *w, void *arg, int events)
+{
+	static char ev_buf[8 *(sizeof(struct inotify_event) + NAME_MAX + 1) + 1];
+	struct inotify_event *ev;
+	ssize_t sz;
+	size_t off;
+	PROBE("pathwatch");
+
+	sz = read(w->fd, ev_buf, sizeof(ev_buf) - 1);
+	if (sz <= 0) {
+		err(1, "invalid inotify event");
+		return;
+	}
+	ev_buf[sz] = 0;
+	iwatch_coalesce(ev_buf, sz);
+
+	for (off = 0; off < (size_t)sz; off += sizeof(*ev) + ev->len) {
+		struct pathwatch *pw;
+
+		if (off + sizeof(*ev) > (size_t)sz)
+			break;
+
+		ev = (struct inotify_event *)&ev_buf[off];
+		if (off + sizeof(*ev) + ev->len > (size_t)sz)
+			break;
+
+		if (!ev->mask)
+			continue;
+
+		TAILQ_FOREACH(pw, &pw_list, link) {
+			if (pw->wd != ev->wd || !pw_match(pw, ev))
+				continue;
+
+			path_trigger(pw->svc);
+		}
+	}
+}
+
+/**
+ * path_start - Watch the paths of a job
+ * @svc: Job with path:
+ *
+ * Called when the job is waiting, or done, a no-op if the paths are
+ * already watched.  They are watched until the job is removed, or its
+ * path: option is changed at reload.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero if none of the paths could be watched.
+ */
+int path_start(svc_t *svc)
+{
+	struct pathwatch *pw;
+	char *spec, *ptr;
+	int num = 0;
+
+	if (fd < 0)
+		return 1;
+
+	TAILQ_FOREACH(pw, &pw_list, link) {
+		if (pw->svc == svc)
+			return 0;
+	}
+
+	spec = strdupa(svc->path);
+	for (ptr = strtok(spec, ","); ptr; ptr = strtok(NULL, ",")) {
+		pw = pw_new(svc, ptr);
+		if (pw && pw->wd >= 0)
+			num++;
+	}
+
+	return num ? 0 : 1;
+}
+
+/**
+ * path_check - Check if a job is activated by its paths right now
+ * @svc: Job with path:
+ *
+ * Only exists: and nonempty: paths can be checked, changed: paths are
+ * only activated by events.
+ *
+ * Returns:
+ * %TRUE(1) if any path is activated, otherwise %FALSE(0).
+ */
+int path_check(svc_t *svc)
+{
+	char *spec, *ptr;
+
+	spec = strdupa(svc->path);
+	for (ptr = strtok(spec, ","); ptr; ptr = strtok(NULL, ",")) {
+		const char *file;
+		int type;
+
+		file = parse_type(ptr, &type);
+		if (type == PATH_EXISTS && !access(file, F_OK))
+			return 1;
+		if (type == PATH_NONEMPTY && is_nonempty(file))
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * path_close - Stop watching the paths of a job
+ * @svc: Job with path:
+ */
+void path_close(svc_t *svc)
+{
+	struct pathwatch *pw, *tmp;
+
+	cancel_work(&svc->path_work);
+	TAILQ_FOREACH_SAFE(pw, &pw_list, link, tmp) {
+		if (pw->svc == svc)
+			pw_free(pw);
+	}
+}
+
+void pathwatch_init(uev_ctx_t *ctx)
+{
+	fd = iwatch_init(&iw_path);
+	if (fd < 0)
+		return;
+
+	if (uev_io_init(ctx, &pathw, pathwatch_cb, NULL, fd, UEV_READ)) {
+		err(1, "Failed setting up I/O callback for path watcher");
+		iwatch_exit(&iw_path);
+		fd = -1;
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
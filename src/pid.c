@@ -26,18 +26,29 @@
 
 #include <errno.h>
 #include <paths.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 #else
 # include <lite/lite.h>
 #endif
 
+#include "finit.h"
+#include "metrics.h"
 #include "pid.h"
+#include "private.h"
 #include "svc.h"
 #include "helpers.h"
+#include "service.h"
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
 
 
 /**
@@ -56,6 +67,131 @@ int pid_alive(pid_t pid)
 	return fexist(name);
 }
 
+/**
+ * pid_svc_alive - Check if the process of a service is running
+ * @svc: Service to check
+ *
+ * Like pid_alive(), but without the risk of PID reuse when the process
+ * of @svc is watched by a pidfd, which becomes readable when it exits.
+ *
+ * Returns:
+ * %TRUE(1) if process of @svc is alive, otherwise %FALSE(0)
+ */
+int pid_svc_alive(svc_t *svc)
+{
+	struct pollfd pfd = { .fd = svc->pidfd, .events = POLLIN };
+
+	if (svc->pid <= 1)
+		return 0;
+	if (svc->pidfd <= 0)
+		return pid_alive(svc->pid);
+
+	return poll(&pfd, 1, 0) == 0;
+}
+
+#ifdef SYS_pidfd_open
+static int pidfd_disabled;
+
+/* Convert from waitid() to waitpid() style status */
+static int pidfd_status(siginfo_t *info)
+{
+	switch (info->si_code) {
+	case CLD_EXITED:
+		return (info->si_status & 0xff) << 8;
+	case CLD_DUMPED:
+		return (info->si_status & 0x7f) | 0x80;
+	default:
+		return info->si_status & 0x7f;
+	}
+}
+
+static void pidfd_cb(uev_t *w, void *arg, int events)
+{
+	siginfo_t info = { 0 };
+	svc_t *svc = arg;
+	int status = 0;
+	pid_t pid;
+	PROBE("pidfd");
+
+	/* Already collected by sigchld_cb(), on error we rely on it */
+	pid = svc->pid;
+	if (pid <= 1 || svc->pidfd != w->fd || UEV_ERROR == events) {
+		pid_unwatch(svc);
+		return;
+	}
+
+	/*
+	 * Not our child, e.g., a daemon adopted from its PID file when we
+	 * are not PID 1, cannot be reaped, and its exit status is unknown.
+	 */
+	if (!waitid(P_PIDFD, w->fd, &info, WEXITED | WNOHANG)) {
+		if (!info.si_pid)
+			return;
+		status = pidfd_status(&info);
+	} else if (errno != ECHILD)
+		return;
+
+	dbg("Collected %s PID %d from pidfd, status: %d", svc_ident(svc, NULL, 0), pid, status);
+	pid_unwatch(svc);
+	service_monitor(pid, status);
+}
+
+/**
+ * pid_watch - Watch the process of a service using a pidfd
+ * @svc: Service with svc->pid set
+ *
+ * The exit of the process is delivered to service_monitor() directly
+ * from the pidfd, unless it is collected by sigchld_cb() first.  This
+ * also covers processes that are not our children, e.g., daemons that
+ * fork and are adopted from their PID file.  Falls back silently to
+ * only SIGCHLD on kernels without pidfd support.
+ */
+void pid_watch(svc_t *svc)
+{
+	int fd;
+
+	if (pidfd_disabled || svc->pid <= 1 || svc->pidfd > 0)
+		return;
+
+	fd = syscall(SYS_pidfd_open, svc->pid, 0);
+	if (fd < 0) {
+		if (errno == ENOSYS) {
+			dbg("No pidfd support in kernel, using only SIGCHLD.");
+			pidfd_disabled = 1;
+		}
+		return;
+	}
+
+	if (uev_io_init(ctx, &svc->pidfd_watcher, pidfd_cb, svc, fd, UEV_READ)) {
+		close(fd);
+		return;
+	}
+	svc->pidfd = fd;
+}
+
+/**
+ * pid_unwatch - Stop watching the process of a service
+ * @svc: Service watched with pid_watch()
+ */
+void pid_unwatch(svc_t *svc)
+{
+	if (svc->pidfd <= 0)
+		return;
+
+	uev_io_stop(&svc->pidfd_watcher);
+	close(svc->pidfd);
+	svc->pidfd = 0;
+}
+#else
+void pid_watch(svc_t *svc)
+{
+}
+
+void pid_unwatch(svc_t *svc)
+{
+}
+#endif /* SYS_pidfd_open */
+
 
 /**
  * pid_get_name - Find name of a process
@@ -169,9 +305,7 @@ int pid_file_set(svc_t *svc, char *file, int not)
 
 	de_dotdot(file);
 	pid_runpath(file, buf, sizeof(buf));
-	strlcpy(&svc->pidfile[not], buf, sizeof(svc->pidfile) - not);
-	if (not)
-		svc->pidfile[0] = '!';
+	svc_set_pidfile(svc, buf, not);
 
 	return 0;
 }
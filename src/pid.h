@@ -29,6 +29,9 @@
 #include "util.h"
 
 int   pid_alive       (pid_t pid);
+int   pid_svc_alive   (svc_t *svc);
+void  pid_watch       (svc_t *svc);
+void  pid_unwatch     (svc_t *svc);
 char *pid_get_name    (pid_t pid, char *name, size_t len);
 
 char *pid_file        (svc_t *svc);
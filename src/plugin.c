@@ -27,6 +27,7 @@
 #include <dlfcn.h>		/* dlopen() et al */
 #include <dirent.h>		/* readdir() et al */
 #include <poll.h>
+#include <sys/wait.h>
 #include <string.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
@@ -39,10 +40,12 @@
 #include "cond.h"
 #include "finit.h"
 #include "helpers.h"
+#include "metrics.h"
 #include "plugin.h"
 #include "private.h"
 #include "service.h"
 #include "sig.h"
+#include "timeline.h"
 #include "util.h"
 
 #define is_io_plugin(p) ((p)->io.cb && (p)->io.fd > 0)
@@ -59,8 +62,31 @@ static TAILQ_HEAD(plugin_head, plugin) plugins  = TAILQ_HEAD_INITIALIZER(plugins
 #ifndef ENABLE_STATIC
 static void check_plugin_depends(plugin_t *plugin);
 #endif
+static void lazy_hook(hook_point_t no);
 
 
+/* Plugins that only make sense on a host, not loaded in a container */
+static const char *host_only[] = {
+	"modprobe",
+	"modules-load",
+	"rtc",
+	"urandom",
+};
+
+static int is_host_only(const char *name)
+{
+	size_t i, len;
+
+	name = basenm(name);
+	len = strcspn(name, ".");
+	for (i = 0; i < NELEMS(host_only); i++) {
+		if (strlen(host_only[i]) == len && !strncmp(host_only[i], name, len))
+			return 1;
+	}
+
+	return 0;
+}
+
 static char *trim_ext(char *name)
 {
 	char *ptr;
@@ -85,6 +111,14 @@ int plugin_register(plugin_t *plugin)
 		return 1;
 	}
 
+#ifdef ENABLE_STATIC
+	/* Built-in plugins register themselves, skip host-only ones */
+	if (plugin->name && in_container() && is_host_only(plugin->name)) {
+		dbg("Container, skipping %s plugin", plugin->name);
+		return 0;
+	}
+#endif
+
 	/* Setup default name if none is provided */
 	nm = plugin->name;
 	if (!nm) {
@@ -206,6 +240,121 @@ int plugin_exists(hook_point_t no)
 static const char *hscript_paths[] = HOOK_TYPES;
 #undef CHOOSE
 
+static int      hscript_async;			/* hookscripts async     */
+static unsigned hscript_block;			/* block:HOOK[,HOOK]     */
+static pid_t    hscript_pid[HOOK_MAX_NUM];	/* running async scripts */
+
+/*
+ * Only hooks called from the event loop can run in the background, the
+ * bootstrap hooks run before we reap children or have conditions, and
+ * the shutdown hooks must complete before we tear down the system.
+ */
+static int hscript_is_async(hook_point_t no)
+{
+	if (!hscript_async || !cond_is_available())
+		return 0;
+	if (no < HOOK_NETWORK_UP || no > HOOK_SYSTEM_UP)
+		return 0;
+
+	return !(hscript_block & (1U << no));
+}
+
+static void hscript_done(hook_point_t no)
+{
+	char cond[64];
+
+	if (no < HOOK_NETWORK_UP || no > HOOK_SYSTEM_UP || !cond_is_available())
+		return;
+
+	snprintf(cond, sizeof(cond), "%s/done", hook_cond[no]);
+	cond_set_oneshot(cond);
+}
+
+/**
+ * plugin_script_conf - parse hookscripts setting from finit.conf
+ * @arg: "async [block:HOOK[,HOOK]]" or "sync"
+ *
+ * Hooks in @block are always run synchronously, as before.  They are
+ * named as their condition, with or without the "hook/" prefix.
+ *
+ * Returns 0 on success, or -1 on error.
+ */
+int plugin_script_conf(char *arg)
+{
+	char *tok, *ptr;
+
+	hscript_async = 0;
+	hscript_block = 0;
+
+	for (tok = strtok_r(arg, " \t", &ptr); tok; tok = strtok_r(NULL, " \t", &ptr)) {
+		char *name, *p;
+
+		if (!strcmp(tok, "async")) {
+			hscript_async = 1;
+			continue;
+		}
+		if (!strcmp(tok, "sync")) {
+			hscript_async = 0;
+			continue;
+		}
+		if (strncmp(tok, "block:", 6)) {
+			errx(1, "hookscripts: unknown option '%s'", tok);
+			return -1;
+		}
+
+		for (name = strtok_r(tok + 6, ",", &p); name; name = strtok_r(NULL, ",", &p)) {
+			int no;
+
+			if (!strncmp(name, "hook/", 5))
+				name += 5;
+
+			for (no = HOOK_NETWORK_UP; no <= HOOK_SYSTEM_UP; no++) {
+				if (!strcmp(hook_cond[no] + 5, name))
+					break;
+			}
+			if (no > HOOK_SYSTEM_UP) {
+				errx(1, "hookscripts: cannot run hook/%s async", name);
+				continue;
+			}
+
+			hscript_block |= 1U << no;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * plugin_script_done - collect an async hook script process
+ * @pid:    PID of the collected process
+ * @status: waitpid() status
+ *
+ * Called by service_monitor() for PIDs it does not know about.  Sets
+ * the hook's done condition, e.g., hook/sys/up/done.
+ *
+ * Returns 0 if @pid was an async hook script, otherwise 1.
+ */
+int plugin_script_done(pid_t pid, int status)
+{
+	int no;
+
+	for (no = HOOK_NETWORK_UP; no <= HOOK_SYSTEM_UP; no++) {
+		if (hscript_pid[no] != pid)
+			continue;
+
+		hscript_pid[no] = 0;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			logit(LOG_WARNING, "Hook scripts for %s failed, status %d", hook_cond[no], status);
+		else
+			dbg("Hook scripts for %s done.", hook_cond[no]);
+
+		hscript_done(no);
+		return 0;
+	}
+
+	return 1;
+}
+
 void plugin_script_run(hook_point_t no)
 {
 	const char *hook_name = hscript_paths[no];
@@ -215,6 +364,7 @@ void plugin_script_run(hook_point_t no)
 		NULL,
 	};
 	char path[CMD_SIZE] = "";
+	pid_t pid;
 
 	strlcat(path, PLUGIN_HOOK_SCRIPTS_PATH, sizeof(path));
 	strlcat(path, hook_name + 4, sizeof(path));
@@ -228,15 +378,57 @@ void plugin_script_run(hook_point_t no)
 			env[3] = "halt";
 			break;
 		case SHUT_REBOOT:
+		case SHUT_KEXEC:
 			env[3] = "reboot";
 			break;
 		}
 	} else
 		env[2] = NULL;
 
-	run_parts(path, NULL, env, 0, 0);
+	if (!hscript_is_async(no)) {
+		run_parts(path, NULL, env, 0, 0, 0);
+		hscript_done(no);
+		return;
+	}
+
+	if (hscript_pid[no]) {
+		dbg("Hook scripts for %s still running, PID %d, skipping.", hook_name, hscript_pid[no]);
+		return;
+	}
+
+	if (!fisdir(path)) {
+		hscript_done(no);
+		return;
+	}
+
+	pid = fork();
+	if (pid == -1) {
+		warn("Failed forking hook scripts for %s, running in foreground", hook_name);
+		run_parts(path, NULL, env, 0, 0, 0);
+		hscript_done(no);
+		return;
+	}
+	if (!pid)
+		_exit(run_parts(path, NULL, env, 0, 0, 0) ? 1 : 0);
+
+	dbg("Hook scripts for %s started in background as PID %d", hook_name, pid);
+	hscript_pid[no] = pid;
 }
 #else
+int plugin_script_conf(char *arg)
+{
+	(void)arg;
+	warnx("hookscripts: not supported, hook-scripts plugin not enabled.");
+	return -1;
+}
+
+int plugin_script_done(pid_t pid, int status)
+{
+	(void)pid;
+	(void)status;
+	return 1;
+}
+
 void plugin_script_run(hook_point_t no)
 {
 	(void)no;
@@ -244,10 +436,25 @@ void plugin_script_run(hook_point_t no)
 #endif
 
 /* Some hooks are called with a fixed argument */
+#ifdef LATENCY_PROBES
+/* Probe per plugin and hook, e.g. "hook/basefs/up/netlink" */
+static struct probe *probe(const char *what, plugin_t *p)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s/%s", what, basenm(p->name));
+
+	return probe_get(name);
+}
+#endif
+
 void plugin_run_hook(hook_point_t no, void *arg)
 {
 	plugin_t *p, *tmp;
 
+	timeline_add(hook_cond[no]);
+	lazy_hook(no);
+
 #ifdef HAVE_HOOK_SCRIPTS_PLUGIN
 	if (!cond_is_available() && !plugloaded) {
 		dbg("conditions not available, calling script based hooks only!");
@@ -257,6 +464,8 @@ void plugin_run_hook(hook_point_t no, void *arg)
 
 	PLUGIN_ITERATOR(p, tmp) {
 		if (p->hook[no].cb) {
+			PROBE_AT(probe(hook_cond[no], p));
+
 			dbg("Calling %s hook n:o %d (arg: %p) ...", basenm(p->name), no, arg ?: "NIL");
 			p->hook[no].cb(arg ? arg : p->hook[no].arg);
 		}
@@ -289,6 +498,8 @@ static void generic_io_cb(uev_t *w, void *arg, int events)
 	plugin_t *p = (plugin_t *)arg;
 
 	if (is_io_plugin(p) && p->io.fd == w->fd) {
+		PROBE_AT(probe("io", p));
+
 		/* Stop watcher, callback may close descriptor on us ... */
 		uev_io_stop(w);
 
@@ -407,6 +618,225 @@ static void check_plugin_depends(plugin_t *plugin)
 	}
 }
 
+/*
+ * Plugins listed in the plugins.manifest of a plugin directory are not
+ * loaded at boot.  Each line names a plugin, the hook points it wants,
+ * and the condition prefixes it provides, e.g.
+ *
+ *     alsa-utils  hook/mount/all,hook/sys/shutdown  -  alsactl
+ *
+ * An optional fourth column is an absolute path, or a command in $PATH,
+ * that must exist for the plugin to be of any use.  The plugin is then
+ * loaded the first time one of its hook points is reached, or when a
+ * service references a condition with one of its prefixes.
+ */
+#define PLUGIN_MANIFEST "plugins.manifest"
+#define LAZY_COND_MAX   4
+
+struct lazy {
+	TAILQ_ENTRY(lazy) link;
+
+	int       present;	/* .so found in plugin directory */
+	char     *path;
+	char      name[32];
+	uint32_t  hooks;	/* Bitmask of hook_point_t */
+	char      conds[LAZY_COND_MAX][32];
+	char      needs[64];
+};
+
+static TAILQ_HEAD(, lazy) lazies = TAILQ_HEAD_INITIALIZER(lazies);
+
+static int hook_lookup(const char *name)
+{
+	int i;
+
+	/* Internal hooks, not exposed as conditions */
+	if (!strcmp(name, "action/svc/reconf"))
+		return HOOK_SVC_RECONF;
+	if (!strcmp(name, "action/sys/runlevel"))
+		return HOOK_RUNLEVEL_CHANGE;
+
+	for (i = 0; i < HOOK_MAX_NUM; i++) {
+		if (!strcmp(hook_cond[i], "nop"))
+			continue;
+		if (!strcmp(hook_cond[i], name))
+			return i;
+	}
+
+	return -1;
+}
+
+static void load_manifest(char *path)
+{
+	char fn[CMD_SIZE], line[LINE_SIZE];
+	int lineno = 0;
+	FILE *fp;
+
+	snprintf(fn, sizeof(fn), "%s/%s", path, PLUGIN_MANIFEST);
+	fp = fopen(fn, "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *name, *hooks, *conds, *needs, *tok;
+		struct lazy *l;
+		int i;
+
+		lineno++;
+		name = strtok(line, " \t\n");
+		if (!name || name[0] == '#')
+			continue;
+
+		hooks = strtok(NULL, " \t\n");
+		conds = strtok(NULL, " \t\n");
+		needs = strtok(NULL, " \t\n");
+		if (!hooks || !conds) {
+			warnx("%s:%d: missing hooks or conditions for %s", fn, lineno, name);
+			continue;
+		}
+
+		l = calloc(1, sizeof(*l));
+		if (!l || !(l->path = strdup(path))) {
+			warn("Failed allocating deferred plugin %s", name);
+			free(l);
+			break;
+		}
+		strlcpy(l->name, trim_ext(name), sizeof(l->name));
+		if (needs)
+			strlcpy(l->needs, needs, sizeof(l->needs));
+
+		if (strcmp(hooks, "-")) {
+			for (tok = strtok(hooks, ","); tok; tok = strtok(NULL, ",")) {
+				int no = hook_lookup(tok);
+
+				if (no < 0) {
+					warnx("%s:%d: unknown hook point %s", fn, lineno, tok);
+					continue;
+				}
+				l->hooks |= 1 << no;
+			}
+		}
+
+		if (strcmp(conds, "-")) {
+			for (i = 0, tok = strtok(conds, ","); tok; tok = strtok(NULL, ",")) {
+				if (i == LAZY_COND_MAX) {
+					warnx("%s:%d: too many condition prefixes", fn, lineno);
+					break;
+				}
+				strlcpy(l->conds[i++], tok, sizeof(l->conds[0]));
+			}
+		}
+
+		TAILQ_INSERT_TAIL(&lazies, l, link);
+	}
+
+	fclose(fp);
+}
+
+static void lazy_free(struct lazy *l)
+{
+	TAILQ_REMOVE(&lazies, l, link);
+	free(l->path);
+	free(l);
+}
+
+/* Called for each plugin found, returns non-zero if listed in the manifest */
+static int lazy_defer(char *path, char *file)
+{
+	char name[sizeof(((struct lazy *)0)->name)];
+	struct lazy *l;
+
+	strlcpy(name, file, sizeof(name));
+	trim_ext(name);
+
+	TAILQ_FOREACH(l, &lazies, link) {
+		if (strcmp(l->path, path) || strcmp(l->name, name))
+			continue;
+
+		dbg("Deferring plugin %s until referenced", name);
+		l->present = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Drop manifest entries for plugins that are not installed */
+static void lazy_prune(void)
+{
+	struct lazy *l, *tmp;
+
+	TAILQ_FOREACH_SAFE(l, &lazies, link, tmp) {
+		if (!l->present)
+			lazy_free(l);
+	}
+}
+
+static int lazy_needs(struct lazy *l)
+{
+	if (!l->needs[0])
+		return 1;
+	if (l->needs[0] == '/')
+		return fexist(l->needs);
+
+	return whichp(l->needs);
+}
+
+/*
+ * Load a deferred plugin, and any plugin it depends on, and set up
+ * I/O watchers for all plugins registered as a result.
+ */
+static void lazy_load(struct lazy *l, const char *why)
+{
+	plugin_t *p;
+
+	if (!plugin_find(l->name)) {
+		logit(LOG_INFO, "Loading plugin %s, referenced by %s", l->name, why);
+
+		p = TAILQ_LAST(&plugins, plugin_head);
+		if (!load_one(l->path, l->name)) {
+			for (p = p ? TAILQ_NEXT(p, link) : TAILQ_FIRST(&plugins); p; p = TAILQ_NEXT(p, link))
+				plugin_io_init(p);
+		}
+	}
+
+	lazy_free(l);
+}
+
+static void lazy_hook(hook_point_t no)
+{
+	struct lazy *l, *tmp;
+
+	TAILQ_FOREACH_SAFE(l, &lazies, link, tmp) {
+		if (!(l->hooks & (1 << no)) || !lazy_needs(l))
+			continue;
+
+		lazy_load(l, hook_cond[no]);
+	}
+}
+
+/*
+ * Called by the .conf parser for each condition a run/task/service
+ * depends on, loads any deferred plugin providing it.
+ */
+void plugin_want_cond(const char *cond)
+{
+	struct lazy *l, *tmp;
+	int i;
+
+	TAILQ_FOREACH_SAFE(l, &lazies, link, tmp) {
+		for (i = 0; i < LAZY_COND_MAX && l->conds[i][0]; i++) {
+			if (strncmp(cond, l->conds[i], strlen(l->conds[i])))
+				continue;
+			if (!lazy_needs(l))
+				break;
+
+			lazy_load(l, cond);
+			break;
+		}
+	}
+}
+
 static int load_plugins(char *path)
 {
 	struct dirent *entry;
@@ -421,16 +851,29 @@ static int load_plugins(char *path)
 		return 1;
 	}
 	plugpath = path;
+	load_manifest(path);
 
 	while ((entry = readdir(dp))) {
 		if (entry->d_name[0] == '.')
 			continue; /* Skip . and .. directories */
 
+		if (!strcmp(entry->d_name, PLUGIN_MANIFEST))
+			continue;
+
+		if (in_container() && is_host_only(entry->d_name)) {
+			dbg("Container, skipping %s plugin", entry->d_name);
+			continue;
+		}
+
+		if (lazy_defer(path, entry->d_name))
+			continue;
+
 		if (load_one(path, entry->d_name))
 			fail++;
 	}
 
 	closedir(dp);
+	lazy_prune();
 
 	return fail;
 }
@@ -440,6 +883,14 @@ static int load_plugins(char *path)
 	print_desc("Initializing plugins", NULL);
 	return 0;
 }
+
+static void lazy_hook(hook_point_t no)
+{
+}
+
+void plugin_want_cond(const char *cond)
+{
+}
 #endif	/* ENABLE_STATIC */
 
 int plugin_list(char *buf, size_t len)
@@ -459,6 +910,22 @@ int plugin_list(char *buf, size_t len)
 	return 0;
 }
 
+/* Number of registered plugins, and of those loaded with dlopen() */
+size_t plugin_footprint(size_t *handles)
+{
+	plugin_t *p, *tmp;
+	size_t num = 0;
+
+	*handles = 0;
+	PLUGIN_ITERATOR(p, tmp) {
+		if (p->handle)
+			(*handles)++;
+		num++;
+	}
+
+	return num;
+}
+
 int plugin_deps(char *buf, size_t len)
 {
 #ifndef ENABLE_STATIC
@@ -513,6 +980,9 @@ void plugin_exit(void)
 #ifndef ENABLE_STATIC
 	plugin_t *p, *tmp;
 
+	while (!TAILQ_EMPTY(&lazies))
+		lazy_free(TAILQ_FIRST(&lazies));
+
         PLUGIN_ITERATOR(p, tmp) {
                 if (dlclose(p->handle)) {
 			char *error = dlerror();
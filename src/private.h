@@ -43,6 +43,8 @@ extern char *fsck_repair;
 
 int          api_init         (uev_ctx_t *ctx);
 int          api_exit         (void);
+int          api_sd           (void);
+void         api_event        (int type, const char *name, int state, int prev, int pid);
 void         conf_flush_events(void);
 
 void         service_monitor  (pid_t lost, int status);
@@ -54,9 +56,13 @@ int          plugin_exists    (hook_point_t no);
 void         plugin_run_hook  (hook_point_t no, void *arg);
 void         plugin_run_hooks (hook_point_t no);
 void         plugin_script_run(hook_point_t no);
+int          plugin_script_done(pid_t pid, int status);
+int          plugin_script_conf(char *arg);
+void         plugin_want_cond (const char *cond);
 
 int          plugin_init      (uev_ctx_t *ctx);
 void         plugin_exit      (void);
+size_t       plugin_footprint (size_t *handles);
 
 #endif /* FINIT_PRIVATE_H_ */
 
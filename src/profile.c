@@ -0,0 +1,407 @@
+/* Boot profile, start order by critical path from previous boot timings
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Built with `configure --with-boot-profile[=FILE]`.  At system up the
+ * time from fork to ready of each service, or to completion of each
+ * run/task, started at bootstrap is saved to FILE.
+ *
+ * At the next bootstrap the critical path weight of each service is
+ * the time of the longest chain of services depending on it, by their
+ * pid/, service/, run/, or task/ conditions, including itself.  When
+ * several services are stepped in the same service_step_all() pass,
+ * they are stepped in order of descending weight, so the start of the
+ * longest dependency chains is not held up by services nothing waits
+ * for.  With equal weights, e.g. unknown services, the order of the
+ * .conf files is kept.
+ *
+ * The saved times are smoothed with those of the previous boot, and the
+ * file is only written when a time has changed significantly.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+
+#include "finit.h"
+#include "log.h"
+#include "profile.h"
+#include "util.h"
+
+#ifdef BOOT_PROFILE
+#define PROF_BUCKETS 64
+#define PROF_DELTA   10		/* Min change, in percent, to save */
+
+struct prof {
+	TAILQ_ENTRY(prof) link;
+	int  msec;
+	int  seen;		/* Still exists, see profile_save() */
+	char ident[];
+};
+
+static TAILQ_HEAD(, prof) prof_hash[PROF_BUCKETS];
+static int prof_loaded;
+static int prof_active;
+
+static struct prof *prof_find(const char *ident)
+{
+	struct prof *p;
+
+	TAILQ_FOREACH(p, &prof_hash[strhash(STRHASH_INIT, ident) % PROF_BUCKETS], link) {
+		if (!strcmp(p->ident, ident))
+			return p;
+	}
+
+	return NULL;
+}
+
+static struct prof *prof_add(const char *ident, int msec)
+{
+	struct prof *p;
+
+	p = malloc(sizeof(*p) + strlen(ident) + 1);
+	if (!p)
+		return NULL;
+
+	strcpy(p->ident, ident);
+	p->msec = msec;
+	p->seen = 0;
+	TAILQ_INSERT_TAIL(&prof_hash[strhash(STRHASH_INIT, ident) % PROF_BUCKETS], p, link);
+
+	return p;
+}
+
+static void prof_load(void)
+{
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int i;
+
+	for (i = 0; i < PROF_BUCKETS; i++)
+		TAILQ_INIT(&prof_hash[i]);
+	prof_loaded = 1;
+
+	fp = fopen(BOOT_PROFILE, "r");
+	if (!fp)
+		return;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *ident, *msec;
+
+		ident = strtok(chomp(line), "\t");
+		msec  = strtok(NULL, "\t");
+		if (!ident || !msec || ident[0] == '#')
+			continue;
+
+		if (!prof_find(ident))
+			prof_add(ident, atoi(msec));
+	}
+
+	free(line);
+	fclose(fp);
+}
+
+/**
+ * profile_apply - Calculate critical path weight of all services
+ *
+ * Called at the start of bootstrap, when all .conf files have been
+ * read, with the services' timings from the previous boot.
+ */
+void profile_apply(void)
+{
+	svc_t *svc, *iter = NULL;
+	int *dur, *weight;
+	int changed, n = 0;
+	svc_t **v;
+	int i, j;
+
+	if (rescue)
+		return;
+
+	prof_load();
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0))
+		n++;
+	if (!n)
+		return;
+
+	v      = calloc(n, sizeof(*v));
+	dur    = calloc(n, sizeof(*dur));
+	weight = calloc(n, sizeof(*weight));
+	if (!v || !dur || !weight)
+		goto done;
+
+	/* Index of each svc in v[], temporarily stored in svc->weight */
+	for (i = 0, svc = svc_iterator(&iter, 1); svc && i < n; svc = svc_iterator(&iter, 0), i++) {
+		struct prof *p;
+
+		p = prof_find(svc_ident(svc, NULL, 0));
+		v[i] = svc;
+		svc->weight = i;
+		dur[i] = weight[i] = p ? p->msec : 0;
+		if (p)
+			prof_active = 1;
+	}
+
+	if (!prof_active)
+		goto clear;
+
+	/*
+	 * Longest path, a provider's weight is its own time plus the
+	 * longest weight of any of its dependents.  Relax until stable,
+	 * at most n rounds, in case of circular dependencies.
+	 */
+	for (j = 0, changed = 1; changed && j < n; j++) {
+		changed = 0;
+
+		for (i = 0; i < n; i++) {
+			char cond[MAX_COND_LEN], *c, *ptr;
+
+			strlcpy(cond, v[i]->cond, sizeof(cond));
+			for (c = strtok_r(cond, ",", &ptr); c; c = strtok_r(NULL, ",", &ptr)) {
+				svc_t *prov = svc_find_provider(c);
+				int k;
+
+				if (!prov || prov == v[i])
+					continue;
+
+				k = prov->weight;
+				if (k < 0 || k >= n || v[k] != prov)
+					continue;
+
+				if (weight[k] < dur[k] + weight[i]) {
+					weight[k] = dur[k] + weight[i];
+					changed = 1;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		v[i]->weight = weight[i];
+		dbg("%s: critical path weight %d msec", svc_ident(v[i], NULL, 0), weight[i]);
+	}
+	goto done;
+clear:
+	for (i = 0; i < n; i++)
+		v[i]->weight = 0;
+done:
+	free(weight);
+	free(dur);
+	free(v);
+}
+
+static int prof_cmp(const void *a, const void *b)
+{
+	const svc_t *sa = *(const svc_t **)a;
+	const svc_t *sb = *(const svc_t **)b;
+
+	if (sa->weight != sb->weight)
+		return sb->weight - sa->weight;
+
+	/* Stable, keep .conf order, see profile_foreach_type() */
+	return sa->weight_pos - sb->weight_pos;
+}
+
+/**
+ * profile_foreach_type - Run a callback for each matching type, by weight
+ * @types: Mask of service types
+ * @cb:    Callback to run for each matching type
+ *
+ * Like svc_foreach_type(), but during bootstrap, with a boot profile,
+ * in order of descending critical path weight.
+ */
+void profile_foreach_type(int types, int (*cb)(svc_t *))
+{
+	svc_t *svc, *iter = NULL;
+	svc_t **v;
+	int i, n = 0;
+
+	if (!bootstrap || !prof_active)
+		goto fallback;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->type & types)
+			n++;
+	}
+
+	v = calloc(n ?: 1, sizeof(*v));
+	if (!v)
+		goto fallback;
+
+	for (i = 0, svc = svc_iterator(&iter, 1); svc && i < n; svc = svc_iterator(&iter, 0)) {
+		if (!(svc->type & types))
+			continue;
+
+		svc->weight_pos = i;
+		v[i++] = svc;
+	}
+	n = i;
+
+	qsort(v, n, sizeof(*v), prof_cmp);
+
+	/*
+	 * Removed services are not freed until their gc timer, so the
+	 * array is safe to use even if a callback removes a service.
+	 */
+	for (i = 0; i < n; i++)
+		cb(v[i]);
+
+	free(v);
+	return;
+fallback:
+	svc_foreach_type(types, cb);
+}
+
+static int prof_delta(int old, int msec)
+{
+	int diff = abs(old - msec);
+
+	return diff > 10 && diff * 100 > old * PROF_DELTA;
+}
+
+static void prof_write(char *buf, size_t len)
+{
+	char tmp[sizeof(BOOT_PROFILE) + 5];
+	char *dir;
+	FILE *fp;
+
+	dir = strdupa(BOOT_PROFILE);
+	*strrchr(dir, '/') = 0;
+	if (dir[0])
+		mkpath(dir, 0755);
+
+	snprintf(tmp, sizeof(tmp), "%s.new", BOOT_PROFILE);
+	fp = fopen(tmp, "w");
+	if (!fp)
+		goto fail;
+
+	if (fwrite(buf, len, 1, fp) != 1) {
+		fclose(fp);
+		goto fail;
+	}
+	if (fclose(fp) || rename(tmp, BOOT_PROFILE))
+		goto fail;
+
+	return;
+fail:
+	err(1, "Failed saving boot profile %s", BOOT_PROFILE);
+	remove(tmp);
+}
+
+/**
+ * profile_save - Save timings of all services started at bootstrap
+ *
+ * Called at system up, when bootstrap is done.
+ */
+void profile_save(void)
+{
+	svc_t *svc, *iter = NULL;
+	struct prof *p, *next;
+	int changed = 0;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int i;
+
+	if (rescue || !prof_loaded)
+		return;
+
+	fp = open_memstream(&buf, &len);
+	if (!fp) {
+		err(1, "Failed collecting boot profile");
+		goto done;
+	}
+
+	fprintf(fp, "# Boot profile, msec from fork to ready, or done, saved by finit at system up\n");
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		char ident[MAX_IDENT_LEN];
+		int msec;
+
+		if (svc->ready_msec <= 0)
+			continue;
+
+		svc_ident(svc, ident, sizeof(ident));
+		msec = svc->ready_msec;
+
+		p = prof_find(ident);
+		if (p) {
+			if (p->seen)
+				continue;
+			if (prof_delta(p->msec, msec))
+				changed = 1;
+			msec = (p->msec + msec) / 2;
+		} else {
+			p = prof_add(ident, msec);
+			if (!p)
+				continue;
+			changed = 1;
+		}
+
+		p->msec = msec;
+		p->seen = 1;
+		fprintf(fp, "%s\t%d\n", ident, msec);
+	}
+	fclose(fp);
+
+	/* Services no longer started at bootstrap */
+	for (i = 0; i < PROF_BUCKETS; i++) {
+		TAILQ_FOREACH(p, &prof_hash[i], link) {
+			if (!p->seen)
+				changed = 1;
+		}
+	}
+
+	if (buf && changed) {
+		dbg("Saving boot profile %s", BOOT_PROFILE);
+		prof_write(buf, len);
+	}
+	free(buf);
+done:
+	for (i = 0; i < PROF_BUCKETS; i++) {
+		TAILQ_FOREACH_SAFE(p, &prof_hash[i], link, next) {
+			TAILQ_REMOVE(&prof_hash[i], p, link);
+			free(p);
+		}
+	}
+	prof_loaded = 0;
+	prof_active = 0;
+}
+#endif /* BOOT_PROFILE */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
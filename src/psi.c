@@ -0,0 +1,272 @@
+/* Pressure stall information (PSI) triggers as conditions
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Each 'psi' line in /etc/finit.conf registers a kernel PSI trigger on
+ * a pressure file, system-wide or of a cgroup.  The kernel wakes us up,
+ * with POLLPRI, when the stall threshold is exceeded in a window:
+ *
+ *     psi memory                 psi/memory/some
+ *     psi io:full 200/1000       psi/io/full
+ *     psi memory cgroup.system   psi/system/memory/some
+ *
+ * The condition is asserted on each event and cleared when there has
+ * been no event in the hold time.  Conditions cannot be negated, so
+ * for services that should be stopped under pressure, psi/RES/ok is
+ * asserted while no trigger of that resource is active.
+ */
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+
+#include "finit.h"
+#include "cond.h"
+#include "helpers.h"
+#include "log.h"
+#include "metrics.h"
+#include "psi.h"
+#include "schedule.h"
+
+#define PSI_STALL   100		/* msec stalled ... */
+#define PSI_WINDOW  1000	/* ... in this window, kernel: 500 to 10000 */
+#define PSI_HOLD    10		/* sec without event before clearing */
+
+struct psi {
+	TAILQ_ENTRY(psi) link;
+	uev_t            watcher;
+	struct wq        hold;
+	int              hold_ms;
+	int              active;
+
+	char             path[256];	/* /proc/pressure/memory, or cgroup */
+	char             trigger[64];	/* "some 100000 1000000" */
+	char             cond[MAX_COND_LEN];	/* psi/[GROUP/]RES/KIND */
+	char             ok[MAX_COND_LEN];	/* psi/[GROUP/]RES/ok */
+};
+
+static TAILQ_HEAD(, psi) psi_list = TAILQ_HEAD_INITIALIZER(psi_list);
+
+/* Update psi/RES/ok for all triggers sharing it with @p */
+static void psi_ok(struct psi *p)
+{
+	struct psi *q;
+
+	TAILQ_FOREACH(q, &psi_list, link) {
+		if (q->active && !strcmp(q->ok, p->ok)) {
+			cond_clear(p->ok);
+			return;
+		}
+	}
+
+	cond_set_oneshot(p->ok);
+}
+
+static void psi_calm(void *arg)
+{
+	struct psi *p = (struct psi *)((struct wq *)arg)->arg;
+
+	dbg("%s: pressure subsided", p->cond);
+	p->active = 0;
+	cond_clear(p->cond);
+	psi_ok(p);
+}
+
+static void psi_cb(uev_t *w, void *arg, int events)
+{
+	struct psi *p = (struct psi *)arg;
+	PROBE("psi");
+
+	if (UEV_ERROR == events || !(events & UEV_PRI)) {
+		/* e.g. cgroup removed */
+		warnx("%s: lost PSI trigger on %s", p->cond, p->path);
+		uev_io_stop(w);
+		close(w->fd);
+		cancel_work(&p->hold);
+		p->active = 0;
+		cond_clear(p->cond);
+		psi_ok(p);
+		return;
+	}
+
+	if (!p->active) {
+		logit(LOG_NOTICE, "%s: pressure stall above threshold", p->cond);
+		p->active = 1;
+		cond_set_oneshot(p->cond);
+		psi_ok(p);
+	}
+
+	cancel_work(&p->hold);
+	schedule_work(&p->hold);
+}
+
+/**
+ * psi_add - Parse psi line from /etc/finit.conf
+ * @arg: RESOURCE[:some|full] [STALL/WINDOW] [hold:SEC] [cgroup.NAME]
+ *
+ * The trigger is registered later, by psi_init(), when cgroups exist.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on invalid syntax.
+ */
+int psi_add(char *arg)
+{
+	int stall = PSI_STALL, window = PSI_WINDOW, hold = PSI_HOLD;
+	char *res = NULL, *kind = "some", *group = NULL;
+	struct psi *p;
+	char *tok;
+
+	for (tok = strtok(arg, " \t"); tok; tok = strtok(NULL, " \t")) {
+		if (!strncmp(tok, "cgroup.", 7))
+			group = &tok[7];
+		else if (!strncmp(tok, "hold:", 5))
+			hold = atoi(&tok[5]);
+		else if (isdigit(tok[0])) {
+			char *ptr = strchr(tok, '/');
+
+			stall = atoi(tok);
+			if (ptr)
+				window = atoi(++ptr);
+		} else if (!res) {
+			res = tok;
+			tok = strchr(tok, ':');
+			if (tok) {
+				*tok++ = 0;
+				kind = tok;
+			}
+		}
+	}
+
+	if (!res || (strcmp(res, "memory") && strcmp(res, "cpu") && strcmp(res, "io")) ||
+	    (strcmp(kind, "some") && strcmp(kind, "full"))) {
+		logit(LOG_WARNING, "psi: invalid resource %s:%s", res ?: "", kind);
+		return 1;
+	}
+	if (window < 500 || window > 10000 || stall <= 0 || stall > window || hold <= 0) {
+		logit(LOG_WARNING, "psi: invalid %s:%s settings %d/%d hold:%d", res, kind, stall, window, hold);
+		return 1;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		err(1, "Failed allocating PSI trigger");
+		return 1;
+	}
+
+	if (group) {
+		snprintf(p->path, sizeof(p->path), "%s/%s/%s.pressure", FINIT_CGPATH, group, res);
+		snprintf(p->cond, sizeof(p->cond), "psi/%s/%s/%s", group, res, kind);
+		snprintf(p->ok, sizeof(p->ok), "psi/%s/%s/ok", group, res);
+	} else {
+		snprintf(p->path, sizeof(p->path), "/proc/pressure/%s", res);
+		snprintf(p->cond, sizeof(p->cond), "psi/%s/%s", res, kind);
+		snprintf(p->ok, sizeof(p->ok), "psi/%s/ok", res);
+	}
+	snprintf(p->trigger, sizeof(p->trigger), "%s %d %d", kind, stall * 1000, window * 1000);
+	p->hold_ms = hold * 1000;
+
+	TAILQ_INSERT_TAIL(&psi_list, p, link);
+
+	return 0;
+}
+
+/**
+ * psi_init - Register all PSI triggers from psi_add()
+ * @ctx: Event loop
+ *
+ * Returns:
+ * Number of triggers that failed.
+ */
+int psi_init(uev_ctx_t *ctx)
+{
+	struct psi *p;
+	int fail = 0;
+
+	TAILQ_FOREACH(p, &psi_list, link) {
+		int fd;
+
+		p->hold.cb    = psi_calm;
+		p->hold.arg   = p;
+		p->hold.delay = p->hold_ms;
+
+		fd = open(p->path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd == -1) {
+			warn("Cannot open %s for PSI trigger", p->path);
+			fail++;
+			continue;
+		}
+
+		if (write(fd, p->trigger, strlen(p->trigger) + 1) < 0) {
+			warn("Failed setting PSI trigger '%s' on %s", p->trigger, p->path);
+			close(fd);
+			fail++;
+			continue;
+		}
+
+		if (uev_io_init(ctx, &p->watcher, psi_cb, p, fd, UEV_PRI)) {
+			warn("Failed watching PSI trigger on %s", p->path);
+			close(fd);
+			fail++;
+			continue;
+		}
+
+		dbg("PSI trigger '%s' on %s, condition %s", p->trigger, p->path, p->cond);
+		cond_set_oneshot(p->ok);
+	}
+
+	return fail;
+}
+
+/* Unregister all triggers, the kernel drops them when closed */
+void psi_exit(void)
+{
+	struct psi *p, *tmp;
+
+	TAILQ_FOREACH_SAFE(p, &psi_list, link, tmp) {
+		TAILQ_REMOVE(&psi_list, p, link);
+		cancel_work(&p->hold);
+		if (p->watcher.fd > 0) {
+			uev_io_stop(&p->watcher);
+			close(p->watcher.fd);
+		}
+		free(p);
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,269 @@
+/* Power supply state, tracked per supply from kernel uevents
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+
+#include "pwr.h"
+
+#define _PATH_SYSFS_PWR  "/sys/class/power_supply"
+
+/*
+ * Only AC type supplies are tracked, the sys/pwr/ac condition is
+ * asserted if either of them is online, or if none can be found.
+ * The latter is what systemd does (ConditionACPower) and also makes
+ * most sense.  Supplies are identified by POWER_SUPPLY_NAME, which
+ * is the same as the directory name in /sys/class/power_supply/
+ */
+struct pwr_supply {
+	TAILQ_ENTRY(pwr_supply) link;
+	int  online;
+	char name[64];
+};
+
+static TAILQ_HEAD(, pwr_supply) supplies = TAILQ_HEAD_INITIALIZER(supplies);
+static int last = -1;		/* last returned by pwr_online() */
+
+static int fgetline(char *path, char *buf, size_t len)
+{
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	if (!fgets(buf, len, fp)) {
+		fclose(fp);
+		return -1;
+	}
+
+	chomp(buf);
+	fclose(fp);
+
+	return 0;
+}
+
+static int is_ac(char *type)
+{
+	char *types[] = {
+		"Mains",
+		"USB",
+		"BrickID",
+		"Wireless",
+		NULL
+	};
+	int i;
+
+	for (i = 0; types[i]; i++) {
+		if (!strncmp(type, types[i], strlen(types[i])))
+			return 1;
+	}
+
+	return 0;
+}
+
+static struct pwr_supply *pwr_find(const char *name)
+{
+	struct pwr_supply *p;
+
+	TAILQ_FOREACH(p, &supplies, link) {
+		if (!strcmp(p->name, name))
+			return p;
+	}
+
+	return NULL;
+}
+
+static void pwr_set(const char *name, int online)
+{
+	struct pwr_supply *p;
+
+	p = pwr_find(name);
+	if (!p) {
+		p = calloc(1, sizeof(*p));
+		if (!p)
+			return;
+
+		strlcpy(p->name, name, sizeof(p->name));
+		TAILQ_INSERT_TAIL(&supplies, p, link);
+	}
+
+	p->online = online;
+}
+
+static void pwr_del(const char *name)
+{
+	struct pwr_supply *p;
+
+	p = pwr_find(name);
+	if (!p)
+		return;
+
+	TAILQ_REMOVE(&supplies, p, link);
+	free(p);
+}
+
+/*
+ * Returns 1 if any AC supply is online, or if none can be found.
+ */
+int pwr_online(void)
+{
+	struct pwr_supply *p;
+
+	if (TAILQ_EMPTY(&supplies))
+		return 1;
+
+	TAILQ_FOREACH(p, &supplies, link) {
+		if (p->online)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Returns 1 if pwr_online() changed since last call */
+static int pwr_changed(void)
+{
+	int now = pwr_online();
+
+	if (now == last)
+		return 0;
+	last = now;
+
+	return 1;
+}
+
+/**
+ * pwr_scan - Read state of all power supplies from sysfs
+ *
+ * Called at startup, and to resynchronize after lost uevents, e.g.,
+ * on ENOBUFS.  Any previous state is discarded.
+ *
+ * Returns:
+ * 1 if pwr_online() changed, or on first call, otherwise 0.
+ */
+int pwr_scan(void)
+{
+	struct dirent **d = NULL;
+	char path[384];
+	int i, n;
+
+	pwr_exit();
+
+	n = scandir(_PATH_SYSFS_PWR, &d, NULL, alphasort);
+	for (i = 0; i < n; i++) {
+		char *nm = d[i]->d_name;
+		char buf[10];
+
+		snprintf(path, sizeof(path), "%s/%s/type", _PATH_SYSFS_PWR, nm);
+		if (!fgetline(path, buf, sizeof(buf)) && is_ac(buf)) {
+			int online = 0;
+
+			snprintf(path, sizeof(path), "%s/%s/online", _PATH_SYSFS_PWR, nm);
+			if (!fgetline(path, buf, sizeof(buf)))
+				online = atoi(buf);
+			pwr_set(nm, online);
+		}
+		free(d[i]);
+	}
+
+	if (n > 0)
+		free(d);
+
+	return pwr_changed();
+}
+
+/**
+ * pwr_uevent - Update state from a kernel uevent
+ * @buf: NUL terminated uevent message, NUL separated KEY=VALUE lines
+ * @len: length of message
+ *
+ * Handles add, change, and remove of power_supply devices, all other
+ * uevents are ignored.  This instead of rescanning sysfs on changes.
+ *
+ * Returns:
+ * 1 if pwr_online() changed, otherwise 0.
+ */
+int pwr_uevent(char *buf, size_t len)
+{
+	char *action = NULL, *subsys = NULL, *name = NULL;
+	char *type = NULL, *online = NULL;
+	size_t i = 0;
+
+	while (i < len) {
+		char *line = buf + i;
+
+		if (!strncmp(line, "ACTION=", 7))
+			action = &line[7];
+		else if (!strncmp(line, "SUBSYSTEM=", 10))
+			subsys = &line[10];
+		else if (!strncmp(line, "POWER_SUPPLY_NAME=", 18))
+			name = &line[18];
+		else if (!strncmp(line, "POWER_SUPPLY_TYPE=", 18))
+			type = &line[18];
+		else if (!strncmp(line, "POWER_SUPPLY_ONLINE=", 20))
+			online = &line[20];
+
+		i += strlen(line) + 1;
+	}
+
+	if (!action || !subsys || !name || strcmp(subsys, "power_supply"))
+		return 0;
+
+	if (!strcmp(action, "remove"))
+		pwr_del(name);
+	else if (type ? !is_ac(type) : !pwr_find(name))
+		return 0;
+	else if (online)
+		pwr_set(name, atoi(online));
+	else if (!pwr_find(name))
+		pwr_set(name, 0);
+
+	return pwr_changed();
+}
+
+void pwr_exit(void)
+{
+	struct pwr_supply *p, *tmp;
+
+	TAILQ_FOREACH_SAFE(p, &supplies, link, tmp) {
+		TAILQ_REMOVE(&supplies, p, link);
+		free(p);
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
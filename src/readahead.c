@@ -0,0 +1,526 @@
+/* Readahead of service binaries and libraries from the previous boot
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Built with `configure --with-readahead[=FILE]`.  At system up, when
+ * bootstrap is done, the files mapped by each service started during
+ * bootstrap are saved to FILE, in the order the services were started.
+ * Found in /proc/PID/maps for services still running, or for tasks and
+ * services that have already exited, their command and its DT_NEEDED
+ * libraries.  At next boot, as soon as all filesystems are mounted, a
+ * helper thread reads the files into the page cache before any service
+ * is started, in the same order.
+ *
+ * The file is only written when its content has changed, so on a stable
+ * system it is written once.  To start over, remove the file.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <link.h>		/* ElfW() */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+
+#include "finit.h"
+#include "log.h"
+#include "readahead.h"
+#include "util.h"
+
+#ifdef READAHEAD_FILE
+#define RA_BUCKETS 256
+#define RA_DIRS    16
+
+#if UINTPTR_MAX > 0xffffffff
+#define RA_ELFCLASS ELFCLASS64
+#else
+#define RA_ELFCLASS ELFCLASS32
+#endif
+
+struct ra_svc {
+	TAILQ_ENTRY(ra_svc) link;
+	char *ident;
+	char *cmd;
+};
+
+struct ra_file {
+	TAILQ_ENTRY(ra_file) hash;
+	char path[];
+};
+
+static TAILQ_HEAD(, ra_svc)  ra_svcs = TAILQ_HEAD_INITIALIZER(ra_svcs);
+static TAILQ_HEAD(, ra_file) ra_files[RA_BUCKETS];
+
+static char *ra_dirs[RA_DIRS];		/* Library search path */
+static int   ra_num_dirs;
+
+static pthread_t ra_tid;
+static int       ra_running;
+static int       ra_count;		/* Set by thread, read after join */
+static long long ra_bytes;
+
+/*
+ * Runs in a helper thread, in parallel with .conf parsing and the start
+ * of the first services, so must not touch any state of the main thread.
+ * Not even logging, the result is logged when joining the thread.
+ */
+static void *ra_thread(void *arg)
+{
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = fopen(READAHEAD_FILE, "r");
+	if (!fp)
+		return NULL;
+
+	while (getline(&line, &len, fp) != -1) {
+		struct stat st;
+		int fd;
+
+		chomp(line);
+		if (line[0] != '/')
+			continue;
+
+		fd = open(line, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+		if (fd == -1)
+			continue;
+
+		if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+			if (readahead(fd, 0, st.st_size))
+				posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+			ra_bytes += st.st_size;
+			ra_count++;
+		}
+		close(fd);
+	}
+
+	free(line);
+	fclose(fp);
+
+	return NULL;
+}
+
+/**
+ * readahead_start - Start reading files from the previous boot
+ *
+ * Called when all filesystems have been mounted, before the first
+ * service is started.
+ */
+void readahead_start(void)
+{
+	if (rescue || !fexist(READAHEAD_FILE))
+		return;
+
+	if (pthread_create(&ra_tid, NULL, ra_thread, NULL)) {
+		warn("Failed starting readahead thread");
+		return;
+	}
+	ra_running = 1;
+}
+
+/**
+ * readahead_record - Record start of a service during bootstrap
+ * @svc: Service, task, or run command being started
+ *
+ * All files of @svc are collected in readahead_save(), at system up.
+ */
+void readahead_record(svc_t *svc)
+{
+	char ident[MAX_IDENT_LEN];
+	struct ra_svc *rs;
+
+	rs = calloc(1, sizeof(*rs));
+	if (!rs)
+		return;
+
+	rs->ident = strdup(svc_ident(svc, ident, sizeof(ident)));
+	rs->cmd   = strdup(svc->cmd);
+	if (!rs->ident || !rs->cmd) {
+		free(rs->ident);
+		free(rs->cmd);
+		free(rs);
+		return;
+	}
+
+	TAILQ_INSERT_TAIL(&ra_svcs, rs, link);
+}
+
+static int ra_add(FILE *fp, const char *path)
+{
+	struct ra_file *rf;
+	struct stat st;
+	unsigned int h;
+
+	h = strhash(STRHASH_INIT, path) % RA_BUCKETS;
+	TAILQ_FOREACH(rf, &ra_files[h], hash) {
+		if (!strcmp(rf->path, path))
+			return 0;
+	}
+
+	if (stat(path, &st) || !S_ISREG(st.st_mode))
+		return 0;
+
+	rf = malloc(sizeof(*rf) + strlen(path) + 1);
+	if (!rf)
+		return 0;
+	strcpy(rf->path, path);
+	TAILQ_INSERT_TAIL(&ra_files[h], rf, hash);
+
+	fprintf(fp, "%s\n", path);
+	return 1;
+}
+
+static void ra_add_dir(const char *dir)
+{
+	int i;
+
+	for (i = 0; i < ra_num_dirs; i++) {
+		if (!strcmp(ra_dirs[i], dir))
+			return;
+	}
+
+	if (ra_num_dirs < RA_DIRS && (ra_dirs[ra_num_dirs] = strdup(dir)))
+		ra_num_dirs++;
+}
+
+/*
+ * Mapped files of a running process, the binary, its libraries, and
+ * any other file it has mapped, e.g., locale archives.
+ */
+static int ra_maps(FILE *fp, pid_t pid, int dirs)
+{
+	char file[32], line[PATH_MAX + 128];
+	FILE *maps;
+	int num = 0;
+
+	snprintf(file, sizeof(file), "/proc/%d/maps", pid);
+	maps = fopen(file, "r");
+	if (!maps)
+		return -1;
+
+	while (fgets(line, sizeof(line), maps)) {
+		unsigned long inode;
+		char *path, *ptr;
+		int pos = 0;
+
+		if (sscanf(line, "%*s %*s %*s %*s %lu %n", &inode, &pos) < 1 || !inode || !pos)
+			continue;
+
+		path = chomp(&line[pos]);
+		if (path[0] != '/' || strstr(path, " (deleted)"))
+			continue;
+
+		if (dirs) {
+			ptr = strrchr(path, '/');
+			if (ptr && strstr(ptr, ".so")) {
+				*ptr = 0;
+				ra_add_dir(path);
+			}
+			continue;
+		}
+
+		num += ra_add(fp, path);
+	}
+	fclose(maps);
+
+	return num;
+}
+
+static void ra_needed(FILE *fp, const char *lib)
+{
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; i < ra_num_dirs; i++) {
+		paste(path, sizeof(path), ra_dirs[i], lib);
+		if (fexist(path)) {
+			ra_add(fp, path);
+			return;
+		}
+	}
+}
+
+/* Map an address in the ELF image to an offset in the file */
+static ElfW(Off) ra_offset(ElfW(Phdr) *ph, int num, ElfW(Addr) addr)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (ph[i].p_type != PT_LOAD)
+			continue;
+		if (addr >= ph[i].p_vaddr && addr < ph[i].p_vaddr + ph[i].p_filesz)
+			return addr - ph[i].p_vaddr + ph[i].p_offset;
+	}
+
+	return 0;
+}
+
+/*
+ * Fallback for tasks and services that have already exited: the ELF
+ * interpreter and DT_NEEDED libraries of the binary.  Only libraries
+ * needed by the binary itself, not their dependencies in turn, those
+ * are usually already in the cache from the other services.
+ */
+static void ra_elf(FILE *fp, const char *file)
+{
+	ElfW(Dyn) *dyn = NULL;
+	ElfW(Ehdr) *eh;
+	ElfW(Phdr) *ph;
+	ElfW(Off) strtab = 0;
+	size_t ndyn = 0;
+	struct stat st;
+	uint8_t *map;
+	int fd, i;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*eh)) {
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	eh = (ElfW(Ehdr) *)map;
+	if (memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != RA_ELFCLASS)
+		goto done;
+	if (eh->e_phoff + (size_t)eh->e_phnum * sizeof(*ph) > (size_t)st.st_size)
+		goto done;
+
+	ph = (ElfW(Phdr) *)(map + eh->e_phoff);
+	for (i = 0; i < eh->e_phnum; i++) {
+		if (ph[i].p_offset + ph[i].p_filesz > (size_t)st.st_size)
+			continue;
+
+		if (ph[i].p_type == PT_INTERP) {
+			char interp[PATH_MAX];
+
+			strlcpy(interp, (char *)map + ph[i].p_offset, MIN(sizeof(interp), ph[i].p_filesz));
+			ra_add(fp, interp);
+		} else if (ph[i].p_type == PT_DYNAMIC) {
+			dyn  = (ElfW(Dyn) *)(map + ph[i].p_offset);
+			ndyn = ph[i].p_filesz / sizeof(*dyn);
+		}
+	}
+
+	if (!dyn)
+		goto done;
+
+	for (i = 0; i < (int)ndyn && dyn[i].d_tag != DT_NULL; i++) {
+		if (dyn[i].d_tag == DT_STRTAB)
+			strtab = ra_offset(ph, eh->e_phnum, dyn[i].d_un.d_ptr);
+	}
+	if (!strtab)
+		goto done;
+
+	for (i = 0; i < (int)ndyn && dyn[i].d_tag != DT_NULL; i++) {
+		const char *lib;
+
+		if (dyn[i].d_tag != DT_NEEDED)
+			continue;
+		if (strtab + dyn[i].d_un.d_val >= (size_t)st.st_size)
+			continue;
+
+		lib = (char *)map + strtab + dyn[i].d_un.d_val;
+		if (!memchr(lib, 0, st.st_size - (strtab + dyn[i].d_un.d_val)))
+			continue;
+
+		if (strchr(lib, '/'))
+			ra_add(fp, lib);
+		else
+			ra_needed(fp, lib);
+	}
+done:
+	munmap(map, st.st_size);
+}
+
+static int ra_changed(char *buf, size_t len)
+{
+	struct stat st;
+	int changed = 1;
+	char *old;
+	FILE *fp;
+
+	if (stat(READAHEAD_FILE, &st) || (size_t)st.st_size != len)
+		return 1;
+
+	fp = fopen(READAHEAD_FILE, "r");
+	if (!fp)
+		return 1;
+
+	old = malloc(len);
+	if (old && fread(old, len, 1, fp) == 1)
+		changed = memcmp(old, buf, len) != 0;
+	free(old);
+	fclose(fp);
+
+	return changed;
+}
+
+static void ra_write(char *buf, size_t len)
+{
+	char tmp[sizeof(READAHEAD_FILE) + 5];
+	char *dir;
+	FILE *fp;
+
+	dir = strdupa(READAHEAD_FILE);
+	*strrchr(dir, '/') = 0;
+	if (dir[0])
+		mkpath(dir, 0755);
+
+	snprintf(tmp, sizeof(tmp), "%s.new", READAHEAD_FILE);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		err(1, "Failed saving readahead list %s", READAHEAD_FILE);
+		return;
+	}
+
+	if (fwrite(buf, len, 1, fp) != 1 || fclose(fp)) {
+		err(1, "Failed saving readahead list %s", READAHEAD_FILE);
+		remove(tmp);
+		return;
+	}
+
+	if (rename(tmp, READAHEAD_FILE)) {
+		err(1, "Failed saving readahead list %s", READAHEAD_FILE);
+		remove(tmp);
+	}
+}
+
+static void ra_free(void)
+{
+	struct ra_file *rf, *nf;
+	struct ra_svc *rs, *ns;
+	int i;
+
+	TAILQ_FOREACH_SAFE(rs, &ra_svcs, link, ns) {
+		TAILQ_REMOVE(&ra_svcs, rs, link);
+		free(rs->ident);
+		free(rs->cmd);
+		free(rs);
+	}
+
+	for (i = 0; i < RA_BUCKETS; i++) {
+		TAILQ_FOREACH_SAFE(rf, &ra_files[i], hash, nf) {
+			TAILQ_REMOVE(&ra_files[i], rf, hash);
+			free(rf);
+		}
+	}
+
+	while (ra_num_dirs > 0)
+		free(ra_dirs[--ra_num_dirs]);
+}
+
+/**
+ * readahead_save - Save files of all services started at bootstrap
+ *
+ * Called at system up, when bootstrap is done.  Also joins the helper
+ * thread from readahead_start(), which is long done by now.
+ */
+void readahead_save(void)
+{
+	struct ra_svc *rs;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int i;
+
+	if (ra_running) {
+		pthread_join(ra_tid, NULL);
+		ra_running = 0;
+		dbg("Readahead of %d files, %lld kiB, done.", ra_count, ra_bytes / 1024);
+	}
+
+	if (rescue || TAILQ_EMPTY(&ra_svcs))
+		goto done;
+
+	for (i = 0; i < RA_BUCKETS; i++)
+		TAILQ_INIT(&ra_files[i]);
+
+	/* Library path, from where our own libraries were found */
+	ra_maps(NULL, getpid(), 1);
+	ra_add_dir("/lib");
+	ra_add_dir("/usr/lib");
+	ra_add_dir("/lib64");
+	ra_add_dir("/usr/lib64");
+
+	fp = open_memstream(&buf, &len);
+	if (!fp) {
+		err(1, "Failed collecting readahead list");
+		goto done;
+	}
+
+	fprintf(fp, "# Files read ahead at boot, saved by finit at system up\n");
+	TAILQ_FOREACH(rs, &ra_svcs, link) {
+		svc_t *svc = svc_find_by_str(rs->ident);
+		char *path;
+
+		fprintf(fp, "# %s\n", rs->ident);
+		if (svc && svc->pid > 1 && ra_maps(fp, svc->pid, 0) > 0)
+			continue;
+
+		path = which(rs->cmd);
+		if (!path)
+			continue;
+
+		ra_add(fp, path);
+		ra_elf(fp, path);
+		free(path);
+	}
+	fclose(fp);
+
+	if (buf && ra_changed(buf, len)) {
+		dbg("Saving readahead list %s", READAHEAD_FILE);
+		ra_write(buf, len);
+	}
+	free(buf);
+done:
+	ra_free();
+}
+#endif /* READAHEAD_FILE */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
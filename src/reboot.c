@@ -44,6 +44,7 @@ static char *msg = NULL;
 
 /* initctl API */
 extern int timeout;
+extern int kexec;
 
 extern int do_reboot  (char *arg);
 extern int do_halt    (char *arg);
@@ -109,6 +110,7 @@ static int usage(int rc)
 		"  -f, --force        Force unsafe %s now, do not contact the init system.\n"
 		"      --halt         Halt system, regardless of how the command is called.\n"
 		"  -h                 Halt or power off after shutdown.\n"
+		"  -k, --kexec        Reboot with kexec, if a kernel has been loaded.\n"
 		"  -P, --poweroff     Power-off system, regardless of how the command is called.\n"
 		"  -r, --reboot       Reboot system, regardless of how the command is called.\n"
 		"  -t, --timeout=SEC  Force reboot/shutdown after a given timeout\n"
@@ -123,6 +125,7 @@ int reboot_main(int argc, char *argv[])
 		{"help",     0, NULL, '?'},
 		{"force",    0, NULL, 'f'},
 		{"halt",     0, NULL, 'H'},
+		{"kexec",    0, NULL, 'k'},
 		{"poweroff", 0, NULL, 'p'},
 		{"reboot",   0, NULL, 'r'},
 		{"timeout",  1, NULL, 't'},
@@ -134,7 +137,7 @@ int reboot_main(int argc, char *argv[])
 	/* Initial command taken from program name */
 	transform(prognm);
 
-	while ((c = getopt_long(argc, argv, "h?fHPprt:", long_options, NULL)) != EOF) {
+	while ((c = getopt_long(argc, argv, "h?fHkPprt:", long_options, NULL)) != EOF) {
 		switch(c) {
 		case '?':
 			return usage(0);
@@ -147,6 +150,11 @@ int reboot_main(int argc, char *argv[])
 			cmd = CMD_HALT;
 			break;
 
+		case 'k':
+			kexec = 1;
+			cmd = CMD_REBOOT;
+			break;
+
 		case 'h':
 		case 'P':
 		case 'p':
@@ -181,6 +189,8 @@ int reboot_main(int argc, char *argv[])
 
 		switch (cmd) {
 		case CMD_REBOOT:
+			if (kexec)
+				reboot(RB_KEXEC); /* returns if nothing loaded */
 			c = reboot(RB_AUTOBOOT);
 			break;
 
@@ -0,0 +1,661 @@
+/* Stateful re-exec of Finit, for in-place upgrades without reboot
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * `initctl reexec` replaces the running PID 1 with a new finit binary,
+ * e.g., after a package upgrade, without restarting any services.  The
+ * runtime state that cannot be recreated from .conf files is written to
+ * a memfd, inherited across execv() along with the initctl API socket,
+ * the readiness notification and listen: sockets of services, and the
+ * pipes of the built-in logger:
+ *
+ *     struct reexec_hdr
+ *     struct reexec_rec, one per service with state worth keeping
+ *     struct logger_rec, one per running logger
+ *
+ * The new finit skips fsck, mounting, and bootstrap, reads its .conf
+ * files as usual and then adopts the PIDs, states, and counters of the
+ * services from the snapshot.  Conditions, including their generation,
+ * and cgroups live in the file system, so they are already in place.
+ *
+ * To keep this simple we only re-exec when the system is settled, i.e.,
+ * not while changing runlevel or reloading, and when no service is in a
+ * transient state, with a pre:/post: script or kill timer running.
+ */
+
+#include "config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+#else
+# include <lite/lite.h>
+#endif
+
+#include "finit.h"
+#include "conout.h"
+#include "helpers.h"
+#include "listen.h"
+#include "log.h"
+#include "logger.h"
+#include "notify.h"
+#include "private.h"
+#include "reexec.h"
+#include "service.h"
+#include "sm.h"
+#include "svc.h"
+#include "util.h"
+
+#define REEXEC_ENV     "FINIT_REEXEC"
+#define REEXEC_MAGIC   "FINITRXC"
+#define REEXEC_VERSION 1
+
+struct reexec_hdr {
+	char     magic[8];
+	uint32_t version;
+	uint32_t count;		/* number of records */
+	int32_t  runlevel;
+	int32_t  prevlevel;
+	int32_t  cfglevel;
+	int32_t  api;		/* inherited API socket, -1: none */
+	int32_t  notify;	/* inherited shared notify socket, -1: none */
+	uint32_t loggers;	/* number of logger records, after services */
+};
+
+struct reexec_rec {
+	char     name[MAX_ARG_LEN];
+	char     id[MAX_ID_LEN];
+	int32_t  pid;
+	int32_t  notify;	/* inherited notify socket, -1: none */
+	int32_t  sockets[LISTEN_MAX]; /* inherited listen: sockets, -1: none */
+	int32_t  status;
+	int32_t  ready_msec;
+	int64_t  start_time;
+	int64_t  forked_at;
+	uint32_t restart_tot;
+	uint32_t oom_tot;
+	uint8_t  state;
+	uint8_t  block;
+	uint8_t  started;
+	uint8_t  once;
+	uint8_t  restart_cnt;
+	uint8_t  activated;
+};
+
+static char             **args;	/* from main(), for execv() */
+static struct reexec_hdr *hdr;	/* snapshot from previous finit */
+static int                api = -1;
+static int                lost;	/* re-executed, but no usable snapshot */
+static struct logger_rec *logs;	/* saved loggers, for handover() */
+static int                nlogs;
+
+
+static int keep_fd(int fd, int keep)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFD);
+	if (flags == -1)
+		return -1;
+
+	if (keep)
+		flags &= ~FD_CLOEXEC;
+	else
+		flags |= FD_CLOEXEC;
+
+	return fcntl(fd, F_SETFD, flags);
+}
+
+/*
+ * Not all descriptors in Finit are opened with O_CLOEXEC, plugins in
+ * particular, so mark all of them, except stdio, before the handful we
+ * hand over to the new finit are unmarked.
+ */
+static void cloexec_all(void)
+{
+	struct dirent *d;
+	DIR *dir;
+
+	dir = opendir("/proc/self/fd");
+	if (!dir)
+		return;
+
+	while ((d = readdir(dir))) {
+		int fd = atoi(d->d_name);
+
+		if (fd > STDERR_FILENO && fd != dirfd(dir))
+			keep_fd(fd, 0);
+	}
+	closedir(dir);
+}
+
+static int notify_fd(svc_t *svc)
+{
+	if (svc->notify_watcher.fd > 0)
+		return svc->notify_watcher.fd;
+
+	return -1;
+}
+
+/* The memfd does not outlive us, fall back to a tmpfile on old kernels */
+static int state_open(void)
+{
+	int fd;
+
+	fd = memfd_create("finit-state", 0);
+	if (fd == -1)
+		fd = open(_PATH_VARRUN "finit", O_TMPFILE | O_RDWR, 0600);
+
+	return fd;
+}
+
+static int save(int fd)
+{
+	struct reexec_hdr h = {
+		.magic     = REEXEC_MAGIC,
+		.version   = REEXEC_VERSION,
+		.runlevel  = runlevel,
+		.prevlevel = prevlevel,
+		.cfglevel  = cfglevel,
+		.api       = api_sd(),
+		.notify    = notify_sd(),
+	};
+	svc_t *svc, *iter = NULL;
+	int i;
+
+	if (write(fd, &h, sizeof(h)) != sizeof(h))
+		return -1;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		struct reexec_rec rec = {
+			.pid         = svc->pid,
+			.notify      = notify_fd(svc),
+			.status      = svc->status,
+			.ready_msec  = svc->ready_msec,
+			.start_time  = svc->start_time,
+			.forked_at   = svc->forked_at,
+			.restart_tot = svc->restart_tot,
+			.oom_tot     = svc->oom_tot,
+			.state       = svc->state,
+			.block       = svc->block,
+			.started     = svc->started,
+			.once        = svc->once,
+			.restart_cnt = svc->restart_cnt,
+			.activated   = svc->activated,
+		};
+		int lfd[LISTEN_MAX];
+		int num;
+
+		num = listen_fds(svc, lfd);
+		for (i = 0; i < LISTEN_MAX; i++)
+			rec.sockets[i] = i < num ? lfd[i] : -1;
+
+		strlcpy(rec.name, svc->name, sizeof(rec.name));
+		strlcpy(rec.id, svc->id, sizeof(rec.id));
+		if (write(fd, &rec, sizeof(rec)) != sizeof(rec))
+			return -1;
+		h.count++;
+	}
+
+	nlogs = logger_save(&logs);
+	if (nlogs < 0)
+		return -1;
+	for (i = 0; i < nlogs; i++) {
+		if (write(fd, &logs[i], sizeof(logs[i])) != sizeof(logs[i]))
+			return -1;
+	}
+	h.loggers = nlogs;
+
+	if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+		return -1;
+
+	return lseek(fd, 0, SEEK_SET) == -1 ? -1 : 0;
+}
+
+/* Inherited descriptors, mark or unmark them all */
+static void handover(int fd, int keep)
+{
+	svc_t *svc, *iter = NULL;
+	int i;
+
+	keep_fd(fd, keep);
+	if (api_sd() > 0)
+		keep_fd(api_sd(), keep);
+	if (notify_sd() > 0)
+		keep_fd(notify_sd(), keep);
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		int sd = notify_fd(svc);
+		int lfd[LISTEN_MAX];
+		int num;
+
+		if (sd > 0)
+			keep_fd(sd, keep);
+
+		num = listen_fds(svc, lfd);
+		for (i = 0; i < num; i++)
+			keep_fd(lfd[i], keep);
+	}
+
+	for (i = 0; i < nlogs; i++)
+		keep_fd(logs[i].fd, keep);
+}
+
+/*
+ * The path to our binary, which after an upgrade is the new binary.
+ * The kernel appends " (deleted)" to the link when it's been replaced.
+ */
+static char *self(char *path, size_t len)
+{
+	ssize_t n;
+	char *ptr;
+
+	n = readlink("/proc/self/exe", path, len - 1);
+	if (n <= 0)
+		return args ? args[0] : NULL;
+	path[n] = 0;
+
+	ptr = strstr(path, " (deleted)");
+	if (ptr && !ptr[10])
+		*ptr = 0;
+
+	return path;
+}
+
+/**
+ * reexec_busy - Check if Finit can re-exec now
+ *
+ * Timers, e.g. a delayed restart, and instability index aging, are not
+ * saved, so a service with any of them pending is also busy.
+ *
+ * Returns:
+ * %TRUE(1) while changing runlevel, reloading, or while any service is
+ * in a transient state, otherwise %FALSE(0).
+ */
+int reexec_busy(void)
+{
+	svc_t *svc, *iter = NULL;
+
+	if (sm.state != SM_RUNNING_STATE || sm.newlevel != -1 || sm.reload)
+		return 1;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc_is_restart(svc) || svc->timer_cb ||
+		    work_pending(&svc->aging) || work_pending(&svc->path_work)) {
+			dbg("%s is busy, %s", svc_ident(svc, NULL, 0), svc_status(svc));
+			return 1;
+		}
+
+		switch (svc->state) {
+		case SVC_STOPPING_STATE:
+		case SVC_CLEANUP_STATE:
+		case SVC_SETUP_STATE:
+		case SVC_STARTING_STATE:
+			dbg("%s is busy, state %s", svc_ident(svc, NULL, 0), svc_status(svc));
+			return 1;
+
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * reexec - Save runtime state and replace PID 1 with a new finit
+ *
+ * Only returns on error, with Finit still fully operational.
+ */
+void reexec(void)
+{
+	char path[256], val[12], *cmd;
+	int fd;
+
+	if (reexec_busy()) {
+		logit(LOG_WARNING, "System busy, cannot re-exec now.");
+		return;
+	}
+
+	cmd = self(path, sizeof(path));
+	if (!cmd || access(cmd, X_OK)) {
+		logit(LOG_ERR, "Cannot re-exec, no finit binary found.");
+		return;
+	}
+
+	fd = state_open();
+	if (fd == -1) {
+		err(1, "Failed creating re-exec state");
+		return;
+	}
+
+	if (save(fd)) {
+		err(1, "Failed saving re-exec state");
+		goto done;
+	}
+
+	logit(LOG_NOTICE, "Re-executing %s ...", cmd);
+	conout_sync(1000);
+
+	cloexec_all();
+	handover(fd, 1);
+	snprintf(val, sizeof(val), "%d", fd);
+	setenv(REEXEC_ENV, val, 1);
+
+	execv(cmd, args);
+
+	err(1, "Failed re-exec of %s", cmd);
+	unsetenv(REEXEC_ENV);
+	handover(fd, 0);
+done:
+	free(logs);
+	logs  = NULL;
+	nlogs = 0;
+	close(fd);
+}
+
+/**
+ * reexec_init - Check if we have been re-executed
+ * @argv: Arguments to main(), saved for reexec()
+ *
+ * Reads the snapshot saved by reexec() in the previous finit, if any.
+ * Must be called before the environment is reset.  Also restores the
+ * runlevel so the .conf files are read in the same context as before.
+ *
+ * Returns:
+ * %TRUE(1) if re-executed, in which case the system is already up and
+ * running, otherwise %FALSE(0).  Also when the snapshot is unusable, the
+ * file systems are still mounted, see reexec_restore().
+ */
+int reexec_init(char *argv[])
+{
+	struct stat st;
+	char *val;
+	int fd;
+
+	args = argv;
+
+	val = getenv(REEXEC_ENV);
+	if (!val)
+		return 0;
+
+	fd = atoi(val);
+	unsetenv(REEXEC_ENV);
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr))
+		goto fail;
+
+	hdr = malloc(st.st_size);
+	if (!hdr)
+		goto fail;
+
+	if (read(fd, hdr, st.st_size) != st.st_size)
+		goto fail;
+
+	if (memcmp(hdr->magic, REEXEC_MAGIC, sizeof(hdr->magic)) || hdr->version != REEXEC_VERSION ||
+	    (size_t)st.st_size != sizeof(*hdr) + hdr->count * sizeof(struct reexec_rec) +
+	    hdr->loggers * sizeof(struct logger_rec)) {
+		logit(LOG_WARNING, "Unsupported re-exec state, restarting all services.");
+		goto fail;
+	}
+	close(fd);
+
+	runlevel  = hdr->runlevel;
+	prevlevel = hdr->prevlevel;
+	cfglevel  = hdr->cfglevel;
+	bootstrap = 0;
+	api       = hdr->api;
+	if (api > 0)
+		keep_fd(api, 0);
+
+	return 1;
+fail:
+	close(fd);
+	free(hdr);
+	hdr = NULL;
+	lost = 1;
+
+	return 1;
+}
+
+/**
+ * reexec_api - Inherited API socket
+ *
+ * Returns:
+ * The listening socket of the initctl API from the previous finit, or
+ * -1 if none.  Only returns the socket once.
+ */
+int reexec_api(void)
+{
+	int sd = api;
+
+	api = -1;
+	return sd;
+}
+
+/* Signal all our children, and orphans reparented to us, except zombies */
+static int signal_children(int signo)
+{
+	struct dirent *d;
+	DIR *dir;
+	int num = 0;
+
+	dir = opendir("/proc");
+	if (!dir)
+		return 0;
+
+	while ((d = readdir(dir))) {
+		char path[32], buf[256], *ptr, state;
+		int pid, ppid;
+		FILE *fp;
+
+		pid = atoi(d->d_name);
+		if (pid <= 1)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+
+		if (fgets(buf, sizeof(buf), fp) && (ptr = strrchr(buf, ')')) &&
+		    sscanf(ptr + 1, " %c %d", &state, &ppid) == 2 &&
+		    ppid == getpid() && state != 'Z') {
+			kill(pid, signo);
+			num++;
+		}
+		fclose(fp);
+	}
+	closedir(dir);
+
+	return num;
+}
+
+/*
+ * Without a snapshot we cannot adopt the services of the previous finit,
+ * so stop them before all services are started again from bootstrap.
+ */
+static void stop_children(void)
+{
+	int i;
+
+	logit(LOG_WARNING, "Stopping all services from before re-exec ...");
+	signal_children(SIGTERM);
+	for (i = 0; i < 30; i++) {
+		do_usleep(100000);
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+		if (!signal_children(0))
+			return;
+	}
+
+	signal_children(SIGKILL);
+	do_usleep(100000);
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+}
+
+/* Inherited listen: sockets of a service that is gone or changed */
+static void close_sockets(struct reexec_rec *rec)
+{
+	int i;
+
+	for (i = 0; i < LISTEN_MAX && rec->sockets[i] > 0; i++)
+		close(rec->sockets[i]);
+}
+
+static void restore(svc_t *svc, struct reexec_rec *rec)
+{
+	int fd[LISTEN_MAX];
+	int num;
+
+	*((svc_state_t *)&svc->state) = rec->state;
+	*((char *)&svc->restart_cnt) = rec->restart_cnt;
+
+	svc->status      = rec->status;
+	svc->ready_msec  = rec->ready_msec;
+	svc->start_time  = rec->start_time;
+	svc->forked_at   = rec->forked_at;
+	svc->restart_tot = rec->restart_tot;
+	svc->oom_tot     = rec->oom_tot;
+	svc->block       = rec->block;
+	svc->started     = rec->started;
+	svc->once        = rec->once;
+	svc->activated   = rec->activated;
+	svc_mark_clean(svc);
+
+	if (rec->pid > 1)
+		svc_set_pid(svc, rec->pid);
+
+	for (num = 0; num < LISTEN_MAX && rec->sockets[num] > 0; num++) {
+		fd[num] = rec->sockets[num];
+		keep_fd(fd[num], 0);
+	}
+	if (num > 0 && !svc_has_listen(svc))
+		close_sockets(rec);
+	else if (num > 0 && listen_adopt(svc, fd, num))
+		err(1, "Failed restoring %s sockets", svc_ident(svc, NULL, 0));
+
+	if (rec->notify > 0) {
+		keep_fd(rec->notify, 0);
+		if (uev_io_init(ctx, &svc->notify_watcher, service_notify_cb, svc, rec->notify, UEV_READ)) {
+			err(1, "Failed restoring %s readiness notifier", svc_ident(svc, NULL, 0));
+			close(rec->notify);
+		}
+	}
+
+	if (svc_is_running(svc))
+		service_watchdog_kick(svc);
+}
+
+/**
+ * reexec_restore - Adopt services from the previous finit
+ * @sm: Pointer to the state machine
+ *
+ * Called after all .conf files have been read.  Services that are no
+ * longer in any .conf file are stopped.  Any children that exited while
+ * we were busy re-executing are collected in the SIGCHLD handler once
+ * we enter the main loop.
+ *
+ * Returns:
+ * POSIX OK(0), or -1 if there was no snapshot, in which case the caller
+ * must bootstrap all services as usual.  Any services left over from the
+ * previous finit are stopped first.
+ */
+int reexec_restore(sm_t *sm)
+{
+	struct logger_rec *lrec;
+	struct reexec_rec *rec;
+	uint32_t i;
+
+	if (!hdr) {
+		if (lost)
+			stop_children();
+		return -1;
+	}
+
+	rec = (struct reexec_rec *)&hdr[1];
+	for (i = 0; i < hdr->count; i++, rec++) {
+		svc_t *svc;
+
+		svc = svc_find(rec->name, rec->id);
+		if (!svc) {
+			if (rec->pid > 1) {
+				logit(LOG_NOTICE, "%s:%s no longer in configuration, stopping PID %d",
+				      rec->name, rec->id, rec->pid);
+				kill(rec->pid, SIGTERM);
+			}
+			if (rec->notify > 0)
+				close(rec->notify);
+			close_sockets(rec);
+			continue;
+		}
+
+		restore(svc, rec);
+	}
+
+	if (hdr->notify > 0) {
+		keep_fd(hdr->notify, 0);
+		if (notify_adopt(ctx, hdr->notify))
+			err(1, "Failed restoring shared notify socket");
+	}
+
+	/* After services, loggers are tied to services by PID */
+	lrec = (struct logger_rec *)rec;
+	for (i = 0; i < hdr->loggers; i++, lrec++) {
+		keep_fd(lrec->fd, 0);
+		logger_restore(lrec);
+	}
+
+	free(hdr);
+	hdr = NULL;
+
+	sm->state = SM_RUNNING_STATE;
+	sm->newlevel = -1;
+	sm->reload = 0;
+	sm->in_teardown = 0;
+
+	enable_progress(0);
+	service_step_all(SVC_TYPE_ANY);
+	logit(LOG_NOTICE, "Re-exec complete, runlevel %d", runlevel);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
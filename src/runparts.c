@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #ifdef _LIBITE_LITE
 # include <libite/conio.h>
@@ -92,10 +93,150 @@ static void run_env(const char *env[])
 	}
 }
 
-int run_parts(char *dir, char *cmd, const char *env[], int progress, int sysv)
+/*
+ * A running script in parallel mode, reaped by rp_reap()
+ */
+struct rp_job {
+	pid_t  pid;
+	char  *path;
+};
+
+static pid_t rp_spawn(char *path, const char *env[])
+{
+	char *argv[4] = {
+		"sh",
+		"-c",
+		path,
+		NULL
+	};
+	pid_t pid;
+
+	pid = fork();
+	if (!pid) {
+		sig_unblock();
+		run_env(env);
+
+		_exit(execvp(_PATH_BSHELL, argv));
+	}
+
+	return pid;
+}
+
+static int rp_result(const char *path, int status)
+{
+	int result = 1;
+
+	if (WIFEXITED(status)) {
+		result = WEXITSTATUS(status);
+		dbg("%s exited with status %d", path, result);
+	} else if (WIFSIGNALED(status))
+		warnx("%s terminated by signal %d", path, WTERMSIG(status));
+
+	return result;
+}
+
+/*
+ * Scripts sharing the same numeric prefix, e.g. S50-foo and S50-bar,
+ * form a group that may run in parallel.  Scripts without a prefix are
+ * a group of their own.  Returns length of prefix, or zero.
+ */
+static size_t rp_group(const char *name, char *key, size_t len)
+{
+	size_t i = 0;
+
+	if (name[0] == 'S' || name[0] == 'K')
+		i++;
+	while (isdigit(name[i]))
+		i++;
+
+	if (i == 0 || !isdigit(name[i - 1]))
+		i = 0;
+	if (i >= len)
+		i = len - 1;
+
+	memcpy(key, name, i);
+	key[i] = 0;
+
+	return i;
+}
+
+/*
+ * Wait for at least one of the running jobs to complete, or all of
+ * them if @all is set.  We poll our own PIDs rather than waitpid(-1)
+ * not to steal the exit status of any other child of the caller.
+ * Returns the accumulated status of the scripts that were reaped.
+ */
+static int rp_reap(struct rp_job *job, int jobs, int *running, int all, int progress)
+{
+	int rc = 0;
+
+	while (*running > 0) {
+		int done = 0;
+		int i;
+
+		for (i = 0; i < jobs; i++) {
+			int status, result;
+			pid_t pid;
+
+			if (!job[i].pid)
+				continue;
+
+			pid = waitpid(job[i].pid, &status, WNOHANG);
+			if (pid == 0)
+				continue;
+			if (pid == -1) {
+				if (errno == EINTR)
+					continue;
+				warnx("failed waiting for %s, error %d: %s", job[i].path, errno, strerror(errno));
+				result = 1;
+			} else
+				result = rp_result(job[i].path, status);
+
+			if (progress) {
+				print_desc("Calling", job[i].path);
+				print_result(result);
+			}
+			rc += result;
+
+			free(job[i].path);
+			job[i].path = NULL;
+			job[i].pid  = 0;
+			(*running)--;
+			done++;
+		}
+
+		if (done && !all)
+			break;
+		if (*running > 0 && !done)
+			usleep(10000);
+	}
+
+	return rc;
+}
+
+/**
+ * run_parts - call all executable files in a directory
+ * @dir:      directory to scan
+ * @cmd:      argument for each script, or %NULL for SysV start/stop
+ * @env:      %NULL terminated list of key, value pairs to set
+ * @progress: show progress for each script
+ * @sysv:     only call SysV style SNNfoo/KNNbar scripts
+ * @jobs:     max scripts to run in parallel, <= 1 for serial mode
+ *
+ * In parallel mode all scripts of the same numeric prefix group are
+ * started, up to @jobs at a time, and the group is waited for before
+ * the next group is started.  So groups still run in order.
+ *
+ * Returns -1 if @dir cannot be read, otherwise the sum of all exit
+ * statuses, i.e., zero if all scripts succeeded.
+ */
+int run_parts(char *dir, char *cmd, const char *env[], int progress, int sysv, int jobs)
 {
 	size_t cmdlen = cmd ? strlen(cmd) : strlen("start");
+	struct rp_job *job = NULL;
+	char group[16] = { 0 };
 	struct dirent **d;
+	int running = 0;
 	int i, num;
 	int rc = 0;
 
@@ -105,15 +246,17 @@ int run_parts(char *dir, char *cmd, const char *env[], int progress, int sysv)
 		return -1;
 	}
 
+	if (jobs > 1) {
+		job = calloc(jobs, sizeof(*job));
+		if (!job) {
+			warn("failed allocating %d jobs, running serially", jobs);
+			jobs = 1;
+		}
+	}
+
 	for (i = 0; i < num; i++) {
 		char path[strlen(dir) + strlen(d[i]->d_name) + 3 + cmdlen];
 		const char *name = d[i]->d_name;
-		char *argv[4] = {
-			"sh",
-			"-c",
-			path,
-			NULL
-		};
 		struct stat st;
 		int result = 0;
 		pid_t pid = 0;
@@ -153,36 +296,61 @@ int run_parts(char *dir, char *cmd, const char *env[], int progress, int sysv)
 			strlcat(path, cmd, sizeof(path));
 		}
 
+		if (job) {
+			char key[sizeof(group)];
+			int slot;
+
+			/* new group, or no group, wait for previous to finish */
+			if (!rp_group(name, key, sizeof(key)) || strcmp(key, group))
+				rc += rp_reap(job, jobs, &running, 1, progress);
+			strlcpy(group, key, sizeof(group));
+
+			if (running >= jobs)
+				rc += rp_reap(job, jobs, &running, 0, progress);
+
+			for (slot = 0; slot < jobs; slot++) {
+				if (!job[slot].pid)
+					break;
+			}
+
+			dbg("Starting %s, group '%s' slot %d", path, group, slot);
+			pid = rp_spawn(path, env);
+			if (pid == -1) {
+				warn("failed starting %s", path);
+				if (progress) {
+					print_desc("Calling", path);
+					print_result(1);
+				}
+				rc++;
+				continue;
+			}
+
+			job[slot].pid  = pid;
+			job[slot].path = strdup(path);
+			running++;
+			continue;
+		}
+
 		if (progress)
 			print_desc("Calling", path);
 
-		pid = fork();
-		if (!pid) {
-			sig_unblock();
-			run_env(env);
-
-			_exit(execvp(_PATH_BSHELL, argv));
-		}
-
-		if (waitpid(pid, &status, 0) == -1) {
+		pid = rp_spawn(path, env);
+		if (pid == -1 || waitpid(pid, &status, 0) == -1) {
 			warnx("failed starting %s, error %d: %s", path, errno, strerror(errno));
 			result = 1;
-		} else {
-			if (WIFEXITED(status)) {
-				result = WEXITSTATUS(status);
-				dbg("%s exited with status %d", path, result);
-			} else if (WIFSIGNALED(status)) {
-				warnx("%s terminated by signal %d", path, WTERMSIG(status));
-				result = 1;
-			} else
-				result = 1;
-		}
+		} else
+			result = rp_result(path, status);
 
 		if (progress)
 			print_result(result);
 		rc += result;
 	}
 
+	if (job) {
+		rc += rp_reap(job, jobs, &running, 1, progress);
+		free(job);
+	}
+
 	while (num--)
 		free(d[num]);
 	free(d);
@@ -193,16 +361,16 @@ int run_parts(char *dir, char *cmd, const char *env[], int progress, int sysv)
 #ifndef __FINIT__
 static int usage(int rc)
 {
-	warnx("usage: runparts [-dhps?] DIRECTORY");
+	warnx("usage: runparts [-bdhps?] [-j NUM] DIRECTORY");
 	return rc;
 }
 
 int main(int argc, char *argv[])
 {
-	int rc, c, progress = 0, sysv = 0;
+	int rc, c, progress = 0, sysv = 0, jobs = 1;
 	char *dir;
 
-	while ((c = getopt(argc, argv, "bdh?ps")) != EOF) {
+	while ((c = getopt(argc, argv, "bdh?j:ps")) != EOF) {
 		switch(c) {
 		case 'b':	/* batch mode */
 			interactive = 0;
@@ -213,6 +381,11 @@ int main(int argc, char *argv[])
 		case 'h':
 		case '?':
 			return usage(0);
+		case 'j':	/* parallel mode, 0: online CPUs */
+			jobs = atoi(optarg);
+			if (jobs <= 0)
+				jobs = sysconf(_SC_NPROCESSORS_ONLN);
+			break;
 		case 'p':
 			progress = 1;
 			break;
@@ -233,7 +406,7 @@ int main(int argc, char *argv[])
 
 	prctl(PR_SET_CHILD_SUBREAPER, 1);
 
-	rc = run_parts(dir, NULL, NULL, progress, sysv);
+	rc = run_parts(dir, NULL, NULL, progress, sysv, jobs);
 	if (rc == -1)
 		err(1, "failed run-parts %s", dir);
 
@@ -22,43 +22,303 @@
  */
 
 #include "config.h"
+#include <time.h>
+
 #include "finit.h"
+#include "metrics.h"
 #include "schedule.h"
 
-#define SC_INIT 0x494E4954	/* "INIT", see ascii(7) */
+/*
+ * All scheduled work, e.g., service timeouts and the service gc, is kept
+ * in a binary min-heap sorted on expiry time, driven by a single libuEv
+ * timer.  This instead of one timer, i.e., one timerfd with its epoll
+ * registration, per service.  The heap is 1-indexed, work->index is zero
+ * when work is not scheduled.
+ *
+ * Expired work, and work scheduled without delay, is moved to a ready
+ * list per priority.  Work already on a ready list is not queued again,
+ * so a burst of events stepping the same work only runs it once.  Each
+ * timer callback runs at most WQ_BUDGET items, highest priority first,
+ * then yields to the event loop so pending I/O, e.g. SIGCHLD and API
+ * requests, is not starved by a long pass over all services.
+ */
+static struct wq **heap;
+static size_t      heap_len;
+static size_t      heap_max;
+
+static TAILQ_HEAD(, wq) ready[WQ_PRIOS] = {
+	TAILQ_HEAD_INITIALIZER(ready[0]),
+	TAILQ_HEAD_INITIALIZER(ready[1]),
+	TAILQ_HEAD_INITIALIZER(ready[2]),
+};
+static size_t      ready_len;
+
+/* Ready lists in dispatch order */
+static const int   order[WQ_PRIOS] = { WQ_HIGH, WQ_NORMAL, WQ_LOW };
+
+static uev_t       timer;
+static int         timer_init;
+static int         dispatching;
+
+static long long now_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void heap_set(size_t i, struct wq *work)
+{
+	heap[i] = work;
+	work->index = i;
+}
+
+static void sift_up(size_t i)
+{
+	struct wq *work = heap[i];
+
+	while (i > 1 && heap[i / 2]->expires > work->expires) {
+		heap_set(i, heap[i / 2]);
+		i /= 2;
+	}
+	heap_set(i, work);
+}
+
+static void sift_down(size_t i)
+{
+	struct wq *work = heap[i];
+
+	while (2 * i <= heap_len) {
+		size_t child = 2 * i;
+
+		if (child < heap_len && heap[child + 1]->expires < heap[child]->expires)
+			child++;
+		if (heap[child]->expires >= work->expires)
+			break;
+
+		heap_set(i, heap[child]);
+		i = child;
+	}
+	heap_set(i, work);
+}
+
+static int heap_insert(struct wq *work)
+{
+	if (heap_len + 1 >= heap_max) {
+		size_t max = heap_max ? heap_max * 2 : 64;
+		struct wq **ptr;
+
+		ptr = realloc(heap, max * sizeof(*heap));
+		if (!ptr)
+			return -1;
+
+		heap = ptr;
+		heap_max = max;
+	}
+
+	heap_set(++heap_len, work);
+	sift_up(heap_len);
+
+	return 0;
+}
+
+static void heap_remove(struct wq *work)
+{
+	size_t i = work->index;
+	struct wq *last;
+
+	work->index = 0;
+	last = heap[heap_len--];
+	if (last == work)
+		return;
+
+	heap_set(i, last);
+	if (i > 1 && heap[i / 2]->expires > last->expires)
+		sift_up(i);
+	else
+		sift_down(i);
+}
+
+static void ready_add(struct wq *work)
+{
+	int prio = work->prio;
+
+	if (prio < 0 || prio >= WQ_PRIOS)
+		prio = WQ_NORMAL;
+
+	TAILQ_INSERT_TAIL(&ready[prio], work, link);
+	work->ready = prio + 1;
+	ready_len++;
+}
+
+static void ready_del(struct wq *work)
+{
+	TAILQ_REMOVE(&ready[work->ready - 1], work, link);
+	work->ready = 0;
+	ready_len--;
+}
+
+static struct wq *ready_pop(void)
+{
+	struct wq *work;
+	int i;
+
+	for (i = 0; i < WQ_PRIOS; i++) {
+		work = TAILQ_FIRST(&ready[order[i]]);
+		if (work) {
+			ready_del(work);
+			return work;
+		}
+	}
+
+	return NULL;
+}
 
 /*
- * libuEv callback wrapper
+ * Arm timer for the first work to expire, or at once for ready work
  */
-static void cb(uev_t *w, void *arg, int events)
+static void rearm(void)
 {
-	struct wq *work = (struct wq *)arg;
+	long long msec;
+
+	if (dispatching)
+		return;
 
-	if (UEV_ERROR == events) {
-		uev_timer_start(w);
+	if (ready_len) {
+		uev_timer_set(&timer, 0, 0);
 		return;
 	}
 
-	work->cb(work);
+	if (!heap_len) {
+		uev_timer_stop(&timer);
+		return;
+	}
+
+	msec = heap[1]->expires - now_msec();
+	if (msec < 0)
+		msec = 0;
+
+	uev_timer_set(&timer, (int)msec, 0);
 }
 
 /*
- * Place work on event queue
+ * libuEv callback, move all expired work to the ready lists and run at
+ * most WQ_BUDGET of them.  Work rescheduled by a callback is put back
+ * in the heap, so it runs at the earliest in the next iteration.
  */
-int schedule_work(struct wq *work)
+static void cb(uev_t *w, void *arg, int events)
 {
-	int msec;
+	long long now = now_msec();
+	size_t num;
+	PROBE("schedule");
 
+	while (heap_len && heap[1]->expires <= now) {
+		struct wq *work = heap[1];
+
+		heap_remove(work);
+		ready_add(work);
+	}
+
+	num = ready_len;
+	if (num > WQ_BUDGET) {
+		metrics.work_yields++;
+		num = WQ_BUDGET;
+	}
+
+	dispatching = 1;
+	while (num--) {
+		struct wq *work = ready_pop();
+
+		if (!work)
+			break;
+
+		metrics.work_run++;
+		work->cb(work);
+	}
+	dispatching = 0;
+
+	rearm();
+}
+
+/*
+ * Place work on event queue, rescheduling it if already queued.  Work
+ * without delay that is already waiting to run is left as-is.
+ */
+int schedule_work(struct wq *work)
+{
 	if (!work)
 		return errno = EINVAL;
 
-	msec = work->delay;
-	if (work->init != SC_INIT) {
-		work->init = SC_INIT;
-		return uev_timer_init(ctx, &work->watcher, cb, work, msec, 0);
+	if (!timer_init) {
+		if (uev_timer_init(ctx, &timer, cb, NULL, 0, 0))
+			return -1;
+		timer_init = 1;
+	}
+
+	if (work->index || work->ready)
+		metrics.work_coalesced++;
+	else
+		metrics.work_queued++;
+
+	if (work->ready) {
+		if (work->delay <= 0)
+			return 0;
+		ready_del(work);
+	}
+	if (work->index)
+		heap_remove(work);
+
+	/* From a work callback, defer to next iteration to avoid starvation */
+	if (work->delay <= 0 && !dispatching) {
+		ready_add(work);
+	} else {
+		work->expires = now_msec() + (work->delay > 0 ? work->delay : 0);
+		if (heap_insert(work))
+			return -1;
+	}
+	rearm();
+
+	return 0;
+}
+
+/*
+ * Remove work from event queue, if queued
+ */
+void cancel_work(struct wq *work)
+{
+	if (!work)
+		return;
+
+	if (work->ready)
+		ready_del(work);
+	else if (work->index)
+		heap_remove(work);
+	else
+		return;
+
+	rearm();
+}
+
+/*
+ * Number of pending timers, i.e., delayed work, and optionally the
+ * number of work items ready to run, for the footprint report.
+ */
+size_t schedule_pending(size_t *num)
+{
+	struct wq *work;
+	int i;
+
+	if (num) {
+		*num = 0;
+		for (i = 0; i < WQ_PRIOS; i++) {
+			TAILQ_FOREACH(work, &ready[i], link)
+				(*num)++;
+		}
 	}
 
-	return uev_timer_set(&work->watcher, msec, 0);
+	return heap_len;
 }
 
 /**
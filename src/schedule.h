@@ -24,14 +24,38 @@
 #ifndef FINIT_SCHEDULE_H_
 #define FINIT_SCHEDULE_H_
 
+#ifdef _LIBITE_LITE
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+
+/* Work priority, expired work runs in this order, see schedule.c */
+#define WQ_NORMAL  0		/* Default, e.g. service_worker() */
+#define WQ_HIGH    1		/* Stop and reap, e.g. kill timeouts */
+#define WQ_LOW     2		/* Housekeeping, e.g. gc, aging */
+#define WQ_PRIOS   3
+
+/* Max work run per event loop iteration, before yielding to I/O */
+#define WQ_BUDGET  32
+
 struct wq {
-	uev_t   watcher;
-	int     init;
-	int     delay;		/* msec delay before starting work */
-	void  (*cb)(void *);
-	void   *arg;
+	size_t     index;	/* INTERNAL, position in heap, 0: not queued */
+	long long  expires;	/* INTERNAL, msec CLOCK_MONOTONIC */
+	int        ready;	/* INTERNAL, on ready list, waiting to run */
+	TAILQ_ENTRY(wq) link;	/* INTERNAL, ready list */
+	int        prio;	/* WQ_NORMAL, WQ_HIGH, or WQ_LOW */
+	int        delay;	/* msec delay before starting work */
+	void     (*cb)(void *);
+	void      *arg;
 };
 
 int   schedule_work(struct wq *work);
+void  cancel_work  (struct wq *work);
+
+size_t schedule_pending(size_t *num);
+
+/* Queued, or expired and waiting to run */
+static inline int work_pending(struct wq *work) { return work->index || work->ready; }
 
 #endif /* FINIT_SCHEDULE_H_ */
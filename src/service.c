@@ -25,7 +25,10 @@
 #include "config.h"		/* Generated by configure script */
 
 #include <ctype.h>		/* isblank() */
+#include <grp.h>		/* setgroups() */
 #include <sched.h>		/* sched_yield() */
+#include <stdint.h>		/* uintptr_t */
+#include <stdlib.h>		/* qsort() */
 #include <string.h>
 #include <sys/reboot.h>
 #include <sys/prctl.h>
@@ -39,21 +42,35 @@
 #endif
 #include <wordexp.h>
 
+#include "affinity.h"
 #include "cgroup.h"
 #include "client.h"
 #include "conf.h"
 #include "cond.h"
 #include "devmon.h"
+#include "envfile.h"
 #include "finit.h"
 #include "helpers.h"
+#include "listen.h"
+#include "pathwatch.h"
+#include "logger.h"
+#include "metrics.h"
+#include "notify.h"
 #include "pid.h"
 #include "private.h"
+#include "profile.h"
+#include "readahead.h"
 #include "sig.h"
 #include "service.h"
 #include "sm.h"
+#include "timeline.h"
+#include "timer.h"
+#include "trace.h"
 #include "tty.h"
+#include "usercache.h"
 #include "util.h"
 #include "utmp-api.h"
+#include "which.h"
 #include "schedule.h"
 
 /*
@@ -62,26 +79,45 @@
  */
 static pid_t run_block_pid;
 
+/* Write end of built-in logger pipe, only valid in the child */
+static int log_fd = -1;
+
 static struct wq work = {
 	.cb = service_worker,
 };
 int service_interval = SERVICE_INTERVAL_DEFAULT;
 
+/*
+ * Max number of services allowed to be starting at the same time, set
+ * by 'jobs' in finit.conf, default and per runlevel.  0: unlimited
+ */
+static int jobs_default;
+static int jobs_levels;
+static int jobs_max[INIT_LEVEL + 1];
+static int jobs_active;
+
+/* Shutdown deadline, see service_deadline() */
+static void deadline_cb(void *unused);
+static struct wq deadline_work = {
+	.cb   = deadline_cb,
+	.prio = WQ_HIGH,
+};
+static long long deadline;	/* msec CLOCK_MONOTONIC, 0: none */
+static int       expired;	/* deadline passed, ignore dependencies */
+
 static void svc_set_state(svc_t *svc, svc_state_t new_state);
 
 /**
- * service_timeout_cb - libuev callback wrapper for service timeouts
- * @w:      Watcher
- * @arg:    Callback argument, from init
- * @events: Error, or ready to read/write (N/A for relative timers)
+ * service_timeout_cb - Work queue callback wrapper for service timeouts
+ * @arg: Pointer to svc->timer
  *
  * Run callback registered when calling service_timeout_after().
  */
-static void service_timeout_cb(uev_t *w, void *arg, int events)
+static void service_timeout_cb(void *arg)
 {
-	svc_t *svc = arg;
+	struct wq *timer = arg;
+	svc_t *svc = timer->arg;
 
-	/* Ignore any UEV_ERROR, we're a one-shot cb so just run it. */
 	if (svc->timer_cb)
 		svc->timer_cb(svc);
 }
@@ -93,7 +129,7 @@ static void service_timeout_cb(uev_t *w, void *arg, int events)
  * @cb:      Callback function
  *
  * After @timeout milliseconds has elapsed, call @cb() with @svc as the
- * argument.
+ * argument.  All service timeouts share the same timer, see schedule.c
  *
  * Returns:
  * POSIX OK(0) on success, non-zero on error.
@@ -103,8 +139,13 @@ int service_timeout_after(svc_t *svc, int timeout, void (*cb)(svc_t *svc))
 	if (svc->timer_cb)
 		return -EBUSY;
 
-	svc->timer_cb = cb;
-	return uev_timer_init(ctx, &svc->timer, service_timeout_cb, svc, timeout, 0);
+	svc->timer_cb    = cb;
+	svc->timer.cb    = service_timeout_cb;
+	svc->timer.arg   = svc;
+	svc->timer.prio  = WQ_HIGH;
+	svc->timer.delay = timeout;
+
+	return schedule_work(&svc->timer);
 }
 
 /**
@@ -118,25 +159,37 @@ int service_timeout_after(svc_t *svc, int timeout, void (*cb)(svc_t *svc))
  */
 int service_timeout_cancel(svc_t *svc)
 {
-	int err;
-
 	if (!svc->timer_cb)
 		return 0;
 
-	err = uev_timer_stop(&svc->timer);
+	cancel_work(&svc->timer);
 	svc->timer_cb = NULL;
 
-	return err;
+	return 0;
 }
 
 struct assoc {
 	TAILQ_ENTRY(assoc) link;
+	LIST_ENTRY(assoc)  hlink;	/* svc_assoc_hash[] */
 
 	pid_t  pid;		/* script pid */
 	svc_t *svc;		/* associated svc_t */
 };
 
+/*
+ * Script PIDs are looked up on every collected child that is not a
+ * service, so keep them hashed on PID as well.
+ */
+#define ASSOC_BUCKETS 64
 static TAILQ_HEAD(, assoc) svc_assoc_list = TAILQ_HEAD_INITIALIZER(svc_assoc_list);
+static LIST_HEAD(, assoc)  svc_assoc_hash[ASSOC_BUCKETS];
+
+static void service_script_free(struct assoc *ptr)
+{
+	TAILQ_REMOVE(&svc_assoc_list, ptr, link);
+	LIST_REMOVE(ptr, hlink);
+	free(ptr);
+}
 
 static void service_script_kill(svc_t *svc)
 {
@@ -148,8 +201,7 @@ static void service_script_kill(svc_t *svc)
 
 		dbg("Killing service %s script PID %d.", svc_ident(svc, NULL, 0), ptr->pid);
 		kill(-ptr->pid, SIGKILL);
-		TAILQ_REMOVE(&svc_assoc_list, ptr, link);
-		free(ptr);
+		service_script_free(ptr);
 	}
 }
 
@@ -165,6 +217,7 @@ static int service_script_add(svc_t *svc, pid_t pid)
 	ptr->svc = svc;
 	ptr->pid = pid;
 	TAILQ_INSERT_TAIL(&svc_assoc_list, ptr, link);
+	LIST_INSERT_HEAD(&svc_assoc_hash[pid & (ASSOC_BUCKETS - 1)], ptr, hlink);
 
 	service_timeout_after(svc, svc->killdelay, service_script_kill);
 
@@ -173,17 +226,16 @@ static int service_script_add(svc_t *svc, pid_t pid)
 
 static int service_script_del(pid_t pid)
 {
-	struct assoc *ptr, *next;
+	struct assoc *ptr;
 
-	TAILQ_FOREACH_SAFE(ptr, &svc_assoc_list, link, next) {
+	LIST_FOREACH(ptr, &svc_assoc_hash[pid & (ASSOC_BUCKETS - 1)], hlink) {
 		if (ptr->pid != pid)
 			continue;
 
 		dbg("Collected service %s script PID %d, killing process group.", svc_ident(ptr->svc, NULL, 0), pid);
 		service_timeout_cancel(ptr->svc);
 		kill(-ptr->pid, SIGKILL);
-		TAILQ_REMOVE(&svc_assoc_list, ptr, link);
-		free(ptr);
+		service_script_free(ptr);
 
 		return 0;
 	}
@@ -377,6 +429,11 @@ static int redirect(svc_t *svc)
 			return fredirect("/dev/null");
 		if (svc->log.console)
 			return fredirect(console());
+		if (log_fd != -1) {
+			dup2(log_fd, STDOUT_FILENO);
+			dup2(log_fd, STDERR_FILENO);
+			return close(log_fd);
+		}
 
 		return lredirect(svc);
 	} else if (debug)
@@ -389,156 +446,93 @@ static int redirect(svc_t *svc)
 	return 0;
 }
 
-/*
- * Source environment file, if it exists
- * Note: must be called from privsepped child
- */
-static void source_env(svc_t *svc)
+static int is_norespawn(void)
 {
-	char *buf, *val, *line, *fn;
-	FILE *fp;
-
-	fn = svc_getenv(svc);
-	if (!fn)
-		return;
-
-	/* Warning in service_start() after svc_checkenv() */
-	fp = fopen(fn, "r");
-	if (!fp)
-		return;
+	return  fexist("/mnt/norespawn") ||
+		fexist("/tmp/norespawn");
+}
 
-	buf = alloca(LINE_SIZE);
-	val = alloca(LINE_SIZE);
-	if (!buf || !val) {
-		warn("Failed allocating temporary env buffer");
-		return;
-	}
+/**
+ * service_cgroup - Path to leaf group of a service
+ * @svc:  Service
+ * @path: Buffer for the path
+ * @len:  Size of @path
+ *
+ * Returns:
+ * The path, or %NULL if @svc does not have a leaf group of its own.
+ */
+char *service_cgroup(svc_t *svc, char *path, size_t len)
+{
+	char grnam[80];
 
-	line = buf;
-	while (fgets(line, LINE_SIZE, fp)) {
-		char *key = chomp(line);
-		wordexp_t we = { 0 };
-		char *value, *end;
-		size_t i;
+	if (svc_is_tty(svc))
+		return cgroup_service_path("getty", &(struct cgroup){ .name = "user" }, path, len);
 
-		/* skip any leading whitespace */
-		while (isspace(*key))
-			key++;
+	return cgroup_service_path(svc_group(svc, grnam, sizeof(grnam)), &svc->cgroup, path, len);
+}
 
-		/* skip comments */
-		if (*key == '#' || *key == ';')
-			continue;
+/*
+ * Services declared in the same .conf file share a leaf group, so only
+ * wait for the group to drain, or kill it, when it is ours alone.  The
+ * result is cached until the set of services changes.
+ */
+static int group_exclusive(svc_t *svc, char *buf, size_t len)
+{
+	svc_t *s, *iter = NULL;
+	char grnam[80];
 
-		/* find end of line */
-		end = key;
-		while (*end)
-			end++;
+	if (svc_is_tty(svc))
+		return 0;
 
-		/* strip trailing whitespace */
-		if (end > key) {
-			end--;
-			while (isspace(*end))
-				*end-- = 0;
-		}
+	svc_group(svc, buf, len);
+	if (svc->group_gen == svc_generation())
+		return svc->group_excl;
 
-		value = strchr(key, '=');
-		if (!value)
+	svc->group_gen  = svc_generation();
+	svc->group_excl = 1;
+	for (s = svc_iterator(&iter, 1); s; s = svc_iterator(&iter, 0)) {
+		if (s == svc || strcmp(s->cgroup.name, svc->cgroup.name))
 			continue;
-		*value++ = 0;
-
-		/* strip leading whitespace from value */
-		while (isspace(*value))
-			value++;
-
-		/* unquote value, if quoted */
-		if (value[0] == '"' || value[0] == '\'') {
-			char q = value[0];
-
-			if (*end == q) {
-				value = &value[1];
-				*end = 0;
-			}
-		}
-
-		/* find end of key */
-		end = key;
-		while (*end)
-			end++;
-
-		/* strip trailing whitespace */
-		if (end > key) {
-			end--;
-			while (isspace(*end))
-				*end-- = 0;
-		}
-
-		/* strip any leading 'set ' */
-		end = key;
-		if (!strncmp(key, "set", 3))
-			end += 3;
-
-		/* check key, no spaces allowed */
-		while (*end && isspace(*end))
-			end++;
-		key = end;
-		while (*end && !isspace(*end))
-			end++;
-		if (*end != 0) {
-			warnx("'%s=%s': not a valid identifier", key, val);
-			continue;	/* invalid key */
-		}
-
-		switch (wordexp(value, &we, 0)) {
-		case 0:
-			for (i = 0, *val = 0; i < we.we_wordc; i++) {
-				if (i > 0)
-					strlcat(val, " ", LINE_SIZE);
-				strlcat(val, we.we_wordv[i], LINE_SIZE);
-			}
-			setenv(key, val, 1);
-			wordfree(&we);
-			break;
 
-		case WRDE_NOSPACE:
-			wordfree(&we);
-			/* fallthrough */
-		default:
-			setenv(key, value, 1);
+		if (!strcmp(svc_group(s, grnam, sizeof(grnam)), buf)) {
+			svc->group_excl = 0;
 			break;
 		}
 	}
 
-	fclose(fp);
+	return svc->group_excl;
 }
 
-static int is_norespawn(void)
+/* Lingering processes, e.g., forked grandchildren, in our leaf group */
+static int group_busy(svc_t *svc)
 {
-	return  fexist("/mnt/norespawn") ||
-		fexist("/tmp/norespawn");
+	char grnam[80];
+
+	if (!group_exclusive(svc, grnam, sizeof(grnam)))
+		return 0;
+
+	return cgroup_service_populated(grnam, &svc->cgroup);
 }
 
-/* used for process group name, derived from originating filename,
- * so to group multiple services, place them in the same .conf
+/*
+ * Confine the leaf group to cpus:, when it is ours alone, otherwise the
+ * child sets its CPU affinity, see affinity.c.  Without cpus: the group
+ * is reset, the option may have been removed on reload.
  */
-static char *group_name(svc_t *svc, char *buf, size_t len)
+static int group_cpuset(svc_t *svc, int fd)
 {
-	char *ptr;
+	char grnam[80];
 
-	if (!svc->file[0])
-		return svc_ident(svc, buf, len);
+	if (fd == -1)
+		return 0;
 
-	ptr = strrchr(svc->file, '/');
-	if (ptr)
-		ptr++;
-	else
-		ptr = svc->file;
+	if (!strcmp(svc->cgroup.name, "root") || !strcmp(svc->cgroup.name, "init"))
+		return 0;
 
-	strlcpy(buf, ptr, len);
-	ptr = strstr(buf, ".conf");
-	if (ptr)
-		*ptr = 0;
+	if (!group_exclusive(svc, grnam, sizeof(grnam)))
+		return 0;
 
-	return buf;
+	return !cgroup_cpuset(fd, svc->cpus) && svc->cpus[0];
 }
 
 static void compose_cmdline(svc_t *svc, char *buf, size_t len)
@@ -546,10 +540,7 @@ static void compose_cmdline(svc_t *svc, char *buf, size_t len)
 	size_t i;
 
 	strlcpy(buf, svc->cmd, len);
-	for (i = 1; i < MAX_NUM_SVC_ARGS; i++) {
-		if (!strlen(svc->args[i]))
-			break;
-
+	for (i = 1; svc->args[i]; i++) {
 		strlcat(buf, " ", len);
 		strlcat(buf, svc->args[i], len);
 	}
@@ -557,19 +548,42 @@ static void compose_cmdline(svc_t *svc, char *buf, size_t len)
 
 static pid_t service_fork(svc_t *svc)
 {
+	struct envfile *ef = NULL;
+	char grnam[80], *fn;
+	int fd, moved, cpuset;
+	struct creds cr;
 	pid_t pid;
 
-	pid = fork();
-	if (pid == 0) {
-		char *home = NULL;
+	/* Parsed once, reused by the child, warning in service_start() */
+	fn = svc_getenv(svc);
+	if (fn)
+		ef = envfile_get(fn);
+
+	/* Start directly in its cgroup, if supported, otherwise move it */
+	if (svc_is_tty(svc))
+		fd = cgroup_user_fd("getty");
+	else
+		fd = cgroup_service_fd(svc_group(svc, grnam, sizeof(grnam)), &svc->cgroup);
+	cpuset = group_cpuset(svc, fd);
+
+	/* Resolved in the parent, from cache, not with NSS in the child */
 #ifdef ENABLE_STATIC
-		int uid = 0; /* XXX: Fix better warning that dropprivs is disabled. */
-		int gid = 0;
+	/* XXX: Fix better warning that dropprivs is disabled. */
+	cr = (struct creds){ .uid = 0, .gid = 0, .ngroups = -1 };
 #else
-		int uid = getuser(svc->username, &home);
-		int gid = getgroup(svc->group);
+	usercache_get(svc->username, svc->group, &cr);
 #endif
 
+	pid = cgroup_fork(fd);
+	moved = pid != -1;
+	if (!moved)
+		pid = fork();
+
+	if (pid == 0) {
+		char *home = cr.home;
+		int uid = cr.uid;
+		int gid = cr.gid;
+
 		sched_yield();
 
 		/* Set configured limits */
@@ -579,7 +593,14 @@ static pid_t service_fork(svc_t *svc)
 				      svc_ident(svc, NULL, 0), rlim2str(i));
 		}
 
-		/* Set desired user+group */
+		/* CPU affinity, NUMA, and scheduling, before dropping privileges */
+		affinity_apply(svc, cpuset);
+
+		/* Set desired user+group, supplementary groups first */
+		if (uid >= 0 && cr.ngroups >= 0) {
+			if (setgroups(cr.ngroups, cr.groups))
+				err(1, "%s: failed setgroups()", svc_ident(svc, NULL, 0));
+		}
 		if (gid >= 0) {
 			if (setgid(gid))
 				err(1, "%s: failed setgid(%d)", svc_ident(svc, NULL, 0), gid);
@@ -602,16 +623,13 @@ static pid_t service_fork(svc_t *svc)
 		}
 
 		/* Source any environment from env:/path/to/file */
-		source_env(svc);
+		envfile_apply(ef);
 	}
 
-	if (pid > 1) {
-		char grnam[80];
-
-		if (svc_is_tty(svc))
-			cgroup_user("getty", pid);
-		else
-			cgroup_service(group_name(svc, grnam, sizeof(grnam)), pid, &svc->cgroup);
+	if (fd != -1) {
+		if (pid > 1 && !moved)
+			cgroup_move(fd, pid);
+		close(fd);
 	}
 
 	return pid;
@@ -629,6 +647,7 @@ static int service_start(svc_t *svc)
 	int result = 0, do_progress = 1;
 	char cmdline[CMD_SIZE] = "";
 	sigset_t nmask, omask;
+	struct logger *lg;
 	pid_t pid;
 	size_t i;
 
@@ -644,7 +663,7 @@ static int service_start(svc_t *svc)
 		return 1;
 
 	/* Don't try and start service if it doesn't exist. */
-	if (!whichp(svc->cmd)) {
+	if (!which_cached(svc->cmd)) {
 		logit(LOG_WARNING, "%s: missing %s or not in $PATH", svc_ident(svc, NULL, 0), svc->cmd);
 		svc_missing(svc);
 		return 1;
@@ -668,8 +687,10 @@ static int service_start(svc_t *svc)
 	}
 
 	compose_cmdline(svc, cmdline, sizeof(cmdline));
-	if (bootstrap)
+	if (bootstrap) {
 		conf_save_exec_order(svc, cmdline, -1);
+		readahead_record(svc);
+	}
 
 	if (svc_is_sysv(svc))
 		logit(LOG_CONSOLE | LOG_NOTICE, "Calling '%s start' ...", cmdline);
@@ -698,15 +719,32 @@ static int service_start(svc_t *svc)
 	sigaddset(&nmask, SIGCHLD);
 	sigprocmask(SIG_BLOCK, &nmask, &omask);
 
+	if (svc->notify == SVC_NOTIFY_SYSTEMD && notify_shared)
+		notify_init(ctx);
+
+	lg = logger_open(svc, &log_fd);
 	pid = service_fork(svc);
+	if (pid != 0) {
+		logger_start(lg, pid);
+		log_fd = -1;
+	}
 	if (pid < 0) {
 		result = -1;
 		goto fail;
 	}
 	if (pid > 1) {
 		dbg("Starting %s as PID %d", svc_ident(svc, NULL, 0), pid);
-		svc->pid = pid;
+		svc_set_pid(svc, pid);
 		svc->start_time = jiffies();
+		svc->forked_at  = timeline_now();
+		if (svc->oom) {
+			char cond[MAX_COND_LEN];
+
+			snprintf(cond, sizeof(cond), "oom/%s", svc_ident(svc, NULL, 0));
+			cond_clear(cond);
+		}
+		svc->oom = svc->oom_raised = 0;
+		TRACE3(svc_fork, svc->name, svc->id, pid);
 	} else if (pid == 0) {
 		char *args[MAX_NUM_SVC_ARGS + 1];
 		int status;
@@ -714,11 +752,16 @@ static int service_start(svc_t *svc)
 		if (!svc_is_tty(svc))
 			redirect(svc);
 
+		if (svc_has_listen(svc) && listen_export(svc))
+			err(1, "%s: failed handing over sockets", svc_ident(svc, NULL, 0));
+
 		if (!svc_is_sysv(svc)) {
 			wordexp_t we = { 0 };
 			int rc;
 
-			if (svc->notify == SVC_NOTIFY_SYSTEMD || svc->notify == SVC_NOTIFY_S6) {
+			if (svc->notify == SVC_NOTIFY_SYSTEMD && notify_shared) {
+				setenv("NOTIFY_SOCKET", NOTIFY_SOCKET, 1);
+			} else if (svc->notify == SVC_NOTIFY_SYSTEMD || svc->notify == SVC_NOTIFY_S6) {
 				if (client_command(INIT_CMD_NOTIFY_SOCKET)) {
 					err(1, "%s: failed creating notify socket", svc_ident(svc, NULL, 0));
 					client_disconnect();
@@ -732,6 +775,16 @@ static int service_start(svc_t *svc)
 				}
 			}
 
+			/* Software watchdog, see sd_watchdog_enabled(3) */
+			if (svc->notify == SVC_NOTIFY_SYSTEMD && svc->watchdog_msec > 0) {
+				char val[24];
+
+				snprintf(val, sizeof(val), "%lld", (long long)svc->watchdog_msec * 1000);
+				setenv("WATCHDOG_USEC", val, 1);
+				snprintf(val, sizeof(val), "%d", getpid());
+				setenv("WATCHDOG_PID", val, 1);
+			}
+
 			if ((rc = wordexp(svc->cmd, &we, 0))) {
 				errx(1, "%s: failed wordexp(%s): %d", svc_ident(svc, NULL, 0), svc->cmd, rc);
 			nomem:
@@ -739,16 +792,13 @@ static int service_start(svc_t *svc)
 				_exit(1);
 			}
 
-			for (i = 0; i < MAX_NUM_SVC_ARGS; i++) {
+			for (i = 0; svc->args[i]; i++) {
 				char *arg = svc->args[i];
 				size_t len = strlen(arg);
 				char str[len + 2];
 				char ch = *arg;
 
-				if (len == 0)
-					break;
-
-				if (svc->notify == SVC_NOTIFY_SYSTEMD || svc->notify == SVC_NOTIFY_S6) {
+				if ((svc->notify == SVC_NOTIFY_SYSTEMD && !notify_shared) || svc->notify == SVC_NOTIFY_S6) {
 					char *ptr = strstr(arg, "%n");
 
 					if (ptr) {
@@ -784,29 +834,17 @@ static int service_start(svc_t *svc)
 				goto nomem;
 			}
 
-			for (i = 0; i < we.we_wordc; i++) {
-				if (strlen(we.we_wordv[i]) >= sizeof(svc->args[i])) {
-					logit(LOG_ERR, "%s: expanded %s arg. '%s' too long", svc_ident(svc, NULL, 0), svc->cmd, we.we_wordv[i]);
-					rc = WRDE_NOSPACE;
-					goto nomem;
-				}
-
-				/* overwrite the child's svc with expanded args */
-				strlcpy(svc->args[i], we.we_wordv[i], sizeof(svc->args[i]));
-				args[i] = svc->args[i];
-			}
-			wordfree(&we);
+			/* expanded args are used until exec, never freed */
+			for (i = 0; i < we.we_wordc; i++)
+				args[i] = we.we_wordv[i];
 		} else {
 			size_t j;
 
 			i = 0;
 			args[i++] = svc->cmd;
 			/* this handles, e.g., bridge-stop br0 start */
-			for (j = 0; j < MAX_NUM_SVC_ARGS; j++) {
-				if (!strlen(svc->args[j]))
-					break;
+			for (j = 0; svc->args[j] && j < MAX_NUM_SVC_ARGS - 2; j++)
 				args[i++] = svc->args[j];
-			}
 			args[i++] = "start";
 		}
 		args[i] = NULL;
@@ -823,9 +861,7 @@ static int service_start(svc_t *svc)
 		buf[0] = 0;
 		strlcat(buf, svc->cmd, sizeof(buf));
 		strlcat(buf, " ", sizeof(buf));
-		for (i = 1; i < MAX_NUM_SVC_ARGS; i++) {
-			if (!strlen(svc->args[i]))
-				break;
+		for (i = 1; svc->args[i]; i++) {
 			strlcat(buf, svc->args[i], sizeof(buf));
 			strlcat(buf, " ", sizeof(buf));
 		}
@@ -896,9 +932,21 @@ fail:
 static void service_kill(svc_t *svc)
 {
 	char *nm, *id = svc_ident(svc, NULL, 0);
+	char grnam[80];
 
 	service_timeout_cancel(svc);
 
+	/* Take down the whole tree, wait for cgroup.events to step us */
+	if (svc->draining && group_busy(svc) && group_exclusive(svc, grnam, sizeof(grnam)) &&
+	    !cgroup_service_kill(grnam, &svc->cgroup)) {
+		logit(LOG_CONSOLE | LOG_NOTICE, "Stopping %s, sending SIGKILL to cgroup ...", id);
+		if (runlevel != 1) {
+			print_desc("Killing ", svc->desc);
+			print(2, NULL);
+		}
+		return;
+	}
+
 	if (svc->pid <= 1) {
 		/* Avoid killing ourselves or all processes ... */
 		dbg("%s: Aborting SIGKILL, already terminated.", id);
@@ -960,7 +1008,8 @@ static void service_cleanup(svc_t *svc)
 		utmp_set_dead(svc->pid); /* Set DEAD_PROCESS UTMP entry */
 
 	svc->oldpid = svc->pid;
-	svc->starting = svc->start_time = svc->pid = 0;
+	svc->starting = svc->start_time = 0;
+	svc_set_pid(svc, 0);
 }
 
 /**
@@ -1016,11 +1065,14 @@ int service_stop(svc_t *svc)
 	 */
 	svc_started(svc);
 
+	/* Stopped by us, not exited, so wait for any forked grandchildren */
+	svc->draining = 1;
+
 	/*
 	 * Verify there's still something there before we send the reaper.
 	 */
-	if (svc->pid > 1 && !pid_alive(svc->pid)) {
-		svc->pid = 0;
+	if (svc->pid > 1 && !pid_svc_alive(svc)) {
+		svc_set_pid(svc, 0);
 		return 0;
 	}
 
@@ -1061,11 +1113,8 @@ int service_stop(svc_t *svc)
 
 		args[i++] = svc->cmd;
 		/* this handles, e.g., bridge-stop br0 stop */
-		for (j = 0; j < MAX_NUM_SVC_ARGS - 2; j++) {
-			if (!strlen(svc->args[j]))
-				break;
+		for (j = 0; svc->args[j] && j < MAX_NUM_SVC_ARGS - 2; j++)
 			args[i++] = svc->args[j];
-		}
 		args[i++] = "stop";
 		args[i] = NULL;
 
@@ -1118,7 +1167,8 @@ static int service_restart(svc_t *svc)
 
 	if (svc->pid <= 1) {
 		dbg("%s: bad PID %d for %s, SIGHUP", svc_ident(svc, NULL, 0), svc->pid, svc->cmd);
-		svc->start_time = svc->pid = 0;
+		svc->start_time = 0;
+		svc_set_pid(svc, 0);
 		return 1;
 	}
 
@@ -1189,11 +1239,14 @@ void service_runlevel(int newlevel)
 }
 
 /*
- * log:/path/to/logfile,priority:facility.level,tag:ident
+ * log:/path/to/logfile,priority:facility.level,tag:ident,rate:N/s,burst:M
  */
 static void parse_log(svc_t *svc, char *arg)
 {
-	char *tok;
+	char *tok, *val;
+
+	svc->log.rate  = 0;
+	svc->log.burst = 0;
 
 	tok = strtok(arg, ":, ");
 	while (tok) {
@@ -1209,6 +1262,10 @@ static void parse_log(svc_t *svc, char *arg)
 			strlcpy(svc->log.prio, strtok(NULL, ","), sizeof(svc->log.prio));
 		else if (!strcmp(tok, "tag") || !strcmp(tok, "identity") || !strcmp(tok, "ident"))
 			strlcpy(svc->log.ident, strtok(NULL, ","), sizeof(svc->log.ident));
+		else if (!strcmp(tok, "rate") && (val = strtok(NULL, ",")))
+			svc->log.rate = atoi(val);	/* N or N/s */
+		else if (!strcmp(tok, "burst") && (val = strtok(NULL, ",")))
+			svc->log.burst = atoi(val);
 
 		tok = strtok(NULL, ":=, ");
 	}
@@ -1225,19 +1282,6 @@ static svc_notify_t parse_notify(char *arg)
 	return SVC_NOTIFY_NONE;	/* unsupported/none */
 }
 
-static void parse_env(svc_t *svc, char *env)
-{
-	if (!env)
-		return;
-
-	if (strlen(env) >= sizeof(svc->env)) {
-		errx(1, "%s: env file is too long (>%zu chars)", svc_ident(svc, NULL, 0), sizeof(svc->env));
-		return;
-	}
-
-	strlcpy(svc->env, env, sizeof(svc->env));
-}
-
 /*
  * the @cgroup argument can be, e.g., .system:mem.max:1234 or just the
  * default group with some cfg, e.g., :mem.max:1234 as a side effect,
@@ -1297,12 +1341,17 @@ static void parse_killdelay(svc_t *svc, char *delay)
 	svc->killdelay = (int)(sec * 1000);
 }
 
-static void parse_script(char *type, char *script, char *buf, size_t len)
+static char *parse_script(char *type, char *script)
 {
-	if (access(script, X_OK))
+	if (!script)
+		return NULL;
+
+	if (access(script, X_OK)) {
 		logit(LOG_WARNING, "%s:%s is missing or not executable, skipping.", type, script);
-	else
-		strlcpy(buf, script, len);
+		return NULL;
+	}
+
+	return script;
 }
 
 /*
@@ -1336,40 +1385,38 @@ static char *parse_name(char *cmd, char *arg)
 }
 
 /*
- * Update the command line args in the svc struct
+ * Parse command line args into @argv, pointing into the tokenized line,
+ * later packed by svc_set_strings().  Check for changes from the args of
+ * the svc struct.
  */
-static void parse_cmdline_args(svc_t *svc, char *cmd, char **args)
+static void parse_cmdline_args(svc_t *svc, char *cmd, char **args, char *argv[])
 {
-	char prev[MAX_ARG_LEN];
 	int diff = 0;
 	char sep = 0;
 	char *arg;
 	int i = 0;
 
-	if (strcmp(svc->args[i], cmd))
-		diff++;
-	strlcpy(svc->args[i++], cmd, sizeof(svc->args[0]));
+	argv[i++] = cmd;
 
 	/*
 	 * Copy supplied args. Stop at MAX_NUM_SVC_ARGS-1 to allow the args
-	 * array to be zero-terminated.
+	 * array to be NULL terminated.
 	 */
 	while ((arg = strtok_r(NULL, " ", args)) && i < (MAX_NUM_SVC_ARGS - 1)) {
 		char ch = arg[0];
 		size_t len;
 
-		if (!sep) {
-			strlcpy(prev, svc->args[i], sizeof(prev));
-			svc->args[i][0] = 0;
-		}
-
 		/* XXX: ugly string arg re-concatenation, fixme */
-		if (ch == '"' || ch == '\'')
-			sep = ch;
-		else if (sep)
-			strlcat(svc->args[i], " ", sizeof(svc->args[0]));
+		if (sep) {
+			char *end = argv[i] + strlen(argv[i]);
 
-		strlcat(svc->args[i], arg, sizeof(svc->args[0]));
+			/* undo strtok_r() inside string arg */
+			memset(end, ' ', arg - end);
+		} else {
+			argv[i] = arg;
+			if (ch == '"' || ch == '\'')
+				sep = ch;
+		}
 
 		/* string arg contained already? */
 		len = strlen(arg);
@@ -1380,24 +1427,18 @@ static void parse_cmdline_args(svc_t *svc, char *cmd, char **args)
 		}
 
 		/* replace any @console arg with the expanded device name */
-		if (svc_is_tty(svc) && tty_isatcon(svc->args[i]))
-			strlcpy(svc->args[i], svc->dev, sizeof(svc->args[i]));
-
-		if (strcmp(svc->args[i], prev))
-			diff++;
+		if (svc_is_tty(svc) && tty_isatcon(argv[i]))
+			argv[i] = svc->dev;
 
 		sep = 0;
 		i++;
 	}
+	argv[i] = NULL;
 
-	/*
-	 * Clear remaining args in case they were set earlier.
-	 * This also zero-terminates the args array.
-	 */
-	while (i < MAX_NUM_SVC_ARGS) {
-		if (svc->args[i++][0]) {
-			svc->args[i-1][0] = 0;
+	for (i = 0; argv[i] || svc->args[i]; i++) {
+		if (!argv[i] || !svc->args[i] || strcmp(argv[i], svc->args[i])) {
 			diff++;
+			break;
 		}
 	}
 
@@ -1410,17 +1451,38 @@ static void parse_cmdline_args(svc_t *svc, char *cmd, char **args)
 	if (diff) {
 		char buf[256];
 
-		for (buf[0] = 0, i = 0; i < MAX_NUM_SVC_ARGS; i++) {
-			if (!strlen(svc->args[i]))
-				break;
+		for (buf[0] = 0, i = 0; argv[i]; i++) {
 			strlcat(buf, " ", sizeof(buf));
-			strlcat(buf, svc->args[i], sizeof(buf));
+			strlcat(buf, argv[i], sizeof(buf));
 		}
 		dbg("Modified args for %s detected: %s", cmd, buf);
 	}
 	svc->args_dirty = (diff > 0);
 }
 
+/*
+ * if:<cond,!cond> is evaluated by svc_enabled(), so make sure the
+ * service is stepped when any of those conditions change.
+ */
+static void parse_ifcond(svc_t *svc, char *ifstmt)
+{
+	char *buf, *c;
+
+	if (ifstmt[0] != '<')
+		return;
+
+	buf = strdupa(&ifstmt[1]);
+	c = strchr(buf, '>');
+	if (c)
+		*c = 0;
+
+	for (c = strtok(buf, ","); c; c = strtok(NULL, ",")) {
+		if (c[0] == '!')
+			c++;
+		cond_dep_watch(svc, c);
+	}
+}
+
 /**
  * service_register - Register service, task or run commands
  * @type:   %SVC_TYPE_SERVICE(0), %SVC_TYPE_TASK(1), %SVC_TYPE_RUN(2)
@@ -1488,17 +1550,28 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	char *id = NULL, *env = NULL, *cgroup = NULL;
 	char *pre_script = NULL, *post_script = NULL;
 	char *ready_script = NULL, *conflict = NULL;
+	char *argv[MAX_NUM_SVC_ARGS];
+	char getty[MAX_STR_LEN];
 	char ident[MAX_IDENT_LEN];
 	char *ifstmt = NULL;
 	char *notify = NULL;
+	char *listen = NULL;
+	char *path = NULL;
 	struct tty tty = { 0 };
 	char *dev = NULL;
 	int respawn = 0;
 	int levels = 0;
-	int forking = 0, manual = 0, nowarn = 0;
+	int forking = 0, manual = 0, nowarn = 0, critical = 0;
+	int watchdog = 0;
+	char *every = NULL, *after = NULL, *cal = NULL, *spread = NULL;
 	int restart_max = SVC_RESPAWN_MAX;
 	int restart_tmo = 0;
+	int backoff_max = 0;
+	int burst = 0, burst_tmo = 0;
 	unsigned oncrash_action = SVC_ONCRASH_IGNORE;
+	int oom_delay = 0, oom_high = 0;
+	char *cpus = NULL, *numa = NULL, *sched = NULL, *nice = NULL, *ionice = NULL;
+	int instances = 0;
 	char *line, *args;
 	svc_t *svc;
 
@@ -1558,10 +1631,22 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 			name = cmd;
 		else if (MATCH_CMD(cmd, "notify:", arg))
 			notify = arg;
+		else if (MATCH_CMD(cmd, "listen:", arg))
+			listen = arg;
+		else if (MATCH_CMD(cmd, "path:", arg))
+			path = arg;
 		else if (MATCH_CMD(cmd, "type:forking", arg))
 			forking = 1;
 		else if (MATCH_CMD(cmd, "manual:yes", arg))
 			manual = 1;
+		else if (MATCH_CMD(cmd, "every:", arg))
+			every = arg;
+		else if (MATCH_CMD(cmd, "after-boot:", arg))
+			after = arg;
+		else if (MATCH_CMD(cmd, "cal:", arg))
+			cal = arg;
+		else if (MATCH_CMD(cmd, "jitter:", arg))
+			spread = arg;
 		else if (MATCH_CMD(cmd, "restart:", arg)) {
 			if (MATCH_CMD(arg, "always", arg))
 				restart_max = -1;
@@ -1574,14 +1659,52 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 			restart_tmo = atoi(arg) * 1000;
 		else if (MATCH_CMD(cmd, "norestart", arg))
 			restart_max = 0;
+		else if (MATCH_CMD(cmd, "backoff:", arg))
+			backoff_max = atoi(arg) * 1000;
+		else if (MATCH_CMD(cmd, "burst:", arg)) {
+			char *ptr = strchr(arg, '/');
+
+			burst = atoi(arg);
+			burst_tmo = ptr ? atoi(++ptr) * 1000 : 0;
+			if (burst > 0 && burst_tmo > 0)
+				burst_tmo /= burst;
+			else
+				burst = 0;
+		}
 		else if (MATCH_CMD(cmd, "nowarn", arg))
 			nowarn = 1;
+		else if (MATCH_CMD(cmd, "critical", arg)) {
+			if (type & SVC_TYPE_RUNTASK)
+				logit(LOG_WARNING, "critical is only for services, ignoring.");
+			else
+				critical = 1;
+		}
+		else if (MATCH_CMD(cmd, "watchdog:", arg))
+			watchdog = atoi(arg) * 1000;
 		else if (MATCH_CMD(cmd, "oncrash:", arg)) {
 			if (MATCH_CMD(arg, "reboot", arg))
 				oncrash_action = SVC_ONCRASH_REBOOT;
 			if (MATCH_CMD(arg, "script", arg))
 				oncrash_action = SVC_ONCRASH_SCRIPT;
 		}
+		else if (MATCH_CMD(cmd, "oom:", arg)) {
+			if (MATCH_CMD(arg, "delay:", arg))
+				oom_delay = atoi(arg) * 1000;
+			else if (MATCH_CMD(arg, "high:", arg))
+				oom_high = atoi(arg);
+		}
+		else if (MATCH_CMD(cmd, "cpus:", arg))
+			cpus = arg;
+		else if (MATCH_CMD(cmd, "numa:", arg))
+			numa = arg;
+		else if (MATCH_CMD(cmd, "sched:", arg))
+			sched = arg;
+		else if (MATCH_CMD(cmd, "nice:", arg))
+			nice = arg;
+		else if (MATCH_CMD(cmd, "ionice:", arg))
+			ionice = arg;
+		else if (MATCH_CMD(cmd, "instances:", arg))
+			instances = conf_parse_instances(arg, NULL);
 		else if (MATCH_CMD(cmd, "respawn", arg))
 			respawn = 1;
 		else if (MATCH_CMD(cmd, "halt:", arg))
@@ -1624,6 +1747,16 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	if (ifstmt && !svc_ifthen(1, ident, ifstmt, nowarn))
 		return 0;
 
+	/* Timer tasks are only started by their timer, or initctl */
+	if (every || after || cal) {
+		if (type == SVC_TYPE_TASK)
+			manual = 1;
+		else {
+			logit(LOG_WARNING, "%s: every:, after-boot:, and cal: only for tasks", ident);
+			every = after = cal = NULL;
+		}
+	}
+
 	levels = conf_parse_runlevels(runlevels);
 	if (runlevel != INIT_LEVEL && !ISOTHER(levels, INIT_LEVEL)) {
 		dbg("Skipping %s%s%s, bootstrap is completed.",
@@ -1686,7 +1819,7 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	} else
 		svc = svc_find(name, id);
 
-	if (!whichp(cmd)) {
+	if (!which_cached(cmd)) {
 		if (nowarn)
 			return 0;
 
@@ -1694,6 +1827,7 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 		return errno;
 	}
 
+	svc_changed();
 	if (!svc) {
 		dbg("Creating new svc for %s name %s id %s type %d", cmd, name, id, type);
 		svc = svc_new(cmd, name, id, type);
@@ -1748,12 +1882,13 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 		svc->nologin = tty.nologin;
 		svc->notty   = tty.notty;
 		svc->rescue  = tty.rescue;
+		svc->lazy    = tty.lazy;
 
 		/* TTYs cannot be redirected */
 		log = NULL;
 	}
 
-	parse_cmdline_args(svc, cmd, &args);
+	parse_cmdline_args(svc, cmd, &args, argv);
 
 	/*
 	 * Warn if svc generates same condition (based on name:id)
@@ -1769,18 +1904,9 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 		parse_killdelay(svc, delay);
 	else
 		svc->killdelay = SVC_TERM_TIMEOUT;
-	if (pre_script)
-		parse_script("pre", pre_script, svc->pre_script, sizeof(svc->pre_script));
-	else
-		memset(svc->pre_script, 0, sizeof(svc->pre_script));
-	if (post_script)
-		parse_script("post", post_script, svc->post_script, sizeof(svc->post_script));
-	else
-		memset(svc->post_script, 0, sizeof(svc->post_script));
-	if (ready_script)
-		parse_script("ready", ready_script, svc->ready_script, sizeof(svc->ready_script));
-	else
-		memset(svc->ready_script, 0, sizeof(svc->ready_script));
+	pre_script   = parse_script("pre", pre_script);
+	post_script  = parse_script("post", post_script);
+	ready_script = parse_script("ready", ready_script);
 	if (!svc_is_tty(svc)) {
 		if (log)
 			parse_log(svc, log);
@@ -1793,33 +1919,58 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	  else
 		svc->notify = readiness;
 
-	if (desc)
-		strlcpy(svc->desc, desc, sizeof(svc->desc));
-	else if (type == SVC_TYPE_TTY)
-		snprintf(svc->desc, sizeof(svc->desc), "Getty on %s", svc->dev);
-	if (env)
-		parse_env(svc, env);
-	else
-		memset(svc->env, 0, sizeof(svc->env));
-	if (file)
-		strlcpy(svc->file, file, sizeof(svc->file));
-	else
-		memset(svc->file, 0, sizeof(svc->file));
+	/* Socket activation, only for services, rebind if changed */
+	if (!listen || !svc_is_daemon(svc))
+		listen = "";
+	if (strcmp(svc->listen, listen))
+		listen_close(svc);
+
+	/* Path activation, not for TTYs, rewatch if changed */
+	if (!path || type == SVC_TYPE_TTY)
+		path = "";
+	if (strcmp(svc->path, path))
+		path_close(svc);
+
+	if (!desc) {
+		if (type == SVC_TYPE_TTY) {
+			snprintf(getty, sizeof(getty), "Getty on %s", svc->dev);
+			desc = getty;
+		} else
+			desc = svc->desc;
+	}
+	if (svc_set_strings(svc, argv, desc, env, pre_script, post_script, ready_script, listen, path)) {
+		errx(1, "Out of memory, cannot register service %s", cmd);
+		return errno = ENOMEM;
+	}
+	svc_set_file(svc, file);
 	if (conflict)
 		strlcpy(svc->conflict, conflict, sizeof(svc->conflict));
 	else
 		memset(svc->conflict, 0, sizeof(svc->conflict));
-	if (ifstmt)
+	if (ifstmt) {
 		strlcpy(svc->ifstmt, ifstmt, sizeof(svc->ifstmt));
-	else
+		parse_ifcond(svc, ifstmt);
+	} else
 		memset(svc->ifstmt, 0, sizeof(svc->ifstmt));
 	svc->manual  = manual;
 	svc->nowarn  = nowarn;
+	svc->critical = critical;
+	svc->watchdog_msec = watchdog;
 	svc->respawn = respawn;
 	svc->forking = forking;
 	svc->restart_max = restart_max;
 	svc->restart_tmo = restart_tmo;
+	svc->backoff_max = backoff_max;
+	if (svc->burst != burst || svc->burst_tmo != burst_tmo)
+		svc->tokens_at = 0;
+	svc->burst = burst;
+	svc->burst_tmo = burst_tmo;
 	svc->oncrash_action = oncrash_action;
+	svc->oom_delay = oom_delay;
+	svc->oom_high  = oom_high;
+	svc->instances = instances;
+	timer_setup(svc, every, after, cal, spread);
+	affinity_setup(svc, cpus, numa, sched, nice, ionice);
 
 	/* Decode any (optional) pid:/optional/path/to/file.pid */
 	if (svc_is_daemon(svc) || svc_is_sysv(svc)) {
@@ -1889,14 +2040,15 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
  */
 void service_unregister(svc_t *svc)
 {
-	char *c;
+	struct cond_dep *iter = NULL;
+	const char *c;
 
 	if (!svc)
 		return;
 
 	service_stop(svc);
 
-	for (c = strtok(svc->cond, ","); c; c = strtok(NULL, ","))
+	for (c = cond_svc_iterator(&iter, 1, svc); c; c = cond_svc_iterator(&iter, 0, NULL))
 		devmon_del_cond(c);
 
 	svc_del(svc);
@@ -1909,9 +2061,12 @@ void service_monitor(pid_t lost, int status)
 	if (lost <= 1)
 		return;
 
+	metrics.reaped++;
+	TRACE2(reap, lost, status);
 	svc = svc_find_by_pid(lost);
 	if (!svc) {
-		if (service_script_del(lost))
+		if (service_script_del(lost) && plugin_script_done(lost, status) &&
+		    exec_collect(lost, status))
 			dbg("collected unknown PID %d", lost);
 		return;
 	}
@@ -1938,7 +2093,7 @@ void service_monitor(pid_t lost, int status)
 	if (svc_is_forking(svc)) {
 		/* Likely start script exiting */
 		if (svc_is_starting(svc)) {
-			svc->pid = 0;	/* Expect no more activity from this one */
+			svc_set_pid(svc, 0); /* Expect no more activity from this one */
 			goto cont;
 		}
 
@@ -1962,7 +2117,8 @@ void service_monitor(pid_t lost, int status)
 
 done:
 	/* No longer running, update books. */
-	svc->start_time = svc->pid = 0;
+	svc->start_time = 0;
+	svc_set_pid(svc, 0);
 cont:
 	if (lost == run_block_pid) {
 		int result = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
@@ -1984,19 +2140,128 @@ cont:
 	sm_step(&sm);
 }
 
-static void svc_mark_affected(char *cond)
+/**
+ * service_cgroup_empty - Called when a leaf cgroup has been drained
+ * @name: Name of leaf group, see svc_group()
+ *
+ * The main PID of a service may be collected before the rest of its
+ * processes have exited.  Services still in %SVC_STOPPING_STATE, with
+ * no main PID, wait for this to complete their stop.
+ */
+void service_cgroup_empty(char *name)
 {
 	svc_t *svc, *iter = NULL;
+	int stepped = 0;
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
-		if (!svc_has_cond(svc))
+	for (svc = svc_group_iterator(&iter, 1, name); svc; svc = svc_group_iterator(&iter, 0, name)) {
+		if (svc->state != SVC_STOPPING_STATE || svc->pid)
+			continue;
+
+		dbg("%s: cgroup empty, completing stop.", svc_ident(svc, NULL, 0));
+		service_step(svc);
+		stepped++;
+	}
+
+	if (stepped)
+		sm_step(&sm);
+}
+
+/* Raise memory.high of the leaf group by svc->oom_high percent, once per start */
+static void memory_high_raise(svc_t *svc, const char *path)
+{
+	unsigned long long val, raised;
+	char buf[32];
+
+	if (fnread(buf, sizeof(buf), "%s/memory.high", path) <= 0)
+		return;
+	if (!strncmp(buf, "max", 3))
+		return;
+
+	val = strtoull(buf, NULL, 10);
+	raised = val + val / 100 * svc->oom_high;
+	if (fnwrite(str("%llu", raised), "%s/memory.high", path)) {
+		warn("%s: failed raising memory.high", svc_ident(svc, NULL, 0));
+		return;
+	}
+
+	logit(LOG_NOTICE, "%s: memory.high raised from %llu to %llu until restart",
+	      svc_ident(svc, NULL, 0), val, raised);
+	svc->oom_raised = 1;
+}
+
+/* Counters are cumulative, a new group with restarted counters is a new baseline */
+static unsigned int memory_event(unsigned int val, unsigned int *seen)
+{
+	unsigned int delta = val >= *seen ? val - *seen : val;
+
+	*seen = val;
+
+	return delta;
+}
+
+static void memory_events(svc_t *svc, const char *path)
+{
+	unsigned int high = 0, oom_kill = 0;
+	char buf[64];
+	FILE *fp;
+
+	fp = fopenf("r", "%s/memory.events", path);
+	if (!fp)
+		return;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (!strncmp(buf, "high ", 5))
+			high = strtoul(&buf[5], NULL, 10);
+		else if (!strncmp(buf, "oom_kill ", 9))
+			oom_kill = strtoul(&buf[9], NULL, 10);
+	}
+	fclose(fp);
+
+	if (memory_event(oom_kill, &svc->oom_seen)) {
+		char cond[MAX_COND_LEN];
+
+		logit(LOG_CONSOLE | LOG_WARNING, "Service %s killed by the OOM killer",
+		      svc_ident(svc, NULL, 0));
+		svc->oom_tot++;
+		svc->oom = 1;
+
+		snprintf(cond, sizeof(cond), "oom/%s", svc_ident(svc, NULL, 0));
+		cond_set_oneshot(cond);
+	}
+
+	if (memory_event(high, &svc->high_seen) && svc->oom_high && !svc->oom_raised)
+		memory_high_raise(svc, path);
+}
+
+/**
+ * service_memory_events - Called when memory.events of a leaf group changes
+ * @name: Name of leaf group, see svc_group()
+ * @path: Path to leaf group
+ *
+ * Records OOM kills on the services of the group, asserting oom/NAME,
+ * and, with oom:high:PCT, raises memory.high when throttled.
+ */
+void service_memory_events(char *name, char *path)
+{
+	svc_t *svc, *iter = NULL;
+
+	for (svc = svc_group_iterator(&iter, 1, name); svc; svc = svc_group_iterator(&iter, 0, name)) {
+		if (svc_is_tty(svc))
 			continue;
 
-		if (cond_affects(cond, svc->cond))
-			svc_mark_dirty(svc);
+		memory_events(svc, path);
 	}
 }
 
+static void svc_mark_affected(char *cond)
+{
+	struct cond_dep *iter = NULL;
+	svc_t *svc;
+
+	for (svc = cond_dep_iterator(&iter, 1, cond); svc; svc = cond_dep_iterator(&iter, 0, NULL))
+		svc_mark_dirty(svc);
+}
+
 /*
  * Called on conf_reload() to update service reverse dependencies.
  * E.g., if ospfd depends on zebra and the zebra Finit conf has
@@ -2071,13 +2336,15 @@ static void set_pre_post_envs(svc_t *svc, const char *type)
 
 static void service_pre_script(svc_t *svc)
 {
-	svc->pid = service_fork(svc);
-	if (svc->pid < 0) {
+	pid_t pid;
+
+	pid = service_fork(svc);
+	if (pid < 0) {
 		err(1, "Failed forking off %s pre:script %s", svc_ident(svc, NULL, 0), svc->pre_script);
 		return;
 	}
 
-	if (svc->pid == 0) {
+	if (pid == 0) {
 		char buf[CMD_SIZE];
 		char *argv[4] = {
 			"sh",
@@ -2098,7 +2365,8 @@ static void service_pre_script(svc_t *svc)
 		_exit(EX_OSERR);
 	}
 
-	dbg("%s: pre:script %s started as PID %d", svc_ident(svc, NULL, 0), svc->pre_script, svc->pid);
+	svc_set_pid(svc, pid);
+	dbg("%s: pre:script %s started as PID %d", svc_ident(svc, NULL, 0), svc->pre_script, pid);
 
 	/* Short hard-coded timeout to prevent locking up Finit */
 	service_timeout_after(svc, svc->killdelay, service_kill_script);
@@ -2106,13 +2374,15 @@ static void service_pre_script(svc_t *svc)
 
 static void service_post_script(svc_t *svc)
 {
-	svc->pid = service_fork(svc);
-	if (svc->pid < 0) {
+	pid_t pid;
+
+	pid = service_fork(svc);
+	if (pid < 0) {
 		err(1, "Failed forking off %s post:script %s", svc_ident(svc, NULL, 0), svc->post_script);
 		return;
 	}
 
-	if (svc->pid == 0) {
+	if (pid == 0) {
 		char buf[CMD_SIZE];
 		char *argv[4] = {
 			"sh",
@@ -2151,7 +2421,8 @@ static void service_post_script(svc_t *svc)
 		_exit(EX_OSERR);
 	}
 
-	dbg("%s: post:script %s started as PID %d", svc_ident(svc, NULL, 0), svc->post_script, svc->pid);
+	svc_set_pid(svc, pid);
+	dbg("%s: post:script %s started as PID %d", svc_ident(svc, NULL, 0), svc->post_script, pid);
 
 	/* Short hard-coded timeout to prevent locking up Finit */
 	service_timeout_after(svc, svc->killdelay, service_kill_script);
@@ -2197,24 +2468,84 @@ void service_ready_script(svc_t *svc)
 	service_script_add(svc, pid);
 }
 
-static void service_retry(svc_t *svc)
+/*
+ * Token bucket of restarts, holds up to svc->burst tokens and regains
+ * one every svc->burst_tmo msec.  Each restart takes a token, with the
+ * bucket empty the restart is delayed until the next token.
+ *
+ * Returns 0 if restart is allowed, otherwise msec to next token.
+ */
+static int bucket_take(svc_t *svc)
 {
-	char *restart_cnt = (char *)&svc->restart_cnt;
-	int timeout;
+	long long now, num;
 
-	service_timeout_cancel(svc);
-	if (svc->respawn) {
-		dbg("%s crashed/exited, respawning ...", svc_ident(svc, NULL, 0));
-		svc_unblock(svc);
-		service_step(svc);
-		return;
+	if (!svc->burst)
+		return 0;
+
+	now = timeline_now();
+	if (!svc->tokens_at) {
+		svc->tokens    = svc->burst;
+		svc->tokens_at = now;
 	}
 
-	if (svc->state != SVC_HALTED_STATE ||
-	    svc->block != SVC_BLOCK_RESTARTING) {
-		svc->restart_tmo = svc->restart_saved;
-		svc_set_state(svc, SVC_RUNNING_STATE);
-		logit(LOG_CONSOLE | LOG_NOTICE, "Successfully restarted crashing service %s.",
+	num = (now - svc->tokens_at) / svc->burst_tmo;
+	if (num > 0) {
+		svc->tokens     = min(svc->burst, svc->tokens + (int)num);
+		svc->tokens_at += num * svc->burst_tmo;
+	}
+	if (svc->tokens == svc->burst)
+		svc->tokens_at = now;
+
+	if (svc->tokens > 0) {
+		svc->tokens--;
+		return 0;
+	}
+
+	return svc->burst_tmo - (int)(now - svc->tokens_at);
+}
+
+/*
+ * Exponential backoff, the delay doubles for each restart attempt, from
+ * the configured restart_sec (at least 2 sec) up to backoff_max.  Up to
+ * 25% jitter spreads out restarts of services crashing at the same time.
+ */
+static int backoff(svc_t *svc, int cnt)
+{
+	long long tmo = max(svc->restart_saved, 2000);
+
+	tmo <<= min(cnt - 1, 20);
+	if (tmo > svc->backoff_max)
+		tmo = svc->backoff_max;
+	tmo -= random() % (tmo / 4 + 1);
+
+	return (int)tmo;
+}
+
+static void service_retry(svc_t *svc)
+{
+	char *restart_cnt = (char *)&svc->restart_cnt;
+	int timeout;
+
+	service_timeout_cancel(svc);
+	if (svc->respawn) {
+		/* Burst limit applies to the delayed respawn as well */
+		timeout = bucket_take(svc);
+		if (timeout > 0) {
+			service_timeout_after(svc, timeout, service_retry);
+			return;
+		}
+
+		dbg("%s crashed/exited, respawning ...", svc_ident(svc, NULL, 0));
+		svc_unblock(svc);
+		service_step(svc);
+		return;
+	}
+
+	if (svc->state != SVC_HALTED_STATE ||
+	    svc->block != SVC_BLOCK_RESTARTING) {
+		svc->restart_tmo = svc->restart_saved;
+		svc_set_state(svc, SVC_RUNNING_STATE);
+		logit(LOG_CONSOLE | LOG_NOTICE, "Successfully restarted crashing service %s.",
 		      svc_ident(svc, NULL, 0));
 		return;
 	}
@@ -2245,15 +2576,27 @@ static void service_retry(svc_t *svc)
 		return;
 	}
 
+	timeout = bucket_take(svc);
+	if (timeout > 0) {
+		logit(LOG_CONSOLE | LOG_WARNING, "Service %s restarting too often, waiting %d msec",
+		      svc_ident(svc, NULL, 0), timeout);
+		service_timeout_after(svc, timeout, service_retry);
+		return;
+	}
+
 	(*restart_cnt)++;
 
 	dbg("%s crashed, trying to start it again, attempt %d", svc_ident(svc, NULL, 0), *restart_cnt);
 	if ((*restart_cnt) == 1)
 		svc->restart_saved = svc->restart_tmo;
-	/* Wait 2s for the first 5 respawns, then back off to 5s */
-	timeout = ((*restart_cnt) <= (svc->restart_max / 2)) ? 2000 : 5000;
-	/* If a longer timeout was specified in the conf, use that instead. */
-	svc->restart_tmo = max(svc->restart_tmo, timeout);
+	if (svc->backoff_max) {
+		svc->restart_tmo = backoff(svc, *restart_cnt);
+	} else {
+		/* Wait 2s for the first 5 respawns, then back off to 5s */
+		timeout = ((*restart_cnt) <= (svc->restart_max / 2)) ? 2000 : 5000;
+		/* If a longer timeout was specified in the conf, use that instead. */
+		svc->restart_tmo = max(svc->restart_tmo, timeout);
+	}
 	logit(LOG_CONSOLE|LOG_WARNING, "Service %s[%d] died, restarting in %d msec (%d/%d)",
 	      svc_ident(svc, NULL, 0), svc->oldpid, svc->restart_tmo, *restart_cnt, svc->restart_max);
 
@@ -2263,10 +2606,161 @@ static void service_retry(svc_t *svc)
 	service_timeout_after(svc, svc->restart_tmo, service_retry);
 }
 
+/**
+ * service_jobs - Set max number of concurrently starting services
+ * @levels: Runlevel bitmask, 0 for the default of all runlevels
+ * @max:    Max number of starting jobs, 0 for unlimited
+ *
+ * Called when parsing finit.conf, with @levels -1 to reset all limits
+ * before a reload.
+ */
+void service_jobs(int levels, int max)
+{
+	int i;
+
+	if (levels < 0) {
+		jobs_default = 0;
+		jobs_levels = 0;
+		memset(jobs_max, 0, sizeof(jobs_max));
+		return;
+	}
+
+	if (!levels) {
+		jobs_default = max;
+		return;
+	}
+
+	for (i = 0; i <= INIT_LEVEL; i++) {
+		if (!ISSET(levels, i))
+			continue;
+		jobs_max[i] = max;
+	}
+	jobs_levels |= levels;
+}
+
+/*
+ * A job slot is claimed when a service leaves the waiting state, it is
+ * held while in setup, starting, and running, until the service is
+ * ready, see service_ready(), or is stopped.  TTYs are exempt.
+ */
+static int slot_get(svc_t *svc)
+{
+	int max = jobs_default;
+
+	if (svc->slot || svc_is_tty(svc))
+		return 1;
+
+	if (ISSET(jobs_levels, runlevel))
+		max = jobs_max[runlevel];
+	if (max && jobs_active >= max)
+		return 0;
+
+	svc->slot = 1;
+	jobs_active++;
+
+	return 1;
+}
+
+/* Release job slot and let any services parked waiting for it retry */
+static void slot_put(svc_t *svc)
+{
+	if (!svc->slot)
+		return;
+
+	svc->slot = 0;
+	jobs_active--;
+
+	if (svc_runq_unpark())
+		schedule_work(&work);
+}
+
+static void aging_start(svc_t *svc);
+
+/*
+ * Every five¹ minutes a running service with a non-zero crash counter
+ * has it decremented, allowing services that have started after an
+ * initial crash to slowly prove themselves again as stable services.
+ * Previously this counter was reset as soon as such services had
+ * stopped crashing at least once per second.  This scheme allows us to
+ * catch those that rage-quit immediately when we try to start them, but
+ * now also those that are only slightly buggy -- when they reach their
+ * restart_max, they too are marked 'crashed'.
+ *
+ * Each service has its own timer, armed when it enters running with a
+ * non-zero counter, so only unstable services are ever visited.
+ *
+ * This does not affect the restart_tot counter, which you can see in
+ * the output from 'initctl status foo', along with this instability
+ * "index" in parethesis: total (cnt/max)
+ *
+ * ¹) Default, see service-interval in finit.conf
+ */
+static void service_aging(void *arg)
+{
+	svc_t *svc = (svc_t *)((struct wq *)arg)->arg;
+	char *restart_cnt = (char *)&svc->restart_cnt;
+
+	if (!svc_is_running(svc) || *restart_cnt <= 0)
+		return;
+
+	logit(LOG_CONSOLE | LOG_DEBUG, "Aging %s instability index (%d/%d)",
+	      svc_ident(svc, NULL, 0), svc->restart_cnt, svc->restart_max);
+	(*restart_cnt)--;
+
+	aging_start(svc);
+}
+
+static void aging_start(svc_t *svc)
+{
+	if (!service_interval || svc->restart_cnt <= 0 || work_pending(&svc->aging))
+		return;
+	if (!svc_is_daemon(svc) && !svc_is_sysv(svc))
+		return;
+
+	svc->aging.cb    = service_aging;
+	svc->aging.arg   = svc;
+	svc->aging.prio  = WQ_LOW;
+	svc->aging.delay = service_interval;
+	schedule_work(&svc->aging);
+}
+
+/*
+ * Software watchdog of a service, with watchdog:SEC and notify:systemd
+ * the service must send WATCHDOG=1 at least every SEC while running,
+ * otherwise it is aborted and the normal crash handling restarts it.
+ */
+static void service_watchdog(void *arg)
+{
+	svc_t *svc = (svc_t *)((struct wq *)arg)->arg;
+
+	if (!svc_is_running(svc) || svc->pid <= 1)
+		return;
+
+	logit(LOG_WARNING, "%s: watchdog timeout, no keepalive in %d sec, aborting it.",
+	      svc_ident(svc, NULL, 0), svc->watchdog_msec / 1000);
+	kill(svc->pid, SIGABRT);
+}
+
+/**
+ * service_watchdog_kick - Restart the software watchdog of a service
+ * @svc: Service that sent WATCHDOG=1, or entered running
+ */
+void service_watchdog_kick(svc_t *svc)
+{
+	if (svc->watchdog_msec <= 0 || !svc_is_running(svc))
+		return;
+
+	svc->watchdog.cb    = service_watchdog;
+	svc->watchdog.arg   = svc;
+	svc->watchdog.delay = svc->watchdog_msec;
+	schedule_work(&svc->watchdog);
+}
+
 static void svc_set_state(svc_t *svc, svc_state_t new_state)
 {
 	svc_state_t *state = (svc_state_t *)&svc->state;
 	const svc_state_t old_state = svc->state;
+	long long now;
 
 	/* if PID isn't collected within SVC_TERM_TIMEOUT msec, kill it! */
 	if (new_state == SVC_STOPPING_STATE) {
@@ -2276,10 +2770,77 @@ static void svc_set_state(svc_t *svc, svc_state_t new_state)
 		service_timeout_after(svc, svc->killdelay, service_kill);
 	}
 
+	if (new_state != SVC_STOPPING_STATE)
+		svc->draining = 0;
+
 	if (svc->state == new_state)
 		return;
 	*state = new_state;
 
+	now = timeline_now();
+	svc->state_msec[old_state] += now - svc->state_at;
+	svc->state_at = now;
+	TRACE4(svc_state, svc->name, svc->id, old_state, new_state);
+	api_event(INIT_EVENT_SVC, svc_ident(svc, NULL, 0), new_state, old_state, svc->pid);
+
+	switch (new_state) {
+	case SVC_SETUP_STATE:
+	case SVC_STARTING_STATE:
+	case SVC_RUNNING_STATE:
+		break;
+
+	default:
+		slot_put(svc);
+		break;
+	}
+
+	/* Sockets and lazy TTYs are only watched while waiting */
+	if (new_state != SVC_WAITING_STATE) {
+		listen_stop(svc);
+		tty_unwatch(svc);
+	}
+	if (new_state != SVC_RUNNING_STATE)
+		cancel_work(&svc->watchdog);
+	if (new_state == SVC_HALTED_STATE) {
+		svc_set_status(svc, NULL);
+		svc->activated = 0;
+	}
+	/* Path activated run/task, activity from now on runs it again */
+	if (new_state == SVC_STARTING_STATE && svc_is_runtask(svc))
+		svc->activated = 0;
+
+	switch (new_state) {
+	case SVC_WAITING_STATE:
+		timeline_stamp(svc, SVC_STAMP_ENABLED);
+		break;
+
+	case SVC_SETUP_STATE:
+		timeline_stamp(svc, SVC_STAMP_COND);
+		break;
+
+	case SVC_STARTING_STATE:
+		if (old_state == SVC_SETUP_STATE)
+			timeline_stamp(svc, SVC_STAMP_PRE);
+		else
+			timeline_stamp(svc, SVC_STAMP_COND);
+		break;
+
+	case SVC_RUNNING_STATE:
+		if (old_state == SVC_STARTING_STATE)
+			timeline_stamp(svc, SVC_STAMP_FORK);
+		aging_start(svc);
+		service_watchdog_kick(svc);
+		break;
+
+	case SVC_DONE_STATE:
+		timeline_stamp(svc, SVC_STAMP_READY);
+		metrics_ready(svc);
+		break;
+
+	default:
+		break;
+	}
+
 	if (svc_is_runtask(svc)) {
 		char success[MAX_COND_LEN], failure[MAX_COND_LEN];
 
@@ -2342,11 +2903,128 @@ void service_forked(svc_t *svc)
 	svc_set_state(svc, SVC_RUNNING_STATE);
 }
 
+/*
+ * Rolling restart of the instances of a template with instances:N, so
+ * capacity never drops to zero.  Instances, sharing the same name, are
+ * restarted in batches of a quarter, at least one, the next batch when
+ * service_ready() reports the previous as ready.  Instances that fail
+ * to start, e.g. crash, or wait for a condition, do not hold up the rest
+ * for longer than ROLLING_TIMEOUT after they have stopped.  A restart
+ * of an instance already restarting queues it for another round.
+ */
+#define ROLLING_TIMEOUT 30000	/* msec */
+
+static void rolling_cb(void *arg);
+static struct wq rolling_work = {
+	.cb = rolling_cb,
+};
+
+static int rolling_batch(svc_t *svc)
+{
+	int num = svc->instances / 4;
+
+	return num > 0 ? num : 1;
+}
+
+/* Instances of the same template restarting now */
+static int rolling_busy(svc_t *svc)
+{
+	svc_t *s, *iter = NULL;
+	int num = 0;
+
+	for (s = svc_named_iterator(&iter, 1, svc->name); s; s = svc_named_iterator(&iter, 0, svc->name)) {
+		if (s->rolling >= 2)
+			num++;
+	}
+
+	return num;
+}
+
+/* Restarted, or failed, leave the batch, back to queue if asked again */
+static void rolling_done(svc_t *svc)
+{
+	svc->rolling = svc->rolling == 3 ? 1 : 0;
+	rolling_work.delay = 0;
+	schedule_work(&rolling_work);
+}
+
+static void rolling_cb(void *arg)
+{
+	long long now = timeline_now();
+	svc_t *svc, *iter = NULL;
+	int busy = 0;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->rolling < 2)
+			continue;
+
+		if (svc_is_blocked(svc) || svc_is_removed(svc) ||
+		    now - svc->rolling_at > svc->killdelay + ROLLING_TIMEOUT) {
+			dbg("%s: rolling restart failed, continuing", svc_ident(svc, NULL, 0));
+			rolling_done(svc);
+			continue;
+		}
+		busy++;
+	}
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->rolling != 1 || rolling_busy(svc) >= rolling_batch(svc))
+			continue;
+
+		dbg("%s: rolling restart", svc_ident(svc, NULL, 0));
+		svc->rolling = 2;
+		svc->rolling_at = now;
+		busy++;
+
+		service_timeout_cancel(svc);
+		if (svc_is_running(svc))
+			service_stop(svc);
+		else
+			svc_start(svc);
+		service_step(svc);
+	}
+
+	/* Poll for instances that fail to start */
+	if (busy) {
+		rolling_work.delay = 1000;
+		schedule_work(&rolling_work);
+	}
+}
+
+/**
+ * service_rolling - Restart instance of a template as part of a batch
+ * @svc: Instance of a template with instances:N
+ *
+ * All instances of a template named in the same request are queued
+ * first, then restarted batch by batch from the work queue.  Instances
+ * already queued are left as-is, those restarting now are queued again.
+ */
+void service_rolling(svc_t *svc)
+{
+	if (svc->rolling == 2)
+		svc->rolling = 3;
+	if (svc->rolling)
+		return;
+
+	svc->rolling = 1;
+	rolling_work.delay = 0;
+	schedule_work(&rolling_work);
+}
+
 /* Set or clear service/foo/ready condition for services and call optional ready:script */
 void service_ready(svc_t *svc, int ready)
 {
 	char buf[MAX_COND_LEN];
 
+	if (ready) {
+		timeline_stamp(svc, SVC_STAMP_READY);
+		metrics_ready(svc);
+		slot_put(svc);
+
+		if (svc->rolling >= 2)
+			rolling_done(svc);
+	}
+
 	if (!svc_is_daemon(svc))
 		return;
 
@@ -2360,6 +3038,218 @@ void service_ready(svc_t *svc, int ready)
 		cond_clear(buf);
 }
 
+/*
+ * At runlevel change, and shutdown, services are stopped in reverse
+ * dependency order: a service is kept running until all services that
+ * depend on it, by a pid/, service/, run/ or task/ condition, and that
+ * are also being stopped, have been collected.  Services that do not
+ * depend on each other are stopped at the same time.  At shutdown the
+ * whole teardown also has a deadline, see service_deadline().
+ *
+ * The dependents of each service are looked up in a reverse provider
+ * map, sorted by provider, built at the first teardown after the set
+ * of services has changed, see svc_generation().
+ */
+struct dep_edge {
+	svc_t *provider;
+	svc_t *dep;
+};
+
+static struct dep_edge *dep_map;
+static size_t           dep_num;
+static unsigned         dep_gen;
+
+static int dep_cmp(const void *a, const void *b)
+{
+	uintptr_t pa = (uintptr_t)((const struct dep_edge *)a)->provider;
+	uintptr_t pb = (uintptr_t)((const struct dep_edge *)b)->provider;
+
+	return (pa > pb) - (pa < pb);
+}
+
+static int dep_map_build(void)
+{
+	svc_t *dep, *iter = NULL;
+	size_t max = 0;
+
+	if (dep_gen == svc_generation())
+		return 0;
+
+	free(dep_map);
+	dep_map = NULL;
+	dep_num = 0;
+
+	for (dep = svc_iterator(&iter, 1); dep; dep = svc_iterator(&iter, 0)) {
+		struct cond_dep *it = NULL;
+		const char *c;
+
+		for (c = cond_svc_iterator(&it, 1, dep); c; c = cond_svc_iterator(&it, 0, NULL)) {
+			svc_t *provider = svc_find_provider(c);
+
+			if (!provider || provider == dep)
+				continue;
+
+			if (dep_num == max) {
+				struct dep_edge *map;
+
+				max = max ? max * 2 : 64;
+				map = realloc(dep_map, max * sizeof(*map));
+				if (!map) {
+					warn("Failed building dependency map for teardown");
+					free(dep_map);
+					dep_map = NULL;
+					return -1;
+				}
+				dep_map = map;
+			}
+			dep_map[dep_num++] = (struct dep_edge){ provider, dep };
+		}
+	}
+
+	if (dep_num)
+		qsort(dep_map, dep_num, sizeof(*dep_map), dep_cmp);
+	dep_gen = svc_generation();
+
+	return 0;
+}
+
+static int has_dependents(svc_t *svc)
+{
+	size_t lo = 0, hi;
+
+	if (expired || dep_map_build())
+		return 0;
+
+	/* First edge of @svc, if any */
+	hi = dep_num;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if ((uintptr_t)dep_map[mid].provider < (uintptr_t)svc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < dep_num && dep_map[lo].provider == svc; lo++) {
+		svc_t *dep = dep_map[lo].dep;
+
+		if (dep->pid <= 1)
+			continue;
+		if (dep->state != SVC_STOPPING_STATE && svc_enabled(dep))
+			continue;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * service_teardown - Stop services whose dependents have been stopped
+ *
+ * Called by the state machine when waiting for services to stop at
+ * runlevel change.  If all remaining services wait for each other,
+ * i.e., a circular dependency, they are all stopped.
+ *
+ * Returns:
+ * A service that is still to be collected, or %NULL when done.
+ */
+svc_t *service_teardown(void)
+{
+	svc_t *svc, *iter = NULL;
+	svc_t *pending = NULL, *stopped = NULL;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->state != SVC_RUNNING_STATE || svc_enabled(svc))
+			continue;
+
+		if (has_dependents(svc)) {
+			pending = svc;
+			continue;
+		}
+
+		service_stop(svc);
+		stopped = svc;
+	}
+
+	if (stopped || !pending)
+		return stopped;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->state != SVC_RUNNING_STATE || svc_enabled(svc))
+			continue;
+
+		logit(LOG_WARNING, "Circular dependency, stopping %s", svc_ident(svc, NULL, 0));
+		service_stop(svc);
+	}
+
+	return pending;
+}
+
+/*
+ * Deadline passed, stop all remaining services, regardless of order,
+ * and SIGKILL those that are already stopping.
+ */
+static void deadline_cb(void *unused)
+{
+	svc_t *svc, *iter = NULL;
+
+	logit(LOG_CONSOLE | LOG_WARNING, "Shutdown deadline passed, killing remaining services ...");
+	expired = 1;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->pid <= 1 || svc_enabled(svc))
+			continue;
+
+		if (svc->state == SVC_RUNNING_STATE)
+			service_stop(svc);
+		if (svc->state == SVC_STOPPING_STATE)
+			service_kill(svc);
+	}
+}
+
+/**
+ * service_deadline - Set deadline for stopping all services
+ * @sec: Seconds from now, zero to disable
+ *
+ * Set when entering runlevel 0 or 6, covers the whole teardown, the
+ * remaining time is also used for unmounting file systems.
+ */
+void service_deadline(int sec)
+{
+	cancel_work(&deadline_work);
+	expired = 0;
+	deadline = 0;
+
+	if (sec <= 0)
+		return;
+
+	deadline = timeline_now() + sec * 1000LL;
+	deadline_work.delay = sec * 1000;
+	schedule_work(&deadline_work);
+}
+
+/**
+ * service_deadline_left - Time left of the shutdown deadline
+ *
+ * Returns:
+ * Milliseconds left, zero if passed, or -1 if there is no deadline.
+ */
+int service_deadline_left(void)
+{
+	long long left;
+
+	if (!deadline)
+		return -1;
+
+	left = deadline - timeline_now();
+	if (left <= 0)
+		return 0;
+
+	return (int)left;
+}
+
 /*
  * Transition task/run/service
  *
@@ -2368,25 +3258,29 @@ void service_ready(svc_t *svc, int ready)
 int service_step(svc_t *svc)
 {
 	char *restart_cnt = (char *)&svc->restart_cnt;
-	int changed = 0, waiting = 0;
+	int changed = 0;
 	svc_state_t old_state;
 	cond_state_t cond;
 	svc_cmd_t enabled;
+	int wait;
 	int err;
 
+	metrics.steps++;
 restart:
 	old_state = svc->state;
 	enabled = svc_enabled(svc);
 
 	dbg("%20s(%4d): %8s %3sabled/%-7s cond:%-4s", svc_ident(svc, NULL, 0), svc->pid,
 	   svc_status(svc), enabled ? "en" : "dis", svc_dirtystr(svc),
-	   condstr(cond_get_agg(svc->cond)));
+	   condstr(cond_get_svc(svc)));
 
 	switch (svc->state) {
 	case SVC_HALTED_STATE:
 		if (enabled)
 			svc_set_state(svc, SVC_WAITING_STATE);
 		else {
+			listen_close(svc);
+			path_close(svc);
 			if (svc_is_conflict(svc)) {
 #if 0
 				logit(svc->nowarn ? LOG_DEBUG : LOG_INFO,
@@ -2395,6 +3289,8 @@ restart:
 #endif
 				if (!svc_conflicts(svc))
 					svc_unblock(svc);
+				else
+					svc_runq_park(svc);
 			}
 		}
 		break;
@@ -2404,10 +3300,16 @@ restart:
 			svc_set_state(svc, SVC_HALTED_STATE);
 		if (svc_is_runtask(svc) && svc_is_manual(svc) && enabled)
 			svc_set_state(svc, SVC_WAITING_STATE);
+		/* Path activated while running, or since, run again */
+		if (svc_has_path(svc) && enabled && svc->state == SVC_DONE_STATE) {
+			path_start(svc);
+			if (svc->activated)
+				svc_set_state(svc, SVC_WAITING_STATE);
+		}
 		break;
 
 	case SVC_STOPPING_STATE:
-		if (!svc->pid) {
+		if (!svc->pid && (!svc->draining || !group_busy(svc))) {
 			char condstr[MAX_COND_LEN];
 
 			dbg("%s: stopped, cleaning up timers and conditions ...", svc_ident(svc, NULL, 0));
@@ -2454,7 +3356,7 @@ restart:
 	case SVC_WAITING_STATE:
 		if (!enabled) {
 			svc_set_state(svc, SVC_HALTED_STATE);
-		} else if (cond_get_agg(svc->cond) == COND_ON) {
+		} else if (cond_get_svc(svc) == COND_ON) {
 			/* wait until all processes have been stopped before continuing... */
 			if (sm_is_in_teardown(&sm))
 				break;
@@ -2469,12 +3371,41 @@ restart:
 				break;
 			}
 
+			/* Socket activated, wait for first connection */
+			if (svc_has_listen(svc) && !svc->activated) {
+				if (!listen_start(svc))
+					break;
+			}
+
+			/* Path activated, wait for path to appear or change */
+			if (svc_has_path(svc) && !svc->activated) {
+				if (!path_start(svc) && !path_check(svc))
+					break;
+				svc->activated = 1;
+			}
+
+			/* Lazy getty, wait for input on the TTY */
+			if (svc_is_lazy(svc) && !svc->activated) {
+				if (!tty_watch(svc))
+					break;
+			}
+
+			/* Too many services starting, wait for a free slot */
+			if (!slot_get(svc)) {
+				dbg("%s: waiting for a job slot", svc_ident(svc, NULL, 0));
+				svc_runq_park(svc);
+				break;
+			}
+
 			if (svc_has_pre(svc)) {
 				svc_set_state(svc, SVC_SETUP_STATE);
 				service_pre_script(svc);
 				break;
 			}
 			svc_set_state(svc, SVC_STARTING_STATE);
+		} else {
+			listen_stop(svc);
+			tty_unwatch(svc);
 		}
 		break;
 
@@ -2487,8 +3418,10 @@ restart:
 		err = service_start(svc);
 		if (err) {
 			/* Busy, waiting for run task, try again later */
-			if (run_block_pid)
+			if (run_block_pid) {
+				svc_runq_park(svc);
 				break;
+			}
 
 			if (svc_is_missing(svc)) {
 				svc_set_state(svc, SVC_HALTED_STATE);
@@ -2504,15 +3437,33 @@ restart:
 
 	case SVC_RUNNING_STATE:
 		if (!enabled) {
+			/* Dependents first, see service_teardown() */
+			if (sm_is_in_teardown(&sm) && has_dependents(svc))
+				break;
 			service_stop(svc);
 			break;
 		}
 
 		if (!svc->pid) {
 			if (svc_is_daemon(svc) || svc_is_sysv(svc) || svc_is_tty(svc)) {
+				char path[256];
+
+				timeline_stamp(svc, SVC_STAMP_CRASH);
 				svc_restarting(svc); /* BLOCK_RESTARTING */
 				svc_set_state(svc, SVC_HALTED_STATE);
 
+				/* The inotify event may still be queued, unless group is gone */
+				if (!svc_is_tty(svc) && service_cgroup(svc, path, sizeof(path)))
+					memory_events(svc, path);
+
+				/* Back off from the same memory pressure */
+				if (svc->oom && svc->oom_delay) {
+					logit(LOG_CONSOLE | LOG_WARNING, "Service %s OOM killed, restarting in %d msec",
+					      svc_ident(svc, NULL, 0), svc->oom_delay);
+					service_timeout_after(svc, svc->oom_delay, service_retry);
+					goto done;
+				}
+
 				/*
 				 * Restart directly after the first crash, except for forking services
 				 * which we need to wait for the forked-off child to create its pid
@@ -2524,6 +3475,14 @@ restart:
 					goto done;
 				}
 
+				wait = bucket_take(svc);
+				if (wait > 0) {
+					logit(LOG_CONSOLE | LOG_WARNING, "Service %s respawning too often, waiting %d msec",
+					      svc_ident(svc, NULL, 0), wait);
+					service_timeout_after(svc, wait, service_retry);
+					goto done;
+				}
+
 				dbg("respawning %s", svc_ident(svc, NULL, 0));
 				svc_unblock(svc);
 				break;
@@ -2538,7 +3497,7 @@ restart:
 		}
 		service_timeout_cancel(svc);
 
-		cond = cond_get_agg(svc->cond);
+		cond = cond_get_svc(svc);
 		switch (cond) {
 		case COND_OFF:
 			service_stop(svc);
@@ -2584,7 +3543,7 @@ restart:
 			break;
 		}
 
-		cond = cond_get_agg(svc->cond);
+		cond = cond_get_svc(svc);
 		switch (cond) {
 		case COND_ON:
 			kill(svc->pid, SIGCONT);
@@ -2616,9 +3575,6 @@ restart:
 		break;
 	}
 
-	/* Are we waiting for a run task to complete? */
-	waiting = run_block_pid;
-
 	if (svc->state != old_state) {
 		dbg("%20s(%4d): -> %8s", svc_ident(svc, NULL, 0), svc->pid, svc_status(svc));
 		changed++;
@@ -2629,21 +3585,52 @@ done:
 	/*
 	 * When a run/task/service changes state, e.g. transitioning from
 	 * waiting to running, other services may need to change state too.
+	 * Services depending on it by condition have already been stepped,
+	 * but services parked on a conflict or a run task need a new try.
 	 */
-	if (changed || waiting)
+	if (changed && svc_runq_unpark())
 		schedule_work(&work);
 
 	return 0;
 }
 
+/*
+ * Full pass over all services, used at bootstrap, runlevel change, and
+ * reload.  Otherwise services are stepped by the event affecting them,
+ * or from the run queue, see service_schedule().
+ */
 void service_step_all(int types)
 {
-	svc_foreach_type(types, service_step);
+	profile_foreach_type(types, service_step);
 }
 
+/**
+ * service_schedule - Step a service later, from the run queue
+ * @svc: Service to step
+ */
+void service_schedule(svc_t *svc)
+{
+	svc_runq_add(svc);
+	schedule_work(&work);
+}
+
+/*
+ * Step services in the run queue, stopping before starting, at most
+ * WQ_BUDGET per call so a full pass yields to I/O now and then.
+ */
 void service_worker(void *unused)
 {
-	service_step_all(SVC_TYPE_RESPAWN | SVC_TYPE_RUNTASK);
+	svc_t *svc;
+	int num = 0;
+
+	while ((svc = svc_runq_pop())) {
+		service_step(svc);
+		if (++num >= WQ_BUDGET) {
+			if (svc_runq_len())
+				schedule_work(&work);
+			break;
+		}
+	}
 }
 
 /**
@@ -2693,14 +3680,14 @@ int service_completed(svc_t **svcp)
 		if (!svc_is_runtask(svc))
 			continue;
 
-		if (!svc_enabled(svc))
+		if (!svc_enabled(svc) || svc_has_timer(svc) || svc_has_path(svc))
 			continue;
 
 		if (svc_conflicts(svc))
 			continue;
 
-		if (strstr(svc->cond, plugin_hook_str(HOOK_SVC_UP)) ||
-		    strstr(svc->cond, plugin_hook_str(HOOK_SYSTEM_UP))) {
+		if (cond_svc_has(svc, plugin_hook_str(HOOK_SVC_UP)) ||
+		    cond_svc_has(svc, plugin_hook_str(HOOK_SYSTEM_UP))) {
 			dbg("Skipping %s(%s), post-strap hook", svc->desc, svc_ident(svc, NULL, 0));
 			continue;
 		}
@@ -2747,8 +3734,9 @@ void service_notify_reconf(void)
 void service_notify_cb(uev_t *w, void *arg, int events)
 {
 	svc_t *svc = (svc_t *)arg;
-	char buf[32];
+	char buf[512];
 	ssize_t len;
+	PROBE("service/notify");
 
 	if (UEV_ERROR == events) {
 		warn("Spurious problem with %s notify callback, restarting.", svc_ident(svc, NULL, 0));
@@ -2764,88 +3752,21 @@ void service_notify_cb(uev_t *w, void *arg, int events)
 
 	buf[len] = 0;
 
-	/* systemd and s6, respectively.  The latter then closes the socket */
-	if (!strcmp(buf, "READY=1\n") || !strcmp(buf, "\n")) {
-		/*
-		 * native (pidfile) services are marked as started by
-		 * the pidfile plugin.
-		 */
-		svc_started(svc);
-
-		/*
-		 * On reload, and this svc is unmodified, it is up to
-		 * the service_notify_reconf() function to step the
-		 * generation of the READY condition.
-		 */
-		service_ready(svc, 1);
+	/* s6 applications send a newline and then close their socket */
+	if (svc->notify == SVC_NOTIFY_S6) {
+		if (strcmp(buf, "\n"))
+			return;
 
-		/* s6 applications close their socket after notification */
-		if (svc->notify == SVC_NOTIFY_S6) {
-			uev_io_stop(w);
-			close(w->fd);
-			w->fd = 0;
-		}
-	}
-}
+		strlcpy(buf, "READY=1", sizeof(buf));
+		notify_parse(svc, buf);
 
-/*
- * Every five¹ minutes we sweep over all services, skipping crashed or
- * otherwise no longer running ones.  Decrement non-zero crash counters
- * to allow services that have started after an initial crash to slowly
- * prove themselves again as stable services.  Previously this counter
- * was reset as soon as such services had stopped crashing at least once
- * per second.  This new scheme allows us to catch those that rage-quit
- * immediately when we try to start them, but now also those that are
- * only slightly buggy -- when they reach their restart_max, they too
- * are marked 'crashed'.
- *
- * This does not affect the restart_tot counter, which you can see in
- * the output from 'initctl status foo', along with this instability
- * "index" in parethesis: total (cnt/max)
- */
-static void service_interval_cb(uev_t *w, void *arg, int events)
-{
-	svc_t *svc, *iter = NULL;
-
-	(void)arg;
-	if (UEV_ERROR == events) {
-		uev_timer_start(w);
+		uev_io_stop(w);
+		close(w->fd);
+		w->fd = 0;
 		return;
 	}
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
-		if (svc_is_daemon(svc) || svc_is_sysv(svc)) {
-			char *restart_cnt = (char *)&svc->restart_cnt;
-
-			if (!svc_is_running(svc))
-				continue;
-
-			if (*restart_cnt > 0) {
-				logit(LOG_CONSOLE | LOG_DEBUG, "Aging %s instability index (%d/%d)",
-				      svc_ident(svc, NULL, 0), svc->restart_cnt, svc->restart_max);
-				(*restart_cnt)--;
-			}
-		}
-	}
-
-	service_init(NULL);
-}
-
-/*
- * The service_interval may change (conf) between invocations, so we
- * periodically reset the one-shot timer instead of using a periodic.
- */
-void service_init(uev_ctx_t *ctx)
-{
-	static int initialized = 0;
-	static uev_t watcher;
-
-	if (!initialized)
-		uev_timer_init(ctx, &watcher, service_interval_cb, NULL, service_interval, 0);
-	else
-		uev_timer_set(&watcher, service_interval, 0);
-
-	initialized = 1;
+	notify_parse(svc, buf);
 }
 
 /**
@@ -41,18 +41,28 @@ void      service_ready_script   (svc_t *svc); /* XXX: only for pidfile plugin b
 int       service_timeout_after  (svc_t *svc, int timeout, void (*cb)(svc_t *svc));
 int       service_timeout_cancel (svc_t *svc);
 
+void      service_jobs           (int levels, int max);
+void      service_cgroup_empty   (char *name);
+void      service_memory_events  (char *name, char *path);
+char     *service_cgroup         (svc_t *svc, char *path, size_t len);
+
 void      service_forked         (svc_t *svc);
 void      service_ready          (svc_t *svc, int ready);
+void      service_rolling        (svc_t *svc);
+void      service_watchdog_kick  (svc_t *svc);
 
 int       service_stop           (svc_t *svc);
 int       service_step           (svc_t *svc);
 void      service_step_all       (int types);
+void      service_schedule       (svc_t *svc);
 void      service_worker         (void *unused);
 
 int       service_completed      (svc_t **svc);
+svc_t    *service_teardown       (void);
+void      service_deadline       (int sec);
+int       service_deadline_left  (void);
 void      service_notify_reconf  (void);
 
-void      service_init           (uev_ctx_t *ctx);
 
 #endif	/* FINIT_SERVICE_H_ */
 
@@ -89,13 +89,16 @@
 #include "cond.h"
 #include "conf.h"
 #include "config.h"
+#include "conout.h"
 #include "helpers.h"
+#include "metrics.h"
 #include "plugin.h"
 #include "private.h"
 #include "sig.h"
 #include "service.h"
 #include "util.h"
 #include "utmp-api.h"
+#include "wdt.h"
 
 /*
  * Old-style SysV shutdown sends a setenv cmd INIT_HALT with "=HALT",
@@ -165,9 +168,8 @@ static struct sigmap {
 #endif
 };
 
-void mdadm_wait(void);
-void unmount_tmpfs(void);
-void unmount_regular(void);
+void unmount_tmpfs(int msec);
+void unmount_regular(int msec);
 
 static void fs_swapoff(void)
 {
@@ -286,6 +288,44 @@ static int do_wait(int secs)
 	return has_proc;
 }
 
+/* Kernel image loaded with kexec -l, or kexec -s */
+static int kexec_loaded(void)
+{
+	FILE *fp;
+	int val = 0;
+
+	fp = fopen("/sys/kernel/kexec_loaded", "r");
+	if (!fp)
+		return 0;
+	if (fscanf(fp, "%d", &val) != 1)
+		val = 0;
+	fclose(fp);
+
+	return val == 1;
+}
+
+/*
+ * Before kexec, have the built-in watchdogd magic close the device, on
+ * SIGUSR1, and wait for it to exit.  An external watchdog daemon gets
+ * SIGTERM.  The integrated watchdog is closed directly.
+ */
+static void wdog_disarm(void)
+{
+	int signo = SIGTERM;
+
+	wdt_disarm();
+
+	if (wdog && !strcmp(wdog->cmd, FINIT_EXECPATH_ "/watchdogd"))
+		signo = SIGUSR1;
+	if (wdog && wdog->pid > 1 && !kill(wdog->pid, signo)) {
+		for (int i = 0; i < 30; i++) {
+			if (waitpid(wdog->pid, NULL, WNOHANG) == wdog->pid)
+				break;
+			do_usleep(100000);
+		}
+	}
+}
+
 void do_shutdown(shutop_t op)
 {
 	struct sched_param sched_param = { .sched_priority = 99 };
@@ -300,6 +340,9 @@ void do_shutdown(shutop_t op)
 		sched_setscheduler(1, SCHED_RR, &sched_param);
 	}
 
+	/* Only synchronous console output from here on */
+	conout_sync(2000);
+
 	halt = op;
 	if (sdown)
 		run_interactive(sdown, "Calling shutdown hook: %s", sdown);
@@ -353,14 +396,15 @@ void do_shutdown(shutop_t op)
 		print(kill(wdog->pid, SIGPWR) == 1, "Advising watchdog, system going down");
 		do_sleep(2);
 	}
+	wdt_shutdown();
 
 	/* Unmount any tmpfs before unmounting swap ... */
 	print(0, "Unmounting filesystems ...");
-	unmount_tmpfs();
+	unmount_tmpfs(service_deadline_left());
 	fs_swapoff();
 
 	/* ... unmount remaining regular file systems. */
-	unmount_regular();
+	unmount_regular(service_deadline_left());
 
 	/*
 	 * We sit on / so we must remount it ro, try all the things!
@@ -394,14 +438,34 @@ void do_shutdown(shutop_t op)
 		print(0, NULL);
 	}
 
+	/*
+	 * Fast reboot, skipping firmware and bootloader, into the kernel
+	 * loaded by kexec.  The watchdog was only set up to reset a hung
+	 * shutdown, above, it must be stopped since nothing kicks it while
+	 * the new kernel boots.
+	 */
+	if (op == SHUT_KEXEC || (op == SHUT_REBOOT && kexecboot)) {
+		if (kexec_loaded()) {
+			print(0, "Rebooting with kexec ...");
+			wdog_disarm();
+			reboot(RB_KEXEC);
+			print(1, "Failed kexec, falling back to normal reboot");
+		} else if (op == SHUT_KEXEC)
+			print(1, "No kexec kernel loaded, falling back to normal reboot");
+		op = SHUT_REBOOT;
+	}
+
 	/* Reboot via watchdog or kernel, or shutdown? */
 	if (op == SHUT_REBOOT) {
 		print(0, "Rebooting ...");
-		if (wdog && wdog->pid > 1) {
+		if ((wdog && wdog->pid > 1) || wdt_enabled()) {
 			int timeout = 10;
 
 			/* Wait here until the WDT reboots, or timeout with fallback */
-			print(kill(wdog->pid, SIGTERM) == 1, "Pending watchdog reboot");
+			if (wdog && wdog->pid > 1)
+				print(kill(wdog->pid, SIGTERM) == 1, "Pending watchdog reboot");
+			else
+				print(wdt_reboot(), "Pending watchdog reboot");
 			while (timeout--)
 				do_sleep(1);
 		}
@@ -423,6 +487,8 @@ void do_shutdown(shutop_t op)
  */
 static void sighup_cb(uev_t *w, void *arg, int events)
 {
+	PROBE("sighup");
+
 	dbg("...");
 	if (UEV_ERROR == events) {
 		errx(1, "Unrecoverable error in signal watcher");
@@ -542,6 +608,7 @@ static void sigchld_cb(uev_t *w, void *arg, int events)
 {
 	int status;
 	pid_t pid;
+	PROBE("sigchld");
 
 	if (UEV_ERROR == events) {
 		errx(1, "Unrecoverable error in signal watcher");
@@ -653,7 +720,8 @@ void sig_setup(uev_ctx_t *ctx)
 	 * Standard SysV init calls ctrl-alt-delete handler
 	 * We need to disable kernel default so it sends us SIGINT
 	 */
-	reboot(RB_DISABLE_CAD);
+	if (!in_container())
+		reboot(RB_DISABLE_CAD);
 	uev_signal_init(ctx, &sigint_watcher, sigint_cb, NULL, SIGINT);
 
 	/* BusyBox/SysV init style signals for halt, power-off and reboot. */
@@ -30,15 +30,22 @@
 #include "cond.h"
 #include "conf.h"
 #include "helpers.h"
+#include "history.h"
+#include "metrics.h"
 #include "private.h"
+#include "profile.h"
+#include "psi.h"
+#include "readahead.h"
 #include "schedule.h"
 #include "service.h"
 #include "sig.h"
+#include "timeline.h"
 #include "tty.h"
 #include "sm.h"
 #include "utmp-api.h"
 
 sm_t sm;
+static long long reload_at;
 
 #ifndef FINIT_NOLOGIN_PATH
 #define FINIT_NOLOGIN_PATH _PATH_NOLOGIN /* Stop user logging in. */
@@ -107,6 +114,9 @@ static char *sm_status(sm_state_t state)
 	case SM_BOOTSTRAP_STATE:
 		return "bootstrap";
 
+	case SM_BOOTSTRAP_WAIT_STATE:
+		return "bootstrap/wait";
+
 	case SM_RUNNING_STATE:
 		return "running";
 
@@ -161,6 +171,7 @@ void sm_init(sm_t *sm)
 	sm->newlevel = -1;
 	sm->reload = 0;
 	sm->in_teardown = 0;
+	timeline_add("sm/bootstrap");
 
 	dbg("Starting bootstrap finalize timer ...");
 	schedule_work(&work);
@@ -195,6 +206,7 @@ restart:
 	switch (sm->state) {
 	case SM_BOOTSTRAP_STATE:
 		dbg("Bootstrapping all services in runlevel S from %s", finit_conf);
+		profile_apply();
 		service_step_all(SVC_TYPE_RUNTASK | SVC_TYPE_SERVICE);
 
 		sm->state = SM_BOOTSTRAP_WAIT_STATE;
@@ -231,13 +243,23 @@ restart:
 
 		/* System bootrapped, launch TTYs et al */
 		bootstrap = 0;
+		conf_flush_exec_order();
+		readahead_save();
+		profile_save();
 		service_step_all(SVC_TYPE_RESPAWN);
 		sm->state = SM_RUNNING_STATE;
+		timeline_add("sm/running");
+		metrics_running();
 		break;
 
 	case SM_RUNNING_STATE:
-		/* We come here from bootstrap, runlevel change and conf reload */
-		service_step_all(SVC_TYPE_ANY);
+		/*
+		 * We come here from bootstrap, runlevel change and conf
+		 * reload, which all end with a full pass, as well as from
+		 * every collected process and initctl command.  So only
+		 * step the services that are in the run queue.
+		 */
+		service_worker(NULL);
 
 		/* runlevel changed? */
 		if (sm->newlevel >= 0 && sm->newlevel <= 9) {
@@ -260,10 +282,13 @@ restart:
 		prevlevel    = runlevel;
 		runlevel     = sm->newlevel;
 		sm->newlevel = -1;
+		api_event(INIT_EVENT_RUNLEVEL, NULL, runlevel, prevlevel, 0);
 
 		/* Restore terse mode and run hooks before shutdown */
 		if (runlevel == 0 || runlevel == 6) {
 			api_exit();
+			psi_exit();
+			history_exit();
 			log_exit();
 			plugin_run_hooks(HOOK_SHUTDOWN);
 		}
@@ -289,6 +314,8 @@ restart:
 
 		dbg("Stopping services not allowed in new runlevel ...");
 		sm->in_teardown = 1;
+		if (runlevel == 0 || runlevel == 6)
+			service_deadline(shutsec);
 		service_step_all(SVC_TYPE_ANY);
 
 		sm->state = SM_RUNLEVEL_WAIT_STATE;
@@ -300,6 +327,8 @@ restart:
 		 * and perform second stage from service_monitor later.
 		 */
 		svc = svc_stop_completed();
+		if (!svc)
+			svc = service_teardown();
 		if (svc) {
 			dbg("Waiting to collect %s, cmd %s(%d) ...", svc_ident(svc, NULL, 0), svc->cmd, svc->pid);
 			break;
@@ -335,6 +364,9 @@ restart:
 		break;
 
 	case SM_RELOAD_CHANGE_STATE:
+		reload_at = timeline_now();
+		metrics.reloads++;
+
 		/* First reload all *.conf in /etc/finit.d/ */
 		conf_reload();
 
@@ -356,6 +388,8 @@ restart:
 		 * and perform second stage from service_monitor later.
 		 */
 		svc = svc_stop_completed();
+		if (!svc)
+			svc = service_teardown();
 		if (svc) {
 			dbg("Waiting to collect %s, cmd %s(%d) ...", svc_ident(svc, NULL, 0), svc->cmd, svc->pid);
 			break;
@@ -376,12 +410,18 @@ restart:
 		service_notify_reconf();
 
 		dbg("Reconfiguration done");
+		metrics_observe(&metrics.reload, timeline_now() - reload_at);
 		sm->state = SM_RUNNING_STATE;
 		break;
 	}
 
-	if (sm->state != old_state)
+	if (sm->state != old_state) {
+		char name[24];
+
+		snprintf(name, sizeof(name), "sm/%s", sm_status(sm->state));
+		timeline_add(name);
 		goto restart;
+	}
 }
 
 /**
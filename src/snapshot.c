@@ -0,0 +1,431 @@
+/* Binary snapshot of parsed .conf files, for faster boot
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+#else
+# include <lite/lite.h>
+#endif
+
+#include "finit.h"
+#include "log.h"
+#include "snapshot.h"
+
+/*
+ * The snapshot, created with `initctl compile`, holds the lines of all
+ * .conf files as read by parse_conf(), i.e., after continuation lines
+ * and comments have been handled, and templates instantiated.  At boot
+ * it is mmap()ed and each file is looked up by path, a file is only
+ * used if its inode, size, and mtime still match, otherwise the .conf
+ * file is read as usual.
+ *
+ *     struct snap_hdr
+ *     struct snap_rec, path\0, line\0 ... line\0, padding
+ *     struct snap_rec, ...
+ */
+struct snap_hdr {
+	char     magic[8];
+	uint32_t version;
+	uint32_t count;		/* number of records */
+	uint32_t size;		/* of all records */
+	uint32_t csum;		/* FNV-1a of all records */
+};
+
+struct snap_rec {
+	uint64_t ino;
+	uint64_t size;
+	int64_t  sec;
+	int64_t  nsec;
+	uint32_t lines;
+	uint32_t len;		/* of path and lines, excl. padding */
+};
+
+#define SNAP_ALIGN(len) (((len) + 7) & ~7)
+
+struct snap_idx {
+	const char            *path;
+	const struct snap_rec *rec;
+};
+
+struct snap {
+	FILE     *fp;
+	char     *file;		/* NULL for in-memory snapshot */
+	char    **buf;
+	uint32_t  count;
+	uint32_t  size;
+	uint32_t  csum;
+};
+
+static struct snap_idx *idx;
+static uint32_t         num;
+static void            *map;
+static size_t           maplen;
+static int              mapped;	/* mmap()ed file, or malloc()ed buffer */
+
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619;
+	}
+
+	return h;
+}
+
+static int idx_cmp(const void *a, const void *b)
+{
+	const struct snap_idx *x = a, *y = b;
+
+	return strcmp(x->path, y->path);
+}
+
+static int snap_index(const char *name)
+{
+	const struct snap_hdr *hdr = map;
+	const uint8_t *ptr, *end;
+
+	if (maplen < sizeof(*hdr))
+		goto fail;
+
+	if (memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) || hdr->version != SNAP_VERSION) {
+		logit(LOG_NOTICE, "Ignoring %s, unsupported version.", name);
+		goto fail;
+	}
+
+	ptr = (const uint8_t *)&hdr[1];
+	if (hdr->size != maplen - sizeof(*hdr) || fnv1a(2166136261, ptr, hdr->size) != hdr->csum) {
+		logit(LOG_WARNING, "Ignoring %s, corrupt file.", name);
+		goto fail;
+	}
+
+	idx = calloc(hdr->count, sizeof(*idx));
+	if (!idx)
+		goto fail;
+
+	end = ptr + hdr->size;
+	for (num = 0; num < hdr->count; num++) {
+		const struct snap_rec *rec = (const struct snap_rec *)ptr;
+
+		if (ptr + sizeof(*rec) > end || ptr + sizeof(*rec) + rec->len > end)
+			goto fail;
+
+		idx[num].rec  = rec;
+		idx[num].path = (const char *)&rec[1];
+		ptr += sizeof(*rec) + SNAP_ALIGN(rec->len);
+	}
+	qsort(idx, num, sizeof(*idx), idx_cmp);
+
+	dbg("Loaded %s, %u files", name, num);
+	return 0;
+fail:
+	snap_unload();
+	return -1;
+}
+
+/**
+ * snap_load - Map snapshot file and index all records
+ * @file: Path to snapshot, created with `initctl compile`
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero if the file is missing, of another
+ * version, or corrupt.
+ */
+int snap_load(char *file)
+{
+	struct stat st;
+	int fd;
+
+	if (map)
+		return 0;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+
+	maplen = st.st_size;
+	map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		return -1;
+	}
+	mapped = 1;
+
+	return snap_index(file);
+}
+
+/**
+ * snap_load_mem - Use in-memory snapshot
+ * @buf: Snapshot from snap_create(NULL), always taken over, freed by snap_unload()
+ * @len: Size of snapshot
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero if @buf is corrupt, or another
+ * snapshot is already loaded.
+ */
+int snap_load_mem(void *buf, size_t len)
+{
+	if (map) {
+		free(buf);
+		return -1;
+	}
+
+	map    = buf;
+	maplen = len;
+	mapped = 0;
+
+	return snap_index("prefetched .conf files");
+}
+
+/**
+ * snap_unload - Release snapshot, no longer needed after boot
+ */
+void snap_unload(void)
+{
+	if (map) {
+		if (mapped)
+			munmap(map, maplen);
+		else
+			free(map);
+	}
+	map = NULL;
+
+	free(idx);
+	idx = NULL;
+	num = 0;
+}
+
+/**
+ * snap_find - Find lines of a .conf file in snapshot
+ * @path:  Path to .conf file, as given to parse_conf()
+ * @lines: Number of lines, set on success
+ *
+ * Returns:
+ * Pointer to the first of @lines consecutive NUL terminated lines, or
+ * %NULL if the file has no record, or has changed since the snapshot.
+ */
+const char *snap_find(char *path, uint32_t *lines)
+{
+	struct snap_idx key = { .path = path }, *found;
+	const struct snap_rec *rec;
+	struct stat st;
+
+	if (!map)
+		return NULL;
+
+	found = bsearch(&key, idx, num, sizeof(*idx), idx_cmp);
+	if (!found)
+		return NULL;
+
+	rec = found->rec;
+	if (stat(path, &st) || rec->ino != (uint64_t)st.st_ino || rec->size != (uint64_t)st.st_size ||
+	    rec->sec != st.st_mtim.tv_sec || rec->nsec != st.st_mtim.tv_nsec) {
+		dbg("%s changed since snapshot", path);
+		return NULL;
+	}
+
+	*lines = rec->lines;
+	return found->path + strlen(found->path) + 1;
+}
+
+/**
+ * snap_create - Start creating a new snapshot
+ * @file: Path to snapshot, or %NULL for an in-memory snapshot
+ * @buf:  Set to the in-memory snapshot, by snap_commit()
+ * @len:  Set to the size of the in-memory snapshot
+ *
+ * The snapshot is written to a temporary file, replacing @file first
+ * in snap_commit().  Without @file, the snapshot is created in memory
+ * for snap_load_mem(), and nothing is logged, for use by a thread.
+ *
+ * Returns:
+ * New snapshot to snap_add() records to, or %NULL on error.
+ */
+struct snap *snap_create(char *file, char **buf, size_t *len)
+{
+	struct snap_hdr hdr = { 0 };
+	struct snap *sn;
+
+	sn = calloc(1, sizeof(*sn));
+	if (!sn)
+		return NULL;
+
+	if (file) {
+		sn->file = strdup(file);
+		if (!sn->file)
+			goto fail;
+
+		sn->fp = fopenf("w", "%s+", file);
+	} else {
+		sn->buf = buf;
+		sn->fp  = open_memstream(buf, len);
+	}
+	if (!sn->fp)
+		goto fail;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, sn->fp) != 1) {
+		fclose(sn->fp);
+		goto fail;
+	}
+	sn->csum = 2166136261;
+
+	return sn;
+fail:
+	if (file)
+		err(1, "Failed creating %s", file);
+	free(sn->file);
+	free(sn);
+	return NULL;
+}
+
+static int append(struct snap *sn, const void *data, size_t len)
+{
+	if (fwrite(data, len, 1, sn->fp) != 1)
+		return -1;
+
+	sn->csum  = fnv1a(sn->csum, data, len);
+	sn->size += len;
+
+	return 0;
+}
+
+/**
+ * snap_add - Add record for a .conf file
+ * @sn:    Snapshot from snap_create()
+ * @path:  Path of .conf file
+ * @st:    Status of .conf file, when it was read
+ * @data:  Lines, each NUL terminated
+ * @len:   Total length of @data
+ * @lines: Number of lines in @data
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int snap_add(struct snap *sn, char *path, struct stat *st, char *data, size_t len, uint32_t lines)
+{
+	const char pad[8] = { 0 };
+	struct snap_rec rec = {
+		.ino   = st->st_ino,
+		.size  = st->st_size,
+		.sec   = st->st_mtim.tv_sec,
+		.nsec  = st->st_mtim.tv_nsec,
+		.lines = lines,
+		.len   = strlen(path) + 1 + len,
+	};
+
+	if (append(sn, &rec, sizeof(rec)) ||
+	    append(sn, path, strlen(path) + 1) ||
+	    (len && append(sn, data, len)) ||
+	    append(sn, pad, SNAP_ALIGN(rec.len) - rec.len))
+		return -1;
+
+	sn->count++;
+	return 0;
+}
+
+static int snap_write(struct snap *sn, struct snap_hdr *hdr, int abort)
+{
+	int rc = 0;
+
+	if (!abort) {
+		if (fseek(sn->fp, 0, SEEK_SET) || fwrite(hdr, sizeof(*hdr), 1, sn->fp) != 1)
+			rc = -1;
+		else if (sn->file && (fflush(sn->fp) || fsync(fileno(sn->fp))))
+			rc = -1;
+	}
+	if (fclose(sn->fp))
+		rc = -1;
+
+	return rc;
+}
+
+/**
+ * snap_commit - Finalize, or abort, snapshot
+ * @sn:    Snapshot from snap_create()
+ * @abort: Non-zero to discard the snapshot, e.g. on error
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int snap_commit(struct snap *sn, int abort)
+{
+	struct snap_hdr hdr = {
+		.magic   = SNAP_MAGIC,
+		.version = SNAP_VERSION,
+		.count   = sn->count,
+		.size    = sn->size,
+		.csum    = sn->csum,
+	};
+	char tmp[sn->file ? strlen(sn->file) + 2 : 1];
+	int rc;
+
+	rc = snap_write(sn, &hdr, abort);
+	if (!sn->file) {
+		if (abort || rc) {
+			free(*sn->buf);
+			*sn->buf = NULL;
+			rc = -1;
+		}
+		free(sn);
+
+		return rc;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s+", sn->file);
+	if (abort || rc) {
+		if (!abort)
+			err(1, "Failed writing %s", tmp);
+		rc = -1;
+		unlink(tmp);
+	} else if (rename(tmp, sn->file)) {
+		err(1, "Failed replacing %s", sn->file);
+		unlink(tmp);
+		rc = -1;
+	}
+
+	free(sn->file);
+	free(sn);
+
+	return rc;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
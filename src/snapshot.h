@@ -0,0 +1,52 @@
+/* Binary snapshot of parsed .conf files, for faster boot
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_SNAPSHOT_H_
+#define FINIT_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define SNAP_MAGIC   "FINITSNP"
+#define SNAP_VERSION 1
+
+struct snap;
+
+int          snap_load   (char *file);
+int          snap_load_mem(void *buf, size_t len);
+void         snap_unload (void);
+const char  *snap_find   (char *path, uint32_t *lines);
+
+struct snap *snap_create (char *file, char **buf, size_t *len);
+int          snap_add    (struct snap *sn, char *path, struct stat *st, char *data, size_t len, uint32_t lines);
+int          snap_commit (struct snap *sn, int abort);
+
+#endif /* FINIT_SNAPSHOT_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
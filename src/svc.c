@@ -39,16 +39,185 @@
 #include "finit.h"
 #include "svc.h"
 #include "helpers.h"
+#include "listen.h"
+#include "pathwatch.h"
 #include "pid.h"
 #include "util.h"
 #include "cond.h"
 #include "schedule.h"
+#include "timeline.h"
+#include "tty.h"
 
 /* Each svc_t needs a unique job# */
 static int jobcounter = 1;
 static TAILQ_HEAD(, svc) svc_list = TAILQ_HEAD_INITIALIZER(svc_list);
 static TAILQ_HEAD(, svc) gc_list  = TAILQ_HEAD_INITIALIZER(gc_list);
 
+/*
+ * Service objects are allocated from slabs, which are never freed.
+ * Objects collected by svc_gc() are recycled by svc_new(), so services
+ * coming and going on reload do not fragment the heap of PID 1.
+ */
+#define POOL_SLAB_LEN 16
+static TAILQ_HEAD(, svc) pool_list = TAILQ_HEAD_INITIALIZER(pool_list);
+static struct {
+	unsigned int slabs;
+	unsigned int inuse;
+	unsigned int avail;
+	unsigned int recycled;
+} pool;
+
+/*
+ * PID index, used when collecting children in service_monitor().  PIDs
+ * are handed out sequentially by the kernel so the low bits are a good
+ * enough hash.  A service is in the index iff svc->pid > 0.
+ */
+#define PID_BUCKETS 256
+static LIST_HEAD(, svc) pid_index[PID_BUCKETS];
+
+static inline int pid_bucket(pid_t pid)
+{
+	return pid & (PID_BUCKETS - 1);
+}
+
+static void pid_unhash(svc_t *svc)
+{
+	if (svc->pid > 0)
+		LIST_REMOVE(svc, pid_link);
+}
+
+/*
+ * PID file index, used by the pidfile plugin for every file created in
+ * the directories it watches.  A service is in the index iff it has a
+ * PID file, svc->pidfile[0] != 0, until svc_del().  The leading '!' of
+ * PID files created by the service itself is not hashed.
+ */
+static LIST_HEAD(, svc) pidfile_index[PID_BUCKETS];
+
+static inline const char *pidfile_path(svc_t *svc)
+{
+	return svc->pidfile[0] == '!' ? &svc->pidfile[1] : svc->pidfile;
+}
+
+static inline int pidfile_bucket(const char *file)
+{
+	return strhash(STRHASH_INIT, file) & (PID_BUCKETS - 1);
+}
+
+static void pidfile_unhash(svc_t *svc)
+{
+	if (svc->pidfile[0])
+		LIST_REMOVE(svc, pidfile_link);
+}
+
+/*
+ * Lookup index for name, name:id, and job.  Neither of them change
+ * after svc_new(), so entries are only added there and removed again
+ * in svc_del().  Buckets are tail queues to keep registration order
+ * when iterating over all instances of a service.  The leaf cgroup
+ * index is also keyed on svc->file, so it is updated by svc_set_file().
+ */
+#define NAME_BUCKETS 256
+TAILQ_HEAD(svc_bucket, svc);
+static struct svc_bucket name_index[NAME_BUCKETS];
+static struct svc_bucket ident_index[NAME_BUCKETS];
+static struct svc_bucket job_index[NAME_BUCKETS];
+static struct svc_bucket group_index[NAME_BUCKETS];
+
+static struct svc_bucket *name_bucket(const char *name)
+{
+	return &name_index[strhash(STRHASH_INIT, name) & (NAME_BUCKETS - 1)];
+}
+
+static struct svc_bucket *ident_bucket(const char *name, const char *id)
+{
+	unsigned int hash;
+
+	hash = strhash(STRHASH_INIT, name);
+	hash = strhash(hash * 33 + ':', id);
+
+	return &ident_index[hash & (NAME_BUCKETS - 1)];
+}
+
+static struct svc_bucket *job_bucket(int job)
+{
+	return &job_index[job & (NAME_BUCKETS - 1)];
+}
+
+/* Leaf cgroup of a service, follows svc->file, see svc_set_file() */
+static struct svc_bucket *group_bucket(svc_t *svc)
+{
+	char grnam[80];
+
+	svc_group(svc, grnam, sizeof(grnam));
+	return &group_index[strhash(STRHASH_INIT, grnam) & (NAME_BUCKETS - 1)];
+}
+
+static void svc_index_add(svc_t *svc)
+{
+	static int init = 0;
+
+	if (!init) {
+		for (int i = 0; i < NAME_BUCKETS; i++) {
+			TAILQ_INIT(&name_index[i]);
+			TAILQ_INIT(&ident_index[i]);
+			TAILQ_INIT(&job_index[i]);
+			TAILQ_INIT(&group_index[i]);
+		}
+		init = 1;
+	}
+
+	TAILQ_INSERT_TAIL(name_bucket(svc->name), svc, name_link);
+	TAILQ_INSERT_TAIL(ident_bucket(svc->name, svc->id), svc, ident_link);
+	TAILQ_INSERT_TAIL(job_bucket(svc->job), svc, job_link);
+	TAILQ_INSERT_TAIL(group_bucket(svc), svc, group_link);
+}
+
+static void svc_index_del(svc_t *svc)
+{
+	TAILQ_REMOVE(name_bucket(svc->name), svc, name_link);
+	TAILQ_REMOVE(ident_bucket(svc->name, svc->id), svc, ident_link);
+	TAILQ_REMOVE(job_bucket(svc->job), svc, job_link);
+	TAILQ_REMOVE(group_bucket(svc), svc, group_link);
+}
+
+/*
+ * Run queue of services to be stepped by service_worker(), and those
+ * parked waiting for any other service to change state, e.g. because
+ * of a conflict or a run task blocking all other services.  Services
+ * with a process to stop or collect are stepped before those waiting
+ * to start, see svc_runq_add().
+ */
+static TAILQ_HEAD(, svc) runq_hi = TAILQ_HEAD_INITIALIZER(runq_hi);
+static TAILQ_HEAD(, svc) runq   = TAILQ_HEAD_INITIALIZER(runq);
+static TAILQ_HEAD(, svc) parkq  = TAILQ_HEAD_INITIALIZER(parkq);
+static int               runq_len;
+
+#define RUNQ_NONE   0
+#define RUNQ_QUEUED 1
+#define RUNQ_PARKED 2
+#define RUNQ_HIGH   3
+
+static void svc_runq_del(svc_t *svc)
+{
+	switch (svc->runq) {
+	case RUNQ_HIGH:
+		TAILQ_REMOVE(&runq_hi, svc, runq_link);
+		runq_len--;
+		break;
+	case RUNQ_QUEUED:
+		TAILQ_REMOVE(&runq, svc, runq_link);
+		runq_len--;
+		break;
+	case RUNQ_PARKED:
+		TAILQ_REMOVE(&parkq, svc, runq_link);
+		break;
+	default:
+		break;
+	}
+	svc->runq = RUNQ_NONE;
+}
+
 /*
  * Before gc removal of svc, make sure we don't clear an active
  * condition of a new instance of the svc.
@@ -79,6 +248,92 @@ static void maybe_clear_cond(svc_t *svc)
 	cond_clear(mkcond(svc, cond, sizeof(cond)));
 }
 
+static svc_t *pool_get(void)
+{
+	svc_t *svc;
+
+	if (TAILQ_EMPTY(&pool_list)) {
+		svc_t *slab;
+		size_t i;
+
+		slab = calloc(POOL_SLAB_LEN, sizeof(*slab));
+		if (!slab)
+			return NULL;
+
+		for (i = 0; i < POOL_SLAB_LEN; i++)
+			TAILQ_INSERT_TAIL(&pool_list, &slab[i], link);
+		pool.avail += POOL_SLAB_LEN;
+		pool.slabs++;
+	}
+
+	svc = TAILQ_FIRST(&pool_list);
+	TAILQ_REMOVE(&pool_list, svc, link);
+	memset(svc, 0, sizeof(*svc));
+	pool.avail--;
+	pool.inuse++;
+
+	return svc;
+}
+
+/* Last in first out, most recently used object is likely in cache */
+static void pool_release(svc_t *svc)
+{
+	cancel_work(&svc->timer);
+	cancel_work(&svc->aging);
+	cancel_work(&svc->watchdog);
+	cancel_work(&svc->tick);
+	free(svc->strings);
+	svc->strings = NULL;
+	free(svc->history);
+	svc->history = NULL;
+
+	TAILQ_INSERT_HEAD(&pool_list, svc, link);
+	pool.avail++;
+	pool.inuse--;
+}
+
+/* Return object of a collected service, counted as recycled */
+static void pool_put(svc_t *svc)
+{
+	pool_release(svc);
+	pool.recycled++;
+}
+
+/**
+ * svc_pool_stats - Summary of service object pool, for debugging
+ * @buf: Buffer to write summary to
+ * @len: Size of @buf
+ *
+ * Returns:
+ * Number of characters written, see snprintf().
+ */
+int svc_pool_stats(char *buf, size_t len)
+{
+	return snprintf(buf, len, "svc pool: %u slabs of %d x %zu bytes, %u in use, %u free, %u recycled",
+			pool.slabs, POOL_SLAB_LEN, sizeof(svc_t), pool.inuse, pool.avail, pool.recycled);
+}
+
+/**
+ * svc_footprint - Number of service objects, for footprint report
+ * @live: Set to number of services in use
+ * @gc:   Set to number of removed services waiting to be collected
+ *
+ * Returns:
+ * Total number of service objects allocated, in all slabs.
+ */
+size_t svc_footprint(size_t *live, size_t *gc)
+{
+	svc_t *svc;
+
+	*live = *gc = 0;
+	TAILQ_FOREACH(svc, &svc_list, link)
+		(*live)++;
+	TAILQ_FOREACH(svc, &gc_list, link)
+		(*gc)++;
+
+	return (size_t)pool.slabs * POOL_SLAB_LEN;
+}
+
 static void svc_gc(void *arg)
 {
 	struct timespec now;
@@ -96,13 +351,34 @@ static void svc_gc(void *arg)
 
 		TAILQ_REMOVE(&gc_list, svc, link);
 		maybe_clear_cond(svc);
-		free(svc);
+		pool_put(svc);
 	}
 
 	if (!TAILQ_EMPTY(&gc_list))
 		schedule_work(work);
 }
 
+static unsigned int generation = 1;
+
+/**
+ * svc_generation - Current generation of the set of services
+ *
+ * Stepped by svc_changed() when a service is created, removed, or
+ * registered again, for caches of relations between services.
+ */
+unsigned svc_generation(void)
+{
+	return generation;
+}
+
+/**
+ * svc_changed - Step generation of the set of services
+ */
+void svc_changed(void)
+{
+	generation++;
+}
+
 /**
  * svc_new - Create a new service
  * @cmd:  External program to call
@@ -128,12 +404,14 @@ svc_t *svc_new(char *cmd, char *name, char *id, int type)
 	if (job == -1)
 		job = jobcounter++;
 
-	svc = calloc(1, sizeof(*svc));
+	svc = pool_get();
 	if (!svc)
 		return NULL;
 
 	svc->type = type;
 	svc->job  = job;
+	svc->ready_msec = -1;
+	svc->state_at   = timeline_now();
 	if (name)
 		strlcpy(svc->name, name, sizeof(svc->name));
 	if (id && id[0])
@@ -142,7 +420,10 @@ svc_t *svc_new(char *cmd, char *name, char *id, int type)
 		strlcpy(svc->cmd, cmd, sizeof(svc->cmd));
 
 	/* Default description, if missing */
-	strlcpy(svc->desc, svc->name, sizeof(svc->desc));
+	if (svc_set_strings(svc, NULL, svc->name, NULL, NULL, NULL, NULL, NULL, NULL)) {
+		pool_release(svc);
+		return NULL;
+	}
 
 	/* Default HALT signal to send */
 	if (svc_is_tty(svc))
@@ -154,12 +435,15 @@ svc_t *svc_new(char *cmd, char *name, char *id, int type)
 	svc->killdelay = SVC_TERM_TIMEOUT;
 
 	TAILQ_INSERT_TAIL(&svc_list, svc, link);
+	svc_index_add(svc);
+	svc_changed();
 
 	return svc;
 }
 
 static struct wq work = {
 	.cb    = svc_gc,
+	.prio  = WQ_LOW,
 	.delay = SVC_TERM_TIMEOUT
 };
 
@@ -172,8 +456,21 @@ static struct wq work = {
  */
 int svc_del(svc_t *svc)
 {
+	/* Collected by gc, never by service_monitor() */
+	pid_unhash(svc);
+	pidfile_unhash(svc);
+	pid_unwatch(svc);
+	listen_close(svc);
+	path_close(svc);
+	tty_unwatch(svc);
+	*((pid_t *)&svc->pid) = 0;
+	svc_index_del(svc);
+	cond_dep_del(svc);
+	svc_runq_del(svc);
+
 	TAILQ_REMOVE(&svc_list, svc, link);
 	TAILQ_INSERT_TAIL(&gc_list, svc, link);
+	svc_changed();
 
 	clock_gettime(CLOCK_MONOTONIC_COARSE, &svc->gc);
 	schedule_work(&work);
@@ -257,14 +554,24 @@ svc_t *svc_named_iterator(svc_t **iter, int first, char *cmd)
 {
 	svc_t *svc;
 
-	for (svc = svc_iterator(iter, first); svc; svc = svc_iterator(iter, 0)) {
-		char *name = svc->name;
+	if (!iter || !cmd) {
+		errno = EINVAL;
+		return NULL;
+	}
 
-		if (string_compare(name, cmd))
-			return svc;
+	if (first)
+		svc = TAILQ_FIRST(name_bucket(cmd));
+	else
+		svc = *iter;
+
+	for (; svc; svc = TAILQ_NEXT(svc, name_link)) {
+		if (string_compare(svc->name, cmd))
+			break;
 	}
 
-	return NULL;
+	*iter = svc ? TAILQ_NEXT(svc, name_link) : NULL;
+
+	return svc;
 }
 
 
@@ -283,12 +590,24 @@ svc_t *svc_job_iterator(svc_t **iter, int first, int job)
 {
 	svc_t *svc;
 
-	for (svc = svc_iterator(iter, first); svc; svc = svc_iterator(iter, 0)) {
+	if (!iter) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (first)
+		svc = TAILQ_FIRST(job_bucket(job));
+	else
+		svc = *iter;
+
+	for (; svc; svc = TAILQ_NEXT(svc, job_link)) {
 		if (svc->job == job)
-			return svc;
+			break;
 	}
 
-	return NULL;
+	*iter = svc ? TAILQ_NEXT(svc, job_link) : NULL;
+
+	return svc;
 }
 
 
@@ -347,6 +666,41 @@ svc_t *svc_stop_completed(void)
 
 	return NULL;
 }
+/**
+ * svc_group_iterator - Iterates over all services of a leaf cgroup
+ * @iter:  Iterator, must be a valid pointer
+ * @first: If set, get first &svc_t, otherwise get next
+ * @group: Name of leaf group, see svc_group()
+ *
+ * Returns:
+ * The first matching &svc_t when %NULL is given as argument, otherwise
+ * the next &svc_t in the same @group until the end when %NULL is
+ * returned.
+ */
+svc_t *svc_group_iterator(svc_t **iter, int first, char *group)
+{
+	char grnam[80];
+	svc_t *svc;
+
+	if (!iter || !group) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (first)
+		svc = TAILQ_FIRST(&group_index[strhash(STRHASH_INIT, group) & (NAME_BUCKETS - 1)]);
+	else
+		svc = *iter;
+
+	for (; svc; svc = TAILQ_NEXT(svc, group_link)) {
+		if (!strcmp(svc_group(svc, grnam, sizeof(grnam)), group))
+			break;
+	}
+
+	*iter = svc ? TAILQ_NEXT(svc, group_link) : NULL;
+
+	return svc;
+}
 
 /**
  * svc_find - Find a service object by its full path name
@@ -358,12 +712,14 @@ svc_t *svc_stop_completed(void)
  */
 svc_t *svc_find(char *name, char *id)
 {
-	svc_t *svc, *iter = NULL;
+	svc_t *svc;
 
+	if (!name)
+		return NULL;
 	if (!id)
 		id = "";
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+	TAILQ_FOREACH(svc, ident_bucket(name, id), ident_link) {
 		if (!strcmp(svc->name, name) && !strcmp(svc->id, id))
 			return svc;
 	}
@@ -406,9 +762,12 @@ svc_t *svc_find_by_str(const char *str)
  */
 svc_t *svc_find_by_pid(pid_t pid)
 {
-	svc_t *svc, *iter = NULL;
+	svc_t *svc;
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+	if (pid <= 0)
+		return NULL;
+
+	LIST_FOREACH(svc, &pid_index[pid_bucket(pid)], pid_link) {
 		if (svc->pid == pid)
 			return svc;
 	}
@@ -438,6 +797,38 @@ svc_t *svc_find_by_cond(const char *cond)
 	return NULL;
 }
 
+/**
+ * svc_find_provider - Find the service providing a dependency condition
+ * @cond: Condition, e.g. pid/foo, service/foo/ready, task/bar:1/success
+ *
+ * Other conditions, e.g. net/, usr/, hook/, do not have a provider we
+ * can know about in advance.
+ *
+ * Returns:
+ * A pointer to an &svc_t object, or %NULL if not found.
+ */
+svc_t *svc_find_provider(const char *cond)
+{
+	char ident[MAX_COND_LEN], *ptr;
+
+	if (cond[0] == '!')
+		cond++;
+
+	if (!strncmp(cond, "pid/", 4))
+		return svc_find_by_str(&cond[4]);
+
+	if (strncmp(cond, "service/", 8) && strncmp(cond, "task/", 5) && strncmp(cond, "run/", 4))
+		return NULL;
+
+	strlcpy(ident, strchr(cond, '/') + 1, sizeof(ident));
+	ptr = strrchr(ident, '/');
+	if (!ptr)
+		return NULL;
+	*ptr = 0;
+
+	return svc_find_by_str(ident);
+}
+
 /**
  * svc_find_by_jobid - Find a service object by its JOB:ID
  * @job: Job n:o
@@ -448,12 +839,12 @@ svc_t *svc_find_by_cond(const char *cond)
  */
 svc_t *svc_find_by_jobid(int job, char *id)
 {
-	svc_t *svc, *iter = NULL;
+	svc_t *svc;
 
 	if (!id)
 		id = "";
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+	TAILQ_FOREACH(svc, job_bucket(job), job_link) {
 		if (svc->job == job && !strcmp(svc->id, id))
 			return svc;
 	}
@@ -497,31 +888,22 @@ svc_t *svc_find_by_tty(char *dev)
  */
 svc_t *svc_find_by_pidfile(char *fn)
 {
-	svc_t *svc, *iter = NULL;
+	svc_t *svc;
 	pid_t pid;
 
-	pid = pid_file_read(fn);
-	if (pid > 1) {
-		svc = svc_find_by_pid(pid);
-		if (svc)
+	/* Declared, or previously found, PID file of a service */
+	LIST_FOREACH(svc, &pidfile_index[pidfile_bucket(fn)], pidfile_link) {
+		if (!strcmp(pidfile_path(svc), fn))
 			return svc;
 	}
 
 	/*
-	 * No PID in file, or a sysv service.  So it has probably forked
-	 * off a chiled that we don't know about.  See if we can match
-	 * the PID file to a service instead.
+	 * Unknown PID file, may be created by a service that did not
+	 * declare it, match the PID in the file to a service instead.
 	 */
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
-		int v = 0;
-
-		if (svc->pidfile[0] == '!')
-			v = 1;
-		if (strcmp(&svc->pidfile[v], fn))
-			continue;
-
-		return svc;
-	}
+	pid = pid_file_read(fn);
+	if (pid > 1)
+		return svc_find_by_pid(pid);
 
 	return NULL;
 }
@@ -563,6 +945,298 @@ void svc_mark_clean(svc_t *svc)
 	*((int *)&svc->args_dirty) = 0;
 }
 
+/**
+ * svc_set_pid - Update PID of a service and the PID index
+ * @svc: Pointer to &svc_t object
+ * @pid: New PID, or zero when collected
+ *
+ * All changes to svc->pid must go through this function, otherwise
+ * svc_find_by_pid() will not find the service when it is collected.
+ * The process is also watched using a pidfd, when supported.
+ */
+void svc_set_pid(svc_t *svc, pid_t pid)
+{
+	if (svc->pid == pid)
+		return;
+
+	pid_unhash(svc);
+	pid_unwatch(svc);
+	*((pid_t *)&svc->pid) = pid;
+	if (pid > 0) {
+		LIST_INSERT_HEAD(&pid_index[pid_bucket(pid)], svc, pid_link);
+		pid_watch(svc);
+	}
+}
+
+/**
+ * svc_set_pidfile - Update PID file of a service
+ * @svc:  Pointer to &svc_t object
+ * @file: Absolute path to PID file
+ * @not:  Set for PID files created by the service itself, pid:!file
+ *
+ * All changes to svc->pidfile must go through this function, otherwise
+ * svc_find_by_pidfile() will not find the service.
+ */
+void svc_set_pidfile(svc_t *svc, const char *file, int not)
+{
+	pidfile_unhash(svc);
+	svc->pidfile[0] = '!';
+	strlcpy(&svc->pidfile[not ? 1 : 0], file, sizeof(svc->pidfile) - (not ? 1 : 0));
+	if (svc->pidfile[0])
+		LIST_INSERT_HEAD(&pidfile_index[pidfile_bucket(pidfile_path(svc))], svc, pidfile_link);
+}
+
+/*
+ * Leaf cgroup name, derived from originating filename, so to group
+ * multiple services, place them in the same .conf
+ */
+char *svc_group(svc_t *svc, char *buf, size_t len)
+{
+	char *ptr;
+
+	if (!svc->file[0])
+		return svc_ident(svc, buf, len);
+
+	ptr = strrchr(svc->file, '/');
+	if (ptr)
+		ptr++;
+	else
+		ptr = svc->file;
+
+	strlcpy(buf, ptr, len);
+	ptr = strstr(buf, ".conf");
+	if (ptr)
+		*ptr = 0;
+
+	return buf;
+}
+
+/**
+ * svc_set_file - Set originating .conf file of a service
+ * @svc:  Pointer to &svc_t object
+ * @file: Path to .conf file, or %NULL for services in finit.conf
+ *
+ * All changes to svc->file must go through this function, otherwise
+ * svc_group_iterator() will not find the service.
+ */
+void svc_set_file(svc_t *svc, const char *file)
+{
+	TAILQ_REMOVE(group_bucket(svc), svc, group_link);
+	if (file)
+		strlcpy(svc->file, file, sizeof(svc->file));
+	else
+		memset(svc->file, 0, sizeof(svc->file));
+	TAILQ_INSERT_TAIL(group_bucket(svc), svc, group_link);
+}
+
+/* Number of strings after the args, see svc_set_strings() */
+#define SVC_STRINGS 8
+
+static int pack_strings(svc_t *svc, char *args[], char *str[])
+{
+	char *none[] = { svc->cmd, NULL };
+	size_t num, len, i;
+	char **argv, *ptr;
+
+	if (!args || !args[0])
+		args = none;
+
+	for (num = 0; args[num]; num++)
+		;
+
+	len = (num + 1) * sizeof(char *);
+	for (i = 0; i < num; i++)
+		len += strlen(args[i]) + 1;
+	for (i = 0; i < SVC_STRINGS; i++)
+		len += (str[i] ? strlen(str[i]) : 0) + 1;
+
+	argv = malloc(len);
+	if (!argv)
+		return -1;
+
+	ptr = (char *)&argv[num + 1];
+	for (i = 0; i < num; i++) {
+		argv[i] = ptr;
+		ptr = stpcpy(ptr, args[i]) + 1;
+	}
+	argv[num] = NULL;
+
+	for (i = 0; i < SVC_STRINGS; i++) {
+		char *val = ptr;
+
+		ptr = stpcpy(ptr, str[i] ?: "") + 1;
+		str[i] = val;
+	}
+
+	free(svc->strings);
+	svc->strings      = (char *)argv;
+	svc->strings_len  = len;
+	svc->args         = argv;
+	svc->desc         = str[0];
+	svc->env          = str[1];
+	svc->pre_script   = str[2];
+	svc->post_script  = str[3];
+	svc->ready_script = str[4];
+	svc->listen       = str[5];
+	svc->status_msg   = str[6];
+	svc->path         = str[7];
+
+	return 0;
+}
+
+/**
+ * svc_set_strings - Update command line args and strings of a service
+ * @svc:   Pointer to &svc_t object
+ * @args:  NULL terminated list of args, args[0] is the command, or NULL
+ * @desc:  Description, or NULL
+ * @env:   Environment file, or NULL
+ * @pre:   pre:script, or NULL
+ * @post:  post:script, or NULL
+ * @ready: ready:script, or NULL
+ * @listen: listen:spec, or NULL
+ * @path:  path:spec, or NULL
+ *
+ * All strings are packed in a single allocation sized to fit, replacing
+ * any previous strings of @svc.  It is safe to pass the current strings
+ * of @svc, e.g., to keep the description.  When @args is NULL the args
+ * are set to only svc->cmd.  The STATUS= message is kept.
+ *
+ * Returns:
+ * POSIX OK(0), or -1 on error with @errno set.
+ */
+int svc_set_strings(svc_t *svc, char *args[], char *desc, char *env,
+		    char *pre, char *post, char *ready, char *listen, char *path)
+{
+	char *str[] = { desc, env, pre, post, ready, listen, svc->status_msg, path };
+
+	return pack_strings(svc, args, str);
+}
+
+/**
+ * svc_set_status - Update STATUS= message of a service
+ * @svc: Pointer to &svc_t object
+ * @msg: Message from sd_notify(), or NULL to clear
+ *
+ * Repacks the strings of @svc, see svc_set_strings(), so the message is
+ * sent to initctl along with the rest of them.
+ *
+ * Returns:
+ * POSIX OK(0), or -1 on error with @errno set.
+ */
+int svc_set_status(svc_t *svc, char *msg)
+{
+	char *str[] = {
+		svc->desc, svc->env, svc->pre_script, svc->post_script,
+		svc->ready_script, svc->listen, msg, svc->path
+	};
+
+	if (!strcmp(svc->status_msg, msg ?: ""))
+		return 0;
+
+	return pack_strings(svc, svc->args, str);
+}
+
+/* Has a process, or pre/post script, that may need to be stopped or reaped */
+static int svc_runq_high(svc_t *svc)
+{
+	switch (svc->state) {
+	case SVC_STOPPING_STATE:
+	case SVC_CLEANUP_STATE:
+	case SVC_PAUSED_STATE:
+	case SVC_RUNNING_STATE:
+		return 1;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * svc_runq_add - Add service to run queue
+ * @svc: Service to step later
+ *
+ * A parked service is moved to the run queue, a service already in the
+ * run queue keeps its position.  Services that may need stopping are
+ * queued ahead of services waiting to start.
+ */
+void svc_runq_add(svc_t *svc)
+{
+	if (svc->runq == RUNQ_QUEUED || svc->runq == RUNQ_HIGH)
+		return;
+
+	svc_runq_del(svc);
+	if (svc_runq_high(svc)) {
+		TAILQ_INSERT_TAIL(&runq_hi, svc, runq_link);
+		svc->runq = RUNQ_HIGH;
+	} else {
+		TAILQ_INSERT_TAIL(&runq, svc, runq_link);
+		svc->runq = RUNQ_QUEUED;
+	}
+	runq_len++;
+}
+
+/**
+ * svc_runq_park - Park service until any other service changes state
+ * @svc: Service waiting for other services
+ *
+ * A service already in the run queue stays there.
+ */
+void svc_runq_park(svc_t *svc)
+{
+	if (svc->runq != RUNQ_NONE)
+		return;
+
+	TAILQ_INSERT_TAIL(&parkq, svc, runq_link);
+	svc->runq = RUNQ_PARKED;
+}
+
+/**
+ * svc_runq_unpark - Move all parked services to the run queue
+ *
+ * Returns:
+ * Number of services moved to the run queue.
+ */
+int svc_runq_unpark(void)
+{
+	svc_t *svc, *next;
+	int num = 0;
+
+	TAILQ_FOREACH_SAFE(svc, &parkq, runq_link, next) {
+		svc_runq_add(svc);
+		num++;
+	}
+
+	return num;
+}
+
+/**
+ * svc_runq_pop - Get next service from run queue
+ *
+ * Returns:
+ * The next &svc_t to step, or %NULL if the run queue is empty.
+ */
+svc_t *svc_runq_pop(void)
+{
+	svc_t *svc;
+
+	svc = TAILQ_FIRST(&runq_hi);
+	if (!svc)
+		svc = TAILQ_FIRST(&runq);
+	if (svc)
+		svc_runq_del(svc);
+
+	return svc;
+}
+
+/**
+ * svc_runq_len - Number of services in run queue, not counting parked
+ */
+int svc_runq_len(void)
+{
+	return runq_len;
+}
+
 void svc_enable(svc_t *svc)
 {
 	*((int *)&svc->removed) = 0;
@@ -595,7 +1269,6 @@ void svc_clean_dynamic(void (*cb)(svc_t *))
 int svc_clean_bootstrap(svc_t *svc)
 {
 	if (!ISOTHER(svc->runlevels, INIT_LEVEL)) {
-		svc->pid = 0;
 		svc_del(svc);
 		return 1;
 	}
@@ -25,6 +25,7 @@
 #ifndef FINIT_SVC_H_
 #define FINIT_SVC_H_
 
+#include <stdint.h>
 #include <sys/ipc.h>		/* IPC_CREAT */
 #include <sys/resource.h>
 #include <sys/types.h>		/* pid_t */
@@ -39,9 +40,14 @@
 
 #include "cgroup.h"
 #include "helpers.h"
+#include "schedule.h"
 
 typedef int svc_cmd_t;
 
+struct cond_dep;
+struct history;
+struct listen;
+
 typedef enum {
 	SVC_TYPE_FREE       = 0,	/* Free to allocate */
 	SVC_TYPE_SERVICE    = 1,	/* Monitored, will be respawned */
@@ -67,6 +73,8 @@ typedef enum {
 	SVC_RUNNING_STATE,	/* Process running */
 } svc_state_t;
 
+#define SVC_STATE_MAX (SVC_RUNNING_STATE + 1)
+
 typedef enum {
 	SVC_BLOCK_NONE = 0,
 	SVC_BLOCK_MISSING,
@@ -91,6 +99,17 @@ typedef enum {
 	SVC_NOTIFY_S6,
 } svc_notify_t;
 
+/* Boot timeline, first time a service reaches each stage */
+typedef enum {
+	SVC_STAMP_ENABLED = 0,	/* Enabled, waiting for conditions */
+	SVC_STAMP_COND,		/* Conditions satisfied */
+	SVC_STAMP_PRE,		/* pre: script done */
+	SVC_STAMP_FORK,		/* Process started */
+	SVC_STAMP_READY,	/* Ready notification, or run/task done */
+	SVC_STAMP_CRASH,	/* First crash */
+	SVC_STAMP_MAX
+} svc_stamp_t;
+
 #define MAX_ID_LEN       16
 #define MAX_ARG_LEN      64
 #define MAX_CMD_LEN      256
@@ -115,6 +134,15 @@ typedef enum {
  */
 typedef struct svc {
 	TAILQ_ENTRY(svc) link;
+	LIST_ENTRY(svc)  pid_link;     /* PID index, see svc_set_pid() */
+	LIST_ENTRY(svc)  pidfile_link; /* PID file index, see svc_set_pidfile() */
+	TAILQ_ENTRY(svc) name_link;    /* Name index, all instances */
+	TAILQ_ENTRY(svc) ident_link;   /* name:id index */
+	TAILQ_ENTRY(svc) job_link;     /* Job index, all instances */
+	TAILQ_ENTRY(svc) group_link;   /* Leaf cgroup index, see svc_set_file() */
+	TAILQ_ENTRY(svc) runq_link;    /* Run queue or parked, see svc_runq_add() */
+	int              runq;         /* 0: none, 1: queued, 2: parked, 3: high */
+	int              slot;         /* Holds a job slot, see service_jobs() */
 
 	/* Origin of service */
 	char           file[MAX_ARG_LEN];
@@ -122,28 +150,43 @@ typedef struct svc {
 	/* Limits and scoping */
 	struct rlimit  rlimit[RLIMIT_NLIMITS];
 	struct cgroup  cgroup;
+	unsigned int   group_gen;      /* Cached group_exclusive(), see svc_generation() */
+	int            group_excl;
 
 	/* Service details */
 	int            sighalt;        /* Signal to stop process, default: SIGTERM */
 	int            killdelay;      /* Delay in msec before sending SIGKILL */
-	pid_t          oldpid, pid;
-	char           pidfile[MAX_CMD_LEN];
+	pid_t          oldpid;
+	const pid_t    pid;            /* Use svc_set_pid() to update */
+	int            pidfd;          /* 0: none, see pid_watch() */
+	uev_t          pidfd_watcher;
+	char           pidfile[MAX_CMD_LEN]; /* Use svc_set_pidfile() to update */
 	long           start_time;     /* Start time, as seconds since boot, from sysinfo() */
+	long long      stamp[SVC_STAMP_MAX]; /* msec CLOCK_MONOTONIC, see timeline_stamp() */
+	long long      forked_at;      /* msec CLOCK_MONOTONIC of latest fork, see metrics_ready() */
+	int            ready_msec;     /* Latest fork to ready latency, -1: never ready */
+	int            weight;         /* Critical path msec at bootstrap, see profile.c */
+	int            weight_pos;     /* Position in svc_list, for a stable sort by weight */
+	long long      state_at;       /* msec CLOCK_MONOTONIC of latest state change */
+	long long      state_msec[SVC_STATE_MAX]; /* Time spent in each state */
 	int            started;	       /* Set for run/task/sysv to track if started */
 	int            status;	       /* From waitpid() when process is collected */
 	const svc_state_t state;       /* Paused, Reloading, Restart, Running, ... */
 	svc_type_t     type;	       /* Service, run, task, ... */
 	char           protect;        /* Services like dbus-daemon & udev by Finit */
+	char           critical;       /* Integrated watchdog not kicked if down too long, see wdt.c */
 	char           manual;	       /* run/task that require `initctl start foo` */
 	char           nowarn;	       /* Skip or log warning if cmd missing or conflicts */
 	const int      dirty;	       /* 0: unmodified, 1: modified */
 	const int      removed;
 	int            starting;       /* ... waiting for pidfile to be re-asserted */
+	int            draining;       /* Stopped, wait for leaf group to drain, see service_stop() */
 	int	       runlevels;
 	int            sighup;	       /* This service supports SIGHUP :) */
 	int	       forking;	       /* This is a service/sysv daemon that forks, wait for it ... */
 	svc_block_t    block;	       /* Reason that this service is currently stopped */
 	char           cond[MAX_COND_LEN];
+	struct cond_dep *cond_deps;    /* Reverse index, see cond_dep_add() */
 
 	/* Instance specifics */
 	int            job;	       /* For intenal use only, canonical ref is NAME:ID */
@@ -157,7 +200,40 @@ typedef struct svc {
 	int            restart_max;    /* Maximum number of restarts allowed */
 	int            restart_saved;  /* INTERNAL, saved copy of .conf value */
 	int            restart_tmo;    /* Time before restarting a crashing service */
+	int            backoff_max;    /* msec, 0: no exponential backoff, see backoff() */
+	int            burst;          /* Restarts allowed in a burst, 0: unlimited */
+	int            burst_tmo;      /* msec to regain one restart in burst */
+	int            tokens;         /* INTERNAL, remaining restarts in burst */
+	long long      tokens_at;      /* INTERNAL, msec CLOCK_MONOTONIC of last refill */
+	struct wq      aging;          /* Instability index aging, see service_aging() */
+	int            watchdog_msec;  /* Software watchdog, max msec between WATCHDOG=1, watchdog:SEC */
+	struct wq      watchdog;       /* Software watchdog, see service_watchdog() */
+	int            every_msec;     /* Timer task, run interval, every:TIME, see timer.c */
+	int            boot_msec;      /* Timer task, first run after boot, after-boot:TIME */
+	int            jitter_msec;    /* Timer task, max spread of start times, jitter:TIME */
+	char           calendar[32];   /* Timer task, wall clock schedule, cal:SPEC */
+	time_t         last_run;       /* Timer task, wall clock time of latest run */
+	time_t         next_run;       /* Timer task, wall clock time of next run */
+	unsigned int   coalesced;      /* Timer task, runs skipped, e.g. still running */
+	struct wq      tick;           /* Timer task, see timer_setup() */
 	unsigned char  oncrash_action; /* Action to perform in crashed state. */
+	int            oom_delay;      /* msec, restart delay after OOM kill, oom:delay:SEC */
+	int            oom_high;       /* Percent to raise memory.high by, oom:high:PCT */
+	unsigned int   oom_tot;        /* Total OOM kills in leaf group */
+	unsigned int   oom_seen;       /* INTERNAL, memory.events:oom_kill last read */
+	unsigned long long log_suppressed; /* Lines dropped by log:rate, see logger.c */
+	unsigned int   high_seen;      /* INTERNAL, memory.events:high last read */
+	char           oom;            /* OOM kill since last start, see service_memory_events() */
+	char           oom_raised;     /* memory.high raised since last start */
+	char           cpus[64];       /* CPU affinity, cpus:LIST, see affinity.c */
+	char           numa[64];       /* NUMA memory policy, numa:POLICY[:NODES] */
+	int            sched_policy;   /* sched:POLICY[:PRIO], -1: inherit */
+	int            sched_prio;     /* Static priority, fifo and rr only */
+	int            nice;           /* nice:NUM */
+	int            ioprio;         /* ionice:CLASS[:LEVEL], 0: inherit */
+	int            instances;      /* Instances of template, instances:N, see conf.c */
+	char           rolling;        /* Rolling restart, 1: queued, 2: restarting, 3: and queued again */
+	long long      rolling_at;     /* msec CLOCK_MONOTONIC, when restarted by rolling_cb() */
 	char           respawn;	       /* ttys, or services with `respawn`, never increment restart_cnt */
 	const char     restart_cnt;    /* Incremented for each restart by service monitor. */
 
@@ -170,6 +246,8 @@ typedef struct svc {
 			char  file[64];
 			char  prio[20];
 			char  ident[20];
+			int   rate;	       /* lines/sec, 0: unlimited */
+			int   burst;	       /* lines, 0: same as rate */
 		} log;
 
 		/* Only for TTY type services */
@@ -182,6 +260,7 @@ typedef struct svc {
 			char  nologin;
 			char  notty;
 			char  rescue;
+			char  lazy;
 		};
 	};
 
@@ -189,22 +268,28 @@ typedef struct svc {
 	char	       username[MAX_USER_LEN];
 	char	       group[MAX_USER_LEN];
 
-	/* Command, arguments and service description */
+	/* Command, arguments and service description, see svc_set_strings() */
 	char	       cmd[MAX_CMD_LEN];
-	char	       args[MAX_NUM_SVC_ARGS][MAX_CMD_LEN];
+	char	     **args;	       /* NULL terminated, args[0] is the command */
 	int            args_dirty;
 	char           conflict[MAX_ARG_LEN];
-	char	       desc[MAX_STR_LEN];
-	char	       env[MAX_CMD_LEN];
-	char	       pre_script[MAX_CMD_LEN];
-	char	       post_script[MAX_CMD_LEN];
-	char	       ready_script[MAX_CMD_LEN];
+	char	      *desc;
+	char	      *env;
+	char	      *pre_script;
+	char	      *post_script;
+	char	      *ready_script;
+	char	      *strings;	       /* Arena for all of the above, and the listen,
+					* status_msg and path below, sent after svc_t */
+	size_t	       strings_len;
+
+	/* Resource usage samples, see history.c */
+	struct history *history;
 
 	/*
 	 * Used to forcefully kill services that won't shutdown on
 	 * termination and to delay restarts of crashing services.
 	 */
-	uev_t          timer;
+	struct wq      timer;	       /* See service_timeout_after() */
 	void           (*timer_cb)(struct svc *svc);
 
 	/*
@@ -212,26 +297,77 @@ typedef struct svc {
 	 */
 	svc_notify_t   notify;
 	uev_t	       notify_watcher; /* i/o watcher */
+	char          *status_msg;     /* STATUS= from sd_notify(), see svc_set_status() */
+
+	/*
+	 * Socket activation: tcp:PORT,udp:PORT,unix:/path
+	 */
+	char          *listen;         /* See svc_set_strings() */
+	struct listen *sockets;        /* See listen_start() */
+	int            activated;      /* Activity on sockets or paths, or lazy TTY, start service */
+
+	/*
+	 * Path activation: [exists:|changed:|nonempty:]PATH[,...]
+	 */
+	char          *path;           /* See svc_set_strings() */
+	struct wq      path_work;      /* Coalesce bursts, see path_start() */
+
+	/*
+	 * Lazy TTY: getty is started on first input, see tty_watch()
+	 */
+	int            ttyfd;          /* 0: none */
+	uev_t          tty_watcher;
 
 	/* time at svc_del(), used by gc timer */
 	struct timespec gc;
 } svc_t;
 
+/*
+ * Compact status record, streamed by INIT_CMD_SVC_DUMP one message per
+ * service over a single connection, instead of a full svc_t each.  The
+ * fixed part is followed by NUL terminated strings: name, id, desc and
+ * all args, the latter terminated by an empty string.  The end of the
+ * stream is a record with pid -1 and no strings.
+ */
+struct svc_rec {
+	uint32_t       len;	       /* Size of record, including strings */
+	int32_t        pid;
+	int32_t        status;
+	int32_t        runlevels;
+	uint32_t       restart_tot;
+	int32_t        type;
+	uint8_t        state;
+	uint8_t        block;
+	uint8_t        started;
+	uint8_t        manual;
+	char           strings[];
+};
+
+/* Flags for INIT_CMD_SVC_DUMP, in rq.runlevel, types filter in rq.sleeptime */
+#define SVC_DUMP_BRIEF   0	       /* struct svc_rec records */
+#define SVC_DUMP_FULL    1	       /* svc_t + strings, as INIT_CMD_SVC_FIND */
+
 svc_t      *svc_new                (char *cmd, char *name, char *id, int type);
 int	    svc_del	           (svc_t *svc);
+unsigned    svc_generation         (void);
+void	    svc_changed            (void);
 void	    svc_validate	   (svc_t *svc);
 
 svc_t	   *svc_find	           (char *name, char *id);
 svc_t	   *svc_find_by_str        (const char *str);
 svc_t	   *svc_find_by_pid        (pid_t pid);
 svc_t	   *svc_find_by_cond	   (const char *cond);
+svc_t	   *svc_find_provider      (const char *cond);
 svc_t	   *svc_find_by_jobid      (int job, char *id);
 svc_t	   *svc_find_by_tty        (char *dev);
 svc_t      *svc_find_by_pidfile    (char *fn);
+char       *svc_group              (svc_t *svc, char *buf, size_t len);
+void        svc_set_file           (svc_t *svc, const char *file);
 
 svc_t      *svc_iterator           (svc_t **iter, int first);
 svc_t      *svc_named_iterator     (svc_t **iter, int first, char *cmd);
 svc_t      *svc_job_iterator       (svc_t **iter, int first, int job);
+svc_t      *svc_group_iterator     (svc_t **iter, int first, char *group);
 
 void	    svc_foreach	           (int (*cb)(svc_t *));
 void        svc_foreach_type       (int types, int (*cb)(svc_t *));
@@ -242,6 +378,19 @@ void	    svc_mark		   (svc_t *svc);
 void	    svc_mark_dynamic       (void);
 void	    svc_mark_dirty         (svc_t *svc);
 void	    svc_mark_clean         (svc_t *svc);
+void	    svc_set_pid            (svc_t *svc, pid_t pid);
+void	    svc_set_pidfile        (svc_t *svc, const char *file, int not);
+int	    svc_pool_stats         (char *buf, size_t len);
+size_t	    svc_footprint          (size_t *live, size_t *gc);
+int	    svc_set_strings        (svc_t *svc, char *args[], char *desc, char *env,
+				    char *pre, char *post, char *ready, char *listen, char *path);
+int	    svc_set_status         (svc_t *svc, char *msg);
+
+void	    svc_runq_add           (svc_t *svc);
+void	    svc_runq_park          (svc_t *svc);
+int	    svc_runq_unpark        (void);
+svc_t	   *svc_runq_pop           (void);
+int	    svc_runq_len           (void);
 void	    svc_clean_dynamic      (void (*cb)(svc_t *));
 int	    svc_clean_bootstrap    (svc_t *svc);
 void	    svc_prune_bootstrap	   (void);
@@ -259,11 +408,15 @@ static inline int svc_is_tty       (svc_t *svc) { return svc && SVC_TYPE_TTY
 static inline int svc_is_runtask   (svc_t *svc) { return svc && (SVC_TYPE_RUNTASK & svc->type);}
 static inline int svc_is_forking   (svc_t *svc) { return svc && svc->forking; }
 static inline int svc_is_manual    (svc_t *svc) { return svc && svc->manual; }
+static inline int svc_has_timer    (svc_t *svc) { return svc && (svc->every_msec || svc->boot_msec || svc->calendar[0]); }
 static inline int svc_is_nohup     (svc_t *svc) { return svc && (0 == svc->sighup); }
 
 static inline int svc_in_runlevel  (svc_t *svc, int runlevel) { return svc && ISSET(svc->runlevels, runlevel); }
 static inline int svc_nohup        (svc_t *svc) { return svc &&  (0 == svc->sighup || 0 != svc->args_dirty); }
 static inline int svc_has_pidfile  (svc_t *svc) { return svc_is_daemon(svc) && svc->pidfile[0] != 0 && svc->pidfile[0] != '!'; }
+static inline int svc_has_listen   (svc_t *svc) { return svc_is_daemon(svc) && svc->listen[0] != 0; }
+static inline int svc_is_lazy      (svc_t *svc) { return svc_is_tty(svc) && svc->lazy; }
+static inline int svc_has_path     (svc_t *svc) { return !svc_is_tty(svc) && svc->path[0] != 0; }
 static inline int svc_has_pre      (svc_t *svc) { return svc->pre_script[0];  }
 static inline int svc_has_post     (svc_t *svc) { return svc->post_script[0]; }
 static inline int svc_has_ready    (svc_t *svc) { return svc->ready_script[0];}
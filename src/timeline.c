@@ -0,0 +1,98 @@
+/* Boot timeline, state machine and hook events with per-service stamps
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <time.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "timeline.h"
+
+/*
+ * Only the first TIMELINE_MAX events are recorded, which is enough to
+ * cover bootstrap and a few reloads.  The point is to see where time is
+ * spent at boot, not to keep a log of the system.
+ */
+static struct tl_event events[TIMELINE_MAX];
+static int             num;
+
+long long timeline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * timeline_add - Record a state machine transition or hook point
+ * @name: Name of event, e.g. sm/running or hook/basefs/up
+ */
+void timeline_add(const char *name)
+{
+	if (num >= TIMELINE_MAX)
+		return;
+
+	events[num].msec = timeline_now();
+	strlcpy(events[num].name, name, sizeof(events[num].name));
+	num++;
+}
+
+/**
+ * timeline_stamp - Record the first time a service reaches a stage
+ * @svc:   Service to stamp
+ * @stamp: Stage in the life of @svc, e.g., SVC_STAMP_READY
+ *
+ * Later stamps of the same stage, e.g. after a restart, are ignored so
+ * the timeline shows how the system came up at boot.
+ */
+void timeline_stamp(svc_t *svc, svc_stamp_t stamp)
+{
+	if (!svc || stamp >= SVC_STAMP_MAX || svc->stamp[stamp])
+		return;
+
+	svc->stamp[stamp] = timeline_now();
+}
+
+/**
+ * timeline_get - All recorded events, for sending to initctl
+ * @num_events: Set to number of events
+ *
+ * Returns:
+ * Array of @num_events events, in the order recorded.
+ */
+const struct tl_event *timeline_get(int *num_events)
+{
+	*num_events = num;
+
+	return events;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,51 @@
+/* Boot timeline, state machine and hook events with per-service stamps
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_TIMELINE_H_
+#define FINIT_TIMELINE_H_
+
+#define TIMELINE_MAX     64	/* Max number of events recorded */
+
+/* State machine transitions and hook points, sent to initctl */
+struct tl_event {
+	long long  msec;	/* CLOCK_MONOTONIC, i.e., since boot */
+	char       name[24];	/* sm/running, hook/basefs/up, ... */
+};
+
+#ifdef __FINIT__
+#include "svc.h"
+
+long long              timeline_now  (void);
+void                   timeline_add  (const char *name);
+void                   timeline_stamp(svc_t *svc, svc_stamp_t stamp);
+const struct tl_event *timeline_get  (int *num_events);
+#endif
+
+#endif /* FINIT_TIMELINE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
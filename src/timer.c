@@ -0,0 +1,375 @@
+/* Timer tasks, periodic and calendar scheduled tasks, like cron
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A task with every:TIME, after-boot:TIME or cal:SPEC is a timer task.
+ * It is not started when entering a runlevel, like manual:yes tasks,
+ * instead it is started by a per-task work item on the shared timer,
+ * see schedule.c.  No cron daemon is needed for a few periodic jobs.
+ *
+ * - every:TIME        monotonic interval, first run TIME after setup
+ * - after-boot:TIME   first run TIME after boot, once unless every:
+ * - cal:SPEC          wall clock, hourly, daily, weekly, monthly or
+ *                     [DAY,..@]HH:MM, e.g. mon,thu@03:30 or *:15
+ * - jitter:TIME       spread start times, by a stable offset per device
+ *
+ * TIME is a number with an optional unit s, m, h, or d, default sec.
+ *
+ * Missed runs are coalesced: if the task is still running, outside its
+ * runlevels, or the wall clock steps past several runs, it is started
+ * once at the next opportunity.  Since the wall clock may be set or
+ * stepped at any time, e.g. by NTP after boot, calendar timers never
+ * sleep longer than TIMER_RECHECK, and compute their next run anew.
+ *
+ * The jitter offset is a hash of /etc/machine-id, or the hostname, and
+ * the task identity, so a fleet of devices with the same configuration
+ * spread their load, e.g. on a server, while each device keeps to the
+ * same schedule across reboots.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+#else
+# include <lite/lite.h>
+#endif
+
+#include "finit.h"
+#include "log.h"
+#include "private.h"
+#include "schedule.h"
+#include "service.h"
+#include "sm.h"
+#include "svc.h"
+#include "timeline.h"
+#include "timer.h"
+#include "util.h"
+
+#define TIMER_RECHECK  (3600 * 1000)	/* msec, max sleep of calendar timers */
+#define TIMER_MAX_DAYS 32		/* look-ahead for next calendar match */
+
+struct cal {
+	int min;			/* 0-59 */
+	int hour;			/* 0-23, -1: every hour */
+	int wdays;			/* bitmask, bit 0: Sunday, 0: every day */
+	int mday;			/* 1: monthly, 0: every day */
+};
+
+static const char *wday_names[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+/*
+ * Parse TIME, a number with an optional unit, to msec.  Returns
+ * -1 on error, or if TIME is zero.
+ */
+static int timespan(const char *str)
+{
+	char *end;
+	long val;
+
+	if (!str || !*str)
+		return -1;
+
+	val = strtol(str, &end, 10);
+	if (val <= 0 || end == str)
+		return -1;
+
+	switch (*end) {
+	case 0:
+	case 's':
+		break;
+	case 'm':
+		val *= 60;
+		break;
+	case 'h':
+		val *= 3600;
+		break;
+	case 'd':
+		val *= 86400;
+		break;
+	default:
+		return -1;
+	}
+
+	/* the shared timer takes an int msec delay */
+	if (val > 86400 * 24)
+		return -1;
+
+	return (int)(val * 1000);
+}
+
+static int cal_parse(const char *spec, struct cal *cal)
+{
+	char *buf, *hhmm, *day;
+
+	memset(cal, 0, sizeof(*cal));
+	if (!strcmp(spec, "hourly")) {
+		cal->hour = -1;
+		return 0;
+	}
+	if (!strcmp(spec, "daily"))
+		return 0;
+	if (!strcmp(spec, "weekly")) {
+		cal->wdays = 1 << 1;
+		return 0;
+	}
+	if (!strcmp(spec, "monthly")) {
+		cal->mday = 1;
+		return 0;
+	}
+
+	buf  = strdupa(spec);
+	hhmm = strchr(buf, '@');
+	if (hhmm) {
+		*hhmm++ = 0;
+		for (day = strtok(buf, ","); day; day = strtok(NULL, ",")) {
+			size_t i;
+
+			for (i = 0; i < NELEMS(wday_names); i++) {
+				if (!strncasecmp(day, wday_names[i], 3))
+					break;
+			}
+			if (i == NELEMS(wday_names))
+				return -1;
+			cal->wdays |= 1 << i;
+		}
+	} else
+		hhmm = buf;
+
+	if (hhmm[0] == '*' && hhmm[1] == ':') {
+		cal->hour = -1;
+		hhmm += 2;
+	} else {
+		char *end;
+
+		cal->hour = (int)strtol(hhmm, &end, 10);
+		if (end == hhmm || *end != ':' || cal->hour < 0 || cal->hour > 23)
+			return -1;
+		hhmm = end + 1;
+	}
+
+	if (!isdigit(hhmm[0]))
+		return -1;
+	cal->min = atoi(hhmm);
+	if (cal->min > 59)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Find next wall clock time, after @now, matching @cal.  Stepping whole
+ * hours via mktime() handles month lengths and DST changes for us.
+ */
+static time_t cal_next(const struct cal *cal, time_t now)
+{
+	struct tm base;
+	int i;
+
+	localtime_r(&now, &base);
+	for (i = 0; i <= TIMER_MAX_DAYS * 24; i++) {
+		struct tm tm = base;
+		time_t t;
+
+		tm.tm_hour += i;
+		tm.tm_min   = cal->min;
+		tm.tm_sec   = 0;
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+		if (t == (time_t)-1 || t <= now)
+			continue;
+
+		if (cal->hour >= 0 && tm.tm_hour != cal->hour)
+			continue;
+		if (cal->wdays && !(cal->wdays & (1 << tm.tm_wday)))
+			continue;
+		if (cal->mday && tm.tm_mday != cal->mday)
+			continue;
+
+		return t;
+	}
+
+	return 0;
+}
+
+/* Stable per device and task offset, in [0, jitter_msec] */
+static int jitter(svc_t *svc)
+{
+	static unsigned int seed;
+	unsigned int hash;
+
+	if (svc->jitter_msec <= 0)
+		return 0;
+
+	if (!seed) {
+		char buf[128] = { 0 };
+		FILE *fp;
+
+		fp = fopen("/etc/machine-id", "r");
+		if (!fp || !fgets(buf, sizeof(buf), fp))
+			gethostname(buf, sizeof(buf) - 1);
+		if (fp)
+			fclose(fp);
+		seed = strhash(STRHASH_INIT, buf) | 1;
+	}
+
+	hash = strhash(seed, svc_ident(svc, NULL, 0));
+
+	return (int)(hash % ((unsigned int)svc->jitter_msec + 1));
+}
+
+/*
+ * Arm the work item of a timer task for its next run, or recheck of the
+ * wall clock.  A one-shot after-boot task is not armed again once run.
+ */
+static void timer_arm(svc_t *svc)
+{
+	long long delay;
+
+	if (svc->calendar[0]) {
+		struct cal cal;
+		time_t now = time(NULL);
+
+		if (cal_parse(svc->calendar, &cal))
+			return;
+		svc->next_run = cal_next(&cal, now);
+		if (!svc->next_run)
+			return;
+
+		delay = (long long)(svc->next_run - now) * 1000 + jitter(svc);
+		if (delay > TIMER_RECHECK)
+			delay = TIMER_RECHECK;
+	} else if (!svc->last_run && svc->boot_msec) {
+		delay = svc->boot_msec + jitter(svc) - timeline_now();
+		if (delay < 0)
+			delay = 0;
+		svc->next_run = time(NULL) + delay / 1000;
+	} else if (svc->every_msec) {
+		delay = svc->every_msec;
+		if (!svc->last_run)
+			delay += jitter(svc);
+		svc->next_run = time(NULL) + delay / 1000;
+	} else {
+		svc->next_run = 0;
+		return;
+	}
+
+	svc->tick.delay = (int)delay;
+	schedule_work(&svc->tick);
+}
+
+static void timer_cb(void *arg)
+{
+	svc_t *svc = (svc_t *)((struct wq *)arg)->arg;
+
+	if (svc_is_removed(svc))
+		return;
+
+	/* Only woken up to recheck the wall clock, not due yet */
+	if (svc->calendar[0] && time(NULL) < svc->next_run) {
+		timer_arm(svc);
+		return;
+	}
+
+	if (!svc_in_runlevel(svc, runlevel) || sm_is_in_teardown(&sm)) {
+		dbg("%s: not in runlevel, skipping timer run", svc_ident(svc, NULL, 0));
+		svc->coalesced++;
+	} else if (svc->state != SVC_HALTED_STATE && svc->state != SVC_DONE_STATE) {
+		logit(LOG_NOTICE, "%s: still running, skipping timer run", svc_ident(svc, NULL, 0));
+		svc->coalesced++;
+	} else {
+		dbg("%s: timer expired, starting", svc_ident(svc, NULL, 0));
+		svc->last_run = time(NULL);
+		svc_start(svc);
+		service_step(svc);
+	}
+
+	timer_arm(svc);
+}
+
+/**
+ * timer_setup - Set up, or update, the timer of a task
+ * @svc:    Task to start by timer
+ * @every:  Interval TIME, or %NULL
+ * @boot:   TIME after boot, or %NULL
+ * @cal:    Calendar SPEC, or %NULL
+ * @spread: Jitter TIME, or %NULL
+ *
+ * Called at registration, also on reload.  An unchanged timer keeps its
+ * schedule, a changed or removed one is re-armed or cancelled.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on invalid TIME or SPEC.
+ */
+int timer_setup(svc_t *svc, char *every, char *boot, char *cal, char *spread)
+{
+	int every_msec = 0, boot_msec = 0, jitter_msec = 0;
+	char calendar[sizeof(svc->calendar)] = { 0 };
+	struct cal tmp;
+
+	if (every && (every_msec = timespan(every)) < 0)
+		goto fail;
+	if (boot && (boot_msec = timespan(boot)) < 0)
+		goto fail;
+	if (spread && (jitter_msec = timespan(spread)) < 0)
+		goto fail;
+	if (cal) {
+		if (cal_parse(cal, &tmp))
+			goto fail;
+		strlcpy(calendar, cal, sizeof(calendar));
+	}
+
+	if (svc->every_msec == every_msec && svc->boot_msec == boot_msec &&
+	    svc->jitter_msec == jitter_msec && !strcmp(svc->calendar, calendar) &&
+	    svc->tick.index)
+		return 0;
+
+	cancel_work(&svc->tick);
+	svc->every_msec  = every_msec;
+	svc->boot_msec   = boot_msec;
+	svc->jitter_msec = jitter_msec;
+	strlcpy(svc->calendar, calendar, sizeof(svc->calendar));
+
+	svc->tick.cb  = timer_cb;
+	svc->tick.arg = svc;
+	timer_arm(svc);
+
+	return 0;
+fail:
+	logit(LOG_ERR, "%s: invalid timer, every:%s after-boot:%s cal:%s jitter:%s",
+	      svc_ident(svc, NULL, 0), every ?: "-", boot ?: "-", cal ?: "-", spread ?: "-");
+	return errno = EINVAL;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -24,8 +24,10 @@
 #include "config.h"		/* Generated by configure script */
 
 #include <sys/sysmacros.h>
+#include <sys/wait.h>
 #include "finit.h"
 #include "helpers.h"
+#include "sig.h"
 #include "tmpfiles.h"
 #include "util.h"
 
@@ -223,6 +225,50 @@ static void write_arg(FILE *fp, char *arg)
 	fputs(arg, fp);
 }
 
+/* Max number of worker processes, each handling one or more subtrees */
+#define TMPFILES_WORKERS 4
+
+struct tmpent {
+	char   *line;		/* From fparseln(), strings below point into it */
+	char   *type;
+	char   *path;
+	char   *user;
+	char   *group;
+	char   *arg;
+	mode_t  mode;
+
+	int     seq;		/* Order of line, in all fragments */
+	char   *dir;		/* Parent directory of path */
+	char    top[32];	/* First component of resolved dir, e.g. /run */
+};
+
+static struct tmpent *ents;
+static size_t         num;
+
+/*
+ * Entries are grouped by the first component of their resolved parent
+ * directory, so /var/run/foo is in the /run subtree when /var/run is a
+ * symlink.  Subtrees are independent and can be set up concurrently.
+ */
+static int subtree(struct tmpent *e)
+{
+	char *real, *ptr;
+
+	e->dir = strdup(dirname(strdupa(e->path)));
+	if (!e->dir)
+		return -1;
+
+	real = realpath(e->dir, NULL);
+	strlcpy(e->top, real ?: e->dir, sizeof(e->top));
+	free(real);
+
+	ptr = strchr(&e->top[1], '/');
+	if (ptr)
+		*ptr = 0;
+
+	return 0;
+}
+
 /*
  * The configuration format is one line per path, containing type, path,
  * mode, ownership, age, and argument fields. The lines are separated by
@@ -234,76 +280,211 @@ static void write_arg(FILE *fp, char *arg)
  *
  * https://www.freedesktop.org/software/systemd/man/tmpfiles.d.html
  */
-static void tmpfiles(char *line)
+static void parse(char *line, int seq)
 {
-	char *type, *path, *token, *user, *group, *age, *arg;
-	char *dst = NULL, *opts = "";
-	struct stat st, ast;
-	int major, minor;
-	int strc, rc = 0;
-	mode_t mode = 0;
-	FILE *fp = NULL;
-	char buf[1024];
-	glob_t gl;
-
-	type = strtok(line, "\t ");
-	if (!type)
-		return;
-
-	path = strtok(NULL, "\t ");
-	if (!path)
-		return;
-	if (strchr(path, '%')) {
-		errx(1, "Path name specifiers unsupported, skipping.");
-		return;
+	struct tmpent *e, *tmp;
+	char *token, *ptr;
+	size_t len;
+
+	if (num % 64 == 0) {
+		tmp = realloc(ents, (num + 64) * sizeof(*ents));
+		if (!tmp)
+			goto drop;
+		ents = tmp;
+	}
+	e = &ents[num];
+	memset(e, 0, sizeof(*e));
+
+	e->type = strtok(line, "\t ");
+	if (!e->type)
+		goto drop;
+
+	e->path = strtok(NULL, "\t ");
+	if (!e->path)
+		goto drop;
+	if (strchr(e->path, '%')) {
+		errx(1, "Path name specifiers unsupported, skipping %s", e->path);
+		goto drop;
 	}
+	len = strlen(e->path);
+	while (len > 1 && e->path[len - 1] == '/')
+		e->path[--len] = 0;
 
 	token = strtok(NULL, "\t ");
 	if (token) {
 		errno = 0;
-		mode = strtoul(token, &arg, 8);
-		if (errno || arg == token)
-			mode = 0;
+		e->mode = strtoul(token, &ptr, 8);
+		if (errno || ptr == token)
+			e->mode = 0;
+	}
+
+	e->user = strtok(NULL, "\t ");
+	if (!e->user || !strcmp(e->user, "-"))
+		e->user = "root";
+	e->group = strtok(NULL, "\t ");
+	if (!e->group || !strcmp(e->group, "-"))
+		e->group = "root";
+
+	strtok(NULL, "\t ");	/* age, unused atm. */
+	e->arg = strtok(NULL, "\n");
+
+	if (subtree(e))
+		goto drop;
+
+	e->line = line;
+	e->seq  = seq;
+	num++;
+	return;
+drop:
+	free(line);
+}
+
+/* Types created with *at() syscalls on the parent directory */
+static int is_at(struct tmpent *e)
+{
+	return strchr("bcdDfFLp", e->type[0]) != NULL;
+}
+
+/* Types that read other paths, run after all subtrees are done */
+static int is_late(struct tmpent *e)
+{
+	return strchr("lC", e->type[0]) != NULL;
+}
+
+static int is_relabel(struct tmpent *e)
+{
+	return strchr("zZ", e->type[0]) != NULL;
+}
+
+static int owner(struct tmpent *e, uid_t *uid, gid_t *gid)
+{
+	int u, g;
+
+	u = getuser(e->user, NULL);
+	if (u < 0) {
+		errx(1, "Unknown user %s for %s, skipping.", e->user, e->path);
+		return -1;
 	}
 
-	user = strtok(NULL, "\t ");
-	if (!user || !strcmp(user, "-"))
-		user = "root";
-	group = strtok(NULL, "\t ");
-	if (!group || !strcmp(group, "-"))
-		group = "root";
+	g = getgroup(e->group);
+	*uid = u;
+	*gid = g < 0 ? 0 : g;
 
-	age = strtok(NULL, "\t ");
-	(void)age;		/* unused atm. */
-	arg = strtok(NULL, "\n");
+	return 0;
+}
 
-	strc = stat(path, &st);
+/*
+ * Create, or truncate, @e in the directory @dfd.  Everything in the
+ * same directory is set up with the same @dfd, saving a path lookup
+ * and the mkpath() of the parent per entry.
+ */
+static int apply_at(struct tmpent *e, int dfd)
+{
+	const char *base = basenm(e->path);
+	int plus = e->type[1] == '+';
+	int major, minor;
+	struct stat st;
+	int exist, fd;
+	uid_t uid;
+	gid_t gid;
+	FILE *fp;
+	int rc = 0;
 
-	switch (type[0]) {
+	exist = !fstatat(dfd, base, &st, AT_SYMLINK_NOFOLLOW);
+
+	switch (e->type[0]) {
 	case 'b':
-		rc = parse_mm(arg, &major, &minor);
+	case 'c':
+		rc = parse_mm(e->arg, &major, &minor);
 		if (rc)
 			break;
-		if (!strc) {
-			if (type[1] != '+')
+		if (exist) {
+			if (!plus)
 				break;
-			erase(path);
+			unlinkat(dfd, base, 0);
 		}
-		mkparent(path, 0755);
-		rc = blkdev(path, mode ?: 0644, major, minor);
+		rc = mknodat(dfd, base, (e->type[0] == 'b' ? S_IFBLK : S_IFCHR) | (e->mode ?: 0644),
+			     makedev(major, minor));
 		break;
-	case 'c':
-		rc = parse_mm(arg, &major, &minor);
-		if (rc)
+	case 'd':
+	case 'D':
+		if (owner(e, &uid, &gid))
 			break;
-		if (!strc) {
-			if (type[1] != '+')
+		rc = mkdirat(dfd, base, e->mode ?: 0755);
+		if (rc && errno == EEXIST)
+			rc = fchmodat(dfd, base, e->mode ?: 0755, 0);
+		if (fchownat(dfd, base, uid, gid, 0))
+			err(1, "Failed chown(%s, %d, %d)", e->path, uid, gid);
+		break;
+	case 'f':
+	case 'F':
+		/* f+/F will create or truncate the file, f only create */
+		if (exist && !plus && e->type[0] == 'f')
+			break;
+		if (owner(e, &uid, &gid))
+			break;
+		fd = openat(dfd, base, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, e->mode ?: 0644);
+		if (fd < 0) {
+			rc = -1;
+			break;
+		}
+		if (fchown(fd, uid, gid))
+			err(1, "Failed chown(%s, %d, %d)", e->path, uid, gid);
+		fp = fdopen(fd, "w");
+		if (!fp) {
+			close(fd);
+			rc = -1;
+			break;
+		}
+		write_arg(fp, e->arg);
+		rc = fclose(fp);
+		break;
+	case 'L':
+		if (exist) {
+			if (!plus)
 				break;
-			erase(path);
+			if (S_ISDIR(st.st_mode))
+				rmrf(e->path);
+			else
+				unlinkat(dfd, base, 0);
 		}
-		mkparent(path, 0755);
-		rc = chardev(path, mode ?: 0644, major, minor);
+		if (!e->arg) {
+			char buf[1024];
+
+			paste(buf, sizeof(buf), "/usr/share/factory", e->path);
+			rc = symlinkat(buf, dfd, base);
+		} else
+			rc = symlinkat(e->arg, dfd, base);
+		if (rc && errno == EEXIST)
+			rc = 0;
+		break;
+	case 'p':
+		if (exist) {
+			if (!plus)
+				break;
+			unlinkat(dfd, base, 0);
+		}
+		rc = mkfifoat(dfd, base, e->mode ?: 0644);
 		break;
+	}
+
+	return rc;
+}
+
+/* Entries with globs, or that read other paths */
+static int apply_path(struct tmpent *e)
+{
+	char *path = e->path, *arg = e->arg;
+	struct stat st, ast;
+	char *dst = NULL;
+	char buf[1024];
+	int rc = 0;
+	glob_t gl;
+	int strc;
+
+	strc = stat(path, &st);
+
+	switch (e->type[0]) {
 	case 'C':
 		if (!arg) {
 			paste(buf, sizeof(buf), "/usr/share/factory", path);
@@ -334,50 +515,25 @@ static void tmpfiles(char *line)
 		if (rc && errno == ENOENT)
 			rc = 0;
 		break;
-	case 'd':
-	case 'D':
-		mkparent(path, 0755);
-		rc = mksubsys(path, mode ?: 0755, user, group);
-		break;
 	case 'e':
 		if (glob(path, GLOB_NOESCAPE, NULL, &gl))
 			break;
 
 		for (size_t i = 0; i < gl.gl_pathc; i++)
-			rc += mksubsys(gl.gl_pathv[i], mode ?: 0755, user, group);
-		break;
-	case 'f':
-	case 'F':
-		mkparent(path, 0755);
-		if (type[1] == '+' || type[0] == 'F') {
-			/* f+/F will create or truncate the file */
-			if (!arg) {
-				rc = create(path, mode ?: 0644, user, group);
-				break;
-			}
-			fp = fopen(path, "w+");
-		} else {
-			/* f will create the file if it doesn't exist */
-			if (strc)
-				fp = fopen(path, "w");
-		}
-
-		if (fp) {
-			write_arg(fp, arg);
-			rc = fclose(fp);
-		}
+			rc += mksubsys(gl.gl_pathv[i], e->mode ?: 0755, e->user, e->group);
+		globfree(&gl);
 		break;
 	case 'l': /* Finit extension, like 'L' but only if target exists */
 		if (!arg) {
 			paste(buf, sizeof(buf), "/usr/share/factory", path);
 			if (stat(buf, &ast))
 				break;
+			arg = buf;
 		} else if (arg[0] != '/') {
-			char *tmp;
+			char tmp[1024];
 
-			tmp = dirname(strdupa(path));
-			paste(buf, sizeof(buf), tmp, arg);
-			dst = realpath(buf, NULL);
+			paste(tmp, sizeof(tmp), e->dir, arg);
+			dst = realpath(tmp, NULL);
 			if (!dst)
 				break;
 			if (stat(dst, &ast))
@@ -386,31 +542,16 @@ static void tmpfiles(char *line)
 			if (stat(arg, &ast))
 				break;
 		}
-		/* fallthrough */
-	case 'L':
 		if (!strc) {
-			if (type[1] != '+')
+			if (e->type[1] != '+')
 				break;
 			rmrf(path);
 		}
 		mkparent(path, 0755);
-		if (!arg) {
-			paste(buf, sizeof(buf), "/usr/share/factory", path);
-			arg = buf;
-		}
 		rc = ln(arg, path);
 		if (rc && errno == EEXIST)
 			rc = 0;
 		break;
-	case 'p':
-		if (!strc) {
-			if (type[1] != '+')
-				break;
-			erase(path);
-		}
-		mkparent(path, 0755);
-		rc = mkfifo(path, mode ?: 0644);
-		break;
 	case 'r':
 		rc = glob_do(path, erase);
 		if (rc && errno == ENOENT)
@@ -427,41 +568,199 @@ static void tmpfiles(char *line)
 			break;
 
 		for (size_t i = 0; i < gl.gl_pathc; i++) {
-			fp = fopen(gl.gl_pathv[i], type[1] == '+' ? "a" : "w");
+			FILE *fp;
+
+			fp = fopen(gl.gl_pathv[i], e->type[1] == '+' ? "a" : "w");
 			if (fp) {
-				write_arg(fp, arg);
+				write_arg(fp, strdupa(arg));
 				rc = fclose(fp);
 			}
 		}
+		globfree(&gl);
 		break;
 	case 'X':
 	case 'x':
 		dbg("Unsupported x/X command, ignoring %s, no support for clean at runtime.", path);
 		break;
-	case 'Z':
-		opts = "-R";
-		/* fallthrough */
-	case 'z':
-		if (!whichp("restorecon"))
-			break;
-		if (glob(path, GLOB_NOESCAPE, NULL, &gl))
-			break;
-
-		for (size_t i = 0; i < gl.gl_pathc; i++) {
-			snprintf(buf, sizeof(buf), "restorecon %s %s", opts, gl.gl_pathv[i]);
-			run(buf, "restorecon");
-		}
-		break;
 	default:
-		errx(1, "Unsupported tmpfiles command '%s'", type);
-		return;
+		errx(1, "Unsupported tmpfiles command '%s'", e->type);
+		break;
 	}
 
 	if (dst)
 		free(dst);
 
-	if (rc)
-		warn("Failed %s operation on path %s", type, path);
+	return rc;
+}
+
+/*
+ * Set up a range of entries, sorted by parent directory.  The parent
+ * is created and opened once for all entries in it.
+ */
+static void run_range(struct tmpent **list, size_t len)
+{
+	const char *dir = NULL;
+	int dfd = -1;
+	int rc;
+
+	for (size_t i = 0; i < len; i++) {
+		struct tmpent *e = list[i];
+
+		if (!is_at(e)) {
+			/* May remove the directory we have open */
+			if (dfd >= 0)
+				close(dfd);
+			dfd = -1;
+			dir = NULL;
+
+			rc = apply_path(e);
+			goto done;
+		}
+
+		if (!dir || strcmp(dir, e->dir)) {
+			if (dfd >= 0)
+				close(dfd);
+
+			dir = e->dir;
+			dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (dfd < 0 && errno == ENOENT) {
+				mkpath(dir, 0755);
+				dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			}
+		}
+		if (dfd < 0)
+			rc = -1;
+		else
+			rc = apply_at(e, dfd);
+	done:
+		if (rc)
+			warn("Failed %s operation on path %s", e->type, e->path);
+	}
+
+	if (dfd >= 0)
+		close(dfd);
+}
+
+/*
+ * Subtrees are handed out round-robin to a small pool of worker
+ * processes, like the parallel unmount in mount.c.  Falls back to
+ * running in-process on a single subtree, or if fork() fails.
+ */
+static void run_subtrees(struct tmpent **list, size_t len)
+{
+	pid_t pid[TMPFILES_WORKERS] = { 0 };
+	size_t start[len + 1];
+	size_t groups = 0;
+	int workers;
+
+	for (size_t i = 0; i < len; i++) {
+		if (i && !strcmp(list[i]->top, list[i - 1]->top))
+			continue;
+		start[groups++] = i;
+	}
+	start[groups] = len;
+
+	workers = min(TMPFILES_WORKERS, (int)groups);
+	for (int w = 0; w < workers; w++) {
+		if (workers > 1) {
+			pid[w] = fork();
+			if (pid[w] > 0)
+				continue;
+			if (pid[w] == 0) {
+				setsid();
+				sig_unblock();
+			}
+		}
+
+		for (size_t g = w; g < groups; g += workers)
+			run_range(&list[start[g]], start[g + 1] - start[g]);
+
+		if (pid[w] == 0 && workers > 1)
+			_exit(0);
+	}
+
+	for (int w = 0; w < workers; w++) {
+		if (pid[w] > 0)
+			waitpid(pid[w], NULL, 0);
+	}
+}
+
+/* All z/Z entries are relabeled with one restorecon call per type */
+static void relabel(struct tmpent **list, size_t len)
+{
+	for (int recursive = 0; recursive < 2; recursive++) {
+		int flags = GLOB_NOESCAPE | GLOB_DOOFFS;
+		glob_t gl = { .gl_offs = 2 };
+		char **argv;
+		pid_t pid;
+
+		for (size_t i = 0; i < len; i++) {
+			if ((list[i]->type[0] == 'Z') != recursive)
+				continue;
+			if (!glob(list[i]->path, flags, NULL, &gl))
+				flags |= GLOB_APPEND;
+		}
+		if (!(flags & GLOB_APPEND))
+			continue;
+
+		/* restorecon [-R] path ... */
+		argv = &gl.gl_pathv[recursive ? 0 : 1];
+		argv[0] = "restorecon";
+		if (recursive)
+			argv[1] = "-R";
+
+		pid = fork();
+		if (pid == 0) {
+			setsid();
+			sig_unblock();
+			execvp(argv[0], argv);
+			_exit(EX_OSERR);
+		}
+		if (pid > 0)
+			waitpid(pid, NULL, 0);
+		else
+			warn("Failed starting restorecon");
+
+		globfree(&gl);
+	}
+}
+
+static int by_path(const void *a, const void *b)
+{
+	const struct tmpent *x = *(struct tmpent * const *)a;
+	const struct tmpent *y = *(struct tmpent * const *)b;
+	int rc;
+
+	rc = strcmp(x->path, y->path);
+	return rc ?: x->seq - y->seq;
+}
+
+/*
+ * Within a subtree entries are kept in file order, e.g. a 'w' or 'e'
+ * line must run after the line creating its path.  Consecutive lines
+ * in the same directory still share the open directory in run_range().
+ */
+static int by_top(const void *a, const void *b)
+{
+	const struct tmpent *x = *(struct tmpent * const *)a;
+	const struct tmpent *y = *(struct tmpent * const *)b;
+	int rc;
+
+	rc = strcmp(x->top, y->top);
+	return rc ?: x->seq - y->seq;
+}
+
+static int by_seq(const void *a, const void *b)
+{
+	const struct tmpent *x = *(struct tmpent * const *)a;
+	const struct tmpent *y = *(struct tmpent * const *)b;
+
+	return x->seq - y->seq;
+}
+
+static int by_name(const void *a, const void *b)
+{
+	return strcmp(basenm(*(char * const *)a), basenm(*(char * const *)b));
 }
 
 /*
@@ -469,6 +768,11 @@ static void tmpfiles(char *line)
  * tmpfiles.d(5) as system search paths.  Finit adds two more
  * before that to have Finit specific ones sorted first, and
  * a configure prefix specific one after that for user needs.
+ *
+ * All fragments are parsed first, in order of their file name.  If
+ * more than one line creates the same path, the first one wins.  Then
+ * each subtree, e.g. /run or /var, is set up, in parallel, followed
+ * by entries that read other paths, and one batch of SELinux relabels.
  */
 void tmpfilesd(void)
 {
@@ -480,19 +784,28 @@ void tmpfilesd(void)
 		"/run/tmpfiles.d/*.conf",
 		"/etc/tmpfiles.d/*.conf", /* local admin overrides */
 	};
+	struct tmpent **list, **late, **label;
+	size_t i, nlist = 0, nlate = 0, nlabel = 0;
 	int flags = GLOB_NOESCAPE;
+	size_t nfrag = 0;
+	char **frag;
+	int seq = 0;
 	glob_t gl;
-	size_t i;
 
 	for (i = 0; i < NELEMS(dir); i++) {
 		glob(dir[i], flags, NULL, &gl);
 		flags |= GLOB_APPEND;
 	}
 
+	frag = calloc(gl.gl_pathc + 1, sizeof(char *));
+	if (!frag) {
+		globfree(&gl);
+		return;
+	}
+
 	for (i = 0; i < gl.gl_pathc; i++) {
 		char *fn = gl.gl_pathv[i];
 		size_t j;
-		FILE *fp;
 
 		/* check for overrides */
 		for (j = i + 1; j < gl.gl_pathc; j++) {
@@ -505,11 +818,18 @@ void tmpfilesd(void)
 		if (!fn)
 			continue; /* skip, override exists */
 
-		fp = fopen(fn, "r");
+		frag[nfrag++] = fn;
+	}
+	qsort(frag, nfrag, sizeof(char *), by_name);
+
+	for (i = 0; i < nfrag; i++) {
+		FILE *fp;
+
+		fp = fopen(frag[i], "r");
 		if (!fp)
 			continue;
 
-//		info("Parsing %s ...", fn);
+//		info("Parsing %s ...", frag[i]);
 		while (!feof(fp)) {
 			char *line;
 
@@ -517,13 +837,61 @@ void tmpfilesd(void)
 			if (!line)
 				continue;
 
-			tmpfiles(line);
+			parse(line, seq++);
 		}
 
 		fclose(fp);
 	}
-
+	free(frag);
 	globfree(&gl);
+
+	list  = calloc(num + 1, sizeof(*list));
+	late  = calloc(num + 1, sizeof(*late));
+	label = calloc(num + 1, sizeof(*label));
+	if (!list || !late || !label)
+		goto done;
+
+	/* Find duplicates, only the first line creating a path is used */
+	for (i = 0; i < num; i++)
+		list[i] = &ents[i];
+	qsort(list, num, sizeof(*list), by_path);
+	for (i = 0; i < num; i++) {
+		struct tmpent *e = list[i];
+
+		if (i && strchr("bcCdDfFLlp", e->type[0]) && !strcmp(e->path, list[i - 1]->path) &&
+		    e->type[0] == list[i - 1]->type[0]) {
+			dbg("Duplicate line for %s, ignoring.", e->path);
+			continue;
+		}
+
+		if (is_relabel(e))
+			label[nlabel++] = e;
+		else if (is_late(e))
+			late[nlate++] = e;
+		else
+			list[nlist++] = e;
+	}
+
+	qsort(list, nlist, sizeof(*list), by_top);
+	run_subtrees(list, nlist);
+
+	qsort(late, nlate, sizeof(*late), by_seq);
+	run_range(late, nlate);
+
+	if (nlabel && whichp("restorecon"))
+		relabel(label, nlabel);
+done:
+	free(label);
+	free(late);
+	free(list);
+
+	for (i = 0; i < num; i++) {
+		free(ents[i].dir);
+		free(ents[i].line);
+	}
+	free(ents);
+	ents = NULL;
+	num = 0;
 }
 
 /**
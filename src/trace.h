@@ -0,0 +1,63 @@
+/* USDT static tracepoints, e.g. for bpftrace, or no-ops
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_TRACE_H_
+#define FINIT_TRACE_H_
+
+/*
+ * With configure --enable-usdt each tracepoint is a single nop in the
+ * code, and a note in the ELF file, until a tracer attaches, e.g.
+ *
+ *   bpftrace -e 'usdt:/sbin/finit:finit:svc_state { printf("%s %d -> %d\n",
+ *                str(arg0), arg2, arg3); }'
+ *
+ * Tracepoints:
+ *   svc_state(name, id, old, new)  Service state change, svc_state_t
+ *   svc_fork(name, id, pid)        Service process started
+ *   reap(pid, status)              Process collected, waitpid() status
+ *   cond(name, prev, next)         Condition change, cond_state_t
+ *   api_request(cmd, data)         API request, see finit.h
+ *
+ * Arguments are always evaluated, so only cheap ones, e.g. svc->name
+ * instead of svc_ident().
+ */
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define TRACE2(name, a1, a2)         DTRACE_PROBE2(finit, name, a1, a2)
+#define TRACE3(name, a1, a2, a3)     DTRACE_PROBE3(finit, name, a1, a2, a3)
+#define TRACE4(name, a1, a2, a3, a4) DTRACE_PROBE4(finit, name, a1, a2, a3, a4)
+#else
+#define TRACE2(name, a1, a2)
+#define TRACE3(name, a1, a2, a3)
+#define TRACE4(name, a1, a2, a3, a4)
+#endif
+
+#endif /* FINIT_TRACE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
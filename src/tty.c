@@ -41,6 +41,7 @@
 #include "finit.h"
 #include "conf.h"
 #include "helpers.h"
+#include "metrics.h"
 #include "service.h"
 #include "tty.h"
 #include "util.h"
@@ -143,12 +144,12 @@ char *tty_atcon(void)
  * a leading '/dev' is encountered the remaining options must be in
  * the following sequence:
  *
- *     tty [!1-9,S] <DEV> [BAUD[,BAUD,...]] [noclear] [nowait] [TERM]
+ *     tty [!1-9,S] <DEV> [BAUD[,BAUD,...]] [noclear] [nowait] [lazy] [TERM]
  *
  * Otherwise the leading prefix must be the full path to an existing
  * getty implementation, with it's arguments following:
  *
- *     tty [!1-9,S] </path/to/getty> [ARGS] [noclear] [nowait]
+ *     tty [!1-9,S] </path/to/getty> [ARGS] [noclear] [nowait] [lazy]
  *
  * Different getty implementations prefer the TTY device argument in
  * different order, so take care to investigate this first.
@@ -166,6 +167,8 @@ int tty_parse_args(struct tty *tty, char *cmd, char **args)
 			tty->nowait  = 1;
 		else if (!strcmp(cmd, "nologin"))
 			tty->nologin = 1;
+		else if (!strcmp(cmd, "lazy"))
+			tty->lazy = 1;		/* getty on first input */
 		else if (!strcmp(cmd, "notty"))
 			tty->notty = 1;		/* for board bringup */
 		else if (!strcmp(cmd, "passenv"))
@@ -184,6 +187,12 @@ int tty_parse_args(struct tty *tty, char *cmd, char **args)
 	if (tty->rescue)
 		tty->notty = 1;
 
+	/* no device to watch, and the first key replaces press Enter */
+	if (tty->notty)
+		tty->lazy = 0;
+	if (tty->lazy)
+		tty->nowait = 1;
+
 	/* skip /dev probe, we just want a bríngup shell */
 	if (tty->notty)
 		return 0;
@@ -308,17 +317,87 @@ int tty_exec(svc_t *svc)
 	}
 
 	dbg("%s: Starting %s ...", dev, svc->cmd);
-	for (i = 1, j = 0; i < MAX_NUM_SVC_ARGS; i++) {
-		if (!svc->args[i][0])
-			break;
-
+	for (i = 1, j = 0; svc->args[i] && i < MAX_NUM_SVC_ARGS; i++)
 		args[j++] = svc->args[i];
-	}
 	args[j++] = NULL;
 
 	return run_getty(dev, svc->cmd, args, svc->noclear, svc->nowait, svc->rlimit);
 }
 
+static void tty_cb(uev_t *w, void *arg, int events)
+{
+	svc_t *svc = (svc_t *)arg;
+	PROBE("tty");
+
+	tty_unwatch(svc);
+	if (UEV_ERROR == events)
+		dbg("%s: error on %s, starting anyway", svc_ident(svc, NULL, 0), svc->dev);
+	else
+		dbg("%s: input on %s, starting getty", svc_ident(svc, NULL, 0), svc->dev);
+
+	svc->activated = 1;
+	service_step(svc);
+}
+
+/**
+ * tty_watch - Wait for input on the TTY of a lazy getty
+ * @svc: TTY service with lazy option
+ *
+ * Instead of one idle getty per TTY, Finit holds the device open and
+ * only starts getty when there is input.  The device is closed before
+ * getty is started, and opened again when the session has ended, since
+ * getty and login hang up the TTY when they are done.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero if the TTY cannot be watched, in which case
+ * the caller should start getty directly.
+ */
+int tty_watch(svc_t *svc)
+{
+	char *dev;
+	int fd;
+
+	if (svc->ttyfd > 0)
+		return uev_io_start(&svc->tty_watcher);
+
+	dev = tty_canonicalize(svc->dev);
+	if (!dev)
+		return 1;
+
+	/* Nonblocking open, do not wait for carrier on serial lines */
+	fd = open(dev, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		dbg("%s: cannot watch %s: %s", svc_ident(svc, NULL, 0), dev, strerror(errno));
+		return 1;
+	}
+
+	if (uev_io_init(ctx, &svc->tty_watcher, tty_cb, svc, fd, UEV_READ)) {
+		close(fd);
+		return 1;
+	}
+
+	dbg("%s: waiting for input on %s, fd %d", svc_ident(svc, NULL, 0), dev, fd);
+	svc->ttyfd = fd;
+
+	return 0;
+}
+
+/**
+ * tty_unwatch - Stop waiting for input on the TTY of a lazy getty
+ * @svc: TTY service with lazy option
+ *
+ * Called when getty is started, or when the TTY is stopped or removed.
+ */
+void tty_unwatch(svc_t *svc)
+{
+	if (svc->ttyfd <= 0)
+		return;
+
+	uev_io_stop(&svc->tty_watcher);
+	close(svc->ttyfd);
+	svc->ttyfd = 0;
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
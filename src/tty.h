@@ -41,6 +41,7 @@ struct tty {
 	char	 nologin;
 	char	 notty;
 	char	 rescue;
+	char	 lazy;
 };
 
 char	*tty_canonicalize (char *dev);
@@ -53,6 +54,9 @@ int	 tty_parse_args   (struct tty *tty, char *cmd, char **args);
 int	 tty_exists	  (char *dev);
 int	 tty_exec	  (svc_t *tty);
 
+int	 tty_watch	  (svc_t *svc);
+void	 tty_unwatch	  (svc_t *svc);
+
 #endif /* FINIT_TTY_H_ */
 
 /**
@@ -0,0 +1,302 @@
+/* Cache of resolved users and groups, for service spawn
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"		/* Generated by configure script */
+
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+
+#include "finit.h"
+#include "helpers.h"
+#include "iwatch.h"
+#include "log.h"
+#include "metrics.h"
+#include "usercache.h"
+
+#define USER_BUCKETS 32
+#define USER_NGROUPS 64
+
+/*
+ * Services with @user:group used to look up both in the forked child,
+ * i.e., getpwnam() and getgrnam(), which with NSS opens and parses the
+ * passwd and group files for every (re)start.  Instead the parent looks
+ * them up once, with the user's supplementary groups, and the result is
+ * cached until any of the files change in /etc, or the next reload.
+ */
+struct uent {
+	LIST_ENTRY(uent) link;
+	int    group;		/* 1: group entry, 0: user entry */
+	int    id;		/* uid or gid, -1 if not found */
+	char  *home;
+	int    ngroups;
+	gid_t *groups;
+	char   name[];
+};
+
+static LIST_HEAD(, uent) cache[USER_BUCKETS];
+
+static struct iwatch iw_user = { .name = "user" };
+static uev_t usw;
+static int enabled;
+
+/* Files in /etc that affect lookups */
+static const char *files[] = {
+	"passwd",
+	"group",
+	"nsswitch.conf",
+};
+
+
+static unsigned int hash(const char *name, int group)
+{
+	unsigned int h = 5381 + group;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+
+	return h % USER_BUCKETS;
+}
+
+static void resolve_user(struct uent *e)
+{
+#ifdef ENABLE_STATIC
+	char *home = NULL;
+
+	e->ngroups = -1;
+	e->id = getuser(e->name, &home);
+	if (e->id >= 0 && home)
+		e->home = strdup(home);
+#else
+	struct passwd *pw;
+	int num = USER_NGROUPS;
+	gid_t gid;
+
+	e->ngroups = -1;
+	e->id = -1;
+
+	pw = getpwnam(e->name);
+	if (!pw)
+		return;
+
+	e->id   = pw->pw_uid;
+	e->home = strdup(pw->pw_dir);
+	gid     = pw->pw_gid;
+
+	/* Retry with the number of groups returned if too small */
+	for (int retry = 0; retry < 2; retry++) {
+		gid_t *groups;
+
+		groups = malloc(num * sizeof(gid_t));
+		if (!groups)
+			return;
+
+		if (getgrouplist(e->name, gid, groups, &num) != -1) {
+			e->groups  = groups;
+			e->ngroups = num;
+			return;
+		}
+		free(groups);
+	}
+#endif
+}
+
+static struct uent *lookup(char *name, int group)
+{
+	struct uent *e;
+	unsigned int h;
+
+	h = hash(name, group);
+	LIST_FOREACH(e, &cache[h], link) {
+		if (e->group == group && !strcmp(e->name, name))
+			return e;
+	}
+
+	e = calloc(1, sizeof(*e) + strlen(name) + 1);
+	if (!e)
+		return NULL;
+
+	strcpy(e->name, name);
+	e->group = group;
+	if (group)
+		e->id = getgroup(name);
+	else
+		resolve_user(e);
+
+	LIST_INSERT_HEAD(&cache[h], e, link);
+
+	return e;
+}
+
+static void uent_free(struct uent *e)
+{
+	free(e->home);
+	free(e->groups);
+	free(e);
+}
+
+/**
+ * usercache_get - Resolve user and group of a service
+ * @user:  User name, or %NULL
+ * @group: Group name, or %NULL
+ * @cr:    Resolved ids, home directory, and supplementary groups
+ *
+ * Before usercache_init(), or without inotify, nothing is cached and
+ * the lookups are made directly every time.  Results are then kept in
+ * a per-call static entry, valid until the next call.
+ */
+void usercache_get(char *user, char *group, struct creds *cr)
+{
+	struct uent *e;
+
+	cr->uid     = -1;
+	cr->gid     = -1;
+	cr->home    = NULL;
+	cr->ngroups = -1;
+	cr->groups  = NULL;
+
+	if (!enabled) {
+		static struct uent *u;
+
+		if (u) {
+			uent_free(u);
+			u = NULL;
+		}
+
+		if (user && user[0]) {
+			u = calloc(1, sizeof(*u) + strlen(user) + 1);
+			if (u) {
+				strcpy(u->name, user);
+				resolve_user(u);
+				cr->uid     = u->id;
+				cr->home    = u->home;
+				cr->ngroups = u->ngroups;
+				cr->groups  = u->groups;
+			}
+		}
+		if (group && group[0])
+			cr->gid = getgroup(group);
+
+		return;
+	}
+
+	if (user && user[0] && (e = lookup(user, 0))) {
+		cr->uid     = e->id;
+		cr->home    = e->home;
+		cr->ngroups = e->ngroups;
+		cr->groups  = e->groups;
+	}
+
+	if (group && group[0] && (e = lookup(group, 1)))
+		cr->gid = e->id;
+}
+
+/**
+ * usercache_flush - Drop all cached users and groups
+ *
+ * Called on .conf reload, in case of NSS backends we cannot watch, and
+ * when any of the watched files in /etc change.
+ */
+void usercache_flush(void)
+{
+	for (int i = 0; i < USER_BUCKETS; i++) {
+		struct uent *e;
+
+		while ((e = LIST_FIRST(&cache[i]))) {
+			LIST_REMOVE(e, link);
+			uent_free(e);
+		}
+	}
+}
+
+static void usercache_cb(uev_t *w, void *arg, int events)
+{
+	char buf[8 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+	int changed = 0;
+	ssize_t sz;
+	PROBE("usercache");
+
+	while ((sz = read(w->fd, buf, sizeof(buf))) > 0) {
+		struct inotify_event *ev;
+		size_t off;
+
+		for (off = 0; off + sizeof(*ev) <= (size_t)sz; off += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)&buf[off];
+			if (!ev->len)
+				continue;
+
+			for (size_t i = 0; i < NELEMS(files); i++) {
+				if (!strcmp(ev->name, files[i]))
+					changed = 1;
+			}
+		}
+	}
+
+	if (changed) {
+		dbg("User or group database changed, flushing cache.");
+		usercache_flush();
+	}
+}
+
+/*
+ * Watch /etc, not the files, since tools like useradd and vipw replace
+ * them using rename().  Without inotify the cache is disabled.
+ */
+void usercache_init(uev_ctx_t *ctx)
+{
+	for (int i = 0; i < USER_BUCKETS; i++)
+		LIST_INIT(&cache[i]);
+
+	if (iwatch_init(&iw_user) < 0)
+		return;
+
+	if (iwatch_add(&iw_user, "/etc", IN_ONLYDIR)) {
+		iwatch_exit(&iw_user);
+		return;
+	}
+
+	if (uev_io_init(ctx, &usw, usercache_cb, NULL, iw_user.fd, UEV_READ)) {
+		warn("Failed setting up user/group watcher");
+		iwatch_exit(&iw_user);
+		return;
+	}
+
+	enabled = 1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,50 @@
+/* Cache of resolved users and groups, for service spawn
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_USERCACHE_H_
+#define FINIT_USERCACHE_H_
+
+#include <sys/types.h>
+#include <uev/uev.h>
+
+/* Resolved @user:group of a service, pointers valid until next flush */
+struct creds {
+	int    uid;		/* -1 if not found */
+	int    gid;		/* -1 if not found */
+	char  *home;		/* %NULL if not found */
+	int    ngroups;		/* supplementary groups, -1 if unknown */
+	gid_t *groups;
+};
+
+void usercache_init  (uev_ctx_t *ctx);
+void usercache_flush (void);
+void usercache_get   (char *user, char *group, struct creds *cr);
+
+#endif /* FINIT_USERCACHE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
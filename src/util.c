@@ -482,6 +482,62 @@ char *sanitize(char *arg, size_t len)
 	return arg;
 }
 
+/* Free-form strings, e.g. STATUS= from a service, as a JSON string */
+char *json_escape(const char *src, char *buf, size_t len)
+{
+	size_t i = 0;
+
+	for (; *src && i + 7 < len; src++) {
+		unsigned char c = *src;
+
+		if (c == '"' || c == '\\') {
+			buf[i++] = '\\';
+			buf[i++] = c;
+		} else if (c < 0x20)
+			i += snprintf(&buf[i], len - i, "\\u%04x", c);
+		else
+			buf[i++] = c;
+	}
+	buf[i] = 0;
+
+	return buf;
+}
+
+/* Same, as text or attribute value in XML, e.g. initctl analyze svg */
+char *xml_escape(const char *src, char *buf, size_t len)
+{
+	size_t i = 0;
+
+	for (; *src && i + 7 < len; src++) {
+		unsigned char c = *src;
+
+		switch (c) {
+		case '<':
+			i += snprintf(&buf[i], len - i, "&lt;");
+			break;
+		case '>':
+			i += snprintf(&buf[i], len - i, "&gt;");
+			break;
+		case '&':
+			i += snprintf(&buf[i], len - i, "&amp;");
+			break;
+		case '"':
+			i += snprintf(&buf[i], len - i, "&quot;");
+			break;
+		case '\'':
+			i += snprintf(&buf[i], len - i, "&apos;");
+			break;
+		default:
+			if (c >= 0x20)
+				buf[i++] = c;
+			break;
+		}
+	}
+	buf[i] = 0;
+
+	return buf;
+}
+
 void de_dotdot(char *file)
 {
         char *cp, *cp2;
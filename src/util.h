@@ -76,6 +76,8 @@ char *uptime       (long secs, char *buf, size_t len);
 char *memsz        (uint64_t sz, char *buf, size_t len);
 
 char *sanitize     (char *arg, size_t len);
+char *json_escape  (const char *src, char *buf, size_t len);
+char *xml_escape   (const char *src, char *buf, size_t len);
 void  de_dotdot    (char *file);
 
 int   ismnt        (char *file, char *dir, char *mode);
@@ -98,6 +100,16 @@ static inline char *strterm(char *str, size_t len)
 	return str;
 }
 
+/* djb2 string hash, start with STRHASH_INIT, chain to hash several strings */
+#define STRHASH_INIT 5381
+static inline unsigned int strhash(unsigned int hash, const char *str)
+{
+	while (*str)
+		hash = hash * 33 + (unsigned char)*str++;
+
+	return hash;
+}
+
 /* paste dir/file into buf */
 static inline int paste(char *buf, size_t len, const char *dir, const char *file)
 {
@@ -40,6 +40,7 @@
 int running  = 1;
 int handover = 0;
 int shutdown = 0;
+int disarm   = 0;
 
 static void sighandler(int signo)
 {
@@ -47,6 +48,8 @@ static void sighandler(int signo)
 		handover = 1;
 	if (signo == SIGPWR)
 		shutdown = 1;
+	if (signo == SIGUSR1)
+		disarm = 1;
 
 	running = 0;
 }
@@ -58,6 +61,7 @@ static int init(char *progname, char *devnode)
 	sprintf(progname, "@finit-watchdog");
 	signal(SIGTERM, sighandler);
 	signal(SIGPWR,  sighandler);
+	signal(SIGUSR1, sighandler);
 
 	openlog(&progname[1], LOG_CONS | LOG_PID, LOG_DAEMON);
 
@@ -110,13 +114,23 @@ int main(int argc, char *argv[])
 	}
 
 	rc = loop(fd, WDT_TIMEOUT);
-	while (!handover) {
-		/* Waiting for SIGTERM or WDT reset ... */
+	while (!handover && !disarm) {
+		/* Waiting for SIGTERM, SIGUSR1, or WDT reset ... */
 		sleep(1);
 
 		/* Set lowest possible timeout on SIGPWR */
 		ioctl(fd, WDIOC_SETTIMEOUT, &shutdown);
 	}
+
+	/* Disarm before kexec, nothing kicks the WDT while it boots */
+	if (disarm) {
+		int dummy = 0, timeout = WDT_TIMEOUT;
+
+		ioctl(fd, WDIOC_SETTIMEOUT, &timeout);
+		ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+		if (write(fd, "V", 1) == -1)
+			rc = EX_IOERR;
+	}
 	close(fd);
 done:
 	closelog();
@@ -0,0 +1,330 @@
+/* Integrated watchdog, kick the WDT from the event loop while Finit is healthy
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * With the 'watchdog' setting in /etc/finit.conf Finit itself kicks the
+ * watchdog device from its event loop, instead of the separate built-in
+ * watchdogd, which is not started.  A heartbeat timer, every second,
+ * measures how late the event loop runs it.  The device is only kicked
+ * if the loop has not been stalled for more than the latency threshold
+ * since the previous kick, and no service marked `critical` has been
+ * down for longer than the grace period.  Otherwise the device is left
+ * to expire and reset the system.
+ *
+ * The device is kicked four times per timeout, so a single stall only
+ * skips one kick, a hung or repeatedly stalled event loop resets the
+ * system within the timeout.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/watchdog.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+#else
+# include <lite/lite.h>
+#endif
+
+#include "finit.h"
+#include "log.h"
+#include "private.h"
+#include "schedule.h"
+#include "sm.h"
+#include "svc.h"
+#include "timeline.h"
+#include "watchdog.h"
+#include "wdt.h"
+
+#define WDT_TICK     1000		/* msec, heartbeat */
+#define WDT_LATENCY  5000		/* msec, default max event loop stall */
+#define WDT_GRACE    60			/* sec, default max downtime of critical svc */
+
+static char     *wdt_dev;
+static int       wdt_fd = -1;
+static int       wdt_conf_set;		/* 'watchdog' in finit.conf */
+static int       wdt_timeout = WDT_TIMEOUT;
+static int       wdt_latency = WDT_LATENCY;
+static int       wdt_grace   = WDT_GRACE;
+static long long wdt_expected;		/* msec, next heartbeat */
+static long long wdt_kicked;		/* msec, last kick */
+static int       wdt_stall;		/* msec, max lateness since last kick */
+static int       wdt_refused;		/* log only once per unhealthy period */
+
+static void wdt_cb(void *arg);
+static struct wq wdt_work = {
+	.cb    = wdt_cb,
+	.prio  = WQ_HIGH,
+	.delay = WDT_TICK,
+};
+
+/**
+ * wdt_conf - Parse 'watchdog [timeout:SEC] [latency:MSEC] [grace:SEC] [DEV]'
+ * @arg: Setting, without the 'watchdog' keyword, may be empty
+ *
+ * Only called at bootstrap, before wdt_init().
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on invalid setting.
+ */
+int wdt_conf(char *arg)
+{
+	const char *errstr = NULL;
+	char *tok, *ptr;
+
+	wdt_conf_set = 1;
+	for (tok = strtok_r(arg, " \t", &ptr); tok; tok = strtok_r(NULL, " \t", &ptr)) {
+		char *val;
+
+		if (tok[0] == '/') {
+			free(wdt_dev);
+			wdt_dev = strdup(tok);
+		} else if (MATCH_CMD(tok, "timeout:", val)) {
+			wdt_timeout = strtonum(val, 1, 3600, &errstr);
+		} else if (MATCH_CMD(tok, "latency:", val)) {
+			wdt_latency = strtonum(val, 100, 3600000, &errstr);
+		} else if (MATCH_CMD(tok, "grace:", val)) {
+			wdt_grace = strtonum(val, 1, 86400, &errstr);
+		} else {
+			logit(LOG_WARNING, "watchdog: unknown option %s", tok);
+			return 1;
+		}
+
+		if (errstr) {
+			logit(LOG_WARNING, "watchdog: invalid %s, %s", tok, errstr);
+			wdt_conf_set = 0;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Critical service that has crashed, or is restarting, for longer than
+ * the grace period.  A service stopped by the operator, or waiting for
+ * its conditions, is not down.
+ */
+static svc_t *wdt_critical(long long now)
+{
+	svc_t *svc, *iter = NULL;
+
+	if (sm_is_in_teardown(&sm))
+		return NULL;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (!svc->critical || svc_is_running(svc))
+			continue;
+		if (!svc_is_crashing(svc) && !svc_is_restart(svc))
+			continue;
+		if (!svc_in_runlevel(svc, runlevel))
+			continue;
+
+		if (now - svc->state_at >= (long long)wdt_grace * 1000)
+			return svc;
+	}
+
+	return NULL;
+}
+
+static void wdt_kick(void)
+{
+	int dummy = 0;
+
+	ioctl(wdt_fd, WDIOC_KEEPALIVE, &dummy);
+}
+
+static void wdt_cb(void *arg)
+{
+	long long now = timeline_now();
+	int period = wdt_timeout * 1000 / 4;
+	svc_t *svc;
+	int late;
+
+	late = (int)(now - wdt_expected);
+	if (late > wdt_stall)
+		wdt_stall = late;
+	wdt_expected = now + WDT_TICK;
+	schedule_work(&wdt_work);
+
+	if (now - wdt_kicked < period)
+		return;
+
+	if (wdt_stall > wdt_latency) {
+		logit(LOG_CRIT, "Event loop stalled %d msec, not kicking watchdog.", wdt_stall);
+		wdt_stall  = 0;
+		wdt_kicked = now;	/* skip one kick */
+		return;
+	}
+
+	svc = wdt_critical(now);
+	if (svc) {
+		if (!wdt_refused)
+			logit(LOG_CRIT, "Critical service %s down for %lld sec, not kicking watchdog.",
+			      svc_ident(svc, NULL, 0), (now - svc->state_at) / 1000);
+		wdt_refused = 1;
+		return;
+	}
+
+	wdt_kick();
+	wdt_kicked  = now;
+	wdt_stall   = 0;
+	wdt_refused = 0;
+}
+
+/**
+ * wdt_init - Open watchdog device and start kicking it, if enabled
+ *
+ * Called after conf_init(), replaces the built-in watchdogd.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero on error.
+ */
+int wdt_init(void)
+{
+	const char *dev = wdt_dev ?: WDT_DEVNODE;
+	int timeout = wdt_timeout;
+
+	if (!wdt_conf_set || rescue)
+		return 0;
+
+	wdt_fd = open(dev, O_WRONLY | O_CLOEXEC);
+	if (wdt_fd == -1) {
+		err(1, "Failed opening watchdog %s", dev);
+		return 1;
+	}
+
+	if (!ioctl(wdt_fd, WDIOC_SETTIMEOUT, &timeout) && timeout != wdt_timeout) {
+		logit(LOG_NOTICE, "Watchdog %s timeout adjusted by driver to %d sec", dev, timeout);
+		wdt_timeout = timeout;
+	}
+
+	/* Only drop the built-in watchdogd when we have the device */
+	if (wdog) {
+		logit(LOG_NOTICE, "Integrated watchdog replaces %s", svc_ident(wdog, NULL, 0));
+		svc_del(wdog);
+		erase(FINIT_RUNPATH_ "/watchdogd.conf");
+		wdog = NULL;
+	}
+
+	dbg("Kicking %s every %d msec, timeout %d sec, max latency %d msec, grace %d sec",
+	    dev, wdt_timeout * 1000 / 4, wdt_timeout, wdt_latency, wdt_grace);
+	wdt_kick();
+	wdt_kicked   = timeline_now();
+	wdt_expected = wdt_kicked + WDT_TICK;
+
+	return schedule_work(&wdt_work);
+}
+
+/**
+ * wdt_enabled - Is Finit kicking the watchdog itself
+ */
+int wdt_enabled(void)
+{
+	return wdt_fd != -1;
+}
+
+/**
+ * wdt_exit - Hand over watchdog to another daemon
+ *
+ * Called when an external watchdog daemon registers with Finit.  The
+ * device is closed with the magic character to not reset the system
+ * before the new daemon has opened it.
+ */
+void wdt_exit(void)
+{
+	if (wdt_fd == -1)
+		return;
+
+	cancel_work(&wdt_work);
+	wdt_kick();
+	if (write(wdt_fd, "V", 1) == -1)
+		warn("Failed magic close of watchdog");
+	close(wdt_fd);
+	wdt_fd = -1;
+}
+
+/**
+ * wdt_shutdown - System going down, reset by watchdog if shutdown hangs
+ *
+ * The event loop is no longer running, so we kick once and lower the
+ * timeout to a third, like the built-in watchdogd on SIGPWR.
+ */
+void wdt_shutdown(void)
+{
+	int timeout = wdt_timeout / 3 ?: 1;
+
+	if (wdt_fd == -1)
+		return;
+
+	cancel_work(&wdt_work);
+	ioctl(wdt_fd, WDIOC_SETTIMEOUT, &timeout);
+	wdt_kick();
+}
+
+/**
+ * wdt_disarm - Stop watchdog before kexec into a new kernel
+ *
+ * Nothing kicks the device from kexec until the new kernel's init has
+ * started.  The configured timeout is restored, in case the driver
+ * cannot be stopped (nowayout), then the device is magic closed.
+ */
+void wdt_disarm(void)
+{
+	int timeout = wdt_timeout;
+
+	if (wdt_fd == -1)
+		return;
+
+	ioctl(wdt_fd, WDIOC_SETTIMEOUT, &timeout);
+	wdt_exit();
+}
+
+/**
+ * wdt_reboot - Reboot by watchdog
+ *
+ * Returns:
+ * POSIX OK(0) if the watchdog will reset the system, non-zero if the
+ * integrated watchdog is not enabled.
+ */
+int wdt_reboot(void)
+{
+	int timeout = 1;
+
+	if (wdt_fd == -1)
+		return 1;
+
+	ioctl(wdt_fd, WDIOC_SETTIMEOUT, &timeout);
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,244 @@
+/* Cache of resolved executables, for whichp() lookups
+ *
+ * Copyright (c) 2024  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"		/* Generated by configure script */
+
+#include <errno.h>
+#include <limits.h>
+#include <paths.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+
+#include "finit.h"
+#include "iwatch.h"
+#include "log.h"
+#include "metrics.h"
+#include "which.h"
+
+#define WHICH_BUCKETS 64
+
+/*
+ * Every service is checked with whichp() when registered and when it
+ * is started.  On a reload of a system with many services that is a
+ * lot of stat() calls, walking $PATH, for the same few commands.  So
+ * results are cached, until any of the directories searched change,
+ * or the next .conf reload, since inotify does not see mounts.
+ */
+struct which {
+	LIST_ENTRY(which) link;
+	int   found;
+	int   error;		/* errno from whichp() */
+	char  cmd[];
+};
+
+static LIST_HEAD(, which) cache[WHICH_BUCKETS];
+
+static struct iwatch iw_which = { .name = "which" };
+static uev_t whw;
+static int enabled;
+
+
+static unsigned int hash(const char *cmd)
+{
+	unsigned int h = 5381;
+
+	while (*cmd)
+		h = h * 33 + (unsigned char)*cmd++;
+
+	return h % WHICH_BUCKETS;
+}
+
+static int watch_dir(char *dir)
+{
+	if (!dir[0])
+		return -1;
+
+	if (iwatch_find_by_path(&iw_which, dir))
+		return 0;
+
+	if (!fisdir(dir))
+		return -1;
+
+	return iwatch_add(&iw_which, dir, IN_ONLYDIR);
+}
+
+/*
+ * Watch the directories a command is looked up in.  Returns non-zero
+ * if any of them cannot be watched, e.g. does not exist (yet).
+ */
+static int watch(char *cmd)
+{
+	char *path, *dir, *ptr;
+	int rc = 0;
+
+	if (cmd[0] == '/') {
+		path = strdupa(cmd);
+		if (!path)
+			return -1;
+
+		ptr = strrchr(path, '/');
+		if (ptr == path)
+			ptr++;
+		*ptr = 0;
+
+		return watch_dir(path);
+	}
+
+	path = getenv("PATH");
+	if (!path)
+		path = _PATH_STDPATH;
+
+	path = strdupa(path);
+	if (!path)
+		return -1;
+
+	for (dir = strtok(path, ":"); dir; dir = strtok(NULL, ":")) {
+		if (watch_dir(dir))
+			rc = -1;
+	}
+
+	return rc;
+}
+
+/**
+ * which_cached - Cached version of whichp()
+ * @cmd: Command, absolute path or name to look up in $PATH
+ *
+ * Returns:
+ * Like whichp(), non-zero if @cmd exists and is executable, otherwise
+ * zero with errno set.
+ */
+int which_cached(char *cmd)
+{
+	struct which *w;
+	unsigned int h;
+	int incomplete;
+
+	/* Relative to cwd, or before which_init(), nothing to cache */
+	if (!enabled || !cmd || !cmd[0] || (cmd[0] != '/' && strchr(cmd, '/')))
+		return whichp(cmd);
+
+	h = hash(cmd);
+	LIST_FOREACH(w, &cache[h], link) {
+		if (strcmp(w->cmd, cmd))
+			continue;
+
+		if (!w->found)
+			errno = w->error;
+		return w->found;
+	}
+
+	/* Watch before lookup, so we don't miss any change in between */
+	incomplete = watch(cmd);
+
+	w = malloc(sizeof(*w) + strlen(cmd) + 1);
+	if (!w)
+		return whichp(cmd);
+
+	strcpy(w->cmd, cmd);
+	errno = 0;
+	w->found = whichp(cmd);
+	w->error = errno;
+
+	/* May show up later in a directory we could not watch */
+	if (!w->found && incomplete) {
+		errno = w->error;
+		free(w);
+		return 0;
+	}
+
+	LIST_INSERT_HEAD(&cache[h], w, link);
+	if (!w->found)
+		errno = w->error;
+
+	return w->found;
+}
+
+/**
+ * which_flush - Drop all cached lookups
+ *
+ * Called on .conf reload, when $PATH may have changed, and when any of
+ * the watched directories change.
+ */
+void which_flush(void)
+{
+	for (int i = 0; i < WHICH_BUCKETS; i++) {
+		struct which *w;
+
+		while ((w = LIST_FIRST(&cache[i]))) {
+			LIST_REMOVE(w, link);
+			free(w);
+		}
+	}
+}
+
+static void which_cb(uev_t *w, void *arg, int events)
+{
+	char buf[8 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+	int changed = 0;
+	PROBE("which");
+
+	while (read(w->fd, buf, sizeof(buf)) > 0)
+		changed = 1;
+
+	if (changed) {
+		dbg("PATH directory changed, flushing cache.");
+		which_flush();
+	}
+}
+
+/*
+ * Without inotify there is no way to know when to flush the cache, so
+ * it is then disabled and which_cached() calls whichp() directly.
+ */
+void which_init(uev_ctx_t *ctx)
+{
+	for (int i = 0; i < WHICH_BUCKETS; i++)
+		LIST_INIT(&cache[i]);
+
+	if (iwatch_init(&iw_which) < 0)
+		return;
+
+	if (uev_io_init(ctx, &whw, which_cb, NULL, iw_which.fd, UEV_READ)) {
+		warn("Failed setting up PATH watcher");
+		close(iw_which.fd);
+		return;
+	}
+
+	enabled = 1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
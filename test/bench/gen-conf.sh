@@ -0,0 +1,46 @@
+#!/bin/sh
+# Generate NUM run/task/services in .conf files of 100 stanzas each.
+#
+# Every tenth stanza is a task, the rest are services.  Services form a
+# DAG of conditions: service N waits for the PID files of N/2 and N/3,
+# which gives a graph depth of log2(NUM).  Tasks wait for condition
+# usr/bench/reap, set by the benchmark to measure how fast Finit can
+# start and collect them.
+
+set -eu
+
+if [ "$#" -lt 2 ]; then
+    echo "Usage:"
+    echo "  $0 NUM DIR"
+    exit 1
+fi
+num=$1
+dir=$2
+
+mkdir -p "$dir"
+rm -f "$dir"/bench-*.conf
+
+i=1
+while [ "$i" -le "$num" ]; do
+    file=$(printf "%s/bench-%05d.conf" "$dir" $(((i - 1) / 100)))
+
+    if [ $((i % 10)) -eq 0 ]; then
+	echo "task [2] name:t$i <usr/bench/reap> /bin/true -- Bench task $i"
+    elif [ "$i" -eq 1 ]; then
+	echo "service [2] name:s$i serv -np -i s$i -- Bench service $i"
+    else
+	# Tasks provide no PID file, depend on service 1 instead
+	p=$((i / 2))
+	[ $((p % 10)) -eq 0 ] && p=1
+	cond="pid/s$p"
+
+	p=$((i / 3))
+	if [ "$p" -gt 1 ] && [ $((p % 10)) -ne 0 ]; then
+	    cond="$cond,pid/s$p"
+	fi
+
+	echo "service [2] name:s$i <$cond> serv -np -i s$i -- Bench service $i"
+    fi >> "$file"
+
+    i=$((i + 1))
+done
@@ -0,0 +1,95 @@
+#!/bin/sh
+# Benchmark Finit with NUM generated run/task/services, see gen-conf.sh
+#
+# Measures time to end of bootstrap, latency of initctl reload and
+# initctl status, and how many tasks Finit can start and collect per
+# second.  Results are appended as one JSON object per line to the
+# file $BENCH_OUTPUT, default bench.json, for tracking across releases.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")/..
+NUM=${1:-100}
+LAPS=${BENCH_LAPS:-20}
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench.json}
+TEST_TIMEOUT=$((300 + NUM / 10))
+
+SYSROOT="${SYSROOT:-$(pwd)/${TEST_DIR}/sysroot}"
+# shellcheck source=/dev/null
+. "$SYSROOT/../test.env"
+
+test_teardown()
+{
+    say "Benchmark done $(date)"
+    rm -f "$SYSROOT$FINIT_RCSD"/bench-*.conf
+}
+
+# Current value of a metric, from initctl metrics
+metric()
+{
+    texec initctl metrics | awk -v m="$1" '$1 == m { print $2 }'
+}
+
+# Milliseconds, from an arbitrary starting point
+now()
+{
+    echo $(($(date +%s%N) / 1000000))
+}
+
+bootstrapped()
+{
+    sec=$(metric finit_bootstrap_seconds)
+    [ -n "$sec" ] && [ "$sec" != "0.000" ]
+}
+
+"$TEST_DIR/bench/gen-conf.sh" "$NUM" "$SYSROOT$FINIT_RCSD"
+tasks=$((NUM / 10))
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Benchmark start $(date), $NUM run/task/services"
+
+retry bootstrapped $((NUM + 100)) 0.5 >/dev/null
+boot=$(metric finit_bootstrap_seconds)
+say "Bootstrap done in $boot sec"
+
+say "Measure initctl status latency, average of $LAPS laps"
+start=$(now)
+i=0
+while [ $i -lt "$LAPS" ]; do
+    texec true
+    i=$((i + 1))
+done
+base=$(($(now) - start))
+
+start=$(now)
+i=0
+while [ $i -lt "$LAPS" ]; do
+    texec initctl status >/dev/null
+    i=$((i + 1))
+done
+status=$(((($(now) - start) - base) / LAPS))
+say "initctl status in $status msec"
+
+say "Measure initctl reload latency, one .conf changed"
+count=$(metric finit_reload_seconds_count)
+sum=$(metric finit_reload_seconds_sum)
+run "echo '# touched' >> $FINIT_RCSD/bench-00000.conf"
+run "initctl reload"
+retry "[ \"\$(metric finit_reload_seconds_count)\" -gt $count ]" $((NUM + 100)) 0.1 >/dev/null
+reload=$(awk -v a="$sum" -v b="$(metric finit_reload_seconds_sum)" 'BEGIN { printf "%d", (b - a) * 1000 }')
+say "initctl reload in $reload msec"
+
+say "Measure reap throughput, $tasks tasks"
+reaped=$(metric finit_reaped_total)
+start=$(now)
+run "initctl cond set bench/reap"
+retry "[ \"\$(metric finit_reaped_total)\" -ge $((reaped + tasks)) ]" $((NUM + 100)) 0.1 >/dev/null
+elapsed=$(($(now) - start))
+rate=$((tasks * 1000 / (elapsed > 0 ? elapsed : 1)))
+say "Reaped $tasks tasks in $elapsed msec, $rate/sec"
+
+version=$(awk -F'"' '/define PACKAGE_VERSION/ { print $2 }' "${top_builddir:-.}/config.h" 2>/dev/null || true)
+printf '{"version":"%s","services":%d,"bootstrap_sec":%s,"status_msec":%d,"reload_msec":%d,"reap_per_sec":%d}\n' \
+       "${version:-unknown}" "$NUM" "$boot" "$status" "$reload" "$rate" >> "$BENCH_OUTPUT"
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Verify that a stopped service is complete only when its cgroup is
+# empty, and that left-overs are killed with the group.  A task that
+# exits on its own, leaving a daemon behind, is done right away and
+# its daemon is left alone.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -f /tmp/fork.pid"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "[ -f /tmp/fork.pid ] && kill \$(cat /tmp/fork.pid) || true"
+    run "rm -f $FINIT_CONF /tmp/fork.pid"
+}
+
+alive()
+{
+    texec kill -0 "$1" 2>/dev/null
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+if ! texec test -d /sys/fs/cgroup/system; then
+    skip "No cgroup support in test environment."
+fi
+
+sep "Stop service with a forked grandchild"
+run "echo 'service name:drain fork.sh -- Drain' > $FINIT_CONF"
+run "initctl reload"
+retry 'assert_status drain running' 25 0.2
+retry 'texec test -s /tmp/fork.pid' 25 0.2
+pid=$(texec cat /tmp/fork.pid)
+assert "Grandchild $pid running" "$(alive "$pid" && echo yes)" = "yes"
+
+run "initctl stop drain"
+retry 'assert_status drain stopped' 50 0.2
+assert "Grandchild $pid killed with the group" "$(alive "$pid" || echo gone)" = "gone"
+
+sep "Task that exits, leaving a daemon behind"
+run "rm -f /tmp/fork.pid"
+run "echo 'task name:daemonize fork.sh exit -- Daemonize' > $FINIT_CONF"
+run "initctl reload"
+retry 'assert_status daemonize done' 10 0.2
+pid=$(texec cat /tmp/fork.pid)
+
+# Longer than the default kill delay, 3 sec
+sleep 4
+assert "Daemon $pid of task left alone" "$(alive "$pid" && echo yes)" = "yes"
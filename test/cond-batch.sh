@@ -0,0 +1,72 @@
+#!/bin/sh
+# Verify batched condition updates: setting several conditions in one
+# 'initctl cond set' starts a service depending on all of them once,
+# the state is published in the shared condition cache, and clearing
+# them stops the service again.  A set must also win over an earlier
+# clear of a debounced condition that has not settled yet.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+# shellcheck disable=SC2034
+BOOTSTRAP="debounce usr/d 2"
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -f /tmp/batch.cnt /tmp/batch.env"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "initctl cond clr a b c d || true"
+    run "rm -f $FINIT_RCSD/batch.conf /tmp/batch.cnt /tmp/batch.env"
+}
+
+runlevel()
+{
+    texec initctl runlevel | awk '{print $2}'
+}
+
+starts()
+{
+    texec sh -c 'cat /tmp/batch.cnt 2>/dev/null | wc -l'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+retry '[ "$(runlevel)" = 2 ]' 50 0.2
+
+say 'Add service depending on three conditions'
+run "echo 'service name:batch <usr/a,usr/b,usr/c> probe.sh batch -- Batch' > $FINIT_RCSD/batch.conf"
+run "initctl reload"
+retry 'assert_status batch waiting' 25 0.2
+
+say 'Set all conditions at once'
+run "initctl cond set a,b,c"
+retry 'assert_status batch running' 25 0.2
+assert_cond usr/a
+assert_cond usr/b
+assert_cond usr/c
+assert "Condition cache published" "$(texec test -s /run/finit/cond.shm && echo yes)" = "yes"
+
+sleep 1
+assert "Service started once" "$(starts)" -eq 1
+
+say 'Clear two of them'
+run "initctl cond clr a b"
+retry 'assert_status batch waiting' 25 0.2
+assert_nocond usr/a
+assert_nocond usr/b
+assert_cond usr/c
+
+say 'Clear and set a debounced condition before the clear settles'
+run "initctl cond set d"
+retry 'assert_cond usr/d' 25 0.2
+run "initctl cond clr d"
+run "initctl cond set d"
+sleep 3
+assert_cond usr/d
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Verify debounced conditions: a flapping interface, within the settle
+# time, must not restart the services that depend on it.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+# shellcheck disable=SC2034
+BOOTSTRAP="debounce net/lo/ 2"
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -f /tmp/flap.cnt /tmp/flap.env"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "rm -f $FINIT_RCSD/flap.conf /tmp/flap.cnt /tmp/flap.env"
+}
+
+runlevel()
+{
+    texec initctl runlevel | awk '{print $2}'
+}
+
+starts()
+{
+    texec sh -c 'cat /tmp/flap.cnt 2>/dev/null | wc -l'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+retry '[ "$(runlevel)" = 2 ]' 50 0.2
+if ! retry 'assert_cond net/lo/exist' 25 0.2; then
+    skip "No net/ conditions, netlink plugin missing."
+fi
+
+say 'Add service depending on loopback being up'
+run "echo 'service name:flap <net/lo/up> probe.sh flap -- Flap' > $FINIT_RCSD/flap.conf"
+run "initctl reload"
+
+run "ip link set lo up"
+sleep 1
+assert "Service held back until link settled" "$(starts)" -eq 0
+retry 'assert_status flap running' 25 0.2
+
+say 'Flap the link, faster than the settle time'
+for _ in 1 2 3 4 5; do
+    run "ip link set lo down"
+    sleep 0.2
+    run "ip link set lo up"
+    sleep 0.2
+done
+
+say 'Wait for the link to settle ...'
+sleep 3
+assert_status flap running
+assert "Service not restarted by flapping link" "$(starts)" -eq 1
+
+say 'Link down for longer than the settle time'
+run "ip link set lo down"
+retry 'assert_status flap waiting' 25 0.2
@@ -0,0 +1,40 @@
+#!/bin/sh
+# An event subscriber that stops reading must not make Finit queue its
+# events without bound.  When API_MAX_EVENTS are queued new events are
+# dropped, and the number dropped is reported once the subscriber reads
+# again.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+OUT=/tmp/events.log
+GO=/tmp/events.go
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "touch $GO; pkill -f 'initctl events' || true"
+    run "rm -f $OUT $GO"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+names=$(seq -f flood%g 1 500 | tr '\n' ' ')
+
+say 'Start subscriber that does not read its events'
+run "rm -f $OUT $GO"
+texec sh -c "initctl events usr/flood | (while [ ! -f $GO ]; do sleep 0.1; done; cat) > $OUT" &
+sleep 1
+
+say 'Flood subscriber with condition events'
+for _ in $(seq 1 20); do
+    run "initctl cond set $names"
+    run "initctl cond clr $names"
+done
+assert "Finit responsive with stalled subscriber" "$(texec initctl -v cond get flood1)" = "off"
+
+say 'Subscriber reads again, next event reports the dropped ones'
+run "touch $GO"
+retry "texec sh -c 'initctl cond set flood1; initctl cond clr flood1; grep -q \"events dropped\" $OUT'" 50 0.2
+assert "Subscriber told about dropped events" "$(texec grep -c 'events dropped' $OUT)" -ge 1
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Verify template instances: a template with instances:N is enabled
+# as-is and creates instances 1..N, and restarting the template name
+# restarts every instance exactly once, in a rolling restart.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+NUM=4
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -f /tmp/worker*.cnt /tmp/worker*.env"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "initctl disable worker@ || true"
+    run "rm -f $FINIT_RCSD/available/worker@.conf /tmp/worker*.cnt /tmp/worker*.env"
+    run "initctl reload"
+}
+
+starts()
+{
+    texec sh -c "cat /tmp/worker$1.cnt 2>/dev/null | wc -l"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Add template with $NUM instances"
+run "echo 'service name:worker instances:$NUM :%i probe.sh worker%i -- Worker %i' > $FINIT_RCSD/available/worker@.conf"
+run "initctl enable worker@"
+run "initctl reload"
+
+for i in $(seq 1 $NUM); do
+    retry "assert_status worker:$i running" 25 0.2
+    assert "Instance $i started once" "$(starts "$i")" -eq 1
+done
+
+say 'Rolling restart of all instances'
+run "initctl restart worker"
+for i in $(seq 1 $NUM); do
+    retry "[ \"\$(starts $i)\" -eq 2 ]" 50 0.2
+    retry "assert_status worker:$i running" 25 0.2
+done
+
+sleep 1
+for i in $(seq 1 $NUM); do
+    assert "Instance $i restarted once" "$(starts "$i")" -eq 2
+done
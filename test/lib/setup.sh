@@ -296,7 +296,7 @@ trap teardown EXIT
 SYSROOT="${SYSROOT:-$(pwd)/${TEST_DIR}/sysroot}"
 export SYSROOT
 
-TEST_TIMEOUT=300
+TEST_TIMEOUT=${TEST_TIMEOUT:-300}
 
 # shellcheck source=/dev/null
 . "$SYSROOT/../test.env"
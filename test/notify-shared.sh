@@ -0,0 +1,51 @@
+#!/bin/sh
+# Verify readiness notification over the shared NOTIFY_SOCKET, set up
+# with 'notify shared' in finit.conf, the sender is identified by PID.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+# shellcheck disable=SC2034
+BOOTSTRAP="notify shared"
+
+test_setup()
+{
+    say "Test start $(date)"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "rm -f $FINIT_RCSD/serv.conf"
+}
+
+runlevel()
+{
+    texec initctl runlevel | awk '{print $2}'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+retry '[ "$(runlevel)" = 2 ]' 50 0.2
+
+say 'Add notify:systemd service'
+run "echo 'service log:stdout notify:systemd serv -n -- Shared notify' > $FINIT_RCSD/serv.conf"
+run "initctl reload"
+
+retry 'assert_status serv running' 50 0.2
+retry 'assert_cond service/serv/ready' 25 0.2
+
+pid=$(texec initctl -j status serv | jq -M .pid)
+assert "Service uses the shared socket" "$(texec sh -c "tr '\0' '\n' < /proc/$pid/environ | grep NOTIFY_SOCKET=")" = "NOTIFY_SOCKET=/run/finit/notify"
+
+say "Verify 'ready' is reasserted after restart ..."
+run "initctl restart serv"
+retry 'assert_pidiff serv '"$pid" 25 0.2
+retry 'assert_cond service/serv/ready' 25 0.2
+
+say "Verify 'ready' is deasserted on stop ..."
+run "initctl stop serv"
+retry 'assert_status serv stopped' 25 0.2
+assert_nocond service/serv/ready
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Verify that an OOM kill in the cgroup of a service is counted, asserts
+# oom/NAME, and that the restart is delayed by oom:delay.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_setup()
+{
+    say "Test start $(date)"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+if ! texec grep -qw memory /sys/fs/cgroup/system/cgroup.subtree_control; then
+    skip "No memory cgroup controller in test environment."
+fi
+
+say 'Add service that keeps allocating memory, limited to 8 MiB'
+run "echo 'service name:hog oom:delay:30 cgroup.system:mem.max:8388608,mem.swap.max:0 tail /dev/zero -- Memory hog' > $FINIT_CONF"
+run "initctl reload"
+
+retry 'assert_cond oom/hog' 50 0.2
+assert "OOM kill counted" "$(texec initctl -j status hog | jq -M .oom_kills)" -ge 1
+
+say 'Restart delayed by oom:delay'
+sleep 2
+assert_nopid hog
+assert_cond oom/hog
+
+run "initctl stop hog"
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Verify path activation: a task with path:exists:PATH is not started
+# until PATH is created, and a burst of events starts it only once.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -rf /tmp/spool /tmp/pathtask.cnt /tmp/pathtask.env"
+    run "mkdir -p /tmp/spool"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "rm -rf $FINIT_CONF /tmp/spool /tmp/pathtask.cnt /tmp/pathtask.env"
+}
+
+starts()
+{
+    texec sh -c 'cat /tmp/pathtask.cnt 2>/dev/null | wc -l'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say 'Add path activated task'
+run "echo 'task name:pathtask path:exists:/tmp/spool/go probe.sh pathtask exit -- Path' > $FINIT_CONF"
+run "initctl reload"
+
+sleep 1
+assert "Task not started before path exists" "$(starts)" -eq 0
+
+say 'Create path, task should run once'
+run "touch /tmp/spool/go; touch /tmp/spool/go; touch /tmp/spool/go"
+retry '[ "$(starts)" -eq 1 ]' 25 0.2
+retry 'assert_status pathtask done' 25 0.2
+
+sleep 1
+assert "Burst of events coalesced into one run" "$(starts)" -eq 1
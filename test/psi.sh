@@ -0,0 +1,45 @@
+#!/bin/sh
+# Verify that a PSI trigger from finit.conf is registered at bootstrap,
+# asserting its ok condition, and that services can depend on it.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+# shellcheck disable=SC2034
+BOOTSTRAP="psi memory 150/2000 hold:1"
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -f /tmp/best.cnt /tmp/best.env"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "rm -f $FINIT_RCSD/best.conf /tmp/best.cnt /tmp/best.env"
+}
+
+runlevel()
+{
+    texec initctl runlevel | awk '{print $2}'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+if ! texec test -w /proc/pressure/memory; then
+    skip "No PSI support in test environment."
+fi
+
+retry '[ "$(runlevel)" = 2 ]' 50 0.2
+
+say 'Trigger registered, no memory pressure'
+retry 'assert_cond psi/memory/ok' 10 0.2
+assert_nocond psi/memory/some
+
+say 'Add best-effort service depending on no pressure'
+run "echo 'service name:best <psi/memory/ok> probe.sh best -- Best effort' > $FINIT_RCSD/best.conf"
+run "initctl reload"
+retry 'assert_status best running' 25 0.2
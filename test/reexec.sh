@@ -0,0 +1,83 @@
+#!/bin/sh
+# Verify 'initctl reexec': Finit executes itself again and adopts the
+# running services, which must keep their PID and not be restarted.
+# Conditions are kept in the file system, and the output of a service
+# to the built-in logger must not be cut off.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+LOG=/tmp/chatty.log
+# shellcheck disable=SC2034
+BOOTSTRAP="log builtin"
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -f /tmp/keep.cnt /tmp/keep.env /tmp/chatty.cnt /tmp/chatty.env $LOG"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "initctl cond clr keep || true"
+    run "rm -f $FINIT_RCSD/keep.conf /tmp/keep.cnt /tmp/keep.env"
+    run "rm -f /tmp/chatty.cnt /tmp/chatty.env $LOG"
+}
+
+runlevel()
+{
+    texec initctl runlevel | awk '{print $2}'
+}
+
+starts()
+{
+    texec sh -c "cat /tmp/$1.cnt 2>/dev/null | wc -l"
+}
+
+lines()
+{
+    texec sh -c "cat $LOG 2>/dev/null | wc -l"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+retry '[ "$(runlevel)" = 2 ]' 50 0.2
+
+say 'Add services, one logging to the built-in logger'
+run "echo 'service name:keep probe.sh keep -- Keep' > $FINIT_RCSD/keep.conf"
+run "echo 'service name:chatty log:$LOG probe.sh chatty log -- Chatty' >> $FINIT_RCSD/keep.conf"
+run "initctl reload"
+retry 'assert_status keep running' 25 0.2
+retry 'assert_status chatty running' 25 0.2
+retry '[ "$(lines)" -gt 0 ]' 25 0.2
+run "initctl cond set keep"
+pid=$(texec initctl -j status keep | jq -M .pid)
+log=$(texec initctl -j status chatty | jq -M .pid)
+
+say 'Re-exec Finit, retry while busy'
+retry 'texec initctl reexec' 25 0.2
+sleep 1
+retry 'texec initctl status keep >/dev/null' 50 0.2
+
+say 'Verify services adopted, not restarted'
+assert_status keep running
+assert "Service kept PID $pid" "$(texec initctl -j status keep | jq -M .pid)" -eq "$pid"
+assert "Service not restarted" "$(starts keep)" -eq 1
+assert_cond usr/keep
+
+say 'Verify output of logging service is still read'
+num=$(lines)
+sleep 1
+assert_status chatty running
+assert "Logging service kept PID $log" "$(texec initctl -j status chatty | jq -M .pid)" -eq "$log"
+assert "Logging service not restarted" "$(starts chatty)" -eq 1
+assert "Output logged after re-exec" "$(lines)" -gt "$num"
+
+say 'Adopted services can be stopped'
+run "initctl stop keep"
+run "initctl stop chatty"
+retry 'assert_status keep stopped' 25 0.2
+retry 'assert_status chatty stopped' 25 0.2
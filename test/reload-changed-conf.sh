@@ -0,0 +1,55 @@
+#!/bin/sh
+# Verify that only services from a changed .conf are affected by reload
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Test done $(date)"
+
+    say "Running test teardown."
+    run "rm -f $FINIT_RCSD/foo.conf $FINIT_RCSD/bar.conf"
+}
+
+pidof_svc()
+{
+    texec initctl -j status "$1" | jq -M .pid
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Test start $(date)"
+
+say "Add two services in separate .conf files in $FINIT_RCSD"
+run "echo 'service [2345] name:foo kill:20 log service.sh -- Foo service' > $FINIT_RCSD/foo.conf"
+run "echo 'service [2345] name:bar kill:20 log service.sh -- Bar service' > $FINIT_RCSD/bar.conf"
+
+say 'Reload Finit'
+run "initctl reload"
+
+retry 'assert_num_children 2 service.sh'
+foo=$(pidof_svc foo)
+bar=$(pidof_svc bar)
+
+say "Change only $FINIT_RCSD/bar.conf"
+run "echo 'service [2345] name:bar kill:20 log service.sh -- Bar service, changed' > $FINIT_RCSD/bar.conf"
+
+say 'Reload Finit'
+run "initctl reload"
+
+retry 'assert_num_children 2 service.sh'
+retry 'assert_desc "Bar service, changed" bar'
+assert "foo not restarted (PID $foo)" "$(pidof_svc foo)" -eq "$foo"
+assert_pidiff bar "$bar"
+
+say "Remove $FINIT_RCSD/bar.conf"
+run "rm -f $FINIT_RCSD/bar.conf"
+
+say 'Reload Finit'
+run "initctl reload"
+
+retry 'assert_num_children 1 service.sh'
+assert "foo not restarted (PID $foo)" "$(pidof_svc foo)" -eq "$foo"
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Verify token bucket throttling of a respawning service, burst:2/6 is
+# two restarts at once, then one every three seconds.  Both the direct
+# and the delayed respawn must take a token.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -f /tmp/burst.cnt /tmp/burst.env"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF /tmp/burst.cnt /tmp/burst.env"
+}
+
+starts()
+{
+    texec sh -c 'cat /tmp/burst.cnt 2>/dev/null | wc -l'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say 'Add respawning service that exits immediately'
+run "echo 'service name:burst respawn burst:2/6 probe.sh burst exit -- Burst' > $FINIT_CONF"
+run "initctl reload"
+
+say 'Let it respawn for 10 sec ...'
+sleep 10
+run "initctl status burst"
+
+# First start, two tokens, then one token at 3, 6, and 9 sec
+num=$(starts)
+assert "Service throttled, $num starts in 10 sec" "$num" -le 6
+assert "Service respawned while throttled, $num starts" "$num" -ge 4
+
+run "initctl stop burst"
@@ -0,0 +1,113 @@
+#!/bin/sh
+# SIGCHLD storm: thousands of tasks and crashing services exit at once
+#
+# Measures reaped children per second, the worst-case delay from exit
+# of a child to service_monitor(), and initctl status latency during
+# the storm.  The delay is the longest fork-to-done latency of a task,
+# minus that of the same task on an idle system, i.e., the exec() cost.
+# Results are appended to $BENCH_OUTPUT, if set, see test/bench/.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+TASKS=${STORM_TASKS:-1000}
+CRASHERS=${STORM_CRASHERS:-50}
+
+test_teardown()
+{
+    say "Test done $(date)"
+
+    say "Running test teardown."
+    run "rm -f $FINIT_RCSD/storm.conf"
+    rm -f "${lat:-}"
+}
+
+# Current value of a metric, from initctl metrics
+metric()
+{
+    texec initctl metrics | awk -v m="$1" '$1 == m { print $2 }'
+}
+
+# Longest fork-to-done latency, in msec, of services matching $1
+ready_max()
+{
+    texec initctl metrics | awk -v re="^finit_service_ready_seconds.service=\"$1\"" '
+        $1 ~ re { if ($2 > max) max = $2 } END { printf "%d", max * 1000 }'
+}
+
+# Milliseconds, from an arbitrary starting point
+now()
+{
+    echo $(($(date +%s%N) / 1000000))
+}
+
+# Time initctl status in a loop until $1 exists, one line per call
+probe_api()
+{
+    while [ ! -f "$1" ]; do
+	start=$(now)
+	texec initctl status >/dev/null
+	echo $(($(now) - start)) >> "$2"
+    done
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+lat=$(mktemp)
+
+say "Test start $(date), $TASKS tasks and $CRASHERS crashing services"
+run "rm -f $FINIT_RCSD/storm.conf"
+run "echo 'task [2] name:idle <usr/idle> /bin/true -- Idle task' >> $FINIT_RCSD/storm.conf"
+i=1
+while [ $i -le "$TASKS" ]; do
+    echo "task [2] name:t$i <usr/storm> /bin/true -- Storm task $i"
+    i=$((i + 1))
+done | texec sh -c "cat >> $FINIT_RCSD/storm.conf"
+i=1
+while [ $i -le "$CRASHERS" ]; do
+    echo "service [2] name:c$i <usr/storm> serv -n -c -i c$i -- Crashing service $i"
+    i=$((i + 1))
+done | texec sh -c "cat >> $FINIT_RCSD/storm.conf"
+
+say 'Reload Finit'
+run "initctl reload"
+retry "[ \"\$(texec initctl status | grep -c 'Storm task')\" -eq $TASKS ]" 100 0.1 >/dev/null
+
+say 'Baseline, one task on an idle system'
+run "initctl cond set idle"
+retry 'assert_status idle done'
+base=$(ready_max idle)
+say "Fork to done on idle system: $base msec"
+
+say 'Start the storm'
+reaped=$(metric finit_reaped_total)
+probe_api "$lat.done" "$lat" &
+start=$(now)
+run "initctl cond set storm"
+
+# All tasks, and at least one round of crashes
+retry "[ \"\$(metric finit_reaped_total)\" -ge $((reaped + TASKS + CRASHERS)) ]" $((TASKS + 100)) 0.1 >/dev/null
+elapsed=$(($(now) - start))
+touch "$lat.done"
+wait $!
+rm -f "$lat.done"
+
+total=$(($(metric finit_reaped_total) - reaped))
+rate=$((total * 1000 / (elapsed > 0 ? elapsed : 1)))
+delay=$(($(ready_max 't[0-9]+') - base))
+[ "$delay" -lt 0 ] && delay=0
+api_max=$(sort -n "$lat" | tail -1)
+api_avg=$(awk '{ sum += $1 } END { printf "%d", NR ? sum / NR : 0 }' "$lat")
+
+say "Reaped $total children in $elapsed msec, $rate/sec"
+say "Worst-case exit to service_monitor() delay: $delay msec"
+say "initctl status during storm: avg $api_avg msec, max $api_max msec"
+
+assert "All tasks collected" "$(texec initctl status | grep 'Storm task' | grep -c done)" -eq "$TASKS"
+assert "Finit responsive during storm" "$api_max" -lt 5000
+
+if [ -n "${BENCH_OUTPUT:-}" ]; then
+    printf '{"storm_tasks":%d,"storm_crashers":%d,"reap_per_sec":%d,"reap_delay_max_msec":%d,"status_avg_msec":%d,"status_max_msec":%d}\n' \
+	   "$TASKS" "$CRASHERS" "$rate" "$delay" "$api_avg" "$api_max" >> "$BENCH_OUTPUT"
+fi
@@ -0,0 +1,13 @@
+#!/bin/sh
+# Leave a grandchild behind in the same cgroup, PID in /tmp/fork.pid,
+# then exit, with 'exit' as argument, or idle like a daemon until
+# stopped.
+
+sleep 86400 &
+echo $! > /tmp/fork.pid
+
+if [ "${1:-}" = "exit" ]; then
+    exit 0
+fi
+
+exec sleep 86400
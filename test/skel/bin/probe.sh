@@ -0,0 +1,21 @@
+#!/bin/sh
+# Test probe: count starts in /tmp/NAME.cnt and save the environment in
+# /tmp/NAME.env, then exit, with 'exit' as second argument, print a line
+# every 100 msec, with 'log', or idle like a daemon until stopped.
+
+echo $$ >> "/tmp/$1.cnt"
+env > "/tmp/$1.env"
+
+case "${2:-}" in
+    exit)
+	exit 0
+	;;
+    log)
+	while :; do
+	    echo "$1 $$ tick"
+	    sleep 0.1
+	done
+	;;
+esac
+
+exec sleep 86400
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Verify socket activation: a service with listen: is not started until
+# the first connection, inherits the socket, and is started again at the
+# next connection after it has crashed.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "ip link set lo up"
+    run "rm -f /tmp/act.cnt /tmp/act.env"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF /tmp/act.cnt /tmp/act.env"
+}
+
+connect()
+{
+    run "echo hello | nc -w 1 127.0.0.1 8099 || true"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say 'Add socket activated service'
+run "echo 'service name:act listen:tcp:127.0.0.1:8099 probe.sh act -- Socket activated' > $FINIT_CONF"
+run "initctl reload"
+
+sleep 1
+assert_nopid act
+assert "Service not started before first connection" "$(texec sh -c 'cat /tmp/act.cnt 2>/dev/null | wc -l')" -eq 0
+
+say 'Connect to socket, service should start'
+connect
+retry 'assert_status act running' 20 0.2
+assert_file_contains /tmp/act.env "LISTEN_FDS=1"
+assert_file_contains /tmp/act.env "LISTEN_PID=$(texec initctl -j status act | jq -M .pid)"
+
+say 'Crash service, it should wait for the next connection'
+run "initctl signal act 9"
+retry 'assert_nopid act' 20 0.2
+sleep 1
+assert "Service not restarted without connection" "$(texec sh -c 'wc -l < /tmp/act.cnt')" -eq 1
+
+connect
+retry 'assert_status act running' 20 0.2
+assert "Service started again at next connection" "$(texec sh -c 'wc -l < /tmp/act.cnt')" -eq 2
+
+say 'Stop service'
+run "initctl stop act"
+retry 'assert_status act stopped' 20 0.2
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Verify timer tasks: a task with every:TIME is not started when its
+# runlevel is entered, only by its timer, and again at every period.
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_setup()
+{
+    say "Test start $(date)"
+    run "rm -f /tmp/tick.cnt /tmp/tick.env"
+}
+
+test_teardown()
+{
+    say "Test done $(date)"
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF /tmp/tick.cnt /tmp/tick.env"
+}
+
+starts()
+{
+    texec sh -c 'cat /tmp/tick.cnt 2>/dev/null | wc -l'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say 'Add timer task'
+run "echo 'task name:tick every:2s probe.sh tick exit -- Tick' > $FINIT_CONF"
+run "initctl reload"
+
+sleep 1
+assert "Timer task not started with its runlevel" "$(starts)" -eq 0
+
+say 'Let the timer run for 5 sec ...'
+sleep 5
+run "initctl status tick"
+
+# Started at 2 and 4 sec, and 6 if the system is slow
+num=$(starts)
+assert "Timer task started by its timer, $num times" "$num" -ge 2
+assert "Timer task not started more often, $num times" "$num" -le 3
+assert_status tick done